@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace cuttlefish {
+
+constexpr std::size_t kCacheLineSize = 64;
+
+namespace ring_queue_internal {
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+// Where the consumer sleeps while the queue is empty, or the producers while
+// it is full. Waking costs a syscall only when a thread went to sleep since
+// the last wake up.
+class Sleepers {
+ public:
+  // Returns once ready() returned true, which it isn't called again after.
+  template <typename Ready>
+  void WaitFor(Ready&& ready) {
+    for (int i = 0; i < kSpins; i++) {
+      if (ready()) {
+        return;
+      }
+      CpuRelax();
+    }
+    while (true) {
+      auto generation = generation_.load(std::memory_order_acquire);
+      armed_.store(true, std::memory_order_release);
+      // Pairs with the fence in WakeAll(): either ready() sees the change, or
+      // WakeAll() sees this thread about to sleep.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) {
+        return;
+      }
+      // Returns right away if WakeAll() moved the generation on already
+      syscall(SYS_futex, &generation_, FUTEX_WAIT_PRIVATE, generation, nullptr,
+              nullptr, 0);
+      if (ready()) {
+        return;
+      }
+    }
+  }
+
+  void WakeAll() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Until the woken threads run and sleep again, there is nobody to wake
+    if (!armed_.load(std::memory_order_relaxed) ||
+        !armed_.exchange(false, std::memory_order_acquire)) {
+      return;
+    }
+    generation_.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &generation_, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+            nullptr, 0);
+  }
+
+ private:
+  static constexpr int kSpins = 64;
+  static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+
+  alignas(kCacheLineSize) std::atomic<std::uint32_t> generation_{0};
+  std::atomic<bool> armed_{false};
+};
+
+}  // namespace ring_queue_internal
+
+enum class RingQueueProducers { kOne, kMany };
+
+/*
+ * Bounded lock-free queue for one consumer thread and one or many producer
+ * threads, over a ring of slots allocated up front. The capacity is rounded
+ * up to a power of two.
+ *
+ * The Try* methods never block. Push() blocks while the queue is full, and
+ * Pop() and PopAll() while it is empty; they spin shortly, then sleep on a
+ * futex. Pushing and popping make no syscall unless the other side sleeps.
+ *
+ * It can replace ThreadSafeQueue and be a Multiplexer queue, with a few
+ * differences:
+ *  - Push() blocks instead of calling a handler when the queue is full. Use
+ *    TryPush() to drop items instead.
+ *  - PopAll() hands each item to a callback where it sits in the ring rather
+ *    than moving them all into a new container.
+ *  - Only one thread may call the Pop methods at a time.
+ */
+template <typename T, RingQueueProducers kProducers>
+class RingQueue {
+ public:
+  explicit RingQueue(std::size_t capacity)
+      : mask_(RoundUpToPowerOfTwo(capacity) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    for (std::size_t i = 0; i <= mask_; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+
+  ~RingQueue() {
+    TryPopAll([](T&&) {});
+  }
+
+  // Returns false without touching u if the queue is full
+  template <typename U>
+  bool TryPush(U&& u) {
+    static_assert(std::is_constructible_v<T, decltype(u)>);
+    Slot* slot = Claim();
+    if (!slot) {
+      return false;
+    }
+    new (slot->storage) T(std::forward<U>(u));
+    Publish(slot);
+    not_empty_.WakeAll();
+    return true;
+  }
+
+  // Waits for room in the queue. Always returns true, like ThreadSafeQueue.
+  template <typename U>
+  bool Push(U&& u) {
+    if (!TryPush(std::forward<U>(u))) {
+      not_full_.WaitFor([this, &u]() { return TryPush(std::forward<U>(u)); });
+    }
+    return true;
+  }
+
+  std::optional<T> TryPop() {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (!Ready(head)) {
+      return std::nullopt;
+    }
+    Slot& slot = slots_[head & mask_];
+    std::optional<T> item(std::move(*slot.Item()));
+    Release(slot, head);
+    head_.store(head + 1, std::memory_order_release);
+    not_full_.WakeAll();
+    return item;
+  }
+
+  T Pop() {
+    std::optional<T> item = TryPop();
+    if (!item) {
+      not_empty_.WaitFor([this, &item]() {
+        item = TryPop();
+        return item.has_value();
+      });
+    }
+    return std::move(*item);
+  }
+
+  /*
+   * Calls consume(T&&) on each item in the queue, in place, and returns how
+   * many there were. The slots are handed back to the producers at the end.
+   */
+  template <typename Consume>
+  std::size_t TryPopAll(Consume&& consume) {
+    auto head = head_.load(std::memory_order_relaxed);
+    std::size_t count = 0;
+    for (; Ready(head); head++, count++) {
+      Slot& slot = slots_[head & mask_];
+      consume(std::move(*slot.Item()));
+      Release(slot, head);
+    }
+    if (count > 0) {
+      head_.store(head, std::memory_order_release);
+      not_full_.WakeAll();
+    }
+    return count;
+  }
+
+  // Like TryPopAll(), after waiting for at least one item
+  template <typename Consume>
+  std::size_t PopAll(Consume&& consume) {
+    std::size_t count = TryPopAll(consume);
+    if (count == 0) {
+      not_empty_.WaitFor([this, &count, &consume]() {
+        count = TryPopAll(consume);
+        return count > 0;
+      });
+    }
+    return count;
+  }
+
+  // Items being pushed by a producer at the same time count as queued
+  std::size_t Size() const {
+    auto head = head_.load(std::memory_order_acquire);
+    auto tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+  bool IsEmpty() const { return Size() == 0; }
+  bool IsFull() const { return Size() > mask_; }
+  std::size_t Capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    // Only used with many producers: the position the slot is free for, or
+    // one after the position of the item in it
+    std::atomic<std::size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* Item() { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  static std::size_t RoundUpToPowerOfTwo(std::size_t n) {
+    std::size_t power = 1;
+    while (power < n) {
+      power <<= 1;
+    }
+    return power;
+  }
+
+  // Reserves the slot at the tail, or returns nullptr if the queue is full
+  Slot* Claim() {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if constexpr (kProducers == RingQueueProducers::kOne) {
+      if (tail - cached_head_ > mask_) {
+        cached_head_ = head_.load(std::memory_order_acquire);
+        if (tail - cached_head_ > mask_) {
+          return nullptr;
+        }
+      }
+      return &slots_[tail & mask_];
+    } else {
+      while (true) {
+        Slot* slot = &slots_[tail & mask_];
+        auto sequence = slot->sequence.load(std::memory_order_acquire);
+        auto lag = static_cast<std::intptr_t>(sequence - tail);
+        if (lag == 0) {
+          if (tail_.compare_exchange_weak(tail, tail + 1,
+                                          std::memory_order_relaxed)) {
+            return slot;
+          }
+        } else if (lag < 0) {
+          // The consumer hasn't freed the slot from the previous lap
+          return nullptr;
+        } else {
+          tail = tail_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+  void Publish(Slot* slot) {
+    if constexpr (kProducers == RingQueueProducers::kOne) {
+      tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+    } else {
+      auto position = slot->sequence.load(std::memory_order_relaxed);
+      slot->sequence.store(position + 1, std::memory_order_release);
+    }
+  }
+
+  // Whether the item at head was published
+  bool Ready(std::size_t head) {
+    if constexpr (kProducers == RingQueueProducers::kOne) {
+      if (head != cached_tail_) {
+        return true;
+      }
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      return head != cached_tail_;
+    } else {
+      auto sequence =
+          slots_[head & mask_].sequence.load(std::memory_order_acquire);
+      return sequence == head + 1;
+    }
+  }
+
+  void Release(Slot& slot, std::size_t head) {
+    slot.Item()->~T();
+    if constexpr (kProducers == RingQueueProducers::kMany) {
+      slot.sequence.store(head + mask_ + 1, std::memory_order_release);
+    }
+  }
+
+  const std::size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+
+  // Each side writes to its own cache lines
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  std::size_t cached_tail_ = 0;
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
+  std::size_t cached_head_ = 0;
+  ring_queue_internal::Sleepers not_empty_;
+  ring_queue_internal::Sleepers not_full_;
+};
+
+template <typename T>
+using SpscRingQueue = RingQueue<T, RingQueueProducers::kOne>;
+template <typename T>
+using MpscRingQueue = RingQueue<T, RingQueueProducers::kMany>;
+
+}  // namespace cuttlefish
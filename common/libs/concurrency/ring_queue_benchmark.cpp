@@ -0,0 +1,138 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how many items per second go from the producer threads to the one
+// consumer thread through ThreadSafeQueue and the ring queues, with the queue
+// bounded to kCapacity items so full queues make the producers wait.
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/libs/concurrency/ring_queue.h"
+#include "common/libs/concurrency/thread_safe_queue.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kCapacity = 256;
+constexpr int kItemsPerRun = 1 << 16;
+
+// ThreadSafeQueue::Push() only takes class types
+struct Item {
+  std::uint64_t value;
+};
+
+// ThreadSafeQueue has no way to make Push() wait for room, so the producers
+// retry until it takes the item
+class BoundedThreadSafeQueue {
+ public:
+  BoundedThreadSafeQueue()
+      : queue_(kCapacity,
+               [this](std::deque<Item>*) { full_ = true; }) {}
+
+  void Push(Item item) {
+    while (true) {
+      full_ = false;
+      queue_.Push(item);
+      if (!full_) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+  Item Pop() { return queue_.Pop(); }
+  template <typename Consume>
+  void PopAll(Consume&& consume) {
+    for (auto item : queue_.PopAll()) {
+      consume(std::move(item));
+    }
+  }
+
+ private:
+  ThreadSafeQueue<Item> queue_;
+  // Only touched under the queue's mutex
+  bool full_ = false;
+};
+
+template <typename Queue>
+Queue* NewQueue() {
+  if constexpr (std::is_same_v<Queue, BoundedThreadSafeQueue>) {
+    return new Queue();
+  } else {
+    return new Queue(kCapacity);
+  }
+}
+
+// range(0) is the number of producers, range(1) whether to consume with
+// PopAll() rather than Pop()
+template <typename Queue>
+void BM_Throughput(benchmark::State& state) {
+  const int producers = state.range(0);
+  const bool pop_all = state.range(1);
+  const int items_per_producer = kItemsPerRun / producers;
+  for (auto _ : state) {
+    std::unique_ptr<Queue> queue(NewQueue<Queue>());
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; i++) {
+      threads.emplace_back([&queue, items_per_producer]() {
+        for (int item = 0; item < items_per_producer; item++) {
+          queue->Push(Item{static_cast<std::uint64_t>(item)});
+        }
+      });
+    }
+    std::uint64_t sum = 0;
+    for (int popped = 0; popped < items_per_producer * producers;) {
+      if (pop_all) {
+        queue->PopAll([&sum, &popped](Item&& item) {
+          sum += item.value;
+          popped++;
+        });
+      } else {
+        sum += queue->Pop().value;
+        popped++;
+      }
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * items_per_producer * producers);
+}
+
+BENCHMARK_TEMPLATE(BM_Throughput, BoundedThreadSafeQueue)
+    ->ArgNames({"producers", "pop_all"})
+    ->ArgsProduct({{1, 2, 4, 8}, {0, 1}})
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Throughput, SpscRingQueue<Item>)
+    ->ArgNames({"producers", "pop_all"})
+    ->ArgsProduct({{1}, {0, 1}})
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Throughput, MpscRingQueue<Item>)
+    ->ArgNames({"producers", "pop_all"})
+    ->ArgsProduct({{1, 2, 4, 8}, {0, 1}})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
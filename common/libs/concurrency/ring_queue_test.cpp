@@ -0,0 +1,149 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/concurrency/multiplexer.h"
+#include "common/libs/concurrency/ring_queue.h"
+
+namespace cuttlefish {
+
+template <typename Queue>
+class RingQueueTest : public ::testing::Test {};
+
+using RingQueueTypes =
+    ::testing::Types<SpscRingQueue<std::unique_ptr<int>>,
+                     MpscRingQueue<std::unique_ptr<int>>>;
+TYPED_TEST_SUITE(RingQueueTest, RingQueueTypes);
+
+TYPED_TEST(RingQueueTest, KeepsOrderUpToCapacity) {
+  TypeParam queue(3);
+  ASSERT_EQ(queue.Capacity(), 4);
+  ASSERT_TRUE(queue.IsEmpty());
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.TryPush(std::make_unique<int>(i)));
+  }
+  ASSERT_TRUE(queue.IsFull());
+  auto rejected = std::make_unique<int>(4);
+  ASSERT_FALSE(queue.TryPush(std::move(rejected)));
+  // a failed push leaves the item with the caller
+  ASSERT_NE(rejected, nullptr);
+
+  for (int i = 0; i < 4; i++) {
+    auto item = queue.TryPop();
+    ASSERT_TRUE(item.has_value());
+    ASSERT_EQ(**item, i);
+  }
+  ASSERT_FALSE(queue.TryPop().has_value());
+  ASSERT_TRUE(queue.IsEmpty());
+}
+
+TYPED_TEST(RingQueueTest, PopAllHandsOverEveryItem) {
+  TypeParam queue(8);
+  // wraps around the ring a few times
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 5; i++) {
+      ASSERT_TRUE(queue.TryPush(std::make_unique<int>(i)));
+    }
+    std::vector<int> popped;
+    auto count = queue.PopAll([&popped](std::unique_ptr<int>&& item) {
+      popped.push_back(*item);
+    });
+    ASSERT_EQ(count, 5);
+    ASSERT_EQ(popped, std::vector<int>({0, 1, 2, 3, 4}));
+    ASSERT_EQ(queue.TryPopAll([](std::unique_ptr<int>&&) {}), 0);
+  }
+}
+
+TYPED_TEST(RingQueueTest, DestroysItemsLeftBehind) {
+  auto item = std::make_shared<int>(0);
+  {
+    using Item = std::shared_ptr<int>;
+    typename std::conditional_t<
+        std::is_same_v<TypeParam, SpscRingQueue<std::unique_ptr<int>>>,
+        SpscRingQueue<Item>, MpscRingQueue<Item>>
+        queue(4);
+    queue.Push(item);
+    queue.Push(item);
+    ASSERT_EQ(item.use_count(), 3);
+  }
+  ASSERT_EQ(item.use_count(), 1);
+}
+
+TYPED_TEST(RingQueueTest, PushWaitsForRoom) {
+  TypeParam queue(2);
+  constexpr int kItems = 1000;
+  std::thread producer([&queue]() {
+    for (int i = 0; i < kItems; i++) {
+      queue.Push(std::make_unique<int>(i));
+    }
+  });
+  for (int i = 0; i < kItems; i++) {
+    ASSERT_EQ(*queue.Pop(), i);
+  }
+  producer.join();
+  ASSERT_TRUE(queue.IsEmpty());
+}
+
+TEST(MpscRingQueueTest, ManyProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kItemsPerProducer = 10000;
+  MpscRingQueue<std::pair<int, int>> queue(16);
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kProducers; producer++) {
+    producers.emplace_back([&queue, producer]() {
+      for (int i = 0; i < kItemsPerProducer; i++) {
+        queue.Push(std::make_pair(producer, i));
+      }
+    });
+  }
+
+  // each producer's items come out in the order it pushed them
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  while (popped < kProducers * kItemsPerProducer) {
+    popped += queue.PopAll([&next](std::pair<int, int>&& item) {
+      ASSERT_EQ(item.second, next[item.first]);
+      next[item.first]++;
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ASSERT_EQ(next, std::vector<int>(kProducers, kItemsPerProducer));
+  ASSERT_TRUE(queue.IsEmpty());
+}
+
+TEST(MpscRingQueueTest, WorksWithMultiplexer) {
+  using Queue = MpscRingQueue<int>;
+  Multiplexer<int, Queue> multiplexer;
+  auto first = multiplexer.RegisterQueue(multiplexer.CreateQueue(4));
+  auto second = multiplexer.RegisterQueue(multiplexer.CreateQueue(4));
+  multiplexer.Push(second, 2);
+  multiplexer.Push(first, 1);
+  ASSERT_EQ(multiplexer.Pop(), 1);
+  ASSERT_EQ(multiplexer.Pop(), 2);
+  ASSERT_TRUE(multiplexer.IsEmpty(first));
+  ASSERT_TRUE(multiplexer.IsEmpty(second));
+}
+
+}  // namespace cuttlefish
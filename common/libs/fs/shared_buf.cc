@@ -47,6 +47,37 @@ ssize_t WriteAll(SharedFD fd, const char* buf, size_t size) {
   return total_written;
 }
 
+ssize_t WriteAll(SharedFD fd, struct iovec* iov, int iovcnt) {
+  size_t total_written = 0;
+  while (iovcnt > 0) {
+    if (iov->iov_len == 0) {
+      iov++;
+      iovcnt--;
+      continue;
+    }
+    ssize_t written = fd->Writev(iov, iovcnt);
+    if (written <= 0) {
+      if (written < 0) {
+        errno = fd->GetErrno();
+        return written;
+      }
+      return total_written;
+    }
+    total_written += written;
+    size_t remaining = written;
+    while (iovcnt > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (remaining > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+  return total_written;
+}
+
 ssize_t ReadExact(SharedFD fd, char* buf, size_t size) {
   size_t total_read = 0;
   ssize_t read = 0;
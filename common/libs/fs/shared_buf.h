@@ -140,6 +140,20 @@ ssize_t WriteAll(SharedFD fd, const std::vector<char>& buf);
  */
 ssize_t WriteAll(SharedFD fd, const char* buf, size_t size);
 
+/**
+ * Writes to fd until all the bytes of the `iovcnt` buffers in `iov` are
+ * written, gathering them with as few writes as possible.
+ *
+ * On a successful write, returns the total size of the buffers.
+ *
+ * If a write error is encountered, returns -1. Some data may have already been
+ * written to fd at that point.
+ *
+ * The entries of `iov` are advanced past what was written and can't be
+ * reused afterwards.
+ */
+ssize_t WriteAll(SharedFD fd, struct iovec* iov, int iovcnt);
+
 /**
  * Writes to fd until `sizeof(T)` bytes are written from binary_data.
  *
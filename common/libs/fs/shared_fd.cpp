@@ -737,6 +737,20 @@ int FileInstance::Fcntl(int command, int value) {
   return rval;
 }
 
+int FileInstance::Fstat(struct stat* buf) {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(fstat(fd_, buf));
+  errno_ = errno;
+  return rval;
+}
+
+int FileInstance::Fsync() {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(fsync(fd_));
+  errno_ = errno;
+  return rval;
+}
+
 Result<void> FileInstance::Flock(int operation) {
   errno = 0;
   int rval = TEMP_FAILURE_RETRY(flock(fd_, operation));
@@ -813,6 +827,13 @@ ssize_t FileInstance::Read(void* buf, size_t count) {
   return rval;
 }
 
+ssize_t FileInstance::Readv(const struct iovec* iov, int iovcnt) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(readv(fd_, iov, iovcnt));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::EventfdRead(eventfd_t* value) {
   errno = 0;
   auto rval = eventfd_read(fd_, value);
@@ -901,6 +922,13 @@ ssize_t FileInstance::Write(const void* buf, size_t count) {
   return rval;
 }
 
+ssize_t FileInstance::Writev(const struct iovec* iov, int iovcnt) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(writev(fd_, iov, iovcnt));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::EventfdWrite(eventfd_t value) {
   errno = 0;
   int rval = eventfd_write(fd_, value);
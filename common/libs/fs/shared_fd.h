@@ -275,6 +275,8 @@ class FileInstance {
   int UNMANAGED_Dup2(int newfd);
   int Fchdir();
   int Fcntl(int command, int value);
+  int Fstat(struct stat* buf);
+  int Fsync();
 
   Result<void> Flock(int operation);
 
@@ -308,6 +310,7 @@ class FileInstance {
   ssize_t Recv(void* buf, size_t len, int flags);
   ssize_t RecvMsg(struct msghdr* msg, int flags);
   ssize_t Read(void* buf, size_t count);
+  ssize_t Readv(const struct iovec* iov, int iovcnt);
   int EventfdRead(eventfd_t* value);
   ssize_t Send(const void* buf, size_t len, int flags);
   ssize_t SendMsg(const struct msghdr* msg, int flags);
@@ -339,6 +342,7 @@ class FileInstance {
    *
    */
   ssize_t Write(const void* buf, size_t count);
+  ssize_t Writev(const struct iovec* iov, int iovcnt);
   int EventfdWrite(eventfd_t value);
   bool IsATTY();
 
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/security/buffered_reader.h"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace cuttlefish {
+
+BufferedReader::BufferedReader(SharedFD fd) : fd_(std::move(fd)) {}
+
+ssize_t BufferedReader::ReadExact(void* buf, std::size_t size) {
+  auto out = static_cast<char*>(buf);
+  std::size_t total_read = std::min(size, end_ - begin_);
+  std::memcpy(out, buffer_.data() + begin_, total_read);
+  begin_ += total_read;
+  while (total_read < size) {
+    // The buffer is empty here. Anything past the requested bytes lands in it.
+    struct iovec iov[2] = {
+        {.iov_base = out + total_read, .iov_len = size - total_read},
+        {.iov_base = buffer_.data(), .iov_len = buffer_.size()},
+    };
+    auto read = fd_->Readv(iov, 2);
+    if (read <= 0) {
+      if (read < 0) {
+        errno = fd_->GetErrno();
+        return read;
+      }
+      return total_read;
+    }
+    auto wanted = std::min<std::size_t>(read, size - total_read);
+    total_read += wanted;
+    begin_ = 0;
+    end_ = read - wanted;
+  }
+  return total_read;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+/*
+ * Reads channel messages from a file descriptor it is the only reader of.
+ *
+ * Every read also fills an internal buffer with whatever else is available,
+ * so the header and the payload of a small message, and often the messages
+ * after it, come in with a single syscall.
+ */
+class BufferedReader {
+ public:
+  static constexpr std::size_t kBufferSize = 4096;
+
+  explicit BufferedReader(SharedFD fd);
+
+  /*
+   * Same as ReadExact in shared_buf.h: returns `size` on success, -1 on a
+   * read error and the number of bytes read when the end of the file comes
+   * first.
+   */
+  ssize_t ReadExact(void* buf, std::size_t size);
+
+  template <typename T>
+  ssize_t ReadExactBinary(T* binary_data) {
+    return ReadExact(binary_data, sizeof(*binary_data));
+  }
+
+ private:
+  SharedFD fd_;
+  std::array<char, kBufferSize> buffer_;
+  std::size_t begin_ = 0;
+  std::size_t end_ = 0;
+};
+
+}  // namespace cuttlefish
@@ -18,14 +18,17 @@
 
 #include "keymaster/android_keymaster_utils.h"
 
+#include "common/libs/security/message_pool.h"
+
 namespace cuttlefish {
 namespace secure_env {
 
 void MessageDestroyer::operator()(RawMessage* ptr) {
+  auto size = sizeof(RawMessage) + ptr->payload_size;
   {
-    keymaster::Eraser(ptr, sizeof(RawMessage) + ptr->payload_size);
+    keymaster::Eraser(ptr, size);
   }
-  std::free(ptr);
+  MessagePool::Release(ptr, size);
 }
 
 }  // namespace secure_env
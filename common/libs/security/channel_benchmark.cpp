@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures request/response round trips over a SharedFdChannel, with an
+// echo thread standing in for secure_env.
+
+#include <string>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/channel_sharedfd.h"
+
+namespace cuttlefish {
+namespace secure_env {
+namespace {
+
+constexpr uint32_t kStopCommand = 0;
+constexpr uint32_t kEchoCommand = 1;
+
+void BM_RoundTrip(benchmark::State& state) {
+  SharedFD request_read, request_write, response_read, response_write;
+  CHECK(SharedFD::Pipe(&request_read, &request_write));
+  CHECK(SharedFD::Pipe(&response_read, &response_write));
+  SharedFdChannel client(response_read, request_write);
+
+  std::thread server([request_read, response_write]() {
+    SharedFdChannel channel(request_read, response_write);
+    while (true) {
+      auto request = channel.ReceiveMessage();
+      CHECK(request.ok()) << request.error().Message();
+      if ((*request)->command == kStopCommand) {
+        return;
+      }
+      auto sent = channel.SendResponse((*request)->command,
+                                       (*request)->payload,
+                                       (*request)->payload_size);
+      CHECK(sent.ok()) << sent.error().Message();
+    }
+  });
+
+  std::string payload(state.range(0), 'x');
+  for (auto _ : state) {
+    auto sent = client.SendRequest(kEchoCommand, payload.data(), payload.size());
+    CHECK(sent.ok()) << sent.error().Message();
+    auto response = client.ReceiveMessage();
+    CHECK(response.ok()) << response.error().Message();
+    benchmark::DoNotOptimize((*response)->payload);
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size() * 2);
+
+  CHECK(client.SendRequest(kStopCommand, nullptr, 0).ok());
+  server.join();
+}
+BENCHMARK(BM_RoundTrip)->RangeMultiplier(4)->Range(64, 16 * 1024);
+
+}  // namespace
+}  // namespace secure_env
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
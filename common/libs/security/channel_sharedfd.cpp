@@ -16,7 +16,10 @@
 
 #include "common/libs/security/channel_sharedfd.h"
 
+#include <sys/uio.h>
+
 #include "common/libs/fs/shared_buf.h"
+#include "common/libs/security/message_pool.h"
 
 namespace cuttlefish {
 namespace secure_env {
@@ -28,7 +31,7 @@ namespace {
  */
 Result<ManagedMessage> CreateMessage(uint32_t command, bool is_response, size_t payload_size) {
   const auto bytes_to_allocate = sizeof(RawMessage) + payload_size;
-  auto memory = std::malloc(bytes_to_allocate);
+  auto memory = MessagePool::Allocate(bytes_to_allocate);
   CF_EXPECT(memory != nullptr,
             "Cannot allocate " << bytes_to_allocate << " bytes for secure_env RPC message");
   auto message = reinterpret_cast<RawMessage*>(memory);
@@ -41,7 +44,7 @@ Result<ManagedMessage> CreateMessage(uint32_t command, bool is_response, size_t
 }
 
 SharedFdChannel::SharedFdChannel(SharedFD input, SharedFD output)
-    : input_(std::move(input)), output_(std::move(output)) {}
+    : input_(input), output_(std::move(output)), reader_(std::move(input)) {}
 
 Result<void> SharedFdChannel::SendRequest(uint32_t command, void* message, size_t message_size) {
   return SendMessage(command, false, message, message_size);
@@ -53,7 +56,7 @@ Result<void> SharedFdChannel::SendResponse(uint32_t command, void* message, size
 
 Result<ManagedMessage> SharedFdChannel::ReceiveMessage() {
   struct RawMessage message_header;
-  auto read = ReadExactBinary(input_, &message_header);
+  auto read = reader_.ReadExactBinary(&message_header);
   CF_EXPECT(read == sizeof(RawMessage),
             "Expected " << sizeof(RawMessage) << ", received " << read << "\n" <<
             "Could not read message: " << input_->StrError());
@@ -62,7 +65,7 @@ Result<ManagedMessage> SharedFdChannel::ReceiveMessage() {
   auto message = CF_EXPECT(CreateMessage(message_header.command, message_header.is_response,
                                          message_header.payload_size));
   auto message_bytes = reinterpret_cast<char*>(message->payload);
-  read = ReadExact(input_, message_bytes, message->payload_size);
+  read = reader_.ReadExact(message_bytes, message->payload_size);
   CF_EXPECT(read == message->payload_size,
             "Could not read message: " << input_->StrError());
 
@@ -71,11 +74,15 @@ Result<ManagedMessage> SharedFdChannel::ReceiveMessage() {
 
 Result<void> SharedFdChannel::SendMessage(uint32_t command, bool response,
                                           void* message, size_t message_size) {
-  auto to_send = CF_EXPECT(CreateMessage(command, response, message_size));
-  memcpy(to_send->payload, message, message_size);
-  auto write_size = sizeof(RawMessage) + message_size;
-  auto to_send_bytes = reinterpret_cast<const char*>(to_send.get());
-  auto written = WriteAll(output_, to_send_bytes, write_size);
+  RawMessage header;
+  header.command = command;
+  header.is_response = response;
+  header.payload_size = message_size;
+  struct iovec iov[2] = {
+      {.iov_base = &header, .iov_len = sizeof(header)},
+      {.iov_base = message, .iov_len = message_size},
+  };
+  auto written = WriteAll(output_, iov, 2);
   CF_EXPECT(written != -1,
             "Could not write message: " << output_->StrError());
   return {};
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/buffered_reader.h"
 #include "common/libs/security/channel.h"
 
 namespace cuttlefish {
@@ -32,6 +33,7 @@ class SharedFdChannel : public Channel {
  private:
   SharedFD input_;
   SharedFD output_;
+  BufferedReader reader_;
 
   Result<void> SendMessage(uint32_t command, bool response, void* message, size_t message_size);
 };
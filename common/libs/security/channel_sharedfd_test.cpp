@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/channel_sharedfd.h"
+#include "common/libs/security/message_pool.h"
+#include "gtest/gtest.h"
+
+namespace cuttlefish {
+namespace secure_env {
+
+std::string Payload(const ManagedMessage& message) {
+  return std::string(reinterpret_cast<const char*>(message->payload),
+                     message->payload_size);
+}
+
+TEST(SharedFdChannel, ReceivesMessagesSentBackToBack) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+  SharedFdChannel channel{read_fd, write_fd};
+
+  std::string first = "first";
+  std::string empty;
+  std::string last = "last";
+  ASSERT_TRUE(channel.SendRequest(1, first.data(), first.size()).ok());
+  ASSERT_TRUE(channel.SendResponse(2, empty.data(), empty.size()).ok());
+  ASSERT_TRUE(channel.SendRequest(3, last.data(), last.size()).ok());
+
+  auto message = channel.ReceiveMessage();
+  ASSERT_TRUE(message.ok()) << message.error().Trace();
+  EXPECT_EQ((*message)->command, 1u);
+  EXPECT_FALSE((*message)->is_response);
+  EXPECT_EQ(Payload(*message), first);
+
+  message = channel.ReceiveMessage();
+  ASSERT_TRUE(message.ok()) << message.error().Trace();
+  EXPECT_EQ((*message)->command, 2u);
+  EXPECT_TRUE((*message)->is_response);
+  EXPECT_EQ(Payload(*message), empty);
+
+  message = channel.ReceiveMessage();
+  ASSERT_TRUE(message.ok()) << message.error().Trace();
+  EXPECT_EQ((*message)->command, 3u);
+  EXPECT_EQ(Payload(*message), last);
+}
+
+TEST(SharedFdChannel, ReceivesMessagesLargerThanThePipe) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+  SharedFdChannel channel{read_fd, write_fd};
+
+  std::string payload;
+  for (int i = 0; payload.size() < MessagePool::kMaxPooledSize * 4; i++) {
+    payload += std::to_string(i);
+  }
+  std::thread sender([&channel, &payload, write_fd]() {
+    for (uint32_t i = 0; i < 3; i++) {
+      EXPECT_TRUE(channel.SendRequest(i, payload.data(), payload.size()).ok());
+    }
+    write_fd->Close();
+  });
+  // No ASSERTs until the sender is joined
+  for (uint32_t i = 0; i < 3; i++) {
+    auto message = channel.ReceiveMessage();
+    EXPECT_TRUE(message.ok()) << message.error().Trace();
+    if (!message.ok()) {
+      // Lets the sender finish writing
+      char discard[4096];
+      while (read_fd->Read(discard, sizeof(discard)) > 0) {
+      }
+      break;
+    }
+    EXPECT_EQ((*message)->command, i);
+    EXPECT_EQ(Payload(*message), payload);
+  }
+  sender.join();
+}
+
+TEST(SharedFdChannel, FailsOnTruncatedMessage) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+  SharedFdChannel channel{read_fd, write_fd};
+
+  RawMessage header = {.command = 1, .is_response = false, .payload_size = 10};
+  ASSERT_EQ(write_fd->Write(&header, sizeof(header)), (ssize_t)sizeof(header));
+  ASSERT_EQ(write_fd->Write("abc", 3), 3);
+  write_fd->Close();
+
+  EXPECT_FALSE(channel.ReceiveMessage().ok());
+}
+
+TEST(MessagePool, ReusesReleasedMemory) {
+  auto first = MessagePool::Allocate(100);
+  ASSERT_NE(first, nullptr);
+  MessagePool::Release(first, 100);
+  // Same size class
+  auto second = MessagePool::Allocate(120);
+  EXPECT_EQ(second, first);
+  MessagePool::Release(second, 120);
+
+  auto large = MessagePool::Allocate(MessagePool::kMaxPooledSize + 1);
+  ASSERT_NE(large, nullptr);
+  MessagePool::Release(large, MessagePool::kMaxPooledSize + 1);
+}
+
+}  // namespace secure_env
+}  // namespace cuttlefish
@@ -18,19 +18,23 @@
 
 #include <keymaster/android_keymaster_utils.h>
 
+#include "common/libs/security/message_pool.h"
+
 namespace cuttlefish {
 
 void GatekeeperCommandDestroyer::operator()(GatekeeperRawMessage* ptr) {
+  auto size = sizeof(GatekeeperRawMessage) + ptr->payload_size;
   {
-    keymaster::Eraser(ptr, sizeof(GatekeeperRawMessage) + ptr->payload_size);
+    keymaster::Eraser(ptr, size);
   }
-  std::free(ptr);
+  MessagePool::Release(ptr, size);
 }
 
 ManagedGatekeeperMessage CreateGatekeeperMessage(uint32_t command,
                                                  bool is_response,
                                                  size_t payload_size) {
-  auto memory = std::malloc(payload_size + sizeof(GatekeeperRawMessage));
+  auto memory =
+      MessagePool::Allocate(payload_size + sizeof(GatekeeperRawMessage));
   auto message = reinterpret_cast<GatekeeperRawMessage*>(memory);
   message->cmd = command;
   message->is_response = is_response;
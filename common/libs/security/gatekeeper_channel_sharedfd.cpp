@@ -28,7 +28,7 @@ using gatekeeper::GatekeeperRawMessage;
 
 SharedFdGatekeeperChannel::SharedFdGatekeeperChannel(SharedFD input,
                                                      SharedFD output)
-    : input_(input), output_(output) {}
+    : input_(input), output_(output), reader_(input) {}
 
 bool SharedFdGatekeeperChannel::SendRequest(
     uint32_t command, const gatekeeper::GateKeeperMessage& message) {
@@ -58,7 +58,7 @@ bool SharedFdGatekeeperChannel::SendMessage(
 
 ManagedGatekeeperMessage SharedFdGatekeeperChannel::ReceiveMessage() {
   struct GatekeeperRawMessage message_header;
-  auto read = ReadExactBinary(input_, &message_header);
+  auto read = reader_.ReadExactBinary(&message_header);
   if (read != sizeof(GatekeeperRawMessage)) {
     LOG(ERROR) << "Expected " << sizeof(GatekeeperRawMessage) << ", received "
                << read;
@@ -70,7 +70,7 @@ ManagedGatekeeperMessage SharedFdGatekeeperChannel::ReceiveMessage() {
       CreateGatekeeperMessage(message_header.cmd, message_header.is_response,
                               message_header.payload_size);
   auto message_bytes = reinterpret_cast<char*>(message->payload);
-  read = ReadExact(input_, message_bytes, message->payload_size);
+  read = reader_.ReadExact(message_bytes, message->payload_size);
   if (read != message->payload_size) {
     LOG(ERROR) << "Could not read Gatekeeper Message: " << input_->StrError();
     return {};
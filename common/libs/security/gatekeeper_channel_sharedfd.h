@@ -19,6 +19,7 @@
 #include "gatekeeper/gatekeeper_messages.h"
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/buffered_reader.h"
 #include "common/libs/security/gatekeeper_channel.h"
 
 namespace cuttlefish {
@@ -39,6 +40,7 @@ class SharedFdGatekeeperChannel : public GatekeeperChannel {
  private:
   SharedFD input_;
   SharedFD output_;
+  BufferedReader reader_;
   bool SendMessage(uint32_t command, bool response,
                    const gatekeeper::GateKeeperMessage& message);
 };
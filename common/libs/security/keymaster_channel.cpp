@@ -16,17 +16,20 @@
 
 #include "common/libs/security/keymaster_channel.h"
 
+#include "common/libs/security/message_pool.h"
+
 namespace cuttlefish {
 
 void KeymasterCommandDestroyer::operator()(keymaster_message* ptr) {
-  { keymaster::Eraser(ptr, sizeof(keymaster_message) + ptr->payload_size); }
-  std::free(ptr);
+  auto size = sizeof(keymaster_message) + ptr->payload_size;
+  { keymaster::Eraser(ptr, size); }
+  MessagePool::Release(ptr, size);
 }
 
 ManagedKeymasterMessage CreateKeymasterMessage(AndroidKeymasterCommand command,
                                                bool is_response,
                                                size_t payload_size) {
-  auto memory = std::malloc(payload_size + sizeof(keymaster_message));
+  auto memory = MessagePool::Allocate(payload_size + sizeof(keymaster_message));
   auto message = reinterpret_cast<keymaster_message*>(memory);
   message->cmd = command;
   message->is_response = is_response;
@@ -32,7 +32,7 @@ namespace cuttlefish {
 
 SharedFdKeymasterChannel::SharedFdKeymasterChannel(SharedFD input,
                                                    SharedFD output)
-    : input_(input), output_(output) {}
+    : input_(input), output_(output), reader_(input) {}
 
 bool SharedFdKeymasterChannel::SendRequest(
     AndroidKeymasterCommand command, const keymaster::Serializable& message) {
@@ -63,7 +63,7 @@ bool SharedFdKeymasterChannel::SendMessage(
 
 ManagedKeymasterMessage SharedFdKeymasterChannel::ReceiveMessage() {
   struct keymaster_message message_header;
-  auto read = ReadExactBinary(input_, &message_header);
+  auto read = reader_.ReadExactBinary(&message_header);
   if (read != sizeof(keymaster_message)) {
     LOG(ERROR) << "Expected " << sizeof(keymaster_message) << ", received "
                << read;
@@ -76,7 +76,7 @@ ManagedKeymasterMessage SharedFdKeymasterChannel::ReceiveMessage() {
       CreateKeymasterMessage(message_header.cmd, message_header.is_response,
                              message_header.payload_size);
   auto message_bytes = reinterpret_cast<char*>(message->payload);
-  read = ReadExact(input_, message_bytes, message->payload_size);
+  read = reader_.ReadExact(message_bytes, message->payload_size);
   if (read != message->payload_size) {
     LOG(ERROR) << "Could not read Keymaster Message: " << input_->StrError();
     return {};
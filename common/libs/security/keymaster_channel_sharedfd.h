@@ -20,6 +20,7 @@
 #include <keymaster/serializable.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/buffered_reader.h"
 #include "common/libs/security/keymaster_channel.h"
 
 namespace cuttlefish {
@@ -41,6 +42,7 @@ class SharedFdKeymasterChannel : public KeymasterChannel {
  private:
   SharedFD input_;
   SharedFD output_;
+  BufferedReader reader_;
   bool SendMessage(keymaster::AndroidKeymasterCommand command, bool response,
                    const keymaster::Serializable& message);
 };
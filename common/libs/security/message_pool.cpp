@@ -0,0 +1,99 @@
+/*
+ * Copyright 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/security/message_pool.h"
+
+#include <array>
+#include <cstdlib>
+#include <vector>
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kMinSizeLog2 = 6;
+constexpr std::size_t kMaxSizeLog2 = 16;
+static_assert(MessagePool::kMaxPooledSize == 1 << kMaxSizeLog2);
+// Enough for a request and its response in flight, plus slack for messages
+// that are held a little longer
+constexpr std::size_t kBuffersPerClass = 8;
+
+std::size_t SizeClass(std::size_t size) {
+  std::size_t size_class = 0;
+  while ((std::size_t{1} << (size_class + kMinSizeLog2)) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+class FreeLists {
+ public:
+  FreeLists() {
+    for (auto& list : lists_) {
+      list.reserve(kBuffersPerClass);
+    }
+  }
+
+  ~FreeLists() {
+    for (auto& list : lists_) {
+      for (auto memory : list) {
+        std::free(memory);
+      }
+    }
+  }
+
+  std::vector<void*>& operator[](std::size_t size_class) {
+    return lists_[size_class];
+  }
+
+ private:
+  std::array<std::vector<void*>, kMaxSizeLog2 - kMinSizeLog2 + 1> lists_;
+};
+
+thread_local FreeLists free_lists;
+
+}  // namespace
+
+void* MessagePool::Allocate(std::size_t size) {
+  if (size > kMaxPooledSize) {
+    return std::malloc(size);
+  }
+  auto size_class = SizeClass(size);
+  auto& list = free_lists[size_class];
+  if (list.empty()) {
+    return std::malloc(std::size_t{1} << (size_class + kMinSizeLog2));
+  }
+  auto memory = list.back();
+  list.pop_back();
+  return memory;
+}
+
+void MessagePool::Release(void* memory, std::size_t size) {
+  if (memory == nullptr) {
+    return;
+  }
+  if (size > kMaxPooledSize) {
+    std::free(memory);
+    return;
+  }
+  auto& list = free_lists[SizeClass(size)];
+  if (list.size() >= kBuffersPerClass) {
+    std::free(memory);
+    return;
+  }
+  list.push_back(memory);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace cuttlefish {
+
+/**
+ * Recycles the memory of secure_env channel messages.
+ *
+ * The messages of a HAL mostly come in a few sizes, so the buffer freed after
+ * one round trip can carry the next one instead of going back to malloc.
+ * Sizes are rounded up to powers of two, and messages larger than
+ * kMaxPooledSize are not pooled. Free buffers are kept per thread, as every
+ * channel is served by a single thread.
+ */
+class MessagePool {
+ public:
+  static constexpr std::size_t kMaxPooledSize = 64 * 1024;
+
+  /** Returns at least `size` bytes, or nullptr when out of memory. */
+  static void* Allocate(std::size_t size);
+  /**
+   * Takes back memory returned by Allocate(`size`). Callers wipe what they
+   * wrote to it first, the pool hands it out again as it is.
+   */
+  static void Release(void* memory, std::size_t size);
+};
+
+}  // namespace cuttlefish
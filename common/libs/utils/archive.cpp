@@ -16,20 +16,187 @@
 
 #include "common/libs/utils/archive.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
+#include <ziparchive/zip_archive.h>
 
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
 
 namespace cuttlefish {
 namespace {
 
+constexpr char kZipMagic[] = {'P', 'K', 0x03, 0x04};
+// Granularity at which runs of zeroes are turned into holes when extracting.
+constexpr size_t kSparseBlockSize = 4096;
+constexpr size_t kMaxExtractionThreads = 8;
+
+bool IsZipFile(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  char magic[sizeof(kZipMagic)];
+  return fd->IsOpen() && ReadExact(fd, magic, sizeof(magic)) == sizeof(magic) &&
+         std::memcmp(magic, kZipMagic, sizeof(magic)) == 0;
+}
+
+// Rejects absolute paths and paths escaping the target directory.
+bool IsSafeMemberName(const std::string& name) {
+  if (name.empty() || name[0] == '/') {
+    return false;
+  }
+  for (const auto& component : android::base::Split(name, "/")) {
+    if (component == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Writes a file sequentially, leaving aligned blocks that only contain zeroes
+ * as holes. Most of the images in an img.zip are mostly empty.
+ */
+class SparseFileWriter {
+ public:
+  SparseFileWriter(SharedFD fd) : fd_(std::move(fd)) {}
+
+  bool Append(const uint8_t* buf, size_t size) {
+    while (size > 0) {
+      size_t chunk =
+          std::min(size, kSparseBlockSize - (offset_ % kSparseBlockSize));
+      if (chunk != kSparseBlockSize || !IsZero(buf, chunk)) {
+        if (position_ != offset_ && fd_->LSeek(offset_, SEEK_SET) != offset_) {
+          return false;
+        }
+        auto written = WriteAll(fd_, (const char*)buf, chunk);
+        if (written != (ssize_t)chunk) {
+          return false;
+        }
+        position_ = offset_ + chunk;
+      }
+      offset_ += chunk;
+      buf += chunk;
+      size -= chunk;
+    }
+    return true;
+  }
+
+  // Extends the file over any trailing hole.
+  bool Finish() { return fd_->Truncate(offset_) == 0; }
+
+ private:
+  static bool IsZero(const uint8_t* buf, size_t size) {
+    return buf[0] == 0 && std::memcmp(buf, buf + 1, size - 1) == 0;
+  }
+
+  SharedFD fd_;
+  off_t offset_ = 0;
+  off_t position_ = 0;
+};
+
+Result<void> ExtractZipEntry(ZipArchiveHandle zip, const std::string& name,
+                             const std::string& target_directory) {
+  CF_EXPECT(IsSafeMemberName(name), "Refusing to extract \"" << name << "\"");
+  const auto destination = target_directory + "/" + name;
+  if (android::base::EndsWith(name, "/")) {
+    CF_EXPECT(EnsureDirectoryExists(destination));
+    return {};
+  }
+  ZipEntry64 entry;
+  int32_t err = FindEntry(zip, name, &entry);
+  CF_EXPECT(err == 0,
+            "Could not find \"" << name << "\": " << ErrorCodeString(err));
+  CF_EXPECT(EnsureDirectoryExists(cpp_dirname(destination)));
+
+  if (S_ISLNK(entry.unix_mode)) {
+    std::string link_target(entry.uncompressed_length, '\0');
+    err = ExtractToMemory(zip, &entry, (uint8_t*)link_target.data(),
+                          link_target.size());
+    CF_EXPECT(err == 0, "Could not read link \""
+                            << name << "\": " << ErrorCodeString(err));
+    unlink(destination.c_str());
+    CF_EXPECT(symlink(link_target.c_str(), destination.c_str()) == 0,
+              "Could not create symlink \"" << destination
+                                            << "\": " << strerror(errno));
+    return {};
+  }
+
+  mode_t mode = entry.unix_mode & 0777;
+  auto fd = SharedFD::Open(destination, O_CREAT | O_WRONLY | O_TRUNC,
+                           mode ? mode : 0644);
+  CF_EXPECT(fd->IsOpen(),
+            "Could not open \"" << destination << "\": " << fd->StrError());
+  SparseFileWriter writer(fd);
+  err = ProcessZipEntryContents(
+      zip, &entry,
+      [](const uint8_t* buf, size_t size, void* cookie) {
+        return static_cast<SparseFileWriter*>(cookie)->Append(buf, size);
+      },
+      &writer);
+  CF_EXPECT(err == 0, "Could not extract \"" << name << "\" to \""
+                                             << destination
+                                             << "\": " << ErrorCodeString(err)
+                                             << ", " << fd->StrError());
+  CF_EXPECT(writer.Finish(), "Could not size \"" << destination
+                                                 << "\": " << fd->StrError());
+  if (mode != 0) {
+    CF_EXPECT(chmod(destination.c_str(), mode) == 0,
+              "Could not chmod \"" << destination << "\": " << strerror(errno));
+  }
+  return {};
+}
+
+/**
+ * Extracts `names` using a few worker threads. Reads go through pread on the
+ * archive's file descriptor, so the workers share the one parsed central
+ * directory.
+ */
+Result<void> ExtractZipEntries(ZipArchiveHandle zip,
+                               const std::vector<std::string>& names,
+                               const std::string& target_directory) {
+  size_t num_workers = std::min<size_t>(
+      {names.size(), std::max(1u, std::thread::hardware_concurrency()),
+       kMaxExtractionThreads});
+  std::atomic<size_t> next_name = 0;
+  auto worker = [&]() -> Result<void> {
+    for (size_t i = next_name++; i < names.size(); i = next_name++) {
+      auto res = ExtractZipEntry(zip, names[i], target_directory);
+      if (!res.ok()) {
+        next_name = names.size();  // Stop the other workers
+        return res;
+      }
+    }
+    return {};
+  };
+  std::vector<std::future<Result<void>>> workers;
+  for (size_t i = 1; i < num_workers; i++) {
+    workers.emplace_back(std::async(std::launch::async, worker));
+  }
+  auto result = worker();
+  for (auto& other : workers) {
+    auto other_result = other.get();
+    if (result.ok() && !other_result.ok()) {
+      result = std::move(other_result);
+    }
+  }
+  return result;
+}
+
 Result<std::vector<std::string>> ExtractHelper(
     std::vector<std::string>& files, const std::string& archive_filepath,
     const std::string& target_directory, const bool keep_archive) {
@@ -57,9 +224,57 @@ Result<std::vector<std::string>> ExtractHelper(
 
 Archive::Archive(const std::string& file) : file_(file) {}
 
-Archive::~Archive() {}
+Archive::~Archive() {
+  if (zip_) {
+    CloseArchive(zip_);
+  }
+}
+
+ZipArchive* Archive::Zip() {
+  if (zip_checked_) {
+    return zip_;
+  }
+  zip_checked_ = true;
+  if (!IsZipFile(file_)) {
+    return nullptr;
+  }
+  int32_t err = OpenArchive(file_.c_str(), &zip_);
+  if (err != 0) {
+    LOG(ERROR) << "Could not open \"" << file_ << "\" as a zip file: "
+               << ErrorCodeString(err) << ", falling back to bsdtar";
+    CloseArchive(zip_);
+    zip_ = nullptr;
+  }
+  return zip_;
+}
+
+Result<std::vector<std::string>> Archive::ZipContents(ZipArchive* zip) {
+  void* cookie;
+  int32_t err = StartIteration(zip, &cookie);
+  CF_EXPECT(err == 0,
+            "Could not list \"" << file_ << "\": " << ErrorCodeString(err));
+  std::vector<std::string> contents;
+  ZipEntry64 entry;
+  std::string_view name;
+  while ((err = Next(cookie, &entry, &name)) == 0) {
+    contents.emplace_back(name);
+  }
+  EndIteration(cookie);
+  // -1 marks the end of the iteration
+  CF_EXPECT(err == -1,
+            "Could not list \"" << file_ << "\": " << ErrorCodeString(err));
+  return contents;
+}
 
 std::vector<std::string> Archive::Contents() {
+  if (auto zip = Zip(); zip) {
+    auto contents = ZipContents(zip);
+    if (!contents.ok()) {
+      LOG(ERROR) << contents.error().Message();
+      return {};
+    }
+    return *contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-tf");
   bsdtar_cmd.AddParameter(file_);
@@ -80,6 +295,22 @@ bool Archive::ExtractAll(const std::string& target_directory) {
 
 bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
                            const std::string& target_directory) {
+  if (auto zip = Zip(); zip) {
+    auto extract = [&]() -> Result<void> {
+      if (!to_extract.empty()) {
+        return ExtractZipEntries(zip, to_extract, target_directory);
+      }
+      // An archive that can't be listed must not look like an empty one
+      auto names = CF_EXPECT(ZipContents(zip));
+      return ExtractZipEntries(zip, names, target_directory);
+    };
+    auto res = extract();
+    if (!res.ok()) {
+      LOG(ERROR) << "Extraction from \"" << file_ << "\" failed: "
+                 << res.error().Message();
+    }
+    return res.ok();
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-x");
   bsdtar_cmd.AddParameter("-v");
@@ -102,6 +333,22 @@ bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
 }
 
 std::string Archive::ExtractToMemory(const std::string& path) {
+  if (auto zip = Zip(); zip) {
+    ZipEntry64 entry;
+    int32_t err = FindEntry(zip, path, &entry);
+    std::string contents;
+    if (err == 0) {
+      contents.resize(entry.uncompressed_length);
+      err = ::ExtractToMemory(zip, &entry, (uint8_t*)contents.data(),
+                              contents.size());
+    }
+    if (err != 0) {
+      LOG(ERROR) << "Could not extract \"" << path << "\" from \"" << file_
+                 << "\" to memory: " << ErrorCodeString(err);
+      return "";
+    }
+    return contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-xf");
   bsdtar_cmd.AddParameter(file_);
@@ -119,26 +366,40 @@ std::string Archive::ExtractToMemory(const std::string& path) {
 }
 
 Result<std::vector<std::string>> ExtractImages(
-    const std::string& archive_filepath, const std::string& target_directory,
+    Archive& archive, const std::string& target_directory,
     const std::vector<std::string>& images, const bool keep_archive) {
-  Archive archive(archive_filepath);
   CF_EXPECT(archive.ExtractFiles(images, target_directory),
-            "Could not extract images from \"" << archive_filepath << "\" to \""
+            "Could not extract images from \"" << archive.File() << "\" to \""
                                                << target_directory << "\"");
 
   std::vector<std::string> files = images;
-  return ExtractHelper(files, archive_filepath, target_directory, keep_archive);
+  return ExtractHelper(files, archive.File(), target_directory, keep_archive);
 }
 
-Result<std::string> ExtractImage(const std::string& archive_filepath,
+Result<std::vector<std::string>> ExtractImages(
+    const std::string& archive_filepath, const std::string& target_directory,
+    const std::vector<std::string>& images, const bool keep_archive) {
+  Archive archive(archive_filepath);
+  return ExtractImages(archive, target_directory, images, keep_archive);
+}
+
+Result<std::string> ExtractImage(Archive& archive,
                                  const std::string& target_directory,
                                  const std::string& image,
                                  const bool keep_archive) {
   std::vector<std::string> result = CF_EXPECT(
-      ExtractImages(archive_filepath, target_directory, {image}, keep_archive));
+      ExtractImages(archive, target_directory, {image}, keep_archive));
   return {result.front()};
 }
 
+Result<std::string> ExtractImage(const std::string& archive_filepath,
+                                 const std::string& target_directory,
+                                 const std::string& image,
+                                 const bool keep_archive) {
+  Archive archive(archive_filepath);
+  return ExtractImage(archive, target_directory, image, keep_archive);
+}
+
 Result<std::vector<std::string>> ExtractArchiveContents(
     const std::string& archive_filepath, const std::string& target_directory,
     const bool keep_archive) {
@@ -20,16 +20,33 @@
 
 #include "common/libs/utils/result.h"
 
+// From ziparchive/zip_archive.h
+struct ZipArchive;
+
 namespace cuttlefish {
 
 // Operations on archive files
+//
+// Zip files are read in-process: the central directory is read once when the
+// archive is first used and members are extracted by a small pool of workers.
+// Everything else (e.g. the host package .tar.gz) goes through bsdtar.
 class Archive {
   std::string file_;
+  ZipArchive* zip_ = nullptr;
+  bool zip_checked_ = false;
+
+  ZipArchive* Zip();
+  Result<std::vector<std::string>> ZipContents(ZipArchive* zip);
 
  public:
   Archive(const std::string& file);
   ~Archive();
 
+  Archive(const Archive&) = delete;
+  Archive& operator=(const Archive&) = delete;
+
+  const std::string& File() const { return file_; }
+
   std::vector<std::string> Contents();
   bool ExtractAll(const std::string& target_directory = ".");
   bool ExtractFiles(const std::vector<std::string>& files,
@@ -37,10 +54,19 @@ class Archive {
   std::string ExtractToMemory(const std::string& path);
 };
 
+// The overloads taking an Archive reuse its central directory, which saves
+// reading it again when extracting several images from the same zip.
+Result<std::vector<std::string>> ExtractImages(
+    Archive& archive, const std::string& target_directory,
+    const std::vector<std::string>& images, const bool keep_archive);
 Result<std::vector<std::string>> ExtractImages(
     const std::string& archive_filepath, const std::string& target_directory,
     const std::vector<std::string>& images, const bool keep_archive);
 
+Result<std::string> ExtractImage(Archive& archive,
+                                 const std::string& target_directory,
+                                 const std::string& image,
+                                 const bool keep_archive);
 Result<std::string> ExtractImage(const std::string& archive_filepath,
                                  const std::string& target_directory,
                                  const std::string& image,
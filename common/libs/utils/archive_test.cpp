@@ -0,0 +1,155 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <ziparchive/zip_writer.h>
+
+#include "common/libs/utils/archive.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/subprocess.h"
+
+namespace cuttlefish {
+namespace {
+
+// Compresses well, unlike the short members
+const std::string kDeflatedContents(64 * 1024, 'c');
+
+class ArchiveTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    zip_ = std::string(dir_.path) + "/img.zip";
+    out_ = std::string(dir_.path) + "/out";
+    ASSERT_TRUE(EnsureDirectoryExists(out_).ok());
+  }
+
+  // Members are {name, contents, compress}
+  void WriteZip(
+      const std::vector<std::tuple<std::string, std::string, bool>>& members) {
+    FILE* file = fopen(zip_.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    ZipWriter writer(file);
+    for (const auto& [name, contents, compress] : members) {
+      ASSERT_EQ(writer.StartEntry(name, compress ? ZipWriter::kCompress : 0),
+                0);
+      ASSERT_EQ(writer.WriteBytes(contents.data(), contents.size()), 0);
+      ASSERT_EQ(writer.FinishEntry(), 0);
+    }
+    ASSERT_EQ(writer.Finish(), 0);
+    ASSERT_EQ(fclose(file), 0);
+  }
+
+  void WriteDefaultZip() {
+    WriteZip({
+        {"stored.img", "stored", false},
+        {"IMAGES/deflated.img", kDeflatedContents, true},
+    });
+  }
+
+  std::string ReadOut(const std::string& name) {
+    std::string contents;
+    EXPECT_TRUE(android::base::ReadFileToString(out_ + "/" + name, &contents));
+    return contents;
+  }
+
+  TemporaryDir dir_;
+  std::string zip_;
+  std::string out_;
+};
+
+TEST_F(ArchiveTest, ExtractsStoredAndDeflatedMembers) {
+  WriteDefaultZip();
+  Archive archive(zip_);
+
+  auto contents = archive.Contents();
+  std::sort(contents.begin(), contents.end());
+  EXPECT_EQ(contents, std::vector<std::string>(
+                          {"IMAGES/deflated.img", "stored.img"}));
+
+  ASSERT_TRUE(archive.ExtractAll(out_));
+  EXPECT_EQ(ReadOut("stored.img"), "stored");
+  EXPECT_EQ(ReadOut("IMAGES/deflated.img"), kDeflatedContents);
+  EXPECT_EQ(archive.ExtractToMemory("IMAGES/deflated.img"), kDeflatedContents);
+}
+
+TEST_F(ArchiveTest, ExtractsImagesWithOneArchive) {
+  WriteDefaultZip();
+  Archive archive(zip_);
+
+  auto stored = ExtractImage(archive, out_, "stored.img", true);
+  ASSERT_TRUE(stored.ok()) << stored.error().Trace();
+  EXPECT_EQ(*stored, out_ + "/stored.img");
+  auto deflated = ExtractImage(archive, out_, "IMAGES/deflated.img", true);
+  ASSERT_TRUE(deflated.ok()) << deflated.error().Trace();
+  EXPECT_EQ(ReadOut("IMAGES/deflated.img"), kDeflatedContents);
+  EXPECT_TRUE(FileExists(zip_));
+}
+
+TEST_F(ArchiveTest, FailsOnMissingMember) {
+  WriteDefaultZip();
+  Archive archive(zip_);
+
+  EXPECT_FALSE(ExtractImage(archive, out_, "missing.img", true).ok());
+  EXPECT_FALSE(
+      ExtractImages(archive, out_, {"stored.img", "missing.img"}, true).ok());
+  EXPECT_EQ(archive.ExtractToMemory("missing.img"), "");
+}
+
+TEST_F(ArchiveTest, FailsOnCorruptedZip) {
+  // The zip magic, but no central directory
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      std::string("PK\x03\x04", 4) + std::string(100, 'x'), zip_));
+  Archive archive(zip_);
+
+  EXPECT_FALSE(archive.ExtractAll(out_));
+  EXPECT_FALSE(ExtractArchiveContents(zip_, out_, true).ok());
+}
+
+TEST_F(ArchiveTest, FallsBackToBsdtar) {
+  if (!FileExists("/usr/bin/bsdtar")) {
+    GTEST_SKIP() << "bsdtar is not installed";
+  }
+  const std::string in = std::string(dir_.path) + "/in";
+  ASSERT_TRUE(EnsureDirectoryExists(in).ok());
+  ASSERT_TRUE(android::base::WriteStringToFile("from tar", in + "/tar.img"));
+  const std::string tar = std::string(dir_.path) + "/host_package.tar.gz";
+  Command bsdtar_cmd("/usr/bin/bsdtar");
+  bsdtar_cmd.AddParameter("-czf");
+  bsdtar_cmd.AddParameter(tar);
+  bsdtar_cmd.AddParameter("-C");
+  bsdtar_cmd.AddParameter(in);
+  bsdtar_cmd.AddParameter("tar.img");
+  ASSERT_EQ(bsdtar_cmd.Start().Wait(), 0);
+
+  Archive archive(tar);
+  auto contents = archive.Contents();
+  EXPECT_NE(std::find(contents.begin(), contents.end(), "tar.img"),
+            contents.end());
+  auto files = ExtractArchiveContents(tar, out_, true);
+  ASSERT_TRUE(files.ok()) << files.error().Trace();
+  EXPECT_EQ(*files, std::vector<std::string>({out_ + "/tar.img"}));
+  EXPECT_EQ(ReadOut("tar.img"), "from tar");
+}
+
+}  // namespace
+}  // namespace cuttlefish
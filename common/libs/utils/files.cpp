@@ -15,8 +15,6 @@
  */
 
 #include "common/libs/utils/files.h"
-#include "common/libs/utils/contains.h"
-#include "common/libs/utils/inotify.h"
 
 #include <dirent.h>
 #include <fcntl.h>
@@ -24,16 +22,19 @@
 #include <libgen.h>
 #include <linux/fiemap.h>
 #include <linux/fs.h>
-#include <sched.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
-#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cerrno>
 #include <chrono>
 #include <climits>
@@ -45,9 +46,12 @@
 #include <iosfwd>
 #include <istream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <ostream>
 #include <ratio>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -192,22 +196,158 @@ bool RecursivelyRemoveDirectory(const std::string& path) {
 
 namespace {
 
-bool SendFile(int out_fd, int in_fd, off64_t* offset, size_t count) {
-  while (count > 0) {
-    const auto bytes_written =
-        TEMP_FAILURE_RETRY(sendfile(out_fd, in_fd, offset, count));
-    if (bytes_written <= 0) {
+struct Extent {
+  off64_t offset;
+  off64_t size;
+};
+
+// Data extents of the file in order, without the holes between them.
+bool DataExtents(int fd, off64_t file_size, std::vector<Extent>& extents) {
+  off64_t offset = 0;
+  while (offset < file_size) {
+    off64_t data = lseek64(fd, offset, SEEK_DATA);
+    if (data == -1) {
+      // ENXIO is returned when there are no more blocks of this type
+      // coming.
+      return errno == ENXIO;
+    }
+    off64_t hole = lseek64(fd, data, SEEK_HOLE);
+    if (hole == -1) {
       return false;
     }
+    extents.push_back(Extent{data, hole - data});
+    offset = hole;
+  }
+  return true;
+}
 
-    count -= bytes_written;
+// The host sysroot predates the glibc wrapper
+ssize_t CopyFileRange(int fd_in, off64_t* off_in, int fd_out,
+                      off64_t* off_out, size_t len) {
+  return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, 0);
+}
+
+bool PreadPwrite(int fd_in, int fd_out, off64_t offset, off64_t size,
+                 std::vector<char>& buffer) {
+  buffer.resize(1 << 20);
+  while (size > 0) {
+    auto to_read = std::min<off64_t>(size, buffer.size());
+    auto bytes_read =
+        TEMP_FAILURE_RETRY(pread64(fd_in, buffer.data(), to_read, offset));
+    if (bytes_read == 0) {
+      // The source shrank while being copied
+      errno = EIO;
+    }
+    if (bytes_read <= 0) {
+      return false;
+    }
+    for (ssize_t written = 0; written < bytes_read;) {
+      auto bytes_written = TEMP_FAILURE_RETRY(
+          pwrite64(fd_out, buffer.data() + written, bytes_read - written,
+                   offset + written));
+      if (bytes_written <= 0) {
+        return false;
+      }
+      written += bytes_written;
+    }
+    offset += bytes_read;
+    size -= bytes_read;
   }
   return true;
 }
 
+class ExtentCopier {
+ public:
+  ExtentCopier(int fd_in, int fd_out, const CopyOptions& options,
+               off64_t total)
+      : fd_in_(fd_in), fd_out_(fd_out), options_(options), total_(total) {}
+
+  bool CopyAll(const std::vector<Extent>& chunks, unsigned threads) {
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+      workers.emplace_back([this, &chunks]() { Work(chunks); });
+    }
+    Work(chunks);
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    return !failed_;
+  }
+
+ private:
+  void Work(const std::vector<Extent>& chunks) {
+    std::vector<char> buffer;
+    while (!failed_) {
+      auto index = next_++;
+      if (index >= chunks.size()) {
+        return;
+      }
+      if (!CopyChunk(chunks[index], buffer)) {
+        PLOG(ERROR) << "Failed to copy " << chunks[index].size
+                    << " bytes at offset " << chunks[index].offset;
+        failed_ = true;
+        return;
+      }
+      Progress(chunks[index].size);
+    }
+  }
+
+  bool CopyChunk(const Extent& chunk, std::vector<char>& buffer) {
+    off64_t in = chunk.offset;
+    off64_t out = chunk.offset;
+    off64_t end = chunk.offset + chunk.size;
+    while (in < end && use_copy_file_range_) {
+      auto copied = CopyFileRange(fd_in_, &in, fd_out_, &out, end - in);
+      if (copied > 0) {
+        continue;
+      }
+      if (copied == 0) {
+        // Some file systems (procfs, FUSE...) copy nothing rather than
+        // failing. pread() tells whether the source really shrank.
+        use_copy_file_range_ = false;
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      // Not supported by the kernel or between these file systems
+      if (errno != ENOSYS && errno != EXDEV && errno != EOPNOTSUPP &&
+          errno != EINVAL) {
+        return false;
+      }
+      use_copy_file_range_ = false;
+    }
+    return PreadPwrite(fd_in_, fd_out_, in, end - in, buffer);
+  }
+
+  // Under the mutex so that the callback sees the counts in order
+  void Progress(off64_t bytes) {
+    std::lock_guard lock(progress_mutex_);
+    copied_ += bytes;
+    if (options_.progress) {
+      options_.progress(copied_, total_);
+    }
+  }
+
+  int fd_in_;
+  int fd_out_;
+  const CopyOptions& options_;
+  off64_t total_;
+  std::atomic<std::size_t> next_ = 0;
+  std::atomic<bool> failed_ = false;
+  std::atomic<bool> use_copy_file_range_ = true;
+  std::mutex progress_mutex_;
+  off64_t copied_ = 0;  // Guarded by progress_mutex_
+};
+
 }  // namespace
 
 bool Copy(const std::string& from, const std::string& to) {
+  return Copy(from, to, CopyOptions{});
+}
+
+bool Copy(const std::string& from, const std::string& to,
+          const CopyOptions& options) {
   android::base::unique_fd fd_from(
       open(from.c_str(), O_RDONLY | O_CLOEXEC));
   android::base::unique_fd fd_to(
@@ -217,52 +357,47 @@ bool Copy(const std::string& from, const std::string& to) {
     return false;
   }
 
-  off_t farthest_seek = lseek(fd_from.get(), 0, SEEK_END);
-  if (farthest_seek == -1) {
-    PLOG(ERROR) << "Could not lseek in \"" << from << "\"";
+  struct stat64 st;
+  if (fstat64(fd_from.get(), &st) < 0) {
+    PLOG(ERROR) << "Could not stat \"" << from << "\"";
     return false;
   }
-  if (ftruncate64(fd_to.get(), farthest_seek) < 0) {
+  off64_t file_size = st.st_size;
+
+  // Sharing the blocks of the source is instant where the file system
+  // supports it (btrfs, xfs, bcachefs...).
+  if (ioctl(fd_to.get(), FICLONE, fd_from.get()) == 0) {
+    if (options.progress) {
+      options.progress(file_size, file_size);
+    }
+    return true;
+  }
+
+  if (ftruncate64(fd_to.get(), file_size) < 0) {
     PLOG(ERROR) << "Failed to ftruncate " << to;
+    return false;
   }
-  off_t offset = 0;
-  while (offset < farthest_seek) {
-    off_t new_offset = lseek(fd_from.get(), offset, SEEK_HOLE);
-    if (new_offset == -1) {
-      // ENXIO is returned when there are no more blocks of this type
-      // coming.
-      if (errno == ENXIO) {
-        return true;
-      }
-      PLOG(ERROR) << "Could not lseek in \"" << from << "\"";
-      return false;
-    }
-    auto data_bytes = new_offset - offset;
-    if (lseek(fd_to.get(), offset, SEEK_SET) < 0) {
-      PLOG(ERROR) << "lseek() on " << to << " failed";
-      return false;
-    }
-    if (!SendFile(fd_to.get(), fd_from.get(), &offset, data_bytes)) {
-      PLOG(ERROR) << "sendfile() failed";
-      return false;
-    }
-    CHECK_EQ(offset, new_offset);
-    if (offset >= farthest_seek) {
-      return true;
-    }
-    new_offset = lseek(fd_from.get(), offset, SEEK_DATA);
-    if (new_offset == -1) {
-      // ENXIO is returned when there are no more blocks of this type
-      // coming.
-      if (errno == ENXIO) {
-        return true;
-      }
-      PLOG(ERROR) << "Could not lseek in \"" << from << "\"";
-      return false;
+  std::vector<Extent> extents;
+  if (!DataExtents(fd_from.get(), file_size, extents)) {
+    PLOG(ERROR) << "Could not lseek in \"" << from << "\"";
+    return false;
+  }
+
+  // Large extents are split so the workers get even shares of them.
+  off64_t chunk_size = std::max<off64_t>(options.chunk_size, 1 << 20);
+  std::vector<Extent> chunks;
+  off64_t data_size = 0;
+  for (const auto& extent : extents) {
+    for (off64_t pos = 0; pos < extent.size; pos += chunk_size) {
+      chunks.push_back(
+          Extent{extent.offset + pos, std::min(chunk_size, extent.size - pos)});
     }
-    offset = new_offset;
+    data_size += extent.size;
   }
-  return true;
+  unsigned threads = std::max(1u, options.threads);
+  threads = std::min<std::size_t>(threads, chunks.size());
+  ExtentCopier copier(fd_from.get(), fd_to.get(), options, data_size);
+  return copier.CopyAll(chunks, threads);
 }
 
 std::string AbsolutePath(const std::string& path) {
@@ -470,126 +605,169 @@ Result<void> WalkDirectory(
   return {};
 }
 
-class InotifyWatcher {
- public:
-  InotifyWatcher(int inotify, const std::string& path, int watch_mode)
-      : inotify_(inotify) {
-    watch_ = inotify_add_watch(inotify_, path.c_str(), watch_mode);
-  }
-  virtual ~InotifyWatcher() { inotify_rm_watch(inotify_, watch_); }
-
- private:
-  int inotify_;
-  int watch_;
-};
+namespace {
 
-static Result<void> WaitForFileInternal(const std::string& path, int timeoutSec,
-                                        int inotify) {
-  CF_EXPECT_NE(path, "", "Path is empty");
+using Clock = std::chrono::steady_clock;
 
-  if (FileExists(path, true)) {
+// Sleeps until a watched directory changes or a deadline passes, to wait
+// for paths to be created without polling for them.
+class PathWaiter {
+ public:
+  explicit PathWaiter(int timeout_sec)
+      : deadline_(Clock::now() + std::chrono::seconds(timeout_sec)) {}
+
+  Result<void> Init() {
+    inotify_.reset(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    CF_EXPECT(inotify_.get() >= 0, "inotify_init1 failed: " << strerror(errno));
+    epoll_.reset(epoll_create1(EPOLL_CLOEXEC));
+    CF_EXPECT(epoll_.get() >= 0, "epoll_create1 failed: " << strerror(errno));
+    struct epoll_event event = {.events = EPOLLIN};
+    CF_EXPECT(epoll_ctl(epoll_.get(), EPOLL_CTL_ADD, inotify_.get(), &event) ==
+                  0,
+              "epoll_ctl failed: " << strerror(errno));
     return {};
   }
 
-  const auto targetTime =
-      std::chrono::system_clock::now() + std::chrono::seconds(timeoutSec);
-
-  const auto parentPath = cpp_dirname(path);
-  const auto filename = cpp_basename(path);
-
-  CF_EXPECT(WaitForFile(parentPath, timeoutSec),
-            "Error while waiting for parent directory creation");
-
-  auto watcher = InotifyWatcher(inotify, parentPath.c_str(), IN_CREATE);
-
-  if (FileExists(path, true)) {
+  // Returns whether the path exists. If it doesn't, its closest existing
+  // ancestor is watched so that Wait() returns when the missing part starts
+  // to be created.
+  Result<bool> Exists(const std::string& path) {
+    if (FileExists(path)) {
+      return true;
+    }
+    auto dir = cpp_dirname(path);
+    while (!DirectoryExists(dir) && dir != "/" && dir != ".") {
+      dir = cpp_dirname(dir);
+    }
+    auto mask = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+    CF_EXPECT(inotify_add_watch(inotify_.get(), dir.c_str(), mask) >= 0,
+              "Failed to watch \"" << dir << "\": " << strerror(errno));
+    // It could have been created before the watch was added
+    return FileExists(path);
+  }
+
+  // Waits for a change in the watched directories, or for `retry` if it's
+  // given. Fails once the deadline has passed.
+  Result<void> Wait(std::optional<Clock::time_point> retry = {}) {
+    auto now = Clock::now();
+    CF_EXPECT(now < deadline_, "Timed out");
+    auto until = retry ? std::min(*retry, deadline_) : deadline_;
+    auto timeout_ms =
+        std::chrono::ceil<std::chrono::milliseconds>(until - now).count();
+    struct epoll_event event;
+    auto ready = epoll_wait(epoll_.get(), &event, 1, timeout_ms);
+    CF_EXPECT(ready >= 0 || errno == EINTR,
+              "epoll_wait failed: " << strerror(errno));
+    // Only whether something changed matters, the paths are checked again.
+    alignas(struct inotify_event) char events[4096];
+    while (read(inotify_.get(), events, sizeof(events)) > 0) {
+    }
     return {};
   }
 
-  while (true) {
-    const auto currentTime = std::chrono::system_clock::now();
-
-    if (currentTime >= targetTime) {
-      return CF_ERR("Timed out");
-    }
-
-    const auto timeRemain =
-        std::chrono::duration_cast<std::chrono::microseconds>(targetTime -
-                                                              currentTime)
-            .count();
-    const auto secondInUsec =
-        std::chrono::microseconds(std::chrono::seconds(1)).count();
-    struct timeval timeout;
-
-    timeout.tv_sec = timeRemain / secondInUsec;
-    timeout.tv_usec = timeRemain % secondInUsec;
-
-    fd_set readfds;
+ private:
+  Clock::time_point deadline_;
+  android::base::unique_fd inotify_;
+  android::base::unique_fd epoll_;
+};
 
-    FD_ZERO(&readfds);
-    FD_SET(inotify, &readfds);
+// Attempts a connection without blocking, returning whether something
+// listens on the socket.
+Result<bool> AcceptsConnections(const std::string& path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  CF_EXPECT(path.size() < sizeof(addr.sun_path),
+            "Socket path \"" << path << "\" is too long");
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  android::base::unique_fd sock(
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  CF_EXPECT(sock.get() >= 0, "socket failed: " << strerror(errno));
+  auto ret = TEMP_FAILURE_RETRY(
+      connect(sock.get(), reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)));
+  if (ret == 0) {
+    return true;
+  }
+  // Bound but not listening yet, a full backlog, or replaced in between
+  CF_EXPECT(errno == ECONNREFUSED || errno == EAGAIN || errno == ENOENT,
+            "Failed to connect to \"" << path << "\": " << strerror(errno));
+  return false;
+}
 
-    auto ret = select(inotify + 1, &readfds, NULL, NULL, &timeout);
+}  // namespace
 
-    if (ret == 0) {
-      return CF_ERR("select() timed out");
-    } else if (ret < 0) {
-      return CF_ERRNO("select() failed");
+Result<void> WaitForFiles(const std::vector<std::string>& paths,
+                          int timeoutSec) {
+  for (const auto& path : paths) {
+    CF_EXPECT_NE(path, "", "Path is empty");
+  }
+  PathWaiter waiter(timeoutSec);
+  CF_EXPECT(waiter.Init());
+  auto pending = paths;
+  while (true) {
+    std::vector<std::string> missing;
+    for (const auto& path : pending) {
+      if (!CF_EXPECT(waiter.Exists(path))) {
+        missing.push_back(path);
+      }
     }
-
-    auto names = GetCreatedFileListFromInotifyFd(inotify);
-
-    CF_EXPECT(names.size() > 0,
-              "Failed to get names from inotify " << strerror(errno));
-
-    if (Contains(names, filename)) {
+    if (missing.empty()) {
       return {};
     }
+    pending = std::move(missing);
+    CF_EXPECT(waiter.Wait(), "Waiting for creation of "
+                                 << android::base::Join(pending, ", "));
   }
-
-  return CF_ERR("This shouldn't be executed");
 }
 
-auto WaitForFile(const std::string& path, int timeoutSec)
-    -> decltype(WaitForFileInternal(path, timeoutSec, 0)) {
-  auto inotify = inotify_init1(IN_CLOEXEC);
-
-  ScopeGuard close_inotify([inotify]() { close(inotify); });
-
-  CF_EXPECT(WaitForFileInternal(path, timeoutSec, inotify));
-
+Result<void> WaitForFile(const std::string& path, int timeoutSec) {
+  CF_EXPECT(WaitForFiles({path}, timeoutSec));
   return {};
 }
 
-Result<void> WaitForUnixSocket(const std::string& path, int timeoutSec) {
-  const auto targetTime =
-      std::chrono::system_clock::now() + std::chrono::seconds(timeoutSec);
-
-  CF_EXPECT(WaitForFile(path, timeoutSec),
-            "Waiting for socket path creation failed");
-  CF_EXPECT(FileIsSocket(path), "Specified path is not a socket");
-
+Result<void> WaitForUnixSockets(const std::vector<std::string>& paths,
+                                int timeoutSec) {
+  for (const auto& path : paths) {
+    CF_EXPECT_NE(path, "", "Path is empty");
+  }
+  PathWaiter waiter(timeoutSec);
+  CF_EXPECT(waiter.Init());
+  // Nothing signals when a bound socket starts listening, so connections are
+  // retried with an increasing delay.
+  constexpr auto kMaxRetryDelay = std::chrono::milliseconds(100);
+  auto retry_delay = std::chrono::milliseconds(1);
+  auto pending = paths;
   while (true) {
-    const auto currentTime = std::chrono::system_clock::now();
-
-    if (currentTime >= targetTime) {
-      return CF_ERR("Timed out");
+    std::vector<std::string> not_ready;
+    bool refused = false;
+    for (const auto& path : pending) {
+      if (!CF_EXPECT(waiter.Exists(path))) {
+        not_ready.push_back(path);
+        continue;
+      }
+      CF_EXPECT(FileIsSocket(path), "\"" << path << "\" is not a socket");
+      if (!CF_EXPECT(AcceptsConnections(path))) {
+        not_ready.push_back(path);
+        refused = true;
+      }
     }
-
-    const auto timeRemain = std::chrono::duration_cast<std::chrono::seconds>(
-                                targetTime - currentTime)
-                                .count();
-    auto testConnect =
-        SharedFD::SocketLocalClient(path, false, SOCK_STREAM, timeRemain);
-
-    if (testConnect->IsOpen()) {
+    if (not_ready.empty()) {
       return {};
     }
-
-    sched_yield();
+    pending = std::move(not_ready);
+    std::optional<Clock::time_point> retry;
+    if (refused) {
+      retry = Clock::now() + retry_delay;
+      retry_delay = std::min(retry_delay * 2, kMaxRetryDelay);
+    }
+    CF_EXPECT(waiter.Wait(retry), "Waiting for "
+                                      << android::base::Join(pending, ", ")
+                                      << " to accept connections");
   }
+}
 
-  return CF_ERR("This shouldn't be executed");
+Result<void> WaitForUnixSocket(const std::string& path, int timeoutSec) {
+  CF_EXPECT(WaitForUnixSockets({path}, timeoutSec));
+  return {};
 }
 
 }  // namespace cuttlefish
@@ -19,6 +19,7 @@
 #include <sys/types.h>
 
 #include <chrono>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -39,6 +40,21 @@ bool CanAccess(const std::string& path, const int mode);
 bool IsDirectoryEmpty(const std::string& path);
 bool RecursivelyRemoveDirectory(const std::string& path);
 bool Copy(const std::string& from, const std::string& to);
+
+struct CopyOptions {
+  // Threads copying data when the file can't be cloned.
+  unsigned threads = 4;
+  // Data extents are split into pieces of at most this many bytes, the unit
+  // of work of a thread.
+  off_t chunk_size = 64 << 20;
+  // Called with the bytes of data copied so far and the total, from one
+  // thread at a time but not always the calling one.
+  std::function<void(off_t copied, off_t total)> progress;
+};
+// Clones the file when its file system can share the blocks, otherwise
+// copies the data extents on a few threads. Holes are preserved either way.
+bool Copy(const std::string& from, const std::string& to,
+          const CopyOptions& options);
 off_t FileSize(const std::string& path);
 bool RemoveFile(const std::string& file);
 Result<std::string> RenameFile(const std::string& current_filepath,
@@ -75,7 +91,14 @@ Result<void> WalkDirectory(
     const std::string& dir,
     const std::function<bool(const std::string&)>& callback);
 
+// Waits for all of the paths to exist, sleeping on inotify watches of their
+// closest existing ancestors in the meantime.
+Result<void> WaitForFiles(const std::vector<std::string>& paths,
+                          int timeoutSec);
 Result<void> WaitForFile(const std::string& path, int timeoutSec);
+// Waits for all of the paths to be unix sockets accepting connections.
+Result<void> WaitForUnixSockets(const std::vector<std::string>& paths,
+                                int timeoutSec);
 Result<void> WaitForUnixSocket(const std::string& path, int timeoutSec);
 
 }  // namespace cuttlefish
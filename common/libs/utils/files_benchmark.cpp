@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures Copy() on images with different extent layouts. The files are
+// created in $TMPDIR, whose file system decides whether they get cloned.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr off_t kMiB = 1 << 20;
+constexpr off_t kImageSize = 512 * kMiB;
+
+enum Layout {
+  // All data, like a freshly built system image
+  kDense,
+  // A few MiB of data every 64MiB, like a userdata image
+  kSparse,
+  // 64KiB of data every 256KiB, like a filesystem after some use
+  kFragmented,
+};
+
+void CreateImage(const std::string& path, Layout layout) {
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CHECK(fd >= 0) << strerror(errno);
+  off_t extent = kImageSize, stride = kImageSize;
+  if (layout == kSparse) {
+    extent = 4 * kMiB;
+    stride = 64 * kMiB;
+  } else if (layout == kFragmented) {
+    extent = 64 << 10;
+    stride = 256 << 10;
+  }
+  std::string data(std::min(extent, 4 * kMiB), 'x');
+  for (off_t offset = 0; offset < kImageSize; offset += stride) {
+    for (off_t pos = 0; pos < extent; pos += data.size()) {
+      CHECK(pwrite(fd, data.data(), data.size(), offset + pos) ==
+            (ssize_t)data.size());
+    }
+  }
+  CHECK(ftruncate(fd, kImageSize) == 0);
+  close(fd);
+}
+
+void BM_Copy(benchmark::State& state) {
+  TemporaryDir dir;
+  std::string from = std::string(dir.path) + "/from";
+  std::string to = std::string(dir.path) + "/to";
+  CreateImage(from, (Layout)state.range(0));
+  CopyOptions options = {.threads = (unsigned)state.range(1)};
+  off_t data_size = 0;
+  options.progress = [&data_size](off_t, off_t total) { data_size = total; };
+
+  for (auto _ : state) {
+    CHECK(Copy(from, to, options));
+  }
+  state.SetBytesProcessed(state.iterations() * data_size);
+}
+BENCHMARK(BM_Copy)
+    ->ArgNames({"layout", "threads"})
+    ->ArgsProduct({{kDense, kSparse, kFragmented}, {1, 2, 4, 8}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
@@ -0,0 +1,202 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr off_t kMiB = 1 << 20;
+
+class CopyTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    from_ = std::string(dir_.path) + "/from";
+    to_ = std::string(dir_.path) + "/to";
+  }
+
+  // Writes `size` bytes of a pattern that depends on the offset
+  void WriteData(int fd, off_t offset, off_t size) {
+    std::string data(size, '\0');
+    for (off_t i = 0; i < size; i++) {
+      data[i] = (char)((offset + i) * 7 / 4096);
+    }
+    ASSERT_EQ(pwrite(fd, data.data(), size, offset), size);
+  }
+
+  // A file with a few data extents and holes between them, including a
+  // trailing hole.
+  void CreateSparseFile() {
+    int fd = open(from_.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    WriteData(fd, 0, 3 * kMiB);
+    WriteData(fd, 16 * kMiB, kMiB / 2);
+    WriteData(fd, 40 * kMiB, 5 * kMiB);
+    ASSERT_EQ(ftruncate(fd, 64 * kMiB), 0);
+    close(fd);
+  }
+
+  void ExpectSameContents() {
+    std::string from, to;
+    ASSERT_TRUE(android::base::ReadFileToString(from_, &from));
+    ASSERT_TRUE(android::base::ReadFileToString(to_, &to));
+    ASSERT_EQ(from.size(), to.size());
+    EXPECT_TRUE(from == to);
+  }
+
+  TemporaryDir dir_;
+  std::string from_;
+  std::string to_;
+};
+
+TEST_F(CopyTest, CopiesSparseFile) {
+  CreateSparseFile();
+  ASSERT_TRUE(Copy(from_, to_));
+  ExpectSameContents();
+
+  struct stat st;
+  ASSERT_EQ(stat(to_.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size, 64 * kMiB);
+  // The holes are not filled in
+  EXPECT_LT(st.st_blocks * 512, 32 * kMiB);
+}
+
+TEST_F(CopyTest, CopiesWithAnyNumberOfThreads) {
+  CreateSparseFile();
+  for (unsigned threads : {1u, 2u, 16u}) {
+    CopyOptions options = {.threads = threads, .chunk_size = kMiB};
+    ASSERT_TRUE(Copy(from_, to_, options)) << threads << " threads";
+    ExpectSameContents();
+  }
+}
+
+TEST_F(CopyTest, ReportsProgress) {
+  CreateSparseFile();
+  std::vector<off_t> reported;
+  off_t reported_total = 0;
+  CopyOptions options = {
+      .threads = 4,
+      .chunk_size = kMiB,
+      .progress =
+          [&reported, &reported_total](off_t copied, off_t total) {
+            reported.push_back(copied);
+            reported_total = total;
+          },
+  };
+  ASSERT_TRUE(Copy(from_, to_, options));
+
+  ASSERT_FALSE(reported.empty());
+  // Reported by one worker at a time, in order
+  EXPECT_TRUE(std::is_sorted(reported.begin(), reported.end()));
+  EXPECT_EQ(reported.back(), reported_total);
+  EXPECT_GE(reported_total, 3 * kMiB + kMiB / 2 + 5 * kMiB);
+  EXPECT_LE(reported_total, 64 * kMiB);
+}
+
+TEST_F(CopyTest, CopiesEmptyFile) {
+  ASSERT_TRUE(android::base::WriteStringToFile("", from_));
+  ASSERT_TRUE(android::base::WriteStringToFile("previous contents", to_));
+  ASSERT_TRUE(Copy(from_, to_));
+  EXPECT_EQ(FileSize(to_), 0);
+}
+
+TEST_F(CopyTest, FailsOnMissingSource) {
+  EXPECT_FALSE(Copy(from_, to_));
+}
+
+class WaitTest : public testing::Test {
+ protected:
+  std::string Path(const std::string& name) {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  // Returns a unix socket bound to `path`, listening if `listen` is set.
+  int Bind(const std::string& path, bool listen) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_GE(sock, 0);
+    EXPECT_EQ(bind(sock, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    if (listen) {
+      EXPECT_EQ(::listen(sock, 4), 0);
+    }
+    return sock;
+  }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(WaitTest, WaitsForNestedPaths) {
+  auto first = Path("a/b/first");
+  auto second = Path("second");
+  std::thread creator([this, &first, &second]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(mkdir(Path("a").c_str(), 0755), 0);
+    ASSERT_EQ(mkdir(Path("a/b").c_str(), 0755), 0);
+    ASSERT_TRUE(android::base::WriteStringToFile("", first));
+    ASSERT_TRUE(android::base::WriteStringToFile("", second));
+  });
+  auto result = WaitForFiles({first, second}, 10);
+  creator.join();
+  ASSERT_TRUE(result.ok()) << result.error().Trace();
+}
+
+TEST_F(WaitTest, TimesOutOnMissingFile) {
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(WaitForFile(Path("missing/file"), 1).ok());
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+}
+
+TEST_F(WaitTest, WaitsForSocketsToListen) {
+  auto created = Path("created");
+  auto bound = Path("bound");
+  int bound_sock = Bind(bound, false);
+  int created_sock = -1;
+  std::thread server([this, &created, &created_sock, bound_sock]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    created_sock = Bind(created, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(listen(bound_sock, 4), 0);
+  });
+  auto result = WaitForUnixSockets({created, bound}, 10);
+  server.join();
+  ASSERT_TRUE(result.ok()) << result.error().Trace();
+  close(bound_sock);
+  close(created_sock);
+}
+
+TEST_F(WaitTest, FailsOnFileThatIsNotASocket) {
+  auto path = Path("file");
+  ASSERT_TRUE(android::base::WriteStringToFile("", path));
+  EXPECT_FALSE(WaitForUnixSocket(path, 1).ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
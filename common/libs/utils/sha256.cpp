@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/sha256.h"
+
+#include <fcntl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+std::string HexDigest(const unsigned char* digest, unsigned int size) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string hex;
+  for (unsigned int i = 0; i < size; i++) {
+    hex.push_back(kHex[digest[i] >> 4]);
+    hex.push_back(kHex[digest[i] & 0xf]);
+  }
+  return hex;
+}
+
+}  // namespace
+
+std::string Sha256(const std::string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  EVP_Digest(data.data(), data.size(), digest, &size, EVP_sha256(), nullptr);
+  return HexDigest(digest, size);
+}
+
+Result<std::string> FileSha256(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path << "\": "
+                                              << fd->StrError());
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(),
+                                                              EVP_MD_CTX_free);
+  CF_EXPECT(EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) == 1);
+  std::vector<char> buffer(1 << 20);
+  while (true) {
+    auto read = fd->Read(buffer.data(), buffer.size());
+    CF_EXPECT(read >= 0, "Could not read \"" << path << "\": "
+                                             << fd->StrError());
+    if (read == 0) {
+      break;
+    }
+    CF_EXPECT(EVP_DigestUpdate(ctx.get(), buffer.data(), read) == 1);
+  }
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+  CF_EXPECT(EVP_DigestFinal_ex(ctx.get(), digest, &size) == 1);
+  return HexDigest(digest, size);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Hex encoded sha256 digest of `data`
+std::string Sha256(const std::string& data);
+
+// Hex encoded sha256 digest of the contents of the file at `path`
+Result<std::string> FileSha256(const std::string& path);
+
+}  // namespace cuttlefish
@@ -17,27 +17,40 @@
 #include "host/commands/assemble_cvd/boot_image_utils.h"
 #include "host/libs/config/cuttlefish_config.h"
 
+#include <bootimg.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <regex>
 #include <sstream>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/result.h"
+#include "common/libs/utils/sha256.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/libs/boot_image/boot_image.h"
+#include "host/libs/boot_image/ramdisk.h"
 
 const char TMP_EXTENSION[] = ".tmp";
-const char CPIO_EXT[] = ".cpio";
-const char TMP_RD_DIR[] = "stripped_ramdisk_dir";
-const char STRIPPED_RD[] = "stripped_ramdisk";
 const char CONCATENATED_VENDOR_RAMDISK[] = "concatenated_vendor_ramdisk";
+// Part of the repack cache keys. Change it when the same inputs would be
+// repacked differently.
+const char REPACK_FORMAT_VERSION[] = "2";
 namespace cuttlefish {
 namespace {
+
+// Guards the files unpacked and repacked once into the shared unpack
+// directory, as the disks of several instances may be assembled at once.
+std::mutex unpack_dir_mutex;
+
 std::string ExtractValue(const std::string& dictionary, const std::string& key) {
   std::size_t index = dictionary.find(key);
   if (index != std::string::npos) {
@@ -73,287 +86,388 @@ bool DeleteTmpFileIfNotChanged(const std::string& tmp_file, const std::string& c
   return true;
 }
 
-void RepackVendorRamdisk(const std::string& kernel_modules_ramdisk_path,
-                         const std::string& original_ramdisk_path,
-                         const std::string& new_ramdisk_path,
-                         const std::string& build_dir) {
-  int success = 0;
-  const std::string ramdisk_stage_dir = build_dir + "/" + TMP_RD_DIR;
-  UnpackRamdisk(original_ramdisk_path, ramdisk_stage_dir);
-
-  success = execute({"rm", "-rf", ramdisk_stage_dir + "/lib/modules"});
-  CHECK(success == 0) << "Could not rmdir \"lib/modules\" in TMP_RD_DIR. "
-                      << "Exited with status " << success;
-
-  const std::string stripped_ramdisk_path = build_dir + "/" + STRIPPED_RD;
-  success = execute({"/bin/bash", "-c",
-                     HostBinaryPath("mkbootfs") + " " + ramdisk_stage_dir +
-                         " > " + stripped_ramdisk_path + CPIO_EXT});
-  CHECK(success == 0) << "Unable to run cd or cpio. Exited with status "
-                      << success;
-
-  success = execute({"/bin/bash", "-c", HostBinaryPath("lz4") +
-                     " -c -l -12 --favor-decSpeed " + stripped_ramdisk_path + CPIO_EXT + " > " +
-                     stripped_ramdisk_path});
-  CHECK(success == 0) << "Unable to run lz4. Exited with status " << success;
-
-  // Concatenates the stripped ramdisk and input ramdisk and places the result at new_ramdisk_path
-  std::ofstream final_rd(new_ramdisk_path, std::ios_base::binary | std::ios_base::trunc);
-  std::ifstream ramdisk_a(stripped_ramdisk_path, std::ios_base::binary);
-  std::ifstream ramdisk_b(kernel_modules_ramdisk_path, std::ios_base::binary);
-  final_rd << ramdisk_a.rdbuf() << ramdisk_b.rdbuf();
+Result<std::string> ReadImage(const std::string& path) {
+  std::string contents;
+  CF_EXPECT(android::base::ReadFileToString(path, &contents),
+            "Unable to read \"" << path << "\": " << strerror(errno));
+  return contents;
 }
 
-}  // namespace
-
-void PackRamdisk(const std::string& ramdisk_stage_dir,
-                 const std::string& output_ramdisk) {
-  int success = execute({"/bin/bash", "-c",
-                         HostBinaryPath("mkbootfs") + " " + ramdisk_stage_dir +
-                             " > " + output_ramdisk + CPIO_EXT});
-  CHECK(success == 0) << "Unable to run cd or cpio. Exited with status "
-                      << success;
-
-  success = execute({"/bin/bash", "-c",
-                     HostBinaryPath("lz4") + " -c -l -12 --favor-decSpeed " +
-                         output_ramdisk + CPIO_EXT + " > " + output_ramdisk});
-  CHECK(success == 0) << "Unable to run lz4. Exited with status " << success;
+Result<void> WriteImage(const std::string& path, const std::string& contents) {
+  CF_EXPECT(android::base::WriteStringToFile(contents, path),
+            "Unable to write \"" << path << "\": " << strerror(errno));
+  return {};
 }
 
-void UnpackRamdisk(const std::string& original_ramdisk_path,
-                   const std::string& ramdisk_stage_dir) {
-  int success =
-      execute({"/bin/bash", "-c",
-               HostBinaryPath("lz4") + " -c -d -l " + original_ramdisk_path +
-                   " > " + original_ramdisk_path + CPIO_EXT});
-  CHECK(success == 0) << "Unable to run lz4. Exited with status " << success;
-  const auto ret = EnsureDirectoryExists(ramdisk_stage_dir);
-  CHECK(ret.ok()) << ret.error().Message();
-
-  success = execute(
-      {"/bin/bash", "-c",
-       "(cd " + ramdisk_stage_dir + " && while " + HostBinaryPath("toybox") +
-           " cpio -idu; do :; done) < " + original_ramdisk_path + CPIO_EXT});
-  CHECK(success == 0) << "Unable to run cd or cpio. Exited with status "
-                      << success;
-}
-
-
-bool UnpackBootImage(const std::string& boot_image_path,
-                     const std::string& unpack_dir) {
-  auto unpack_path = HostBinaryPath("unpack_bootimg");
-  Command unpack_cmd(unpack_path);
+// unpack_bootimg is kept for the boot image headers older than v3, which
+// the native parser doesn't handle.
+Result<void> RunUnpackBootimg(const std::string& image_path,
+                              const std::string& unpack_dir,
+                              const std::string& params_file) {
+  Command unpack_cmd(HostBinaryPath("unpack_bootimg"));
   unpack_cmd.AddParameter("--boot_img");
-  unpack_cmd.AddParameter(boot_image_path);
+  unpack_cmd.AddParameter(image_path);
   unpack_cmd.AddParameter("--out");
   unpack_cmd.AddParameter(unpack_dir);
-
-  auto output_file = SharedFD::Creat(unpack_dir + "/boot_params", 0666);
-  if (!output_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create intermediate boot params file: "
-               << output_file->StrError();
-    return false;
-  }
+  auto output_file = SharedFD::Creat(unpack_dir + "/" + params_file, 0666);
+  CF_EXPECT(output_file->IsOpen(),
+            "Unable to create intermediate boot params file: "
+                << output_file->StrError());
   unpack_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, output_file);
-
   int success = unpack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run unpack_bootimg. Exited with status "
-               << success;
-    return false;
-  }
-  return true;
+  CF_EXPECT(success == 0,
+            "Unable to run unpack_bootimg. Exited with status " << success);
+  return {};
 }
 
-bool UnpackVendorBootImageIfNotUnpacked(
-    const std::string& vendor_boot_image_path, const std::string& unpack_dir) {
-  // the vendor boot params file is created during the first unpack. If it's
-  // already there, a unpack has occurred and there's no need to repeat the
-  // process.
-  if (FileExists(unpack_dir + "/vendor_boot_params")) {
-    return true;
+// The params files hold what unpack_bootimg prints, which is where the
+// command lines were read from before the images were parsed natively.
+std::string BootParams(const BootImage& boot) {
+  std::stringstream params;
+  params << "boot magic: " << BOOT_MAGIC << "\n";
+  params << "kernel_size: " << boot.kernel.size() << "\n";
+  params << "ramdisk size: " << boot.ramdisk.size() << "\n";
+  if (boot.os_version != 0) {
+    params << "os version: " << OsVersionString(boot.os_version) << "\n";
+    params << "os patch level: " << OsPatchLevelString(boot.os_version)
+           << "\n";
   }
-
-  auto unpack_path = HostBinaryPath("unpack_bootimg");
-  Command unpack_cmd(unpack_path);
-  unpack_cmd.AddParameter("--boot_img");
-  unpack_cmd.AddParameter(vendor_boot_image_path);
-  unpack_cmd.AddParameter("--out");
-  unpack_cmd.AddParameter(unpack_dir);
-  auto output_file = SharedFD::Creat(unpack_dir + "/vendor_boot_params", 0666);
-  if (!output_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create intermediate vendor boot params file: "
-               << output_file->StrError();
-    return false;
+  params << "boot image header version: " << boot.header_version << "\n";
+  params << "command line args: " << boot.cmdline << "\n";
+  if (boot.header_version >= 4) {
+    params << "boot.img signature size: " << boot.signature.size() << "\n";
   }
-  unpack_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, output_file);
-  int success = unpack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run unpack_bootimg. Exited with status " << success;
-    return false;
+  return params.str();
+}
+
+std::string VendorBootParams(const VendorBootImage& vendor_boot) {
+  std::stringstream params;
+  params << "boot magic: " << VENDOR_BOOT_MAGIC << "\n";
+  params << "vendor boot image header version: " << vendor_boot.header_version
+         << "\n";
+  params << "page size: " << vendor_boot.page_size << "\n";
+  params << "vendor ramdisk total size: " << vendor_boot.Ramdisk().size()
+         << "\n";
+  params << "vendor command line args: " << vendor_boot.cmdline << "\n";
+  params << "product name: " << vendor_boot.name << "\n";
+  params << "dtb size: " << vendor_boot.dtb.size() << "\n";
+  if (vendor_boot.header_version >= 4) {
+    params << "vendor ramdisk table entries: " << vendor_boot.ramdisks.size()
+           << "\n";
+    params << "vendor bootconfig size: " << vendor_boot.bootconfig.size()
+           << "\n";
   }
+  return params.str();
+}
 
-  // Concatenates all vendor ramdisk into one single ramdisk.
-  Command concat_cmd("/bin/bash");
-  concat_cmd.AddParameter("-c");
-  concat_cmd.AddParameter("cat " + unpack_dir + "/vendor_ramdisk*");
-  auto concat_file =
-      SharedFD::Creat(unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK, 0666);
-  if (!concat_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create concatenated vendor ramdisk file: "
-               << concat_file->StrError();
-    return false;
+Result<void> UnpackBootImageToDir(const std::string& boot_image_path,
+                                  const std::string& unpack_dir) {
+  auto image = CF_EXPECT(ReadImage(boot_image_path));
+  if (CF_EXPECT(BootImageHeaderVersion(image)) < 3) {
+    CF_EXPECT(RunUnpackBootimg(boot_image_path, unpack_dir, "boot_params"));
+    return {};
   }
-  concat_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, concat_file);
-  success = concat_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run cat. Exited with status " << success;
-    return false;
+  auto boot = CF_EXPECT(ParseBootImage(image));
+  CF_EXPECT(WriteImage(unpack_dir + "/kernel", boot.kernel));
+  CF_EXPECT(WriteImage(unpack_dir + "/ramdisk", boot.ramdisk));
+  if (!boot.signature.empty()) {
+    CF_EXPECT(WriteImage(unpack_dir + "/boot_signature", boot.signature));
   }
-  return true;
+  CF_EXPECT(WriteImage(unpack_dir + "/boot_params", BootParams(boot)));
+  return {};
 }
 
-bool RepackBootImage(const std::string& new_kernel_path,
-                     const std::string& boot_image_path,
-                     const std::string& new_boot_image_path,
-                     const std::string& build_dir) {
-  if (UnpackBootImage(boot_image_path, build_dir) == false) {
-    return false;
+Result<void> UnpackVendorBootImageToDir(
+    const std::string& vendor_boot_image_path, const std::string& unpack_dir) {
+  auto vendor_boot = CF_EXPECT(
+      ParseVendorBootImage(CF_EXPECT(ReadImage(vendor_boot_image_path))));
+  // Named as unpack_bootimg names them
+  if (vendor_boot.header_version == 3) {
+    CF_EXPECT(WriteImage(unpack_dir + "/vendor_ramdisk",
+                         vendor_boot.ramdisks[0].contents));
+  } else {
+    for (size_t i = 0; i < vendor_boot.ramdisks.size(); i++) {
+      auto name = android::base::StringPrintf("/vendor_ramdisk%02zu", i);
+      CF_EXPECT(WriteImage(unpack_dir + name,
+                           vendor_boot.ramdisks[i].contents));
+    }
+    CF_EXPECT(WriteImage(unpack_dir + "/bootconfig", vendor_boot.bootconfig));
   }
+  CF_EXPECT(WriteImage(unpack_dir + "/dtb", vendor_boot.dtb));
+  CF_EXPECT(WriteImage(unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
+                       vendor_boot.Ramdisk()));
+  // Written last, as its presence marks a complete unpack
+  CF_EXPECT(WriteImage(unpack_dir + "/vendor_boot_params",
+                       VendorBootParams(vendor_boot)));
+  return {};
+}
 
-  std::string boot_params = ReadFile(build_dir + "/boot_params");
-  auto kernel_cmdline = ExtractValue(boot_params, "command line args: ");
-  LOG(DEBUG) << "Cmdline from boot image is " << kernel_cmdline;
-
-  auto tmp_boot_image_path = new_boot_image_path + TMP_EXTENSION;
-  auto repack_path = HostBinaryPath("mkbootimg");
-  Command repack_cmd(repack_path);
-  repack_cmd.AddParameter("--kernel");
-  repack_cmd.AddParameter(new_kernel_path);
-  repack_cmd.AddParameter("--ramdisk");
-  repack_cmd.AddParameter(build_dir + "/ramdisk");
-  repack_cmd.AddParameter("--header_version");
-  repack_cmd.AddParameter("4");
-  repack_cmd.AddParameter("--cmdline");
-  repack_cmd.AddParameter(kernel_cmdline);
-  repack_cmd.AddParameter("-o");
-  repack_cmd.AddParameter(tmp_boot_image_path);
-  int success = repack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run mkbootimg. Exited with status " << success;
-    return false;
+// The vendor boot params file is created last during the first unpack. If
+// it's already there, an unpack has occurred and there's no need to repeat
+// the process.
+Result<void> UnpackVendorBootImageOnce(
+    const std::string& vendor_boot_image_path, const std::string& unpack_dir) {
+  if (!FileExists(unpack_dir + "/vendor_boot_params")) {
+    CF_EXPECT(UnpackVendorBootImageToDir(vendor_boot_image_path, unpack_dir));
   }
+  return {};
+}
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
+// Replaces the kernel modules in the original ramdisk with the ones in the
+// kernel modules ramdisk. The original ramdisk is stripped of lib/modules in
+// memory, and the kernel modules ramdisk is appended so the kernel extracts it
+// over the stripped one.
+Result<void> RepackVendorRamdisk(const std::string& kernel_modules_ramdisk_path,
+                                 const std::string& original_ramdisk_path,
+                                 const std::string& new_ramdisk_path) {
+  auto original = CF_EXPECT(ReadImage(original_ramdisk_path));
+  auto entries = CF_EXPECT(ParseCpio(CF_EXPECT(DecompressRamdisk(original))));
+  RemoveCpioDirectory(entries, "lib/modules");
+  auto stripped = CF_EXPECT(Lz4LegacyCompress(WriteCpio(entries)));
+  auto modules = CF_EXPECT(ReadImage(kernel_modules_ramdisk_path));
+  CF_EXPECT(WriteImage(new_ramdisk_path, stripped + modules));
+  return {};
+}
+
+Result<void> AddHashFooter(const std::string& image_path,
+                           const std::string& original_image_path,
+                           const std::string& partition_name) {
+  Command avb_cmd(HostBinaryPath("avbtool"));
   avb_cmd.AddParameter("add_hash_footer");
   avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_boot_image_path);
+  avb_cmd.AddParameter(image_path);
   avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(boot_image_path));
+  avb_cmd.AddParameter(FileSize(original_image_path));
   avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
-    return false;
-  }
+  avb_cmd.AddParameter(partition_name);
+  int success = avb_cmd.Start().Wait();
+  CF_EXPECT(success == 0,
+            "Unable to run avbtool. Exited with status " << success);
+  return {};
+}
 
-  return DeleteTmpFileIfNotChanged(tmp_boot_image_path, new_boot_image_path);
+// Identifies a repack by the contents of its inputs. The repacked images are
+// derived from nothing else but `options`.
+Result<std::string> RepackCacheKey(const std::string& kind,
+                                   const std::vector<std::string>& inputs,
+                                   const std::string& options) {
+  std::string key = std::string("repack/") + REPACK_FORMAT_VERSION + "/" + kind;
+  for (const auto& input : inputs) {
+    key += "/" + CF_EXPECT(FileSha256(input));
+  }
+  return key + "/" + options;
 }
 
-bool RepackVendorBootImage(const std::string& new_ramdisk,
-                           const std::string& vendor_boot_image_path,
-                           const std::string& new_vendor_boot_image_path,
-                           const std::string& unpack_dir,
-                           bool bootconfig_supported) {
-  if (UnpackVendorBootImageIfNotUnpacked(vendor_boot_image_path, unpack_dir) ==
-      false) {
-    return false;
+// Writes the output of `repack` to `image_path`, or the output of an earlier
+// repack with the same `key` when there is a cache.
+Result<void> RepackThroughCache(
+    ArtifactCache* cache, const std::function<Result<std::string>()>& key,
+    const std::string& image_path,
+    const std::function<Result<void>(const std::string&)>& repack) {
+  if (!cache) {
+    CF_EXPECT(repack(image_path));
+    return {};
   }
+  // The cache places a copy of its own, which the guest may write to
+  RemoveFile(image_path);
+  CF_EXPECT(cache->Fetch(CF_EXPECT(key()), image_path, repack));
+  return {};
+}
 
-  std::string ramdisk_path;
-  if (new_ramdisk.size()) {
-    ramdisk_path = unpack_dir + "/vendor_ramdisk_repacked";
-    if (!FileExists(ramdisk_path)) {
-      RepackVendorRamdisk(new_ramdisk,
-                          unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
-                          ramdisk_path, unpack_dir);
+Result<void> RepackBootImageImpl(const std::string& new_kernel_path,
+                                 const std::string& boot_image_path,
+                                 const std::string& new_boot_image_path,
+                                 const std::string& build_dir,
+                                 ArtifactCache* cache) {
+  auto repack = [&](const std::string& output_path) -> Result<void> {
+    auto image = CF_EXPECT(ReadImage(boot_image_path));
+    BootImage original;
+    if (CF_EXPECT(BootImageHeaderVersion(image)) >= 3) {
+      original = CF_EXPECT(ParseBootImage(image));
+    } else {
+      CF_EXPECT(RunUnpackBootimg(boot_image_path, build_dir, "boot_params"));
+      original.cmdline = ExtractValue(ReadFile(build_dir + "/boot_params"),
+                                      "command line args: ");
+      original.ramdisk = CF_EXPECT(ReadImage(build_dir + "/ramdisk"));
     }
-  } else {
-    ramdisk_path = unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK;
-  }
+    LOG(DEBUG) << "Cmdline from boot image is " << original.cmdline;
+
+    // What mkbootimg made of the kernel, ramdisk and command line alone
+    BootImage repacked;
+    repacked.cmdline = original.cmdline;
+    repacked.kernel = CF_EXPECT(ReadImage(new_kernel_path));
+    repacked.ramdisk = std::move(original.ramdisk);
+    CF_EXPECT(WriteImage(output_path, CF_EXPECT(WriteBootImage(repacked))));
+    CF_EXPECT(AddHashFooter(output_path, boot_image_path, "boot"));
+    return {};
+  };
+  auto key = [&]() {
+    return RepackCacheKey("boot", {new_kernel_path, boot_image_path}, "");
+  };
+  auto tmp_boot_image_path = new_boot_image_path + TMP_EXTENSION;
+  CF_EXPECT(RepackThroughCache(cache, key, tmp_boot_image_path, repack));
+  CF_EXPECT(DeleteTmpFileIfNotChanged(tmp_boot_image_path, new_boot_image_path));
+  return {};
+}
 
-  std::string bootconfig = ReadFile(unpack_dir + "/bootconfig");
-  LOG(DEBUG) << "Bootconfig parameters from vendor boot image are "
-             << bootconfig;
-  std::string vendor_boot_params = ReadFile(unpack_dir + "/vendor_boot_params");
-  auto kernel_cmdline =
-      ExtractValue(vendor_boot_params, "vendor command line args: ") +
-      (bootconfig_supported
-           ? ""
-           : " " + android::base::StringReplace(bootconfig, "\n", " ", true));
-  if (!bootconfig_supported) {
-    // TODO(b/182417593): Until we pass the module parameters through
-    // modules.options, we pass them through bootconfig using
-    // 'kernel.<key>=<value>' But if we don't support bootconfig, we need to
-    // rename them back to the old cmdline version
-    kernel_cmdline = android::base::StringReplace(
-        kernel_cmdline, " kernel.", " ", true);
+Result<void> RepackVendorBootImageImpl(
+    const std::string& new_ramdisk, const std::string& vendor_boot_image_path,
+    const std::string& new_vendor_boot_image_path,
+    const std::string& unpack_dir, bool bootconfig_supported,
+    ArtifactCache* cache) {
+  std::string ramdisk_path;
+  {
+    std::lock_guard<std::mutex> lock(unpack_dir_mutex);
+    CF_EXPECT(UnpackVendorBootImageOnce(vendor_boot_image_path, unpack_dir));
+    if (new_ramdisk.size()) {
+      // One per kernel modules ramdisk, as instances or launches sharing the
+      // unpack directory may each bring their own
+      ramdisk_path = unpack_dir + "/vendor_ramdisk_repacked_" +
+                     CF_EXPECT(FileSha256(new_ramdisk));
+      if (!FileExists(ramdisk_path)) {
+        auto tmp_ramdisk_path = ramdisk_path + TMP_EXTENSION;
+        CF_EXPECT(RepackVendorRamdisk(
+            new_ramdisk, unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
+            tmp_ramdisk_path));
+        CF_EXPECT(RenameFile(tmp_ramdisk_path, ramdisk_path));
+      }
+    } else {
+      ramdisk_path = unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK;
+    }
   }
-  LOG(DEBUG) << "Cmdline from vendor boot image is " << kernel_cmdline;
 
+  auto repack = [&](const std::string& output_path) -> Result<void> {
+    std::string bootconfig = ReadFile(unpack_dir + "/bootconfig");
+    LOG(DEBUG) << "Bootconfig parameters from vendor boot image are "
+               << bootconfig;
+    std::string vendor_boot_params =
+        ReadFile(unpack_dir + "/vendor_boot_params");
+    auto kernel_cmdline =
+        ExtractValue(vendor_boot_params, "vendor command line args: ") +
+        (bootconfig_supported
+             ? ""
+             : " " + android::base::StringReplace(bootconfig, "\n", " ", true));
+    if (!bootconfig_supported) {
+      // TODO(b/182417593): Until we pass the module parameters through
+      // modules.options, we pass them through bootconfig using
+      // 'kernel.<key>=<value>' But if we don't support bootconfig, we need to
+      // rename them back to the old cmdline version
+      kernel_cmdline = android::base::StringReplace(
+          kernel_cmdline, " kernel.", " ", true);
+    }
+    LOG(DEBUG) << "Cmdline from vendor boot image is " << kernel_cmdline;
+
+    // What mkbootimg made of a single --vendor_ramdisk, the command line, dtb
+    // and bootconfig
+    VendorBootImage repacked;
+    repacked.cmdline = kernel_cmdline;
+    repacked.ramdisks.push_back(VendorRamdisk{
+        .type = VENDOR_RAMDISK_TYPE_PLATFORM,
+        .contents = CF_EXPECT(ReadImage(ramdisk_path)),
+    });
+    repacked.dtb = ReadFile(unpack_dir + "/dtb");
+    if (bootconfig_supported) {
+      repacked.bootconfig = bootconfig;
+    }
+    CF_EXPECT(
+        WriteImage(output_path, CF_EXPECT(WriteVendorBootImage(repacked))));
+    CF_EXPECT(AddHashFooter(output_path, vendor_boot_image_path,
+                            "vendor_boot"));
+    return {};
+  };
+  // Keyed on the ramdisk that is packed rather than the one passed in
+  auto key = [&]() -> Result<std::string> {
+    return CF_EXPECT(
+        RepackCacheKey("vendor_boot", {vendor_boot_image_path, ramdisk_path},
+                       bootconfig_supported ? "bootconfig" : "cmdline"));
+  };
   auto tmp_vendor_boot_image_path = new_vendor_boot_image_path + TMP_EXTENSION;
-  auto repack_path = HostBinaryPath("mkbootimg");
-  Command repack_cmd(repack_path);
-  repack_cmd.AddParameter("--vendor_ramdisk");
-  repack_cmd.AddParameter(ramdisk_path);
-  repack_cmd.AddParameter("--header_version");
-  repack_cmd.AddParameter("4");
-  repack_cmd.AddParameter("--vendor_cmdline");
-  repack_cmd.AddParameter(kernel_cmdline);
-  repack_cmd.AddParameter("--vendor_boot");
-  repack_cmd.AddParameter(tmp_vendor_boot_image_path);
-  repack_cmd.AddParameter("--dtb");
-  repack_cmd.AddParameter(unpack_dir + "/dtb");
-  if (bootconfig_supported) {
-    repack_cmd.AddParameter("--vendor_bootconfig");
-    repack_cmd.AddParameter(unpack_dir + "/bootconfig");
+  CF_EXPECT(
+      RepackThroughCache(cache, key, tmp_vendor_boot_image_path, repack));
+  CF_EXPECT(DeleteTmpFileIfNotChanged(tmp_vendor_boot_image_path,
+                                      new_vendor_boot_image_path));
+  return {};
+}
+
+}  // namespace
+
+void PackRamdisk(const std::string& ramdisk_stage_dir,
+                 const std::string& output_ramdisk) {
+  auto result = PackRamdiskDirectory(ramdisk_stage_dir, output_ramdisk);
+  CHECK(result.ok()) << "Unable to pack \"" << ramdisk_stage_dir
+                     << "\": " << result.error().Message();
+}
+
+void UnpackRamdisk(const std::string& original_ramdisk_path,
+                   const std::string& ramdisk_stage_dir) {
+  auto result = ExtractRamdisk(original_ramdisk_path, ramdisk_stage_dir);
+  CHECK(result.ok()) << "Unable to unpack \"" << original_ramdisk_path
+                     << "\": " << result.error().Message();
+}
+
+bool UnpackBootImage(const std::string& boot_image_path,
+                     const std::string& unpack_dir) {
+  auto result = UnpackBootImageToDir(boot_image_path, unpack_dir);
+  if (!result.ok()) {
+    LOG(ERROR) << "Unable to unpack \"" << boot_image_path
+               << "\": " << result.error().Message();
+    return false;
   }
+  return true;
+}
 
-  int success = repack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run mkbootimg. Exited with status " << success;
+bool UnpackVendorBootImageIfNotUnpacked(
+    const std::string& vendor_boot_image_path, const std::string& unpack_dir) {
+  std::lock_guard<std::mutex> lock(unpack_dir_mutex);
+  auto result = UnpackVendorBootImageOnce(vendor_boot_image_path, unpack_dir);
+  if (!result.ok()) {
+    LOG(ERROR) << "Unable to unpack \"" << vendor_boot_image_path
+               << "\": " << result.error().Message();
     return false;
   }
+  return true;
+}
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
-  avb_cmd.AddParameter("add_hash_footer");
-  avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_vendor_boot_image_path);
-  avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(vendor_boot_image_path));
-  avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("vendor_boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+bool RepackBootImage(const std::string& new_kernel_path,
+                     const std::string& boot_image_path,
+                     const std::string& new_boot_image_path,
+                     const std::string& build_dir, ArtifactCache* cache) {
+  auto result = RepackBootImageImpl(new_kernel_path, boot_image_path,
+                                    new_boot_image_path, build_dir, cache);
+  if (!result.ok()) {
+    LOG(ERROR) << "Unable to repack \"" << boot_image_path
+               << "\": " << result.error().Message();
     return false;
   }
+  return true;
+}
 
-  return DeleteTmpFileIfNotChanged(tmp_vendor_boot_image_path, new_vendor_boot_image_path);
+bool RepackVendorBootImage(const std::string& new_ramdisk,
+                           const std::string& vendor_boot_image_path,
+                           const std::string& new_vendor_boot_image_path,
+                           const std::string& unpack_dir,
+                           bool bootconfig_supported, ArtifactCache* cache) {
+  auto result = RepackVendorBootImageImpl(
+      new_ramdisk, vendor_boot_image_path, new_vendor_boot_image_path,
+      unpack_dir, bootconfig_supported, cache);
+  if (!result.ok()) {
+    LOG(ERROR) << "Unable to repack \"" << vendor_boot_image_path
+               << "\": " << result.error().Message();
+    return false;
+  }
+  return true;
 }
 
 bool RepackVendorBootImageWithEmptyRamdisk(
     const std::string& vendor_boot_image_path,
     const std::string& new_vendor_boot_image_path,
-    const std::string& unpack_dir, bool bootconfig_supported) {
+    const std::string& unpack_dir, bool bootconfig_supported,
+    ArtifactCache* cache) {
   auto empty_ramdisk_file =
       SharedFD::Creat(unpack_dir + "/empty_ramdisk", 0666);
   return RepackVendorBootImage(
       unpack_dir + "/empty_ramdisk", vendor_boot_image_path,
-      new_vendor_boot_image_path, unpack_dir, bootconfig_supported);
+      new_vendor_boot_image_path, unpack_dir, bootconfig_supported, cache);
 }
 
 void RepackGem5BootImage(const std::string& initrd_path,
@@ -369,11 +483,17 @@ void RepackGem5BootImage(const std::string& initrd_path,
                              std::ios_base::binary);
   std::string new_ramdisk_path = unpack_dir + "/vendor_ramdisk_repacked";
   // Test to make sure new ramdisk hasn't already been repacked if input ramdisk is provided
+  std::unique_lock<std::mutex> lock(unpack_dir_mutex);
   if (FileExists(input_ramdisk_path) && !FileExists(new_ramdisk_path)) {
-    RepackVendorRamdisk(input_ramdisk_path,
-                        unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
-                        new_ramdisk_path, unpack_dir);
+    auto result = RepackVendorRamdisk(
+        input_ramdisk_path, unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
+        new_ramdisk_path);
+    if (!result.ok()) {
+      LOG(ERROR) << "Unable to repack the vendor ramdisk: "
+                 << result.error().Message();
+    }
   }
+  lock.unlock();
   std::ifstream vendor_boot_ramdisk(FileExists(new_ramdisk_path) ? new_ramdisk_path : unpack_dir +
                                     "/concatenated_vendor_ramdisk",
                                     std::ios_base::binary);
@@ -430,27 +550,36 @@ void RepackGem5BootImage(const std::string& initrd_path,
 
 Result<std::string> ReadAndroidVersionFromBootImage(
     const std::string& boot_image_path) {
-  // temp dir path length is chosen to be larger than sun_path_length (108)
-  char tmp_dir[200];
-  sprintf(tmp_dir, "%s/XXXXXX", StringFromEnv("TEMP", "/tmp").c_str());
-  char* unpack_dir = mkdtemp(tmp_dir);
-  if (!unpack_dir) {
-    return CF_ERR("boot image unpack dir could not be created");
-  }
-  bool unpack_status = UnpackBootImage(boot_image_path, unpack_dir);
-  if (!unpack_status) {
-    RecursivelyRemoveDirectory(unpack_dir);
-    return CF_ERR("\"" + boot_image_path + "\" boot image unpack into \"" +
-                  unpack_dir + "\" failed");
-  }
+  std::string os_version;
+  auto image = CF_EXPECT(ReadImage(boot_image_path));
+  if (CF_EXPECT(BootImageHeaderVersion(image)) >= 3) {
+    auto boot = CF_EXPECT(ParseBootImage(image));
+    if (boot.os_version != 0) {
+      os_version = OsVersionString(boot.os_version);
+    }
+  } else {
+    // temp dir path length is chosen to be larger than sun_path_length (108)
+    char tmp_dir[200];
+    sprintf(tmp_dir, "%s/XXXXXX", StringFromEnv("TEMP", "/tmp").c_str());
+    char* unpack_dir = mkdtemp(tmp_dir);
+    if (!unpack_dir) {
+      return CF_ERR("boot image unpack dir could not be created");
+    }
+    bool unpack_status = UnpackBootImage(boot_image_path, unpack_dir);
+    if (!unpack_status) {
+      RecursivelyRemoveDirectory(unpack_dir);
+      return CF_ERR("\"" + boot_image_path + "\" boot image unpack into \"" +
+                    unpack_dir + "\" failed");
+    }
 
-  // dirty hack to read out boot params
-  size_t dir_path_len = strlen(tmp_dir);
-  std::string boot_params = ReadFile(strcat(unpack_dir, "/boot_params"));
-  unpack_dir[dir_path_len] = '\0';
+    // dirty hack to read out boot params
+    size_t dir_path_len = strlen(tmp_dir);
+    std::string boot_params = ReadFile(strcat(unpack_dir, "/boot_params"));
+    unpack_dir[dir_path_len] = '\0';
 
-  RecursivelyRemoveDirectory(unpack_dir);
-  std::string os_version = ExtractValue(boot_params, "os version: ");
+    RecursivelyRemoveDirectory(unpack_dir);
+    os_version = ExtractValue(boot_params, "os version: ");
+  }
   CF_EXPECT(os_version != "", "Could not extract os version from \"" + boot_image_path + "\"");
   std::regex re("[1-9][0-9]*.[0-9]+.[0-9]+");
   CF_EXPECT(std::regex_match(os_version, re), "Version string is not a valid version \"" + os_version + "\"");
@@ -19,6 +19,7 @@
 #include <vector>
 
 #include "common/libs/utils/result.h"
+#include "host/libs/web/artifact_cache.h"
 
 namespace cuttlefish {
 
@@ -26,19 +27,24 @@ namespace cuttlefish {
 // headers
 static constexpr size_t VBMETA_MAX_SIZE = 65536ul;
 
+// The repack functions take the images from `cache`, when given, if the same
+// inputs were repacked before.
 bool RepackBootImage(const std::string& new_kernel_path,
                      const std::string& boot_image_path,
                      const std::string& new_boot_image_path,
-                     const std::string& tmp_artifact_dir);
+                     const std::string& tmp_artifact_dir,
+                     ArtifactCache* cache = nullptr);
 bool RepackVendorBootImage(const std::string& new_ramdisk_path,
                            const std::string& vendor_boot_image_path,
                            const std::string& new_vendor_boot_image_path,
                            const std::string& unpack_dir,
-                           bool bootconfig_supported);
+                           bool bootconfig_supported,
+                           ArtifactCache* cache = nullptr);
 bool RepackVendorBootImageWithEmptyRamdisk(
     const std::string& vendor_boot_image_path,
     const std::string& new_vendor_boot_image_path,
-    const std::string& unpack_dir, bool bootconfig_supported);
+    const std::string& unpack_dir, bool bootconfig_supported,
+    ArtifactCache* cache = nullptr);
 bool UnpackBootImage(const std::string& boot_image_path,
                      const std::string& unpack_dir);
 bool UnpackVendorBootImageIfNotUnpacked(
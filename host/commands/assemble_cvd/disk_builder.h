@@ -36,9 +36,6 @@ class DiskBuilder {
   DiskBuilder& FooterPath(std::string footer_path) &;
   DiskBuilder FooterPath(std::string footer_path) &&;
 
-  DiskBuilder& CrosvmPath(std::string crosvm_path) &;
-  DiskBuilder CrosvmPath(std::string crosvm_path) &&;
-
   DiskBuilder& VmManager(std::string vm_manager) &;
   DiskBuilder VmManager(std::string vm_manager) &&;
 
@@ -67,7 +64,6 @@ class DiskBuilder {
   std::string header_path_;
   std::string footer_path_;
   std::string vm_manager_;
-  std::string crosvm_path_;
   std::string config_path_;
   std::string composite_disk_path_;
   std::string overlay_path_;
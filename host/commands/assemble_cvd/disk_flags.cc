@@ -22,11 +22,11 @@
 #include <android-base/strings.h>
 #include <fruit/fruit.h>
 #include <gflags/gflags.h>
-#include <sys/statvfs.h>
 
 #include <fstream>
 
 #include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/size_utils.h"
 #include "common/libs/utils/subprocess.h"
@@ -34,6 +34,7 @@
 #include "host/commands/assemble_cvd/boot_image_utils.h"
 #include "host/commands/assemble_cvd/disk_builder.h"
 #include "host/commands/assemble_cvd/flags_defaults.h"
+#include "host/commands/assemble_cvd/instance_assembly.h"
 #include "host/commands/assemble_cvd/super_image_mixer.h"
 #include "host/commands/assemble_cvd/vendor_dlkm_utils.h"
 #include "host/libs/config/bootconfig_args.h"
@@ -42,6 +43,7 @@
 #include "host/libs/config/inject.h"
 #include "host/libs/config/instance_nums.h"
 #include "host/libs/vm_manager/gem5_manager.h"
+#include "host/libs/web/artifact_cache.h"
 
 
 // Taken from external/avb/avbtool.py; this define is not in the headers
@@ -108,6 +110,16 @@ DEFINE_string(blank_metadata_image_mb, CF_DEFAULTS_BLANK_METADATA_IMAGE_MB,
 DEFINE_string(
     blank_sdcard_image_mb, CF_DEFAULTS_BLANK_SDCARD_IMAGE_MB,
     "If enabled, the size of the blank sdcard image to generate, MB.");
+DEFINE_string(boot_repack_cache, CF_DEFAULTS_BOOT_REPACK_CACHE,
+              "Host-wide directory keeping boot and vendor_boot images "
+              "repacked with a custom kernel or ramdisk, so that relaunching "
+              "with the same inputs skips the repack. Empty to always repack.");
+DEFINE_int32(boot_repack_cache_size_mb, CF_DEFAULTS_BOOT_REPACK_CACHE_SIZE_MB,
+             "Least recently used images are evicted from the boot repack "
+             "cache past this size, MB.");
+DEFINE_int32(disk_assembly_threads, CF_DEFAULTS_DISK_ASSEMBLY_THREADS,
+             "How many instances to assemble disks for at the same time. 0 "
+             "for one per core.");
 
 DECLARE_string(ap_rootfs_image);
 DECLARE_string(bootloader);
@@ -384,7 +396,6 @@ DiskBuilder OsCompositeDiskBuilder(const CuttlefishConfig& config,
   return DiskBuilder()
       .Partitions(GetOsCompositeDiskConfig(instance))
       .VmManager(config.vm_manager())
-      .CrosvmPath(instance.crosvm_binary())
       .ConfigPath(instance.PerInstancePath("os_composite_disk_config.txt"))
       .HeaderPath(instance.PerInstancePath("os_composite_gpt_header.img"))
       .FooterPath(instance.PerInstancePath("os_composite_gpt_footer.img"))
@@ -397,7 +408,6 @@ DiskBuilder ApCompositeDiskBuilder(const CuttlefishConfig& config,
   return DiskBuilder()
       .Partitions(GetApCompositeDiskConfig(config, instance))
       .VmManager(config.vm_manager())
-      .CrosvmPath(instance.crosvm_binary())
       .ConfigPath(instance.PerInstancePath("ap_composite_disk_config.txt"))
       .HeaderPath(instance.PerInstancePath("ap_composite_gpt_header.img"))
       .FooterPath(instance.PerInstancePath("ap_composite_gpt_footer.img"))
@@ -455,18 +465,6 @@ std::vector<ImagePartition> persistent_ap_composite_disk_config(
   return partitions;
 }
 
-static uint64_t AvailableSpaceAtPath(const std::string& path) {
-  struct statvfs vfs {};
-  if (statvfs(path.c_str(), &vfs) != 0) {
-    int error_num = errno;
-    LOG(ERROR) << "Could not find space available at " << path << ", error was "
-               << strerror(error_num);
-    return 0;
-  }
-  // f_frsize (block size) * f_bavail (free blocks) for unprivileged users.
-  return static_cast<uint64_t>(vfs.f_frsize) * vfs.f_bavail;
-}
-
 class KernelRamdiskRepacker : public SetupFeature {
  public:
   INJECT(
@@ -538,6 +536,22 @@ class KernelRamdiskRepacker : public SetupFeature {
         google::FlagSettingMode::SET_FLAGS_DEFAULT);
     return true;
   }
+  // A cache that can't be opened only costs the repack, so it isn't fatal.
+  std::unique_ptr<ArtifactCache> OpenRepackCache() {
+    if (FLAGS_boot_repack_cache.empty() ||
+        FLAGS_boot_repack_cache_size_mb <= 0) {
+      return {};
+    }
+    auto cache = ArtifactCache::Open(
+        FLAGS_boot_repack_cache,
+        (std::uint64_t)FLAGS_boot_repack_cache_size_mb << 20);
+    if (!cache.ok()) {
+      LOG(WARNING) << "Not caching repacked boot images: "
+                   << cache.error().Message();
+      return {};
+    }
+    return std::move(*cache);
+  }
   bool Setup() override {
     if (!FileHasContent(instance_.boot_image())) {
       LOG(ERROR) << "File not found: " << instance_.boot_image();
@@ -554,6 +568,8 @@ class KernelRamdiskRepacker : public SetupFeature {
       return false;
     }
 
+    auto repack_cache = OpenRepackCache();
+
     // Repacking a boot.img doesn't work with Gem5 because the user must always
     // specify a vmlinux instead of an arm64 Image, and that file can be too
     // large to be repacked. Skip repack of boot.img on Gem5, as we need to be
@@ -564,7 +580,8 @@ class KernelRamdiskRepacker : public SetupFeature {
       const std::string new_boot_image_path = instance_.new_boot_image();
       bool success =
           RepackBootImage(instance_.kernel_path(), instance_.boot_image(),
-                          new_boot_image_path, instance_.instance_dir());
+                          new_boot_image_path, instance_.instance_dir(),
+                          repack_cache.get());
       if (!success) {
         LOG(ERROR) << "Failed to regenerate the boot image with the new kernel";
         return false;
@@ -594,7 +611,7 @@ class KernelRamdiskRepacker : public SetupFeature {
         bool success = RepackVendorBootImage(
             ramdisk_repacked, instance_.vendor_boot_image(),
             new_vendor_boot_image_path, config_.assembly_dir(),
-            instance_.bootconfig_supported());
+            instance_.bootconfig_supported(), repack_cache.get());
         if (!success) {
           LOG(ERROR) << "Failed to regenerate the vendor boot image with the "
                         "new ramdisk";
@@ -604,7 +621,8 @@ class KernelRamdiskRepacker : public SetupFeature {
           // ramdisk.
           bool success = RepackVendorBootImageWithEmptyRamdisk(
               instance_.vendor_boot_image(), new_vendor_boot_image_path,
-              config_.assembly_dir(), instance_.bootconfig_supported());
+              config_.assembly_dir(), instance_.bootconfig_supported(),
+              repack_cache.get());
           if (!success) {
             LOG(ERROR) << "Failed to regenerate the vendor boot image without "
                           "a ramdisk";
@@ -627,8 +645,9 @@ class KernelRamdiskRepacker : public SetupFeature {
 class Gem5ImageUnpacker : public SetupFeature {
  public:
   INJECT(Gem5ImageUnpacker(const CuttlefishConfig& config,
+                           const CuttlefishConfig::InstanceSpecific& instance,
                            KernelRamdiskRepacker& bir))
-      : config_(config), bir_(bir) {}
+      : config_(config), instance_(instance), bir_(bir) {}
 
   // SetupFeature
   std::string Name() const override { return "Gem5ImageUnpacker"; }
@@ -640,15 +659,15 @@ class Gem5ImageUnpacker : public SetupFeature {
   }
 
   bool Enabled() const override {
-    // Everything has a bootloader except gem5, so only run this for gem5
-    return config_.vm_manager() == Gem5Manager::name();
+    // Everything has a bootloader except gem5, so only run this for gem5. The
+    // images are unpacked into the assembly directory once, from the default
+    // instance.
+    return config_.vm_manager() == Gem5Manager::name() &&
+           instance_.id() == config_.ForDefaultInstance().id();
   }
 
  protected:
   Result<void> ResultSetup() override {
-    const CuttlefishConfig::InstanceSpecific& instance_ =
-        config_.ForDefaultInstance();
-
     /* Unpack the original or repacked boot and vendor boot ramdisks, so that
      * we have access to the baked bootconfig and raw compressed ramdisks.
      * This allows us to emulate what a bootloader would normally do, which
@@ -702,6 +721,7 @@ class Gem5ImageUnpacker : public SetupFeature {
 
  private:
   const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
   KernelRamdiskRepacker& bir_;
 };
 
@@ -1076,7 +1096,6 @@ class InitializeInstanceCompositeDisk : public SetupFeature {
         DiskBuilder()
             .Partitions(persistent_composite_disk_config(instance_))
             .VmManager(config_.vm_manager())
-            .CrosvmPath(instance_.crosvm_binary())
             .ConfigPath(ipath("persistent_composite_disk_config.txt"))
             .HeaderPath(ipath("persistent_composite_gpt_header.img"))
             .FooterPath(ipath("persistent_composite_gpt_footer.img"))
@@ -1089,7 +1108,6 @@ class InitializeInstanceCompositeDisk : public SetupFeature {
         DiskBuilder()
             .Partitions(persistent_ap_composite_disk_config(instance_))
             .VmManager(config_.vm_manager())
-            .CrosvmPath(instance_.crosvm_binary())
             .ConfigPath(ipath("ap_persistent_composite_disk_config.txt"))
             .HeaderPath(ipath("ap_persistent_composite_gpt_header.img"))
             .FooterPath(ipath("ap_persistent_composite_gpt_footer.img"))
@@ -1464,86 +1482,129 @@ Result<void> DiskImageFlagsVectorization(CuttlefishConfig& config, const Fetcher
   return {};
 }
 
-Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
-                                    const CuttlefishConfig& config) {
-  for (const auto& instance : config.Instances()) {
-    // TODO(schuffelen): Unify this with the other injector created in
-    // assemble_cvd.cpp
-    fruit::Injector<> injector(DiskChangesComponent, &fetcher_config, &config,
-                               &instance);
-    for (auto& late_injected : injector.getMultibindings<LateInjected>()) {
-      CF_EXPECT(late_injected->LateInject(injector));
-    }
-
-    const auto& features = injector.getMultibindings<SetupFeature>();
-    CF_EXPECT(SetupFeature::RunSetup(features));
-    fruit::Injector<> instance_injector(DiskChangesPerInstanceComponent,
-                                        &fetcher_config, &config, &instance);
-    for (auto& late_injected :
-         instance_injector.getMultibindings<LateInjected>()) {
-      CF_EXPECT(late_injected->LateInject(instance_injector));
-    }
-
-    const auto& instance_features =
-        instance_injector.getMultibindings<SetupFeature>();
-    CF_EXPECT(SetupFeature::RunSetup(instance_features),
-              "instance = \"" << instance.instance_name() << "\"");
-
-    // Check if filling in the sparse image would run out of disk space.
-    auto existing_sizes = SparseFileSizes(instance.data_image());
-    CF_EXPECT(existing_sizes.sparse_size > 0 || existing_sizes.disk_size > 0,
-              "Unable to determine size of \"" << instance.data_image()
-                                               << "\". Does this file exist?");
-    auto available_space = AvailableSpaceAtPath(instance.data_image());
-    if (available_space <
-        existing_sizes.sparse_size - existing_sizes.disk_size) {
-      // TODO(schuffelen): Duplicate this check in run_cvd when it can run on a
-      // separate machine
-      return CF_ERR("Not enough space remaining in fs containing \""
-                    << instance.data_image() << "\", wanted "
-                    << (existing_sizes.sparse_size - existing_sizes.disk_size)
-                    << ", got " << available_space);
-    } else {
-      LOG(DEBUG) << "Available space: " << available_space;
-      LOG(DEBUG) << "Sparse size of \"" << instance.data_image()
-                 << "\": " << existing_sizes.sparse_size;
-      LOG(DEBUG) << "Disk size of \"" << instance.data_image()
-                 << "\": " << existing_sizes.disk_size;
-    }
+static Result<void> AssembleInstanceDisks(
+    const FetcherConfig& fetcher_config, const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    DiskSpaceBudget& space_budget, AssemblyTimer& timer) {
+  // TODO(schuffelen): Unify this with the other injector created in
+  // assemble_cvd.cpp
+  fruit::Injector<> injector(DiskChangesComponent, &fetcher_config, &config,
+                             &instance);
+  for (auto& late_injected : injector.getMultibindings<LateInjected>()) {
+    CF_EXPECT(late_injected->LateInject(injector));
+  }
 
-    auto os_disk_builder = OsCompositeDiskBuilder(config, instance);
-    const auto os_built_composite = CF_EXPECT(os_disk_builder.BuildCompositeDiskIfNecessary());
+  const auto& features = injector.getMultibindings<SetupFeature>();
+  CF_EXPECT(timer.Time("setup", [&features]() {
+    return SetupFeature::RunSetup(features);
+  }));
+  fruit::Injector<> instance_injector(DiskChangesPerInstanceComponent,
+                                      &fetcher_config, &config, &instance);
+  for (auto& late_injected :
+       instance_injector.getMultibindings<LateInjected>()) {
+    CF_EXPECT(late_injected->LateInject(instance_injector));
+  }
 
-    auto ap_disk_builder = ApCompositeDiskBuilder(config, instance);
-    if (instance.ap_boot_flow() != APBootFlow::None) {
-      CF_EXPECT(ap_disk_builder.BuildCompositeDiskIfNecessary());
-    }
+  const auto& instance_features =
+      instance_injector.getMultibindings<SetupFeature>();
+  CF_EXPECT(timer.Time("instance setup", [&instance_features]() {
+    return SetupFeature::RunSetup(instance_features);
+  }));
+
+  // Check if filling in the sparse image would run out of disk space.
+  auto existing_sizes = SparseFileSizes(instance.data_image());
+  CF_EXPECT(existing_sizes.sparse_size > 0 || existing_sizes.disk_size > 0,
+            "Unable to determine size of \"" << instance.data_image()
+                                             << "\". Does this file exist?");
+  LOG(DEBUG) << "Sparse size of \"" << instance.data_image()
+             << "\": " << existing_sizes.sparse_size;
+  LOG(DEBUG) << "Disk size of \"" << instance.data_image()
+             << "\": " << existing_sizes.disk_size;
+  // TODO(schuffelen): Duplicate this check in run_cvd when it can run on a
+  // separate machine
+  CF_EXPECT(space_budget.Reserve(
+      instance.data_image(),
+      std::max<off_t>(0, existing_sizes.sparse_size - existing_sizes.disk_size)));
+
+  auto os_disk_builder = OsCompositeDiskBuilder(config, instance);
+  auto ap_disk_builder = ApCompositeDiskBuilder(config, instance);
+  const auto os_built_composite =
+      CF_EXPECT(timer.Time("composite disks", [&]() -> Result<bool> {
+        auto built = CF_EXPECT(os_disk_builder.BuildCompositeDiskIfNecessary());
+        if (instance.ap_boot_flow() != APBootFlow::None) {
+          CF_EXPECT(ap_disk_builder.BuildCompositeDiskIfNecessary());
+        }
+        return built;
+      }));
 
-    if (os_built_composite) {
-      if (FileExists(instance.access_kregistry_path())) {
-        CF_EXPECT(CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */,
-                                   "none"),
-                  "Failed for \"" << instance.access_kregistry_path() << "\"");
-      }
-      if (FileExists(instance.hwcomposer_pmem_path())) {
-        CF_EXPECT(CreateBlankImage(instance.hwcomposer_pmem_path(), 2 /* mb */,
-                                   "none"),
-                  "Failed for \"" << instance.hwcomposer_pmem_path() << "\"");
-      }
-      if (FileExists(instance.pstore_path())) {
-        CF_EXPECT(CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none"),
-                  "Failed for\"" << instance.pstore_path() << "\"");
-      }
+  if (os_built_composite) {
+    if (FileExists(instance.access_kregistry_path())) {
+      CF_EXPECT(CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */,
+                                 "none"),
+                "Failed for \"" << instance.access_kregistry_path() << "\"");
+    }
+    if (FileExists(instance.hwcomposer_pmem_path())) {
+      CF_EXPECT(CreateBlankImage(instance.hwcomposer_pmem_path(), 2 /* mb */,
+                                 "none"),
+                "Failed for \"" << instance.hwcomposer_pmem_path() << "\"");
+    }
+    if (FileExists(instance.pstore_path())) {
+      CF_EXPECT(CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none"),
+                "Failed for\"" << instance.pstore_path() << "\"");
     }
+  }
 
-    if (!instance.protected_vm()) {
+  if (!instance.protected_vm()) {
+    CF_EXPECT(timer.Time("overlays", [&]() -> Result<void> {
       os_disk_builder.OverlayPath(instance.PerInstancePath("overlay.img"));
       CF_EXPECT(os_disk_builder.BuildOverlayIfNecessary());
       if (instance.ap_boot_flow() != APBootFlow::None) {
         ap_disk_builder.OverlayPath(instance.PerInstancePath("ap_overlay.img"));
         CF_EXPECT(ap_disk_builder.BuildOverlayIfNecessary());
       }
-    }
+      return {};
+    }));
+  }
+  return {};
+}
+
+Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
+                                    const CuttlefishConfig& config) {
+  // Besides the files they read and the free space, the instances share:
+  //  - the vendor boot unpack directory, which boot_image_utils serializes,
+  //  - the combined target files, which RebuildSuperImage serializes,
+  //  - the flags KernelRamdiskRepacker sets, which gflags serializes,
+  //  - the images Gem5ImageUnpacker unpacks into the assembly directory.
+  // The default instance unpacks the latter on its own, before the others
+  // start, so nothing reads them half written.
+  const auto instances = config.Instances();
+  const auto default_id = config.ForDefaultInstance().id();
+  DiskSpaceBudget space_budget;
+  std::vector<InstanceAssembly> first;
+  std::vector<InstanceAssembly> assemblies;
+  for (const auto& instance : instances) {
+    auto& batch = config.vm_manager() == Gem5Manager::name() &&
+                          instance.id() == default_id
+                      ? first
+                      : assemblies;
+    batch.push_back(InstanceAssembly{
+        .name = instance.instance_name(),
+        .assemble =
+            [&fetcher_config, &config, &instance,
+             &space_budget](AssemblyTimer& timer) -> Result<void> {
+          CF_EXPECT(AssembleInstanceDisks(fetcher_config, config, instance,
+                                          space_budget, timer),
+                    "instance = \"" << instance.instance_name() << "\"");
+          return {};
+        },
+    });
+  }
+  if (!first.empty()) {
+    CF_EXPECT(AssembleInstances(first, 1));
+  }
+  if (!assemblies.empty()) {
+    CF_EXPECT(AssembleInstances(assemblies,
+                                std::max(0, FLAGS_disk_assembly_threads)));
   }
 
   for (auto instance : config.Instances()) {
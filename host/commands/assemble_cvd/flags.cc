@@ -22,6 +22,7 @@
 #include <gflags/gflags.h>
 #include <json/json.h>
 #include <json/writer.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -40,11 +41,13 @@
 
 #include "launch_cvd.pb.h"
 
+#include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/base64.h"
 #include "common/libs/utils/contains.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/network.h"
+#include "common/libs/utils/subprocess.h"
 #include "flags.h"
 #include "flags_defaults.h"
 #include "host/commands/assemble_cvd/alloc.h"
@@ -56,6 +59,7 @@
 #include "host/libs/config/esp.h"
 #include "host/libs/config/host_tools_version.h"
 #include "host/libs/config/instance_nums.h"
+#include "host/libs/graphics_detector/graphics_availability_cache.h"
 #include "host/libs/graphics_detector/graphics_configuration.h"
 #include "host/libs/graphics_detector/graphics_detector.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
@@ -137,6 +141,11 @@ DEFINE_vec(hwcomposer, CF_DEFAULTS_HWCOMPOSER,
 DEFINE_vec(gpu_capture_binary, CF_DEFAULTS_GPU_CAPTURE_BINARY,
               "Path to the GPU capture binary to use when capturing GPU traces"
               "(ngfx, renderdoc, etc)");
+DEFINE_string(graphics_detection_cache,
+              CF_DEFAULTS_GRAPHICS_DETECTION_CACHE,
+              "File caching the host graphics capabilities between launches. "
+              "It is probed again when the host drivers change. Empty to "
+              "probe on every launch.");
 DEFINE_vec(enable_gpu_udmabuf,
            cuttlefish::BoolToString(CF_DEFAULTS_ENABLE_GPU_UDMABUF),
            "Use the udmabuf driver for zero-copy virtio-gpu");
@@ -161,6 +170,10 @@ DEFINE_int32(
     "with rootcanal_instance_num. Else, launch a new rootcanal instance");
 DEFINE_string(rootcanal_args, CF_DEFAULTS_ROOTCANAL_ARGS,
               "Space-separated list of rootcanal args. ");
+DEFINE_bool(pin_host_cpus, CF_DEFAULTS_PIN_HOST_CPUS,
+            "Give each instance of the group its own host cores, on a single "
+            "NUMA node where possible, and keep its host processes on them. "
+            "crosvm also pins every vCPU to one of the cores.");
 DEFINE_bool(enable_host_uwb, CF_DEFAULTS_ENABLE_HOST_UWB,
             "Enable Pica in the host.");
 DEFINE_int32(
@@ -803,7 +816,23 @@ Result<CuttlefishConfig> InitializeCuttlefishConfiguration(
   tmp_config_obj.set_vm_manager(vm_manager_vec[0]);
 
   const GraphicsAvailability graphics_availability =
-    GetGraphicsAvailabilityWithSubprocessCheck();
+      GetGraphicsAvailabilityWithCache({
+          .path = FLAGS_graphics_detection_cache,
+          .start_refresh =
+              []() {
+                // Outlives assemble_cvd, and its output isn't waited for
+                Command refresh_cmd(HostBinaryPath("detect_graphics"));
+                refresh_cmd.AddParameter("--refresh_cache=",
+                                         FLAGS_graphics_detection_cache);
+                auto dev_null = SharedFD::Open("/dev/null", O_RDWR);
+                refresh_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut,
+                                          dev_null);
+                refresh_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdErr,
+                                          dev_null);
+                refresh_cmd.Start(
+                    SubprocessOptions().ExitWithParent(false).InGroup(true));
+              },
+      });
 
   LOG(DEBUG) << graphics_availability;
 
@@ -815,6 +844,7 @@ Result<CuttlefishConfig> InitializeCuttlefishConfiguration(
   tmp_config_obj.set_extra_bootconfig_args(FLAGS_extra_bootconfig_args);
 
   tmp_config_obj.set_host_tools_version(HostToolsCrc());
+  tmp_config_obj.set_pin_host_cpus(FLAGS_pin_host_cpus);
 
   tmp_config_obj.set_gem5_debug_flags(FLAGS_gem5_debug_flags);
 
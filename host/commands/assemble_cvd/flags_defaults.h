@@ -50,6 +50,8 @@
 #define CF_DEFAULTS_FILE_VERBOSITY "DEBUG"
 #define CF_DEFAULTS_VERBOSITY "INFO"
 #define CF_DEFAULTS_RUN_FILE_DISCOVERY true
+#define CF_DEFAULTS_LAUNCH_CONCURRENCY 0
+#define CF_DEFAULTS_LAUNCH_STAGGER_MS 0
 #define CF_DEFAULTS_MEMORY_MB CF_DEFAULTS_DYNAMIC_INT
 #define CF_DEFAULTS_SHARE_SCHED_CORE false
 // TODO: defined twice, please remove redundant definitions
@@ -99,7 +101,11 @@
 #define CF_DEFAULTS_BLANK_METADATA_IMAGE_MB "64"
 #define CF_DEFAULTS_BLANK_SDCARD_IMAGE_MB "2048"
 #define CF_DEFAULTS_BOOT_IMAGE CF_DEFAULTS_DYNAMIC_STRING
+#define CF_DEFAULTS_BOOT_REPACK_CACHE \
+  (StringFromEnv("HOME", ".") + "/.cache/cuttlefish/boot_repack")
+#define CF_DEFAULTS_BOOT_REPACK_CACHE_SIZE_MB 1024
 #define CF_DEFAULTS_DATA_IMAGE CF_DEFAULTS_DYNAMIC_STRING
+#define CF_DEFAULTS_DISK_ASSEMBLY_THREADS 0
 #define CF_DEFAULTS_INIT_BOOT_IMAGE CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_METADATA_IMAGE CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_MISC_IMAGE CF_DEFAULTS_DYNAMIC_STRING
@@ -131,6 +137,8 @@
 #define CF_DEFAULTS_DISPLAY1 CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_DISPLAY2 CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_DISPLAY3 CF_DEFAULTS_DYNAMIC_STRING
+#define CF_DEFAULTS_GRAPHICS_DETECTION_CACHE \
+  (StringFromEnv("HOME", ".") + "/.cache/cuttlefish/graphics_availability")
 
 // Camera default parameters
 #define CF_DEFAULTS_CAMERA_SERVER_PORT CF_DEFAULTS_DYNAMIC_INT
@@ -144,6 +152,7 @@
 #define CF_DEFAULTS_AP_KERNEL_IMAGE CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_AP_ROOTFS_IMAGE CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_VHOST_NET false
+#define CF_DEFAULTS_PIN_HOST_CPUS false
 #define CF_DEFAULTS_VHOST_USER_MAC80211_HWSIM CF_DEFAULTS_DYNAMIC_STRING
 #define CF_DEFAULTS_WMEDIUMD_CONFIG CF_DEFAULTS_DYNAMIC_STRING
 
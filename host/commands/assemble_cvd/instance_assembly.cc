@@ -0,0 +1,151 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/assemble_cvd/instance_assembly.h"
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+double Seconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+struct Outcome {
+  std::optional<Result<void>> result;
+  std::chrono::nanoseconds duration{};
+  AssemblyTimer timer;
+};
+
+void LogReport(const std::vector<InstanceAssembly>& instances,
+               const std::vector<Outcome>& outcomes, std::size_t threads,
+               std::chrono::nanoseconds total) {
+  std::size_t name_width = 0;
+  for (const auto& instance : instances) {
+    name_width = std::max(name_width, instance.name.size());
+  }
+  std::stringstream report;
+  report << std::fixed << std::setprecision(1) << "Assembled "
+         << instances.size() << " instances in " << Seconds(total) << "s on "
+         << threads << " threads:";
+  for (std::size_t i = 0; i < instances.size(); i++) {
+    const auto& outcome = outcomes[i];
+    report << "\n  " << std::left << std::setw(name_width) << instances[i].name
+           << std::right << (outcome.result->ok() ? "  ok     " : "  failed ")
+           << std::setw(6) << Seconds(outcome.duration) << "s";
+    const char* separator = "  ";
+    for (const auto& [step, duration] : outcome.timer.Steps()) {
+      report << separator << step << " " << Seconds(duration) << "s";
+      separator = ", ";
+    }
+  }
+  LOG(INFO) << report.str();
+}
+
+}  // namespace
+
+Result<void> DiskSpaceBudget::Reserve(const std::string& path,
+                                      std::uint64_t bytes) {
+  struct stat st;
+  CF_EXPECT(stat(path.c_str(), &st) == 0,
+            "Could not stat \"" << path << "\": " << strerror(errno));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = available_.find(st.st_dev);
+  if (it == available_.end()) {
+    struct statvfs vfs {};
+    CF_EXPECT(statvfs(path.c_str(), &vfs) == 0,
+              "Could not find space available at \""
+                  << path << "\": " << strerror(errno));
+    std::uint64_t available = (std::uint64_t)vfs.f_bavail * vfs.f_frsize;
+    it = available_.emplace(st.st_dev, available).first;
+  }
+  CF_EXPECT(bytes <= it->second,
+            "Not enough space remaining in fs containing \""
+                << path << "\", wanted " << bytes << ", got " << it->second
+                << " after the other instances");
+  it->second -= bytes;
+  LOG(DEBUG) << "Reserved " << bytes << " bytes for \"" << path << "\", "
+             << it->second << " left";
+  return {};
+}
+
+Result<void> AssembleInstances(const std::vector<InstanceAssembly>& instances,
+                               std::size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<std::size_t>(1, std::min(threads, instances.size()));
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Outcome> outcomes(instances.size());
+  std::atomic<std::size_t> next = 0;
+  auto work = [&instances, &outcomes, &next]() {
+    for (auto i = next++; i < instances.size(); i = next++) {
+      auto instance_start = std::chrono::steady_clock::now();
+      outcomes[i].result = instances[i].assemble(outcomes[i].timer);
+      outcomes[i].duration = std::chrono::steady_clock::now() - instance_start;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < threads; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  LogReport(instances, outcomes, threads,
+            std::chrono::steady_clock::now() - start);
+
+  std::vector<std::string> failed;
+  std::optional<std::size_t> first_failure;
+  for (std::size_t i = 0; i < instances.size(); i++) {
+    if (outcomes[i].result->ok()) {
+      continue;
+    }
+    failed.push_back(instances[i].name);
+    if (!first_failure) {
+      first_failure = i;
+    } else {
+      LOG(ERROR) << "Failed to assemble instance \"" << instances[i].name
+                 << "\": " << outcomes[i].result->error().Trace();
+    }
+  }
+  if (!first_failure) {
+    return {};
+  }
+  // The other failures were logged above
+  auto error = std::move(outcomes[*first_failure].result->error());
+  error.PushEntry(CF_STACK_TRACE_ENTRY("")
+                  << "Failed to assemble " << failed.size() << " of "
+                  << instances.size() << " instances: "
+                  << android::base::Join(failed, ", "));
+  return std::move(error);
+}
+
+}  // namespace cuttlefish
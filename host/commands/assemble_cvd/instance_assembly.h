@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * Free space shared by the instances assembled at the same time. The free
+ * space of each filesystem is read once and every reservation is taken out of
+ * it, so two instances can't both count on the same free bytes.
+ */
+class DiskSpaceBudget {
+ public:
+  // Reserves `bytes` on the filesystem containing `path`.
+  Result<void> Reserve(const std::string& path, std::uint64_t bytes);
+
+ private:
+  std::mutex mutex_;
+  std::map<dev_t, std::uint64_t> available_;
+};
+
+// Times the steps assembling one instance.
+class AssemblyTimer {
+ public:
+  template <typename F>
+  auto Time(const std::string& step, const F& f) -> decltype(f()) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = f();
+    steps_.emplace_back(step, std::chrono::steady_clock::now() - start);
+    return result;
+  }
+
+  const std::vector<std::pair<std::string, std::chrono::nanoseconds>>& Steps()
+      const {
+    return steps_;
+  }
+
+ private:
+  std::vector<std::pair<std::string, std::chrono::nanoseconds>> steps_;
+};
+
+struct InstanceAssembly {
+  std::string name;
+  std::function<Result<void>(AssemblyTimer&)> assemble;
+};
+
+/**
+ * Assembles the instances on up to `threads` threads, or on one per core
+ * when `threads` is 0. A failed instance doesn't stop the others; the errors
+ * of all the failed instances are returned together. The time each instance
+ * spent in each step is logged at the end.
+ */
+Result<void> AssembleInstances(const std::vector<InstanceAssembly>& instances,
+                               std::size_t threads);
+
+}  // namespace cuttlefish
@@ -0,0 +1,197 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Assembles the disks of N instances from synthetic images, one instance at a
+// time and concurrently. Each instance goes through the steps that dominate
+// the real assembly: repacking a vendor ramdisk, creating its blank images,
+// and building its composite disk and overlay.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/assemble_cvd/instance_assembly.h"
+#include "host/libs/boot_image/ramdisk.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kPartitions = 8;
+constexpr off_t kPartitionSize = 32 << 20;
+constexpr off_t kMetadataSize = 64 << 20;
+constexpr off_t kDataSize = 1ll << 30;
+
+Result<void> WriteFileOfSize(const std::string& path, off_t size,
+                             char fill) {
+  auto fd = SharedFD::Open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CF_EXPECT(fd->IsOpen(), fd->StrError());
+  std::string block(1 << 20, fill);
+  for (off_t written = 0; written < size; written += block.size()) {
+    CF_EXPECT(WriteAll(fd, block) == (ssize_t)block.size(), fd->StrError());
+  }
+  return {};
+}
+
+// A vendor ramdisk with a few hundred modules, like the ones assemble_cvd
+// strips before appending the modules of a custom kernel.
+std::string SyntheticRamdisk() {
+  std::vector<CpioEntry> entries = {
+      CpioEntry{.name = "lib", .mode = S_IFDIR | 0755},
+      CpioEntry{.name = "lib/modules", .mode = S_IFDIR | 0755},
+  };
+  for (int i = 0; i < 300; i++) {
+    std::string data;
+    for (int j = 0; data.size() < (32 << 10); j++) {
+      data += std::to_string((i * 7919 + j * 104729) % 1000003);
+    }
+    entries.push_back(CpioEntry{
+        .name = "lib/modules/module" + std::to_string(i) + ".ko",
+        .mode = S_IFREG | 0644,
+        .data = data,
+    });
+  }
+  return WriteCpio(entries);
+}
+
+class SyntheticImages {
+ public:
+  SyntheticImages() {
+    for (int i = 0; i < kPartitions; i++) {
+      ImagePartition partition{
+          .label = "partition" + std::to_string(i),
+          .image_file_path =
+              std::string(dir_.path) + "/partition" + std::to_string(i),
+          .type = kLinuxFilesystem,
+          .read_only = true,
+      };
+      auto res = WriteFileOfSize(partition.image_file_path, kPartitionSize,
+                                 'a' + i);
+      CHECK(res.ok()) << res.error().Trace();
+      partitions_.push_back(partition);
+    }
+    ramdisk_ = SyntheticRamdisk();
+  }
+
+  std::string Directory() const { return dir_.path; }
+
+  Result<void> Assemble(const std::string& instance_dir,
+                        DiskSpaceBudget& budget, AssemblyTimer& timer) {
+    CF_EXPECT(EnsureDirectoryExists(instance_dir));
+    CF_EXPECT(timer.Time("setup", [this, &instance_dir]() -> Result<void> {
+      auto entries = CF_EXPECT(ParseCpio(ramdisk_));
+      RemoveCpioDirectory(entries, "lib/modules");
+      auto ramdisk = CF_EXPECT(Lz4LegacyCompress(WriteCpio(entries) + ramdisk_));
+      CF_EXPECT(android::base::WriteStringToFile(
+          ramdisk, instance_dir + "/vendor_ramdisk_repacked"));
+      return {};
+    }));
+
+    auto metadata = instance_dir + "/metadata.img";
+    auto data = instance_dir + "/userdata.img";
+    CF_EXPECT(timer.Time("instance setup", [&]() -> Result<void> {
+      CF_EXPECT(WriteFileOfSize(metadata, kMetadataSize, '\0'));
+      CF_EXPECT(truncate(data.c_str(), 0) == 0 || errno == ENOENT);
+      auto fd = SharedFD::Open(data, O_WRONLY | O_CREAT, 0644);
+      CF_EXPECT(fd->IsOpen() && fd->Truncate(kDataSize) == 0,
+                fd->StrError());
+      return {};
+    }));
+
+    auto sizes = SparseFileSizes(data);
+    CF_EXPECT(budget.Reserve(data, sizes.sparse_size - sizes.disk_size));
+
+    auto composite = instance_dir + "/os_composite.img";
+    CF_EXPECT(timer.Time("composite disks", [&]() -> Result<void> {
+      auto partitions = partitions_;
+      partitions.push_back(ImagePartition{
+          .label = "metadata",
+          .image_file_path = metadata,
+          .type = kLinuxFilesystem,
+          .read_only = false,
+      });
+      partitions.push_back(ImagePartition{
+          .label = "userdata",
+          .image_file_path = data,
+          .type = kLinuxFilesystem,
+          .read_only = false,
+      });
+      CreateCompositeDisk(partitions, instance_dir + "/gpt_header.img",
+                          instance_dir + "/gpt_footer.img", composite);
+      return {};
+    }));
+    CF_EXPECT(timer.Time("overlays", [&]() {
+      return CreateQcowOverlay(composite, instance_dir + "/overlay.img");
+    }));
+    return {};
+  }
+
+ private:
+  TemporaryDir dir_;
+  std::vector<ImagePartition> partitions_;
+  std::string ramdisk_;
+};
+
+void BM_AssembleInstances(benchmark::State& state) {
+  static SyntheticImages images;
+  const int instances = state.range(0);
+  const int threads = state.range(1);
+  for (auto _ : state) {
+    DiskSpaceBudget budget;
+    std::vector<InstanceAssembly> assemblies;
+    for (int i = 0; i < instances; i++) {
+      auto instance_dir = images.Directory() + "/cvd-" + std::to_string(i + 1);
+      assemblies.push_back(InstanceAssembly{
+          .name = "cvd-" + std::to_string(i + 1),
+          .assemble =
+              [instance_dir, &budget](AssemblyTimer& timer) {
+                return images.Assemble(instance_dir, budget, timer);
+              },
+      });
+    }
+    auto res = AssembleInstances(assemblies, threads);
+    CHECK(res.ok()) << res.error().Trace();
+  }
+  state.SetItemsProcessed(state.iterations() * instances);
+}
+BENCHMARK(BM_AssembleInstances)
+    ->ArgNames({"instances", "threads"})
+    ->Args({1, 1})
+    ->Args({4, 1})
+    ->Args({4, 4})
+    ->Args({8, 1})
+    ->Args({8, 8})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  // Every iteration logs its timing report
+  android::base::SetMinimumLogSeverity(android::base::WARNING);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
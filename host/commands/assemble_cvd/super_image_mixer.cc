@@ -22,6 +22,7 @@
 #include <cstdio>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 #include <android-base/strings.h>
 #include <android-base/logging.h>
@@ -249,6 +250,10 @@ Result<void> RebuildSuperImage(const FetcherConfig& fetcher_config,
   auto instance = config.ForDefaultInstance();
   // TODO(schuffelen): Use cuttlefish_assembly
   std::string combined_target_path = instance.PerInstanceInternalPath("target_combined");
+  // Every instance combines into the default instance's directory, and
+  // their disks may be assembled at the same time
+  static std::mutex combined_target_mutex;
+  std::lock_guard<std::mutex> lock(combined_target_mutex);
   // TODO(schuffelen): Use otatools/bin/merge_target_files
   CF_EXPECT(CombineTargetZipFiles(default_target_zip, system_target_zip,
                                   combined_target_path),
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/assemble_cvd/boot_image_utils.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/boot_image/boot_image.h"
+#include "host/libs/boot_image/ramdisk.h"
+#include "host/libs/web/artifact_cache.h"
+
+namespace cuttlefish {
+namespace {
+
+class RepackVendorBootImageTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // The hash footer is avbtool's business, a stand-in leaves the image as is
+    const std::string host_out = std::string(dir_.path) + "/host_out";
+    ASSERT_TRUE(EnsureDirectoryExists(host_out + "/bin").ok());
+    ASSERT_TRUE(android::base::WriteStringToFile("#!/bin/sh\nexit 0\n",
+                                                 host_out + "/bin/avbtool"));
+    ASSERT_EQ(chmod((host_out + "/bin/avbtool").c_str(), 0755), 0);
+    ASSERT_EQ(setenv("ANDROID_HOST_OUT", host_out.c_str(), 1), 0);
+
+    unpack_dir_ = std::string(dir_.path) + "/unpack";
+    ASSERT_TRUE(EnsureDirectoryExists(unpack_dir_).ok());
+    auto cache = ArtifactCache::Open(std::string(dir_.path) + "/cache",
+                                     1024 * 1024 * 1024);
+    ASSERT_TRUE(cache.ok()) << cache.error().Trace();
+    cache_ = std::move(*cache);
+
+    VendorBootImage vendor_boot;
+    vendor_boot.cmdline = "console=hvc0";
+    vendor_boot.ramdisks.push_back(VendorRamdisk{
+        .contents = Ramdisk("lib/modules/original.ko", "original"),
+    });
+    vendor_boot.bootconfig = "androidboot.hardware=cutf_cvm\n";
+    vendor_boot_ = std::string(dir_.path) + "/vendor_boot.img";
+    auto image = WriteVendorBootImage(vendor_boot);
+    ASSERT_TRUE(image.ok()) << image.error().Trace();
+    ASSERT_TRUE(android::base::WriteStringToFile(*image, vendor_boot_));
+  }
+
+  static std::string Ramdisk(const std::string& name,
+                             const std::string& contents) {
+    auto compressed = Lz4LegacyCompress(WriteCpio({
+        CpioEntry{.name = name, .mode = 0100644, .data = contents},
+    }));
+    return compressed.ok() ? *compressed : "";
+  }
+
+  // Repacks with the kernel modules ramdisk holding `module`, and returns the
+  // ramdisk in the repacked image
+  std::string Repack(const std::string& module, const std::string& out_name) {
+    const std::string modules = std::string(dir_.path) + "/modules.img";
+    EXPECT_TRUE(android::base::WriteStringToFile(
+        Ramdisk("lib/modules/" + module + ".ko", module), modules));
+    const std::string out = std::string(dir_.path) + "/" + out_name;
+    EXPECT_TRUE(RepackVendorBootImage(modules, vendor_boot_, out, unpack_dir_,
+                                      true, cache_.get()));
+    std::string image;
+    EXPECT_TRUE(android::base::ReadFileToString(out, &image));
+    auto repacked = ParseVendorBootImage(image);
+    EXPECT_TRUE(repacked.ok()) << repacked.error().Trace();
+    return repacked.ok() ? repacked->Ramdisk() : "";
+  }
+
+  TemporaryDir dir_;
+  std::string unpack_dir_;
+  std::string vendor_boot_;
+  std::unique_ptr<ArtifactCache> cache_;
+};
+
+TEST_F(RepackVendorBootImageTest, DifferentRamdisksGiveDifferentImages) {
+  auto first = Repack("first", "first.img");
+  auto second = Repack("second", "second.img");
+  EXPECT_NE(first, second);
+  EXPECT_NE(second.find(Ramdisk("lib/modules/second.ko", "second")),
+            std::string::npos);
+  EXPECT_EQ(first.find(Ramdisk("lib/modules/second.ko", "second")),
+            std::string::npos);
+
+  // From the cache this time
+  EXPECT_EQ(Repack("first", "first_again.img"), first);
+}
+
+TEST_F(RepackVendorBootImageTest, EmptyRamdiskDoesNotReuseTheLastRepack) {
+  auto with_modules = Repack("module", "with_modules.img");
+  const std::string out = std::string(dir_.path) + "/empty.img";
+  ASSERT_TRUE(RepackVendorBootImageWithEmptyRamdisk(
+      vendor_boot_, out, unpack_dir_, true, cache_.get()));
+  std::string image;
+  ASSERT_TRUE(android::base::ReadFileToString(out, &image));
+  auto repacked = ParseVendorBootImage(image);
+  ASSERT_TRUE(repacked.ok()) << repacked.error().Trace();
+  EXPECT_NE(repacked->Ramdisk(), with_modules);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,168 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/assemble_cvd/instance_assembly.h"
+
+#include <sys/statvfs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+using testing::HasSubstr;
+
+// Counts the calls to each instance and how many run at the same time
+class Recorder {
+ public:
+  InstanceAssembly Instance(const std::string& name, bool fail = false) {
+    return InstanceAssembly{
+        .name = name,
+        .assemble = [this, name, fail](AssemblyTimer& timer) -> Result<void> {
+          timer.Time("step", [this, &name]() {
+            std::lock_guard lock(mutex_);
+            calls_.push_back(name);
+            running_++;
+            max_running_ = std::max(max_running_, running_);
+            return running_;
+          });
+          // Long enough for the other workers to overlap with it
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+          {
+            std::lock_guard lock(mutex_);
+            running_--;
+          }
+          if (fail) {
+            return CF_ERR("no space for " << name);
+          }
+          return {};
+        },
+    };
+  }
+
+  std::vector<std::string> Calls() {
+    std::lock_guard lock(mutex_);
+    auto calls = calls_;
+    std::sort(calls.begin(), calls.end());
+    return calls;
+  }
+  int MaxRunning() {
+    std::lock_guard lock(mutex_);
+    return max_running_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::string> calls_;
+  int running_ = 0;
+  int max_running_ = 0;
+};
+
+TEST(AssembleInstancesTest, AssemblesEveryInstanceOnce) {
+  Recorder recorder;
+  auto result = AssembleInstances(
+      {recorder.Instance("cvd-1"), recorder.Instance("cvd-2"),
+       recorder.Instance("cvd-3")},
+      2);
+  ASSERT_TRUE(result.ok()) << result.error().Trace();
+  EXPECT_EQ(recorder.Calls(),
+            std::vector<std::string>({"cvd-1", "cvd-2", "cvd-3"}));
+  EXPECT_LE(recorder.MaxRunning(), 2);
+}
+
+TEST(AssembleInstancesTest, CollectsTheErrorsOfEveryInstance) {
+  Recorder recorder;
+  auto result = AssembleInstances(
+      {recorder.Instance("cvd-1", true), recorder.Instance("cvd-2"),
+       recorder.Instance("cvd-3", true)},
+      1);
+  ASSERT_FALSE(result.ok());
+  // The first failure doesn't stop the others
+  EXPECT_EQ(recorder.Calls(),
+            std::vector<std::string>({"cvd-1", "cvd-2", "cvd-3"}));
+  auto trace = result.error().Trace();
+  EXPECT_THAT(trace, HasSubstr("no space for cvd-1"));
+  EXPECT_THAT(trace, HasSubstr("Failed to assemble 2 of 3 instances: "
+                               "cvd-1, cvd-3"));
+}
+
+TEST(AssembleInstancesTest, UsesEveryCoreWithZeroThreads) {
+  Recorder recorder;
+  std::vector<InstanceAssembly> instances;
+  for (int i = 0; i < 4; i++) {
+    instances.push_back(recorder.Instance("cvd-" + std::to_string(i)));
+  }
+  auto result = AssembleInstances(instances, 0);
+  ASSERT_TRUE(result.ok()) << result.error().Trace();
+  EXPECT_EQ(recorder.Calls().size(), 4u);
+  EXPECT_LE(recorder.MaxRunning(),
+            std::max(1u, std::thread::hardware_concurrency()));
+}
+
+TEST(AssembleInstancesTest, StartsNoMoreThreadsThanInstances) {
+  Recorder recorder;
+  auto result = AssembleInstances(
+      {recorder.Instance("cvd-1"), recorder.Instance("cvd-2")}, 16);
+  ASSERT_TRUE(result.ok()) << result.error().Trace();
+  EXPECT_EQ(recorder.Calls(), std::vector<std::string>({"cvd-1", "cvd-2"}));
+  EXPECT_LE(recorder.MaxRunning(), 2);
+}
+
+TEST(AssembleInstancesTest, AcceptsNoInstances) {
+  EXPECT_TRUE(AssembleInstances({}, 0).ok());
+}
+
+std::uint64_t AvailableBytes(const std::string& path) {
+  struct statvfs vfs {};
+  EXPECT_EQ(statvfs(path.c_str(), &vfs), 0);
+  return (std::uint64_t)vfs.f_bavail * vfs.f_frsize;
+}
+
+TEST(DiskSpaceBudgetTest, InstancesOnTheSameFilesystemShareTheSpace) {
+  TemporaryDir dir;
+  const std::string first = std::string(dir.path) + "/cvd-1";
+  const std::string second = std::string(dir.path) + "/cvd-2";
+  ASSERT_TRUE(android::base::WriteStringToFile("", first));
+  ASSERT_TRUE(android::base::WriteStringToFile("", second));
+  const auto available = AvailableBytes(dir.path);
+  ASSERT_GT(available, 4u);
+
+  DiskSpaceBudget budget;
+  ASSERT_TRUE(budget.Reserve(first, available / 2).ok());
+  // Each would fit on its own, not both
+  auto result = budget.Reserve(second, available / 2 + available / 4);
+  ASSERT_FALSE(result.ok());
+  EXPECT_THAT(result.error().Message(), HasSubstr("after the other instances"));
+  EXPECT_TRUE(budget.Reserve(second, available / 4).ok());
+}
+
+TEST(DiskSpaceBudgetTest, FailsOnMissingPath) {
+  TemporaryDir dir;
+  DiskSpaceBudget budget;
+  EXPECT_FALSE(budget.Reserve(std::string(dir.path) + "/missing", 0).ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -18,10 +18,13 @@
 #include <sys/stat.h>
 
 #include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -40,8 +43,11 @@
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/result.h"
+#include "common/libs/utils/scope_guard.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/fetch/fetch_timeline.h"
 #include "host/libs/config/fetcher_config.h"
+#include "host/libs/web/artifact_cache.h"
 #include "host/libs/web/build_api.h"
 #include "host/libs/web/credential_source.h"
 
@@ -55,6 +61,7 @@ const std::string KERNEL = "kernel";
 const std::string OTA_TOOLS = "otatools.zip";
 const std::string OTA_TOOLS_DIR = "/otatools/";
 const int DEFAULT_RETRY_PERIOD = 20;
+const int DEFAULT_CACHE_SIZE_GB = 25;
 const std::string USAGE_MESSAGE =
     "<flags>\n"
     "\n"
@@ -78,6 +85,10 @@ struct BuildApiFlags {
 #else
       false;
 #endif
+  bool enable_caching = false;
+  std::string cache_directory =
+      StringFromEnv("HOME", ".") + "/.cache/cuttlefish/fetch";
+  std::int32_t cache_size_gb = DEFAULT_CACHE_SIZE_GB;
 };
 
 struct BuildSourceFlags {
@@ -143,6 +154,17 @@ std::vector<Flag> GetFlagsVector(FetchFlags& fetch_flags,
       GflagsCompatFlag("external_dns_resolver",
                        build_api_flags.external_dns_resolver)
           .Help("Use an out-of-process mechanism to resolve DNS queries"));
+  flags.emplace_back(
+      GflagsCompatFlag("enable_caching", build_api_flags.enable_caching)
+          .Help("Share downloaded artifacts with other fetches on this host "
+                "through --cache_directory."));
+  flags.emplace_back(
+      GflagsCompatFlag("cache_directory", build_api_flags.cache_directory)
+          .Help("Host-wide directory for cached build artifacts."));
+  flags.emplace_back(
+      GflagsCompatFlag("cache_size_gb", build_api_flags.cache_size_gb)
+          .Help("Least recently used artifacts are evicted from the cache "
+                "once it grows beyond this size."));
 
   flags.emplace_back(
       GflagsCompatFlag("default_build", build_source_flags.default_build)
@@ -222,17 +244,6 @@ Result<std::string> DownloadImageZip(BuildApi& build_api, const Build& build,
   return build_api.DownloadFile(build, target_directory, img_zip_name);
 }
 
-Result<std::vector<std::string>> DownloadImages(
-    BuildApi& build_api, const Build& build,
-    const std::string& target_directory, const std::vector<std::string>& images,
-    const bool keep_archives) {
-  std::string local_path =
-      CF_EXPECT(DownloadImageZip(build_api, build, target_directory));
-  std::vector<std::string> files = CF_EXPECT(
-      ExtractImages(local_path, target_directory, images, keep_archives));
-  return files;
-}
-
 Result<std::string> DownloadTargetFiles(BuildApi& build_api, const Build& build,
                                         const std::string& target_directory) {
   std::string target_files_name = GetBuildZipName(build, "target_files");
@@ -262,41 +273,6 @@ Result<std::string> DownloadMiscInfo(BuildApi& build_api, const Build& build,
   return build_api.DownloadFile(build, target_dir, "misc_info.txt");
 }
 
-Result<std::vector<std::string>> DownloadBoot(
-    BuildApi& build_api, const Build& build,
-    const std::string& specified_artifact, const std::string& target_dir,
-    const bool keep_archives) {
-  std::string target_boot = target_dir + "/boot.img";
-  const std::string& boot_artifact =
-      specified_artifact != "" ? specified_artifact : "boot.img";
-  if (specified_artifact != "") {
-    Result<std::string> artifact_result =
-        build_api.DownloadFile(build, target_dir, specified_artifact);
-    if (artifact_result.ok()) {
-      RenameFile(artifact_result.value(), target_boot);
-      return {{target_boot}};
-    }
-    LOG(INFO) << "Find " << boot_artifact << " in the img zip";
-  }
-
-  std::vector<std::string> files{target_boot};
-  std::string img_zip =
-      CF_EXPECT(DownloadImageZip(build_api, build, target_dir));
-  const bool keep_img_zip_archive_for_vendor_boot = true;
-  std::string extracted_boot =
-      CF_EXPECT(ExtractImage(img_zip, target_dir, boot_artifact,
-                             keep_img_zip_archive_for_vendor_boot));
-  if (extracted_boot != target_boot) {
-    CF_EXPECT(RenameFile(extracted_boot, target_boot));
-  }
-  Result<std::string> extracted_vendor_boot_result =
-      ExtractImage(img_zip, target_dir, "vendor_boot.img", keep_archives);
-  if (extracted_vendor_boot_result.ok()) {
-    files.push_back(extracted_vendor_boot_result.value());
-  }
-  return files;
-}
-
 Result<void> AddFilesToConfig(FileSource purpose, const Build& build,
                               const std::vector<std::string>& paths,
                               FetcherConfig* config,
@@ -349,21 +325,7 @@ std::unique_ptr<CredentialSource> TryOpenServiceAccountFile(
       new ServiceAccountOauthCredentialSource(std::move(*result)));
 }
 
-Result<void> ProcessHostPackage(BuildApi& build_api, const Build& build,
-                                const std::string& target_dir,
-                                FetcherConfig* config,
-                                const std::string& host_package_build,
-                                const bool keep_archives) {
-  std::vector<std::string> host_package_files = CF_EXPECT(
-      DownloadHostPackage(build_api, build, target_dir, keep_archives));
-  CF_EXPECT(AddFilesToConfig(host_package_build != ""
-                                 ? FileSource::HOST_PACKAGE_BUILD
-                                 : FileSource::DEFAULT_BUILD,
-                             build, host_package_files, config, target_dir));
-  return {};
-}
-
-BuildApi GetBuildApi(const BuildApiFlags& flags) {
+Result<std::unique_ptr<BuildApi>> GetBuildApi(const BuildApiFlags& flags) {
   auto resolver =
       flags.external_dns_resolver ? GetEntDnsResolve : NameResolver();
   std::unique_ptr<HttpClient> curl = HttpClient::CurlClient(resolver);
@@ -396,9 +358,16 @@ BuildApi GetBuildApi(const BuildApiFlags& flags) {
   } else {
     credential_source = FixedCredentialSource::make(flags.credential_source);
   }
-  return BuildApi(std::move(retrying_http_client), std::move(curl),
-                  std::move(credential_source), flags.api_key,
-                  flags.wait_retry_period);
+  std::unique_ptr<ArtifactCache> artifact_cache;
+  if (flags.enable_caching) {
+    CF_EXPECT(flags.cache_size_gb > 0, "--cache_size_gb must be positive");
+    artifact_cache = CF_EXPECT(ArtifactCache::Open(
+        flags.cache_directory, (std::uint64_t)flags.cache_size_gb << 30));
+  }
+  return std::make_unique<BuildApi>(
+      std::move(retrying_http_client), std::move(curl),
+      std::move(credential_source), flags.api_key, flags.wait_retry_period,
+      std::move(artifact_cache));
 }
 
 Result<std::optional<Build>> GetBuildHelper(BuildApi& build_api,
@@ -446,6 +415,23 @@ Result<Builds> GetBuildsFromSources(BuildApi& build_api,
   return {result};
 }
 
+// Moves the files extracted into `staged_dir` to the same relative paths under
+// `target_dir`.
+Result<std::vector<std::string>> MoveIntoPlace(
+    const std::vector<std::string>& staged, const std::string& staged_dir,
+    const std::string& target_dir) {
+  std::vector<std::string> placed;
+  for (const auto& file : staged) {
+    std::string_view relative(file);
+    CF_EXPECT(android::base::ConsumePrefix(&relative, staged_dir + "/"),
+              "\"" << file << "\" is not in \"" << staged_dir << "\"");
+    std::string destination = target_dir + "/" + std::string(relative);
+    CF_EXPECT(EnsureDirectoryExists(cpp_dirname(destination), RWX_ALL_MODE));
+    placed.emplace_back(CF_EXPECT(RenameFile(file, destination)));
+  }
+  return placed;
+}
+
 }  // namespace
 
 Result<void> FetchCvdMain(int argc, char** argv) {
@@ -461,31 +447,219 @@ Result<void> FetchCvdMain(int argc, char** argv) {
   std::string target_dir = AbsolutePath(flags.target_directory);
   CF_EXPECT(EnsureDirectoryExists(target_dir, RWX_ALL_MODE));
   FetcherConfig config;
+  FetchTimeline timeline;
   curl_global_init(CURL_GLOBAL_DEFAULT);
   {
-    BuildApi build_api = GetBuildApi(flags.build_api_flags);
-    const Builds builds =
-        CF_EXPECT(GetBuildsFromSources(build_api, flags.build_source_flags));
+    std::unique_ptr<BuildApi> build_api_ptr =
+        CF_EXPECT(GetBuildApi(flags.build_api_flags));
+    BuildApi& build_api = *build_api_ptr;
+    const Builds builds = CF_EXPECT(timeline.Run("resolve builds", [&]() {
+      return GetBuildsFromSources(build_api, flags.build_source_flags);
+    }));
+    const DownloadFlags& download_flags = flags.download_flags;
+
+    // Every download starts right away. The results are consumed below in the
+    // same order as before, so files from later builds still replace the ones
+    // from earlier builds, but extracting one archive overlaps with the
+    // downloads that are still running.
+    std::string staging_dir = target_dir + "/.fetch_staging";
+    CF_EXPECT(EnsureDirectoryExists(staging_dir, RWX_ALL_MODE));
+    ScopeGuard remove_staging_dir(
+        [&staging_dir]() { RecursivelyRemoveDirectory(staging_dir); });
+
+    auto host_package = timeline.Async("host package", [&]() {
+      return DownloadHostPackage(build_api, builds.host_package.value(),
+                                 target_dir, flags.keep_downloaded_archives);
+    });
+    std::optional<std::future<Result<std::vector<std::string>>>> ota_tools;
+    if (builds.otatools.has_value()) {
+      ota_tools = timeline.Async("otatools", [&]() {
+        return DownloadOtaTools(build_api, builds.otatools.value(), target_dir,
+                                flags.keep_downloaded_archives);
+      });
+    }
 
-    auto process_pkg_ret = std::async(
-        std::launch::async, ProcessHostPackage, std::ref(build_api),
-        std::cref(builds.host_package.value()), std::cref(target_dir), &config,
-        std::cref(flags.build_source_flags.host_package_build),
-        std::cref(flags.keep_downloaded_archives));
+    // Several steps may take files from the same img zip. Each of them
+    // extracts its files into a staging directory of its own as soon as the
+    // zip is downloaded, after which the zip is deleted. The steps are all
+    // registered before the zip downloads start.
+    using Extraction = std::function<Result<std::vector<std::string>>(
+        const std::string& archive, const std::string& dir)>;
+    struct ImgZipStep {
+      std::string name;
+      std::string dir;
+      Extraction extract;
+      std::promise<Result<std::vector<std::string>>> result;
+    };
+    struct ImgZip {
+      Build build;
+      std::vector<std::shared_ptr<ImgZipStep>> steps;
+    };
+    std::map<std::string, ImgZip> img_zips;
+    auto extract_from_img_zip = [&](const Build& build,
+                                    const std::string& step,
+                                    Extraction extract) {
+      auto img_zip_step = std::make_shared<ImgZipStep>(ImgZipStep{
+          .name = step,
+          .dir = staging_dir + "/" + step,
+          .extract = std::move(extract),
+      });
+      auto result = img_zip_step->result.get_future().share();
+      auto& img_zip = img_zips.try_emplace(GetBuildZipName(build, "img"),
+                                           ImgZip{.build = build})
+                          .first->second;
+      img_zip.steps.emplace_back(std::move(img_zip_step));
+      return result;
+    };
+    // Failed downloads are reported through the steps, which decide whether
+    // they can do without the files.
+    std::vector<std::future<Result<void>>> img_zip_downloads;
+    auto start_img_zip = [&](const std::string& name, const ImgZip& img_zip) {
+      img_zip_downloads.emplace_back(timeline.Async(
+          "download " + name,
+          [&build_api, &target_dir, &timeline, &flags,
+           img_zip]() -> Result<void> {
+            auto local_path =
+                DownloadImageZip(build_api, img_zip.build, target_dir);
+            for (const auto& step : img_zip.steps) {
+              if (!local_path.ok()) {
+                step->result.set_value(CF_ERR(local_path.error().Message()));
+                continue;
+              }
+              step->result.set_value(
+                  timeline.Run("extract " + step->name,
+                               [&]() -> Result<std::vector<std::string>> {
+                                 CF_EXPECT(EnsureDirectoryExists(
+                                     step->dir, RWX_ALL_MODE));
+                                 return CF_EXPECT(
+                                     step->extract(*local_path, step->dir));
+                               }));
+            }
+            CF_EXPECT(std::move(local_path));
+            if (!flags.keep_downloaded_archives) {
+              RemoveFile(*local_path);
+            }
+            return {};
+          }));
+    };
+
+    auto target_files = [&](const Build& build, const std::string& dir) {
+      return timeline.Async(
+          "download " + GetBuildZipName(build, "target_files"),
+          [&build_api, build, dir]() -> Result<std::string> {
+            CF_EXPECT(EnsureDirectoryExists(dir, RWX_ALL_MODE));
+            return CF_EXPECT(DownloadTargetFiles(build_api, build, dir));
+          });
+    };
+    // Single files are staged in a directory of their own, and moved into
+    // place once everything that comes before them has been extracted.
+    auto single_file = [&](const std::string& stage, const Build& build,
+                           const std::string& artifact,
+                           const std::string& backup_artifact) {
+      std::string dir = staging_dir + "/" + stage;
+      return timeline.Async(
+          "download " + stage,
+          [&build_api, build, dir, artifact,
+           backup_artifact]() -> Result<std::string> {
+            CF_EXPECT(EnsureDirectoryExists(dir, RWX_ALL_MODE));
+            if (backup_artifact == "") {
+              return CF_EXPECT(build_api.DownloadFile(build, dir, artifact));
+            }
+            return CF_EXPECT(build_api.DownloadFileWithBackup(
+                build, dir, artifact, backup_artifact));
+          });
+    };
+
+    using Extracted = std::shared_future<Result<std::vector<std::string>>>;
+    std::optional<Extracted> default_images;
+    if (download_flags.download_img_zip) {
+      default_images = extract_from_img_zip(
+          builds.default_build, "default_images",
+          [](const std::string& archive, const std::string& dir) {
+            return ExtractArchiveContents(archive, dir, true);
+          });
+    }
+    std::optional<Extracted> system_images;
+    if (builds.system.has_value() && download_flags.download_img_zip) {
+      system_images = extract_from_img_zip(
+          builds.system.value(), "system_images",
+          [](const std::string& archive, const std::string& dir) {
+            return ExtractImages(archive, dir, {"system.img", "product.img"},
+                                 true);
+          });
+    }
+    std::string boot_name = download_flags.boot_artifact != ""
+                                ? download_flags.boot_artifact
+                                : "boot.img";
+    auto extract_boot = [boot_name](const std::string& archive_path,
+                                     const std::string& dir)
+        -> Result<std::vector<std::string>> {
+      Archive archive(archive_path);
+      std::vector<std::string> boot_files{
+          CF_EXPECT(ExtractImage(archive, dir, boot_name, true))};
+      Result<std::string> extracted_vendor_boot_result =
+          ExtractImage(archive, dir, "vendor_boot.img", true);
+      if (extracted_vendor_boot_result.ok()) {
+        boot_files.push_back(extracted_vendor_boot_result.value());
+      }
+      return boot_files;
+    };
+    // Only needed if the boot artifact can't be downloaded, unless there is
+    // no boot artifact or the img zip is downloaded anyway
+    std::optional<Extracted> boot_images;
+    if (builds.boot.has_value() &&
+        (download_flags.boot_artifact == "" ||
+         img_zips.count(GetBuildZipName(builds.boot.value(), "img")))) {
+      boot_images =
+          extract_from_img_zip(builds.boot.value(), "boot_images", extract_boot);
+    }
+    for (const auto& [name, img_zip] : img_zips) {
+      start_img_zip(name, img_zip);
+    }
 
-    if (builds.otatools.has_value()) {
-      std::vector<std::string> ota_tools_files = CF_EXPECT(
-          DownloadOtaTools(build_api, builds.otatools.value(), target_dir,
-                           flags.keep_downloaded_archives));
-      CF_EXPECT(AddFilesToConfig(FileSource::DEFAULT_BUILD,
-                                 builds.default_build, ota_tools_files, &config,
-                                 target_dir));
+    std::optional<std::future<Result<std::string>>> default_target_files;
+    if (builds.system.has_value() || download_flags.download_target_files_zip) {
+      default_target_files =
+          target_files(builds.default_build, target_dir + "/default");
+    }
+    std::optional<std::future<Result<std::string>>> system_target_files;
+    if (builds.system.has_value()) {
+      system_target_files =
+          target_files(builds.system.value(), target_dir + "/system");
     }
-    if (flags.download_flags.download_img_zip) {
-      std::string local_path = CF_EXPECT(
-          DownloadImageZip(build_api, builds.default_build, target_dir));
-      std::vector<std::string> image_files = CF_EXPECT(ExtractArchiveContents(
-          local_path, target_dir, flags.keep_downloaded_archives));
+    std::optional<std::future<Result<std::string>>> kernel;
+    std::optional<std::future<Result<std::string>>> initramfs;
+    if (builds.kernel.has_value()) {
+      // If the kernel is from an arm/aarch64 build, the artifact will be called
+      // Image.
+      kernel = single_file("kernel", builds.kernel.value(), "bzImage", "Image");
+      initramfs =
+          single_file("initramfs", builds.kernel.value(), "initramfs.img", "");
+    }
+    std::optional<std::future<Result<std::string>>> boot_artifact;
+    if (builds.boot.has_value() && download_flags.boot_artifact != "") {
+      boot_artifact = single_file("boot", builds.boot.value(),
+                                  download_flags.boot_artifact, "");
+    }
+    auto misc_info =
+        single_file("misc_info", builds.default_build, "misc_info.txt", "");
+    std::optional<std::future<Result<std::string>>> bootloader;
+    if (builds.bootloader.has_value()) {
+      // If the bootloader is from an arm/aarch64 build, the artifact will be of
+      // filetype bin.
+      bootloader = single_file("bootloader", builds.bootloader.value(),
+                               "u-boot.rom", "u-boot.bin");
+    }
+    // Returning early waits for the downloads still running in the destructors
+    // of the futures above, so they are cancelled first. Declared after the
+    // futures for it to run before their destructors.
+    ScopeGuard cancel_downloads([&build_api]() { build_api.CancelDownloads(); });
+
+    if (default_images) {
+      Result<std::vector<std::string>> extracted = default_images->get();
+      std::vector<std::string> image_files =
+          CF_EXPECT(MoveIntoPlace(CF_EXPECT(std::move(extracted)),
+                                  staging_dir + "/default_images", target_dir));
       LOG(INFO) << "Adding img-zip files for default build";
       for (auto& file : image_files) {
         LOG(INFO) << file;
@@ -494,12 +668,8 @@ Result<void> FetchCvdMain(int argc, char** argv) {
                                  builds.default_build, image_files, &config,
                                  target_dir));
     }
-    if (builds.system.has_value() ||
-        flags.download_flags.download_target_files_zip) {
-      std::string default_target_dir = target_dir + "/default";
-      CF_EXPECT(EnsureDirectoryExists(default_target_dir), RWX_ALL_MODE);
-      std::string target_files = CF_EXPECT(DownloadTargetFiles(
-          build_api, builds.default_build, default_target_dir));
+    if (default_target_files) {
+      std::string target_files = CF_EXPECT(default_target_files->get());
       LOG(INFO) << "Adding target files for default build";
       CF_EXPECT(AddFilesToConfig(FileSource::DEFAULT_BUILD,
                                  builds.default_build, {target_files}, &config,
@@ -507,59 +677,63 @@ Result<void> FetchCvdMain(int argc, char** argv) {
     }
 
     if (builds.system.has_value()) {
-      bool system_in_img_zip = true;
-      if (flags.download_flags.download_img_zip) {
-        auto image_files = DownloadImages(
-            build_api, builds.system.value(), target_dir,
-            {"system.img", "product.img"}, flags.keep_downloaded_archives);
-        if (!image_files.ok() || image_files->empty()) {
-          LOG(INFO)
-              << "Could not find system image for " << builds.system.value()
-              << "in the img zip. Assuming a super image build, which will "
-              << "get the system image from the target zip.";
-          system_in_img_zip = false;
-        } else {
-          LOG(INFO) << "Adding img-zip files for system build";
-          CF_EXPECT(AddFilesToConfig(FileSource::SYSTEM_BUILD,
-                                     builds.system.value(), *image_files,
-                                     &config, target_dir, true));
+      std::vector<std::string> image_files;
+      if (system_images) {
+        const auto& extracted = system_images->get();
+        if (extracted.ok()) {
+          image_files = CF_EXPECT(MoveIntoPlace(
+              *extracted, staging_dir + "/system_images", target_dir));
         }
       }
-      std::string system_target_dir = target_dir + "/system";
-      CF_EXPECT(EnsureDirectoryExists(system_target_dir, RWX_ALL_MODE));
-      std::string target_files = CF_EXPECT(DownloadTargetFiles(
-          build_api, builds.system.value(), system_target_dir));
+      bool system_in_img_zip = true;
+      if (system_images && image_files.empty()) {
+        LOG(INFO) << "Could not find system image for "
+                  << builds.system.value()
+                  << "in the img zip. Assuming a super image build, which will "
+                  << "get the system image from the target zip.";
+        system_in_img_zip = false;
+      } else if (system_images) {
+        LOG(INFO) << "Adding img-zip files for system build";
+        CF_EXPECT(AddFilesToConfig(FileSource::SYSTEM_BUILD,
+                                   builds.system.value(), image_files, &config,
+                                   target_dir, true));
+      }
+      std::string target_files = CF_EXPECT(system_target_files->get());
       CF_EXPECT(AddFilesToConfig(FileSource::SYSTEM_BUILD,
                                  builds.system.value(), {target_files}, &config,
                                  target_dir));
       if (!system_in_img_zip) {
-        std::string extracted_system = CF_EXPECT(
-            ExtractImage(target_files, target_dir, "IMAGES/system.img",
-                         flags.keep_downloaded_archives));
-        CF_EXPECT(RenameFile(extracted_system, target_dir + "/system.img"));
-
-        Result<std::string> extracted_product_result =
-            ExtractImage(target_files, target_dir, "IMAGES/product.img",
-                         flags.keep_downloaded_archives);
-        if (extracted_product_result.ok()) {
-          CF_EXPECT(RenameFile(extracted_product_result.value(),
-                               target_dir + "/product.img"));
-        }
-
-        Result<std::string> extracted_system_ext_result =
-            ExtractImage(target_files, target_dir, "IMAGES/system_ext.img",
-                         flags.keep_downloaded_archives);
-        if (extracted_system_ext_result.ok()) {
-          CF_EXPECT(RenameFile(extracted_system_ext_result.value(),
-                               target_dir + "/system_ext.img"));
-        }
-
-        Result<std::string> extracted_vbmeta_system =
-            ExtractImage(target_files, target_dir, "IMAGES/vbmeta_system.img",
-                         flags.keep_downloaded_archives);
-        if (extracted_vbmeta_system.ok()) {
-          CF_EXPECT(RenameFile(extracted_vbmeta_system.value(),
-                               target_dir + "/vbmeta_system.img"));
+        auto extract_system = [&]() -> Result<void> {
+          Archive archive(target_files);
+          std::string extracted_system = CF_EXPECT(
+              ExtractImage(archive, target_dir, "IMAGES/system.img", true));
+          CF_EXPECT(RenameFile(extracted_system, target_dir + "/system.img"));
+
+          Result<std::string> extracted_product_result = ExtractImage(
+              archive, target_dir, "IMAGES/product.img", true);
+          if (extracted_product_result.ok()) {
+            CF_EXPECT(RenameFile(extracted_product_result.value(),
+                                 target_dir + "/product.img"));
+          }
+
+          Result<std::string> extracted_system_ext_result = ExtractImage(
+              archive, target_dir, "IMAGES/system_ext.img", true);
+          if (extracted_system_ext_result.ok()) {
+            CF_EXPECT(RenameFile(extracted_system_ext_result.value(),
+                                 target_dir + "/system_ext.img"));
+          }
+
+          Result<std::string> extracted_vbmeta_system = ExtractImage(
+              archive, target_dir, "IMAGES/vbmeta_system.img", true);
+          if (extracted_vbmeta_system.ok()) {
+            CF_EXPECT(RenameFile(extracted_vbmeta_system.value(),
+                                 target_dir + "/vbmeta_system.img"));
+          }
+          return {};
+        };
+        CF_EXPECT(timeline.Run("extract system target files", extract_system));
+        if (!flags.keep_downloaded_archives) {
+          RemoveFile(target_files);
         }
         // This should technically call AddFilesToConfig with the produced
         // files, but it will conflict with the ones produced from the default
@@ -568,64 +742,95 @@ Result<void> FetchCvdMain(int argc, char** argv) {
       }
     }
 
-    if (builds.kernel.has_value()) {
+    if (kernel) {
       std::string local_path = target_dir + "/kernel";
-      // If the kernel is from an arm/aarch64 build, the artifact will be called
-      // Image.
-      std::string kernel_filepath = CF_EXPECT(build_api.DownloadFileWithBackup(
-          builds.kernel.value(), target_dir, "bzImage", "Image"));
-      RenameFile(kernel_filepath, local_path);
+      CF_EXPECT(RenameFile(CF_EXPECT(kernel->get()), local_path));
       CF_EXPECT(AddFilesToConfig(FileSource::KERNEL_BUILD,
                                  builds.kernel.value(), {local_path}, &config,
                                  target_dir));
 
       // Certain kernel builds do not have corresponding ramdisks.
-      Result<std::string> initramfs_img_result = build_api.DownloadFile(
-          builds.kernel.value(), target_dir, "initramfs.img");
+      Result<std::string> initramfs_img_result = initramfs->get();
       if (initramfs_img_result.ok()) {
-        CF_EXPECT(AddFilesToConfig(
-            FileSource::KERNEL_BUILD, builds.kernel.value(),
-            {initramfs_img_result.value()}, &config, target_dir));
+        std::string initramfs_path = target_dir + "/initramfs.img";
+        CF_EXPECT(RenameFile(initramfs_img_result.value(), initramfs_path));
+        CF_EXPECT(AddFilesToConfig(FileSource::KERNEL_BUILD,
+                                   builds.kernel.value(), {initramfs_path},
+                                   &config, target_dir));
       }
     }
 
     if (builds.boot.has_value()) {
-      std::vector<std::string> boot_files = CF_EXPECT(DownloadBoot(
-          build_api, builds.boot.value(), flags.download_flags.boot_artifact,
-          target_dir, flags.keep_downloaded_archives));
+      std::string target_boot = target_dir + "/boot.img";
+      std::vector<std::string> boot_files{target_boot};
+      Result<std::string> artifact_result = CF_ERR("No boot artifact");
+      if (boot_artifact) {
+        artifact_result = boot_artifact->get();
+      }
+      if (artifact_result.ok()) {
+        CF_EXPECT(RenameFile(artifact_result.value(), target_boot));
+      } else {
+        if (boot_artifact) {
+          LOG(INFO) << "Find " << boot_name << " in the img zip";
+        }
+        if (!boot_images) {
+          boot_images = extract_from_img_zip(builds.boot.value(),
+                                             "boot_images", extract_boot);
+          auto name = GetBuildZipName(builds.boot.value(), "img");
+          start_img_zip(name, img_zips.at(name));
+        }
+        Result<std::vector<std::string>> extracted_result = boot_images->get();
+        std::vector<std::string> extracted = CF_EXPECT(
+            MoveIntoPlace(CF_EXPECT(std::move(extracted_result)),
+                          staging_dir + "/boot_images", target_dir));
+        if (extracted[0] != target_boot) {
+          CF_EXPECT(RenameFile(extracted[0], target_boot));
+        }
+        boot_files.insert(boot_files.end(), extracted.begin() + 1,
+                          extracted.end());
+      }
       CF_EXPECT(AddFilesToConfig(FileSource::BOOT_BUILD, builds.boot.value(),
                                  boot_files, &config, target_dir, true));
     }
 
     // Some older builds might not have misc_info.txt, so permit errors on
     // fetching misc_info.txt
-    auto misc_info =
-        DownloadMiscInfo(build_api, builds.default_build, target_dir);
-    if (misc_info.ok()) {
+    Result<std::string> misc_info_result = misc_info.get();
+    if (misc_info_result.ok()) {
+      std::string misc_info_path = target_dir + "/misc_info.txt";
+      CF_EXPECT(RenameFile(misc_info_result.value(), misc_info_path));
       CF_EXPECT(AddFilesToConfig(FileSource::DEFAULT_BUILD,
-                                 builds.default_build, {misc_info.value()},
+                                 builds.default_build, {misc_info_path},
                                  &config, target_dir, true));
     }
 
-    if (builds.bootloader.has_value()) {
+    if (bootloader) {
       std::string local_path = target_dir + "/bootloader";
-      // If the bootloader is from an arm/aarch64 build, the artifact will be of
-      // filetype bin.
-      std::string bootloader_filepath =
-          CF_EXPECT(build_api.DownloadFileWithBackup(builds.bootloader.value(),
-                                                     target_dir, "u-boot.rom",
-                                                     "u-boot.bin"));
-      RenameFile(bootloader_filepath, local_path);
+      CF_EXPECT(RenameFile(CF_EXPECT(bootloader->get()), local_path));
       CF_EXPECT(AddFilesToConfig(FileSource::BOOTLOADER_BUILD,
                                  builds.bootloader.value(), {local_path},
                                  &config, target_dir, true));
     }
 
-    // Wait for ProcessHostPackage to return.
-    CF_EXPECT(process_pkg_ret.get(),
-              "Could not download host package for " << builds.default_build);
+    if (ota_tools) {
+      std::vector<std::string> ota_tools_files = CF_EXPECT(ota_tools->get());
+      CF_EXPECT(AddFilesToConfig(FileSource::DEFAULT_BUILD,
+                                 builds.default_build, ota_tools_files, &config,
+                                 target_dir));
+    }
+    std::vector<std::string> host_package_files =
+        CF_EXPECT(host_package.get(), "Could not download host package for "
+                                          << builds.default_build);
+    CF_EXPECT(AddFilesToConfig(flags.build_source_flags.host_package_build != ""
+                                   ? FileSource::HOST_PACKAGE_BUILD
+                                   : FileSource::DEFAULT_BUILD,
+                               builds.host_package.value(), host_package_files,
+                               &config, target_dir));
+
+    cancel_downloads.Cancel();
   }
   curl_global_cleanup();
+  LOG(INFO) << timeline.Summary();
 
   // Due to constraints of the build system, artifacts intentionally cannot
   // determine their own build id. So it's unclear which build number fetch_cvd
@@ -0,0 +1,55 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/cvd/fetch/fetch_timeline.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace cuttlefish {
+
+std::string FetchTimeline::Summary() {
+  static constexpr int kWidth = 40;
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::sort(stages_.begin(), stages_.end(),
+            [](const Stage& a, const Stage& b) { return a.start < b.start; });
+  auto end = origin_;
+  for (const auto& stage : stages_) {
+    end = std::max(end, stage.end);
+  }
+  double total = Seconds(end - origin_);
+  std::stringstream summary;
+  summary << std::fixed << std::setprecision(1) << "Fetch timeline, "
+          << total << "s total:\n";
+  for (const auto& stage : stages_) {
+    double start = Seconds(stage.start - origin_);
+    double duration = Seconds(stage.end - stage.start);
+    int first = total > 0 ? (int)(kWidth * start / total) : 0;
+    int last = total > 0 ? (int)(kWidth * (start + duration) / total) : 0;
+    std::string bar(kWidth, ' ');
+    for (int i = first; i <= std::min(last, kWidth - 1); i++) {
+      bar[i] = '#';
+    }
+    summary << std::setw(7) << start << "s " << std::setw(7) << duration
+            << "s |" << bar << "| " << stage.name
+            << (stage.ok ? "" : " (failed)") << "\n";
+  }
+  return summary.str();
+}
+
+}  // namespace cuttlefish
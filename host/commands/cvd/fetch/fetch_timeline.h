@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+
+/**
+ * Records when each stage of a fetch ran, so that a summary showing how the
+ * downloads and extractions overlapped can be printed at the end.
+ */
+class FetchTimeline {
+ public:
+  FetchTimeline() : origin_(std::chrono::steady_clock::now()) {}
+
+  // Runs `stage` on the calling thread.
+  template <typename F>
+  auto Run(const std::string& name, const F& stage) -> decltype(stage()) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = stage();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stages_.push_back(Stage{
+        .name = name,
+        .start = start,
+        .end = std::chrono::steady_clock::now(),
+        .ok = result.ok(),
+    });
+    return result;
+  }
+
+  // Runs `stage` on a new thread. Its Result, successful or not, is returned
+  // through the future.
+  template <typename F>
+  auto Async(const std::string& name, F stage) {
+    return std::async(std::launch::async,
+                      [this, name, stage]() { return Run(name, stage); });
+  }
+
+  // One line per stage in the order they started, with a bar showing when
+  // it ran. Failed stages are marked as such.
+  std::string Summary();
+
+ private:
+  struct Stage {
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    bool ok;
+  };
+
+  static double Seconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  std::chrono::steady_clock::time_point origin_;
+  std::mutex mutex_;
+  std::vector<Stage> stages_;
+};
+
+}  // namespace cuttlefish
@@ -28,8 +28,10 @@
 #include <string>
 #include <thread>
 
+#include "common/libs/utils/files.h"
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/instance_manager.h"
 #include "host/commands/cvd/reset_client_utils.h"
 
 namespace cuttlefish {
@@ -181,6 +183,11 @@ Result<void> HandleReset(CvdClient& client,
   CF_EXPECT(KillAllCuttlefishInstances(
       {.cvd_server_children_only = options.device_by_cvd_only,
        .clear_instance_dirs = options.clean_runtime_dir}));
+  // Otherwise the next server would bring back the devices killed above
+  const auto journal_path = CF_EXPECT(InstanceManager::JournalPath(getuid()));
+  if (FileExists(journal_path) && !RemoveFile(journal_path)) {
+    LOG(ERROR) << "Failed to remove " << journal_path;
+  }
   return {};
 }
 
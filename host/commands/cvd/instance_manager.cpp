@@ -17,6 +17,8 @@
 #include "host/commands/cvd/instance_manager.h"
 
 #include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include <map>
 #include <mutex>
@@ -32,6 +34,7 @@
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
+#include "common/libs/utils/users.h"
 #include "cvd_server.pb.h"
 #include "host/commands/cvd/common_utils.h"
 #include "host/commands/cvd/selector/instance_database_utils.h"
@@ -89,6 +92,30 @@ Result<void> InstanceManager::LoadFromJson(const uid_t uid,
   return {};
 }
 
+Result<std::string> InstanceManager::JournalPath(const uid_t uid) {
+  // Private to uid, as the records decide what the server stops later
+  const auto dir = CF_EXPECT(SystemWideUserHome(uid)) + "/.cvd";
+  CF_EXPECT(EnsureDirectoryExists(dir, S_IRWXU));
+  struct stat st;
+  CF_EXPECT(lstat(dir.c_str(), &st) == 0,
+            "Could not stat \"" << dir << "\": " << strerror(errno));
+  CF_EXPECT(S_ISDIR(st.st_mode) && st.st_uid == uid,
+            "\"" << dir << "\" is not a directory owned by " << uid);
+  if ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    CF_EXPECT(chmod(dir.c_str(), S_IRWXU) == 0,
+              "Could not restrict \"" << dir << "\": " << strerror(errno));
+  }
+  return dir + "/instance_database.journal";
+}
+
+Result<void> InstanceManager::AttachJournal(const uid_t uid,
+                                            const std::string& path) {
+  std::lock_guard lock(instance_db_mutex_);
+  auto& db = GetInstanceDB(uid);
+  CF_EXPECT(db.AttachJournal(path));
+  return {};
+}
+
 Result<InstanceManager::GroupCreationInfo> InstanceManager::Analyze(
     const std::string& sub_cmd, const CreationAnalyzerParam& param,
     const ucred& credential) {
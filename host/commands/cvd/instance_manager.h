@@ -111,6 +111,11 @@ class InstanceManager {
   Result<Json::Value> Serialize(const uid_t uid);
   Result<void> LoadFromJson(const uid_t uid, const Json::Value&);
 
+  // Where the server journals the instance database of uid, so it outlives
+  // the server process. Kept in a directory only uid can access.
+  static Result<std::string> JournalPath(const uid_t uid);
+  Result<void> AttachJournal(const uid_t uid, const std::string& path);
+
  private:
   Result<cvd::Status> CvdFleetImpl(const uid_t uid, const SharedFD& out,
                                    const SharedFD& err);
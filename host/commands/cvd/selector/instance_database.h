@@ -16,12 +16,15 @@
 
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "common/libs/utils/result.h"
 #include "host/commands/cvd/selector/constant_reference.h"
+#include "host/commands/cvd/selector/instance_database_journal.h"
 #include "host/commands/cvd/selector/instance_database_types.h"
 #include "host/commands/cvd/selector/instance_group_record.h"
 #include "host/commands/cvd/selector/instance_record.h"
@@ -58,6 +61,20 @@ class InstanceDatabase {
   Json::Value Serialize() const;
   Result<void> LoadFromJson(const Json::Value&);
 
+  /**
+   * Keeps the database in the journal at path from now on.
+   *
+   * An empty database is loaded from what the journal already records. A
+   * database that already holds groups replaces it instead. Either way the
+   * journal is then compacted into a snapshot. Each later change
+   * appends one record, and the journal is compacted again once it holds
+   * kCompactionRatio records per group (and at least kMinRecordsToCompact).
+   *
+   * The in-memory database stays authoritative: failing to append to the
+   * journal is logged, and doesn't undo the change.
+   */
+  Result<void> AttachJournal(const std::string& path);
+
   /**
    * Adds instance to the group.
    *
@@ -144,11 +161,36 @@ class InstanceDatabase {
 
   Result<void> LoadGroupFromJson(const Json::Value& group_json);
 
+  // keep the indexes below in sync with local_instance_groups_
+  void IndexGroup(LocalInstanceGroup& group);
+  void IndexInstance(const LocalInstance& instance);
+  void UnindexGroup(const LocalInstanceGroup& group);
+
+  Result<void> AddInstanceToGroup(LocalInstanceGroup& group, const unsigned id,
+                                  const std::string& instance_name);
+
+  Result<void> Replay(const Json::Value& record);
+  void AppendToJournal(const Json::Value& record);
+  void AppendGroupToJournal(const LocalInstanceGroup& group);
+
   std::vector<std::unique_ptr<LocalInstanceGroup>> local_instance_groups_;
   Map<FieldName, ConstGroupHandler> group_handlers_;
   Map<FieldName, ConstInstanceHandler> instance_handlers_;
 
+  // Secondary indexes for the queries, owned by local_instance_groups_
+  Map<std::string, LocalInstanceGroup*> groups_by_name_;
+  Map<std::string, LocalInstanceGroup*> groups_by_home_;
+  // by the realpath of the HOME, taken when the group is added
+  Map<std::string, LocalInstanceGroup*> groups_by_home_realpath_;
+  Map<unsigned, const LocalInstance*> instances_by_id_;
+  // per-instance names are unique only within a group
+  Map<std::string, Set<ConstRef<LocalInstance>>> instances_by_name_;
+
+  std::unique_ptr<InstanceDatabaseJournal> journal_;
+
   static constexpr const char kJsonGroups[] = "Groups";
+  static constexpr std::size_t kCompactionRatio = 4;
+  static constexpr std::size_t kMinRecordsToCompact = 64;
 };
 
 }  // namespace selector
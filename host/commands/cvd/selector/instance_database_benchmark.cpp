@@ -0,0 +1,192 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of the selector queries and of the journaled changes to
+// an InstanceDatabase against the number of instances in it. Each group has
+// kInstancesPerGroup instances, and every group uses the same per-instance
+// names, like groups created from the same config do.
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/cvd/selector/instance_database.h"
+#include "host/commands/cvd/selector/selector_constants.h"
+
+namespace cuttlefish {
+namespace selector {
+namespace {
+
+constexpr int kInstancesPerGroup = 4;
+
+std::string GroupName(int group) { return "group_" + std::to_string(group); }
+
+class Workspace {
+ public:
+  Workspace() {
+    // AddInstanceGroup() checks for a launcher in the host artifacts
+    CHECK(EnsureDirectoryExists(HostArtifactsPath() + "/bin").ok());
+    CHECK(SharedFD::Creat(HostArtifactsPath() + "/bin/launch_cvd", 0755)
+              ->IsOpen());
+  }
+
+  std::string HostArtifactsPath() const {
+    return std::string(dir_.path) + "/host_out";
+  }
+  std::string Home(int group) const {
+    return std::string(dir_.path) + "/" + GroupName(group);
+  }
+  std::string JournalPath() const {
+    return std::string(dir_.path) + "/instance_db.journal";
+  }
+
+  void AddGroup(InstanceDatabase& db, int group) const {
+    CHECK(EnsureDirectoryExists(Home(group)).ok());
+    auto added = db.AddInstanceGroup({
+        .group_name = GroupName(group),
+        .home_dir = Home(group),
+        .host_artifacts_path = HostArtifactsPath(),
+        .product_out_path = HostArtifactsPath(),
+    });
+    CHECK(added.ok()) << added.error().Trace();
+    std::vector<InstanceDatabase::InstanceInfo> instances;
+    for (int i = 0; i < kInstancesPerGroup; i++) {
+      instances.push_back({
+          .id = static_cast<unsigned>(group * kInstancesPerGroup + i + 1),
+          .name = std::to_string(i + 1),
+      });
+    }
+    CHECK(db.AddInstances(GroupName(group), instances).ok());
+  }
+
+  // Fills a database with `instances` instances, with a journal if asked to
+  void Fill(InstanceDatabase& db, int instances, bool journal) const {
+    if (journal) {
+      RemoveFile(JournalPath());
+      CHECK(db.AttachJournal(JournalPath()).ok());
+    }
+    for (int group = 0; group < instances / kInstancesPerGroup; group++) {
+      AddGroup(db, group);
+    }
+  }
+
+ private:
+  TemporaryDir dir_;
+};
+
+void BM_FindGroupByHome(benchmark::State& state) {
+  static Workspace workspace;
+  InstanceDatabase db;
+  workspace.Fill(db, state.range(0), false);
+  const auto home = workspace.Home(state.range(0) / kInstancesPerGroup / 2);
+  for (auto _ : state) {
+    auto group = db.FindGroup({kHomeField, home});
+    CHECK(group.ok());
+    benchmark::DoNotOptimize(group);
+  }
+}
+
+void BM_FindInstanceById(benchmark::State& state) {
+  static Workspace workspace;
+  InstanceDatabase db;
+  workspace.Fill(db, state.range(0), false);
+  const auto id = std::to_string(state.range(0) / 2);
+  for (auto _ : state) {
+    auto instance = db.FindInstance({kInstanceIdField, id});
+    CHECK(instance.ok());
+    benchmark::DoNotOptimize(instance);
+  }
+}
+
+void BM_FindInstanceByGroupAndName(benchmark::State& state) {
+  static Workspace workspace;
+  InstanceDatabase db;
+  workspace.Fill(db, state.range(0), false);
+  const Queries queries = {
+      {kGroupNameField, GroupName(state.range(0) / kInstancesPerGroup / 2)},
+      {kInstanceNameField, std::to_string(kInstancesPerGroup)},
+  };
+  for (auto _ : state) {
+    auto instance = db.FindInstance(queries);
+    CHECK(instance.ok());
+    benchmark::DoNotOptimize(instance);
+  }
+}
+
+// Adds and removes one group, like "cvd start" followed by "cvd stop"
+void BM_AddRemoveGroup(benchmark::State& state) {
+  static Workspace workspace;
+  InstanceDatabase db;
+  workspace.Fill(db, state.range(0), state.range(1));
+  const int group = state.range(0) / kInstancesPerGroup;
+  for (auto _ : state) {
+    workspace.AddGroup(db, group);
+    CHECK(db.RemoveInstanceGroup(GroupName(group)));
+  }
+}
+
+void BM_SetBuildId(benchmark::State& state) {
+  static Workspace workspace;
+  InstanceDatabase db;
+  workspace.Fill(db, state.range(0), state.range(1));
+  const auto group = GroupName(state.range(0) / kInstancesPerGroup / 2);
+  for (auto _ : state) {
+    CHECK(db.SetBuildId(group, "1234").ok());
+  }
+}
+
+void BM_AttachJournal(benchmark::State& state) {
+  static Workspace workspace;
+  {
+    InstanceDatabase db;
+    workspace.Fill(db, state.range(0), true);
+  }
+  for (auto _ : state) {
+    InstanceDatabase db;
+    CHECK(db.AttachJournal(workspace.JournalPath()).ok());
+  }
+}
+
+BENCHMARK(BM_FindGroupByHome)->ArgName("instances")->Range(16, 1024);
+BENCHMARK(BM_FindInstanceById)->ArgName("instances")->Range(16, 1024);
+BENCHMARK(BM_FindInstanceByGroupAndName)
+    ->ArgName("instances")
+    ->Range(16, 1024);
+BENCHMARK(BM_AddRemoveGroup)
+    ->ArgNames({"instances", "journal"})
+    ->ArgsProduct({{16, 128, 1024}, {0, 1}});
+BENCHMARK(BM_SetBuildId)
+    ->ArgNames({"instances", "journal"})
+    ->ArgsProduct({{16, 128, 1024}, {0, 1}});
+BENCHMARK(BM_AttachJournal)
+    ->ArgName("instances")
+    ->Range(16, 1024)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace selector
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  // Creating the homes logs every directory
+  android::base::SetMinimumLogSeverity(android::base::WARNING);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -21,10 +21,12 @@
 #include <sstream>
 
 #include <android-base/file.h>
+#include <android-base/logging.h>
 #include <android-base/parseint.h>
 
 #include "common/libs/utils/contains.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/scope_guard.h"
 #include "host/commands/cvd/common_utils.h"
 #include "host/commands/cvd/selector/instance_database_utils.h"
 #include "host/commands/cvd/selector/selector_constants.h"
@@ -44,7 +46,56 @@ InstanceDatabase::FindIterator(const LocalInstanceGroup& group) {
   return local_instance_groups_.end();
 }
 
-void InstanceDatabase::Clear() { local_instance_groups_.clear(); }
+void InstanceDatabase::Clear() {
+  local_instance_groups_.clear();
+  groups_by_name_.clear();
+  groups_by_home_.clear();
+  groups_by_home_realpath_.clear();
+  instances_by_id_.clear();
+  instances_by_name_.clear();
+  AppendToJournal(InstanceDatabaseJournal::ClearRecord());
+}
+
+void InstanceDatabase::IndexGroup(LocalInstanceGroup& group) {
+  groups_by_name_[group.GroupName()] = std::addressof(group);
+  groups_by_home_[group.HomeDir()] = std::addressof(group);
+  std::string home_realpath;
+  if (android::base::Realpath(group.HomeDir(), std::addressof(home_realpath))) {
+    groups_by_home_realpath_[home_realpath] = std::addressof(group);
+  }
+  for (const auto& instance : group.Instances()) {
+    IndexInstance(*instance);
+  }
+}
+
+void InstanceDatabase::IndexInstance(const LocalInstance& instance) {
+  instances_by_id_[instance.InstanceId()] = std::addressof(instance);
+  instances_by_name_[instance.PerInstanceName()].insert(Cref(instance));
+}
+
+void InstanceDatabase::UnindexGroup(const LocalInstanceGroup& group) {
+  groups_by_name_.erase(group.GroupName());
+  groups_by_home_.erase(group.HomeDir());
+  for (auto itr = groups_by_home_realpath_.begin();
+       itr != groups_by_home_realpath_.end();) {
+    if (itr->second == std::addressof(group)) {
+      itr = groups_by_home_realpath_.erase(itr);
+    } else {
+      itr++;
+    }
+  }
+  for (const auto& instance : group.Instances()) {
+    instances_by_id_.erase(instance->InstanceId());
+    auto by_name = instances_by_name_.find(instance->PerInstanceName());
+    if (by_name == instances_by_name_.end()) {
+      continue;
+    }
+    by_name->second.erase(Cref(*instance));
+    if (by_name->second.empty()) {
+      instances_by_name_.erase(by_name);
+    }
+  }
+}
 
 Result<ConstRef<LocalInstanceGroup>> InstanceDatabase::AddInstanceGroup(
     const AddInstanceGroupParam& param) {
@@ -58,8 +109,7 @@ Result<ConstRef<LocalInstanceGroup>> InstanceDatabase::AddInstanceGroup(
   std::vector<Query> queries = {{kHomeField, param.home_dir},
                                 {kGroupNameField, param.group_name}};
   for (const auto& query : queries) {
-    auto instance_groups =
-        CF_EXPECT(Find<LocalInstanceGroup>(query, group_handlers_));
+    auto instance_groups = CF_EXPECT(FindGroups(query));
     std::stringstream err_msg;
     err_msg << query.field_name_ << " : " << query.field_value_
             << " is already taken.";
@@ -73,40 +123,50 @@ Result<ConstRef<LocalInstanceGroup>> InstanceDatabase::AddInstanceGroup(
   CF_EXPECT(new_group != nullptr);
   local_instance_groups_.emplace_back(new_group);
   const auto raw_ptr = local_instance_groups_.back().get();
+  IndexGroup(*raw_ptr);
+  AppendGroupToJournal(*raw_ptr);
   ConstRef<LocalInstanceGroup> const_ref = *raw_ptr;
   return {const_ref};
 }
 
-Result<void> InstanceDatabase::AddInstance(const std::string& group_name,
-                                           const unsigned id,
-                                           const std::string& instance_name) {
-  LocalInstanceGroup* group_ptr = CF_EXPECT(FindMutableGroup(group_name));
-  LocalInstanceGroup& group = *group_ptr;
-
+Result<void> InstanceDatabase::AddInstanceToGroup(
+    LocalInstanceGroup& group, const unsigned id,
+    const std::string& instance_name) {
   CF_EXPECT(IsValidInstanceName(instance_name),
             "instance_name " << instance_name << " is invalid.");
-  auto itr = FindIterator(group);
-  CF_EXPECT(
-      itr != local_instance_groups_.end() && *itr != nullptr,
-      "Adding instances to non-existing group " + group.InternalGroupName());
-
-  auto instances =
-      CF_EXPECT(FindInstances({kInstanceIdField, std::to_string(id)}));
-  if (instances.size() != 0) {
+  if (Contains(instances_by_id_, id)) {
     return CF_ERR("instance id " << id << " is taken");
   }
 
-  auto instances_by_name = CF_EXPECT((*itr)->FindByInstanceName(instance_name));
+  auto instances_by_name = CF_EXPECT(group.FindByInstanceName(instance_name));
   if (!instances_by_name.empty()) {
     return CF_ERR("instance name " << instance_name << " is taken");
   }
-  return (*itr)->AddInstance(id, instance_name);
+  CF_EXPECT(group.AddInstance(id, instance_name));
+  auto added = CF_EXPECT(group.FindById(id));
+  CF_EXPECT_EQ(added.size(), 1);
+  IndexInstance(added.cbegin()->Get());
+  return {};
+}
+
+Result<void> InstanceDatabase::AddInstance(const std::string& group_name,
+                                           const unsigned id,
+                                           const std::string& instance_name) {
+  LocalInstanceGroup* group_ptr = CF_EXPECT(FindMutableGroup(group_name));
+  CF_EXPECT(AddInstanceToGroup(*group_ptr, id, instance_name));
+  AppendGroupToJournal(*group_ptr);
+  return {};
 }
 
 Result<void> InstanceDatabase::AddInstances(
     const std::string& group_name, const std::vector<InstanceInfo>& instances) {
+  LocalInstanceGroup* group_ptr = CF_EXPECT(FindMutableGroup(group_name));
+  // One record for the whole batch, including what was added before an error
+  ScopeGuard journal_group(
+      [this, group_ptr]() { AppendGroupToJournal(*group_ptr); });
   for (const auto& instance_info : instances) {
-    CF_EXPECT(AddInstance(group_name, instance_info.id, instance_info.name));
+    CF_EXPECT(
+        AddInstanceToGroup(*group_ptr, instance_info.id, instance_info.name));
   }
   return {};
 }
@@ -116,21 +176,16 @@ Result<void> InstanceDatabase::SetBuildId(const std::string& group_name,
   auto* group_ptr = CF_EXPECT(FindMutableGroup(group_name));
   auto& group = *group_ptr;
   group.SetBuildId(build_id);
+  AppendGroupToJournal(group);
   return {};
 }
 
 Result<LocalInstanceGroup*> InstanceDatabase::FindMutableGroup(
     const std::string& group_name) {
-  LocalInstanceGroup* group_ptr = nullptr;
-  for (auto& group_uniq_ptr : local_instance_groups_) {
-    if (group_uniq_ptr && group_uniq_ptr->GroupName() == group_name) {
-      group_ptr = group_uniq_ptr.get();
-      break;
-    }
-  }
-  CF_EXPECT(group_ptr != nullptr,
+  auto itr = groups_by_name_.find(group_name);
+  CF_EXPECT(itr != groups_by_name_.end(),
             "Instance Group named as " << group_name << " is not found.");
-  return group_ptr;
+  return itr->second;
 }
 
 bool InstanceDatabase::RemoveInstanceGroup(const std::string& group_name) {
@@ -148,63 +203,57 @@ bool InstanceDatabase::RemoveInstanceGroup(const LocalInstanceGroup& group) {
   if (itr == local_instance_groups_.end() || !(*itr)) {
     return false;
   }
+  const std::string group_name = group.GroupName();
+  UnindexGroup(**itr);
   local_instance_groups_.erase(itr);
+  AppendToJournal(InstanceDatabaseJournal::RemoveRecord(group_name));
   return true;
 }
 
 Result<Set<ConstRef<LocalInstanceGroup>>> InstanceDatabase::FindGroupsByHome(
     const std::string& home) const {
-  auto subset = CollectToSet<LocalInstanceGroup>(
-      local_instance_groups_,
-      [&home](const std::unique_ptr<LocalInstanceGroup>& group) {
-        if (!group) {
-          return false;
-        }
-        if (group->HomeDir() == home) {
-          return true;
-        }
-        if (group->HomeDir().empty() || home.empty()) {
-          return false;
-        }
-        // The two paths must be an absolute path.
-        // this is guaranteed by the CreationAnalyzer
-        std::string home_realpath;
-        std::string group_home_realpath;
-        if (!android::base::Realpath(home, std::addressof(home_realpath))) {
-          return false;
-        }
-        if (!android::base::Realpath(group->HomeDir(),
-                                     std::addressof(group_home_realpath))) {
-          return false;
-        }
-        return home_realpath == group_home_realpath;
-      });
-  return AtMostOne(subset, GenerateTooManyInstancesErrorMsg(1, kHomeField));
+  Set<ConstRef<LocalInstanceGroup>> subset;
+  if (auto itr = groups_by_home_.find(home); itr != groups_by_home_.end()) {
+    subset.insert(Cref(*itr->second));
+    return subset;
+  }
+  if (home.empty()) {
+    return subset;
+  }
+  // The two paths must be an absolute path.
+  // this is guaranteed by the CreationAnalyzer
+  std::string home_realpath;
+  if (!android::base::Realpath(home, std::addressof(home_realpath))) {
+    return subset;
+  }
+  if (auto itr = groups_by_home_realpath_.find(home_realpath);
+      itr != groups_by_home_realpath_.end()) {
+    subset.insert(Cref(*itr->second));
+  }
+  return subset;
 }
 
 Result<Set<ConstRef<LocalInstanceGroup>>>
 InstanceDatabase::FindGroupsByGroupName(const std::string& group_name) const {
-  auto subset = CollectToSet<LocalInstanceGroup>(
-      local_instance_groups_,
-      [&group_name](const std::unique_ptr<LocalInstanceGroup>& group) {
-        return (group && group->GroupName() == group_name);
-      });
-  return AtMostOne(subset,
-                   GenerateTooManyInstancesErrorMsg(1, kGroupNameField));
+  Set<ConstRef<LocalInstanceGroup>> subset;
+  if (auto itr = groups_by_name_.find(group_name);
+      itr != groups_by_name_.end()) {
+    subset.insert(Cref(*itr->second));
+  }
+  return subset;
 }
 
 Result<Set<ConstRef<LocalInstanceGroup>>>
 InstanceDatabase::FindGroupsByInstanceName(
     const std::string& instance_name) const {
-  auto subset = CollectToSet<LocalInstanceGroup>(
-      local_instance_groups_,
-      [&instance_name](const std::unique_ptr<LocalInstanceGroup>& group) {
-        if (!group) {
-          return false;
-        }
-        auto instance_set_result = group->FindByInstanceName(instance_name);
-        return instance_set_result.ok() && (instance_set_result->size() == 1);
-      });
+  Set<ConstRef<LocalInstanceGroup>> subset;
+  auto itr = instances_by_name_.find(instance_name);
+  if (itr == instances_by_name_.end()) {
+    return subset;
+  }
+  for (const auto& instance : itr->second) {
+    subset.insert(Cref(instance.Get().ParentGroup()));
+  }
   return subset;
 }
 
@@ -214,46 +263,31 @@ Result<Set<ConstRef<LocalInstance>>> InstanceDatabase::FindInstancesById(
   if (!android::base::ParseInt(id, &parsed_int)) {
     return CF_ERR(id << " cannot be converted to an integer");
   }
-  auto collector =
-      [parsed_int](const std::unique_ptr<LocalInstanceGroup>& group)
-      -> Result<Set<ConstRef<LocalInstance>>> {
-    CF_EXPECT(group != nullptr);
-    return group->FindById(parsed_int);
-  };
-  auto subset = CollectAllElements<LocalInstance, LocalInstanceGroup>(
-      collector, local_instance_groups_);
-  CF_EXPECT(subset.ok());
-  return AtMostOne(*subset,
-                   GenerateTooManyInstancesErrorMsg(1, kInstanceIdField));
+  Set<ConstRef<LocalInstance>> subset;
+  if (auto itr = instances_by_id_.find(parsed_int);
+      itr != instances_by_id_.end()) {
+    subset.insert(Cref(*itr->second));
+  }
+  return subset;
 }
 
 Result<Set<ConstRef<LocalInstance>>>
 InstanceDatabase::FindInstancesByInstanceName(
     const Value& instance_specific_name) const {
-  auto collector = [&instance_specific_name](
-                       const std::unique_ptr<LocalInstanceGroup>& group)
-      -> Result<Set<ConstRef<LocalInstance>>> {
-    CF_EXPECT(group != nullptr);
-    return (group->FindByInstanceName(instance_specific_name));
-  };
-  return CollectAllElements<LocalInstance, LocalInstanceGroup>(
-      collector, local_instance_groups_);
+  auto itr = instances_by_name_.find(instance_specific_name);
+  if (itr == instances_by_name_.end()) {
+    return Set<ConstRef<LocalInstance>>{};
+  }
+  return itr->second;
 }
 
 Result<Set<ConstRef<LocalInstance>>> InstanceDatabase::FindInstancesByGroupName(
     const Value& group_name) const {
-  auto collector =
-      [&group_name](const std::unique_ptr<LocalInstanceGroup>& group)
-      -> Result<Set<ConstRef<LocalInstance>>> {
-    CF_EXPECT(group != nullptr);
-    if (group->GroupName() != group_name) {
-      Set<ConstRef<LocalInstance>> empty_set;
-      return empty_set;
-    }
-    return (group->FindAllInstances());
-  };
-  return CollectAllElements<LocalInstance, LocalInstanceGroup>(
-      collector, local_instance_groups_);
+  auto itr = groups_by_name_.find(group_name);
+  if (itr == groups_by_name_.end()) {
+    return Set<ConstRef<LocalInstance>>{};
+  }
+  return itr->second->FindAllInstances();
 }
 
 Json::Value InstanceDatabase::Serialize() const {
@@ -326,5 +360,72 @@ Result<void> InstanceDatabase::LoadFromJson(const Json::Value& db_json) {
   return {};
 }
 
+Result<void> InstanceDatabase::AttachJournal(const std::string& path) {
+  CF_EXPECT(journal_ == nullptr, "A journal is already attached");
+  auto journal = CF_EXPECT(InstanceDatabaseJournal::Open(path));
+  // Groups already in the database, e.g. carried over by a restarting
+  // server, are at least as recent as the journal
+  if (IsEmpty()) {
+    for (const auto& record : journal->Records()) {
+      auto replayed = Replay(record);
+      if (!replayed.ok()) {
+        Clear();
+        CF_EXPECT(std::move(replayed), "Failed to replay \"" << path << "\"");
+      }
+    }
+  }
+  CF_EXPECT(journal->Compact(Serialize()));
+  journal_ = std::move(journal);
+  return {};
+}
+
+Result<void> InstanceDatabase::Replay(const Json::Value& record) {
+  using Journal = InstanceDatabaseJournal;
+  const std::string op = record[Journal::kJsonOp].asString();
+  if (op == Journal::kOpSnapshot) {
+    Clear();
+    CF_EXPECT(LoadFromJson(record[Journal::kJsonDatabase]));
+  } else if (op == Journal::kOpPut) {
+    const Json::Value& group_json = record[Journal::kJsonGroup];
+    RemoveInstanceGroup(
+        group_json[LocalInstanceGroup::kJsonGroupName].asString());
+    CF_EXPECT(LoadGroupFromJson(group_json));
+  } else if (op == Journal::kOpRemove) {
+    RemoveInstanceGroup(record[Journal::kJsonGroupName].asString());
+  } else if (op == Journal::kOpClear) {
+    Clear();
+  } else {
+    return CF_ERR("Unknown journal record \"" << op << "\"");
+  }
+  return {};
+}
+
+void InstanceDatabase::AppendGroupToJournal(const LocalInstanceGroup& group) {
+  if (journal_) {
+    AppendToJournal(InstanceDatabaseJournal::PutRecord(group.Serialize()));
+  }
+}
+
+void InstanceDatabase::AppendToJournal(const Json::Value& record) {
+  if (!journal_) {
+    return;
+  }
+  auto appended = journal_->Append(record);
+  if (!appended.ok()) {
+    // A snapshot brings the journal back in line with the database
+    LOG(ERROR) << appended.error().Trace();
+  }
+  const auto compaction_threshold = std::max(
+      kMinRecordsToCompact, kCompactionRatio * local_instance_groups_.size());
+  if (appended.ok() && journal_->Size() < compaction_threshold) {
+    return;
+  }
+  auto compacted = journal_->Compact(Serialize());
+  if (!compacted.ok()) {
+    LOG(ERROR) << "Failed to compact the instance database journal: "
+               << compacted.error().Trace();
+  }
+}
+
 }  // namespace selector
 }  // namespace cuttlefish
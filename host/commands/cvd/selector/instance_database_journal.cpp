@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/selector/instance_database_journal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string_view>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace selector {
+namespace {
+
+// The records drive what the server later stops, so the journal is never
+// reached through a symlink
+constexpr int kAppendFlags = O_WRONLY | O_APPEND | O_CLOEXEC | O_NOFOLLOW;
+
+Result<void> CheckOwnedRegularFile(SharedFD fd, const std::string& path) {
+  struct stat st;
+  CF_EXPECT(fd->Fstat(&st) == 0,
+            "Could not stat \"" << path << "\": " << fd->StrError());
+  CF_EXPECT(S_ISREG(st.st_mode), "\"" << path << "\" is not a regular file");
+  CF_EXPECT(st.st_uid == geteuid(),
+            "\"" << path << "\" is owned by " << st.st_uid << ", not "
+                 << geteuid());
+  return {};
+}
+
+std::unique_ptr<Json::StreamWriter> LineWriter() {
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  return std::unique_ptr<Json::StreamWriter>(factory.newStreamWriter());
+}
+
+}  // namespace
+
+Json::Value InstanceDatabaseJournal::SnapshotRecord(
+    const Json::Value& db_json) {
+  Json::Value record;
+  record[kJsonOp] = kOpSnapshot;
+  record[kJsonDatabase] = db_json;
+  return record;
+}
+
+Json::Value InstanceDatabaseJournal::PutRecord(Json::Value group_json) {
+  Json::Value record;
+  record[kJsonOp] = kOpPut;
+  record[kJsonGroup] = std::move(group_json);
+  return record;
+}
+
+Json::Value InstanceDatabaseJournal::RemoveRecord(
+    const std::string& group_name) {
+  Json::Value record;
+  record[kJsonOp] = kOpRemove;
+  record[kJsonGroupName] = group_name;
+  return record;
+}
+
+Json::Value InstanceDatabaseJournal::ClearRecord() {
+  Json::Value record;
+  record[kJsonOp] = kOpClear;
+  return record;
+}
+
+Result<std::unique_ptr<InstanceDatabaseJournal>> InstanceDatabaseJournal::Open(
+    const std::string& path) {
+  // Read through the descriptor that was checked, not the path again
+  auto fd = SharedFD::Open(path, O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC |
+                                     O_NOFOLLOW,
+                           0600);
+  CF_EXPECT(fd->IsOpen(),
+            "Could not open \"" << path << "\": " << fd->StrError());
+  CF_EXPECT(CheckOwnedRegularFile(fd, path));
+  std::string contents;
+  CF_EXPECT(ReadAll(fd, &contents) >= 0,
+            "Could not read \"" << path << "\": " << fd->StrError());
+
+  std::vector<Json::Value> records;
+  std::string_view remaining = contents;
+  while (!remaining.empty()) {
+    auto end = remaining.find('\n');
+    if (end == std::string_view::npos) {
+      // Only the last append can be cut short
+      LOG(WARNING) << "Dropping the incomplete last record of \"" << path
+                   << "\"";
+      auto complete = contents.size() - remaining.size();
+      CF_EXPECT(fd->Truncate(complete) == 0,
+                "Could not truncate \"" << path << "\": " << fd->StrError());
+      break;
+    }
+    auto record = CF_EXPECT(ParseJson(remaining.substr(0, end)),
+                            "Corrupted record in \"" << path << "\"");
+    records.emplace_back(std::move(record));
+    remaining.remove_prefix(end + 1);
+  }
+  return std::unique_ptr<InstanceDatabaseJournal>(
+      new InstanceDatabaseJournal(path, fd, std::move(records)));
+}
+
+InstanceDatabaseJournal::InstanceDatabaseJournal(
+    const std::string& path, SharedFD fd, std::vector<Json::Value> records)
+    : path_(path),
+      fd_(std::move(fd)),
+      records_(std::move(records)),
+      size_(records_.size()),
+      // Building a writer costs more than writing a record with it
+      writer_(LineWriter()) {}
+
+std::string InstanceDatabaseJournal::ToLine(const Json::Value& record) const {
+  std::stringstream line;
+  writer_->write(record, &line);
+  line << '\n';
+  return line.str();
+}
+
+Result<void> InstanceDatabaseJournal::Append(const Json::Value& record) {
+  auto line = ToLine(record);
+  CF_EXPECT(WriteAll(fd_, line) == (ssize_t)line.size(),
+            "Could not append to \"" << path_ << "\": " << fd_->StrError());
+  size_++;
+  return {};
+}
+
+Result<void> InstanceDatabaseJournal::Compact(const Json::Value& db_json) {
+  auto line = ToLine(SnapshotRecord(db_json));
+  const auto temp_path = path_ + ".tmp";
+  // Left behind by a crash, or planted: either way it isn't reused
+  RemoveFile(temp_path);
+  auto temp = SharedFD::Open(
+      temp_path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC | O_NOFOLLOW, 0600);
+  CF_EXPECT(temp->IsOpen(), "Could not create \"" << temp_path << "\": "
+                                                  << temp->StrError());
+  CF_EXPECT(WriteAll(temp, line) == (ssize_t)line.size(),
+            "Could not write \"" << temp_path << "\": " << temp->StrError());
+  // Otherwise a crash could leave the rename on disk but not the snapshot
+  CF_EXPECT(temp->Fsync() == 0,
+            "Could not sync \"" << temp_path << "\": " << temp->StrError());
+  temp->Close();
+  CF_EXPECT(RenameFile(temp_path, path_));
+
+  // The old descriptor still appends to the file that was renamed over
+  auto fd = SharedFD::Open(path_, kAppendFlags);
+  CF_EXPECT(fd->IsOpen(),
+            "Could not reopen \"" << path_ << "\": " << fd->StrError());
+  CF_EXPECT(CheckOwnedRegularFile(fd, path_));
+  fd_ = std::move(fd);
+  records_.clear();
+  size_ = 0;
+  return {};
+}
+
+}  // namespace selector
+}  // namespace cuttlefish
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/json.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+namespace selector {
+
+/**
+ * Append-only log of the changes made to an InstanceDatabase.
+ *
+ * Each line of the file is one json record:
+ *   {"Op": "Snapshot", "Database": <InstanceDatabase::Serialize()>}
+ *   {"Op": "Put", "Group": <LocalInstanceGroup::Serialize()>}
+ *   {"Op": "Remove", "Group Name": <group name>}
+ *   {"Op": "Clear"}
+ *
+ * "Put" carries the whole group as it is after the change, so recording a
+ * change costs the size of one group rather than of the database. Compact()
+ * replaces all the records with a single snapshot.
+ */
+class InstanceDatabaseJournal {
+ public:
+  static constexpr const char kJsonOp[] = "Op";
+  static constexpr const char kJsonDatabase[] = "Database";
+  static constexpr const char kJsonGroup[] = "Group";
+  static constexpr const char kJsonGroupName[] = "Group Name";
+  static constexpr const char kOpSnapshot[] = "Snapshot";
+  static constexpr const char kOpPut[] = "Put";
+  static constexpr const char kOpRemove[] = "Remove";
+  static constexpr const char kOpClear[] = "Clear";
+
+  static Json::Value SnapshotRecord(const Json::Value& db_json);
+  static Json::Value PutRecord(Json::Value group_json);
+  static Json::Value RemoveRecord(const std::string& group_name);
+  static Json::Value ClearRecord();
+
+  /**
+   * Opens the journal at path for appending, creating it if needed.
+   *
+   * The records already in the file are returned by Records() until the
+   * journal is compacted. A last line cut short by a crash in the middle
+   * of an append is dropped.
+   */
+  static Result<std::unique_ptr<InstanceDatabaseJournal>> Open(
+      const std::string& path);
+
+  const std::vector<Json::Value>& Records() const { return records_; }
+  // How many records were appended since the last snapshot
+  std::size_t Size() const { return size_; }
+
+  Result<void> Append(const Json::Value& record);
+  /**
+   * Writes the snapshot to a new file that is then renamed over the journal,
+   * so a crash leaves either the old records or the snapshot behind.
+   */
+  Result<void> Compact(const Json::Value& db_json);
+
+ private:
+  InstanceDatabaseJournal(const std::string& path, SharedFD fd,
+                          std::vector<Json::Value> records);
+  std::string ToLine(const Json::Value& record) const;
+
+  std::string path_;
+  SharedFD fd_;
+  std::vector<Json::Value> records_;
+  std::size_t size_;
+  std::unique_ptr<Json::StreamWriter> writer_;
+};
+
+}  // namespace selector
+}  // namespace cuttlefish
@@ -470,6 +470,13 @@ Result<void> CvdServer::InstanceDbFromJson(const std::string& json_string) {
   return {};
 }
 
+Result<void> CvdServer::AttachInstanceDbJournal() {
+  const uid_t uid = getuid();
+  const auto path = CF_EXPECT(InstanceManager::JournalPath(uid));
+  CF_EXPECT(instance_manager_.AttachJournal(uid, path));
+  return {};
+}
+
 static fruit::Component<> ServerComponent(ServerLogger* server_logger) {
   return fruit::createComponent()
       .addMultibinding<CvdServer, CvdServer>()
@@ -510,6 +517,13 @@ Result<int> CvdServerMain(ServerMainParam&& fds) {
     CF_EXPECT(server.InstanceDbFromJson(json_string),
               "Failed to load from: " << json_string);
   }
+  // A carried over database replaces what the journal holds. Without a
+  // journal the server still works, it only forgets the instances if it dies.
+  auto journal_attached = server.AttachInstanceDbJournal();
+  if (!journal_attached.ok()) {
+    LOG(ERROR) << "Not journaling the instance database: "
+               << journal_attached.error().Trace();
+  }
 
   server.StartServer(server_fd);
 
@@ -82,6 +82,8 @@ class CvdServer {
   void Stop();
   void Join();
   Result<void> InstanceDbFromJson(const std::string& json_string);
+  // Keeps the instance database on disk, see InstanceManager::JournalPath()
+  Result<void> AttachInstanceDbJournal();
 
  private:
   struct OngoingRequest {
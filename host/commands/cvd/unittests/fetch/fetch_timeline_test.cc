@@ -0,0 +1,112 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/fetch/fetch_timeline.h"
+
+namespace cuttlefish {
+namespace {
+
+// The stage lines of the summary, without the header line
+std::vector<std::string> SummaryStages(FetchTimeline& timeline) {
+  auto lines = android::base::Split(timeline.Summary(), "\n");
+  EXPECT_GE(lines.size(), 2);
+  // The header comes first and the summary ends with a newline
+  return std::vector<std::string>(lines.begin() + 1, lines.end() - 1);
+}
+
+Result<int> FailingStage() { return CF_ERR("download failed"); }
+
+TEST(FetchTimelineTest, RunsStagesInOrder) {
+  FetchTimeline timeline;
+  std::vector<std::string> ran;
+  for (const auto& name : {"first", "second", "third"}) {
+    auto result = timeline.Run(name, [&ran, name]() -> Result<void> {
+      ran.push_back(name);
+      return {};
+    });
+    ASSERT_TRUE(result.ok());
+  }
+  ASSERT_EQ(ran, std::vector<std::string>({"first", "second", "third"}));
+
+  auto stages = SummaryStages(timeline);
+  ASSERT_EQ(stages.size(), 3);
+  EXPECT_TRUE(android::base::EndsWith(stages[0], "| first"));
+  EXPECT_TRUE(android::base::EndsWith(stages[1], "| second"));
+  EXPECT_TRUE(android::base::EndsWith(stages[2], "| third"));
+}
+
+TEST(FetchTimelineTest, AsyncStagesOverlapWithLaterStages) {
+  FetchTimeline timeline;
+  std::promise<void> started;
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  auto download = timeline.Async("download", [&started,
+                                              released]() -> Result<int> {
+    started.set_value();
+    // Only finishes once the stage started after it has run
+    CF_EXPECT(released.wait_for(std::chrono::seconds(30)) ==
+                  std::future_status::ready,
+              "Not released");
+    return 42;
+  });
+  started.get_future().wait();
+  auto extract = timeline.Run("extract", [&release]() -> Result<void> {
+    release.set_value();
+    return {};
+  });
+  ASSERT_TRUE(extract.ok());
+  auto downloaded = download.get();
+  ASSERT_TRUE(downloaded.ok()) << downloaded.error().Trace();
+  EXPECT_EQ(*downloaded, 42);
+
+  // Listed by when they started, though the download finished last
+  auto stages = SummaryStages(timeline);
+  ASSERT_EQ(stages.size(), 2);
+  EXPECT_TRUE(android::base::EndsWith(stages[0], "| download"));
+  EXPECT_TRUE(android::base::EndsWith(stages[1], "| extract"));
+}
+
+TEST(FetchTimelineTest, PropagatesErrors) {
+  FetchTimeline timeline;
+  auto download = timeline.Async("download", FailingStage);
+  auto downloaded = download.get();
+  ASSERT_FALSE(downloaded.ok());
+  EXPECT_NE(downloaded.error().Message().find("download failed"),
+            std::string::npos);
+
+  auto extract = timeline.Run("extract", []() -> Result<void> {
+    return CF_ERR("extract failed");
+  });
+  ASSERT_FALSE(extract.ok());
+  EXPECT_NE(extract.error().Message().find("extract failed"),
+            std::string::npos);
+
+  auto stages = SummaryStages(timeline);
+  ASSERT_EQ(stages.size(), 2);
+  EXPECT_TRUE(android::base::EndsWith(stages[0], "| download (failed)"));
+  EXPECT_TRUE(android::base::EndsWith(stages[1], "| extract (failed)"));
+}
+
+}  // namespace
+}  // namespace cuttlefish
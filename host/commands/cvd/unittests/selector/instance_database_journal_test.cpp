@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "host/commands/cvd/selector/instance_database.h"
+#include "host/commands/cvd/selector/selector_constants.h"
+#include "host/commands/cvd/unittests/selector/instance_database_helper.h"
+
+namespace cuttlefish {
+namespace selector {
+
+using CvdInstanceDatabaseJournalTest = CvdInstanceDatabaseTest;
+
+static std::size_t CountLines(const std::string& path) {
+  std::string contents;
+  if (!android::base::ReadFileToString(path, &contents)) {
+    return 0;
+  }
+  return std::count(contents.begin(), contents.end(), '\n');
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, ReplaysChanges) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  auto& db = GetDb();
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  auto attach_result = db.AttachJournal(journal_path);
+  ASSERT_TRUE(attach_result.ok()) << attach_result.error().Trace();
+  if (!AddGroups({"miau", "nyah", "mjau"}) ||
+      !AddInstances("miau", {{1, "8"}, {10, "tv_instance"}}) ||
+      !AddInstances("nyah", {{7, "my_favorite_phone"}})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  ASSERT_TRUE(db.SetBuildId("nyah", "1234").ok());
+  ASSERT_TRUE(db.RemoveInstanceGroup("mjau"));
+
+  InstanceDatabase reloaded;
+  auto reload_result = reloaded.AttachJournal(journal_path);
+  ASSERT_TRUE(reload_result.ok()) << reload_result.error().Trace();
+
+  ASSERT_EQ(reloaded.InstanceGroups().size(), 2);
+  auto nyah = reloaded.FindGroup({kGroupNameField, "nyah"});
+  ASSERT_TRUE(nyah.ok()) << nyah.error().Trace();
+  ASSERT_EQ(nyah->Get().BuildId(), "1234");
+  auto tv = reloaded.FindInstance({kInstanceIdField, std::to_string(10)});
+  ASSERT_TRUE(tv.ok()) << tv.error().Trace();
+  ASSERT_EQ(tv->Get().PerInstanceName(), "tv_instance");
+  auto mjau = reloaded.FindGroups({kGroupNameField, "mjau"});
+  ASSERT_TRUE(mjau.ok());
+  ASSERT_TRUE(mjau->empty());
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, Compacts) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  auto& db = GetDb();
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  ASSERT_TRUE(db.AttachJournal(journal_path).ok());
+  if (!AddGroups({"miau"})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(db.SetBuildId("miau", std::to_string(i)).ok());
+  }
+  ASSERT_LT(CountLines(journal_path), 100);
+
+  InstanceDatabase reloaded;
+  ASSERT_TRUE(reloaded.AttachJournal(journal_path).ok());
+  auto miau = reloaded.FindGroup({kGroupNameField, "miau"});
+  ASSERT_TRUE(miau.ok()) << miau.error().Trace();
+  ASSERT_EQ(miau->Get().BuildId(), "999");
+  // attaching starts from a snapshot
+  ASSERT_EQ(CountLines(journal_path), 1);
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, KeepsGroupsAlreadyInDatabase) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  auto& db = GetDb();
+  if (!AddGroups({"miau", "nyah"})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  const auto carried_over = db.Serialize();
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  ASSERT_TRUE(db.AttachJournal(journal_path).ok());
+  ASSERT_TRUE(db.RemoveInstanceGroup("nyah"));
+
+  // like a restarting server that got the database through a memfd
+  InstanceDatabase carried;
+  ASSERT_TRUE(carried.LoadFromJson(carried_over).ok());
+  auto attach_result = carried.AttachJournal(journal_path);
+  ASSERT_TRUE(attach_result.ok()) << attach_result.error().Trace();
+  ASSERT_EQ(carried.InstanceGroups().size(), 2);
+
+  InstanceDatabase reloaded;
+  ASSERT_TRUE(reloaded.AttachJournal(journal_path).ok());
+  ASSERT_EQ(reloaded.InstanceGroups().size(), 2);
+  ASSERT_TRUE(reloaded.FindGroup({kGroupNameField, "nyah"}).ok());
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, DropsIncompleteRecord) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  auto& db = GetDb();
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  ASSERT_TRUE(db.AttachJournal(journal_path).ok());
+  if (!AddGroups({"miau"})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(journal_path, &contents));
+  contents += R"({"Op": "Remove", "Group Na)";
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, journal_path));
+
+  InstanceDatabase reloaded;
+  auto reload_result = reloaded.AttachJournal(journal_path);
+  ASSERT_TRUE(reload_result.ok()) << reload_result.error().Trace();
+  ASSERT_TRUE(reloaded.FindGroup({kGroupNameField, "miau"}).ok());
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, RejectsCorruptedRecord) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  ASSERT_TRUE(android::base::WriteStringToFile("{\"Op\": \n", journal_path));
+
+  auto& db = GetDb();
+  ASSERT_FALSE(db.AttachJournal(journal_path).ok());
+  ASSERT_TRUE(db.IsEmpty());
+}
+
+TEST_F(CvdInstanceDatabaseJournalTest, RefusesSymlinkedJournal) {
+  if (!SetUpOk()) {
+    GTEST_SKIP() << Error().msg;
+  }
+  const std::string target_path = Workspace() + "/elsewhere";
+  const std::string journal_path = Workspace() + "/instance_db.journal";
+  ASSERT_TRUE(android::base::WriteStringToFile("", target_path));
+  ASSERT_EQ(symlink(target_path.c_str(), journal_path.c_str()), 0);
+
+  auto& db = GetDb();
+  ASSERT_FALSE(db.AttachJournal(journal_path).ok());
+  if (!AddGroups({"miau"})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  ASSERT_EQ(CountLines(target_path), 0);
+}
+
+}  // namespace selector
+}  // namespace cuttlefish
@@ -216,6 +216,33 @@ TEST_F(CvdInstanceDatabaseTest, RemoveGroup) {
   ASSERT_FALSE(db.RemoveInstanceGroup(*eng_group));
 }
 
+TEST_F(CvdInstanceDatabaseTest, RemoveGroupDropsItsInstances) {
+  if (!SetUpOk() || !AddGroups({"miau", "nyah"})) {
+    GTEST_SKIP() << Error().msg;
+  }
+  auto& db = GetDb();
+  if (!AddInstances("miau", {{1, "8"}, {10, "tv_instance"}}) ||
+      !AddInstances("nyah", {{7, "my_favorite_phone"}, {11, "tv_instance"}})) {
+    GTEST_SKIP() << Error().msg;
+  }
+
+  ASSERT_TRUE(db.RemoveInstanceGroup("miau"));
+
+  auto by_home = db.FindGroups({kHomeField, Workspace() + "/" + "miau"});
+  auto by_id = db.FindInstances({kInstanceIdField, std::to_string(1)});
+  auto by_name = db.FindInstances({kInstanceNameField, "tv_instance"});
+  ASSERT_TRUE(by_home.ok()) << by_home.error().Trace();
+  ASSERT_TRUE(by_id.ok()) << by_id.error().Trace();
+  ASSERT_TRUE(by_name.ok()) << by_name.error().Trace();
+  ASSERT_TRUE(by_home->empty());
+  ASSERT_TRUE(by_id->empty());
+  ASSERT_EQ(by_name->size(), 1);
+  ASSERT_EQ(by_name->cbegin()->Get().InstanceId(), 11);
+  // the home and the ids of the removed group are free again
+  ASSERT_TRUE(AddGroups({"miau"}));
+  ASSERT_TRUE(AddInstances("miau", {{1, "8"}}));
+}
+
 TEST_F(CvdInstanceDatabaseTest, AddInstances) {
   if (!SetUpOk() || !AddGroups({"yah_ong"})) {
     GTEST_SKIP() << Error().msg;
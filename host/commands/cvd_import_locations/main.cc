@@ -26,6 +26,10 @@
 
 DEFINE_int32(instance_num, 1, "Which instance to read the configs from");
 DEFINE_double(delay, 1.0, "delay interval between different coordinates");
+DEFINE_bool(use_timestamps, true,
+            "play the coordinates on their timestamps, when they have some");
+DEFINE_double(playback_speed, 1.0,
+              "how many times faster than recorded to play the coordinates");
 
 DEFINE_string(format, "", "supported file format, either kml or gpx");
 DEFINE_string(file_path, "", "path to input file location {Kml or gpx} format");
@@ -47,6 +51,14 @@ arguments:
 
   --delay=[delay_value]
     delay between different gps locations ( double , default value is 1.0 second)
+    only used between the locations without timestamps
+
+  --use_timestamps=[true/false]
+    play the gps locations on their timestamps, when the file has some
+    ( bool , default value is true)
+
+  --playback_speed=[speed_value]
+    divides all the delays between gps locations ( double , default value is 1.0)
 
   --instance_num=[integer_value]
     running instance number , starts from 1 ( integer , default value is 1)
@@ -61,10 +73,38 @@ examples:
 
     cvd_import_locations --format="gpx" --file_path="input.gpx" --delay=.5 --instance_num=2
 
+    cvd_import_locations --format="gpx" --file_path="drive.gpx" --playback_speed=10
+
 )"""";
 namespace cuttlefish {
 namespace {
 
+// Counts the fixes going through, and drops their timestamps unless they're
+// used.
+class TimestampFilter : public GpsFixStream {
+ public:
+  TimestampFilter(GpsFixStream& fixes, bool use_timestamps)
+      : fixes_(fixes), use_timestamps_(use_timestamps) {}
+
+  bool next(GpsFix* fix, std::string* error) override {
+    if (!fixes_.next(fix, error)) {
+      return false;
+    }
+    if (!use_timestamps_) {
+      fix->time = 0;
+    }
+    count_++;
+    return true;
+  }
+
+  size_t count() const { return count_; }
+
+ private:
+  GpsFixStream& fixes_;
+  bool use_timestamps_;
+  size_t count_ = 0;
+};
+
 int ImportLocationsCvdMain(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
   google::ParseCommandLineFlags(&argc, &argv, true);
@@ -88,33 +128,35 @@ int ImportLocationsCvdMain(int argc, char** argv) {
   GnssClient gpsclient(
       grpc::CreateChannel(socket_name, grpc::InsecureChannelCredentials()));
 
-  GpsFixArray coordinates;
+  std::unique_ptr<GpsFixStream> coordinates;
   std::string error;
-  bool isOk = false;
 
   LOG(INFO) << "Server port: " << server_port << " socket: " << socket_name
             << std::endl;
+  // The file is read as the request is built, without holding the whole
+  // document in memory
   if (FLAGS_format == "gpx" || FLAGS_format == "GPX") {
-    isOk =
-        GpxParser::parseFile(FLAGS_file_path.c_str(), &coordinates, &error);
+    coordinates = GpxParser::openFile(FLAGS_file_path.c_str(), &error);
   } else if (FLAGS_format == "kml" || FLAGS_format == "KML") {
-    isOk =
-        KmlParser::parseFile(FLAGS_file_path.c_str(), &coordinates, &error);
+    coordinates = KmlParser::openFile(FLAGS_file_path.c_str(), &error);
   }
 
-  LOG(INFO) << "Number of parsed points: " << coordinates.size() << std::endl;
-
-  if (!isOk) {
+  if (!coordinates) {
     LOG(ERROR) << " Parsing Error: " << error << std::endl;
     return 1;
   }
+  TimestampFilter fixes(*coordinates, FLAGS_use_timestamps);
 
   int delay = (int)(1000 * FLAGS_delay);
-  auto status = gpsclient.SendGpsLocations(delay,coordinates);
-  CHECK(status.ok()) << "Failed to send gps location data \n";
+  auto status =
+      gpsclient.SendGpsLocations(delay, fixes, FLAGS_playback_speed);
+  // Parsing errors only come up while the request is built
   if (!status.ok()) {
+    LOG(ERROR) << "Failed to send gps location data: "
+               << status.error().Message();
     return 1;
   }
+  LOG(INFO) << "Number of parsed points: " << fixes.count() << std::endl;
   std::this_thread::sleep_for(std::chrono::milliseconds(delay));
   return 0;
 }
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/libs/location/GpsFix.h"
+#include "host/libs/location/GpsFixScheduler.h"
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+struct Delivery {
+  Clock::time_point at;
+  GpsFixArray fixes;
+};
+
+class Recorder {
+ public:
+  void Deliver(const GpsFixArray& fixes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deliveries_.push_back(Delivery{Clock::now(), fixes});
+    fixes_ += fixes.size();
+    cv_.notify_all();
+  }
+
+  // Waits for |fixes| fixes to be delivered in total
+  std::vector<Delivery> WaitFor(size_t fixes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::seconds(5),
+                 [this, fixes]() { return fixes_ >= fixes; });
+    return deliveries_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Delivery> deliveries_;
+  size_t fixes_ = 0;
+};
+
+std::unique_ptr<GpsFixStream> Fixes(std::vector<time_t> times) {
+  GpsFixArray fixes;
+  for (size_t i = 0; i < times.size(); i++) {
+    GpsFix fix;
+    fix.name = std::to_string(i);
+    fix.time = times[i];
+    fixes.push_back(fix);
+  }
+  return std::make_unique<GpsFixArrayStream>(std::move(fixes));
+}
+
+TEST(GpsFixScheduler, DeliversOnScaledTimestamps) {
+  Recorder recorder;
+  GpsFixScheduler scheduler(
+      [&recorder](const GpsFixArray& fixes) { recorder.Deliver(fixes); });
+  auto start = Clock::now();
+  // One second apart, played ten times faster
+  scheduler.Play(Fixes({1000, 1001, 1002}), milliseconds(5000), 10);
+
+  auto deliveries = recorder.WaitFor(3);
+  ASSERT_EQ(3U, deliveries.size());
+  for (size_t i = 0; i < deliveries.size(); i++) {
+    EXPECT_GE(deliveries[i].at - start, milliseconds(100 * i)) << i;
+    EXPECT_LT(deliveries[i].at - start, milliseconds(100 * i + 80)) << i;
+  }
+}
+
+TEST(GpsFixScheduler, UsesIntervalWithoutTimestamps) {
+  Recorder recorder;
+  GpsFixScheduler scheduler(
+      [&recorder](const GpsFixArray& fixes) { recorder.Deliver(fixes); });
+  auto start = Clock::now();
+  // The last one goes back in time
+  scheduler.Play(Fixes({0, 0, 1000, 900}), milliseconds(50));
+
+  auto deliveries = recorder.WaitFor(4);
+  ASSERT_EQ(4U, deliveries.size());
+  EXPECT_GE(deliveries[3].at - start, milliseconds(150));
+  EXPECT_LT(deliveries[3].at - start, milliseconds(230));
+}
+
+TEST(GpsFixScheduler, BatchesFixesDueTogether) {
+  Recorder recorder;
+  bool first = true;
+  GpsFixScheduler scheduler([&](const GpsFixArray& fixes) {
+    recorder.Deliver(fixes);
+    if (first) {
+      // Stalls while the next fixes fall due
+      first = false;
+      std::this_thread::sleep_for(milliseconds(200));
+    }
+  });
+  scheduler.Play(Fixes({0, 0, 0, 0, 0, 0}), milliseconds(20));
+
+  auto deliveries = recorder.WaitFor(6);
+  ASSERT_EQ(2U, deliveries.size());
+  EXPECT_EQ(1U, deliveries[0].fixes.size());
+  EXPECT_EQ(5U, deliveries[1].fixes.size());
+  EXPECT_EQ("5", deliveries[1].fixes.back().name);
+}
+
+TEST(GpsFixScheduler, PlayReplacesFixes) {
+  Recorder recorder;
+  GpsFixScheduler scheduler(
+      [&recorder](const GpsFixArray& fixes) { recorder.Deliver(fixes); });
+  scheduler.Play(Fixes({0, 0}), milliseconds(200));
+  recorder.WaitFor(1);
+  scheduler.Play(Fixes({0}), milliseconds(200));
+
+  recorder.WaitFor(2);
+  // The second fix of the first stream would be due by now
+  std::this_thread::sleep_for(milliseconds(300));
+  auto deliveries = recorder.WaitFor(2);
+  ASSERT_EQ(2U, deliveries.size());
+  EXPECT_EQ("0", deliveries[1].fixes[0].name);
+  EXPECT_LT(deliveries[1].at - deliveries[0].at, milliseconds(150));
+}
+
+}  // namespace
+}  // namespace cuttlefish
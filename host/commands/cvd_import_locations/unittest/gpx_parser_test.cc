@@ -378,4 +378,42 @@ TEST(GpxParser, ParseValidDocumentString) {
   EXPECT_EQ("Trkpt 2-2", locations[7].name);
 }
 
+TEST(GpxParser, StreamValidDocument) {
+  std::string error;
+  auto stream = GpxParser::openString(kValidDocumentText,
+                                      strlen(kValidDocumentText), &error);
+  ASSERT_NE(nullptr, stream);
+
+  std::vector<std::string> names;
+  GpsFix fix;
+  while (stream->next(&fix, &error)) {
+    names.push_back(fix.name);
+  }
+  EXPECT_EQ("", error);
+  std::vector<std::string> expected = {"Wpt 1",     "Wpt 2",     "Rtept 1",
+                                       "Rtept 2",   "Trkpt 1-1", "Trkpt 1-2",
+                                       "Trkpt 2-1", "Trkpt 2-2"};
+  EXPECT_EQ(expected, names);
+}
+
+char kStreamErrorText[] =
+    "<?xml version=\"1.0\"?>"
+    "<gpx>"
+    "<wpt lon=\"0\" lat=\"0\"><name>Wpt 1</name></wpt>"
+    "<wpt lon=\"0\"><name>Wpt 2</name></wpt>"
+    "<wpt lon=\"0\" lat=\"0\"><name>Wpt 3</name></wpt>"
+    "</gpx>";
+TEST(GpxParser, StreamStopsAtError) {
+  std::string error;
+  auto stream = GpxParser::openString(kStreamErrorText,
+                                      strlen(kStreamErrorText), &error);
+  ASSERT_NE(nullptr, stream);
+
+  GpsFix fix;
+  ASSERT_TRUE(stream->next(&fix, &error));
+  EXPECT_EQ("Wpt 1", fix.name);
+  EXPECT_FALSE(stream->next(&fix, &error));
+  EXPECT_NE("", error);
+}
+
 }  // namespace cuttlefish
\ No newline at end of file
@@ -658,4 +658,35 @@ TEST(KmlParser, ParsePlacemarkNullNameNoCrashString) {
   EXPECT_STREQ("", locations.front().description.c_str());
 }
 
+TEST(KmlParser, StreamValidComplexDocument) {
+  std::string error;
+  auto stream = KmlParser::openString(kValidComplexText,
+                                      strlen(kValidComplexText), &error);
+  ASSERT_NE(nullptr, stream);
+
+  GpsFixArray locations;
+  GpsFix fix;
+  while (stream->next(&fix, &error)) {
+    locations.push_back(fix);
+  }
+  EXPECT_EQ("", error);
+  ASSERT_EQ(3U, locations.size());
+  EXPECT_EQ("Tessellated", locations[0].name);
+  EXPECT_EQ("Transparent", locations[1].name);
+  EXPECT_EQ("Fruity", locations[2].name);
+}
+
+TEST(KmlParser, StreamLineStringOneFixAtATime) {
+  std::string error;
+  auto stream = KmlParser::openString(kMultipleCoordinatesText,
+                                      strlen(kMultipleCoordinatesText), &error);
+  ASSERT_NE(nullptr, stream);
+
+  GpsFix fix;
+  ASSERT_TRUE(stream->next(&fix, &error));
+  EXPECT_FLOAT_EQ(-122.0822035425683, fix.longitude);
+  ASSERT_TRUE(stream->next(&fix, &error));
+  EXPECT_FLOAT_EQ(10.4, fix.longitude);
+}
+
 }  // namespace cuttlefish
\ No newline at end of file
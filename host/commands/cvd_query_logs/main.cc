@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/log_store/log_store.h"
+
+DEFINE_int32(instance_num, 1, "Which instance to read the logs of");
+DEFINE_string(log, "logcat", "Which log to read, logcat or kernel");
+DEFINE_string(store_dir, "",
+              "Read the store in this directory instead of the instance's, "
+              "e.g. one extracted from a bugreport");
+DEFINE_string(since, "", "Only lines received at or after this time");
+DEFINE_string(until, "", "Only lines received at or before this time");
+DEFINE_string(tags, "", "Comma separated logcat tags to keep");
+DEFINE_string(pids, "", "Comma separated logcat pids to keep");
+
+const char* kUsageMessage = R""""(query the stored guest logs
+
+Usage: cvd_query_logs [options]
+
+Prints the matching lines of the logcat or kernel log of an instance, oldest
+first. Only the parts of the store that may contain matching lines are read
+and decompressed.
+
+Times are host times at which the lines were received, either relative to now
+("30s", "10m", "2h", "1d"), seconds since the epoch or a local date like
+"2023-10-19 12:00:00". Lines received a few seconds around the requested
+range may also be printed.
+
+examples:
+
+    cvd_query_logs --since=10m --tags=ActivityManager,WindowManager
+    cvd_query_logs --log=kernel --since="2023-10-19 12:00:00" --until=1h
+    cvd_query_logs --store_dir=bugreport/logs/logcat_store --pids=1234
+
+)"""";
+
+namespace cuttlefish {
+namespace {
+
+Result<std::int64_t> ParseTimeMs(const std::string& value) {
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+  static constexpr struct {
+    char suffix;
+    std::int64_t ms;
+  } kUnits[] = {{'s', 1000}, {'m', 60000}, {'h', 3600000}, {'d', 86400000}};
+  for (const auto& [suffix, ms] : kUnits) {
+    std::int64_t amount;
+    if (!value.empty() && value.back() == suffix &&
+        android::base::ParseInt(value.substr(0, value.size() - 1), &amount,
+                                std::int64_t{0})) {
+      return now - amount * ms;
+    }
+  }
+  std::int64_t seconds;
+  if (android::base::ParseInt(value, &seconds, std::int64_t{0})) {
+    return seconds * 1000;
+  }
+  struct tm date = {};
+  auto end = strptime(value.c_str(), "%Y-%m-%d %H:%M:%S", &date);
+  CF_EXPECT(end != nullptr && *end == '\0', "Invalid time \"" << value << "\"");
+  date.tm_isdst = -1;
+  return static_cast<std::int64_t>(mktime(&date)) * 1000;
+}
+
+Result<LogQuery> QueryFromFlags() {
+  LogQuery query;
+  if (!FLAGS_since.empty()) {
+    query.since_ms = CF_EXPECT(ParseTimeMs(FLAGS_since));
+  }
+  if (!FLAGS_until.empty()) {
+    query.until_ms = CF_EXPECT(ParseTimeMs(FLAGS_until));
+  }
+  for (const auto& tag : android::base::Split(FLAGS_tags, ",")) {
+    if (!tag.empty()) {
+      query.tags.insert(tag);
+    }
+  }
+  for (const auto& pid_str : android::base::Split(FLAGS_pids, ",")) {
+    if (pid_str.empty()) {
+      continue;
+    }
+    int pid;
+    CF_EXPECT(android::base::ParseInt(pid_str, &pid, 0),
+              "Invalid pid \"" << pid_str << "\"");
+    query.pids.insert(pid);
+  }
+  return query;
+}
+
+Result<std::string> StoreDirectory() {
+  if (!FLAGS_store_dir.empty()) {
+    return FLAGS_store_dir;
+  }
+  auto config = CuttlefishConfig::Get();
+  CF_EXPECT(config != nullptr, "Failed to obtain config object");
+  auto instance = config->ForInstance(FLAGS_instance_num);
+  if (FLAGS_log == "logcat") {
+    return instance.logcat_store_path();
+  } else if (FLAGS_log == "kernel") {
+    return instance.kernel_log_store_path();
+  }
+  return CF_ERR("Unknown log \"" << FLAGS_log << "\"");
+}
+
+Result<void> QueryLogsMain() {
+  auto query = CF_EXPECT(QueryFromFlags());
+  auto directory = CF_EXPECT(StoreDirectory());
+  CF_EXPECT(QueryLogStore(directory, query, [](std::string_view line) {
+    fwrite(line.data(), 1, line.size(), stdout);
+    fputc('\n', stdout);
+  }));
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  gflags::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto result = cuttlefish::QueryLogsMain();
+  if (!result.ok()) {
+    LOG(ERROR) << result.error().Trace();
+    return 1;
+  }
+  return 0;
+}
@@ -49,7 +49,7 @@
 #include <common/libs/fs/shared_select.h>
 #include <host/libs/config/cuttlefish_config.h>
 #include <host/libs/config/logging.h>
-#include <queue>
+#include "host/libs/location/GpsFixScheduler.h"
 
 using gnss_grpc_proxy::GnssGrpcProxy;
 using gnss_grpc_proxy::SendGpsReply;
@@ -111,10 +111,10 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
        : gnss_in_(gnss_in),
          gnss_out_(gnss_out),
          fixed_location_in_(fixed_location_in),
-         fixed_location_out_(fixed_location_out) {
-          //Set the default GPS delay to 1 second
-          fixed_locations_delay_=1000;
-         }
+         fixed_location_out_(fixed_location_out),
+         fixed_location_scheduler_([this](const GpsFixArray& fixes) {
+           UpdateFixedLocation(fixes);
+         }) {}
 
 
    Status SendGps(ServerContext* context, const SendGpsRequest* request,
@@ -126,10 +126,10 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
    }
 
 
-  std::string ConvertCoordinate(gnss_grpc_proxy::GpsCoordinates coordinate){
-    std::string latitude = std::to_string(coordinate.latitude());
-    std::string longitude = std::to_string(coordinate.longitude());
-    std::string elevation = std::to_string(coordinate.elevation());
+  std::string ConvertCoordinate(const GpsFix& coordinate){
+    std::string latitude = std::to_string(coordinate.latitude);
+    std::string longitude = std::to_string(coordinate.longitude);
+    std::string elevation = std::to_string(coordinate.elevation);
     std::string result = latitude + "," + longitude + "," + elevation;
     return result;
   }
@@ -138,16 +138,20 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
                         const SendGpsCoordinatesRequest* request,
                         SendGpsCoordinatesReply* reply) override {
      reply->set_status(SendGpsCoordinatesReply::OK);//update protobuf reply
-     {
-       std::lock_guard<std::mutex> lock(fixed_locations_queue_mutex_);
-       // Reset local buffers
-       fixed_locations_queue_ = {};
-       // Make a local copy of the input buffers
-       for (auto loc : request->coordinates()) {
-         fixed_locations_queue_.push(ConvertCoordinate(loc));
-       }
-       fixed_locations_delay_ = request->delay();
+     GpsFixArray fixes;
+     for (const auto& loc : request->coordinates()) {
+       GpsFix fix;
+       fix.latitude = loc.latitude();
+       fix.longitude = loc.longitude();
+       fix.elevation = loc.elevation();
+       fix.time = loc.time();
+       fixes.push_back(fix);
      }
+     // Replaces whatever was playing
+     fixed_location_scheduler_.Play(
+         std::make_unique<GpsFixArrayStream>(std::move(fixes)),
+         std::chrono::milliseconds(request->delay()),
+         request->playback_speed());
 
      return Status::OK;
    }
@@ -185,8 +189,6 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
     void StartServer() {
       // Create a new thread to handle writes to the gnss and to the any client
       // connected to the socket.
-      fixed_location_write_thread_ =
-          std::thread([this]() { WriteFixedLocationFromQueue(); });
       measurement_read_thread_ =
           std::thread([this]() { ReadMeasurementLoop(); });
       fixed_location_read_thread_ =
@@ -287,9 +289,6 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
       if (fixed_location_file_read_thread_.joinable()) {
         fixed_location_file_read_thread_.join();
       }
-      if (fixed_location_write_thread_.joinable()) {
-        fixed_location_write_thread_.join();
-      }
       if (measurement_file_read_thread_.joinable()) {
         measurement_file_read_thread_.join();
       }
@@ -353,20 +352,12 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
      }
    }
 
-   [[noreturn]] void WriteFixedLocationFromQueue() {
-      while (true) {
-         if (!fixed_locations_queue_.empty()) {
-         std::string dataPoint = fixed_locations_queue_.front();
-         std::string line = GenerateGpsLine(dataPoint);
-         std::lock_guard<std::mutex> lock(cached_fixed_location_mutex);
-         cached_fixed_location = line;
-         {
-           std::lock_guard<std::mutex> lock(fixed_locations_queue_mutex_);
-           fixed_locations_queue_.pop();
-         }
-       }
-       std::this_thread::sleep_for(std::chrono::milliseconds(fixed_locations_delay_));
-     }
+   // The guest asks for the current location rather than receiving every
+   // fix, of the fixes falling due together only the last one matters.
+   void UpdateFixedLocation(const GpsFixArray& fixes) {
+     std::string line = GenerateGpsLine(ConvertCoordinate(fixes.back()));
+     std::lock_guard<std::mutex> lock(cached_fixed_location_mutex);
+     cached_fixed_location = line;
    }
 
     std::string getTimeNanosFromLine(const std::string& line) {
@@ -388,7 +379,6 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
     std::thread measurement_read_thread_;
     std::thread fixed_location_read_thread_;
     std::thread fixed_location_file_read_thread_;
-    std::thread fixed_location_write_thread_;
     std::thread measurement_file_read_thread_;
 
     std::string cached_fixed_location;
@@ -398,9 +388,8 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
     std::string previous_cached_gnss_raw;
     std::mutex cached_gnss_raw_mutex;
 
-    std::queue<std::string> fixed_locations_queue_;
-    std::mutex fixed_locations_queue_mutex_;
-    int fixed_locations_delay_;
+    // Declared last, its thread uses the members above
+    cuttlefish::GpsFixScheduler fixed_location_scheduler_;
 };
 
 void RunServer() {
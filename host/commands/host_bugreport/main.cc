@@ -14,37 +14,82 @@
  * limitations under the License.
  */
 
-#include <stdio.h>
-#include <fstream>
+#include <algorithm>
+#include <set>
 #include <string>
+#include <thread>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
+#include "host/commands/host_bugreport/parallel_zip_writer.h"
 #include "host/libs/config/cuttlefish_config.h"
-#include "ziparchive/zip_writer.h"
 
 DEFINE_string(output, "host_bugreport.zip", "Where to write the output");
+DEFINE_uint64(max_log_size_mb, 0,
+              "Only the last lines of logs larger than this are saved. 0 "
+              "saves them whole.");
 
 namespace cuttlefish {
 namespace {
 
-void SaveFile(ZipWriter& writer, const std::string& zip_path,
-              const std::string& file_path) {
-  writer.StartEntry(zip_path, ZipWriter::kCompress | ZipWriter::kAlign32);
-  std::fstream file(file_path, std::fstream::in | std::fstream::binary);
-  do {
-    char data[1024 * 10];
-    file.read(data, sizeof(data));
-    writer.WriteBytes(data, file.gcount());
-  } while (file);
-  writer.FinishEntry();
-  if (file.bad()) {
-    LOG(ERROR) << "Error in logging " << file_path << " to " << zip_path;
+// Saves a directory written by LogStoreWriter. Sealed segments are already
+// compressed and are saved as they are. Unless `max_size` is 0, only the
+// newest segments that fit in it are saved.
+void SaveLogStore(ParallelZipWriter& writer, const std::string& zip_dir,
+                  const std::string& store_dir, std::uint64_t max_size) {
+  auto files_result = DirectoryContents(store_dir);
+  if (!files_result.ok()) {
+    return;
+  }
+  auto files = std::move(*files_result);
+  std::sort(files.begin(), files.end());
+  auto has_file = [&files](const std::string& name) {
+    return std::binary_search(files.begin(), files.end(), name);
+  };
+  auto segment = [](const std::string& file) {
+    return file.substr(0, file.find('.'));
+  };
+  std::set<std::string> saved_segments;
+  std::uint64_t saved_size = 0;
+  for (auto it = files.rbegin(); it != files.rend(); it++) {
+    if (!android::base::EndsWith(*it, ".log") &&
+        !android::base::EndsWith(*it, ".zst")) {
+      continue;
+    }
+    saved_size += FileSize(store_dir + "/" + *it);
+    if (max_size != 0 && saved_size > max_size) {
+      break;
+    }
+    saved_segments.insert(segment(*it));
+  }
+  // Indexes of segments being written are read first so that they don't
+  // point past the end of the data saved with them.
+  for (const auto& file : files) {
+    if (saved_segments.count(segment(file)) &&
+        android::base::EndsWith(file, ".log.idx")) {
+      writer.AddContents(zip_dir + "/" + file,
+                         ReadFile(store_dir + "/" + file));
+    }
+  }
+  for (const auto& file : files) {
+    if (!saved_segments.count(segment(file))) {
+      continue;
+    }
+    auto zip_path = zip_dir + "/" + file;
+    auto path = store_dir + "/" + file;
+    if (android::base::EndsWith(file, ".zst")) {
+      // Without its index the segment is still being sealed
+      if (has_file(file + ".idx")) {
+        writer.AddStoredFile(zip_path, path);
+      }
+    } else if (android::base::EndsWith(file, ".log") ||
+               android::base::EndsWith(file, ".zst.idx")) {
+      writer.AddFile(zip_path, path);
+    }
   }
 }
 
@@ -55,28 +100,38 @@ Result<void> CvdHostBugreportMain(int argc, char** argv) {
   auto config = CuttlefishConfig::Get();
   CHECK(config) << "Unable to find the config";
 
-  auto out_path = FLAGS_output.c_str();
-  std::unique_ptr<FILE, decltype(&fclose)> out(fopen(out_path, "wbe"), &fclose);
-  ZipWriter writer(out.get());
+  auto out = SharedFD::Open(FLAGS_output,
+                            O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+  CF_EXPECT(out->IsOpen(), "Could not open \"" << FLAGS_output
+                                                << "\": " << out->StrError());
+  ParallelZipWriter writer(out, cpp_dirname(AbsolutePath(FLAGS_output)),
+                           std::thread::hardware_concurrency());
+  std::uint64_t tail_size = FLAGS_max_log_size_mb << 20;
 
   auto save = [&writer, config](const std::string& path) {
-    SaveFile(writer, "cuttlefish_assembly/" + path, config->AssemblyPath(path));
+    writer.AddFile("cuttlefish_assembly/" + path, config->AssemblyPath(path));
   };
   save("assemble_cvd.log");
   save("cuttlefish_config.json");
 
   for (const auto& instance : config->Instances()) {
-    auto save = [&writer, instance](const std::string& path) {
+    auto save = [&writer, instance](const std::string& path,
+                                    std::uint64_t tail_size = 0) {
       const auto& zip_name = instance.instance_name() + "/" + path;
       const auto& file_name = instance.PerInstancePath(path.c_str());
-      SaveFile(writer, zip_name, file_name);
+      writer.AddFile(zip_name, file_name, tail_size);
     };
     save("cuttlefish_config.json");
     save("disk_config.txt");
-    save("kernel.log");
-    save("launcher.log");
-    save("logcat");
-    save("metrics.log");
+    save("launcher.log", tail_size);
+    save("metrics.log", tail_size);
+    save("kernel.log", tail_size);
+    save("logcat", tail_size);
+    // The stores hold the same lines for querying by time, tag or pid
+    SaveLogStore(writer, instance.instance_name() + "/logs/kernel_log_store",
+                 instance.kernel_log_store_path(), tail_size);
+    SaveLogStore(writer, instance.instance_name() + "/logs/logcat_store",
+                 instance.logcat_store_path(), tail_size);
     auto tombstones =
         CF_EXPECT(DirectoryContents(instance.PerInstancePath("tombstones")),
                   "Cannot read from tombstones directory.");
@@ -97,7 +152,7 @@ Result<void> CvdHostBugreportMain(int argc, char** argv) {
     }
   }
 
-  writer.Finish();
+  CF_EXPECT(writer.Finish());
 
   LOG(INFO) << "Saved to \"" << FLAGS_output << "\"";
 
@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/host_bugreport/parallel_zip_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kChunkSize = 1 << 20;
+// Compressed data past this is moved out of memory
+constexpr std::size_t kSpillSize = 8 << 20;
+
+constexpr std::uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr std::uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr std::uint32_t kZip64EndSignature = 0x06064b50;
+constexpr std::uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr std::uint32_t kEndSignature = 0x06054b50;
+constexpr std::uint16_t kZip64ExtraId = 0x0001;
+constexpr std::uint16_t kVersion = 20;
+constexpr std::uint16_t kZip64Version = 45;
+// Unix, as the external attributes hold a file mode
+constexpr std::uint16_t kMadeBy = (3 << 8) | kZip64Version;
+constexpr std::uint16_t kUtf8Flag = 1 << 11;
+constexpr std::uint16_t kStoredMethod = 0;
+constexpr std::uint16_t kDeflateMethod = 8;
+constexpr std::uint32_t kMax32 = std::numeric_limits<std::uint32_t>::max();
+constexpr std::uint16_t kMax16 = std::numeric_limits<std::uint16_t>::max();
+
+void Put16(std::string& out, std::uint16_t value) {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+void Put32(std::string& out, std::uint32_t value) {
+  Put16(out, value & 0xffff);
+  Put16(out, value >> 16);
+}
+
+void Put64(std::string& out, std::uint64_t value) {
+  Put32(out, value & 0xffffffff);
+  Put32(out, value >> 32);
+}
+
+// The fields of a zip64 extra block, of which only those that don't fit in
+// their 32 bit header fields are present.
+std::string Zip64Extra(std::uint64_t size, std::uint64_t compressed_size,
+                       std::optional<std::uint64_t> offset) {
+  std::string fields;
+  if (size >= kMax32 || compressed_size >= kMax32) {
+    // Local headers need both sizes as soon as one of them is too large
+    Put64(fields, size);
+    Put64(fields, compressed_size);
+  }
+  if (offset && *offset >= kMax32) {
+    Put64(fields, *offset);
+  }
+  if (fields.empty()) {
+    return "";
+  }
+  std::string extra;
+  Put16(extra, kZip64ExtraId);
+  Put16(extra, fields.size());
+  return extra + fields;
+}
+
+void DosTime(time_t time, std::uint16_t* dos_time, std::uint16_t* dos_date) {
+  struct tm tm;
+  localtime_r(&time, &tm);
+  // The format starts in 1980
+  if (tm.tm_year < 80) {
+    *dos_time = 0;
+    *dos_date = (1 << 5) | 1;
+    return;
+  }
+  *dos_time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  *dos_date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+}  // namespace
+
+// Data of an entry, in memory while it's small and in an unnamed file
+// otherwise.
+class ParallelZipWriter::Spool {
+ public:
+  explicit Spool(const std::string& temp_dir) : temp_dir_(temp_dir) {}
+  // The first `size` bytes of an existing file.
+  Spool(SharedFD file, std::uint64_t size) : file_(file), file_size_(size) {}
+
+  Result<void> Append(const char* data, std::size_t size) {
+    if (!file_->IsOpen() && buffer_.size() + size <= kSpillSize) {
+      buffer_.append(data, size);
+      return {};
+    }
+    if (!file_->IsOpen()) {
+      file_ = SharedFD::Open(temp_dir_, O_TMPFILE | O_RDWR, 0600);
+      CF_EXPECT(file_->IsOpen(), "Could not create a temporary file in \""
+                                     << temp_dir_
+                                     << "\": " << file_->StrError());
+      CF_EXPECT(WriteAll(file_, buffer_) == buffer_.size(),
+                "Could not write a temporary file: " << file_->StrError());
+      file_size_ = buffer_.size();
+      buffer_ = std::string();
+    }
+    CF_EXPECT(WriteAll(file_, data, size) == size,
+              "Could not write a temporary file: " << file_->StrError());
+    file_size_ += size;
+    return {};
+  }
+
+  std::uint64_t Size() const { return file_size_ + buffer_.size(); }
+
+  Result<void> CopyTo(SharedFD out) {
+    if (file_->IsOpen()) {
+      CF_EXPECT(file_->LSeek(0, SEEK_SET) == 0,
+                "Could not rewind: " << file_->StrError());
+      std::string chunk(kChunkSize, '\0');
+      for (std::uint64_t pos = 0; pos < file_size_;) {
+        std::size_t size = std::min<std::uint64_t>(chunk.size(),
+                                                   file_size_ - pos);
+        CF_EXPECT(ReadExact(file_, chunk.data(), size) == size,
+                  "Could not read entry data: " << file_->StrError());
+        CF_EXPECT(WriteAll(out, chunk.data(), size) == size,
+                  "Could not write archive: " << out->StrError());
+        pos += size;
+      }
+    }
+    CF_EXPECT(WriteAll(out, buffer_) == buffer_.size(),
+              "Could not write archive: " << out->StrError());
+    return {};
+  }
+
+ private:
+  std::string temp_dir_;
+  std::string buffer_;
+  SharedFD file_;
+  std::uint64_t file_size_ = 0;
+};
+
+ParallelZipWriter::ParallelZipWriter(SharedFD out, std::string temp_dir,
+                                     unsigned threads)
+    : temp_dir_(std::move(temp_dir)), out_(out) {
+  for (unsigned i = 0; i < std::max(threads, 1u); i++) {
+    threads_.emplace_back([this]() { Work(); });
+  }
+}
+
+ParallelZipWriter::~ParallelZipWriter() {
+  {
+    std::lock_guard lock(queue_mutex_);
+    finishing_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+void ParallelZipWriter::AddFile(const std::string& zip_path,
+                                const std::string& file_path,
+                                std::uint64_t tail_size) {
+  Enqueue(Job{
+      .zip_path = zip_path,
+      .file_path = file_path,
+      .compress = true,
+      .tail_size = tail_size,
+  });
+}
+
+void ParallelZipWriter::AddStoredFile(const std::string& zip_path,
+                                      const std::string& file_path) {
+  Enqueue(Job{
+      .zip_path = zip_path,
+      .file_path = file_path,
+      .compress = false,
+      .tail_size = 0,
+  });
+}
+
+void ParallelZipWriter::AddContents(const std::string& zip_path,
+                                    std::string contents) {
+  Enqueue(Job{
+      .zip_path = zip_path,
+      .contents = std::move(contents),
+      .compress = true,
+      .tail_size = 0,
+  });
+}
+
+void ParallelZipWriter::Enqueue(Job job) {
+  {
+    std::lock_guard lock(queue_mutex_);
+    CHECK(!finishing_) << "Entry added after Finish()";
+    queue_.emplace_back(std::move(job));
+  }
+  queue_cv_.notify_one();
+}
+
+void ParallelZipWriter::Work() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock lock(queue_mutex_);
+      queue_cv_.wait(lock, [this]() { return finishing_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      job = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    auto result = Process(job);
+    if (!result.ok()) {
+      LOG(ERROR) << "Error in logging "
+                 << (job.file_path.empty() ? "contents" : job.file_path)
+                 << " to " << job.zip_path << ": " << result.error().Message();
+    }
+  }
+}
+
+Result<void> ParallelZipWriter::Process(const Job& job) {
+  if (job.compress) {
+    CF_EXPECT(Deflate(job));
+  } else {
+    CF_EXPECT(Store(job));
+  }
+  return {};
+}
+
+Result<void> ParallelZipWriter::Deflate(const Job& job) {
+  CentralEntry entry{
+      .zip_path = job.zip_path,
+      .method = kDeflateMethod,
+      .crc = static_cast<std::uint32_t>(crc32(0, nullptr, 0)),
+      .size = 0,
+  };
+  SharedFD file;
+  time_t mtime = time(nullptr);
+  std::string pending;  // Read before compression started
+  if (job.file_path.empty()) {
+    pending = job.contents;
+  } else {
+    file = SharedFD::Open(job.file_path, O_RDONLY);
+    CF_EXPECT(file->IsOpen(), file->StrError());
+    struct stat st;
+    CF_EXPECT(stat(job.file_path.c_str(), &st) == 0, strerror(errno));
+    mtime = st.st_mtime;
+    if (job.tail_size && static_cast<std::uint64_t>(st.st_size) >
+                             job.tail_size) {
+      CF_EXPECT(file->LSeek(st.st_size - job.tail_size, SEEK_SET) >= 0,
+                file->StrError());
+      // Drop the partial line at the start of the tail
+      while (true) {
+        pending.resize(kChunkSize);
+        auto read = file->Read(pending.data(), pending.size());
+        CF_EXPECT(read >= 0, file->StrError());
+        pending.resize(read);
+        auto newline = pending.find('\n');
+        if (read == 0 || newline != std::string::npos) {
+          pending.erase(0, newline == std::string::npos ? 0 : newline + 1);
+          break;
+        }
+      }
+    }
+  }
+  DosTime(mtime, &entry.dos_time, &entry.dos_date);
+
+  z_stream stream = {};
+  // Raw deflate, as zip has its own headers
+  CF_EXPECT(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                         8, Z_DEFAULT_STRATEGY) == Z_OK,
+            "deflateInit2 failed");
+  std::unique_ptr<z_stream, decltype(&deflateEnd)> stream_guard(&stream,
+                                                                &deflateEnd);
+  Spool spool(temp_dir_);
+  std::string input = std::move(pending);
+  std::string output(kChunkSize / 4, '\0');
+  bool eof = !file->IsOpen();
+  while (true) {
+    if (input.empty() && !eof) {
+      input.resize(kChunkSize);
+      auto read = file->Read(input.data(), input.size());
+      CF_EXPECT(read >= 0, file->StrError());
+      input.resize(read);
+      eof = read == 0;
+    }
+    entry.crc = crc32(entry.crc, reinterpret_cast<const Bytef*>(input.data()),
+                      input.size());
+    entry.size += input.size();
+    stream.next_in = reinterpret_cast<Bytef*>(input.data());
+    stream.avail_in = input.size();
+    int ret;
+    do {
+      stream.next_out = reinterpret_cast<Bytef*>(output.data());
+      stream.avail_out = output.size();
+      ret = deflate(&stream, eof ? Z_FINISH : Z_NO_FLUSH);
+      CF_EXPECT(ret != Z_STREAM_ERROR, "deflate failed");
+      CF_EXPECT(spool.Append(output.data(), output.size() - stream.avail_out));
+    } while (stream.avail_out == 0 && ret != Z_STREAM_END);
+    input.clear();
+    if (ret == Z_STREAM_END) {
+      break;
+    }
+  }
+  entry.compressed_size = spool.Size();
+
+  std::lock_guard lock(out_mutex_);
+  CF_EXPECT(WriteEntry(std::move(entry), spool));
+  return {};
+}
+
+Result<void> ParallelZipWriter::Store(const Job& job) {
+  auto file = SharedFD::Open(job.file_path, O_RDONLY);
+  CF_EXPECT(file->IsOpen(), file->StrError());
+  struct stat st;
+  CF_EXPECT(stat(job.file_path.c_str(), &st) == 0, strerror(errno));
+  CentralEntry entry{
+      .zip_path = job.zip_path,
+      .method = kStoredMethod,
+      .crc = static_cast<std::uint32_t>(crc32(0, nullptr, 0)),
+      .size = 0,
+  };
+  DosTime(st.st_mtime, &entry.dos_time, &entry.dos_date);
+  // The checksum goes in the header, before the data
+  std::string chunk(kChunkSize, '\0');
+  while (true) {
+    auto read = file->Read(chunk.data(), chunk.size());
+    CF_EXPECT(read >= 0, file->StrError());
+    if (read == 0) {
+      break;
+    }
+    entry.crc =
+        crc32(entry.crc, reinterpret_cast<const Bytef*>(chunk.data()), read);
+    entry.size += read;
+  }
+  entry.compressed_size = entry.size;
+  Spool spool(file, entry.size);
+
+  std::lock_guard lock(out_mutex_);
+  CF_EXPECT(WriteEntry(std::move(entry), spool));
+  return {};
+}
+
+Result<void> ParallelZipWriter::WriteEntry(CentralEntry entry, Spool& data) {
+  CF_EXPECT(!broken_, "The archive is missing an entry's data");
+  entry.offset = offset_;
+  auto extra = Zip64Extra(entry.size, entry.compressed_size, std::nullopt);
+  std::string header;
+  Put32(header, kLocalHeaderSignature);
+  Put16(header, extra.empty() ? kVersion : kZip64Version);
+  Put16(header, kUtf8Flag);
+  Put16(header, entry.method);
+  Put16(header, entry.dos_time);
+  Put16(header, entry.dos_date);
+  Put32(header, entry.crc);
+  Put32(header, extra.empty() ? entry.compressed_size : kMax32);
+  Put32(header, extra.empty() ? entry.size : kMax32);
+  Put16(header, entry.zip_path.size());
+  Put16(header, extra.size());
+  header += entry.zip_path;
+  header += extra;
+
+  // A failure past this point leaves a partial entry behind
+  broken_ = true;
+  CF_EXPECT(Write(header));
+  CF_EXPECT(data.CopyTo(out_));
+  broken_ = false;
+  offset_ += header.size() + entry.compressed_size;
+  entries_.emplace_back(std::move(entry));
+  return {};
+}
+
+Result<void> ParallelZipWriter::Finish() {
+  {
+    std::lock_guard lock(queue_mutex_);
+    finishing_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  std::lock_guard lock(out_mutex_);
+  CF_EXPECT(!broken_, "The archive is missing an entry's data");
+  CF_EXPECT(WriteCentralDirectory());
+  return {};
+}
+
+Result<void> ParallelZipWriter::WriteCentralDirectory() {
+  std::string directory;
+  for (const auto& entry : entries_) {
+    auto extra = Zip64Extra(entry.size, entry.compressed_size, entry.offset);
+    Put32(directory, kCentralHeaderSignature);
+    Put16(directory, kMadeBy);
+    Put16(directory, extra.empty() ? kVersion : kZip64Version);
+    Put16(directory, kUtf8Flag);
+    Put16(directory, entry.method);
+    Put16(directory, entry.dos_time);
+    Put16(directory, entry.dos_date);
+    Put32(directory, entry.crc);
+    bool large_sizes = entry.size >= kMax32 || entry.compressed_size >= kMax32;
+    Put32(directory, large_sizes ? kMax32 : entry.compressed_size);
+    Put32(directory, large_sizes ? kMax32 : entry.size);
+    Put16(directory, entry.zip_path.size());
+    Put16(directory, extra.size());
+    Put16(directory, 0);  // Comment length
+    Put16(directory, 0);  // Disk number
+    Put16(directory, 0);  // Internal attributes
+    Put32(directory, (S_IFREG | 0644) << 16);
+    Put32(directory, std::min<std::uint64_t>(entry.offset, kMax32));
+    directory += entry.zip_path;
+    directory += extra;
+  }
+
+  std::uint64_t directory_offset = offset_;
+  std::uint64_t count = entries_.size();
+  std::string end;
+  if (count >= kMax16 || directory.size() >= kMax32 ||
+      directory_offset >= kMax32) {
+    std::uint64_t zip64_end_offset = directory_offset + directory.size();
+    Put32(end, kZip64EndSignature);
+    Put64(end, 44);  // Size of the rest of the record
+    Put16(end, kMadeBy);
+    Put16(end, kZip64Version);
+    Put32(end, 0);  // Disk number
+    Put32(end, 0);  // Disk with the central directory
+    Put64(end, count);
+    Put64(end, count);
+    Put64(end, directory.size());
+    Put64(end, directory_offset);
+
+    Put32(end, kZip64LocatorSignature);
+    Put32(end, 0);  // Disk with the zip64 end record
+    Put64(end, zip64_end_offset);
+    Put32(end, 1);  // Number of disks
+  }
+  Put32(end, kEndSignature);
+  Put16(end, 0);  // Disk number
+  Put16(end, 0);  // Disk with the central directory
+  Put16(end, std::min<std::uint64_t>(count, kMax16));
+  Put16(end, std::min<std::uint64_t>(count, kMax16));
+  Put32(end, std::min<std::uint64_t>(directory.size(), kMax32));
+  Put32(end, std::min<std::uint64_t>(directory_offset, kMax32));
+  Put16(end, 0);  // Comment length
+
+  CF_EXPECT(Write(directory + end));
+  return {};
+}
+
+Result<void> ParallelZipWriter::Write(const std::string& data) {
+  CF_EXPECT(WriteAll(out_, data) == data.size(),
+            "Could not write archive: " << out_->StrError());
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * Writes a zip file whose entries are compressed on a pool of threads, each
+ * entry as an independent deflate stream. Entries are appended to the
+ * archive in the order they finish, and the central directory is written by
+ * Finish(). Zip64 records are used when the archive outgrows the classic
+ * format.
+ *
+ * Files that can't be read are logged and left out of the archive rather
+ * than failing it, as a bugreport should have as much as it can.
+ */
+class ParallelZipWriter {
+ public:
+  // Entries too large to keep in memory while they wait to be written are
+  // spilled to unnamed files in `temp_dir`.
+  ParallelZipWriter(SharedFD out, std::string temp_dir, unsigned threads);
+  ~ParallelZipWriter();
+
+  // Only the lines in the last `tail_size` bytes of the file are saved when
+  // `tail_size` isn't 0.
+  void AddFile(const std::string& zip_path, const std::string& file_path,
+               std::uint64_t tail_size = 0);
+  // Saves the file as is, for files that are already compressed.
+  void AddStoredFile(const std::string& zip_path, const std::string& file_path);
+  void AddContents(const std::string& zip_path, std::string contents);
+
+  // Waits for the queued entries and writes the central directory.
+  Result<void> Finish();
+
+ private:
+  struct Job {
+    std::string zip_path;
+    std::string file_path;
+    std::string contents;
+    bool compress;
+    std::uint64_t tail_size;
+  };
+  struct CentralEntry {
+    std::string zip_path;
+    std::uint16_t method;
+    std::uint16_t dos_time;
+    std::uint16_t dos_date;
+    std::uint32_t crc;
+    std::uint64_t compressed_size;
+    std::uint64_t size;
+    std::uint64_t offset;
+  };
+  class Spool;
+
+  void Enqueue(Job job);
+  void Work();
+  Result<void> Process(const Job& job);
+  Result<void> Deflate(const Job& job);
+  Result<void> Store(const Job& job);
+  // Appends an entry and its data to the archive, to be called with
+  // `out_mutex_` held.
+  Result<void> WriteEntry(CentralEntry entry, Spool& data);
+  Result<void> WriteCentralDirectory();
+  Result<void> Write(const std::string& data);
+
+  std::string temp_dir_;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<Job> queue_;
+  bool finishing_ = false;
+  std::vector<std::thread> threads_;
+
+  // Guards the output and everything below
+  std::mutex out_mutex_;
+  SharedFD out_;
+  std::uint64_t offset_ = 0;
+  std::vector<CentralEntry> entries_;
+  // Set when an entry was only partly written, which ruins the archive
+  bool broken_ = false;
+};
+
+}  // namespace cuttlefish
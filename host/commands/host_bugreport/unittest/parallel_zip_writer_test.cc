@@ -0,0 +1,151 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/host_bugreport/parallel_zip_writer.h"
+
+#include <fcntl.h>
+
+#include <map>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <ziparchive/zip_archive.h>
+
+namespace cuttlefish {
+namespace {
+
+struct Entry {
+  std::uint16_t method;
+  std::string contents;
+};
+
+class ParallelZipWriterTest : public testing::Test {
+ protected:
+  void SetUp() override { zip_path_ = std::string(dir_.path) + "/out.zip"; }
+
+  std::unique_ptr<ParallelZipWriter> Writer(unsigned threads = 4) {
+    auto out = SharedFD::Open(zip_path_, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    EXPECT_TRUE(out->IsOpen()) << out->StrError();
+    return std::make_unique<ParallelZipWriter>(out, dir_.path, threads);
+  }
+
+  std::string WriteFile(const std::string& name, const std::string& contents) {
+    auto path = std::string(dir_.path) + "/" + name;
+    EXPECT_TRUE(android::base::WriteStringToFile(contents, path));
+    return path;
+  }
+
+  std::map<std::string, Entry> ReadZip() {
+    std::map<std::string, Entry> entries;
+    ZipArchiveHandle handle;
+    int32_t err = OpenArchive(zip_path_.c_str(), &handle);
+    EXPECT_EQ(err, 0) << ErrorCodeString(err);
+    if (err != 0) {
+      return entries;
+    }
+    void* cookie;
+    EXPECT_EQ(StartIteration(handle, &cookie), 0);
+    ZipEntry64 entry;
+    std::string_view name;
+    while (Next(cookie, &entry, &name) == 0) {
+      std::string contents(entry.uncompressed_length, '\0');
+      err = ExtractToMemory(handle, &entry,
+                            reinterpret_cast<uint8_t*>(contents.data()),
+                            contents.size());
+      EXPECT_EQ(err, 0) << name << ": " << ErrorCodeString(err);
+      entries[std::string(name)] = Entry{entry.method, std::move(contents)};
+    }
+    EndIteration(cookie);
+    CloseArchive(handle);
+    return entries;
+  }
+
+  TemporaryDir dir_;
+  std::string zip_path_;
+};
+
+TEST_F(ParallelZipWriterTest, SavesEntries) {
+  std::string large;
+  for (int i = 0; large.size() < (20 << 20); i++) {
+    large += "line " + std::to_string(i) + "\n";
+  }
+  {
+    auto writer = Writer();
+    writer->AddFile("dir/small", WriteFile("small", "hello"));
+    // Larger than what is kept in memory
+    writer->AddFile("large", WriteFile("large", large));
+    writer->AddFile("empty", WriteFile("empty", ""));
+    writer->AddStoredFile("stored", WriteFile("stored", "compressed"));
+    writer->AddContents("contents", "from memory");
+    auto result = writer->Finish();
+    ASSERT_TRUE(result.ok()) << result.error().Trace();
+  }
+
+  auto entries = ReadZip();
+  ASSERT_EQ(entries.size(), 5u);
+  EXPECT_EQ(entries["dir/small"].contents, "hello");
+  EXPECT_EQ(entries["large"].contents, large);
+  EXPECT_EQ(entries["empty"].contents, "");
+  EXPECT_EQ(entries["stored"].contents, "compressed");
+  EXPECT_EQ(entries["stored"].method, 0);
+  EXPECT_EQ(entries["contents"].contents, "from memory");
+  EXPECT_EQ(entries["contents"].method, 8);
+}
+
+TEST_F(ParallelZipWriterTest, SavesTailFromLineStart) {
+  {
+    auto writer = Writer();
+    writer->AddFile("log", WriteFile("log", "first\nsecond\nthird\n"), 10);
+    writer->AddFile("short", WriteFile("short", "first\n"), 10);
+    ASSERT_TRUE(writer->Finish().ok());
+  }
+
+  auto entries = ReadZip();
+  EXPECT_EQ(entries["log"].contents, "third\n");
+  EXPECT_EQ(entries["short"].contents, "first\n");
+}
+
+TEST_F(ParallelZipWriterTest, SkipsMissingFiles) {
+  {
+    auto writer = Writer();
+    writer->AddFile("missing", std::string(dir_.path) + "/missing");
+    writer->AddStoredFile("missing_stored", std::string(dir_.path) + "/nope");
+    writer->AddFile("present", WriteFile("present", "here"));
+    ASSERT_TRUE(writer->Finish().ok());
+  }
+
+  auto entries = ReadZip();
+  ASSERT_EQ(entries.size(), 1u);
+  EXPECT_EQ(entries["present"].contents, "here");
+}
+
+TEST_F(ParallelZipWriterTest, UsesZip64PastEntryLimit) {
+  constexpr int kEntries = 70000;
+  {
+    auto writer = Writer();
+    for (int i = 0; i < kEntries; i++) {
+      writer->AddContents("entry" + std::to_string(i), std::to_string(i));
+    }
+    ASSERT_TRUE(writer->Finish().ok());
+  }
+
+  auto entries = ReadZip();
+  ASSERT_EQ(entries.size(), kEntries);
+  EXPECT_EQ(entries["entry69999"].contents, "69999");
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -88,11 +88,10 @@ void ProcessSubscriptions(
 }  // namespace
 
 namespace monitor {
-KernelLogServer::KernelLogServer(cuttlefish::SharedFD pipe_fd,
-                                 const std::string& log_name)
-    : pipe_fd_(pipe_fd),
-      log_fd_(cuttlefish::SharedFD::Open(log_name.c_str(),
-                                         O_CREAT | O_RDWR | O_APPEND, 0666)) {}
+KernelLogServer::KernelLogServer(
+    cuttlefish::SharedFD pipe_fd,
+    std::unique_ptr<cuttlefish::LogStoreWriter> log_store)
+    : pipe_fd_(pipe_fd), log_store_(std::move(log_store)) {}
 
 void KernelLogServer::BeforeSelect(cuttlefish::SharedFDSet* fd_read) const {
   fd_read->Set(pipe_fd_);
@@ -109,7 +108,7 @@ void KernelLogServer::SubscribeToEvents(monitor::EventCallback callback) {
 }
 
 bool KernelLogServer::HandleIncomingMessage() {
-  const size_t buf_len = 256;
+  const size_t buf_len = 4096;
   char buf[buf_len];
   ssize_t ret = pipe_fd_->Read(buf, buf_len);
   if (ret < 0) {
@@ -118,8 +117,10 @@ bool KernelLogServer::HandleIncomingMessage() {
   }
   if (ret == 0) return false;
   // Write the log to a file
-  if (log_fd_->Write(buf, ret) < 0) {
-    LOG(ERROR) << "Could not write kernel log to file: " << log_fd_->StrError();
+  auto appended = log_store_->Append(buf, ret);
+  if (!appended.ok()) {
+    LOG(ERROR) << "Could not write kernel log to file: "
+               << appended.error().Message();
     return false;
   }
 
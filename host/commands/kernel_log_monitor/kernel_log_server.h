@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,6 +26,7 @@
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/fs/shared_select.h"
+#include "host/libs/log_store/log_store.h"
 
 namespace monitor {
 
@@ -56,7 +58,8 @@ using EventCallback = std::function<SubscriptionAction(Json::Value)>;
 // Only accept one connection.
 class KernelLogServer {
  public:
-  KernelLogServer(cuttlefish::SharedFD pipe_fd, const std::string& log_name);
+  KernelLogServer(cuttlefish::SharedFD pipe_fd,
+                  std::unique_ptr<cuttlefish::LogStoreWriter> log_store);
 
   ~KernelLogServer() = default;
 
@@ -76,7 +79,7 @@ class KernelLogServer {
   bool HandleIncomingMessage();
 
   cuttlefish::SharedFD pipe_fd_;
-  cuttlefish::SharedFD log_fd_;
+  std::unique_ptr<cuttlefish::LogStoreWriter> log_store_;
   std::string line_;
   std::vector<EventCallback> subscribers_;
 
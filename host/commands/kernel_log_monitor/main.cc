@@ -31,6 +31,7 @@
 #include <host/libs/config/logging.h>
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
 #include "host/commands/kernel_log_monitor/utils.h"
+#include "host/libs/log_store/log_store.h"
 
 DEFINE_int32(log_pipe_fd, -1,
              "A file descriptor representing a (UNIX) socket from which to "
@@ -94,8 +95,14 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  monitor::KernelLogServer klog{pipe,
-                                instance.PerInstanceLogPath("kernel.log")};
+  auto log_store = cuttlefish::LogStoreWriter::Create(
+      instance.kernel_log_store_path(), instance.kernel_log_path(), {});
+  if (!log_store.ok()) {
+    LOG(ERROR) << "Could not open the kernel log store: "
+               << log_store.error().Message();
+    return 2;
+  }
+  monitor::KernelLogServer klog{pipe, std::move(*log_store)};
 
   for (auto subscriber_fd: subscriber_fds) {
     if (subscriber_fd->IsOpen()) {
@@ -16,18 +16,23 @@
 
 #include <signal.h>
 
+#include <vector>
+
 #include <gflags/gflags.h>
 #include <android-base/logging.h>
 
-#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/logging.h"
+#include "host/libs/log_store/log_store.h"
 
 DEFINE_int32(log_pipe_fd, -1,
              "A file descriptor representing a (UNIX) socket from which to "
              "read the logs. If -1 is given the socket is created according to "
              "the instance configuration");
+DEFINE_uint64(max_size_mb, 0,
+              "Oldest logcat segments are deleted when the stored logcat is "
+              "larger than this. 0 keeps all of it.");
 
 int main(int argc, char** argv) {
   cuttlefish::DefaultSubprocessLogging(argv);
@@ -59,25 +64,26 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  auto path = instance.logcat_path();
-  auto logcat_file =
-      cuttlefish::SharedFD::Open(path.c_str(), O_CREAT | O_APPEND | O_WRONLY, 0666);
+  cuttlefish::LogStoreWriter::Options options;
+  options.max_size = FLAGS_max_size_mb << 20;
+  auto store = cuttlefish::LogStoreWriter::Create(
+      instance.logcat_store_path(), instance.logcat_path(), options);
+  CHECK(store.ok()) << "Could not open the logcat store: "
+                    << store.error().Message();
 
   // Server loop
+  std::vector<char> buff(64 << 10);
   while (true) {
-    char buff[1024];
-    auto read = pipe->Read(buff, sizeof(buff));
+    auto read = pipe->Read(buff.data(), buff.size());
     if (read < 0) {
       LOG(ERROR) << "Could not read logcat: " << pipe->StrError();
       break;
     }
-    auto written = cuttlefish::WriteAll(logcat_file, buff, read);
-    CHECK(written == read)
-        << "Error writing to log file: " << logcat_file->StrError()
-        << ". This is unrecoverable.";
+    auto appended = (*store)->Append(buff.data(), read);
+    CHECK(appended.ok()) << "Error writing to the logcat store: "
+                         << appended.error().Message()
+                         << ". This is unrecoverable.";
   }
-
-  logcat_file->Close();
   pipe->Close();
   return 0;
 }
@@ -41,7 +41,9 @@ class KernelLogMonitor : public CommandSource,
 
   // DiagnosticInformation
   std::vector<std::string> Diagnostics() const override {
-    return {"Kernel log: " + instance_.PerInstancePath("kernel.log")};
+    return {"Kernel log: " + instance_.kernel_log_path(),
+            "Kernel log store, for cvd_query_logs: " +
+                instance_.kernel_log_store_path()};
   }
 
   Result<void> LateInject(fruit::Injector<>& injector) override {
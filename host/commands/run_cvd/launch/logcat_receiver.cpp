@@ -36,7 +36,9 @@ class LogcatReceiver : public CommandSource, public DiagnosticInformation {
       : instance_(instance) {}
   // DiagnosticInformation
   std::vector<std::string> Diagnostics() const override {
-    return {"Logcat output: " + instance_.logcat_path()};
+    return {"Logcat output: " + instance_.logcat_path(),
+            "Logcat store, for cvd_query_logs: " +
+                instance_.logcat_store_path()};
   }
 
   // CommandSource
@@ -225,6 +225,16 @@ Result<void> RunCvdMain(int argc, char** argv) {
   ConfigureLogs(*config, instance);
   CF_EXPECT(ChdirIntoRuntimeDir(instance));
 
+  // Before any thread or process is started, so that all of them inherit it
+  auto cpu_placement =
+      CF_EXPECT(vm_manager::InstanceCpuPlacement(*config, instance));
+  if (cpu_placement) {
+    auto applied = vm_manager::ApplyCpuPlacement(*cpu_placement);
+    if (!applied.ok()) {
+      LOG(WARNING) << "Not pinning host CPUs: " << applied.error().Message();
+    }
+  }
+
   fruit::Injector<> injector(runCvdComponent, config, &instance);
 
   for (auto& late_injected : injector.getMultibindings<LateInjected>()) {
@@ -34,28 +34,12 @@
 #include "host/libs/config/data_image.h"
 #include "host/libs/config/feature.h"
 #include "host/libs/config/inject.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
 
 namespace cuttlefish {
 
 namespace {
 
-bool CreateQcowOverlay(const std::string& crosvm_path,
-                       const std::string& backing_file,
-                       const std::string& output_overlay_path) {
-  Command crosvm_qcow2_cmd(crosvm_path);
-  crosvm_qcow2_cmd.AddParameter("create_qcow2");
-  crosvm_qcow2_cmd.AddParameter("--backing-file");
-  crosvm_qcow2_cmd.AddParameter(backing_file);
-  crosvm_qcow2_cmd.AddParameter(output_overlay_path);
-  int success = crosvm_qcow2_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run crosvm create_qcow2. Exited with status "
-               << success;
-    return false;
-  }
-  return true;
-}
-
 class ServerLoopImpl : public ServerLoop,
                        public SetupFeature,
                        public LateInjected {
@@ -281,8 +265,11 @@ class ServerLoopImpl : public ServerLoop,
       auto composite_disk_path = overlay_file.composite_disk_path.c_str();
 
       unlink(overlay_path.c_str());
-      if (!CreateQcowOverlay(instance_.crosvm_binary(), composite_disk_path, overlay_path)) {
-        LOG(ERROR) << "CreateQcowOverlay failed";
+      auto overlay_res = CreateQcowOverlay(composite_disk_path, overlay_path);
+      if (!overlay_res.ok()) {
+        LOG(ERROR) << "CreateQcowOverlay failed: "
+                   << overlay_res.error().Message();
+        LOG(DEBUG) << overlay_res.error().Trace();
         return false;
       }
     }
@@ -68,8 +68,11 @@ ConfUiSignServer::ConfUiSignServer(TpmResourceManager& tpm_resource_manager,
 
     data.insert(data.end(), request.payload_.data(),
                 request.payload_.data() + request.payload_.size());
-    auto hmac = TpmHmacWithContext(tpm_resource_manager_, "confirmation_token",
-                                   data.data(), data.size());
+    auto hmac = [this, &data]() {
+      auto tpm_lock = tpm_resource_manager_.Lock();
+      return TpmHmacWithContext(tpm_resource_manager_, "confirmation_token",
+                                data.data(), data.size());
+    }();
     if (!hmac) {
       LOG(ERROR) << "Could not calculate confirmation token hmac";
       sign_sender.Send(confui::SignMessageError::kUnknownError, {});
@@ -21,8 +21,18 @@
 namespace cuttlefish {
 
 GatekeeperResponder::GatekeeperResponder(cuttlefish::GatekeeperChannel& channel,
-                                         gatekeeper::GateKeeper& gatekeeper)
-    : channel_(channel), gatekeeper_(gatekeeper) {}
+                                         gatekeeper::GateKeeper& gatekeeper,
+                                         TpmResourceManager* resource_manager)
+    : channel_(channel),
+      gatekeeper_(gatekeeper),
+      resource_manager_(resource_manager) {}
+
+std::unique_lock<std::mutex> GatekeeperResponder::LockTpm() {
+  if (resource_manager_) {
+    return resource_manager_->Lock();
+  }
+  return {};
+}
 
 bool GatekeeperResponder::ProcessMessage() {
   auto request = channel_.ReceiveMessage();
@@ -42,7 +52,10 @@ bool GatekeeperResponder::ProcessMessage() {
         return false;
       }
       EnrollResponse response;
-      gatekeeper_.Enroll(enroll_request, &response);
+      {
+        auto tpm_lock = LockTpm();
+        gatekeeper_.Enroll(enroll_request, &response);
+      }
       return channel_.SendResponse(ENROLL, response);
     }
     case VERIFY: {
@@ -53,7 +66,10 @@ bool GatekeeperResponder::ProcessMessage() {
         return false;
       }
       VerifyResponse response;
-      gatekeeper_.Verify(verify_request, &response);
+      {
+        auto tpm_lock = LockTpm();
+        gatekeeper_.Verify(verify_request, &response);
+      }
       return channel_.SendResponse(VERIFY, response);
     }
     default:
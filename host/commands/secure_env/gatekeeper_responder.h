@@ -15,9 +15,12 @@
 
 #pragma once
 
+#include <mutex>
+
 #include <gatekeeper/gatekeeper.h>
 
 #include "common/libs/security/gatekeeper_channel.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
 
 namespace cuttlefish {
 
@@ -25,10 +28,16 @@ class GatekeeperResponder {
 private:
  cuttlefish::GatekeeperChannel& channel_;
  gatekeeper::GateKeeper& gatekeeper_;
+ TpmResourceManager* resource_manager_;
+
+ std::unique_lock<std::mutex> LockTpm();
 
 public:
+ // `resource_manager` may be null when `gatekeeper` doesn't use a TPM shared
+ // with other threads.
  GatekeeperResponder(cuttlefish::GatekeeperChannel& channel,
-                     gatekeeper::GateKeeper& gatekeeper);
+                     gatekeeper::GateKeeper& gatekeeper,
+                     TpmResourceManager* resource_manager = nullptr);
 
  bool ProcessMessage();
 };
@@ -21,8 +21,11 @@
 namespace cuttlefish {
 
 KeymasterResponder::KeymasterResponder(cuttlefish::KeymasterChannel& channel,
-                                       keymaster::AndroidKeymaster& keymaster)
-    : channel_(channel), keymaster_(keymaster) {}
+                                       keymaster::AndroidKeymaster& keymaster,
+                                       TpmResourceManager* resource_manager)
+    : channel_(channel),
+      keymaster_(keymaster),
+      resource_manager_(resource_manager) {}
 
 bool KeymasterResponder::ProcessMessage() {
   auto request = channel_.ReceiveMessage();
@@ -42,7 +45,7 @@ bool KeymasterResponder::ProcessMessage() {
       return false;                                                  \
     }                                                                \
     METHOD_NAME##Response response(keymaster_.message_version());    \
-    keymaster_.METHOD_NAME(request, &response);                      \
+    WithTpm([&]() { keymaster_.METHOD_NAME(request, &response); });  \
     return channel_.SendResponse(ENUM_NAME, response);               \
   }
     HANDLE_MESSAGE(GENERATE_KEY, GenerateKey)
@@ -78,7 +81,8 @@ bool KeymasterResponder::ProcessMessage() {
       LOG(ERROR) << "Failed to deserialize " #METHOD_NAME "Request"; \
       return false;                                                  \
     }                                                                \
-    auto response = keymaster_.METHOD_NAME(request);                 \
+    auto response =                                                  \
+        WithTpm([&]() { return keymaster_.METHOD_NAME(request); });  \
     return channel_.SendResponse(ENUM_NAME, response);               \
   }
     HANDLE_MESSAGE_W_RETURN(COMPUTE_SHARED_HMAC, ComputeSharedHmac)
@@ -96,7 +100,8 @@ bool KeymasterResponder::ProcessMessage() {
 #undef HANDLE_MESSAGE_W_RETURN
 #define HANDLE_MESSAGE_W_RETURN_NO_ARG(ENUM_NAME, METHOD_NAME) \
   case ENUM_NAME: {                                            \
-    auto response = keymaster_.METHOD_NAME();                  \
+    auto response =                                            \
+        WithTpm([&]() { return keymaster_.METHOD_NAME(); });   \
     return channel_.SendResponse(ENUM_NAME, response);         \
   }
     HANDLE_MESSAGE_W_RETURN_NO_ARG(GET_HMAC_SHARING_PARAMETERS,
@@ -112,7 +117,7 @@ bool KeymasterResponder::ProcessMessage() {
       }
       AddEntropyResponse response(keymaster_.message_version());
       ;
-      keymaster_.AddRngEntropy(request, &response);
+      WithTpm([&]() { keymaster_.AddRngEntropy(request, &response); });
       return channel_.SendResponse(ADD_RNG_ENTROPY, response);
     }
     case DESTROY_ATTESTATION_IDS:
@@ -15,9 +15,12 @@
 
 #pragma once
 
+#include <mutex>
+
 #include <keymaster/android_keymaster.h>
 
 #include "common/libs/security/keymaster_channel.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
 
 namespace cuttlefish {
 
@@ -25,10 +28,25 @@ class KeymasterResponder {
  private:
   cuttlefish::KeymasterChannel& channel_;
   keymaster::AndroidKeymaster& keymaster_;
+  TpmResourceManager* resource_manager_;
+
+  // Runs `handler` with the TPM to this thread, so that only the handling of
+  // a request and not the waits on the channel exclude other HALs.
+  template <typename F>
+  auto WithTpm(F handler) {
+    std::unique_lock<std::mutex> lock;
+    if (resource_manager_) {
+      lock = resource_manager_->Lock();
+    }
+    return handler();
+  }
 
  public:
+  // `resource_manager` may be null when `keymaster` doesn't use a TPM shared
+  // with other threads.
   KeymasterResponder(cuttlefish::KeymasterChannel& channel,
-                     keymaster::AndroidKeymaster& keymaster);
+                     keymaster::AndroidKeymaster& keymaster,
+                     TpmResourceManager* resource_manager = nullptr);
 
   bool ProcessMessage();
 };
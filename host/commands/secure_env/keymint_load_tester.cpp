@@ -0,0 +1,252 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays KeyMint traffic against the TPM backed implementation used by
+// secure_env, on an in-process TPM, and reports the operations per second.
+// Each client thread takes the TPM lock per request as the HAL threads of
+// secure_env do, so this also measures how they contend for it.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/authorization_set.h>
+
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/scope_guard.h"
+#include "host/commands/secure_env/fragile_tpm_storage.h"
+#include "host/commands/secure_env/insecure_fallback_storage.h"
+#include "host/commands/secure_env/proxy_keymaster_context.h"
+#include "host/commands/secure_env/test_tpm.h"
+#include "host/commands/secure_env/tpm_gatekeeper.h"
+#include "host/commands/secure_env/tpm_keymaster_context.h"
+#include "host/commands/secure_env/tpm_keymaster_enforcement.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
+
+DEFINE_int32(clients, 4, "Number of threads sending requests");
+DEFINE_int32(seconds, 10, "How long to send requests for");
+DEFINE_int32(sign_size, 1024, "Bytes signed by each operation");
+DEFINE_int32(signs_per_key, 16,
+             "Operations done with each key before generating a new one");
+
+namespace cuttlefish {
+namespace {
+
+using keymaster::AuthorizationSet;
+using keymaster::AuthorizationSetBuilder;
+
+// Copied from secure_env_linux_main.cpp
+constexpr size_t kOperationTableSize = 16;
+
+enum Op { kGenerateKey, kBegin, kUpdate, kFinish, kNumOps };
+constexpr std::array<const char*, kNumOps> kOpNames = {
+    "GenerateKey", "BeginOperation", "UpdateOperation", "FinishOperation"};
+
+struct Stats {
+  std::array<std::atomic<std::uint64_t>, kNumOps> done = {};
+  std::array<std::atomic<std::uint64_t>, kNumOps> failed = {};
+};
+
+class Client {
+ public:
+  Client(keymaster::AndroidKeymaster& keymaster,
+         TpmResourceManager& resource_manager, Stats& stats)
+      : keymaster_(keymaster),
+        resource_manager_(resource_manager),
+        stats_(stats),
+        input_(FLAGS_sign_size, 'x') {}
+
+  void Run(std::chrono::steady_clock::time_point deadline) {
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (!GenerateKey()) {
+        continue;
+      }
+      for (int i = 0; i < FLAGS_signs_per_key; i++) {
+        Sign();
+      }
+    }
+  }
+
+ private:
+  bool Record(Op op, keymaster_error_t error) {
+    if (error == KM_ERROR_OK) {
+      stats_.done[op]++;
+      return true;
+    }
+    if (stats_.failed[op]++ == 0) {
+      LOG(ERROR) << kOpNames[op] << " failed: " << error;
+    }
+    return false;
+  }
+
+  bool GenerateKey() {
+    keymaster::GenerateKeyRequest request(keymaster_.message_version());
+    request.key_description.Reinitialize(
+        AuthorizationSet(AuthorizationSetBuilder()
+                             .HmacKey(256)
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Authorization(keymaster::TAG_MIN_MAC_LENGTH, 256)
+                             .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)));
+    keymaster::GenerateKeyResponse response(keymaster_.message_version());
+    {
+      auto tpm_lock = resource_manager_.Lock();
+      keymaster_.GenerateKey(request, &response);
+    }
+    if (!Record(kGenerateKey, response.error)) {
+      return false;
+    }
+    key_blob_ = std::move(response.key_blob);
+    return true;
+  }
+
+  void Sign() {
+    keymaster::BeginOperationRequest begin(keymaster_.message_version());
+    begin.purpose = KM_PURPOSE_SIGN;
+    begin.SetKeyMaterial(key_blob_);
+    begin.additional_params.Reinitialize(
+        AuthorizationSet(AuthorizationSetBuilder()
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Authorization(keymaster::TAG_MAC_LENGTH, 256)));
+    keymaster::BeginOperationResponse begun(keymaster_.message_version());
+    {
+      auto tpm_lock = resource_manager_.Lock();
+      keymaster_.BeginOperation(begin, &begun);
+    }
+    if (!Record(kBegin, begun.error)) {
+      return;
+    }
+
+    keymaster::UpdateOperationRequest update(keymaster_.message_version());
+    update.op_handle = begun.op_handle;
+    update.input.Reinitialize(input_.data(), input_.size());
+    keymaster::UpdateOperationResponse updated(keymaster_.message_version());
+    {
+      auto tpm_lock = resource_manager_.Lock();
+      keymaster_.UpdateOperation(update, &updated);
+    }
+    if (!Record(kUpdate, updated.error)) {
+      return;
+    }
+
+    keymaster::FinishOperationRequest finish(keymaster_.message_version());
+    finish.op_handle = begun.op_handle;
+    keymaster::FinishOperationResponse finished(keymaster_.message_version());
+    {
+      auto tpm_lock = resource_manager_.Lock();
+      keymaster_.FinishOperation(finish, &finished);
+    }
+    Record(kFinish, finished.error);
+  }
+
+  keymaster::AndroidKeymaster& keymaster_;
+  TpmResourceManager& resource_manager_;
+  Stats& stats_;
+  std::string input_;
+  keymaster::KeymasterKeyBlob key_blob_;
+};
+
+int KeymintLoadTesterMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(FLAGS_clients > 0 && FLAGS_clients <= (int)kOperationTableSize)
+      << "--clients must be between 1 and " << kOperationTableSize;
+
+  // The TPM simulator and the gatekeeper storage write to the working
+  // directory.
+  char work_dir[] = "/tmp/keymint_load_tester.XXXXXX";
+  CHECK(mkdtemp(work_dir) != nullptr) << strerror(errno);
+  // Declared first so that it runs after the TPM is gone
+  ScopeGuard remove_work_dir(
+      [&work_dir]() { RecursivelyRemoveDirectory(work_dir); });
+  CHECK(chdir(work_dir) == 0) << strerror(errno);
+
+  TestTpm tpm;
+  TpmResourceManager resource_manager(tpm.Esys());
+  FragileTpmStorage secure_storage(resource_manager, "gatekeeper_secure");
+  InsecureFallbackStorage insecure_storage(resource_manager,
+                                           "gatekeeper_insecure");
+  TpmGatekeeper gatekeeper(resource_manager, secure_storage, insecure_storage);
+  TpmKeymasterEnforcement enforcement(resource_manager, gatekeeper);
+  TpmKeymasterContext context(resource_manager, enforcement);
+  // keymaster::AndroidKeymaster takes ownership of the context it's given.
+  keymaster::AndroidKeymaster keymaster(
+      new ProxyKeymasterContext(context), kOperationTableSize,
+      keymaster::MessageVersion(keymaster::KmVersion::KEYMINT_3,
+                                0 /* km_date */));
+
+  // What the HAL sends before any key is used
+  keymaster::ConfigureRequest configure(keymaster.message_version());
+  configure.os_version = 140000;
+  configure.os_patchlevel = 202310;
+  keymaster::ConfigureResponse configured(keymaster.message_version());
+  keymaster.Configure(configure, &configured);
+  CHECK(configured.error == KM_ERROR_OK)
+      << "Configure failed: " << configured.error;
+  keymaster::ConfigureVendorPatchlevelRequest vendor_patchlevel(
+      keymaster.message_version());
+  vendor_patchlevel.vendor_patchlevel = 20231001;
+  keymaster.ConfigureVendorPatchlevel(vendor_patchlevel);
+  keymaster::ConfigureBootPatchlevelRequest boot_patchlevel(
+      keymaster.message_version());
+  boot_patchlevel.boot_patchlevel = 20231001;
+  keymaster.ConfigureBootPatchlevel(boot_patchlevel);
+
+  Stats stats;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(FLAGS_seconds);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_clients; i++) {
+    threads.emplace_back([&keymaster, &resource_manager, &stats, deadline]() {
+      Client(keymaster, resource_manager, stats).Run(deadline);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::uint64_t total = 0;
+  for (int op = 0; op < kNumOps; op++) {
+    std::cout << std::left << std::setw(16) << kOpNames[op] << std::right
+              << std::setw(10) << stats.done[op] << " ok" << std::setw(8)
+              << stats.failed[op] << " failed" << std::setw(12) << std::fixed
+              << std::setprecision(1) << stats.done[op] / elapsed.count()
+              << " ops/sec\n";
+    total += stats.done[op];
+  }
+  std::cout << "total " << std::fixed << std::setprecision(1)
+            << total / elapsed.count() << " ops/sec with " << FLAGS_clients
+            << " clients\n";
+  return 0;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::KeymintLoadTesterMain(argc, argv);
+}
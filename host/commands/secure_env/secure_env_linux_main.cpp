@@ -287,11 +287,13 @@ int SecureEnvMain(int argc, char** argv) {
   auto keymaster_in = DupFdFlag(FLAGS_keymaster_fd_in);
   auto keymaster_out = DupFdFlag(FLAGS_keymaster_fd_out);
   keymaster::AndroidKeymaster* borrowed_km = keymaster.get();
-  threads.emplace_back([keymaster_in, keymaster_out, borrowed_km]() {
+  threads.emplace_back([keymaster_in, keymaster_out, borrowed_km,
+                        resource_manager]() {
     while (true) {
       SharedFdKeymasterChannel keymaster_channel(keymaster_in, keymaster_out);
 
-      KeymasterResponder keymaster_responder(keymaster_channel, *borrowed_km);
+      KeymasterResponder keymaster_responder(keymaster_channel, *borrowed_km,
+                                             resource_manager);
 
       while (keymaster_responder.ProcessMessage()) {
       }
@@ -300,12 +302,14 @@ int SecureEnvMain(int argc, char** argv) {
 
   auto gatekeeper_in = DupFdFlag(FLAGS_gatekeeper_fd_in);
   auto gatekeeper_out = DupFdFlag(FLAGS_gatekeeper_fd_out);
-  threads.emplace_back([gatekeeper_in, gatekeeper_out, &gatekeeper]() {
+  threads.emplace_back([gatekeeper_in, gatekeeper_out, &gatekeeper,
+                        resource_manager]() {
     while (true) {
       SharedFdGatekeeperChannel gatekeeper_channel(gatekeeper_in,
                                                    gatekeeper_out);
 
-      GatekeeperResponder gatekeeper_responder(gatekeeper_channel, *gatekeeper);
+      GatekeeperResponder gatekeeper_responder(gatekeeper_channel, *gatekeeper,
+                                               resource_manager);
 
       while (gatekeeper_responder.ProcessMessage()) {
       }
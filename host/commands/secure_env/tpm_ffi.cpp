@@ -32,6 +32,8 @@ uint32_t tpm_hmac(void* trm, const uint8_t* data, uint32_t data_len,
   }
   TpmResourceManager* resource_manager =
       reinterpret_cast<TpmResourceManager*>(trm);
+  // The Rust TA runs on its own thread, next to the other HALs
+  auto tpm_lock = resource_manager->Lock();
   auto hmac =
       TpmHmacWithContext(*resource_manager, "TpmHmac_context", data, data_len);
   if (!hmac) {
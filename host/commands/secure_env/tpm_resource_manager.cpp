@@ -69,6 +69,10 @@ ESYS_CONTEXT* TpmResourceManager::Esys() {
   return esys_;
 }
 
+std::unique_lock<std::mutex> TpmResourceManager::Lock() {
+  return std::unique_lock(esys_mutex_);
+}
+
 TpmObjectSlot TpmResourceManager::ReserveSlot() {
   auto slot_num = used_slots_.fetch_add(1);
   if (slot_num >= maximum_object_slots_) {
@@ -15,8 +15,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <set>
 
 #include <tss2/tss2_esys.h>
@@ -55,8 +57,16 @@ public:
 
   ESYS_CONTEXT* Esys();
   std::shared_ptr<ObjectSlot> ReserveSlot();
+
+  /**
+   * The ESYS context isn't thread safe, and the few object slots can't be
+   * shared between concurrent sequences of TPM commands. Threads serving
+   * requests from different HALs hold this while they may use the TPM.
+   */
+  std::unique_lock<std::mutex> Lock();
 private:
   ESYS_CONTEXT* esys_;
+  std::mutex esys_mutex_;
   const std::uint32_t maximum_object_slots_;
   std::atomic<std::uint32_t> used_slots_;
 };
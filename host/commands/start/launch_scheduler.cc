@@ -0,0 +1,220 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/start/launch_scheduler.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/scope_guard.h"
+#include "host/commands/run_cvd/runner_defs.h"
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct PendingReport {
+  std::size_t runner;
+  SharedFD report;
+  Clock::time_point started;
+};
+
+double Seconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// Pipes aren't created with O_CLOEXEC, and the runners started later must not
+// inherit the ends of the pipes of the earlier ones: a leaked write end keeps a
+// runner's stdin or boot report pipe open after it's gone.
+Result<void> CreatePipe(SharedFD* read_end, SharedFD* write_end) {
+  CF_EXPECT(SharedFD::Pipe(read_end, write_end),
+            "Could not create a pipe: " << strerror(errno));
+  for (auto& fd : {*read_end, *write_end}) {
+    CF_EXPECT(fd->Fcntl(F_SETFD, FD_CLOEXEC) == 0,
+              "Could not set FD_CLOEXEC: " << fd->StrError());
+  }
+  return {};
+}
+
+// Writing to a runner that exited without reading its input raises SIGPIPE,
+// which would kill the launcher before it stops the runners already started.
+// The signal is blocked around the write so the write fails with EPIPE
+// instead. It isn't ignored outright, as the runners would inherit that.
+Result<void> WriteInput(SharedFD stdin_write, const std::string& input,
+                        const std::string& name) {
+  sigset_t sigpipe, previous;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  CF_EXPECT(pthread_sigmask(SIG_BLOCK, &sigpipe, &previous) == 0,
+            "Could not block SIGPIPE");
+  auto written = WriteAll(stdin_write, input);
+  auto write_error = stdin_write->StrError();
+  if (stdin_write->GetErrno() == EPIPE && !sigismember(&previous, SIGPIPE)) {
+    // Consumed here, rather than delivered once it's unblocked
+    struct timespec no_wait = {0, 0};
+    sigtimedwait(&sigpipe, nullptr, &no_wait);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  CF_EXPECT(written == (ssize_t)input.size(),
+            "Could not write to the stdin of \"" << name << "\": "
+                                                  << write_error);
+  return {};
+}
+
+Result<PendingReport> Start(RunnerLaunch launch,
+                            std::vector<LaunchedRunner>& runners) {
+  SharedFD stdin_read, stdin_write, report_read, report_write;
+  CF_EXPECT(CreatePipe(&stdin_read, &stdin_write));
+  CF_EXPECT(CreatePipe(&report_read, &report_write));
+
+  PendingReport pending{
+      .runner = runners.size(),
+      .report = report_read,
+  };
+  {
+    // The command holds its own copies of the runner's ends of the pipes until
+    // it's destroyed, which would hide the runner exiting.
+    Command command = std::move(launch.command);
+    command.AddParameter("-reboot_notification_fd=", report_write);
+    command.RedirectStdIO(Subprocess::StdIOChannel::kStdIn, stdin_read);
+    pending.started = Clock::now();
+    auto process = command.Start();
+    CF_EXPECT(process.Started(), "Could not start \"" << launch.name << "\"");
+    runners.push_back(LaunchedRunner{
+        .name = launch.name,
+        .process = std::move(process),
+    });
+  }
+  // Left to the runner alone, so writing fails rather than blocks if it exits
+  // without reading its input
+  stdin_read->Close();
+  CF_EXPECT(WriteInput(stdin_write, launch.input, launch.name));
+  return pending;
+}
+
+void ReadReport(const PendingReport& pending, LaunchedRunner& runner) {
+  runner.boot_time = Clock::now() - pending.started;
+  RunnerExitCodes boot_result;
+  auto bytes_read = pending.report->Read(&boot_result, sizeof(boot_result));
+  if (bytes_read != sizeof(boot_result)) {
+    LOG(ERROR) << "\"" << runner.name << "\" exited without reporting its boot";
+    runner.boot_result = RunnerExitCodes::kPipeIOError;
+  } else {
+    runner.boot_result = boot_result;
+  }
+}
+
+// The runners started before a launch failed would outlive it otherwise
+void StopRunners(std::vector<LaunchedRunner>& runners) {
+  for (auto& runner : runners) {
+    LOG(WARNING) << "Stopping \"" << runner.name << "\"";
+    if (runner.process.Stop() != StopperResult::kStopSuccess) {
+      LOG(ERROR) << "Could not stop \"" << runner.name << "\"";
+      continue;
+    }
+    runner.process.Wait();
+  }
+}
+
+}  // namespace
+
+bool LaunchedRunner::Booted() const {
+  return boot_result == RunnerExitCodes::kSuccess;
+}
+
+Result<std::vector<LaunchedRunner>> LaunchRunners(
+    std::vector<RunnerLaunch> launches, const LaunchOptions& options) {
+  std::vector<LaunchedRunner> runners;
+  ScopeGuard stop_runners([&runners]() { StopRunners(runners); });
+  std::vector<PendingReport> pending;
+  std::optional<Clock::time_point> first_start;
+  std::optional<Clock::time_point> last_start;
+  std::size_t next = 0;
+  while (next < launches.size() || !pending.empty()) {
+    auto now = Clock::now();
+    bool below_limit =
+        options.concurrency == 0 || pending.size() < options.concurrency;
+    std::optional<Clock::time_point> next_start;
+    if (next < launches.size() && below_limit) {
+      next_start = last_start ? *last_start + options.stagger : now;
+    }
+    if (next_start && *next_start <= now) {
+      auto started = CF_EXPECT(Start(std::move(launches[next]), runners));
+      first_start = first_start.value_or(started.started);
+      last_start = started.started;
+      runners.back().started_at = started.started - *first_start;
+      pending.push_back(std::move(started));
+      next++;
+      continue;
+    }
+
+    // Wait for a boot report, or for the stagger to allow the next start
+    int timeout = -1;
+    if (next_start) {
+      timeout = std::chrono::ceil<std::chrono::milliseconds>(*next_start - now)
+                    .count();
+    }
+    std::vector<PollSharedFd> poll_fds;
+    for (const auto& report : pending) {
+      poll_fds.push_back(PollSharedFd{.fd = report.report, .events = POLLIN});
+    }
+    if (SharedFD::Poll(poll_fds, timeout) < 0) {
+      CF_EXPECT(errno == EINTR, "Failed to poll the boot reports: "
+                                    << strerror(errno));
+      continue;
+    }
+    for (std::size_t i = poll_fds.size(); i-- > 0;) {
+      if (poll_fds[i].revents == 0) {
+        continue;
+      }
+      ReadReport(pending[i], runners[pending[i].runner]);
+      pending.erase(pending.begin() + i);
+    }
+  }
+  stop_runners.Cancel();
+  return runners;
+}
+
+void LogLaunchReport(const std::vector<LaunchedRunner>& runners) {
+  std::size_t name_width = 0;
+  for (const auto& runner : runners) {
+    name_width = std::max(name_width, runner.name.size());
+  }
+  std::stringstream report;
+  report << std::fixed << std::setprecision(1) << "Launched " << runners.size()
+         << " devices:";
+  for (const auto& runner : runners) {
+    report << "\n  " << std::left << std::setw(name_width) << runner.name
+           << std::right << (runner.Booted() ? "  booted " : "  failed ")
+           << " started at " << Seconds(runner.started_at) << "s, reported after "
+           << Seconds(runner.boot_time) << "s";
+  }
+  LOG(INFO) << report.str();
+}
+
+}  // namespace cuttlefish
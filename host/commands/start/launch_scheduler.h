@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+
+namespace cuttlefish {
+
+struct RunnerLaunch {
+  std::string name;
+  Command command;
+  // Written to the runner's stdin, which is closed afterwards.
+  std::string input;
+};
+
+struct LaunchOptions {
+  // How many runners may be booting at the same time, 0 for no limit.
+  std::size_t concurrency = 0;
+  // The least time between two runners starting.
+  std::chrono::milliseconds stagger{0};
+};
+
+struct LaunchedRunner {
+  std::string name;
+  Subprocess process;
+  // When the runner started, counted from the start of the first one.
+  std::chrono::nanoseconds started_at{};
+  // How long after starting the runner reported the end of its boot.
+  std::chrono::nanoseconds boot_time{};
+  // What the runner reported, one of RunnerExitCodes. A runner which exits
+  // without reporting anything counts as kPipeIOError.
+  int boot_result = -1;
+
+  bool Booted() const;
+};
+
+/**
+ * Starts the runners without waiting for each other to boot, passing each of
+ * them the write end of a pipe in -reboot_notification_fd. The boot reports
+ * coming back through the pipes are all waited for in one poll loop, which
+ * also starts the runners still queued as the concurrency limit and the
+ * stagger allow. Returns once every runner reported its boot or exited. On
+ * failure, the runners already started are stopped and waited for.
+ */
+Result<std::vector<LaunchedRunner>> LaunchRunners(
+    std::vector<RunnerLaunch> launches, const LaunchOptions& options);
+
+// Logs how long each runner took to start and to boot.
+void LogLaunchReport(const std::vector<LaunchedRunner>& runners);
+
+}  // namespace cuttlefish
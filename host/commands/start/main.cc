@@ -13,6 +13,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -30,6 +32,7 @@
 #include "host/commands/assemble_cvd/flags_defaults.h"
 #include "host/commands/start/filesystem_explorer.h"
 #include "host/commands/start/flag_forwarder.h"
+#include "host/commands/start/launch_scheduler.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/fetcher_config.h"
 #include "host/libs/config/host_tools_version.h"
@@ -68,6 +71,11 @@ DEFINE_string(file_verbosity, CF_DEFAULTS_FILE_VERBOSITY,
 DEFINE_bool(use_overlay, CF_DEFAULTS_USE_OVERLAY,
             "Capture disk writes an overlay. This is a "
             "prerequisite for powerwash_cvd or multiple instances.");
+DEFINE_int32(launch_concurrency, CF_DEFAULTS_LAUNCH_CONCURRENCY,
+             "How many devices may be booting at the same time. 0 for no "
+             "limit.");
+DEFINE_int32(launch_stagger_ms, CF_DEFAULTS_LAUNCH_STAGGER_MS,
+             "The least time between starting two devices, in milliseconds.");
 
 namespace {
 
@@ -99,16 +107,6 @@ cuttlefish::Subprocess StartAssembler(cuttlefish::SharedFD assembler_stdin,
   return assemble_cmd.Start();
 }
 
-cuttlefish::Subprocess StartRunner(cuttlefish::SharedFD runner_stdin,
-                            const std::vector<std::string>& argv) {
-  cuttlefish::Command run_cmd(kRunnerBin);
-  for (const auto& arg : argv) {
-    run_cmd.AddParameter(arg);
-  }
-  run_cmd.RedirectStdIO(cuttlefish::Subprocess::StdIOChannel::kStdIn, runner_stdin);
-  return run_cmd.Start();
-}
-
 void WriteFiles(cuttlefish::FetcherConfig fetcher_config, cuttlefish::SharedFD out) {
   std::stringstream output_streambuf;
   for (const auto& file : fetcher_config.get_cvd_files()) {
@@ -394,27 +392,40 @@ int main(int argc, char** argv) {
     LOG(DEBUG) << "assemble_cvd exited successfully.";
   }
 
-  std::vector<cuttlefish::Subprocess> runners;
+  std::vector<cuttlefish::RunnerLaunch> launches;
   for (const auto& instance_num : *instance_nums) {
-    cuttlefish::SharedFD runner_stdin_in, runner_stdin_out;
-    cuttlefish::SharedFD::Pipe(&runner_stdin_out, &runner_stdin_in);
     std::string instance_num_str = std::to_string(instance_num);
-    setenv(cuttlefish::kCuttlefishInstanceEnvVarName, instance_num_str.c_str(),
-           /* overwrite */ 1);
-
-    auto run_proc = StartRunner(std::move(runner_stdin_out),
-                                forwarder.ArgvForSubprocess(kRunnerBin));
-    runners.push_back(std::move(run_proc));
-    if (cuttlefish::WriteAll(runner_stdin_in, assembler_output) < 0) {
-      int error_num = errno;
-      LOG(ERROR) << "Could not write to run_cvd: " << strerror(error_num);
-      return -1;
+    cuttlefish::Command run_cmd(kRunnerBin);
+    run_cmd.UnsetFromEnvironment(cuttlefish::kCuttlefishInstanceEnvVarName);
+    run_cmd.AddEnvironmentVariable(cuttlefish::kCuttlefishInstanceEnvVarName,
+                                   instance_num_str);
+    for (const auto& arg : forwarder.ArgvForSubprocess(kRunnerBin)) {
+      run_cmd.AddParameter(arg);
     }
+    launches.push_back(cuttlefish::RunnerLaunch{
+        .name = "cvd-" + instance_num_str,
+        .command = std::move(run_cmd),
+        .input = assembler_output,
+    });
+  }
+
+  auto runners = cuttlefish::LaunchRunners(
+      std::move(launches),
+      cuttlefish::LaunchOptions{
+          .concurrency = (std::size_t)std::max(0, FLAGS_launch_concurrency),
+          .stagger = std::chrono::milliseconds(
+              std::max(0, FLAGS_launch_stagger_ms)),
+      });
+  if (!runners.ok()) {
+    LOG(ERROR) << runners.error().Message();
+    LOG(DEBUG) << runners.error().Trace();
+    return -1;
   }
+  cuttlefish::LogLaunchReport(*runners);
 
   bool run_cvd_failure = false;
-  for (auto& run_proc : runners) {
-    auto run_ret = run_proc.Wait();
+  for (auto& runner : *runners) {
+    auto run_ret = runner.process.Wait();
     if (run_ret != 0) {
       run_cvd_failure = true;
       LOG(ERROR) << "run_cvd returned " << run_ret;
@@ -0,0 +1,79 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Stands in for run_cvd in the launch scheduler tests. Reads its stdin to the
+// end like run_cvd reads the assembler output, then reports its boot through
+// -reboot_notification_fd after -boot_delay_ms. -boot_result picks what it
+// reports: "success", "failure", "none" to exit without reporting, or
+// "no_read" to exit before reading its stdin.
+
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/run_cvd/runner_defs.h"
+
+int main(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+
+  int notification_fd = -1;
+  int boot_delay_ms = 0;
+  std::string boot_result = "success";
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (android::base::ConsumePrefix(&arg, "-reboot_notification_fd=")) {
+      CHECK(android::base::ParseInt(std::string(arg), &notification_fd));
+    } else if (android::base::ConsumePrefix(&arg, "-boot_delay_ms=")) {
+      CHECK(android::base::ParseInt(std::string(arg), &boot_delay_ms));
+    } else if (android::base::ConsumePrefix(&arg, "-boot_result=")) {
+      boot_result = arg;
+    } else {
+      LOG(FATAL) << "Unknown argument \"" << argv[i] << "\"";
+    }
+  }
+  CHECK(notification_fd >= 0) << "Missing -reboot_notification_fd";
+  auto notification = cuttlefish::SharedFD::Dup(notification_fd);
+  close(notification_fd);
+
+  if (boot_result == "no_read") {
+    return cuttlefish::RunnerExitCodes::kCuttlefishConfigurationInitError;
+  }
+  std::string input;
+  CHECK(cuttlefish::ReadAll(cuttlefish::SharedFD::Dup(0), &input) >= 0);
+  // Without its input run_cvd has no config to boot
+  if (input.empty() || boot_result == "none") {
+    return cuttlefish::RunnerExitCodes::kCuttlefishConfigurationInitError;
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(boot_delay_ms));
+  auto exit_code = boot_result == "success"
+                       ? cuttlefish::RunnerExitCodes::kSuccess
+                       : cuttlefish::RunnerExitCodes::kVirtualDeviceBootFailed;
+  CHECK(notification->Write(&exit_code, sizeof(exit_code)) ==
+        sizeof(exit_code));
+  notification->Close();
+  // Like run_cvd, keep running after the boot until stopped
+  pause();
+  return 0;
+}
@@ -0,0 +1,155 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/start/launch_scheduler.h"
+
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "host/commands/run_cvd/runner_defs.h"
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::milliseconds;
+
+class LaunchSchedulerTest : public testing::Test {
+ protected:
+  void TearDown() override {
+    for (auto& runner : runners_) {
+      runner.process.Stop();
+      runner.process.Wait();
+    }
+  }
+
+  RunnerLaunch FakeRunner(const std::string& name, int boot_delay_ms,
+                          const std::string& boot_result = "success",
+                          const std::string& input = "cuttlefish_config") {
+    Command command(android::base::GetExecutableDirectory() +
+                    "/cvd_internal_start_fake_run_cvd");
+    command.AddParameter("-boot_delay_ms=", boot_delay_ms);
+    command.AddParameter("-boot_result=", boot_result);
+    return RunnerLaunch{
+        .name = name,
+        .command = std::move(command),
+        .input = input,
+    };
+  }
+
+  void Launch(std::vector<RunnerLaunch> launches,
+              const LaunchOptions& options) {
+    auto runners = LaunchRunners(std::move(launches), options);
+    ASSERT_TRUE(runners.ok()) << runners.error().Trace();
+    runners_ = std::move(*runners);
+  }
+
+  std::vector<LaunchedRunner> runners_;
+};
+
+TEST_F(LaunchSchedulerTest, StartsWithoutWaitingForBoots) {
+  std::vector<RunnerLaunch> launches;
+  for (int i = 0; i < 4; i++) {
+    launches.push_back(FakeRunner("cvd-" + std::to_string(i + 1), 500));
+  }
+  auto start = std::chrono::steady_clock::now();
+  Launch(std::move(launches), LaunchOptions{});
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(runners_.size(), 4);
+  EXPECT_LT(elapsed, milliseconds(4 * 500));
+  for (const auto& runner : runners_) {
+    EXPECT_TRUE(runner.Booted()) << runner.name;
+    EXPECT_LT(runner.started_at, milliseconds(500)) << runner.name;
+    EXPECT_GE(runner.boot_time, milliseconds(500)) << runner.name;
+  }
+}
+
+TEST_F(LaunchSchedulerTest, LimitsConcurrentBoots) {
+  std::vector<RunnerLaunch> launches;
+  for (int i = 0; i < 4; i++) {
+    launches.push_back(FakeRunner("cvd-" + std::to_string(i + 1), 300));
+  }
+  Launch(std::move(launches), LaunchOptions{.concurrency = 2});
+
+  ASSERT_EQ(runners_.size(), 4);
+  for (const auto& runner : runners_) {
+    EXPECT_TRUE(runner.Booted()) << runner.name;
+  }
+  // The last two wait for one of the first two to boot
+  EXPECT_LT(runners_[1].started_at, milliseconds(300));
+  EXPECT_GE(runners_[2].started_at, milliseconds(300));
+  EXPECT_GE(runners_[3].started_at, milliseconds(300));
+}
+
+TEST_F(LaunchSchedulerTest, StaggersStarts) {
+  std::vector<RunnerLaunch> launches;
+  for (int i = 0; i < 3; i++) {
+    launches.push_back(FakeRunner("cvd-" + std::to_string(i + 1), 0));
+  }
+  Launch(std::move(launches), LaunchOptions{.stagger = milliseconds(200)});
+
+  ASSERT_EQ(runners_.size(), 3);
+  for (std::size_t i = 1; i < runners_.size(); i++) {
+    EXPECT_GE(runners_[i].started_at - runners_[i - 1].started_at,
+              milliseconds(200))
+        << runners_[i].name;
+  }
+}
+
+TEST_F(LaunchSchedulerTest, ReportsEachRunner) {
+  std::vector<RunnerLaunch> launches;
+  launches.push_back(FakeRunner("booted", 100));
+  launches.push_back(FakeRunner("failed", 100, "failure"));
+  launches.push_back(FakeRunner("exited", 100, "none"));
+  launches.push_back(FakeRunner("no_input", 100, "success", ""));
+  Launch(std::move(launches), LaunchOptions{.concurrency = 2});
+
+  ASSERT_EQ(runners_.size(), 4);
+  EXPECT_EQ(runners_[0].boot_result, RunnerExitCodes::kSuccess);
+  EXPECT_EQ(runners_[1].boot_result, RunnerExitCodes::kVirtualDeviceBootFailed);
+  EXPECT_EQ(runners_[2].boot_result, RunnerExitCodes::kPipeIOError);
+  EXPECT_EQ(runners_[3].boot_result, RunnerExitCodes::kPipeIOError);
+}
+
+TEST_F(LaunchSchedulerTest, StopsStartedRunnersOnFailure) {
+  std::vector<RunnerLaunch> launches;
+  launches.push_back(FakeRunner("booting", 60000));
+  // More input than the pipe holds, so writing it waits for the runner
+  launches.push_back(
+      FakeRunner("broken", 0, "no_read", std::string(1 << 20, 'x')));
+  launches.push_back(FakeRunner("queued", 0));
+
+  auto runners = LaunchRunners(std::move(launches), LaunchOptions{});
+  ASSERT_FALSE(runners.ok());
+  // Failed with EPIPE, without SIGPIPE killing the launcher
+  EXPECT_NE(runners.error().Message().find("broken"), std::string::npos)
+      << runners.error().Trace();
+  EXPECT_NE(runners.error().Message().find(strerror(EPIPE)), std::string::npos)
+      << runners.error().Trace();
+  // Both started runners were waited for, and the last one never started
+  EXPECT_EQ(waitpid(-1, nullptr, WNOHANG), -1);
+  EXPECT_EQ(errno, ECHILD);
+}
+
+}  // namespace
+}  // namespace cuttlefish
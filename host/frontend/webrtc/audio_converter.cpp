@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include <android-base/logging.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace cuttlefish {
+namespace {
+
+// Zero crossings of the sinc on each side of the output position at the
+// lowest of the two rates, trades filter sharpness for cpu time.
+constexpr int kZeroCrossings = 8;
+// Fraction of the lower Nyquist frequency that is let through.
+constexpr double kPassband = 0.92;
+// Resampler taps are padded to a multiple of this many floats.
+constexpr size_t kVectorWidth = 8;
+// Frames decoded at a time on the resampling path, small enough for the
+// planar buffers to stay in L1.
+constexpr size_t kChunkFrames = 256;
+
+template <PcmFormat F>
+struct Traits;
+
+// kShift moves a sample to the top of an int32, kFromS16 scales a value in
+// the 16 bit range to the format.
+template <>
+struct Traits<PcmFormat::kS8> {
+  using Sample = int8_t;
+  static constexpr int kShift = 24;
+  static constexpr float kFromS16 = 1.0f / 256;
+};
+template <>
+struct Traits<PcmFormat::kS16> {
+  using Sample = int16_t;
+  static constexpr int kShift = 16;
+  static constexpr float kFromS16 = 1.0f;
+};
+template <>
+struct Traits<PcmFormat::kS24> {
+  using Sample = int32_t;
+  static constexpr int kShift = 8;
+  static constexpr float kFromS16 = 256.0f;
+};
+template <>
+struct Traits<PcmFormat::kS32> {
+  using Sample = int32_t;
+  static constexpr int kShift = 0;
+  static constexpr float kFromS16 = 65536.0f;
+};
+
+// Loads a sample into the top bits of an int32. Ignores the padding byte of
+// S24 samples, which guests don't always sign extend.
+template <PcmFormat F>
+int32_t Load(const uint8_t* src) {
+  typename Traits<F>::Sample sample;
+  memcpy(&sample, src, sizeof(sample));
+  return static_cast<int32_t>(static_cast<uint32_t>(sample)
+                              << Traits<F>::kShift);
+}
+
+template <PcmFormat F>
+void Store(int32_t value, uint8_t* dst) {
+  auto sample =
+      static_cast<typename Traits<F>::Sample>(value >> Traits<F>::kShift);
+  memcpy(dst, &sample, sizeof(sample));
+}
+
+// Vector versions of Load and Store, 8 samples at a time.
+#if defined(__SSE2__)
+constexpr bool kHasSimd = true;
+
+template <PcmFormat F>
+void Load8(const uint8_t* src, __m128i& lo, __m128i& hi) {
+  const auto zero = _mm_setzero_si128();
+  if constexpr (F == PcmFormat::kS8) {
+    auto bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+    auto words = _mm_unpacklo_epi8(zero, bytes);
+    lo = _mm_unpacklo_epi16(zero, words);
+    hi = _mm_unpackhi_epi16(zero, words);
+  } else if constexpr (F == PcmFormat::kS16) {
+    auto words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    lo = _mm_unpacklo_epi16(zero, words);
+    hi = _mm_unpackhi_epi16(zero, words);
+  } else {
+    lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    if constexpr (F == PcmFormat::kS24) {
+      lo = _mm_slli_epi32(lo, 8);
+      hi = _mm_slli_epi32(hi, 8);
+    }
+  }
+}
+
+template <PcmFormat F>
+void Store8(__m128i lo, __m128i hi, uint8_t* dst) {
+  if constexpr (F == PcmFormat::kS8) {
+    auto words =
+        _mm_packs_epi32(_mm_srai_epi32(lo, 24), _mm_srai_epi32(hi, 24));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst),
+                     _mm_packs_epi16(words, words));
+  } else if constexpr (F == PcmFormat::kS16) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst),
+        _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16)));
+  } else {
+    if constexpr (F == PcmFormat::kS24) {
+      lo = _mm_srai_epi32(lo, 8);
+      hi = _mm_srai_epi32(hi, 8);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), hi);
+  }
+}
+
+template <PcmFormat From, PcmFormat To>
+void Convert8(const uint8_t* src, uint8_t* dst) {
+  __m128i lo, hi;
+  Load8<From>(src, lo, hi);
+  Store8<To>(lo, hi, dst);
+}
+#elif defined(__ARM_NEON)
+constexpr bool kHasSimd = true;
+
+template <PcmFormat F>
+void Load8(const uint8_t* src, int32x4_t& lo, int32x4_t& hi) {
+  if constexpr (F == PcmFormat::kS8) {
+    auto words = vshll_n_s8(vld1_s8(reinterpret_cast<const int8_t*>(src)), 8);
+    lo = vshll_n_s16(vget_low_s16(words), 16);
+    hi = vshll_n_s16(vget_high_s16(words), 16);
+  } else if constexpr (F == PcmFormat::kS16) {
+    auto words = vld1q_s16(reinterpret_cast<const int16_t*>(src));
+    lo = vshll_n_s16(vget_low_s16(words), 16);
+    hi = vshll_n_s16(vget_high_s16(words), 16);
+  } else {
+    lo = vld1q_s32(reinterpret_cast<const int32_t*>(src));
+    hi = vld1q_s32(reinterpret_cast<const int32_t*>(src) + 4);
+    if constexpr (F == PcmFormat::kS24) {
+      lo = vshlq_n_s32(lo, 8);
+      hi = vshlq_n_s32(hi, 8);
+    }
+  }
+}
+
+template <PcmFormat F>
+void Store8(int32x4_t lo, int32x4_t hi, uint8_t* dst) {
+  if constexpr (F == PcmFormat::kS8) {
+    auto words = vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16));
+    vst1_s8(reinterpret_cast<int8_t*>(dst), vshrn_n_s16(words, 8));
+  } else if constexpr (F == PcmFormat::kS16) {
+    vst1q_s16(reinterpret_cast<int16_t*>(dst),
+              vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+  } else {
+    if constexpr (F == PcmFormat::kS24) {
+      lo = vshrq_n_s32(lo, 8);
+      hi = vshrq_n_s32(hi, 8);
+    }
+    vst1q_s32(reinterpret_cast<int32_t*>(dst), lo);
+    vst1q_s32(reinterpret_cast<int32_t*>(dst) + 4, hi);
+  }
+}
+
+template <PcmFormat From, PcmFormat To>
+void Convert8(const uint8_t* src, uint8_t* dst) {
+  int32x4_t lo, hi;
+  Load8<From>(src, lo, hi);
+  Store8<To>(lo, hi, dst);
+}
+#else
+constexpr bool kHasSimd = false;
+
+template <PcmFormat From, PcmFormat To>
+void Convert8(const uint8_t*, uint8_t*) {}
+#endif
+
+template <PcmFormat From, PcmFormat To>
+void ConvertSamples(const uint8_t* src, uint8_t* dst, size_t samples) {
+  constexpr size_t kIn = sizeof(typename Traits<From>::Sample);
+  constexpr size_t kOut = sizeof(typename Traits<To>::Sample);
+  size_t i = 0;
+  if constexpr (kHasSimd) {
+    for (; i + 8 <= samples; i += 8) {
+      Convert8<From, To>(src + i * kIn, dst + i * kOut);
+    }
+  }
+  for (; i < samples; i++) {
+    Store<To>(Load<From>(src + i * kIn), dst + i * kOut);
+  }
+}
+
+template <PcmFormat From>
+void ConvertSamples(const uint8_t* src, uint8_t* dst, PcmFormat to,
+                    size_t samples) {
+  switch (to) {
+    case PcmFormat::kS8:
+      return ConvertSamples<From, PcmFormat::kS8>(src, dst, samples);
+    case PcmFormat::kS16:
+      return ConvertSamples<From, PcmFormat::kS16>(src, dst, samples);
+    case PcmFormat::kS24:
+      return ConvertSamples<From, PcmFormat::kS24>(src, dst, samples);
+    case PcmFormat::kS32:
+      return ConvertSamples<From, PcmFormat::kS32>(src, dst, samples);
+  }
+}
+
+// Deinterleaves samples into float planes in the 16 bit range.
+template <PcmFormat F>
+void Decode(const uint8_t* src, int channels, size_t frames,
+            float* const* planes) {
+  constexpr size_t kSize = sizeof(typename Traits<F>::Sample);
+  constexpr float kScale = 1.0f / 65536;
+  for (size_t i = 0; i < frames; i++) {
+    for (int c = 0; c < channels; c++) {
+      planes[c][i] = Load<F>(src + (i * channels + c) * kSize) * kScale;
+    }
+  }
+}
+
+void Decode(const uint8_t* src, PcmFormat format, int channels, size_t frames,
+            float* const* planes) {
+  switch (format) {
+    case PcmFormat::kS8:
+      return Decode<PcmFormat::kS8>(src, channels, frames, planes);
+    case PcmFormat::kS16:
+      return Decode<PcmFormat::kS16>(src, channels, frames, planes);
+    case PcmFormat::kS24:
+      return Decode<PcmFormat::kS24>(src, channels, frames, planes);
+    case PcmFormat::kS32:
+      return Decode<PcmFormat::kS32>(src, channels, frames, planes);
+  }
+}
+
+// Interleaves float planes in the 16 bit range, rounding and clipping.
+template <PcmFormat F>
+void Encode(const float* const* planes, int channels, size_t frames,
+            uint8_t* dst) {
+  using Sample = typename Traits<F>::Sample;
+  constexpr int64_t kMax = (int64_t{1} << (31 - Traits<F>::kShift)) - 1;
+  constexpr int64_t kMin = -kMax - 1;
+  for (size_t i = 0; i < frames; i++) {
+    for (int c = 0; c < channels; c++) {
+      int64_t value = std::llrint(planes[c][i] * Traits<F>::kFromS16);
+      auto sample = static_cast<Sample>(std::clamp(value, kMin, kMax));
+      memcpy(dst + (i * channels + c) * sizeof(Sample), &sample,
+             sizeof(sample));
+    }
+  }
+}
+
+void Encode(const float* const* planes, int channels, size_t frames,
+            PcmFormat format, uint8_t* dst) {
+  switch (format) {
+    case PcmFormat::kS8:
+      return Encode<PcmFormat::kS8>(planes, channels, frames, dst);
+    case PcmFormat::kS16:
+      return Encode<PcmFormat::kS16>(planes, channels, frames, dst);
+    case PcmFormat::kS24:
+      return Encode<PcmFormat::kS24>(planes, channels, frames, dst);
+    case PcmFormat::kS32:
+      return Encode<PcmFormat::kS32>(planes, channels, frames, dst);
+  }
+}
+
+// Dot products of two float arrays whose length is a multiple of
+// kVectorWidth.
+float DotProductScalar(const float* a, const float* b, size_t len) {
+  float sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+float HorizontalSum(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+float DotProductSse(const float* a, const float* b, size_t len) {
+  auto sum0 = _mm_setzero_ps();
+  auto sum1 = _mm_setzero_ps();
+  for (size_t i = 0; i < len; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+  }
+  return HorizontalSum(_mm_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx2,fma"))) float DotProductAvx2(const float* a,
+                                                         const float* b,
+                                                         size_t len) {
+  auto sum = _mm256_setzero_ps();
+  for (size_t i = 0; i < len; i += 8) {
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+  }
+  return HorizontalSum(_mm_add_ps(_mm256_castps256_ps128(sum),
+                                  _mm256_extractf128_ps(sum, 1)));
+}
+#elif defined(__aarch64__)
+float DotProductNeon(const float* a, const float* b, size_t len) {
+  auto sum0 = vdupq_n_f32(0);
+  auto sum1 = vdupq_n_f32(0);
+  for (size_t i = 0; i < len; i += 8) {
+    sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+    sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  return vaddvq_f32(vaddq_f32(sum0, sum1));
+}
+#endif
+
+double Sinc(double x) {
+  return x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+}
+
+// Blackman window over [-1, 1].
+double Window(double x) {
+  return 0.42 + 0.5 * std::cos(M_PI * x) + 0.08 * std::cos(2 * M_PI * x);
+}
+
+}  // namespace
+
+int BytesPerSample(PcmFormat format) {
+  switch (format) {
+    case PcmFormat::kS8:
+      return 1;
+    case PcmFormat::kS16:
+      return 2;
+    case PcmFormat::kS24:
+    case PcmFormat::kS32:
+      return 4;
+  }
+  return -1;
+}
+
+void ConvertPcm(const uint8_t* src, PcmFormat src_format, uint8_t* dst,
+                PcmFormat dst_format, size_t samples) {
+  if (src_format == dst_format) {
+    memcpy(dst, src, samples * BytesPerSample(src_format));
+    return;
+  }
+  switch (src_format) {
+    case PcmFormat::kS8:
+      return ConvertSamples<PcmFormat::kS8>(src, dst, dst_format, samples);
+    case PcmFormat::kS16:
+      return ConvertSamples<PcmFormat::kS16>(src, dst, dst_format, samples);
+    case PcmFormat::kS24:
+      return ConvertSamples<PcmFormat::kS24>(src, dst, dst_format, samples);
+    case PcmFormat::kS32:
+      return ConvertSamples<PcmFormat::kS32>(src, dst, dst_format, samples);
+  }
+}
+
+Resampler::Resampler(int in_rate, int out_rate, int channels)
+    : channels_(channels), dot_product_(DotProductScalar) {
+  CHECK(in_rate > 0 && out_rate > 0) << "Invalid sample rates: " << in_rate
+                                     << " -> " << out_rate;
+  auto divisor = std::gcd(in_rate, out_rate);
+  phases_ = out_rate / divisor;
+  step_ = in_rate / divisor;
+
+  // Relative to the input rate, so downsampling widens the filter.
+  double cutoff = kPassband * std::min(1.0, (double)out_rate / in_rate);
+  half_taps_ = std::ceil(kZeroCrossings / cutoff);
+  taps_ = (2 * half_taps_ + kVectorWidth - 1) / kVectorWidth * kVectorWidth;
+  coefficients_.resize(phases_ * taps_, 0.0f);
+  for (size_t phase = 0; phase < phases_; phase++) {
+    auto coefficients = &coefficients_[phase * taps_];
+    double sum = 0;
+    for (size_t tap = 0; tap < 2 * half_taps_; tap++) {
+      // Distance in input frames between the tap and the output frame
+      double x = (double)tap + 1 - half_taps_ - (double)phase / phases_;
+      double value = cutoff * Sinc(cutoff * x) * Window(x / half_taps_);
+      coefficients[tap] = value;
+      sum += value;
+    }
+    // Unity gain at DC for every phase
+    for (size_t tap = 0; tap < 2 * half_taps_; tap++) {
+      coefficients[tap] /= sum;
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  dot_product_ = DotProductSse;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    dot_product_ = DotProductAvx2;
+  }
+#elif defined(__aarch64__)
+  dot_product_ = DotProductNeon;
+#endif
+
+  // The first output frame lines up with the first input frame, the taps
+  // before it read silence.
+  frames_ = half_taps_ - 1;
+  position_ = frames_;
+  phase_ = 0;
+  input_.resize(channels_, std::vector<float>(frames_, 0.0f));
+}
+
+float* Resampler::InputBuffer(int channel, size_t frames) {
+  auto& input = input_[channel];
+  if (input.size() < frames_ + frames) {
+    input.resize(frames_ + frames);
+  }
+  return input.data() + frames_;
+}
+
+void Resampler::Commit(size_t frames) { frames_ += frames; }
+
+size_t Resampler::Read(float* const* out, size_t max_frames) {
+  size_t produced = 0;
+  while (produced < max_frames &&
+         position_ + 1 - half_taps_ + taps_ <= frames_) {
+    auto coefficients = &coefficients_[phase_ * taps_];
+    auto first = position_ + 1 - half_taps_;
+    for (int c = 0; c < channels_; c++) {
+      out[c][produced] = dot_product_(&input_[c][first], coefficients, taps_);
+    }
+    produced++;
+    phase_ += step_;
+    position_ += phase_ / phases_;
+    phase_ %= phases_;
+  }
+  // Drop the frames no future output needs
+  auto consumed = std::min(position_ + 1 - half_taps_, frames_);
+  if (consumed > 0) {
+    for (auto& input : input_) {
+      std::copy(input.begin() + consumed, input.begin() + frames_,
+                input.begin());
+    }
+    frames_ -= consumed;
+    position_ -= consumed;
+  }
+  return produced;
+}
+
+AudioConverter::AudioConverter(PcmFormat in_format, int in_rate,
+                               PcmFormat out_format, int out_rate,
+                               int channels)
+    : in_format_(in_format),
+      out_format_(out_format),
+      channels_(channels),
+      in_frame_size_(BytesPerSample(in_format) * channels),
+      out_frame_size_(BytesPerSample(out_format) * channels) {
+  if (in_rate != out_rate) {
+    resampler_ = std::make_unique<Resampler>(in_rate, out_rate, channels);
+    planes_.resize(kChunkFrames * channels);
+  }
+}
+
+void AudioConverter::Write(const volatile uint8_t* data, size_t len) {
+  // The shared memory is only read once, by the conversion itself.
+  auto src = const_cast<const uint8_t*>(data);
+  if (!partial_frame_.empty()) {
+    auto missing = std::min(len, in_frame_size_ - partial_frame_.size());
+    partial_frame_.insert(partial_frame_.end(), src, src + missing);
+    src += missing;
+    len -= missing;
+    if (partial_frame_.size() < in_frame_size_) {
+      return;
+    }
+    Convert(partial_frame_.data(), 1);
+    partial_frame_.clear();
+  }
+  auto frames = len / in_frame_size_;
+  Convert(src, frames);
+  partial_frame_.assign(src + frames * in_frame_size_, src + len);
+}
+
+size_t AudioConverter::FramesAvailable() const {
+  return (output_end_ - output_begin_) / out_frame_size_;
+}
+
+const uint8_t* AudioConverter::Data() const {
+  return output_.data() + output_begin_;
+}
+
+void AudioConverter::Consume(size_t frames) {
+  output_begin_ += std::min(frames, FramesAvailable()) * out_frame_size_;
+  if (output_begin_ == output_end_) {
+    output_begin_ = output_end_ = 0;
+  }
+}
+
+size_t AudioConverter::Read(uint8_t* dst, size_t max_frames) {
+  auto frames = std::min(max_frames, FramesAvailable());
+  memcpy(dst, Data(), frames * out_frame_size_);
+  Consume(frames);
+  return frames;
+}
+
+void AudioConverter::Convert(const uint8_t* data, size_t frames) {
+  if (!resampler_) {
+    ConvertPcm(data, in_format_, OutputBuffer(frames), out_format_,
+               frames * channels_);
+    output_end_ += frames * out_frame_size_;
+    return;
+  }
+  std::vector<float*> planes(channels_);
+  for (size_t done = 0; done < frames;) {
+    auto chunk = std::min(kChunkFrames, frames - done);
+    for (int c = 0; c < channels_; c++) {
+      planes[c] = resampler_->InputBuffer(c, chunk);
+    }
+    Decode(data + done * in_frame_size_, in_format_, channels_, chunk,
+           planes.data());
+    resampler_->Commit(chunk);
+    done += chunk;
+
+    for (int c = 0; c < channels_; c++) {
+      planes[c] = &planes_[c * kChunkFrames];
+    }
+    size_t produced;
+    do {
+      produced = resampler_->Read(planes.data(), kChunkFrames);
+      Encode(planes.data(), channels_, produced, out_format_,
+             OutputBuffer(produced));
+      output_end_ += produced * out_frame_size_;
+    } while (produced == kChunkFrames);
+  }
+}
+
+uint8_t* AudioConverter::OutputBuffer(size_t frames) {
+  auto needed = frames * out_frame_size_;
+  if (output_end_ + needed > output_.size() && output_begin_ > 0) {
+    std::copy(output_.begin() + output_begin_, output_.begin() + output_end_,
+              output_.begin());
+    output_end_ -= output_begin_;
+    output_begin_ = 0;
+  }
+  if (output_end_ + needed > output_.size()) {
+    output_.resize(output_end_ + needed);
+  }
+  return output_.data() + output_end_;
+}
+
+}  // namespace cuttlefish
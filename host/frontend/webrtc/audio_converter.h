@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace cuttlefish {
+
+// Little endian signed PCM sample formats exchanged with the guest.
+enum class PcmFormat {
+  kS8,
+  kS16,
+  // 24 significant bits in the low part of a 32 bit container.
+  kS24,
+  kS32,
+};
+
+int BytesPerSample(PcmFormat format);
+
+// Converts `samples` interleaved samples from one format to another without
+// changing the rate.
+void ConvertPcm(const uint8_t* src, PcmFormat src_format, uint8_t* dst,
+                PcmFormat dst_format, size_t samples);
+
+// Polyphase windowed sinc resampler working on planar float samples. The
+// conversion ratio is kept as an exact fraction so no drift accumulates.
+class Resampler {
+ public:
+  Resampler(int in_rate, int out_rate, int channels);
+
+  // Returns a pointer to room for `frames` more input frames of `channel`.
+  // Every channel must be filled before calling Commit().
+  float* InputBuffer(int channel, size_t frames);
+  void Commit(size_t frames);
+
+  // Writes as many output frames as the input allows, up to `max_frames`, to
+  // the `channels` planes in `out`. Returns the number of frames written.
+  size_t Read(float* const* out, size_t max_frames);
+
+ private:
+  using DotProduct = float (*)(const float*, const float*, size_t);
+
+  int channels_;
+  // Output frames are produced at input positions advancing by step_ /
+  // phases_ input frames.
+  size_t phases_;
+  size_t step_;
+  // Taps on each side of the output position.
+  size_t half_taps_;
+  // Taps per phase, padded to a multiple of the vector width.
+  size_t taps_;
+  std::vector<float> coefficients_;
+  DotProduct dot_product_;
+
+  std::vector<std::vector<float>> input_;
+  size_t frames_;
+  // Input frame preceding the next output frame and its phase.
+  size_t position_;
+  size_t phase_;
+};
+
+// Converts a stream of interleaved PCM data between formats and rates.
+// Input may be written in arbitrarily sized pieces, converted frames are kept
+// until read.
+class AudioConverter {
+ public:
+  AudioConverter(PcmFormat in_format, int in_rate, PcmFormat out_format,
+                 int out_rate, int channels);
+
+  // Consumes and converts all of `data`, keeping any trailing partial frame
+  // for the next call.
+  void Write(const volatile uint8_t* data, size_t len);
+
+  // Number of converted frames waiting to be read.
+  size_t FramesAvailable() const;
+  // The converted frames, valid until the next call to a non-const method.
+  const uint8_t* Data() const;
+  void Consume(size_t frames);
+
+  // Copies up to `max_frames` converted frames to `dst`, returns the number
+  // of frames copied.
+  size_t Read(uint8_t* dst, size_t max_frames);
+
+ private:
+  void Convert(const uint8_t* data, size_t frames);
+  uint8_t* OutputBuffer(size_t frames);
+
+  PcmFormat in_format_;
+  PcmFormat out_format_;
+  int channels_;
+  size_t in_frame_size_;
+  size_t out_frame_size_;
+  std::unique_ptr<Resampler> resampler_;
+
+  std::vector<uint8_t> partial_frame_;
+  std::vector<float> planes_;
+  std::vector<uint8_t> output_;
+  size_t output_begin_ = 0;
+  size_t output_end_ = 0;
+};
+
+}  // namespace cuttlefish
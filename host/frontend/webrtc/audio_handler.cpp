@@ -16,8 +16,11 @@
 
 #include "host/frontend/webrtc/audio_handler.h"
 
+#include <string.h>
+
 #include <algorithm>
 #include <chrono>
+#include <optional>
 
 #include <android-base/logging.h>
 #include <rtc_base/time_utils.h>
@@ -25,6 +28,11 @@
 namespace cuttlefish {
 namespace {
 
+// The rate and format webrtc works with, other streams are converted.
+constexpr int kWebrtcSampleRate = 48000;
+constexpr PcmFormat kWebrtcFormat = PcmFormat::kS16;
+constexpr int kWebrtcFramesPer10ms = kWebrtcSampleRate / 100;
+
 const virtio_snd_jack_info JACKS[] = {};
 constexpr uint32_t NUM_JACKS = sizeof(JACKS) / sizeof(JACKS[0]);
 
@@ -239,6 +247,21 @@ int BitsPerSample(uint8_t virtio_format) {
   }
 }
 
+std::optional<PcmFormat> ToPcmFormat(uint8_t virtio_format) {
+  switch (virtio_format) {
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S8:
+      return PcmFormat::kS8;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+      return PcmFormat::kS16;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+      return PcmFormat::kS24;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+      return PcmFormat::kS32;
+    default:
+      return std::nullopt;
+  }
+}
+
 int SampleRate(uint8_t virtio_rate) {
   switch (virtio_rate) {
     case (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_5512:
@@ -275,6 +298,12 @@ int SampleRate(uint8_t virtio_rate) {
   }
 }
 
+// Whether `bit` is set in a virtio-snd formats or rates mask. Bits past the
+// mask's width are never set, and shifting by them would be undefined.
+bool AdvertisesBit(uint64_t mask, uint8_t bit) {
+  return bit < 64 && (mask & (((uint64_t)1) << bit));
+}
+
 }  // namespace
 
 AudioHandler::AudioHandler(
@@ -333,19 +362,42 @@ void AudioHandler::SetStreamParameters(StreamSetParamsCommand& cmd) {
   auto bits_per_sample = BitsPerSample(cmd.format());
   auto sample_rate = SampleRate(cmd.rate());
   auto channels = cmd.channels();
-  if (bits_per_sample < 0 || sample_rate < 0 ||
+  auto format = ToPcmFormat(cmd.format());
+  // The guest picks format and rate, so they are validated before they are
+  // used as shift amounts below
+  if (bits_per_sample < 0 || sample_rate < 0 || !format ||
       channels < stream_info.channels_min ||
       channels > stream_info.channels_max) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
+  // Only what the stream advertises can be converted
+  if (!AdvertisesBit(stream_info.formats.as_uint64_t(), cmd.format()) ||
+      !AdvertisesBit(stream_info.rates.as_uint64_t(), cmd.rate())) {
+    cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
+    return;
+  }
   {
-    std::lock_guard<std::mutex> lock(stream_descs_[cmd.stream_id()].mtx);
-    stream_descs_[cmd.stream_id()].bits_per_sample = bits_per_sample;
-    stream_descs_[cmd.stream_id()].sample_rate = sample_rate;
-    stream_descs_[cmd.stream_id()].channels = channels;
-    auto len10ms = (channels * (sample_rate / 100) * bits_per_sample) / 8;
-    stream_descs_[cmd.stream_id()].buffer.Reset(len10ms);
+    auto& stream_desc = stream_descs_[cmd.stream_id()];
+    std::lock_guard<std::mutex> lock(stream_desc.mtx);
+    stream_desc.bits_per_sample = bits_per_sample;
+    stream_desc.sample_rate = sample_rate;
+    stream_desc.channels = channels;
+    if (*format == kWebrtcFormat && sample_rate == kWebrtcSampleRate) {
+      // Passed through without copies whenever possible
+      stream_desc.converter.reset();
+      auto len10ms = (channels * (sample_rate / 100) * bits_per_sample) / 8;
+      stream_desc.buffer.Reset(len10ms);
+    } else if (IsCapture(cmd.stream_id())) {
+      stream_desc.converter = std::make_unique<AudioConverter>(
+          kWebrtcFormat, kWebrtcSampleRate, *format, sample_rate, channels);
+      stream_desc.buffer.Reset(channels * kWebrtcFramesPer10ms *
+                               BytesPerSample(kWebrtcFormat));
+    } else {
+      stream_desc.converter = std::make_unique<AudioConverter>(
+          *format, sample_rate, kWebrtcFormat, kWebrtcSampleRate, channels);
+      stream_desc.buffer.Reset(0);
+    }
   }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
@@ -424,6 +476,11 @@ void AudioHandler::OnPlaybackBuffer(TxBuffer buffer) {
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
       return;
     }
+    if (stream_desc.converter) {
+      ConvertPlayback(stream_desc, buffer);
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+      return;
+    }
     // Webrtc will silently ignore any buffer with a length different than 10ms,
     // so we must split any buffer bigger than that and temporarily store any
     // remaining frames that are less than that size.
@@ -484,6 +541,11 @@ void AudioHandler::OnCaptureBuffer(RxBuffer buffer) {
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
       return;
     }
+    if (stream_desc.converter) {
+      ConvertCapture(stream_desc, buffer);
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+      return;
+    }
     const auto bytes_per_sample = stream_desc.bits_per_sample / 8;
     const auto samples_per_channel = stream_desc.sample_rate / 100;
     const auto bytes_per_request =
@@ -552,6 +614,71 @@ void AudioHandler::OnCaptureBuffer(RxBuffer buffer) {
   buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
 }
 
+void AudioHandler::ConvertPlayback(StreamDesc& stream_desc,
+                                   const TxBuffer& buffer) {
+  auto& converter = *stream_desc.converter;
+  // Conversion reads straight from the shared memory, only whole 10ms chunks
+  // of converted audio are kept around.
+  converter.Write(buffer.get(), buffer.len());
+  auto chunks = converter.FramesAvailable() / kWebrtcFramesPer10ms;
+  if (chunks == 0) {
+    return;
+  }
+  // The last chunk gets the current time
+  auto timestamp = rtc::TimeMillis() - (chunks - 1) * 10;
+  for (size_t i = 0; i < chunks; i++) {
+    auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
+        converter.Data(), BytesPerSample(kWebrtcFormat) * 8,
+        kWebrtcSampleRate, stream_desc.channels, kWebrtcFramesPer10ms);
+    audio_sink_->OnFrame(audio_frame_buffer, timestamp);
+    converter.Consume(kWebrtcFramesPer10ms);
+    timestamp += 10;
+  }
+}
+
+void AudioHandler::ConvertCapture(StreamDesc& stream_desc, RxBuffer& buffer) {
+  auto& converter = *stream_desc.converter;
+  auto& holding_buffer = stream_desc.buffer;
+  const size_t frame_size =
+      (stream_desc.bits_per_sample / 8) * stream_desc.channels;
+  auto rx_buffer = const_cast<uint8_t*>(buffer.get());
+  size_t bytes_read = 0;
+  while (buffer.len() - bytes_read >= frame_size) {
+    if (converter.FramesAvailable() == 0) {
+      bool muted = false;
+      auto res = audio_source_->GetMoreAudioData(
+          holding_buffer.data(), BytesPerSample(kWebrtcFormat),
+          kWebrtcFramesPer10ms, stream_desc.channels, kWebrtcSampleRate,
+          muted);
+      if (res < 0) {
+        // This is likely a recoverable error, log the error but don't let the
+        // VMM know about it so that it doesn't crash.
+        LOG(ERROR) << "Failed to receive audio data from client";
+        break;
+      }
+      if (muted) {
+        // Silence goes through the converter too so that the resampler's
+        // history stays continuous.
+        memset(holding_buffer.data(), 0, holding_buffer.buffer.size());
+        res = kWebrtcFramesPer10ms;
+      }
+      if (res == 0) {
+        break;
+      }
+      converter.Write(holding_buffer.data(),
+                      res * BytesPerSample(kWebrtcFormat) *
+                          stream_desc.channels);
+    }
+    auto frames =
+        converter.Read(rx_buffer + bytes_read,
+                       (buffer.len() - bytes_read) / frame_size);
+    bytes_read += frames * frame_size;
+  }
+  if (bytes_read < buffer.len()) {
+    memset(rx_buffer + bytes_read, 0, buffer.len() - bytes_read);
+  }
+}
+
 void AudioHandler::HoldingBuffer::Reset(size_t size) {
   buffer.resize(size);
   count = 0;
@@ -21,6 +21,7 @@
 #include <thread>
 #include <vector>
 
+#include "host/frontend/webrtc/audio_converter.h"
 #include "host/frontend/webrtc/libdevice/audio_sink.h"
 #include "host/frontend/webrtc/libcommon/audio_source.h"
 #include "host/libs/audio_connector/server.h"
@@ -49,6 +50,10 @@ class AudioHandler : public AudioServerExecutor {
     int channels = -1;
     bool active = false;
     HoldingBuffer buffer;
+    // Set when the guest's format or rate differ from the 48kHz 16 bit audio
+    // webrtc works with. Streams using a converter only pass whole 10ms
+    // chunks at that rate to and from webrtc, held in `buffer` for capture.
+    std::unique_ptr<AudioConverter> converter;
   };
 
  public:
@@ -74,6 +79,8 @@ class AudioHandler : public AudioServerExecutor {
 
  private:
   [[noreturn]] void Loop();
+  void ConvertPlayback(StreamDesc& stream_desc, const TxBuffer& buffer);
+  void ConvertCapture(StreamDesc& stream_desc, RxBuffer& buffer);
 
   std::shared_ptr<webrtc_streaming::AudioSink> audio_sink_;
   std::unique_ptr<AudioServer> audio_server_;
@@ -42,57 +42,10 @@
 #include "host/libs/config/cuttlefish_config.h"
 
 DECLARE_bool(write_virtio_input);
+DECLARE_int32(input_coalescing_ms);
 
 namespace cuttlefish {
 
-// TODO (b/147511234): de-dup this from vnc server and here
-struct virtio_input_event {
-  uint16_t type;
-  uint16_t code;
-  int32_t value;
-};
-
-struct multitouch_slot {
-  int32_t id;
-  int32_t slot;
-  int32_t x;
-  int32_t y;
-};
-
-struct InputEventBuffer {
-  virtual ~InputEventBuffer() = default;
-  virtual void AddEvent(uint16_t type, uint16_t code, int32_t value) = 0;
-  virtual size_t size() const = 0;
-  virtual const void *data() const = 0;
-};
-
-template <typename T>
-struct InputEventBufferImpl : public InputEventBuffer {
-  InputEventBufferImpl() {
-    buffer_.reserve(6);  // 6 is usually enough
-  }
-  void AddEvent(uint16_t type, uint16_t code, int32_t value) override {
-    buffer_.push_back({.type = type, .code = code, .value = value});
-  }
-  T *data() { return buffer_.data(); }
-  const void *data() const override { return buffer_.data(); }
-  std::size_t size() const override { return buffer_.size() * sizeof(T); }
-
- private:
-  std::vector<T> buffer_;
-};
-
-// TODO: we could add an arg here to specify whether we want the multitouch buffer?
-std::unique_ptr<InputEventBuffer> GetEventBuffer() {
-  if (FLAGS_write_virtio_input) {
-    return std::unique_ptr<InputEventBuffer>(
-        new InputEventBufferImpl<virtio_input_event>());
-  } else {
-    return std::unique_ptr<InputEventBuffer>(
-        new InputEventBufferImpl<input_event>());
-  }
-}
-
 /**
  * connection observer implementation for regular android mode.
  * i.e. when it is not in the confirmation UI mode (or TEE),
@@ -108,13 +61,15 @@ class ConnectionObserverImpl
           commands_to_custom_action_servers,
       std::weak_ptr<DisplayHandler> display_handler,
       CameraController *camera_controller,
-      cuttlefish::confui::HostVirtualInput &confui_input)
+      cuttlefish::confui::HostVirtualInput &confui_input,
+      InputEventCoalescer &input_coalescer)
       : input_sockets_(input_sockets),
         kernel_log_events_handler_(kernel_log_events_handler),
         commands_to_custom_action_servers_(commands_to_custom_action_servers),
         weak_display_handler_(display_handler),
         camera_controller_(camera_controller),
-        confui_input_(confui_input) {}
+        confui_input_(confui_input),
+        input_coalescer_(input_coalescer) {}
   virtual ~ConnectionObserverImpl() {
     auto display_handler = weak_display_handler_.lock();
     if (kernel_log_subscription_id_ != -1) {
@@ -151,34 +106,27 @@ class ConnectionObserverImpl
       }
       return;
     }
-    auto buffer = GetEventBuffer();
-    if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
-      return;
-    }
-    buffer->AddEvent(EV_ABS, ABS_X, x);
-    buffer->AddEvent(EV_ABS, ABS_Y, y);
-    buffer->AddEvent(EV_KEY, BTN_TOUCH, down);
-    buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
-  }
-
-  void OnMultiTouchEvent(const std::string &display_label, Json::Value id,
-                         Json::Value slot, Json::Value x, Json::Value y,
-                         bool down, int size) {
-    auto buffer = GetEventBuffer();
-    if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
-      return;
-    }
-
-    for (int i = 0; i < size; i++) {
-      auto this_slot = slot[i].asInt();
-      auto this_id = id[i].asInt();
-      auto this_x = x[i].asInt();
-      auto this_y = y[i].asInt();
+    input_coalescer_.Submit(input_sockets_.GetTouchClientByLabel(display_label),
+                            {
+                                {EV_ABS, ABS_X, x},
+                                {EV_ABS, ABS_Y, y},
+                                {EV_KEY, BTN_TOUCH, down},
+                                {EV_SYN, SYN_REPORT, 0},
+                            });
+  }
+
+  void OnMultiTouchEvent(
+      const std::string &display_label,
+      const std::vector<cuttlefish::webrtc_streaming::TouchContact> &contacts,
+      bool down) override {
+    std::vector<InputEvent> frame;
+    frame.reserve(contacts.size() * 7 + 2);
+
+    for (const auto &contact : contacts) {
+      auto this_slot = contact.slot;
+      auto this_id = contact.id;
+      auto this_x = contact.x;
+      auto this_y = contact.y;
 
       if (confui_input_.IsConfUiActive()) {
         if (down) {
@@ -187,34 +135,37 @@ class ConnectionObserverImpl
         continue;
       }
 
-      buffer->AddEvent(EV_ABS, ABS_MT_SLOT, this_slot);
+      frame.push_back({EV_ABS, ABS_MT_SLOT, this_slot});
       if (down) {
         bool is_new = active_touch_slots_.insert(this_slot).second;
         if (is_new) {
-          buffer->AddEvent(EV_ABS, ABS_MT_TRACKING_ID, this_id);
+          frame.push_back({EV_ABS, ABS_MT_TRACKING_ID, this_id});
           if (active_touch_slots_.size() == 1) {
-            buffer->AddEvent(EV_KEY, BTN_TOUCH, 1);
+            frame.push_back({EV_KEY, BTN_TOUCH, 1});
           }
         }
-        buffer->AddEvent(EV_ABS, ABS_MT_POSITION_X, this_x);
-        buffer->AddEvent(EV_ABS, ABS_MT_POSITION_Y, this_y);
+        frame.push_back({EV_ABS, ABS_MT_POSITION_X, this_x});
+        frame.push_back({EV_ABS, ABS_MT_POSITION_Y, this_y});
         // send ABS_X and ABS_Y for single-touch compatibility
-        buffer->AddEvent(EV_ABS, ABS_X, this_x);
-        buffer->AddEvent(EV_ABS, ABS_Y, this_y);
+        frame.push_back({EV_ABS, ABS_X, this_x});
+        frame.push_back({EV_ABS, ABS_Y, this_y});
       } else {
         // released touch
-        buffer->AddEvent(EV_ABS, ABS_MT_TRACKING_ID, this_id);
+        frame.push_back({EV_ABS, ABS_MT_TRACKING_ID, this_id});
         active_touch_slots_.erase(this_slot);
         if (active_touch_slots_.empty()) {
-          buffer->AddEvent(EV_KEY, BTN_TOUCH, 0);
+          frame.push_back({EV_KEY, BTN_TOUCH, 0});
         }
       }
     }
 
-    buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    if (frame.empty()) {
+      // Only went to the confirmation UI
+      return;
+    }
+    frame.push_back({EV_SYN, SYN_REPORT, 0});
+    input_coalescer_.Submit(input_sockets_.GetTouchClientByLabel(display_label),
+                            std::move(frame));
   }
 
   void OnKeyboardEvent(uint16_t code, bool down) override {
@@ -223,29 +174,13 @@ class ConnectionObserverImpl
       return;
     }
 
-    auto buffer = GetEventBuffer();
-    if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
-      return;
-    }
-    buffer->AddEvent(EV_KEY, code, down);
-    buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.keyboard_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_coalescer_.Submit(input_sockets_.keyboard_client,
+                            {{EV_KEY, code, down}, {EV_SYN, SYN_REPORT, 0}});
   }
 
   void OnSwitchEvent(uint16_t code, bool state) {
-    auto buffer = GetEventBuffer();
-    if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
-      return;
-    }
-    buffer->AddEvent(EV_SW, code, state);
-    buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.switches_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_coalescer_.Submit(input_sockets_.switches_client,
+                            {{EV_SW, code, state}, {EV_SYN, SYN_REPORT, 0}});
   }
 
   void OnAdbChannelOpen(std::function<bool(const uint8_t *, size_t)>
@@ -412,6 +347,7 @@ class ConnectionObserverImpl
   std::set<int32_t> active_touch_slots_;
   cuttlefish::CameraController *camera_controller_;
   cuttlefish::confui::HostVirtualInput &confui_input_;
+  InputEventCoalescer &input_coalescer_;
 };
 
 CfConnectionObserverFactory::CfConnectionObserverFactory(
@@ -420,7 +356,9 @@ CfConnectionObserverFactory::CfConnectionObserverFactory(
     cuttlefish::confui::HostVirtualInput &confui_input)
     : input_sockets_(input_sockets),
       kernel_log_events_handler_(kernel_log_events_handler),
-      confui_input_{confui_input} {}
+      confui_input_{confui_input},
+      input_coalescer_(FLAGS_write_virtio_input,
+                       std::chrono::milliseconds(FLAGS_input_coalescing_ms)) {}
 
 std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>
 CfConnectionObserverFactory::CreateObserver() {
@@ -428,7 +366,7 @@ CfConnectionObserverFactory::CreateObserver() {
       new ConnectionObserverImpl(input_sockets_, kernel_log_events_handler_,
                                  commands_to_custom_action_servers_,
                                  weak_display_handler_, camera_controller_,
-                                 confui_input_));
+                                 confui_input_, input_coalescer_));
 }
 
 void CfConnectionObserverFactory::AddCustomActionServer(
@@ -21,6 +21,7 @@
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/input_event_coalescer.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
 #include "host/frontend/webrtc/libdevice/camera_controller.h"
 #include "host/frontend/webrtc/libdevice/connection_observer.h"
@@ -70,6 +71,8 @@ class CfConnectionObserverFactory
   std::weak_ptr<DisplayHandler> weak_display_handler_;
   cuttlefish::confui::HostVirtualInput& confui_input_;
   cuttlefish::CameraController* camera_controller_ = nullptr;
+  // Shared by all clients, as they write to the same devices
+  InputEventCoalescer input_coalescer_;
 };
 
 }  // namespace cuttlefish
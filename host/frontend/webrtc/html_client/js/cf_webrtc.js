@@ -14,6 +14,12 @@
  * limitations under the License.
  */
 
+const INPUT_PROTOCOL_VERSION = 1;
+const INPUT_EVENT_DISPLAY_LABEL = 0;
+const INPUT_EVENT_TOUCH = 1;
+const INPUT_EVENT_MULTI_TOUCH = 2;
+const INPUT_EVENT_KEYBOARD = 3;
+
 function createDataChannel(pc, label, onMessage) {
   console.debug('creating data channel: ' + label);
   let dataChannel = pc.createDataChannel(label);
@@ -90,6 +96,7 @@ class DeviceConnection {
   #cameraInputQueue;
   #controlChannel;
   #inputChannel;
+  #inputDisplayIndices = new Map();
   #adbChannel;
   #bluetoothChannel;
   #locationChannel;
@@ -252,7 +259,46 @@ class DeviceConnection {
     this.#inputChannel.send(JSON.stringify(evt));
   }
 
+  // Binary input events are understood by devices advertising this protocol
+  // version or a later one, see libdevice/input_events.h for the layout.
+  #useBinaryInput() {
+    return this.#description &&
+        this.#description.input_protocol_version >= INPUT_PROTOCOL_VERSION;
+  }
+
+  #binaryInput(type, displayIndex, down, payloadSize) {
+    const buffer = new ArrayBuffer(4 + payloadSize);
+    const view = new DataView(buffer);
+    view.setUint8(0, INPUT_PROTOCOL_VERSION);
+    view.setUint8(1, type);
+    view.setUint8(2, displayIndex);
+    view.setUint8(3, down ? 1 : 0);
+    return {buffer, view};
+  }
+
+  #displayIndex(display_label) {
+    let index = this.#inputDisplayIndices.get(display_label);
+    if (index === undefined) {
+      index = this.#inputDisplayIndices.size;
+      this.#inputDisplayIndices.set(display_label, index);
+      const label = new TextEncoder().encode(display_label);
+      const {buffer} = this.#binaryInput(
+          INPUT_EVENT_DISPLAY_LABEL, index, false, label.length);
+      new Uint8Array(buffer, 4).set(label);
+      this.#inputChannel.send(buffer);
+    }
+    return index;
+  }
+
   sendMousePosition({x, y, down, display_label}) {
+    if (this.#useBinaryInput()) {
+      const {buffer, view} = this.#binaryInput(
+          INPUT_EVENT_TOUCH, this.#displayIndex(display_label), down, 8);
+      view.setInt32(4, x, true);
+      view.setInt32(8, y, true);
+      this.#inputChannel.send(buffer);
+      return;
+    }
     this.#sendJsonInput({
       type: 'mouse',
       down: down ? 1 : 0,
@@ -265,6 +311,21 @@ class DeviceConnection {
   // TODO (b/124121375): This should probably be an array of pointer events and
   // have different properties.
   sendMultiTouch({idArr, xArr, yArr, down, slotArr, display_label}) {
+    if (this.#useBinaryInput()) {
+      const count = idArr.length;
+      const {buffer, view} = this.#binaryInput(
+          INPUT_EVENT_MULTI_TOUCH, this.#displayIndex(display_label), down,
+          4 + count * 16);
+      view.setUint16(4, count, true);
+      const arrays = [idArr, slotArr, xArr, yArr];
+      for (let a = 0; a < arrays.length; a++) {
+        for (let i = 0; i < count; i++) {
+          view.setInt32(8 + (a * count + i) * 4, arrays[a][i], true);
+        }
+      }
+      this.#inputChannel.send(buffer);
+      return;
+    }
     this.#sendJsonInput({
       type: 'multi-touch',
       id: idArr,
@@ -277,6 +338,14 @@ class DeviceConnection {
   }
 
   sendKeyEvent(code, type) {
+    if (this.#useBinaryInput()) {
+      const code_bytes = new TextEncoder().encode(code);
+      const {buffer} = this.#binaryInput(
+          INPUT_EVENT_KEYBOARD, 0, type == 'keydown', code_bytes.length);
+      new Uint8Array(buffer, 4).set(code_bytes);
+      this.#inputChannel.send(buffer);
+      return;
+    }
     this.#sendJsonInput({type: 'keyboard', keycode: code, event_type: type});
   }
 
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/input_event_coalescer.h"
+
+#include <linux/input.h>
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+// Kept below UIO_MAXIOV, frames past it are written right away
+constexpr size_t kMaxPendingFrames = 256;
+
+static_assert(sizeof(InputEvent) == 8,
+              "InputEvent must match struct virtio_input_event");
+
+bool IsMultiTouchCode(uint16_t code) {
+  return code >= ABS_MT_TOUCH_MAJOR && code <= ABS_MT_TOOL_Y &&
+         code != ABS_MT_SLOT;
+}
+
+// The events of a motion only frame, with the later value of repeated
+// events.
+struct MotionFrame {
+  std::vector<int32_t> slots;
+  std::map<int32_t, std::vector<InputEvent>> slot_events;
+  std::vector<InputEvent> other_events;
+};
+
+void SetEvent(std::vector<InputEvent>& events, const InputEvent& event) {
+  auto it = std::find_if(events.begin(), events.end(), [&event](auto& e) {
+    return e.type == event.type && e.code == event.code;
+  });
+  if (it == events.end()) {
+    events.push_back(event);
+  } else {
+    it->value = event.value;
+  }
+}
+
+bool ParseMotion(const std::vector<InputEvent>& frame, MotionFrame& motion) {
+  if (frame.empty() || frame.back().type != EV_SYN ||
+      frame.back().code != SYN_REPORT) {
+    return false;
+  }
+  // The slot selected before the frame isn't known here
+  std::optional<int32_t> slot;
+  for (auto it = frame.begin(); it != frame.end() - 1; it++) {
+    if (it->type == EV_ABS && it->code == ABS_MT_SLOT) {
+      slot = it->value;
+      if (!motion.slot_events.count(*slot)) {
+        motion.slots.push_back(*slot);
+        motion.slot_events[*slot];
+      }
+    } else if (it->type == EV_ABS && it->code == ABS_MT_TRACKING_ID) {
+      // Contacts starting or ending
+      return false;
+    } else if (it->type == EV_ABS && IsMultiTouchCode(it->code)) {
+      if (!slot) {
+        return false;
+      }
+      SetEvent(motion.slot_events[*slot], *it);
+    } else if (it->type == EV_ABS || it->type == EV_KEY) {
+      SetEvent(motion.other_events, *it);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+InputEventCoalescer::InputEventCoalescer(bool virtio_input,
+                                         std::chrono::milliseconds interval,
+                                         Writer writer)
+    : virtio_input_(virtio_input),
+      interval_(interval),
+      writer_(std::move(writer)) {
+  if (interval_.count() > 0) {
+    flush_thread_ = std::thread([this]() { FlushThread(); });
+  }
+}
+
+InputEventCoalescer::~InputEventCoalescer() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (flush_thread_.joinable()) {
+    flush_thread_.join();
+  }
+  Flush();
+}
+
+bool InputEventCoalescer::MergeMotion(std::vector<InputEvent>& into,
+                                      const std::vector<InputEvent>& frame) {
+  MotionFrame merged;
+  MotionFrame update;
+  if (!ParseMotion(into, merged) || !ParseMotion(frame, update)) {
+    return false;
+  }
+  for (const auto& event : update.other_events) {
+    if (event.type != EV_KEY) {
+      SetEvent(merged.other_events, event);
+      continue;
+    }
+    // Key changes must reach the guest in their own frame
+    auto it = std::find_if(
+        merged.other_events.begin(), merged.other_events.end(),
+        [&event](auto& e) { return e.type == EV_KEY && e.code == event.code; });
+    if (it == merged.other_events.end() || it->value != event.value) {
+      return false;
+    }
+  }
+  for (auto slot : update.slots) {
+    if (!merged.slot_events.count(slot)) {
+      merged.slots.push_back(slot);
+    }
+    for (const auto& event : update.slot_events[slot]) {
+      SetEvent(merged.slot_events[slot], event);
+    }
+  }
+
+  into.clear();
+  for (auto slot : merged.slots) {
+    into.push_back({EV_ABS, ABS_MT_SLOT, slot});
+    into.insert(into.end(), merged.slot_events[slot].begin(),
+                merged.slot_events[slot].end());
+  }
+  into.insert(into.end(), merged.other_events.begin(),
+              merged.other_events.end());
+  into.push_back({EV_SYN, SYN_REPORT, 0});
+  return true;
+}
+
+void InputEventCoalescer::Submit(SharedFD fd, std::vector<InputEvent> frame) {
+  std::unique_lock lock(mutex_);
+  auto [it, inserted] = devices_.try_emplace(fd);
+  auto& device = it->second;
+  if (inserted || (device.frames.empty() && !device.writing &&
+                   Clock::now() - device.last_write >= interval_)) {
+    // Not written to in the last interval
+    device.frames.emplace_back(std::move(frame));
+    WriteFrames(lock, fd, device);
+  } else {
+    // The frames being written were taken out already, so only pending
+    // frames are merged into
+    if (device.frames.empty() ||
+        !MergeMotion(device.frames.back(), frame)) {
+      device.frames.emplace_back(std::move(frame));
+    }
+    if (device.frames.size() >= kMaxPendingFrames) {
+      WriteFrames(lock, fd, device);
+    } else {
+      cv_.notify_one();
+    }
+  }
+  if (interval_.count() == 0 && !device.writing && device.frames.empty()) {
+    // Nothing to wait for, nor a flush thread to forget the device later
+    devices_.erase(fd);
+  }
+}
+
+void InputEventCoalescer::Flush() {
+  std::unique_lock lock(mutex_);
+  // Iterators stay valid while unlocked, as only idle devices are erased
+  for (auto& [fd, device] : devices_) {
+    if (!device.frames.empty()) {
+      WriteFrames(lock, fd, device);
+    }
+  }
+}
+
+void InputEventCoalescer::FlushThread() {
+  std::unique_lock lock(mutex_);
+  while (!stopping_) {
+    auto now = Clock::now();
+    auto next_deadline = Clock::time_point::max();
+    for (auto it = devices_.begin(); it != devices_.end();) {
+      auto& [fd, device] = *it;
+      auto deadline = device.last_write + interval_;
+      if (device.writing) {
+        // The writing thread notifies when it is done
+        it++;
+      } else if (deadline > now) {
+        next_deadline = std::min(next_deadline, deadline);
+        it++;
+      } else if (!device.frames.empty()) {
+        WriteFrames(lock, fd, device);
+        next_deadline = std::min(next_deadline, device.last_write + interval_);
+        it++;
+      } else {
+        // Idle, don't hold on to sockets replaced by reconnecting clients
+        it = devices_.erase(it);
+      }
+    }
+    if (next_deadline == Clock::time_point::max()) {
+      cv_.wait(lock);
+    } else {
+      cv_.wait_until(lock, next_deadline);
+    }
+  }
+}
+
+void InputEventCoalescer::WriteFrames(std::unique_lock<std::mutex>& lock,
+                                      SharedFD fd, Device& device) {
+  if (device.writing) {
+    return;
+  }
+  device.writing = true;
+  do {
+    // Frames keep arriving while the lock is released
+    auto count = std::min(device.frames.size(), kMaxPendingFrames);
+    std::vector<std::vector<InputEvent>> frames(
+        std::make_move_iterator(device.frames.begin()),
+        std::make_move_iterator(device.frames.begin() + count));
+    device.frames.erase(device.frames.begin(), device.frames.begin() + count);
+    lock.unlock();
+    Write(fd, frames);
+    lock.lock();
+    device.last_write = Clock::now();
+  } while (DueLocked(device));
+  device.writing = false;
+  if (!device.frames.empty()) {
+    cv_.notify_one();
+  }
+}
+
+bool InputEventCoalescer::DueLocked(const Device& device) const {
+  return !device.frames.empty() &&
+         (device.frames.size() >= kMaxPendingFrames ||
+          Clock::now() - device.last_write >= interval_);
+}
+
+void InputEventCoalescer::Write(SharedFD fd,
+                                std::vector<std::vector<InputEvent>>& frames) {
+  std::vector<struct iovec> iov;
+  std::vector<struct input_event> converted;
+  if (virtio_input_) {
+    // The frames already have the virtio layout
+    for (auto& frame : frames) {
+      iov.push_back({frame.data(), frame.size() * sizeof(InputEvent)});
+    }
+  } else {
+    for (const auto& frame : frames) {
+      for (const auto& event : frame) {
+        converted.push_back({.type = event.type,
+                             .code = event.code,
+                             .value = event.value});
+      }
+    }
+    iov.push_back(
+        {converted.data(), converted.size() * sizeof(struct input_event)});
+  }
+  // Events for devices without a connected client are dropped
+  if (fd->IsOpen() && writer_(fd, iov.data(), iov.size()) < 0) {
+    LOG(ERROR) << "Failed to write input events: " << fd->StrError();
+  }
+}
+
+ssize_t InputEventCoalescer::DefaultWriter(SharedFD fd, struct iovec* iov,
+                                           int iovcnt) {
+  return WriteAll(fd, iov, iovcnt);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+struct InputEvent {
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+};
+
+/**
+ * Batches the input events written to the virtual input devices.
+ *
+ * The first frame (events up to a SYN_REPORT) sent to an idle device is
+ * written right away. Frames sent to a device written to less than an
+ * interval ago wait for the interval to end and are written together with a
+ * single vectored write. While they wait, a frame that only moves existing
+ * contacts replaces the positions in the previous frame instead of being
+ * queued after it, so bursts of motion reach the guest as one update.
+ */
+class InputEventCoalescer {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Replaceable to observe the writes in tests
+  using Writer = std::function<ssize_t(SharedFD, struct iovec*, int)>;
+
+  // Events are written as struct virtio_input_event when `virtio_input` is
+  // set, as struct input_event otherwise. An `interval` of 0 writes every
+  // frame as it arrives.
+  InputEventCoalescer(bool virtio_input, std::chrono::milliseconds interval,
+                      Writer writer = DefaultWriter);
+  ~InputEventCoalescer();
+
+  // `frame` must end with a SYN_REPORT.
+  void Submit(SharedFD device, std::vector<InputEvent> frame);
+  // Writes the pending frames of every device.
+  void Flush();
+
+  // Merges `frame` into `into` when both only update the positions of
+  // contacts and the state of keys that don't change. Returns false, leaving
+  // `into` untouched, otherwise.
+  static bool MergeMotion(std::vector<InputEvent>& into,
+                          const std::vector<InputEvent>& frame);
+
+ private:
+  struct Device {
+    std::vector<std::vector<InputEvent>> frames;
+    Clock::time_point last_write;
+    // A thread took frames out and is writing them without `mutex_`
+    bool writing = false;
+  };
+
+  static ssize_t DefaultWriter(SharedFD fd, struct iovec* iov, int iovcnt);
+
+  void FlushThread();
+  // Writes the pending frames of the device with `lock` released, so slow
+  // sockets don't hold up the other devices. Frames submitted meanwhile are
+  // written next if they are due already. Returns right away if another
+  // thread is writing to the device, as it will pick them up.
+  void WriteFrames(std::unique_lock<std::mutex>& lock, SharedFD fd,
+                   Device& device);
+  bool DueLocked(const Device& device) const;
+  void Write(SharedFD fd, std::vector<std::vector<InputEvent>>& frames);
+
+  bool virtio_input_;
+  std::chrono::milliseconds interval_;
+  Writer writer_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<SharedFD, Device> devices_;
+  bool stopping_ = false;
+  std::thread flush_thread_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the JSON and binary input event protocols on multi-touch events
+// with 1 to 10 contacts. The Decode benchmarks measure what the streamer does
+// for every message received on the input channel, the Inject ones also
+// include serializing the event as the client does, from the event to the
+// ConnectionObserver call.
+
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <json/json.h>
+
+#include "host/frontend/webrtc/libdevice/input_events.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+constexpr auto kDisplayLabel = "display_0";
+
+class CountingObserver : public ConnectionObserver {
+ public:
+  void OnConnected() override {}
+  void OnTouchEvent(const std::string&, int x, int, bool) override {
+    sum += x;
+  }
+  void OnMultiTouchEvent(const std::string&,
+                         const std::vector<TouchContact>& contacts,
+                         bool) override {
+    for (const auto& contact : contacts) {
+      sum += contact.x;
+    }
+  }
+  void OnKeyboardEvent(uint16_t keycode, bool) override { sum += keycode; }
+  void OnAdbChannelOpen(std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnAdbMessage(const uint8_t*, size_t) override {}
+  void OnControlChannelOpen(std::function<bool(const Json::Value)>) override {}
+  void OnLidStateChange(bool) override {}
+  void OnHingeAngleChange(int) override {}
+  void OnPowerButton(bool) override {}
+  void OnBackButton(bool) override {}
+  void OnHomeButton(bool) override {}
+  void OnMenuButton(bool) override {}
+  void OnVolumeDownButton(bool) override {}
+  void OnVolumeUpButton(bool) override {}
+  void OnCustomActionButton(const std::string&, const std::string&) override {}
+  void OnCameraControlMsg(const Json::Value&) override {}
+  void OnBluetoothChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnBluetoothMessage(const uint8_t*, size_t) override {}
+  void OnLocationChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnLocationMessage(const uint8_t*, size_t) override {}
+  void OnKmlLocationsChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnGpxLocationsChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnKmlLocationsMessage(const uint8_t*, size_t) override {}
+  void OnGpxLocationsMessage(const uint8_t*, size_t) override {}
+  void OnCameraData(const std::vector<char>&) override {}
+
+  int64_t sum = 0;
+};
+
+std::vector<TouchContact> Contacts(int count, int frame) {
+  std::vector<TouchContact> contacts;
+  for (int i = 0; i < count; i++) {
+    contacts.push_back(TouchContact{
+        .id = 100 + i,
+        .slot = i,
+        .x = 100 * i + frame % 720,
+        .y = 200 + frame % 1280,
+    });
+  }
+  return contacts;
+}
+
+// What cf_webrtc.js sends for a multi-touch event
+std::string JsonMultiTouch(const std::vector<TouchContact>& contacts) {
+  Json::Value evt;
+  evt["type"] = "multi-touch";
+  evt["display_label"] = kDisplayLabel;
+  evt["down"] = 1;
+  for (const auto& contact : contacts) {
+    evt["id"].append(contact.id);
+    evt["slot"].append(contact.slot);
+    evt["x"].append(contact.x);
+    evt["y"].append(contact.y);
+  }
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  return Json::writeString(factory, evt);
+}
+
+void BM_DecodeJson(benchmark::State& state) {
+  InputEventDecoder decoder;
+  CountingObserver observer;
+  auto message = JsonMultiTouch(Contacts(state.range(0), 0));
+  for (auto _ : state) {
+    auto res = decoder.DecodeJson(message.data(), message.size(), observer);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes/event"] = message.size();
+}
+BENCHMARK(BM_DecodeJson)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+
+void BM_DecodeBinary(benchmark::State& state) {
+  InputEventDecoder decoder;
+  CountingObserver observer;
+  auto label = EncodeDisplayLabel(0, kDisplayLabel);
+  CHECK(decoder.DecodeBinary(label.data(), label.size(), observer).ok());
+  auto message = EncodeMultiTouchEvent(0, Contacts(state.range(0), 0), true);
+  for (auto _ : state) {
+    auto res = decoder.DecodeBinary(message.data(), message.size(), observer);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes/event"] = message.size();
+}
+BENCHMARK(BM_DecodeBinary)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+
+void BM_InjectJson(benchmark::State& state) {
+  InputEventDecoder decoder;
+  CountingObserver observer;
+  int frame = 0;
+  for (auto _ : state) {
+    auto message = JsonMultiTouch(Contacts(state.range(0), frame++));
+    auto res = decoder.DecodeJson(message.data(), message.size(), observer);
+    benchmark::DoNotOptimize(res);
+  }
+  benchmark::DoNotOptimize(observer.sum);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InjectJson)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+
+void BM_InjectBinary(benchmark::State& state) {
+  InputEventDecoder decoder;
+  CountingObserver observer;
+  auto label = EncodeDisplayLabel(0, kDisplayLabel);
+  CHECK(decoder.DecodeBinary(label.data(), label.size(), observer).ok());
+  int frame = 0;
+  for (auto _ : state) {
+    auto message =
+        EncodeMultiTouchEvent(0, Contacts(state.range(0), frame++), true);
+    auto res = decoder.DecodeBinary(message.data(), message.size(), observer);
+    benchmark::DoNotOptimize(res);
+  }
+  benchmark::DoNotOptimize(observer.sum);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InjectBinary)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
@@ -28,6 +28,7 @@
 #include <api/video_codecs/video_encoder_factory.h>
 
 #include "host/frontend/webrtc/libcommon/audio_device.h"
+#include "host/frontend/webrtc/libcommon/shared_video_encoder.h"
 #include "host/frontend/webrtc/libcommon/vp8only_encoder_factory.h"
 
 namespace cuttlefish {
@@ -46,14 +47,21 @@ Result<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>>
 CreatePeerConnectionFactory(
     rtc::Thread* network_thread, rtc::Thread* worker_thread,
     rtc::Thread* signal_thread,
-    rtc::scoped_refptr<webrtc::AudioDeviceModule> audio_device_module) {
+    rtc::scoped_refptr<webrtc::AudioDeviceModule> audio_device_module,
+    bool share_video_encoders) {
+  // Only VP8 is supported
+  std::unique_ptr<webrtc::VideoEncoderFactory> video_encoder_factory =
+      std::make_unique<VP8OnlyEncoderFactory>(
+          webrtc::CreateBuiltinVideoEncoderFactory());
+  if (share_video_encoders) {
+    video_encoder_factory = std::make_unique<SharedVideoEncoderFactory>(
+        std::move(video_encoder_factory));
+  }
   auto peer_connection_factory = webrtc::CreatePeerConnectionFactory(
       network_thread, worker_thread, signal_thread, audio_device_module,
       webrtc::CreateBuiltinAudioEncoderFactory(),
       webrtc::CreateBuiltinAudioDecoderFactory(),
-      // Only VP8 is supported
-      std::make_unique<VP8OnlyEncoderFactory>(
-          webrtc::CreateBuiltinVideoEncoderFactory()),
+      std::move(video_encoder_factory),
       webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /* audio_mixer */,
       nullptr /* audio_processing */);
   CF_EXPECT(peer_connection_factory.get(),
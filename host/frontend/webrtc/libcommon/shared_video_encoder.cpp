@@ -0,0 +1,569 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/libcommon/shared_video_encoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <android-base/logging.h>
+#include <api/video/encoded_image.h>
+#include <api/video/video_bitrate_allocation.h>
+#include <modules/video_coding/include/video_codec_interface.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+// Upper bound of each bitrate tier, in bits per second. Peer connections whose
+// bandwidth estimates fall in the same tier share one encoder.
+constexpr uint32_t kTierMaxBitrates[] = {
+    500'000,
+    1'500'000,
+    4'000'000,
+    std::numeric_limits<uint32_t>::max(),
+};
+constexpr int kNumTiers = std::size(kTierMaxBitrates);
+// Estimates may wander this far past a tier boundary before a peer connection
+// moves to the next tier, since every move costs a key frame.
+constexpr double kTierHysteresis = 0.2;
+// Key frame requests arriving closer together than this are merged.
+constexpr auto kMinKeyFrameInterval = std::chrono::milliseconds(300);
+// Encoded frames kept for peer connections that lag a few frames behind.
+constexpr size_t kRecentFrames = 8;
+
+uint32_t TierMin(int tier) {
+  return tier == 0 ? 0 : kTierMaxBitrates[tier - 1];
+}
+
+int SelectTier(uint32_t target_bps, std::optional<int> current) {
+  if (current) {
+    double low = TierMin(*current) * (1 - kTierHysteresis);
+    double high = kTierMaxBitrates[*current] * (1 + kTierHysteresis);
+    if (target_bps >= low && target_bps <= high) {
+      return *current;
+    }
+  }
+  int tier = 0;
+  while (tier < kNumTiers - 1 && target_bps > kTierMaxBitrates[tier]) {
+    tier++;
+  }
+  return tier;
+}
+
+struct EncodedFrame {
+  int64_t timestamp_us;
+  // Timestamp of the previous frame produced by the same encoder, which this
+  // one depends on unless it is a key frame.
+  std::optional<int64_t> previous_us;
+  bool dropped = true;
+  bool key = false;
+  webrtc::EncodedImage image;
+  webrtc::CodecSpecificInfo info;
+};
+
+struct SharedEncoderKey {
+  std::string format;
+  int source_id;
+  int width;
+  int height;
+  int tier;
+
+  bool operator<(const SharedEncoderKey& other) const {
+    return std::tie(format, source_id, width, height, tier) <
+           std::tie(other.format, other.source_id, other.width, other.height,
+                    other.tier);
+  }
+};
+
+/*
+ * One encoder shared by all the peer connections watching the same source at
+ * the same resolution and bitrate tier. Frames are encoded by whichever peer
+ * connection presents them first; the rest get the stored result.
+ *
+ * mutex_ guards the subscribers and key frame state and is never held while
+ * the encoder runs, so the peer connections don't wait on each other's
+ * encodes to get a stored frame or update their targets. encode_mutex_
+ * serializes the calls into the encoder, and is taken before mutex_.
+ */
+class SharedEncoder : public webrtc::EncodedImageCallback {
+ public:
+  SharedEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder, int tier)
+      : encoder_(std::move(encoder)), tier_(tier) {}
+
+  ~SharedEncoder() override { encoder_->Release(); }
+
+  int32_t Init(webrtc::VideoCodec codec,
+               const webrtc::VideoEncoder::Settings& settings) {
+    std::lock_guard<std::mutex> lock(encode_mutex_);
+    codec.maxBitrate = std::min<uint64_t>(codec.maxBitrate,
+                                          kTierMaxBitrates[tier_] / 1000);
+    codec.startBitrate = std::min(codec.startBitrate, codec.maxBitrate);
+    auto ret = encoder_->InitEncode(&codec, settings);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+      return ret;
+    }
+    return encoder_->RegisterEncodeCompleteCallback(this);
+  }
+
+  void SetTarget(const void* client, uint32_t bitrate_bps, double framerate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    targets_[client] = {bitrate_bps, framerate};
+    rates_changed_ = true;
+  }
+
+  void Unsubscribe(const void* client) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    targets_.erase(client);
+    rates_changed_ = true;
+  }
+
+  void RequestKeyFrame() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    key_frame_requested_ = true;
+  }
+
+  std::shared_ptr<const EncodedFrame> Encode(const webrtc::VideoFrame& frame) {
+    std::shared_ptr<const EncodedFrame> encoded;
+    if (FindRecent(frame, encoded)) {
+      return encoded;
+    }
+
+    std::lock_guard<std::mutex> encode_lock(encode_mutex_);
+    std::optional<webrtc::VideoEncoder::RateControlParameters> rates;
+    bool force_key_frame;
+    auto now = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Another peer connection may have encoded it while this one waited.
+      if (FindRecentLocked(frame, encoded)) {
+        return encoded;
+      }
+      rates = TakeRates();
+      force_key_frame =
+          key_frame_requested_ &&
+          (!last_key_frame_ || now - *last_key_frame_ >= kMinKeyFrameInterval);
+      // Requests arriving during the encode are kept for the next frame.
+      key_frame_requested_ &= !force_key_frame;
+    }
+    if (rates) {
+      encoder_->SetRates(*rates);
+    }
+    std::vector<webrtc::VideoFrameType> types{
+        force_key_frame ? webrtc::VideoFrameType::kVideoFrameKey
+                        : webrtc::VideoFrameType::kVideoFrameDelta};
+
+    current_ = std::make_shared<EncodedFrame>();
+    current_->timestamp_us = frame.timestamp_us();
+    current_->previous_us = last_encoded_us_;
+    // OnEncodedImage is called from within Encode() and fills current_.
+    if (encoder_->Encode(frame, &types) != WEBRTC_VIDEO_CODEC_OK) {
+      LOG(ERROR) << "Shared video encoder failed to encode frame";
+    }
+    if (!current_->dropped) {
+      last_encoded_us_ = current_->timestamp_us;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!current_->dropped && current_->key) {
+      last_key_frame_ = now;
+    } else if (force_key_frame) {
+      key_frame_requested_ = true;
+    }
+    recent_.push_back(current_);
+    if (recent_.size() > kRecentFrames) {
+      recent_.pop_front();
+    }
+    return std::move(current_);
+  }
+
+  // EncodedImageCallback
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info) override {
+    // Called with encode_mutex_ held, from Encode().
+    if (!current_) {
+      return Result(Result::ERROR_SEND_FAILED);
+    }
+    current_->dropped = false;
+    current_->key =
+        encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+    current_->image = encoded_image;
+    // The encoder may reuse its output buffer, and this frame is kept around
+    // for peer connections that have not asked for it yet.
+    current_->image.SetEncodedData(webrtc::EncodedImageBuffer::Create(
+        encoded_image.data(), encoded_image.size()));
+    if (codec_specific_info) {
+      current_->info = *codec_specific_info;
+    }
+    return Result(Result::OK);
+  }
+
+ private:
+  struct Target {
+    uint32_t bitrate_bps;
+    double framerate;
+  };
+
+  // Returns true if the frame needs no encoding. `encoded` is then the stored
+  // result, or nullptr if the frame is too old to be encoded and the caller
+  // needs to resynchronize with a key frame.
+  bool FindRecent(const webrtc::VideoFrame& frame,
+                  std::shared_ptr<const EncodedFrame>& encoded) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return FindRecentLocked(frame, encoded);
+  }
+
+  bool FindRecentLocked(const webrtc::VideoFrame& frame,
+                        std::shared_ptr<const EncodedFrame>& encoded) {
+    for (const auto& recent : recent_) {
+      if (recent->timestamp_us == frame.timestamp_us()) {
+        encoded = recent;
+        return true;
+      }
+    }
+    if (!recent_.empty() &&
+        frame.timestamp_us() < recent_.back()->timestamp_us) {
+      encoded = nullptr;
+      return true;
+    }
+    return false;
+  }
+
+  // The tier is encoded for its slowest peer connection, so none of them is
+  // sent more than its bandwidth estimate allows.
+  std::optional<webrtc::VideoEncoder::RateControlParameters> TakeRates() {
+    if (!rates_changed_) {
+      return std::nullopt;
+    }
+    rates_changed_ = false;
+    uint32_t bitrate = kTierMaxBitrates[tier_];
+    double framerate = 0;
+    for (const auto& [unused, target] : targets_) {
+      if (target.bitrate_bps > 0) {
+        bitrate = std::min(bitrate, target.bitrate_bps);
+      }
+      framerate = std::max(framerate, target.framerate);
+    }
+    webrtc::VideoBitrateAllocation allocation;
+    allocation.SetBitrate(0, 0, bitrate);
+    return webrtc::VideoEncoder::RateControlParameters(
+        allocation, framerate > 0 ? framerate : 30);
+  }
+
+  // Guarded by encode_mutex_
+  std::mutex encode_mutex_;
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  const int tier_;
+  std::optional<int64_t> last_encoded_us_;
+  std::shared_ptr<EncodedFrame> current_;
+
+  // Guarded by mutex_
+  std::mutex mutex_;
+  std::map<const void*, Target> targets_;
+  bool rates_changed_ = true;
+  bool key_frame_requested_ = false;
+  std::optional<std::chrono::steady_clock::time_point> last_key_frame_;
+  std::deque<std::shared_ptr<const EncodedFrame>> recent_;
+};
+
+}  // namespace
+
+class SharedEncoderPool {
+ public:
+  SharedEncoderPool(std::unique_ptr<webrtc::VideoEncoderFactory> inner)
+      : inner_(std::move(inner)) {}
+
+  webrtc::VideoEncoderFactory& inner() { return *inner_; }
+
+  std::shared_ptr<SharedEncoder> Get(
+      const SharedEncoderKey& key, const webrtc::SdpVideoFormat& format,
+      const webrtc::VideoCodec& codec,
+      const webrtc::VideoEncoder::Settings& settings) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto it = encoders_.find(key); it != encoders_.end()) {
+      if (auto encoder = it->second.lock()) {
+        return encoder;
+      }
+    }
+    auto inner_encoder = inner_->CreateVideoEncoder(format);
+    if (!inner_encoder) {
+      return nullptr;
+    }
+    auto encoder =
+        std::make_shared<SharedEncoder>(std::move(inner_encoder), key.tier);
+    webrtc::VideoCodec shared_codec = codec;
+    shared_codec.width = key.width;
+    shared_codec.height = key.height;
+    if (shared_codec.numberOfSimulcastStreams == 1) {
+      shared_codec.simulcastStream[0].width = key.width;
+      shared_codec.simulcastStream[0].height = key.height;
+    }
+    if (encoder->Init(shared_codec, settings) != WEBRTC_VIDEO_CODEC_OK) {
+      LOG(ERROR) << "Failed to initialize shared video encoder";
+      return nullptr;
+    }
+    encoders_[key] = encoder;
+    return encoder;
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> inner_;
+  std::mutex mutex_;
+  std::map<SharedEncoderKey, std::weak_ptr<SharedEncoder>> encoders_;
+};
+
+namespace {
+
+/*
+ * The encoder WebRTC creates for every video sender. Frames from shared sources
+ * go through the SharedEncoder of the matching tier, anything else is encoded
+ * privately.
+ */
+class SharedEncoderClient : public webrtc::VideoEncoder {
+ public:
+  SharedEncoderClient(std::shared_ptr<SharedEncoderPool> pool,
+                      webrtc::SdpVideoFormat format)
+      : pool_(std::move(pool)), format_(std::move(format)) {}
+
+  ~SharedEncoderClient() override { Release(); }
+
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const Settings& settings) override {
+    Release();
+    codec_ = *codec_settings;
+    settings_ = settings;
+    target_bps_ = codec_.startBitrate * 1000;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    if (private_encoder_) {
+      private_encoder_->RegisterEncodeCompleteCallback(callback);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Release() override {
+    Unsubscribe();
+    if (private_encoder_) {
+      private_encoder_->Release();
+      private_encoder_.reset();
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    if (!settings_ || !callback_) {
+      return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+    auto buffer = frame.video_frame_buffer();
+    const SharedFrameBuffer* shared =
+        SharedFrameBuffer::FromBuffer(buffer.get());
+    if (!shared) {
+      return EncodePrivately(frame, frame_types);
+    }
+    if (private_encoder_) {
+      private_encoder_->Release();
+      private_encoder_.reset();
+    }
+
+    int tier = SelectTier(target_bps_, tier_);
+    SharedEncoderKey key{
+        .format = format_.name,
+        .source_id = shared->source_id(),
+        .width = buffer->width(),
+        .height = buffer->height(),
+        .tier = tier,
+    };
+    if (!shared_encoder_ || key_ < key || key < key_) {
+      Unsubscribe();
+      shared_encoder_ = pool_->Get(key, format_, codec_, *settings_);
+      if (!shared_encoder_) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+      }
+      key_ = key;
+      tier_ = tier;
+      shared_encoder_->SetTarget(this, target_bps_, framerate_);
+      // The new encoder's delta frames depend on frames this peer never got.
+      needs_key_frame_ = true;
+    }
+
+    bool key_frame_wanted = needs_key_frame_;
+    for (auto type : frame_types ? *frame_types
+                                 : std::vector<webrtc::VideoFrameType>{}) {
+      key_frame_wanted |= type == webrtc::VideoFrameType::kVideoFrameKey;
+    }
+    if (key_frame_wanted) {
+      shared_encoder_->RequestKeyFrame();
+    }
+
+    auto encoded = shared_encoder_->Encode(frame);
+    if (!encoded) {
+      needs_key_frame_ = true;
+      shared_encoder_->RequestKeyFrame();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    if (encoded->dropped) {
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    if (!encoded->key &&
+        (needs_key_frame_ || encoded->previous_us != last_delivered_us_)) {
+      // This peer missed the frame this one depends on, e.g. because its
+      // sender dropped it. Wait for the next key frame.
+      needs_key_frame_ = true;
+      shared_encoder_->RequestKeyFrame();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    webrtc::EncodedImage image = encoded->image;
+    image.SetTimestamp(frame.timestamp());
+    image.ntp_time_ms_ = frame.ntp_time_ms();
+    image.capture_time_ms_ = frame.render_time_ms();
+    needs_key_frame_ = false;
+    last_delivered_us_ = encoded->timestamp_us;
+    callback_->OnEncodedImage(image, &encoded->info);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void SetRates(const RateControlParameters& parameters) override {
+    target_bps_ = parameters.bitrate.get_sum_bps();
+    framerate_ = parameters.framerate_fps;
+    last_rates_ = parameters;
+    if (private_encoder_) {
+      private_encoder_->SetRates(parameters);
+    }
+    if (shared_encoder_) {
+      shared_encoder_->SetTarget(this, target_bps_, framerate_);
+    }
+  }
+
+  EncoderInfo GetEncoderInfo() const override {
+    EncoderInfo info;
+    if (private_encoder_) {
+      info = private_encoder_->GetEncoderInfo();
+    } else {
+      // Resolution is left alone so that peers keep sharing an encoder, they
+      // adapt to their bandwidth by moving between bitrate tiers instead.
+      info.implementation_name = "SharedEncoder";
+      info.scaling_settings = ScalingSettings::kOff;
+    }
+    // Otherwise WebRTC converts SharedFrameBuffers to I420 before Encode().
+    info.supports_native_handle = true;
+    return info;
+  }
+
+ private:
+  int32_t EncodePrivately(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) {
+    Unsubscribe();
+    if (!private_encoder_) {
+      private_encoder_ = pool_->inner().CreateVideoEncoder(format_);
+      if (!private_encoder_) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+      }
+      auto ret = private_encoder_->InitEncode(&codec_, *settings_);
+      if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        private_encoder_.reset();
+        return ret;
+      }
+      private_encoder_->RegisterEncodeCompleteCallback(callback_);
+      if (last_rates_) {
+        private_encoder_->SetRates(*last_rates_);
+      }
+    }
+    return private_encoder_->Encode(frame, frame_types);
+  }
+
+  void Unsubscribe() {
+    if (shared_encoder_) {
+      shared_encoder_->Unsubscribe(this);
+      shared_encoder_.reset();
+    }
+    last_delivered_us_.reset();
+  }
+
+  std::shared_ptr<SharedEncoderPool> pool_;
+  webrtc::SdpVideoFormat format_;
+  webrtc::VideoCodec codec_ = {};
+  std::optional<Settings> settings_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  std::optional<RateControlParameters> last_rates_;
+  uint32_t target_bps_ = 0;
+  double framerate_ = 0;
+
+  std::unique_ptr<webrtc::VideoEncoder> private_encoder_;
+
+  std::shared_ptr<SharedEncoder> shared_encoder_;
+  SharedEncoderKey key_;
+  std::optional<int> tier_;
+  bool needs_key_frame_ = true;
+  std::optional<int64_t> last_delivered_us_;
+};
+
+}  // namespace
+
+SharedFrameBuffer::SharedFrameBuffer(
+    int source_id, rtc::scoped_refptr<webrtc::I420BufferInterface> buffer)
+    : source_id_(source_id), buffer_(std::move(buffer)) {}
+
+const SharedFrameBuffer* SharedFrameBuffer::FromBuffer(
+    const webrtc::VideoFrameBuffer* buffer) {
+  if (!buffer || buffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+    return nullptr;
+  }
+  return static_cast<const SharedFrameBuffer*>(buffer);
+}
+
+int SharedFrameBuffer::NewSourceId() {
+  static std::atomic<int> next_id = 0;
+  return next_id++;
+}
+
+SharedVideoEncoderFactory::SharedVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> inner)
+    : pool_(std::make_shared<SharedEncoderPool>(std::move(inner))) {}
+
+std::vector<webrtc::SdpVideoFormat>
+SharedVideoEncoderFactory::GetSupportedFormats() const {
+  return pool_->inner().GetSupportedFormats();
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+SharedVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  return std::make_unique<SharedEncoderClient>(pool_, format);
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
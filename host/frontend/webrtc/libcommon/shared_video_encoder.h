@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video_codecs/video_encoder.h>
+#include <api/video_codecs/video_encoder_factory.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+class SharedEncoderPool;
+
+// Frame of a video source whose frames may be encoded once and sent to every
+// peer connection watching it. Sources opt in by wrapping their I420 frames in
+// one. It is a native buffer so that the encoders can tell it apart from the
+// buffers WebRTC makes, e.g. by scaling; anything that needs the pixels gets
+// them through ToI420().
+class SharedFrameBuffer : public webrtc::VideoFrameBuffer {
+ public:
+  SharedFrameBuffer(int source_id,
+                    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer);
+  ~SharedFrameBuffer() override = default;
+
+  // Returns `buffer` as a SharedFrameBuffer, or nullptr if it is some other
+  // kind of buffer. No other native buffers are made on the host.
+  static const SharedFrameBuffer* FromBuffer(
+      const webrtc::VideoFrameBuffer* buffer);
+
+  // Allocates an identifier for a new video source.
+  static int NewSourceId();
+
+  int source_id() const { return source_id_; }
+
+  // From VideoFrameBuffer
+  Type type() const override { return Type::kNative; }
+  int width() const override { return buffer_->width(); }
+  int height() const override { return buffer_->height(); }
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override {
+    return buffer_;
+  }
+
+ private:
+  int source_id_;
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_;
+};
+
+// Encoder factory for the encode-once mode: every encoder it creates forwards
+// frames of a SharedFrameBuffer source to a single encoder per source,
+// resolution and bitrate tier, and hands the encoded frames to all the peer
+// connections subscribed to it. Other frames are encoded privately, as the
+// inner factory would.
+class SharedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  SharedVideoEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> inner);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::shared_ptr<SharedEncoderPool> pool_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
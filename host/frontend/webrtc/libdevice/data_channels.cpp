@@ -19,7 +19,7 @@
 #include <android-base/logging.h>
 
 #include "host/frontend/webrtc/libcommon/utils.h"
-#include "host/frontend/webrtc/libdevice/keyboard.h"
+#include "host/frontend/webrtc/libdevice/input_events.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
@@ -76,88 +76,20 @@ static constexpr auto kCameraDataEof = "EOF";
 class InputChannelHandler : public DataChannelHandler {
  public:
   void OnMessageInner(const webrtc::DataBuffer &msg) override {
-    if (msg.binary) {
-      // TODO (jemoreira) consider binary protocol to avoid JSON parsing
-      // overhead
-      LOG(ERROR) << "Received invalid (binary) data on input channel";
-      return;
-    }
-    auto size = msg.size();
-
-    Json::Value evt;
-    Json::CharReaderBuilder builder;
-    std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
-    std::string errorMessage;
-    auto str = msg.data.cdata<char>();
-    if (!json_reader->parse(str, str + size, &evt, &errorMessage) < 0) {
-      LOG(ERROR) << "Received invalid JSON object over input channel: "
-                 << errorMessage;
-      return;
-    }
-    if (!evt.isMember("type") || !evt["type"].isString()) {
-      LOG(ERROR) << "Input event doesn't have a valid 'type' field: "
-                 << evt.toStyledString();
-      return;
-    }
-    auto event_type = evt["type"].asString();
-    if (event_type == "mouse") {
-      auto result =
-          ValidateJsonObject(evt, "mouse",
-                             {{"down", Json::ValueType::intValue},
-                              {"x", Json::ValueType::intValue},
-                              {"y", Json::ValueType::intValue},
-                              {"display_label", Json::ValueType::stringValue}});
-      if (!result.ok()) {
-        LOG(ERROR) << result.error().Trace();
-        return;
-      }
-      auto label = evt["display_label"].asString();
-      int32_t down = evt["down"].asInt();
-      int32_t x = evt["x"].asInt();
-      int32_t y = evt["y"].asInt();
-
-      observer()->OnTouchEvent(label, x, y, down);
-    } else if (event_type == "multi-touch") {
-      auto result =
-          ValidateJsonObject(evt, "multi-touch",
-                             {{"id", Json::ValueType::arrayValue},
-                              {"down", Json::ValueType::intValue},
-                              {"x", Json::ValueType::arrayValue},
-                              {"y", Json::ValueType::arrayValue},
-                              {"slot", Json::ValueType::arrayValue},
-                              {"display_label", Json::ValueType::stringValue}});
-      if (!result.ok()) {
-        LOG(ERROR) << result.error().Trace();
-        return;
-      }
-
-      auto label = evt["display_label"].asString();
-      auto idArr = evt["id"];
-      int32_t down = evt["down"].asInt();
-      auto xArr = evt["x"];
-      auto yArr = evt["y"];
-      auto slotArr = evt["slot"];
-      int size = evt["id"].size();
-
-      observer()->OnMultiTouchEvent(label, idArr, slotArr, xArr, yArr, down,
-                                    size);
-    } else if (event_type == "keyboard") {
-      auto result =
-          ValidateJsonObject(evt, "keyboard",
-                             {{"event_type", Json::ValueType::stringValue},
-                              {"keycode", Json::ValueType::stringValue}});
-      if (!result.ok()) {
-        LOG(ERROR) << result.error().Trace();
-        return;
-      }
-      auto down = evt["event_type"].asString() == std::string("keydown");
-      auto code = DomKeyCodeToLinux(evt["keycode"].asString());
-      observer()->OnKeyboardEvent(code, down);
-    } else {
-      LOG(ERROR) << "Unrecognized event type: " << event_type;
-      return;
+    // Clients send binary events when the device advertises the binary
+    // protocol, JSON objects otherwise.
+    auto result =
+        msg.binary
+            ? decoder_.DecodeBinary(msg.data.cdata(), msg.size(), *observer())
+            : decoder_.DecodeJson(msg.data.cdata<char>(), msg.size(),
+                                  *observer());
+    if (!result.ok()) {
+      LOG(ERROR) << result.error().Trace();
     }
   }
+
+ private:
+  InputEventDecoder decoder_;
 };
 
 class ControlChannelHandler : public DataChannelHandler {
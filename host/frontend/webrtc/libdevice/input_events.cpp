@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/libdevice/input_events.h"
+
+#include <endian.h>
+#include <string.h>
+
+#include "host/frontend/webrtc/libcommon/utils.h"
+#include "host/frontend/webrtc/libdevice/keyboard.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+constexpr size_t kHeaderSize = 4;
+constexpr size_t kMultiTouchHeaderSize = kHeaderSize + 4;
+// More than any touchscreen reports at once
+constexpr size_t kMaxContacts = 64;
+
+std::vector<uint8_t> Header(InputEventType type, uint8_t display, bool down,
+                            size_t size) {
+  std::vector<uint8_t> message;
+  message.reserve(size);
+  message.push_back(kInputProtocolVersion);
+  message.push_back(static_cast<uint8_t>(type));
+  message.push_back(display);
+  message.push_back(down ? kInputEventDownFlag : 0);
+  return message;
+}
+
+void AppendBytes(std::vector<uint8_t>& message, const std::string& bytes) {
+  message.insert(message.end(), bytes.begin(), bytes.end());
+}
+
+void AppendInt32(std::vector<uint8_t>& message, int32_t value) {
+  uint32_t le = htole32(static_cast<uint32_t>(value));
+  auto bytes = reinterpret_cast<const uint8_t*>(&le);
+  message.insert(message.end(), bytes, bytes + sizeof(le));
+}
+
+int32_t ReadInt32(const uint8_t* data) {
+  uint32_t le;
+  memcpy(&le, data, sizeof(le));
+  return static_cast<int32_t>(le32toh(le));
+}
+
+}  // namespace
+
+std::vector<uint8_t> EncodeDisplayLabel(uint8_t display,
+                                        const std::string& label) {
+  auto message = Header(InputEventType::kDisplayLabel, display, false,
+                        kHeaderSize + label.size());
+  AppendBytes(message, label);
+  return message;
+}
+
+std::vector<uint8_t> EncodeTouchEvent(uint8_t display, int32_t x, int32_t y,
+                                      bool down) {
+  auto message =
+      Header(InputEventType::kTouch, display, down, kHeaderSize + 8);
+  AppendInt32(message, x);
+  AppendInt32(message, y);
+  return message;
+}
+
+std::vector<uint8_t> EncodeMultiTouchEvent(
+    uint8_t display, const std::vector<TouchContact>& contacts, bool down) {
+  auto message = Header(InputEventType::kMultiTouch, display, down,
+                        kMultiTouchHeaderSize + contacts.size() * 16);
+  message.push_back(contacts.size() & 0xff);
+  message.push_back(contacts.size() >> 8);
+  message.push_back(0);
+  message.push_back(0);
+  for (const auto& contact : contacts) {
+    AppendInt32(message, contact.id);
+  }
+  for (const auto& contact : contacts) {
+    AppendInt32(message, contact.slot);
+  }
+  for (const auto& contact : contacts) {
+    AppendInt32(message, contact.x);
+  }
+  for (const auto& contact : contacts) {
+    AppendInt32(message, contact.y);
+  }
+  return message;
+}
+
+std::vector<uint8_t> EncodeKeyboardEvent(const std::string& dom_key_code,
+                                         bool down) {
+  auto message = Header(InputEventType::kKeyboard, 0, down,
+                        kHeaderSize + dom_key_code.size());
+  AppendBytes(message, dom_key_code);
+  return message;
+}
+
+InputEventDecoder::InputEventDecoder()
+    : json_reader_(Json::CharReaderBuilder().newCharReader()) {
+  contacts_.reserve(kMaxContacts);
+}
+
+Result<void> InputEventDecoder::DecodeBinary(const uint8_t* data, size_t size,
+                                             ConnectionObserver& observer) {
+  CF_EXPECT(size >= kHeaderSize, "Input event too short: " << size);
+  CF_EXPECT(data[0] == kInputProtocolVersion,
+            "Unsupported input protocol version: " << (int)data[0]);
+  auto type = static_cast<InputEventType>(data[1]);
+  uint8_t display = data[2];
+  bool down = data[3] & kInputEventDownFlag;
+  auto payload = data + kHeaderSize;
+  auto payload_size = size - kHeaderSize;
+
+  switch (type) {
+    case InputEventType::kDisplayLabel: {
+      if (display_labels_.size() <= display) {
+        display_labels_.resize(display + 1);
+      }
+      display_labels_[display] =
+          std::string(reinterpret_cast<const char*>(payload), payload_size);
+      return {};
+    }
+    case InputEventType::kTouch: {
+      CF_EXPECT(payload_size == 8, "Invalid touch event size: " << size);
+      CF_EXPECT(display < display_labels_.size() &&
+                    !display_labels_[display].empty(),
+                "Unknown display index: " << (int)display);
+      observer.OnTouchEvent(display_labels_[display], ReadInt32(payload),
+                            ReadInt32(payload + 4), down);
+      return {};
+    }
+    case InputEventType::kMultiTouch: {
+      CF_EXPECT(payload_size >= 4, "Invalid multi-touch event size: " << size);
+      size_t count = payload[0] | (payload[1] << 8);
+      CF_EXPECT(count <= kMaxContacts, "Too many touch contacts: " << count);
+      CF_EXPECT(payload_size == 4 + count * 16,
+                "Invalid multi-touch event size for " << count
+                                                      << " contacts: " << size);
+      CF_EXPECT(display < display_labels_.size() &&
+                    !display_labels_[display].empty(),
+                "Unknown display index: " << (int)display);
+      auto ids = payload + 4;
+      auto slots = ids + count * 4;
+      auto xs = slots + count * 4;
+      auto ys = xs + count * 4;
+      contacts_.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        contacts_[i] = TouchContact{
+            .id = ReadInt32(ids + i * 4),
+            .slot = ReadInt32(slots + i * 4),
+            .x = ReadInt32(xs + i * 4),
+            .y = ReadInt32(ys + i * 4),
+        };
+      }
+      observer.OnMultiTouchEvent(display_labels_[display], contacts_, down);
+      return {};
+    }
+    case InputEventType::kKeyboard: {
+      auto code = DomKeyCodeToLinux(
+          std::string(reinterpret_cast<const char*>(payload), payload_size));
+      observer.OnKeyboardEvent(code, down);
+      return {};
+    }
+  }
+  return CF_ERR("Unrecognized input event type: " << (int)data[1]);
+}
+
+Result<void> InputEventDecoder::DecodeJson(const char* data, size_t size,
+                                           ConnectionObserver& observer) {
+  Json::Value evt;
+  std::string errorMessage;
+  CF_EXPECT(json_reader_->parse(data, data + size, &evt, &errorMessage),
+            "Received invalid JSON object over input channel: "
+                << errorMessage);
+  CF_EXPECT(evt.isMember("type") && evt["type"].isString(),
+            "Input event doesn't have a valid 'type' field: "
+                << evt.toStyledString());
+  auto event_type = evt["type"].asString();
+  if (event_type == "mouse") {
+    CF_EXPECT(
+        ValidateJsonObject(evt, "mouse",
+                           {{"down", Json::ValueType::intValue},
+                            {"x", Json::ValueType::intValue},
+                            {"y", Json::ValueType::intValue},
+                            {"display_label", Json::ValueType::stringValue}}));
+    auto label = evt["display_label"].asString();
+    int32_t down = evt["down"].asInt();
+    int32_t x = evt["x"].asInt();
+    int32_t y = evt["y"].asInt();
+
+    observer.OnTouchEvent(label, x, y, down);
+  } else if (event_type == "multi-touch") {
+    CF_EXPECT(
+        ValidateJsonObject(evt, "multi-touch",
+                           {{"id", Json::ValueType::arrayValue},
+                            {"down", Json::ValueType::intValue},
+                            {"x", Json::ValueType::arrayValue},
+                            {"y", Json::ValueType::arrayValue},
+                            {"slot", Json::ValueType::arrayValue},
+                            {"display_label", Json::ValueType::stringValue}}));
+
+    auto label = evt["display_label"].asString();
+    const auto& idArr = evt["id"];
+    int32_t down = evt["down"].asInt();
+    const auto& xArr = evt["x"];
+    const auto& yArr = evt["y"];
+    const auto& slotArr = evt["slot"];
+    Json::ArrayIndex size = idArr.size();
+    CF_EXPECT(slotArr.size() == size && xArr.size() == size &&
+                  yArr.size() == size,
+              "Multi-touch arrays have different sizes");
+
+    contacts_.resize(size);
+    for (Json::ArrayIndex i = 0; i < size; i++) {
+      contacts_[i] = TouchContact{
+          .id = idArr[i].asInt(),
+          .slot = slotArr[i].asInt(),
+          .x = xArr[i].asInt(),
+          .y = yArr[i].asInt(),
+      };
+    }
+    observer.OnMultiTouchEvent(label, contacts_, down);
+  } else if (event_type == "keyboard") {
+    CF_EXPECT(
+        ValidateJsonObject(evt, "keyboard",
+                           {{"event_type", Json::ValueType::stringValue},
+                            {"keycode", Json::ValueType::stringValue}}));
+    auto down = evt["event_type"].asString() == std::string("keydown");
+    auto code = DomKeyCodeToLinux(evt["keycode"].asString());
+    observer.OnKeyboardEvent(code, down);
+  } else {
+    return CF_ERR("Unrecognized event type: " << event_type);
+  }
+  return {};
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
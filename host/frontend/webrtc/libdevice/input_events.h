@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/libdevice/connection_observer.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Advertised to clients in the device info. Clients that understand it send
+// binary input events, the others keep sending JSON objects.
+constexpr int kInputProtocolVersion = 1;
+
+// Binary input events are little endian records starting with a 4 byte
+// header: protocol version, event type, display index and flags.
+//
+// kDisplayLabel: the label bytes, binding the display index to a display for
+//   the following events. Sent once per display before using its index.
+// kTouch: int32 x, int32 y.
+// kMultiTouch: uint16 contact count, 2 reserved bytes, then the int32 arrays
+//   of tracking ids, slots, x and y coordinates, one entry per contact each.
+// kKeyboard: the DOM key code bytes. The display index is ignored.
+enum class InputEventType : uint8_t {
+  kDisplayLabel = 0,
+  kTouch = 1,
+  kMultiTouch = 2,
+  kKeyboard = 3,
+};
+
+constexpr uint8_t kInputEventDownFlag = 1;
+
+std::vector<uint8_t> EncodeDisplayLabel(uint8_t display,
+                                        const std::string& label);
+std::vector<uint8_t> EncodeTouchEvent(uint8_t display, int32_t x, int32_t y,
+                                      bool down);
+std::vector<uint8_t> EncodeMultiTouchEvent(
+    uint8_t display, const std::vector<TouchContact>& contacts, bool down);
+std::vector<uint8_t> EncodeKeyboardEvent(const std::string& dom_key_code,
+                                         bool down);
+
+// Decodes the messages received on the input data channel and calls the
+// matching methods of the connection observer. Keeps the display labels bound
+// by the client, so there should be one per channel.
+class InputEventDecoder {
+ public:
+  InputEventDecoder();
+
+  Result<void> DecodeBinary(const uint8_t* data, size_t size,
+                            ConnectionObserver& observer);
+  Result<void> DecodeJson(const char* data, size_t size,
+                          ConnectionObserver& observer);
+
+ private:
+  std::unique_ptr<Json::CharReader> json_reader_;
+  std::vector<std::string> display_labels_;
+  // Reused between events to avoid allocating on every touch
+  std::vector<TouchContact> contacts_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -40,6 +40,7 @@
 #include "host/frontend/webrtc/libdevice/audio_track_source_impl.h"
 #include "host/frontend/webrtc/libdevice/camera_streamer.h"
 #include "host/frontend/webrtc/libdevice/client_handler.h"
+#include "host/frontend/webrtc/libdevice/input_events.h"
 #include "host/frontend/webrtc/libdevice/video_track_source_impl.h"
 #include "host/frontend/webrtc_operator/constants/signaling_constants.h"
 
@@ -55,6 +56,7 @@ constexpr auto kIsTouchField = "is_touch";
 constexpr auto kDisplaysField = "displays";
 constexpr auto kAudioStreamsField = "audio_streams";
 constexpr auto kHardwareField = "hardware";
+constexpr auto kInputProtocolVersionField = "input_protocol_version";
 constexpr auto kControlPanelButtonCommand = "command";
 constexpr auto kControlPanelButtonTitle = "title";
 constexpr auto kControlPanelButtonIconName = "icon_name";
@@ -216,7 +218,8 @@ std::unique_ptr<Streamer> Streamer::Create(
 
   auto result = CreatePeerConnectionFactory(
       impl->network_thread_.get(), impl->worker_thread_.get(),
-      impl->signal_thread_.get(), impl->audio_device_module_->device_module());
+      impl->signal_thread_.get(), impl->audio_device_module_->device_module(),
+      cfg.share_video_encoders);
 
   if (!result.ok()) {
     LOG(ERROR) << result.error().Trace();
@@ -404,6 +407,7 @@ void Streamer::Impl::OnOpen() {
       hardware[k] = v;
     }
     device_info[kHardwareField] = hardware;
+    device_info[kInputProtocolVersionField] = kInputProtocolVersion;
     Json::Value custom_control_panel_buttons(Json::arrayValue);
     for (const auto& button : custom_control_panel_buttons_) {
       Json::Value button_entry;
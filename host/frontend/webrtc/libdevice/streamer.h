@@ -49,6 +49,9 @@ struct StreamerConfig {
   // [0,0] means all ports
   std::pair<uint16_t, uint16_t> udp_port_range = {15550, 15599};
   std::pair<uint16_t, uint16_t> tcp_port_range = {15550, 15599};
+  // Encode each display once per bitrate tier and send the result to every
+  // client, instead of running one encoder per client.
+  bool share_video_encoders = false;
 };
 
 class OperatorObserver {
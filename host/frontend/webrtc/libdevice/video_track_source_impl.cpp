@@ -18,6 +18,8 @@
 
 #include <api/video/video_frame_buffer.h>
 
+#include "host/frontend/webrtc/libcommon/shared_video_encoder.h"
+
 namespace cuttlefish {
 namespace webrtc_streaming {
 
@@ -52,14 +54,20 @@ class VideoFrameWrapper : public webrtc::I420BufferInterface {
 }  // namespace
 
 VideoTrackSourceImpl::VideoTrackSourceImpl(int width, int height)
-    : webrtc::VideoTrackSource(false), width_(width), height_(height) {}
+    : webrtc::VideoTrackSource(false),
+      width_(width),
+      height_(height),
+      source_id_(SharedFrameBuffer::NewSourceId()) {}
 
 void VideoTrackSourceImpl::OnFrame(std::shared_ptr<VideoFrameBuffer> frame,
                                    int64_t timestamp_us) {
   auto video_frame =
       webrtc::VideoFrame::Builder()
           .set_video_frame_buffer(rtc::scoped_refptr<webrtc::VideoFrameBuffer>(
-              new rtc::RefCountedObject<VideoFrameWrapper>(frame)))
+              new rtc::RefCountedObject<SharedFrameBuffer>(
+                  source_id_,
+                  rtc::scoped_refptr<webrtc::I420BufferInterface>(
+                      new rtc::RefCountedObject<VideoFrameWrapper>(frame)))))
           .set_timestamp_us(timestamp_us)
           .build();
   broadcaster_.OnFrame(video_frame);
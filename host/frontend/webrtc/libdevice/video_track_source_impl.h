@@ -48,6 +48,8 @@ class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
  private:
   int width_;
   int height_;
+  // Identifies this display's frames to shared video encoders.
+  int source_id_;
   rtc::VideoBroadcaster broadcaster_;
 };
 
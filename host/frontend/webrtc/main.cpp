@@ -59,9 +59,16 @@ DEFINE_string(action_servers, "",
               "where each entry corresponds to one custom action server.");
 DEFINE_bool(write_virtio_input, true,
             "Whether to send input events in virtio format.");
+DEFINE_int32(input_coalescing_ms, 8,
+             "Input events arriving less than this apart are batched, and "
+             "merged when they only move touches. 0 writes each one as it "
+             "arrives.");
 DEFINE_int32(audio_server_fd, -1, "An fd to listen on for audio frames");
 DEFINE_int32(camera_streamer_fd, -1, "An fd to send client camera frames");
 DEFINE_string(client_dir, "webrtc", "Location of the client files");
+DEFINE_bool(share_video_encoders, false,
+            "Encode each display once for all clients with similar bandwidth "
+            "instead of once per client.");
 
 using cuttlefish::AudioHandler;
 using cuttlefish::CfConnectionObserverFactory;
@@ -208,6 +215,7 @@ int main(int argc, char** argv) {
   streamer_config.client_files_port = client_server->port();
   streamer_config.tcp_port_range = instance.webrtc_tcp_port_range();
   streamer_config.udp_port_range = instance.webrtc_udp_port_range();
+  streamer_config.share_video_encoders = FLAGS_share_video_encoders;
   streamer_config.operator_server.addr = cvd_config->sig_server_address();
   streamer_config.operator_server.port = cvd_config->sig_server_port();
   streamer_config.operator_server.path = cvd_config->sig_server_path();
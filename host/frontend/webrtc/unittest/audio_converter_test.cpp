@@ -0,0 +1,142 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+template <typename T>
+std::vector<uint8_t> Bytes(const std::vector<T>& samples) {
+  auto data = reinterpret_cast<const uint8_t*>(samples.data());
+  return std::vector<uint8_t>(data, data + samples.size() * sizeof(T));
+}
+
+template <typename T>
+std::vector<T> Samples(const std::vector<uint8_t>& bytes) {
+  std::vector<T> samples(bytes.size() / sizeof(T));
+  memcpy(samples.data(), bytes.data(), samples.size() * sizeof(T));
+  return samples;
+}
+
+template <typename To, typename From>
+std::vector<To> Convert(const std::vector<From>& samples, PcmFormat from,
+                        PcmFormat to) {
+  auto src = Bytes(samples);
+  std::vector<uint8_t> dst(samples.size() * sizeof(To));
+  ConvertPcm(src.data(), from, dst.data(), to, samples.size());
+  return Samples<To>(dst);
+}
+
+// Stereo S24 sine wave with the same tone on both channels.
+std::vector<int32_t> Sine(double frequency, int rate, size_t frames,
+                          double amplitude) {
+  std::vector<int32_t> samples;
+  for (size_t i = 0; i < frames; i++) {
+    auto value = amplitude * std::sin(2 * M_PI * frequency * i / rate);
+    samples.push_back(std::lround(value));
+    samples.push_back(std::lround(value));
+  }
+  return samples;
+}
+
+std::vector<int16_t> Resample(const std::vector<int32_t>& samples, int rate,
+                              size_t piece_size) {
+  AudioConverter converter(PcmFormat::kS24, rate, PcmFormat::kS16, 48000, 2);
+  auto bytes = Bytes(samples);
+  for (size_t pos = 0; pos < bytes.size(); pos += piece_size) {
+    converter.Write(bytes.data() + pos,
+                    std::min(piece_size, bytes.size() - pos));
+  }
+  std::vector<int16_t> out(converter.FramesAvailable() * 2);
+  converter.Read(reinterpret_cast<uint8_t*>(out.data()),
+                 converter.FramesAvailable());
+  return out;
+}
+
+}  // namespace
+
+TEST(AudioConverterTest, NarrowsToS16) {
+  // More samples than a vector holds so both code paths run.
+  std::vector<int32_t> s32(11, 0x12345678);
+  s32[9] = -0x12345678;
+  auto s16 = Convert<int16_t>(s32, PcmFormat::kS32, PcmFormat::kS16);
+  EXPECT_EQ(s16[0], 0x1234);
+  EXPECT_EQ(s16[8], 0x1234);
+  EXPECT_EQ(s16[9], -0x1235);
+  EXPECT_EQ(s16[10], 0x1234);
+
+  // The padding byte of S24 samples is ignored.
+  std::vector<int32_t> s24(11, 0x7f123456);
+  s24[10] = 0x00fedcba;
+  s16 = Convert<int16_t>(s24, PcmFormat::kS24, PcmFormat::kS16);
+  EXPECT_EQ(s16[0], 0x1234);
+  EXPECT_EQ(s16[10], -0x124);
+
+  std::vector<int8_t> s8(11, -2);
+  s16 = Convert<int16_t>(s8, PcmFormat::kS8, PcmFormat::kS16);
+  EXPECT_EQ(s16[0], -512);
+  EXPECT_EQ(s16[10], -512);
+}
+
+TEST(AudioConverterTest, WideningRoundTrips) {
+  std::vector<int16_t> s16;
+  for (int i = -32768; i < 32768; i += 257) {
+    s16.push_back(i);
+  }
+  auto s24 = Convert<int32_t>(s16, PcmFormat::kS16, PcmFormat::kS24);
+  EXPECT_EQ(s24[1], s16[1] * 256);
+  EXPECT_EQ(Convert<int16_t>(s24, PcmFormat::kS24, PcmFormat::kS16), s16);
+  auto s32 = Convert<int32_t>(s16, PcmFormat::kS16, PcmFormat::kS32);
+  EXPECT_EQ(s32[1], s16[1] * 65536);
+  EXPECT_EQ(Convert<int16_t>(s32, PcmFormat::kS32, PcmFormat::kS16), s16);
+}
+
+TEST(AudioConverterTest, ResamplesTone) {
+  constexpr int kRate = 44100;
+  constexpr double kAmplitude = 1 << 22;
+  auto out = Resample(Sine(1000, kRate, kRate / 10, kAmplitude), kRate, 4096);
+
+  // 100ms of input produce close to 100ms of output, minus the filter delay.
+  ASSERT_GT(out.size() / 2, 4700u);
+  ASSERT_LE(out.size() / 2, 4800u);
+  for (size_t i = 100; i < out.size() / 2; i++) {
+    auto expected = kAmplitude / 256 * std::sin(2 * M_PI * 1000 * i / 48000);
+    ASSERT_NEAR(out[2 * i], expected, 80) << "at frame " << i;
+    ASSERT_EQ(out[2 * i], out[2 * i + 1]);
+  }
+}
+
+TEST(AudioConverterTest, OutputDoesNotDependOnWriteSizes) {
+  auto samples = Sine(440, 22050, 2000, 1 << 20);
+  // 7 bytes splits frames and samples.
+  EXPECT_EQ(Resample(samples, 22050, 7), Resample(samples, 22050, 1 << 16));
+}
+
+TEST(AudioConverterTest, FiltersFrequenciesAboveNyquist) {
+  constexpr int kRate = 384000;
+  auto out = Resample(Sine(30000, kRate, kRate / 10, 1 << 22), kRate, 4096);
+  ASSERT_GT(out.size(), 0u);
+  for (size_t i = 100; i < out.size(); i++) {
+    ASSERT_LT(std::abs(out[i]), 300) << "at sample " << i;
+  }
+}
+
+}  // namespace cuttlefish
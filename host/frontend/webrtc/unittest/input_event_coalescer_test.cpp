@@ -0,0 +1,305 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc/input_event_coalescer.h"
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <string.h>
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::milliseconds;
+
+// Stands in for the input sockets, recording the events written to each and
+// how many write calls it took.
+class CountingSink {
+ public:
+  InputEventCoalescer::Writer Writer(bool virtio_input = true) {
+    return [this, virtio_input](SharedFD fd, struct iovec* iov, int iovcnt) {
+      std::lock_guard lock(mutex_);
+      writes[fd]++;
+      ssize_t total = 0;
+      for (int i = 0; i < iovcnt; i++) {
+        auto data = static_cast<const char*>(iov[i].iov_base);
+        auto event_size =
+            virtio_input ? sizeof(InputEvent) : sizeof(struct input_event);
+        for (size_t pos = 0; pos < iov[i].iov_len; pos += event_size) {
+          InputEvent event;
+          if (virtio_input) {
+            memcpy(&event, data + pos, sizeof(event));
+          } else {
+            struct input_event full;
+            memcpy(&full, data + pos, sizeof(full));
+            event = {full.type, full.code, full.value};
+          }
+          events[fd].push_back(event);
+        }
+        total += iov[i].iov_len;
+      }
+      return total;
+    };
+  }
+
+  std::vector<InputEvent> Events(SharedFD fd) {
+    std::lock_guard lock(mutex_);
+    return events[fd];
+  }
+  int Writes(SharedFD fd) {
+    std::lock_guard lock(mutex_);
+    return writes[fd];
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<SharedFD, std::vector<InputEvent>> events;
+  std::map<SharedFD, int> writes;
+};
+
+// What ConnectionObserverImpl sends for a touch moving or starting
+std::vector<InputEvent> Touch(int slot, int x, int y, bool start = false) {
+  std::vector<InputEvent> frame = {{EV_ABS, ABS_MT_SLOT, slot}};
+  if (start) {
+    frame.push_back({EV_ABS, ABS_MT_TRACKING_ID, slot + 100});
+    frame.push_back({EV_KEY, BTN_TOUCH, 1});
+  }
+  frame.push_back({EV_ABS, ABS_MT_POSITION_X, x});
+  frame.push_back({EV_ABS, ABS_MT_POSITION_Y, y});
+  frame.push_back({EV_ABS, ABS_X, x});
+  frame.push_back({EV_ABS, ABS_Y, y});
+  frame.push_back({EV_SYN, SYN_REPORT, 0});
+  return frame;
+}
+
+std::vector<InputEvent> Release(int slot) {
+  return {{EV_ABS, ABS_MT_SLOT, slot},
+          {EV_ABS, ABS_MT_TRACKING_ID, -1},
+          {EV_KEY, BTN_TOUCH, 0},
+          {EV_SYN, SYN_REPORT, 0}};
+}
+
+std::vector<InputEvent> Key(uint16_t code, bool down) {
+  return {{EV_KEY, code, down}, {EV_SYN, SYN_REPORT, 0}};
+}
+
+// The value of the last event with the code for the slot
+int32_t Last(const std::vector<InputEvent>& events, int slot, uint16_t code) {
+  int current_slot = -1;
+  int32_t value = -1;
+  for (const auto& event : events) {
+    if (event.type == EV_ABS && event.code == ABS_MT_SLOT) {
+      current_slot = event.value;
+    } else if (event.type == EV_ABS && event.code == code &&
+               current_slot == slot) {
+      value = event.value;
+    }
+  }
+  return value;
+}
+
+int Count(const std::vector<InputEvent>& events, uint16_t type,
+          uint16_t code) {
+  return std::count_if(events.begin(), events.end(), [&](auto& event) {
+    return event.type == type && event.code == code;
+  });
+}
+
+class InputEventCoalescerTest : public testing::Test {
+ protected:
+  SharedFD touch_ = SharedFD::Open("/dev/null", O_WRONLY);
+  SharedFD keyboard_ = SharedFD::Open("/dev/null", O_WRONLY);
+  CountingSink sink_;
+};
+
+TEST_F(InputEventCoalescerTest, MergesSwipeMotion) {
+  // Long enough for the test to flush before the coalescer does
+  InputEventCoalescer coalescer(true, milliseconds(60000), sink_.Writer());
+  coalescer.Submit(touch_, Touch(0, 0, 0, /* start */ true));
+  for (int i = 1; i <= 100; i++) {
+    coalescer.Submit(touch_, Touch(0, i * 10, i * 5));
+  }
+  coalescer.Submit(touch_, Release(0));
+  coalescer.Flush();
+
+  // The first frame is written right away, the rest in a single write
+  EXPECT_EQ(sink_.Writes(touch_), 2);
+  auto events = sink_.Events(touch_);
+  EXPECT_EQ(Count(events, EV_SYN, SYN_REPORT), 3);
+  EXPECT_EQ(Count(events, EV_ABS, ABS_MT_POSITION_X), 2);
+  EXPECT_EQ(Last(events, 0, ABS_MT_POSITION_X), 1000);
+  EXPECT_EQ(Last(events, 0, ABS_MT_POSITION_Y), 500);
+  EXPECT_EQ(Last(events, 0, ABS_MT_TRACKING_ID), -1);
+  EXPECT_EQ(events.back().type, EV_SYN);
+}
+
+TEST_F(InputEventCoalescerTest, KeepsEveryContactOfPinch) {
+  InputEventCoalescer coalescer(true, milliseconds(60000), sink_.Writer());
+  coalescer.Submit(touch_, Touch(0, 100, 100, true));
+  coalescer.Submit(touch_, Touch(1, 900, 900, true));
+  for (int i = 1; i <= 50; i++) {
+    coalescer.Submit(touch_, Touch(0, 100 + i, 100 + i));
+    coalescer.Submit(touch_, Touch(1, 900 - i, 900 - i));
+  }
+  coalescer.Flush();
+
+  auto events = sink_.Events(touch_);
+  EXPECT_EQ(sink_.Writes(touch_), 2);
+  EXPECT_EQ(Count(events, EV_ABS, ABS_MT_TRACKING_ID), 2);
+  // The start of the second contact, then one update with both of them
+  EXPECT_EQ(Count(events, EV_SYN, SYN_REPORT), 3);
+  EXPECT_EQ(Last(events, 0, ABS_MT_POSITION_X), 150);
+  EXPECT_EQ(Last(events, 1, ABS_MT_POSITION_X), 850);
+}
+
+TEST_F(InputEventCoalescerTest, KeepsKeyTransitions) {
+  InputEventCoalescer coalescer(true, milliseconds(60000), sink_.Writer());
+  for (int i = 0; i < 10; i++) {
+    coalescer.Submit(keyboard_, Key(KEY_A, true));
+    coalescer.Submit(keyboard_, Key(KEY_A, false));
+  }
+  coalescer.Flush();
+
+  auto events = sink_.Events(keyboard_);
+  EXPECT_EQ(sink_.Writes(keyboard_), 2);
+  ASSERT_EQ(events.size(), 40u);
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(events[i * 2].code, KEY_A);
+    EXPECT_EQ(events[i * 2].value, i % 2 == 0 ? 1 : 0);
+  }
+}
+
+TEST_F(InputEventCoalescerTest, WritesEachDeviceSeparately) {
+  InputEventCoalescer coalescer(true, milliseconds(60000), sink_.Writer());
+  coalescer.Submit(touch_, Touch(0, 1, 1, true));
+  coalescer.Submit(keyboard_, Key(KEY_B, true));
+  coalescer.Submit(touch_, Touch(0, 2, 2));
+  coalescer.Submit(keyboard_, Key(KEY_B, false));
+  coalescer.Flush();
+
+  EXPECT_EQ(sink_.Writes(touch_), 2);
+  EXPECT_EQ(sink_.Writes(keyboard_), 2);
+  EXPECT_EQ(Count(sink_.Events(keyboard_), EV_KEY, KEY_B), 2);
+  EXPECT_EQ(Last(sink_.Events(touch_), 0, ABS_MT_POSITION_X), 2);
+}
+
+TEST_F(InputEventCoalescerTest, FlushesAfterInterval) {
+  InputEventCoalescer coalescer(true, milliseconds(5), sink_.Writer());
+  coalescer.Submit(touch_, Touch(0, 1, 1, true));
+  coalescer.Submit(touch_, Touch(0, 2, 2));
+  coalescer.Submit(touch_, Touch(0, 3, 3));
+  for (int i = 0; i < 100 && sink_.Writes(touch_) < 2; i++) {
+    std::this_thread::sleep_for(milliseconds(5));
+  }
+
+  EXPECT_EQ(sink_.Writes(touch_), 2);
+  EXPECT_EQ(Last(sink_.Events(touch_), 0, ABS_MT_POSITION_X), 3);
+}
+
+TEST_F(InputEventCoalescerTest, WritesThroughWithoutInterval) {
+  InputEventCoalescer coalescer(false, milliseconds(0), sink_.Writer(false));
+  for (int i = 0; i < 5; i++) {
+    coalescer.Submit(touch_, Touch(0, i, i, i == 0));
+  }
+
+  EXPECT_EQ(sink_.Writes(touch_), 5);
+  EXPECT_EQ(Count(sink_.Events(touch_), EV_ABS, ABS_MT_POSITION_X), 5);
+}
+
+TEST_F(InputEventCoalescerTest, SlowDeviceDoesNotBlockOthers) {
+  std::promise<void> touch_writing;
+  std::promise<void> unblock_touch;
+  auto unblocked = unblock_touch.get_future().share();
+  auto counting_writer = sink_.Writer(false);
+  auto writer = [&, unblocked](SharedFD fd, struct iovec* iov, int iovcnt) {
+    if (fd == touch_) {
+      touch_writing.set_value();
+      unblocked.wait();
+    }
+    return counting_writer(fd, iov, iovcnt);
+  };
+  InputEventCoalescer coalescer(false, milliseconds(0), writer);
+
+  std::thread touch_thread(
+      [&]() { coalescer.Submit(touch_, Touch(0, 1, 1, true)); });
+  touch_writing.get_future().wait();
+  coalescer.Submit(keyboard_, Key(KEY_C, true));
+  EXPECT_EQ(sink_.Writes(keyboard_), 1);
+  EXPECT_EQ(sink_.Writes(touch_), 0);
+
+  unblock_touch.set_value();
+  touch_thread.join();
+  EXPECT_EQ(sink_.Writes(touch_), 1);
+}
+
+TEST_F(InputEventCoalescerTest, KeepsOrderOfFramesSubmittedWhileWriting) {
+  std::promise<void> touch_writing;
+  std::promise<void> unblock_touch;
+  auto unblocked = unblock_touch.get_future().share();
+  bool first_write = true;
+  auto counting_writer = sink_.Writer(false);
+  auto writer = [&, unblocked](SharedFD fd, struct iovec* iov, int iovcnt) {
+    if (first_write) {
+      first_write = false;
+      touch_writing.set_value();
+      unblocked.wait();
+    }
+    return counting_writer(fd, iov, iovcnt);
+  };
+  InputEventCoalescer coalescer(false, milliseconds(0), writer);
+
+  std::thread touch_thread(
+      [&]() { coalescer.Submit(touch_, Touch(0, 1, 1, true)); });
+  touch_writing.get_future().wait();
+  // Left to the writing thread, which writes them after its frame
+  coalescer.Submit(touch_, Touch(0, 2, 2));
+  coalescer.Submit(touch_, Release(0));
+  EXPECT_EQ(sink_.Writes(touch_), 0);
+
+  unblock_touch.set_value();
+  touch_thread.join();
+  auto events = sink_.Events(touch_);
+  EXPECT_EQ(sink_.Writes(touch_), 2);
+  ASSERT_EQ(Count(events, EV_ABS, ABS_MT_POSITION_X), 2);
+  EXPECT_EQ(Last(events, 0, ABS_MT_POSITION_X), 2);
+  EXPECT_EQ(Last(events, 0, ABS_MT_TRACKING_ID), -1);
+}
+
+TEST(InputEventCoalescerMergeTest, OnlyMergesMotion) {
+  auto frame = Touch(0, 1, 1);
+  EXPECT_TRUE(InputEventCoalescer::MergeMotion(frame, Touch(1, 2, 2)));
+  EXPECT_FALSE(InputEventCoalescer::MergeMotion(frame, Touch(2, 3, 3, true)));
+  EXPECT_FALSE(InputEventCoalescer::MergeMotion(frame, Release(0)));
+  EXPECT_FALSE(InputEventCoalescer::MergeMotion(frame, Key(KEY_A, true)));
+  // Missing the SYN_REPORT
+  EXPECT_FALSE(InputEventCoalescer::MergeMotion(
+      frame, {{EV_ABS, ABS_MT_SLOT, 0}, {EV_ABS, ABS_MT_POSITION_X, 5}}));
+
+  EXPECT_EQ(Last(frame, 0, ABS_MT_POSITION_X), 1);
+  EXPECT_EQ(Last(frame, 1, ABS_MT_POSITION_X), 2);
+  EXPECT_EQ(Count(frame, EV_SYN, SYN_REPORT), 1);
+}
+
+}  // namespace
+}  // namespace cuttlefish
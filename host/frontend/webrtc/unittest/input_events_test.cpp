@@ -0,0 +1,181 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc/libdevice/input_events.h"
+
+#include <linux/input.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+bool operator==(const TouchContact& a, const TouchContact& b) {
+  return a.id == b.id && a.slot == b.slot && a.x == b.x && a.y == b.y;
+}
+
+namespace {
+
+struct Event {
+  std::string label;
+  std::vector<TouchContact> contacts;
+  bool down = false;
+  uint16_t keycode = 0;
+};
+
+class RecordingObserver : public ConnectionObserver {
+ public:
+  void OnConnected() override {}
+  void OnTouchEvent(const std::string& label, int x, int y,
+                    bool down) override {
+    events.push_back(Event{label, {{0, 0, x, y}}, down});
+  }
+  void OnMultiTouchEvent(const std::string& label,
+                         const std::vector<TouchContact>& contacts,
+                         bool down) override {
+    events.push_back(Event{label, contacts, down});
+  }
+  void OnKeyboardEvent(uint16_t keycode, bool down) override {
+    events.push_back(Event{"", {}, down, keycode});
+  }
+  void OnAdbChannelOpen(std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnAdbMessage(const uint8_t*, size_t) override {}
+  void OnControlChannelOpen(std::function<bool(const Json::Value)>) override {}
+  void OnLidStateChange(bool) override {}
+  void OnHingeAngleChange(int) override {}
+  void OnPowerButton(bool) override {}
+  void OnBackButton(bool) override {}
+  void OnHomeButton(bool) override {}
+  void OnMenuButton(bool) override {}
+  void OnVolumeDownButton(bool) override {}
+  void OnVolumeUpButton(bool) override {}
+  void OnCustomActionButton(const std::string&, const std::string&) override {}
+  void OnCameraControlMsg(const Json::Value&) override {}
+  void OnBluetoothChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnBluetoothMessage(const uint8_t*, size_t) override {}
+  void OnLocationChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnLocationMessage(const uint8_t*, size_t) override {}
+  void OnKmlLocationsChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnGpxLocationsChannelOpen(
+      std::function<bool(const uint8_t*, size_t)>) override {}
+  void OnKmlLocationsMessage(const uint8_t*, size_t) override {}
+  void OnGpxLocationsMessage(const uint8_t*, size_t) override {}
+  void OnCameraData(const std::vector<char>&) override {}
+
+  std::vector<Event> events;
+};
+
+class InputEventsTest : public testing::Test {
+ protected:
+  Result<void> Binary(const std::vector<uint8_t>& message) {
+    return decoder_.DecodeBinary(message.data(), message.size(), observer_);
+  }
+  Result<void> Json(const std::string& message) {
+    return decoder_.DecodeJson(message.data(), message.size(), observer_);
+  }
+
+  InputEventDecoder decoder_;
+  RecordingObserver observer_;
+};
+
+TEST_F(InputEventsTest, DecodesBinaryMultiTouch) {
+  ASSERT_TRUE(Binary(EncodeDisplayLabel(1, "display_1")).ok());
+  std::vector<TouchContact> contacts = {
+      {.id = 7, .slot = 0, .x = 100, .y = 200},
+      {.id = 8, .slot = 1, .x = -1, .y = 1 << 20},
+  };
+  auto res = Binary(EncodeMultiTouchEvent(1, contacts, true));
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+
+  ASSERT_EQ(observer_.events.size(), 1u);
+  EXPECT_EQ(observer_.events[0].label, "display_1");
+  EXPECT_TRUE(observer_.events[0].down);
+  EXPECT_EQ(observer_.events[0].contacts, contacts);
+}
+
+TEST_F(InputEventsTest, DecodesBinaryTouchAndKeyboard) {
+  ASSERT_TRUE(Binary(EncodeDisplayLabel(0, "display_0")).ok());
+  ASSERT_TRUE(Binary(EncodeTouchEvent(0, 12, 34, false)).ok());
+  ASSERT_TRUE(Binary(EncodeKeyboardEvent("KeyA", true)).ok());
+
+  ASSERT_EQ(observer_.events.size(), 2u);
+  EXPECT_EQ(observer_.events[0].label, "display_0");
+  EXPECT_EQ(observer_.events[0].contacts[0].x, 12);
+  EXPECT_EQ(observer_.events[0].contacts[0].y, 34);
+  EXPECT_FALSE(observer_.events[0].down);
+  EXPECT_EQ(observer_.events[1].keycode, KEY_A);
+  EXPECT_TRUE(observer_.events[1].down);
+}
+
+TEST_F(InputEventsTest, MatchesJsonEvents) {
+  auto res = Json(
+      R"({"type":"multi-touch","id":[7,8],"slot":[0,1],"x":[100,-1],)"
+      R"("y":[200,1048576],"down":1,"display_label":"display_1"})");
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  ASSERT_TRUE(Binary(EncodeDisplayLabel(3, "display_1")).ok());
+  ASSERT_TRUE(Binary(EncodeMultiTouchEvent(3, observer_.events[0].contacts,
+                                           true))
+                  .ok());
+  ASSERT_TRUE(Json(R"({"type":"keyboard","keycode":"KeyA",)"
+                   R"("event_type":"keyup"})")
+                  .ok());
+  ASSERT_TRUE(Binary(EncodeKeyboardEvent("KeyA", false)).ok());
+
+  ASSERT_EQ(observer_.events.size(), 4u);
+  EXPECT_EQ(observer_.events[0].label, observer_.events[1].label);
+  EXPECT_EQ(observer_.events[0].contacts, observer_.events[1].contacts);
+  EXPECT_EQ(observer_.events[0].down, observer_.events[1].down);
+  EXPECT_EQ(observer_.events[2].keycode, observer_.events[3].keycode);
+  EXPECT_EQ(observer_.events[2].down, observer_.events[3].down);
+}
+
+TEST_F(InputEventsTest, RejectsInvalidBinaryEvents) {
+  // Display index not bound yet
+  EXPECT_FALSE(Binary(EncodeTouchEvent(0, 1, 2, true)).ok());
+  ASSERT_TRUE(Binary(EncodeDisplayLabel(0, "display_0")).ok());
+
+  auto wrong_version = EncodeTouchEvent(0, 1, 2, true);
+  wrong_version[0] = kInputProtocolVersion + 1;
+  EXPECT_FALSE(Binary(wrong_version).ok());
+
+  auto truncated = EncodeMultiTouchEvent(0, {{1, 0, 1, 2}, {2, 1, 3, 4}}, true);
+  truncated.pop_back();
+  EXPECT_FALSE(Binary(truncated).ok());
+
+  auto unknown_type = EncodeTouchEvent(0, 1, 2, true);
+  unknown_type[1] = 42;
+  EXPECT_FALSE(Binary(unknown_type).ok());
+
+  EXPECT_FALSE(Binary({kInputProtocolVersion, 1}).ok());
+  EXPECT_TRUE(observer_.events.empty());
+}
+
+TEST_F(InputEventsTest, RejectsInvalidJsonEvents) {
+  EXPECT_FALSE(Json("{not json").ok());
+  EXPECT_FALSE(Json(R"({"x":1})").ok());
+  EXPECT_FALSE(Json(R"({"type":"mouse","x":1})").ok());
+  EXPECT_FALSE(Json(R"({"type":"unknown"})").ok());
+  EXPECT_TRUE(observer_.events.empty());
+}
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
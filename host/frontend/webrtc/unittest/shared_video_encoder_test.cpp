@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/libcommon/shared_video_encoder.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <api/video/encoded_image.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_bitrate_allocation.h>
+#include <api/video/video_frame.h>
+#include <gtest/gtest.h>
+#include <modules/video_coding/include/video_codec_interface.h>
+#include <modules/video_coding/include/video_error_codes.h>
+#include <rtc_base/ref_counted_object.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+using webrtc::VideoFrameType;
+
+// Longer than the shared encoders wait between two key frames
+constexpr auto kKeyFrameInterval = std::chrono::milliseconds(350);
+
+struct EncoderStats {
+  int created = 0;
+  int encodes = 0;
+  uint32_t bitrate_bps = 0;
+};
+
+// Produces a key frame when asked to, or for its first frame, and a delta
+// frame otherwise
+class FakeEncoder : public webrtc::VideoEncoder {
+ public:
+  FakeEncoder(EncoderStats& stats) : stats_(stats) { stats_.created++; }
+
+  int InitEncode(const webrtc::VideoCodec*, const Settings&) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t Release() override { return WEBRTC_VIDEO_CODEC_OK; }
+
+  int32_t Encode(const webrtc::VideoFrame& frame,
+                 const std::vector<VideoFrameType>* frame_types) override {
+    stats_.encodes++;
+    bool key = first_;
+    for (auto type : *frame_types) {
+      key |= type == VideoFrameType::kVideoFrameKey;
+    }
+    first_ = false;
+    webrtc::EncodedImage image;
+    image._frameType =
+        key ? VideoFrameType::kVideoFrameKey : VideoFrameType::kVideoFrameDelta;
+    image.SetTimestamp(frame.timestamp());
+    image.SetEncodedData(webrtc::EncodedImageBuffer::Create(1));
+    webrtc::CodecSpecificInfo info;
+    info.codecType = webrtc::kVideoCodecVP8;
+    callback_->OnEncodedImage(image, &info);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void SetRates(const RateControlParameters& parameters) override {
+    stats_.bitrate_bps = parameters.bitrate.get_sum_bps();
+  }
+
+  EncoderInfo GetEncoderInfo() const override { return EncoderInfo(); }
+
+ private:
+  EncoderStats& stats_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  bool first_ = true;
+};
+
+class FakeEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  FakeEncoderFactory(EncoderStats& stats) : stats_(stats) {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    return {webrtc::SdpVideoFormat("VP8")};
+  }
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat&) override {
+    return std::make_unique<FakeEncoder>(stats_);
+  }
+
+ private:
+  EncoderStats& stats_;
+};
+
+class RecordingCallback : public webrtc::EncodedImageCallback {
+ public:
+  Result OnEncodedImage(const webrtc::EncodedImage& image,
+                        const webrtc::CodecSpecificInfo*) override {
+    frames.push_back(image._frameType);
+    return Result(Result::OK);
+  }
+
+  std::vector<VideoFrameType> frames;
+};
+
+webrtc::VideoEncoder::RateControlParameters Rates(uint32_t bitrate_bps) {
+  webrtc::VideoBitrateAllocation allocation;
+  allocation.SetBitrate(0, 0, bitrate_bps);
+  return webrtc::VideoEncoder::RateControlParameters(allocation, 30);
+}
+
+// The encoder WebRTC would create for one peer connection
+struct Peer {
+  Peer(webrtc::VideoEncoderFactory& factory, uint32_t bitrate_bps)
+      : encoder(factory.CreateVideoEncoder(webrtc::SdpVideoFormat("VP8"))) {
+    webrtc::VideoCodec codec = {};
+    codec.codecType = webrtc::kVideoCodecVP8;
+    codec.width = 1280;
+    codec.height = 720;
+    codec.startBitrate = bitrate_bps / 1000;
+    codec.maxBitrate = 10'000;
+    codec.maxFramerate = 30;
+    codec.numberOfSimulcastStreams = 1;
+    webrtc::VideoEncoder::Settings settings(
+        webrtc::VideoEncoder::Capabilities(false), 1, 1200);
+    EXPECT_EQ(encoder->InitEncode(&codec, settings), WEBRTC_VIDEO_CODEC_OK);
+    encoder->RegisterEncodeCompleteCallback(&callback);
+    encoder->SetRates(Rates(bitrate_bps));
+  }
+
+  void Encode(const webrtc::VideoFrame& frame,
+              VideoFrameType type = VideoFrameType::kVideoFrameDelta) {
+    std::vector<VideoFrameType> types{type};
+    EXPECT_EQ(encoder->Encode(frame, &types), WEBRTC_VIDEO_CODEC_OK);
+  }
+
+  RecordingCallback callback;
+  std::unique_ptr<webrtc::VideoEncoder> encoder;
+};
+
+webrtc::VideoFrame Frame(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+                         int64_t timestamp_us) {
+  return webrtc::VideoFrame::Builder()
+      .set_video_frame_buffer(buffer)
+      .set_timestamp_us(timestamp_us)
+      .set_timestamp_rtp(timestamp_us * 90 / 1000)
+      .build();
+}
+
+webrtc::VideoFrame SharedFrame(int source_id, int64_t timestamp_us,
+                               int width = 1280, int height = 720) {
+  return Frame(rtc::scoped_refptr<webrtc::VideoFrameBuffer>(
+                   new rtc::RefCountedObject<SharedFrameBuffer>(
+                       source_id, webrtc::I420Buffer::Create(width, height))),
+               timestamp_us);
+}
+
+class SharedVideoEncoderTest : public ::testing::Test {
+ protected:
+  SharedVideoEncoderTest()
+      : factory_(std::make_unique<FakeEncoderFactory>(stats_)),
+        source_(SharedFrameBuffer::NewSourceId()) {}
+
+  EncoderStats stats_;
+  SharedVideoEncoderFactory factory_;
+  int source_;
+};
+
+TEST_F(SharedVideoEncoderTest, SharesEncoderAtSameResolutionAndTier) {
+  Peer first(factory_, 1'000'000);
+  Peer second(factory_, 1'200'000);
+
+  for (int64_t timestamp_us : {1000, 2000}) {
+    auto frame = SharedFrame(source_, timestamp_us);
+    first.Encode(frame);
+    second.Encode(frame);
+  }
+
+  EXPECT_EQ(stats_.created, 1);
+  EXPECT_EQ(stats_.encodes, 2);
+  std::vector<VideoFrameType> expected{VideoFrameType::kVideoFrameKey,
+                                       VideoFrameType::kVideoFrameDelta};
+  EXPECT_EQ(first.callback.frames, expected);
+  EXPECT_EQ(second.callback.frames, expected);
+}
+
+TEST_F(SharedVideoEncoderTest, SeparatesEncodersByResolutionAndTier) {
+  Peer slow(factory_, 1'000'000);
+  Peer fast(factory_, 3'000'000);
+  auto frame = SharedFrame(source_, 1000);
+  slow.Encode(frame);
+  fast.Encode(frame);
+  EXPECT_EQ(stats_.created, 2);
+  EXPECT_EQ(stats_.encodes, 2);
+
+  // Same tier as the slow peer, another resolution
+  Peer small(factory_, 1'000'000);
+  small.Encode(SharedFrame(source_, 1000, 640, 480));
+  EXPECT_EQ(stats_.created, 3);
+
+  // Same resolution and tier, another display
+  Peer other_display(factory_, 1'000'000);
+  other_display.Encode(SharedFrame(SharedFrameBuffer::NewSourceId(), 1000));
+  EXPECT_EQ(stats_.created, 4);
+
+  EXPECT_EQ(slow.callback.frames.size(), 1);
+  EXPECT_EQ(fast.callback.frames.size(), 1);
+  EXPECT_EQ(small.callback.frames.size(), 1);
+  EXPECT_EQ(other_display.callback.frames.size(), 1);
+}
+
+TEST_F(SharedVideoEncoderTest, FollowsSubscribers) {
+  auto first = std::make_unique<Peer>(factory_, 1'000'000);
+  auto second = std::make_unique<Peer>(factory_, 600'000);
+  auto frame = SharedFrame(source_, 1000);
+  first->Encode(frame);
+  second->Encode(frame);
+  // The new rates apply from the next encode, for the slowest subscriber
+  first->Encode(SharedFrame(source_, 2000));
+  EXPECT_EQ(stats_.bitrate_bps, 600'000);
+
+  second.reset();
+  first->Encode(SharedFrame(source_, 3000));
+  EXPECT_EQ(stats_.bitrate_bps, 1'000'000);
+  EXPECT_EQ(stats_.created, 1);
+
+  // The encoder goes away with its last subscriber
+  first.reset();
+  Peer third(factory_, 1'000'000);
+  third.Encode(SharedFrame(source_, 4000));
+  EXPECT_EQ(stats_.created, 2);
+  EXPECT_EQ(third.callback.frames,
+            std::vector<VideoFrameType>{VideoFrameType::kVideoFrameKey});
+}
+
+TEST_F(SharedVideoEncoderTest, MergesKeyFrameRequests) {
+  Peer first(factory_, 1'000'000);
+  Peer second(factory_, 1'000'000);
+  auto frame = SharedFrame(source_, 1000);
+  first.Encode(frame);
+  second.Encode(frame);
+
+  // Too soon after the first key frame, the request waits
+  frame = SharedFrame(source_, 2000);
+  first.Encode(frame, VideoFrameType::kVideoFrameKey);
+  second.Encode(frame, VideoFrameType::kVideoFrameKey);
+
+  // Both requests are served by one key frame
+  std::this_thread::sleep_for(kKeyFrameInterval);
+  for (int64_t timestamp_us : {3000, 4000}) {
+    frame = SharedFrame(source_, timestamp_us);
+    first.Encode(frame);
+    second.Encode(frame);
+  }
+
+  EXPECT_EQ(stats_.encodes, 4);
+  std::vector<VideoFrameType> expected{
+      VideoFrameType::kVideoFrameKey, VideoFrameType::kVideoFrameDelta,
+      VideoFrameType::kVideoFrameKey, VideoFrameType::kVideoFrameDelta};
+  EXPECT_EQ(first.callback.frames, expected);
+  EXPECT_EQ(second.callback.frames, expected);
+}
+
+TEST_F(SharedVideoEncoderTest, LateSubscriberWaitsForKeyFrame) {
+  Peer first(factory_, 1'000'000);
+  first.Encode(SharedFrame(source_, 1000));
+
+  // Joins right after a key frame, so it can't have another one yet
+  Peer second(factory_, 1'000'000);
+  auto frame = SharedFrame(source_, 2000);
+  first.Encode(frame);
+  second.Encode(frame);
+  EXPECT_TRUE(second.callback.frames.empty());
+
+  std::this_thread::sleep_for(kKeyFrameInterval);
+  frame = SharedFrame(source_, 3000);
+  first.Encode(frame);
+  second.Encode(frame);
+  EXPECT_EQ(second.callback.frames,
+            std::vector<VideoFrameType>{VideoFrameType::kVideoFrameKey});
+  EXPECT_EQ(first.callback.frames.size(), 3);
+  EXPECT_EQ(stats_.created, 1);
+}
+
+TEST_F(SharedVideoEncoderTest, EncodesOtherFramesPrivately) {
+  auto plain = webrtc::I420Buffer::Create(1280, 720);
+  EXPECT_EQ(SharedFrameBuffer::FromBuffer(plain.get()), nullptr);
+  auto shared = SharedFrame(source_, 1000);
+  EXPECT_NE(SharedFrameBuffer::FromBuffer(shared.video_frame_buffer().get()),
+            nullptr);
+
+  Peer first(factory_, 1'000'000);
+  Peer second(factory_, 1'000'000);
+  auto frame = Frame(plain, 1000);
+  first.Encode(frame);
+  second.Encode(frame);
+  // One private encoder per peer
+  EXPECT_EQ(stats_.created, 2);
+  EXPECT_EQ(stats_.encodes, 2);
+  EXPECT_EQ(first.callback.frames.size(), 1);
+  EXPECT_EQ(second.callback.frames.size(), 1);
+
+  // Native frames must reach the encoder as they are
+  EXPECT_TRUE(first.encoder->GetEncoderInfo().supports_native_handle);
+  first.Encode(SharedFrame(source_, 2000));
+  EXPECT_EQ(stats_.created, 3);
+  EXPECT_EQ(first.callback.frames.size(), 2);
+}
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
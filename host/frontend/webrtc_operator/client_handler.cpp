@@ -16,6 +16,7 @@
 #include "host/frontend/webrtc_operator/client_handler.h"
 
 #include <algorithm>
+#include <mutex>
 #include <random>
 
 #include <android-base/logging.h>
@@ -148,6 +149,7 @@ class PollConnectionHandler : public ClientHandler {
 
   void SendDeviceMessage(const Json::Value& message) override {
     constexpr size_t kMaxMessagesInQueue = 1000;
+    std::lock_guard<std::mutex> lock(messages_mutex_);
     if (messages_.size() > kMaxMessagesInQueue) {
       LOG(ERROR) << "Polling client " << client_id_ << " reached "
                  << kMaxMessagesInQueue
@@ -158,6 +160,7 @@ class PollConnectionHandler : public ClientHandler {
   }
 
   std::vector<Json::Value> PollMessages() {
+    std::lock_guard<std::mutex> lock(messages_mutex_);
     std::vector<Json::Value> ret;
     std::swap(ret, messages_);
     return ret;
@@ -177,11 +180,14 @@ class PollConnectionHandler : public ClientHandler {
  private:
   size_t client_id_ = 0;
   std::weak_ptr<DeviceHandler> device_handler_;
+  // Filled by the device's thread, drained by the client's polls
+  std::mutex messages_mutex_;
   std::vector<Json::Value> messages_;
 };
 
 std::shared_ptr<PollConnectionHandler> PollConnectionStore::Get(
     const std::string& conn_id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (!handlers_.count(conn_id)) {
     return nullptr;
   }
@@ -189,6 +195,7 @@ std::shared_ptr<PollConnectionHandler> PollConnectionStore::Get(
 }
 
 std::string PollConnectionStore::Add(std::shared_ptr<PollConnectionHandler> handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
   std::string conn_id;
   do {
     conn_id = RandomClientSecret(64);
@@ -34,6 +34,7 @@ void DeviceHandler::OnClosed() {
 
 size_t DeviceHandler::RegisterClient(
     std::shared_ptr<ClientHandler> client_handler) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
   clients_.emplace_back(client_handler);
   return clients_.size();
 }
@@ -88,13 +89,16 @@ void DeviceHandler::HandleForward(const Json::Value& message) {
     Close();
     return;
   }
-  if (client_id <= 0 || client_id > clients_.size()) {
-    LogAndReplyError("Forward failed: Unknown client " +
-                     std::to_string(client_id));
-    return;
+  std::shared_ptr<ClientHandler> client_handler;
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    if (client_id <= 0 || client_id > clients_.size()) {
+      LogAndReplyError("Forward failed: Unknown client " +
+                       std::to_string(client_id));
+      return;
+    }
+    client_handler = clients_[client_id - 1].lock();
   }
-  auto client_index = client_id - 1;
-  auto client_handler = clients_[client_index].lock();
   if (!client_handler) {
     SendClientDisconnectMessage(client_id);
     return;
@@ -16,6 +16,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -54,6 +55,8 @@ class DeviceHandler : public SignalHandler,
 
   std::string device_id_;
   Json::Value device_info_;
+  // Clients register from the threads servicing their own connections
+  std::mutex clients_mutex_;
   std::vector<std::weak_ptr<ClientHandler>> clients_;
 };
 
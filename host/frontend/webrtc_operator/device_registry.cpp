@@ -15,56 +15,78 @@
 
 #include "host/frontend/webrtc_operator/device_registry.h"
 
+#include <algorithm>
+#include <functional>
+
 #include <android-base/logging.h>
 
 #include "host/frontend/webrtc_operator/device_handler.h"
 
 namespace cuttlefish {
 
+DeviceRegistry::DeviceRegistry(std::size_t shards)
+    : shards_(std::max<std::size_t>(shards, 1)) {}
+
+DeviceRegistry::Shard& DeviceRegistry::ShardFor(const std::string& device_id) {
+  return shards_[std::hash<std::string>{}(device_id) % shards_.size()];
+}
+
 bool DeviceRegistry::RegisterDevice(
     const std::string& device_id,
     std::weak_ptr<DeviceHandler> device_handler) {
-  if (devices_.count(device_id) > 0) {
-    LOG(ERROR) << "Device '" << device_id << "' is already registered";
-    return false;
+  auto& shard = ShardFor(device_id);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.devices.try_emplace(device_id, device_handler).second) {
+      LOG(ERROR) << "Device '" << device_id << "' is already registered";
+      return false;
+    }
   }
-
-  devices_.try_emplace(device_id, device_handler);
   LOG(INFO) << "Registered device: '" << device_id << "'";
   return true;
 }
 
 void DeviceRegistry::UnRegisterDevice(const std::string& device_id) {
-  auto record = devices_.find(device_id);
-  if (record == devices_.end()) {
-    LOG(WARNING) << "Requested to unregister an unkwnown device: '" << device_id
-                 << "'";
-    return;
+  auto& shard = ShardFor(device_id);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.devices.erase(device_id) == 0) {
+      LOG(WARNING) << "Requested to unregister an unkwnown device: '"
+                   << device_id << "'";
+      return;
+    }
   }
-  devices_.erase(record);
   LOG(INFO) << "Unregistered device: '" << device_id << "'";
 }
 
 std::shared_ptr<DeviceHandler> DeviceRegistry::GetDevice(
     const std::string& device_id) {
-  if (devices_.count(device_id) == 0) {
+  auto& shard = ShardFor(device_id);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto record = shard.devices.find(device_id);
+  if (record == shard.devices.end()) {
     LOG(INFO) << "Requested device (" << device_id << ") is not registered";
     return nullptr;
   }
-  auto device_handler = devices_[device_id].lock();
+  auto device_handler = record->second.lock();
   if (!device_handler) {
     LOG(WARNING) << "Destroyed device handler detected for device '"
                  << device_id << "'";
-    UnRegisterDevice(device_id);
+    shard.devices.erase(record);
+    LOG(INFO) << "Unregistered device: '" << device_id << "'";
   }
   return device_handler;
 }
 
 std::vector<std::string> DeviceRegistry::ListDeviceIds() const {
   std::vector<std::string> ret;
-  for (const auto& entry: devices_) {
-    ret.push_back(entry.first);
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& entry : shard.devices) {
+      ret.push_back(entry.first);
+    }
   }
+  std::sort(ret.begin(), ret.end());
   return ret;
 }
 
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -28,8 +29,15 @@ namespace cuttlefish {
 
 class DeviceHandler;
 
+// The devices are spread over shards by the hash of their ids, each shard with
+// its own lock, so the event loops only contend when they look up devices in
+// the same shard. Safe to use from any thread.
 class DeviceRegistry {
  public:
+  static constexpr std::size_t kDefaultShards = 16;
+
+  explicit DeviceRegistry(std::size_t shards = kDefaultShards);
+
   bool RegisterDevice(const std::string& device_id,
                       std::weak_ptr<DeviceHandler> device_handler);
   void UnRegisterDevice(const std::string& device_id);
@@ -39,7 +47,15 @@ class DeviceRegistry {
   std::vector<std::string> ListDeviceIds() const;
 
  private:
-  std::map<std::string, std::weak_ptr<DeviceHandler>> devices_;
+  struct Shard {
+    mutable std::mutex mutex;
+    std::map<std::string, std::weak_ptr<DeviceHandler>> devices;
+  };
+
+  Shard& ShardFor(const std::string& device_id);
+
+  // Never resized, the shards can't be moved
+  std::vector<Shard> shards_;
 };
 
 }  // namespace cuttlefish
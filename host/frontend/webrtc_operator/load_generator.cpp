@@ -0,0 +1,508 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulates many devices and clients signaling through an operator. Every
+// device registers, then its clients connect to it and exchange messages with
+// it through the operator. All the sessions run on a single lws context.
+// Reports the percentiles of the time it took to register the devices, to
+// connect the clients and to relay the messages each way.
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+#include <libwebsockets.h>
+
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
+
+DEFINE_string(operator_addr, "localhost", "The address of the operator.");
+DEFINE_int32(operator_port, 8443, "The port of the operator.");
+DEFINE_bool(use_secure_http, true,
+            "Whether the operator uses WSS, with a certificate which may be "
+            "self signed.");
+DEFINE_uint32(devices, 1000, "How many devices to register.");
+DEFINE_uint32(clients_per_device, 1,
+              "How many clients connect to each device.");
+DEFINE_uint32(messages, 10,
+              "How many messages each client sends to its device. The device "
+              "sends one back for each.");
+DEFINE_uint32(max_pending_connections, 64,
+              "How many websocket handshakes may be in flight at once.");
+DEFINE_uint32(timeout_secs, 300, "How long to wait for all the sessions.");
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+
+constexpr char kOperatorProtocolName[] = "webrtc-operator";
+constexpr char kProtocolName[] = "webrtc-operator-load";
+constexpr char kSequenceField[] = "sequence";
+constexpr char kSentAtField[] = "sent_at_ns";
+
+int LwsCallback(struct lws* wsi, enum lws_callback_reasons reason, void* user,
+                void* in, size_t len);
+
+const struct lws_protocols kProtocols[2] = {
+    {kProtocolName, LwsCallback, 0, 0, 0, NULL, 0},
+    {NULL, NULL, 0, 0, 0, NULL, 0}};
+
+Json::Int64 NowNs() {
+  return std::chrono::duration_cast<nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct Session {
+  enum class Role { kDevice, kClient };
+
+  Role role;
+  std::string device_id;
+  struct lws* wsi = nullptr;
+  Clock::time_point connect_start;
+  bool done = false;
+  std::uint32_t messages_sent = 0;
+  std::string receive_buffer;
+  // Each message is preceded by LWS_PRE bytes for lws to use
+  std::deque<std::vector<uint8_t>> write_queue;
+};
+
+class LoadGenerator {
+ public:
+  Result<void> Run();
+  void Report() const;
+
+  int Callback(struct lws* wsi, enum lws_callback_reasons reason, void* in,
+               size_t len);
+
+ private:
+  void Connect(Session& session);
+  void StartPendingConnections();
+  void Send(Session& session, const Json::Value& message);
+  void SendToDevice(Session& client);
+  void Finish(Session& session, bool failed);
+  bool Finished() const;
+
+  void OnEstablished(Session& session);
+  void OnMessage(Session& session, const Json::Value& message);
+  void OnDeviceMessage(Session& device, const std::string& type,
+                       const Json::Value& message);
+  void OnClientMessage(Session& client, const std::string& type,
+                       const Json::Value& message);
+  void OnWritable(Session& session);
+
+  struct lws_context* context_ = nullptr;
+  lws_sorted_usec_list_t tick_ = {};
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  std::unordered_map<struct lws*, Session*> sessions_by_wsi_;
+  std::deque<Session*> connect_queue_;
+  std::size_t pending_connections_ = 0;
+
+  std::size_t registered_devices_ = 0;
+  std::size_t failed_devices_ = 0;
+  std::size_t finished_clients_ = 0;
+  std::size_t failed_clients_ = 0;
+  std::size_t errors_ = 0;
+  nanoseconds elapsed_{};
+  std::vector<nanoseconds> device_registration_;
+  std::vector<nanoseconds> client_connection_;
+  std::vector<nanoseconds> client_to_device_;
+  std::vector<nanoseconds> device_to_client_;
+};
+
+// lws_service() only returns when there's something to do, the tick makes it
+// return regularly so that the timeout is checked.
+void Tick(lws_sorted_usec_list_t* sul) {
+  lws_sul_schedule(lws_get_context_from_sul(sul), 0, sul, Tick,
+                   100 * LWS_US_PER_MS);
+}
+
+Result<void> LoadGenerator::Run() {
+  struct lws_context_creation_info info;
+  memset(&info, 0, sizeof(info));
+  info.port = CONTEXT_PORT_NO_LISTEN;
+  info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+  info.protocols = kProtocols;
+  info.user = this;
+  context_ = lws_create_context(&info);
+  CF_EXPECT(context_ != nullptr, "Failed to create the websocket context");
+  lws_sul_schedule(context_, 0, &tick_, Tick, 100 * LWS_US_PER_MS);
+
+  for (std::uint32_t i = 0; i < FLAGS_devices; i++) {
+    sessions_.emplace_back(new Session{
+        .role = Session::Role::kDevice,
+        .device_id = "load_test_" + std::to_string(i),
+    });
+    Connect(*sessions_.back());
+  }
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::seconds(FLAGS_timeout_secs);
+  while (!Finished() && Clock::now() < deadline) {
+    if (lws_service(context_, 0) < 0) {
+      break;
+    }
+  }
+  elapsed_ = Clock::now() - start;
+  bool finished = Finished();
+  // Closing the remaining connections calls back into this object
+  stopping_ = true;
+  lws_context_destroy(context_);
+  CF_EXPECT(finished, "Gave up after "
+                          << std::chrono::duration<double>(elapsed_).count()
+                          << "s with "
+                          << (std::size_t)FLAGS_devices *
+                                     FLAGS_clients_per_device -
+                                 finished_clients_
+                          << " clients unfinished");
+  return {};
+}
+
+bool LoadGenerator::Finished() const {
+  return finished_clients_ ==
+         (std::size_t)FLAGS_devices * FLAGS_clients_per_device;
+}
+
+void LoadGenerator::Connect(Session& session) {
+  connect_queue_.push_back(&session);
+  StartPendingConnections();
+}
+
+void LoadGenerator::StartPendingConnections() {
+  while (pending_connections_ < FLAGS_max_pending_connections &&
+         !connect_queue_.empty()) {
+    auto& session = *connect_queue_.front();
+    connect_queue_.pop_front();
+
+    struct lws_client_connect_info connect_info;
+    memset(&connect_info, 0, sizeof(connect_info));
+    connect_info.context = context_;
+    connect_info.port = FLAGS_operator_port;
+    connect_info.address = FLAGS_operator_addr.c_str();
+    connect_info.path = session.role == Session::Role::kDevice
+                            ? "/register_device"
+                            : "/connect_client";
+    connect_info.host = connect_info.address;
+    connect_info.origin = connect_info.address;
+    if (FLAGS_use_secure_http) {
+      connect_info.ssl_connection = LCCSCF_USE_SSL | LCCSCF_ALLOW_SELFSIGNED |
+                                    LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
+    }
+    connect_info.protocol = kOperatorProtocolName;
+    connect_info.local_protocol_name = kProtocolName;
+    connect_info.pwsi = &session.wsi;
+
+    session.connect_start = Clock::now();
+    if (!lws_client_connect_via_info(&connect_info)) {
+      LOG(ERROR) << "Failed to connect to " << FLAGS_operator_addr << ":"
+                 << FLAGS_operator_port;
+      Finish(session, /* failed */ true);
+      continue;
+    }
+    sessions_by_wsi_[session.wsi] = &session;
+    pending_connections_++;
+  }
+}
+
+void LoadGenerator::Send(Session& session, const Json::Value& message) {
+  Json::StreamWriterBuilder factory;
+  auto str = Json::writeString(factory, message);
+  std::vector<uint8_t> buffer(LWS_PRE + str.size());
+  memcpy(&buffer[LWS_PRE], str.data(), str.size());
+  session.write_queue.push_back(std::move(buffer));
+  lws_callback_on_writable(session.wsi);
+}
+
+void LoadGenerator::SendToDevice(Session& client) {
+  Json::Value message;
+  message[webrtc_signaling::kTypeField] = webrtc_signaling::kForwardType;
+  message[webrtc_signaling::kPayloadField][kSequenceField] =
+      client.messages_sent++;
+  message[webrtc_signaling::kPayloadField][kSentAtField] = NowNs();
+  Send(client, message);
+}
+
+void LoadGenerator::Finish(Session& session, bool failed) {
+  if (session.done) {
+    return;
+  }
+  session.done = true;
+  if (session.role == Session::Role::kClient) {
+    finished_clients_++;
+    failed_clients_ += failed;
+  } else if (failed) {
+    // The device's clients never get to connect
+    failed_devices_++;
+    finished_clients_ += FLAGS_clients_per_device;
+    failed_clients_ += FLAGS_clients_per_device;
+  }
+}
+
+void LoadGenerator::OnEstablished(Session& session) {
+  Json::Value message;
+  if (session.role == Session::Role::kDevice) {
+    message[webrtc_signaling::kTypeField] = webrtc_signaling::kRegisterType;
+    message[webrtc_signaling::kDeviceIdField] = session.device_id;
+    message[webrtc_signaling::kDeviceInfoField]["load_test"] = true;
+  } else {
+    message[webrtc_signaling::kTypeField] = webrtc_signaling::kConnectType;
+    message[webrtc_signaling::kDeviceIdField] = session.device_id;
+  }
+  Send(session, message);
+}
+
+void LoadGenerator::OnMessage(Session& session, const Json::Value& message) {
+  if (message.isMember("error")) {
+    LOG(WARNING) << "Operator error for " << session.device_id << ": "
+                 << message["error"].asString();
+    errors_++;
+    if (session.role == Session::Role::kClient ||
+        !session.messages_sent /* not registered yet */) {
+      Finish(session, /* failed */ true);
+    }
+    return;
+  }
+  auto type = message[webrtc_signaling::kTypeField].asString();
+  if (session.role == Session::Role::kDevice) {
+    OnDeviceMessage(session, type, message);
+  } else {
+    OnClientMessage(session, type, message);
+  }
+}
+
+void LoadGenerator::OnDeviceMessage(Session& device, const std::string& type,
+                                    const Json::Value& message) {
+  if (type == webrtc_signaling::kConfigType && !device.messages_sent) {
+    // The operator sends the config once the device is registered. The
+    // device's messages_sent counts the replies it sends, which makes it a
+    // registered device as soon as it's non zero.
+    device.messages_sent = 1;
+    registered_devices_++;
+    device_registration_.push_back(Clock::now() - device.connect_start);
+    for (std::uint32_t i = 0; i < FLAGS_clients_per_device; i++) {
+      sessions_.emplace_back(new Session{
+          .role = Session::Role::kClient,
+          .device_id = device.device_id,
+      });
+      Connect(*sessions_.back());
+    }
+  } else if (type == webrtc_signaling::kClientMessageType) {
+    const auto& payload = message[webrtc_signaling::kPayloadField];
+    client_to_device_.emplace_back(NowNs() - payload[kSentAtField].asInt64());
+
+    Json::Value reply;
+    reply[webrtc_signaling::kTypeField] = webrtc_signaling::kForwardType;
+    reply[webrtc_signaling::kClientIdField] =
+        message[webrtc_signaling::kClientIdField];
+    reply[webrtc_signaling::kPayloadField][kSequenceField] =
+        payload[kSequenceField];
+    reply[webrtc_signaling::kPayloadField][kSentAtField] = NowNs();
+    Send(device, reply);
+    device.messages_sent++;
+  }
+}
+
+void LoadGenerator::OnClientMessage(Session& client, const std::string& type,
+                                    const Json::Value& message) {
+  if (type == webrtc_signaling::kDeviceInfoType) {
+    client_connection_.push_back(Clock::now() - client.connect_start);
+  } else if (type == webrtc_signaling::kDeviceMessageType) {
+    const auto& payload = message[webrtc_signaling::kPayloadField];
+    device_to_client_.emplace_back(NowNs() - payload[kSentAtField].asInt64());
+  } else {
+    return;
+  }
+  if (client.messages_sent < FLAGS_messages) {
+    SendToDevice(client);
+  } else {
+    Finish(client, /* failed */ false);
+  }
+}
+
+void LoadGenerator::OnWritable(Session& session) {
+  if (session.write_queue.empty()) {
+    return;
+  }
+  auto& buffer = session.write_queue.front();
+  auto len = buffer.size() - LWS_PRE;
+  if (lws_write(session.wsi, &buffer[LWS_PRE], len, LWS_WRITE_TEXT) < len) {
+    LOG(ERROR) << "Failed to write to the operator for " << session.device_id;
+  }
+  session.write_queue.pop_front();
+  if (!session.write_queue.empty()) {
+    lws_callback_on_writable(session.wsi);
+  }
+}
+
+int LoadGenerator::Callback(struct lws* wsi, enum lws_callback_reasons reason,
+                            void* in, size_t len) {
+  if (stopping_) {
+    return 0;
+  }
+  auto it = sessions_by_wsi_.find(wsi);
+  if (it == sessions_by_wsi_.end()) {
+    return 0;
+  }
+  auto& session = *it->second;
+  switch (reason) {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+      pending_connections_--;
+      StartPendingConnections();
+      OnEstablished(session);
+      break;
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+      LOG(ERROR) << "Failed to connect for " << session.device_id << ": "
+                 << (in ? (const char*)in : "(null)");
+      pending_connections_--;
+      sessions_by_wsi_.erase(it);
+      Finish(session, /* failed */ true);
+      StartPendingConnections();
+      break;
+    case LWS_CALLBACK_CLIENT_RECEIVE: {
+      session.receive_buffer.append((const char*)in, len);
+      if (!lws_is_final_fragment(wsi) || lws_remaining_packet_payload(wsi)) {
+        break;
+      }
+      Json::Value message;
+      Json::CharReaderBuilder builder;
+      std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
+      std::string error;
+      const auto& data = session.receive_buffer;
+      if (json_reader->parse(data.data(), data.data() + data.size(), &message,
+                             &error)) {
+        OnMessage(session, message);
+      } else {
+        LOG(ERROR) << "Received invalid JSON: " << error;
+        errors_++;
+      }
+      session.receive_buffer.clear();
+      break;
+    }
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+      OnWritable(session);
+      break;
+    case LWS_CALLBACK_CLIENT_CLOSED:
+      if (!session.done) {
+        LOG(ERROR) << "The operator closed the connection for "
+                   << session.device_id;
+      }
+      sessions_by_wsi_.erase(it);
+      Finish(session, /* failed */ true);
+      break;
+    default:
+      break;
+  }
+  return 0;
+}
+
+std::string Milliseconds(nanoseconds duration) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2)
+     << std::chrono::duration<double, std::milli>(duration).count() << "ms";
+  return ss.str();
+}
+
+void PrintPercentiles(const std::string& name,
+                      std::vector<nanoseconds> latencies) {
+  std::cout << std::left << std::setw(22) << name << std::right;
+  if (latencies.empty()) {
+    std::cout << std::setw(10) << "-" << "\n";
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  for (double percentile : {0.5, 0.9, 0.99}) {
+    auto index = (std::size_t)(percentile * (latencies.size() - 1));
+    std::cout << std::setw(12) << Milliseconds(latencies[index]);
+  }
+  std::cout << std::setw(12) << Milliseconds(latencies.back()) << std::setw(10)
+            << latencies.size() << "\n";
+}
+
+void LoadGenerator::Report() const {
+  std::cout << "Devices: " << registered_devices_ << " registered, "
+            << failed_devices_ << " failed\n"
+            << "Clients: " << client_connection_.size() << " connected, "
+            << failed_clients_ << " failed\n"
+            << "Errors from the operator: " << errors_ << "\n"
+            << "Ran for " << std::fixed << std::setprecision(1)
+            << std::chrono::duration<double>(elapsed_).count() << "s\n\n";
+  std::cout << std::left << std::setw(22) << "" << std::right << std::setw(12)
+            << "p50" << std::setw(12) << "p90" << std::setw(12) << "p99"
+            << std::setw(12) << "max" << std::setw(10) << "count"
+            << "\n";
+  PrintPercentiles("device registration", device_registration_);
+  PrintPercentiles("client connection", client_connection_);
+  PrintPercentiles("client to device", client_to_device_);
+  PrintPercentiles("device to client", device_to_client_);
+}
+
+int LwsCallback(struct lws* wsi, enum lws_callback_reasons reason, void* user,
+                void* in, size_t len) {
+  auto context = lws_get_context(wsi);
+  auto generator =
+      context ? reinterpret_cast<LoadGenerator*>(lws_context_user(context))
+              : nullptr;
+  if (!generator) {
+    return lws_callback_http_dummy(wsi, reason, user, in, len);
+  }
+  return generator->Callback(wsi, reason, in, len);
+}
+
+// Every session takes a file descriptor
+void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+      PLOG(WARNING) << "Failed to raise the open files limit";
+    }
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  lws_set_log_level(LLL_ERR, nullptr);
+  cuttlefish::RaiseFileLimit();
+
+  cuttlefish::LoadGenerator generator;
+  auto result = generator.Run();
+  generator.Report();
+  if (!result.ok()) {
+    LOG(ERROR) << result.error().Message();
+    return 1;
+  }
+  return 0;
+}
@@ -13,8 +13,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <map>
 #include <string>
+#include <thread>
 
 #include <android-base/logging.h>
 #include <gflags/gflags.h>
@@ -36,6 +38,12 @@ DEFINE_string(certs_dir, "webrtc/certs",
               "server.key file and (optionally) a CA.crt file.");
 DEFINE_string(stun_server, "stun.l.google.com:19302",
               "host:port of STUN server to use for public address resolution");
+DEFINE_uint32(event_loops, 1,
+              "How many threads service the connections, each owning the "
+              "connections it accepts. 0 for one per core.");
+DEFINE_uint32(registry_shards, cuttlefish::DeviceRegistry::kDefaultShards,
+              "How many independently locked shards the devices are spread "
+              "over.");
 
 namespace {
 
@@ -53,7 +61,7 @@ int main(int argc, char** argv) {
   cuttlefish::DefaultSubprocessLogging(argv);
   ::gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  cuttlefish::DeviceRegistry device_registry;
+  cuttlefish::DeviceRegistry device_registry(FLAGS_registry_shards);
   cuttlefish::PollConnectionStore poll_store;
   cuttlefish::ServerConfig server_config({FLAGS_stun_server});
 
@@ -108,6 +116,10 @@ int main(int argc, char** argv) {
             new cuttlefish::PollHandler(wsi, &poll_store));
       });
 
-  wss.Serve();
+  auto event_loops = FLAGS_event_loops;
+  if (event_loops == 0) {
+    event_loops = std::max(1u, std::thread::hardware_concurrency());
+  }
+  wss.Serve(event_loops);
   return 0;
 }
@@ -0,0 +1,114 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/frontend/webrtc_operator/device_handler.h"
+#include "host/frontend/webrtc_operator/device_registry.h"
+#include "host/frontend/webrtc_operator/server_config.h"
+
+namespace cuttlefish {
+namespace {
+
+class DeviceRegistryTest : public testing::TestWithParam<std::size_t> {
+ protected:
+  DeviceRegistryTest() : registry_(GetParam()) {}
+
+  // The handlers never touch their connection unless they receive messages
+  std::shared_ptr<DeviceHandler> NewDevice() {
+    return std::make_shared<DeviceHandler>(nullptr, &registry_, config_);
+  }
+
+  ServerConfig config_{{}};
+  DeviceRegistry registry_;
+};
+
+TEST_P(DeviceRegistryTest, FindsDevicesInEveryShard) {
+  std::vector<std::shared_ptr<DeviceHandler>> devices;
+  std::vector<std::string> ids;
+  for (int i = 0; i < 100; i++) {
+    devices.push_back(NewDevice());
+    ids.push_back("device_" + std::to_string(i));
+    ASSERT_TRUE(registry_.RegisterDevice(ids.back(), devices.back()));
+  }
+  for (std::size_t i = 0; i < ids.size(); i++) {
+    EXPECT_EQ(registry_.GetDevice(ids[i]), devices[i]) << ids[i];
+  }
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(registry_.ListDeviceIds(), ids);
+
+  registry_.UnRegisterDevice("device_7");
+  EXPECT_EQ(registry_.GetDevice("device_7"), nullptr);
+  EXPECT_EQ(registry_.ListDeviceIds().size(), ids.size() - 1);
+}
+
+TEST_P(DeviceRegistryTest, RejectsDuplicateIds) {
+  auto first = NewDevice();
+  auto second = NewDevice();
+  ASSERT_TRUE(registry_.RegisterDevice("device", first));
+  EXPECT_FALSE(registry_.RegisterDevice("device", second));
+  EXPECT_EQ(registry_.GetDevice("device"), first);
+}
+
+TEST_P(DeviceRegistryTest, DropsDestroyedDevicesOnLookup) {
+  auto device = NewDevice();
+  ASSERT_TRUE(registry_.RegisterDevice("device", device));
+  device.reset();
+
+  EXPECT_EQ(registry_.ListDeviceIds(), std::vector<std::string>({"device"}));
+  EXPECT_EQ(registry_.GetDevice("device"), nullptr);
+  EXPECT_TRUE(registry_.ListDeviceIds().empty());
+  // The id is free for a new device
+  auto replacement = NewDevice();
+  EXPECT_TRUE(registry_.RegisterDevice("device", replacement));
+  EXPECT_EQ(registry_.GetDevice("device"), replacement);
+}
+
+TEST_P(DeviceRegistryTest, RegistersFromManyThreads) {
+  constexpr int kThreads = 8;
+  constexpr int kDevicesPerThread = 50;
+  std::vector<std::shared_ptr<DeviceHandler>> devices;
+  for (int i = 0; i < kThreads * kDevicesPerThread; i++) {
+    devices.push_back(NewDevice());
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, &devices, t]() {
+      for (int i = t * kDevicesPerThread; i < (t + 1) * kDevicesPerThread;
+           i++) {
+        auto id = "device_" + std::to_string(i);
+        EXPECT_TRUE(registry_.RegisterDevice(id, devices[i]));
+        EXPECT_EQ(registry_.GetDevice(id), devices[i]);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(registry_.ListDeviceIds().size(), devices.size());
+}
+
+// 0 shards is taken as 1
+INSTANTIATE_TEST_SUITE_P(Shards, DeviceRegistryTest,
+                         testing::Values(0, 1, DeviceRegistry::kDefaultShards));
+
+}  // namespace
+}  // namespace cuttlefish
@@ -15,12 +15,52 @@
  */
 #include "host/libs/allocd/alloc_utils.h"
 
+#include <grp.h>
+
+#include <cctype>
 #include <cstdint>
 #include <fstream>
 
 #include "android-base/logging.h"
+#include "host/libs/allocd/netlink_batch.h"
 
 namespace cuttlefish {
+namespace {
+
+constexpr char kTapGroup[] = "cvdnetwork";
+
+// Commits a batch and logs the operations that failed. Returns true when all
+// of them succeeded.
+bool CommitBatch(NetlinkBatch& batch, const std::string& description) {
+  bool ok = true;
+  for (const auto& result : batch.Commit()) {
+    if (!result.ok()) {
+      LOG(WARNING) << description << ": " << result.error().Message();
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Parses the "/NN" suffix the gateway functions are given.
+std::optional<int> PrefixLength(const std::string& netmask) {
+  if (netmask.size() < 2 || netmask[0] != '/') {
+    return std::nullopt;
+  }
+  int prefix_len = 0;
+  for (size_t i = 1; i < netmask.size(); i++) {
+    if (!isdigit(netmask[i])) {
+      return std::nullopt;
+    }
+    prefix_len = prefix_len * 10 + (netmask[i] - '0');
+  }
+  if (prefix_len > 32) {
+    return std::nullopt;
+  }
+  return prefix_len;
+}
+
+}  // namespace
 
 int RunExternalCommand(const std::string& command) {
   FILE* fp;
@@ -50,32 +90,32 @@ int RunExternalCommand(const std::string& command) {
 }
 
 bool AddTapIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip tuntap add dev " << name << " mode tap group cvdnetwork vnet_hdr";
-  auto add_command = ss.str();
-  LOG(INFO) << "Create tap interface: " << add_command;
-  int status = RunExternalCommand(add_command);
-  return status == 0;
+  LOG(INFO) << "Create tap interface: " << name;
+  group* tap_group = getgrnam(kTapGroup);
+  if (tap_group == nullptr) {
+    LOG(WARNING) << "No group named " << kTapGroup;
+    return false;
+  }
+  auto res = CreatePersistentTap(name, tap_group->gr_gid);
+  if (!res.ok()) {
+    LOG(WARNING) << res.error().Message();
+    return false;
+  }
+  return true;
 }
 
 bool ShutdownIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << name << " down";
-  auto link_command = ss.str();
-  LOG(INFO) << "Shutdown tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
-
-  return status == 0;
+  LOG(INFO) << "Shutdown tap interface: " << name;
+  NetlinkBatch batch;
+  batch.SetDown(name);
+  return CommitBatch(batch, "Shutdown " + name);
 }
 
 bool BringUpIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << name << " up";
-  auto link_command = ss.str();
-  LOG(INFO) << "Bring up tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
-
-  return status == 0;
+  LOG(INFO) << "Bring up tap interface: " << name;
+  NetlinkBatch batch;
+  batch.SetUp(name);
+  return CommitBatch(batch, "Bring up " + name);
 }
 
 bool CreateEthernetIface(const std::string& name, const std::string& bridge_name,
@@ -85,7 +125,8 @@ bool CreateEthernetIface(const std::string& name, const std::string& bridge_name
 
   EthernetNetworkConfig config{false, false, false};
 
-  if (!CreateTap(name)) {
+  // Linking the tap to the bridge brings it up
+  if (!AddTapIface(name)) {
     return false;
   }
 
@@ -139,12 +180,17 @@ bool CreateMobileIface(const std::string& name, uint16_t id,
   auto gateway = MobileGatewayName(ipaddr, id);
   auto network = MobileNetworkName(ipaddr, netmask, id);
 
-  if (!CreateTap(name)) {
+  if (!AddTapIface(name)) {
     return false;
   }
 
-  if (!AddGateway(name, gateway, netmask)) {
+  // Bring the tap up and assign the gateway in one transaction
+  NetlinkBatch batch;
+  batch.SetUp(name);
+  batch.AddAddress(name, gateway, *PrefixLength(netmask));
+  if (!CommitBatch(batch, "Setup mobile interface " + name)) {
     DestroyIface(name);
+    return false;
   }
 
   if (!IptableConfig(network, true)) {
@@ -174,24 +220,28 @@ bool DestroyMobileIface(const std::string& name, uint16_t id,
 
 bool AddGateway(const std::string& name, const std::string& gateway,
                 const std::string& netmask) {
-  std::stringstream ss;
-  ss << "ip addr add " << gateway << netmask << " broadcast + dev " << name;
-  auto command = ss.str();
-  LOG(INFO) << "setup gateway: " << command;
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  LOG(INFO) << "setup gateway: " << gateway << netmask << " on " << name;
+  auto prefix_len = PrefixLength(netmask);
+  if (!prefix_len) {
+    LOG(WARNING) << "Invalid netmask: " << netmask;
+    return false;
+  }
+  NetlinkBatch batch;
+  batch.AddAddress(name, gateway, *prefix_len);
+  return CommitBatch(batch, "Add gateway to " + name);
 }
 
 bool DestroyGateway(const std::string& name, const std::string& gateway,
                     const std::string& netmask) {
-  std::stringstream ss;
-  ss << "ip addr del " << gateway << netmask << " broadcast + dev " << name;
-  auto command = ss.str();
-  LOG(INFO) << "removing gateway: " << command;
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  LOG(INFO) << "removing gateway: " << gateway << netmask << " from " << name;
+  auto prefix_len = PrefixLength(netmask);
+  if (!prefix_len) {
+    LOG(WARNING) << "Invalid netmask: " << netmask;
+    return false;
+  }
+  NetlinkBatch batch;
+  batch.DeleteAddress(name, gateway, *prefix_len);
+  return CommitBatch(batch, "Remove gateway from " + name);
 }
 
 bool DestroyEthernetIface(const std::string& name, bool has_ipv4_bridge,
@@ -273,12 +323,9 @@ bool EbtablesFilter(const std::string& name, bool use_ipv4, bool add,
 
 bool LinkTapToBridge(const std::string& tap_name,
                      const std::string& bridge_name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << tap_name << " master " << bridge_name;
-  auto command = ss.str();
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  NetlinkBatch batch;
+  batch.SetMaster(tap_name, bridge_name);
+  return CommitBatch(batch, "Link " + tap_name + " to " + bridge_name);
 }
 
 bool CreateTap(const std::string& name) {
@@ -298,25 +345,26 @@ bool CreateTap(const std::string& name) {
 }
 
 bool DeleteIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link delete " << name;
-  auto link_command = ss.str();
-  LOG(INFO) << "Delete tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
-
-  return status == 0;
+  LOG(INFO) << "Delete tap interface: " << name;
+  NetlinkBatch batch;
+  batch.DeleteLink(name);
+  return CommitBatch(batch, "Delete " + name);
 }
 
 bool DestroyIface(const std::string& name) {
-  if (!ShutdownIface(name)) {
-    LOG(WARNING) << "Failed to shutdown tap interface: " << name;
-    // the interface might have already shutdown ... so ignore and try to remove
-    // the interface. In the future we could read from the pipe and handle this
-    // case more elegantly
-  }
-
-  if (!DeleteIface(name)) {
-    LOG(WARNING) << "Failed to delete tap interface: " << name;
+  NetlinkBatch batch;
+  batch.SetDown(name);
+  batch.DeleteLink(name);
+  auto results = batch.Commit();
+  if (!results[0].ok()) {
+    // the interface might have already shutdown, so only the deletion matters
+    LOG(WARNING) << "Failed to shutdown tap interface " << name << ": "
+                 << results[0].error().Message();
+  }
+
+  if (!results[1].ok()) {
+    LOG(WARNING) << "Failed to delete tap interface " << name << ": "
+                 << results[1].error().Message();
     return false;
   }
 
@@ -333,19 +381,10 @@ std::optional<std::string> GetUserName(uid_t uid) {
 }
 
 bool CreateBridge(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link add name " << name
-     << " type bridge forward_delay 0 stp_state 0";
-
-  auto command = ss.str();
-  LOG(INFO) << "create bridge: " << command;
-  int status = RunExternalCommand(command);
-
-  if (status != 0) {
-    return false;
-  }
-
-  return BringUpIface(name);
+  LOG(INFO) << "create bridge: " << name;
+  NetlinkBatch batch;
+  batch.AddBridge(name);
+  return CommitBatch(batch, "Create bridge " + name);
 }
 
 bool DestroyBridge(const std::string& name) { return DeleteIface(name); }
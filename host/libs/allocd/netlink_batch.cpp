@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host/libs/allocd/netlink_batch.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/if_tun.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/net/netlink_request.h"
+
+namespace cuttlefish {
+namespace {
+
+// Keeps each sendmsg well below the default socket buffer size
+constexpr size_t kMaxBatchBytes = 32 * 1024;
+// Room for the acknowledgements of a full batch
+constexpr size_t kReceiveBufferSize = 64 * 1024;
+
+Result<in_addr> ParseAddress(const std::string& address) {
+  in_addr parsed;
+  CF_EXPECT(inet_pton(AF_INET, address.c_str(), &parsed) == 1,
+            "Invalid IPv4 address \"" << address << "\"");
+  return parsed;
+}
+
+Result<int> InterfaceIndex(const std::string& name) {
+  unsigned index = if_nametoindex(name.c_str());
+  CF_EXPECT(index != 0, "No interface named \"" << name << "\"");
+  return static_cast<int>(index);
+}
+
+std::string ExtendedAckMessage(const nlmsghdr* header) {
+  if (!(header->nlmsg_flags & NLM_F_ACK_TLVS)) {
+    return "";
+  }
+  auto err = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(header));
+  // With NETLINK_CAP_ACK the request isn't echoed unless it failed
+  size_t offset = NLMSG_ALIGN(sizeof(nlmsgerr));
+  if (!(header->nlmsg_flags & NLM_F_CAPPED)) {
+    offset += NLMSG_ALIGN(err->msg.nlmsg_len - sizeof(nlmsghdr));
+  }
+  size_t payload = header->nlmsg_len - NLMSG_HDRLEN;
+  auto data = reinterpret_cast<const char*>(err);
+  while (offset + NLA_HDRLEN <= payload) {
+    auto attr = reinterpret_cast<const nlattr*>(data + offset);
+    if (attr->nla_len < NLA_HDRLEN || offset + attr->nla_len > payload) {
+      break;
+    }
+    if (attr->nla_type == NLMSGERR_ATTR_MSG) {
+      return std::string(data + offset + NLA_HDRLEN,
+                         strnlen(data + offset + NLA_HDRLEN,
+                                 attr->nla_len - NLA_HDRLEN));
+    }
+    offset += NLA_ALIGN(attr->nla_len);
+  }
+  return "";
+}
+
+class Transaction {
+ public:
+  Transaction(std::vector<Result<void>>& results) : results_(results) {
+    fd_ = SharedFD::Socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (!fd_->IsOpen()) {
+      return;
+    }
+    // Both are optional: without them the errors are less descriptive and
+    // the acknowledgements larger.
+    int one = 1;
+    fd_->SetSockOpt(SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+    fd_->SetSockOpt(SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+  }
+
+  Result<void> Open() const {
+    CF_EXPECT(fd_->IsOpen(),
+              "Failed to open an rtnetlink socket: " << fd_->StrError());
+    return {};
+  }
+
+  bool HasPending() const { return !pending_.empty(); }
+
+  void Queue(NetlinkRequest request, size_t op) {
+    pending_bytes_ += request.RequestLength();
+    pending_ops_.push_back(op);
+    pending_.emplace_back(std::move(request));
+    if (pending_bytes_ >= kMaxBatchBytes) {
+      Flush();
+    }
+  }
+
+  // Sends the queued requests in one message and collects their results.
+  void Flush() {
+    if (pending_.empty()) {
+      return;
+    }
+    auto res = SendAndReceive();
+    if (!res.ok()) {
+      for (auto op : pending_ops_) {
+        if (results_[op].ok()) {
+          results_[op] = CF_ERR(res.error().Message());
+        }
+      }
+    }
+    pending_.clear();
+    pending_ops_.clear();
+    pending_bytes_ = 0;
+  }
+
+ private:
+  Result<void> SendAndReceive() {
+    std::vector<iovec> iov;
+    iov.reserve(pending_.size());
+    for (const auto& request : pending_) {
+      iov.push_back({request.RequestData(), request.RequestLength()});
+    }
+    sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    msghdr msg = {};
+    msg.msg_name = &kernel;
+    msg.msg_namelen = sizeof(kernel);
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov.size();
+    CF_EXPECT(fd_->SendMsg(&msg, 0) >= 0,
+              "Failed to send netlink messages: " << fd_->StrError());
+
+    size_t unanswered = pending_.size();
+    std::vector<char> buffer(kReceiveBufferSize);
+    while (unanswered > 0) {
+      iovec recv_iov = {buffer.data(), buffer.size()};
+      msghdr recv_msg = {};
+      recv_msg.msg_iov = &recv_iov;
+      recv_msg.msg_iovlen = 1;
+      auto received = fd_->RecvMsg(&recv_msg, 0);
+      CF_EXPECT(received >= 0,
+                "Failed to receive netlink responses: " << fd_->StrError());
+      CF_EXPECT(!(recv_msg.msg_flags & MSG_TRUNC),
+                "Netlink response truncated");
+      unsigned len = static_cast<unsigned>(received);
+      for (auto header = reinterpret_cast<nlmsghdr*>(buffer.data());
+           NLMSG_OK(header, len); header = NLMSG_NEXT(header, len)) {
+        if (header->nlmsg_type != NLMSG_ERROR) {
+          continue;
+        }
+        auto op = OpForSequence(header->nlmsg_seq);
+        if (op == nullptr) {
+          LOG(WARNING) << "Unexpected netlink sequence number "
+                       << header->nlmsg_seq;
+          continue;
+        }
+        auto err = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(header));
+        if (err->error != 0) {
+          auto detail = ExtendedAckMessage(header);
+          results_[*op] = CF_ERR(strerror(-err->error)
+                                 << (detail.empty() ? "" : ": ") << detail);
+        }
+        unanswered--;
+      }
+    }
+    return {};
+  }
+
+  const size_t* OpForSequence(uint32_t seq) const {
+    for (size_t i = 0; i < pending_.size(); i++) {
+      if (pending_[i].SeqNo() == seq) {
+        return &pending_ops_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<Result<void>>& results_;
+  SharedFD fd_;
+  std::vector<NetlinkRequest> pending_;
+  std::vector<size_t> pending_ops_;
+  size_t pending_bytes_ = 0;
+};
+
+// Messages that address the link by name, which the kernel resolves when it
+// gets to them.
+NetlinkRequest LinkRequest(int type, int flags, const std::string& name,
+                           bool up) {
+  NetlinkRequest request(type, flags);
+  request.AddIfInfo(0, up);
+  request.AddString(IFLA_IFNAME, name);
+  return request;
+}
+
+Result<NetlinkRequest> AddressRequest(int type, int flags,
+                                      const std::string& name,
+                                      const std::string& address,
+                                      int prefix_len) {
+  CF_EXPECT(prefix_len >= 0 && prefix_len <= 32,
+            "Invalid prefix length " << prefix_len);
+  auto local = CF_EXPECT(ParseAddress(address));
+  NetlinkRequest request(type, flags);
+  request.AddAddrInfo(CF_EXPECT(InterfaceIndex(name)), prefix_len);
+  request.AddInt(IFA_LOCAL, local.s_addr);
+  request.AddInt(IFA_ADDRESS, local.s_addr);
+  // What `ip addr add ... broadcast +` does
+  if (prefix_len < 31) {
+    uint32_t host_mask = prefix_len == 0 ? ~0u : ~0u >> prefix_len;
+    request.AddInt(IFA_BROADCAST, local.s_addr | htonl(host_mask));
+  }
+  return request;
+}
+
+}  // namespace
+
+void NetlinkBatch::AddBridge(const std::string& name) {
+  ops_.push_back({.type = OpType::kAddBridge, .name = name});
+}
+
+void NetlinkBatch::SetUp(const std::string& name) {
+  ops_.push_back({.type = OpType::kSetUp, .name = name});
+}
+
+void NetlinkBatch::SetDown(const std::string& name) {
+  ops_.push_back({.type = OpType::kSetDown, .name = name});
+}
+
+void NetlinkBatch::SetMaster(const std::string& name,
+                             const std::string& master) {
+  ops_.push_back(
+      {.type = OpType::kSetMaster, .name = name, .argument = master});
+}
+
+void NetlinkBatch::DeleteLink(const std::string& name) {
+  ops_.push_back({.type = OpType::kDeleteLink, .name = name});
+}
+
+void NetlinkBatch::AddAddress(const std::string& name,
+                              const std::string& address, int prefix_len) {
+  ops_.push_back({.type = OpType::kAddAddress,
+                  .name = name,
+                  .argument = address,
+                  .prefix_len = prefix_len});
+}
+
+void NetlinkBatch::DeleteAddress(const std::string& name,
+                                 const std::string& address, int prefix_len) {
+  ops_.push_back({.type = OpType::kDeleteAddress,
+                  .name = name,
+                  .argument = address,
+                  .prefix_len = prefix_len});
+}
+
+std::vector<Result<void>> NetlinkBatch::Commit() {
+  std::vector<Op> ops;
+  std::swap(ops, ops_);
+  std::vector<Result<void>> results(ops.size());
+  Transaction transaction(results);
+  if (auto open = transaction.Open(); !open.ok()) {
+    for (auto& result : results) {
+      result = CF_ERR(open.error().Message());
+    }
+    return results;
+  }
+
+  for (size_t i = 0; i < ops.size(); i++) {
+    const auto& op = ops[i];
+    auto build = [&op]() -> Result<NetlinkRequest> {
+      switch (op.type) {
+        case OpType::kAddBridge: {
+          auto request = LinkRequest(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL,
+                                     op.name, true);
+          request.PushList(IFLA_LINKINFO);
+          request.AddString(IFLA_INFO_KIND, "bridge");
+          request.PushList(IFLA_INFO_DATA);
+          request.AddInt(IFLA_BR_FORWARD_DELAY, uint32_t{0});
+          request.AddInt(IFLA_BR_STP_STATE, uint32_t{0});
+          request.PopList();
+          request.PopList();
+          return request;
+        }
+        case OpType::kSetUp:
+          return LinkRequest(RTM_NEWLINK, 0, op.name, true);
+        case OpType::kSetDown:
+          return LinkRequest(RTM_NEWLINK, 0, op.name, false);
+        case OpType::kSetMaster: {
+          auto master = CF_EXPECT(InterfaceIndex(op.argument));
+          auto request = LinkRequest(RTM_NEWLINK, 0, op.name, true);
+          request.AddInt(IFLA_MASTER, master);
+          return request;
+        }
+        case OpType::kDeleteLink:
+          return LinkRequest(RTM_DELLINK, 0, op.name, false);
+        case OpType::kAddAddress:
+          return CF_EXPECT(AddressRequest(RTM_NEWADDR,
+                                          NLM_F_CREATE | NLM_F_EXCL, op.name,
+                                          op.argument, op.prefix_len));
+        case OpType::kDeleteAddress:
+          return CF_EXPECT(AddressRequest(RTM_DELADDR, 0, op.name,
+                                          op.argument, op.prefix_len));
+      }
+      return CF_ERR("Unknown operation");
+    };
+    auto request = build();
+    if (!request.ok() && transaction.HasPending()) {
+      // The interface may be created by one of the queued messages
+      transaction.Flush();
+      auto retried = build();
+      if (retried.ok()) {
+        transaction.Queue(std::move(*retried), i);
+        continue;
+      }
+    }
+    if (!request.ok()) {
+      results[i] = CF_ERR(request.error().Message());
+      continue;
+    }
+    transaction.Queue(std::move(*request), i);
+  }
+  transaction.Flush();
+  return results;
+}
+
+Result<void> CreatePersistentTap(const std::string& name, gid_t group) {
+  CF_EXPECT(name.size() < IFNAMSIZ, "Interface name too long: " << name);
+  auto tun = SharedFD::Open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+  CF_EXPECT(tun->IsOpen(), "Failed to open /dev/net/tun: " << tun->StrError());
+
+  ifreq ifr = {};
+  strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  CF_EXPECT(tun->Ioctl(TUNSETIFF, &ifr) == 0,
+            "Failed to create tap \"" << name << "\": " << tun->StrError());
+  CF_EXPECT(tun->Ioctl(TUNSETGROUP, reinterpret_cast<void*>(
+                                        static_cast<uintptr_t>(group))) == 0,
+            "Failed to set the group of \"" << name
+                                            << "\": " << tun->StrError());
+  CF_EXPECT(tun->Ioctl(TUNSETPERSIST, reinterpret_cast<void*>(1)) == 0,
+            "Failed to make \"" << name
+                                << "\" persistent: " << tun->StrError());
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * Queues link and address changes and sends them to the kernel over
+ * rtnetlink, replacing one `ip` process per change with a single sendmsg
+ * for the whole batch.
+ *
+ * The kernel processes the messages of a batch in order and carries on
+ * after a failed one, so Commit() reports a result per queued operation.
+ * Interfaces are named rather than indexed, so an operation can refer to a
+ * link created earlier in the same batch; when that needs an index the
+ * messages queued before it are sent first.
+ */
+class NetlinkBatch {
+ public:
+  // Creates a bridge that forwards without delay and doesn't run STP, and
+  // brings it up.
+  void AddBridge(const std::string& name);
+  void SetUp(const std::string& name);
+  void SetDown(const std::string& name);
+  // Brings `name` up as a port of `master`.
+  void SetMaster(const std::string& name, const std::string& master);
+  void DeleteLink(const std::string& name);
+  // Assigns an IPv4 address, with the broadcast address of its network.
+  void AddAddress(const std::string& name, const std::string& address,
+                  int prefix_len);
+  void DeleteAddress(const std::string& name, const std::string& address,
+                     int prefix_len);
+
+  size_t Size() const { return ops_.size(); }
+
+  // Sends the queued operations and empties the batch. The results are in
+  // the order the operations were queued.
+  std::vector<Result<void>> Commit();
+
+ private:
+  enum class OpType {
+    kAddBridge,
+    kSetUp,
+    kSetDown,
+    kSetMaster,
+    kDeleteLink,
+    kAddAddress,
+    kDeleteAddress,
+  };
+  struct Op {
+    OpType type;
+    std::string name;
+    // The master for kSetMaster, the address for the address operations
+    std::string argument;
+    int prefix_len = 0;
+  };
+
+  std::vector<Op> ops_;
+};
+
+// Creates a persistent tap interface with a virtio net header, which members
+// of `group` can open. Taps are made through /dev/net/tun, not rtnetlink.
+Result<void> CreatePersistentTap(const std::string& name, gid_t group);
+
+}  // namespace cuttlefish
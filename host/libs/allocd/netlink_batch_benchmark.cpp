@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares creating and destroying bridges through `ip`, as allocd used to,
+// with doing it in netlink batches. Runs in a network namespace of its own.
+// Real time is what matters, as most of the work of `ip` happens in child
+// processes and all of it in the kernel.
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "host/libs/allocd/alloc_utils.h"
+#include "host/libs/allocd/netlink_batch.h"
+
+namespace cuttlefish {
+namespace {
+
+std::string BridgeName(int i) { return "cvd-bench-" + std::to_string(i); }
+
+void BM_ShellBridges(benchmark::State& state) {
+  for (auto _ : state) {
+    for (int i = 0; i < state.range(0); i++) {
+      auto name = BridgeName(i);
+      CHECK(RunExternalCommand("ip link add name " + name +
+                               " type bridge forward_delay 0 stp_state 0") ==
+            0);
+      CHECK(RunExternalCommand("ip link set dev " + name + " up") == 0);
+    }
+    for (int i = 0; i < state.range(0); i++) {
+      auto name = BridgeName(i);
+      CHECK(RunExternalCommand("ip link set dev " + name + " down") == 0);
+      CHECK(RunExternalCommand("ip link delete " + name) == 0);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ShellBridges)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+void BM_NetlinkBridges(benchmark::State& state) {
+  NetlinkBatch batch;
+  for (auto _ : state) {
+    for (int i = 0; i < state.range(0); i++) {
+      batch.AddBridge(BridgeName(i));
+    }
+    for (const auto& result : batch.Commit()) {
+      CHECK(result.ok()) << result.error().Message();
+    }
+    for (int i = 0; i < state.range(0); i++) {
+      batch.SetDown(BridgeName(i));
+      batch.DeleteLink(BridgeName(i));
+    }
+    for (const auto& result : batch.Commit()) {
+      CHECK(result.ok()) << result.error().Message();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_NetlinkBridges)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+void EnterNetworkNamespace() {
+  std::string uid_map = std::to_string(getuid()) + " " +
+                        std::to_string(getuid()) + " 1";
+  std::string gid_map = std::to_string(getgid()) + " " +
+                        std::to_string(getgid()) + " 1";
+  if (unshare(CLONE_NEWUSER | CLONE_NEWNET) == 0) {
+    CHECK(android::base::WriteStringToFile("deny", "/proc/self/setgroups"));
+    CHECK(android::base::WriteStringToFile(uid_map, "/proc/self/uid_map"));
+    CHECK(android::base::WriteStringToFile(gid_map, "/proc/self/gid_map"));
+    return;
+  }
+  // User namespaces may be disabled, which root can do without
+  PCHECK(unshare(CLONE_NEWNET) == 0) << "Failed to make a network namespace";
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  // The commands would be logged for every bridge
+  android::base::SetMinimumLogSeverity(android::base::WARNING);
+  cuttlefish::EnterNetworkNamespace();
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+// The tests change links, so they run in a network namespace of their own.
+// A user namespace gives them CAP_NET_ADMIN there without privileges on the
+// host.
+bool EnterNetworkNamespace() {
+  std::string uid_map = std::to_string(getuid()) + " " +
+                        std::to_string(getuid()) + " 1";
+  std::string gid_map = std::to_string(getgid()) + " " +
+                        std::to_string(getgid()) + " 1";
+  if (unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0) {
+    PLOG(WARNING) << "Failed to create user and network namespaces";
+    return false;
+  }
+  return android::base::WriteStringToFile("deny", "/proc/self/setgroups") &&
+         android::base::WriteStringToFile(uid_map, "/proc/self/uid_map") &&
+         android::base::WriteStringToFile(gid_map, "/proc/self/gid_map");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (!EnterNetworkNamespace()) {
+    LOG(WARNING) << "Tests that change links will be skipped";
+  }
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,206 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/allocd/netlink_batch.h"
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/libs/allocd/alloc_utils.h"
+
+namespace cuttlefish {
+namespace {
+
+class NetlinkBatchTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Only change links in the namespace made by main(), which starts with
+    // nothing but the loopback interface.
+    auto interfaces = if_nameindex();
+    ASSERT_NE(interfaces, nullptr);
+    bool isolated = interfaces[0].if_name != nullptr &&
+                    std::string(interfaces[0].if_name) == "lo" &&
+                    interfaces[1].if_name == nullptr;
+    if_freenameindex(interfaces);
+    if (!isolated) {
+      GTEST_SKIP() << "Not running in a new network namespace";
+    }
+  }
+
+  void TearDown() override {
+    auto interfaces = if_nameindex();
+    NetlinkBatch batch;
+    for (auto i = interfaces; i && i->if_name; i++) {
+      if (std::string(i->if_name) != "lo") {
+        batch.DeleteLink(i->if_name);
+      }
+    }
+    if_freenameindex(interfaces);
+    batch.Commit();
+  }
+
+  static bool Exists(const std::string& name) {
+    return if_nametoindex(name.c_str()) != 0;
+  }
+
+  static int Flags(const std::string& name) {
+    ifreq ifr = {};
+    strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+    close(fd);
+    return ret == 0 ? ifr.ifr_flags : 0;
+  }
+
+  static std::string LinkDetails(const std::string& name) {
+    std::string output;
+    FILE* ip = popen(("ip -o link show dev " + name).c_str(), "r");
+    if (ip == nullptr) {
+      return output;
+    }
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), ip)) {
+      output += buffer;
+    }
+    pclose(ip);
+    return output;
+  }
+
+  // Returns "address/broadcast" for the IPv4 addresses of `name`.
+  static std::vector<std::string> Addresses(const std::string& name) {
+    std::vector<std::string> addresses;
+    ifaddrs* list;
+    if (getifaddrs(&list) != 0) {
+      return addresses;
+    }
+    for (auto i = list; i; i = i->ifa_next) {
+      if (name != i->ifa_name || !i->ifa_addr ||
+          i->ifa_addr->sa_family != AF_INET) {
+        continue;
+      }
+      char address[INET_ADDRSTRLEN] = {};
+      char broadcast[INET_ADDRSTRLEN] = {};
+      inet_ntop(AF_INET, &((sockaddr_in*)i->ifa_addr)->sin_addr, address,
+                sizeof(address));
+      if (i->ifa_broadaddr) {
+        inet_ntop(AF_INET, &((sockaddr_in*)i->ifa_broadaddr)->sin_addr,
+                  broadcast, sizeof(broadcast));
+      }
+      addresses.push_back(std::string(address) + "/" + broadcast);
+    }
+    freeifaddrs(list);
+    return addresses;
+  }
+};
+
+TEST_F(NetlinkBatchTest, CreatesBridgeWithAddress) {
+  NetlinkBatch batch;
+  batch.AddBridge("cvd-br0");
+  // Needs the index of the bridge, which doesn't exist until the first
+  // message is sent
+  batch.AddAddress("cvd-br0", "192.168.96.1", 24);
+  auto results = batch.Commit();
+
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_TRUE(results[0].ok()) << results[0].error().Message();
+  EXPECT_TRUE(results[1].ok()) << results[1].error().Message();
+  EXPECT_EQ(batch.Size(), 0u);
+  EXPECT_TRUE(Flags("cvd-br0") & IFF_UP);
+  EXPECT_EQ(Addresses("cvd-br0"),
+            std::vector<std::string>{"192.168.96.1/192.168.96.255"});
+}
+
+TEST_F(NetlinkBatchTest, ReportsErrorsPerOperation) {
+  NetlinkBatch batch;
+  batch.DeleteLink("cvd-missing");
+  batch.AddBridge("cvd-br0");
+  batch.AddBridge("cvd-br0");
+  batch.AddAddress("cvd-br0", "not an address", 24);
+  batch.SetUp("cvd-br1");
+  batch.AddBridge("cvd-br1");
+  auto results = batch.Commit();
+
+  ASSERT_EQ(results.size(), 6u);
+  EXPECT_FALSE(results[0].ok());
+  EXPECT_TRUE(results[1].ok()) << results[1].error().Message();
+  EXPECT_FALSE(results[2].ok());
+  EXPECT_FALSE(results[3].ok());
+  EXPECT_FALSE(results[4].ok());
+  EXPECT_TRUE(results[5].ok()) << results[5].error().Message();
+  EXPECT_TRUE(Exists("cvd-br1"));
+}
+
+TEST_F(NetlinkBatchTest, SetsMasterAndDeletes) {
+  if (RunExternalCommand("ip link add cvd-v0 type veth peer name cvd-v1")) {
+    GTEST_SKIP() << "Can't create a veth pair to link";
+  }
+  NetlinkBatch batch;
+  batch.AddBridge("cvd-br0");
+  batch.SetMaster("cvd-v0", "cvd-br0");
+  for (const auto& result : batch.Commit()) {
+    EXPECT_TRUE(result.ok()) << result.error().Message();
+  }
+  EXPECT_TRUE(Flags("cvd-v0") & IFF_UP);
+  EXPECT_NE(LinkDetails("cvd-v0").find(" master cvd-br0 "), std::string::npos)
+      << LinkDetails("cvd-v0");
+
+  batch.SetDown("cvd-v0");
+  batch.DeleteLink("cvd-v0");
+  batch.DeleteLink("cvd-br0");
+  for (const auto& result : batch.Commit()) {
+    EXPECT_TRUE(result.ok()) << result.error().Message();
+  }
+  EXPECT_FALSE(Exists("cvd-v0"));
+  EXPECT_FALSE(Exists("cvd-v1"));
+  EXPECT_FALSE(Exists("cvd-br0"));
+}
+
+TEST_F(NetlinkBatchTest, AllocUtilsManageBridgeGateway) {
+  ASSERT_TRUE(CreateBridge("cvd-br0"));
+  EXPECT_FALSE(CreateBridge("cvd-br0"));
+  ASSERT_TRUE(AddGateway("cvd-br0", "192.168.97.1", "/30"));
+  EXPECT_EQ(Addresses("cvd-br0"),
+            std::vector<std::string>{"192.168.97.1/192.168.97.3"});
+  EXPECT_FALSE(AddGateway("cvd-br0", "192.168.97.5", "30"));
+  EXPECT_TRUE(DestroyGateway("cvd-br0", "192.168.97.1", "/30"));
+  EXPECT_TRUE(Addresses("cvd-br0").empty());
+  EXPECT_TRUE(DestroyIface("cvd-br0"));
+  EXPECT_FALSE(Exists("cvd-br0"));
+  EXPECT_FALSE(DestroyIface("cvd-br0"));
+}
+
+TEST_F(NetlinkBatchTest, CreatesPersistentTap) {
+  if (access("/dev/net/tun", R_OK | W_OK) != 0) {
+    GTEST_SKIP() << "Can't open /dev/net/tun";
+  }
+  auto res = CreatePersistentTap("cvd-tap0", getgid());
+  ASSERT_TRUE(res.ok()) << res.error().Message();
+  // Stays after the descriptor that created it is closed
+  EXPECT_TRUE(Exists("cvd-tap0"));
+  EXPECT_TRUE(DestroyIface("cvd-tap0"));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host/libs/boot_image/boot_image.h"
+
+#include <bootimg.h>
+
+#include <cstring>
+#include <sstream>
+
+namespace cuttlefish {
+namespace {
+
+// Boot images from v3 on have a fixed page size
+constexpr uint32_t kBootImagePageSize = 4096;
+
+size_t PageAlign(size_t size, uint32_t page_size) {
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+// Reads the section of `size` bytes at `offset`, returning the offset of the
+// next section.
+Result<size_t> ReadSection(std::string_view image, size_t offset, size_t size,
+                           uint32_t page_size, std::string& out) {
+  CF_EXPECT(offset <= image.size() && size <= image.size() - offset,
+            "Image truncated: section of " << size << " bytes at " << offset
+                                           << " past the end of " << image.size());
+  out = image.substr(offset, size);
+  return PageAlign(offset + size, page_size);
+}
+
+std::string CString(const uint8_t* data, size_t max_size) {
+  auto chars = reinterpret_cast<const char*>(data);
+  return std::string(chars, strnlen(chars, max_size));
+}
+
+Result<void> CopyCString(const std::string& value, uint8_t* out,
+                         size_t max_size, const char* field) {
+  // Leave room for the terminator
+  CF_EXPECT(value.size() < max_size, field << " is longer than "
+                                           << max_size - 1 << " bytes");
+  memcpy(out, value.data(), value.size());
+  return {};
+}
+
+template <typename T>
+Result<T> ReadHeader(std::string_view image) {
+  CF_EXPECT(image.size() >= sizeof(T), "Image too small for its header");
+  T header;
+  memcpy(&header, image.data(), sizeof(T));
+  return header;
+}
+
+void AppendPadded(std::string& out, std::string_view data,
+                  uint32_t page_size) {
+  out += data;
+  out.resize(PageAlign(out.size(), page_size), '\0');
+}
+
+}  // namespace
+
+std::string VendorBootImage::Ramdisk() const {
+  std::string ramdisk;
+  for (const auto& entry : ramdisks) {
+    ramdisk += entry.contents;
+  }
+  return ramdisk;
+}
+
+Result<uint32_t> BootImageHeaderVersion(std::string_view image) {
+  if (image.substr(0, BOOT_MAGIC_SIZE) == BOOT_MAGIC) {
+    // Where all the boot image header versions keep it
+    return CF_EXPECT(ReadHeader<boot_img_hdr_v3>(image)).header_version;
+  }
+  if (image.substr(0, VENDOR_BOOT_MAGIC_SIZE) == VENDOR_BOOT_MAGIC) {
+    return CF_EXPECT(ReadHeader<vendor_boot_img_hdr_v3>(image)).header_version;
+  }
+  return CF_ERR("Not a boot or vendor_boot image");
+}
+
+Result<BootImage> ParseBootImage(std::string_view image) {
+  CF_EXPECT(image.substr(0, BOOT_MAGIC_SIZE) == BOOT_MAGIC,
+            "Not a boot image");
+  auto header = CF_EXPECT(ReadHeader<boot_img_hdr_v3>(image));
+  uint32_t header_version = header.header_version;
+  CF_EXPECT(header_version == 3 || header_version == 4,
+            "Unsupported boot image header version " << header_version);
+  BootImage boot;
+  boot.header_version = header.header_version;
+  boot.os_version = header.os_version;
+  boot.cmdline = CString(header.cmdline, sizeof(header.cmdline));
+  size_t offset = kBootImagePageSize;
+  offset = CF_EXPECT(ReadSection(image, offset, header.kernel_size,
+                                 kBootImagePageSize, boot.kernel));
+  offset = CF_EXPECT(ReadSection(image, offset, header.ramdisk_size,
+                                 kBootImagePageSize, boot.ramdisk));
+  if (header.header_version == 4) {
+    auto v4 = CF_EXPECT(ReadHeader<boot_img_hdr_v4>(image));
+    CF_EXPECT(ReadSection(image, offset, v4.signature_size,
+                          kBootImagePageSize, boot.signature));
+  }
+  return boot;
+}
+
+Result<std::string> WriteBootImage(const BootImage& boot) {
+  CF_EXPECT(boot.header_version == 3 || boot.header_version == 4,
+            "Unsupported boot image header version " << boot.header_version);
+  CF_EXPECT(boot.header_version == 4 || boot.signature.empty(),
+            "Boot image signatures need a v4 header");
+  boot_img_hdr_v4 header = {};
+  memcpy(header.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  header.kernel_size = boot.kernel.size();
+  header.ramdisk_size = boot.ramdisk.size();
+  header.os_version = boot.os_version;
+  header.header_size = boot.header_version == 4 ? sizeof(boot_img_hdr_v4)
+                                                : sizeof(boot_img_hdr_v3);
+  header.header_version = boot.header_version;
+  CF_EXPECT(CopyCString(boot.cmdline, header.cmdline, sizeof(header.cmdline),
+                        "Kernel command line"));
+  header.signature_size = boot.signature.size();
+
+  std::string image;
+  image.reserve(kBootImagePageSize * 3 + boot.kernel.size() +
+                boot.ramdisk.size() + boot.signature.size());
+  AppendPadded(image,
+               std::string_view(reinterpret_cast<const char*>(&header),
+                                header.header_size),
+               kBootImagePageSize);
+  AppendPadded(image, boot.kernel, kBootImagePageSize);
+  AppendPadded(image, boot.ramdisk, kBootImagePageSize);
+  if (boot.header_version == 4) {
+    AppendPadded(image, boot.signature, kBootImagePageSize);
+  }
+  return image;
+}
+
+Result<VendorBootImage> ParseVendorBootImage(std::string_view image) {
+  CF_EXPECT(image.substr(0, VENDOR_BOOT_MAGIC_SIZE) == VENDOR_BOOT_MAGIC,
+            "Not a vendor_boot image");
+  auto header = CF_EXPECT(ReadHeader<vendor_boot_img_hdr_v4>(image));
+  uint32_t header_version = header.header_version;
+  uint32_t page_size = header.page_size;
+  CF_EXPECT(header_version == 3 || header_version == 4,
+            "Unsupported vendor_boot image header version " << header_version);
+  CF_EXPECT(page_size > 0 && (page_size & (page_size - 1)) == 0,
+            "Invalid page size " << page_size);
+  VendorBootImage vendor_boot;
+  vendor_boot.header_version = header.header_version;
+  vendor_boot.page_size = header.page_size;
+  vendor_boot.kernel_addr = header.kernel_addr;
+  vendor_boot.ramdisk_addr = header.ramdisk_addr;
+  vendor_boot.tags_addr = header.tags_addr;
+  vendor_boot.dtb_addr = header.dtb_addr;
+  vendor_boot.name = CString(header.name, sizeof(header.name));
+  vendor_boot.cmdline = CString(header.cmdline, sizeof(header.cmdline));
+
+  size_t offset = PageAlign(header.header_size, page_size);
+  std::string ramdisk;
+  offset = CF_EXPECT(ReadSection(image, offset, header.vendor_ramdisk_size,
+                                 page_size, ramdisk));
+  offset = CF_EXPECT(
+      ReadSection(image, offset, header.dtb_size, page_size, vendor_boot.dtb));
+  if (header.header_version == 3) {
+    vendor_boot.ramdisks.push_back(VendorRamdisk{.contents = ramdisk});
+    return vendor_boot;
+  }
+
+  CF_EXPECT(header.vendor_ramdisk_table_entry_size >=
+                sizeof(vendor_ramdisk_table_entry_v4),
+            "Vendor ramdisk table entries too small");
+  std::string table;
+  offset = CF_EXPECT(ReadSection(image, offset,
+                                 header.vendor_ramdisk_table_size, page_size,
+                                 table));
+  CF_EXPECT((uint64_t)header.vendor_ramdisk_table_entry_num *
+                    header.vendor_ramdisk_table_entry_size <=
+                table.size(),
+            "Vendor ramdisk table too small for its entries");
+  for (uint32_t i = 0; i < header.vendor_ramdisk_table_entry_num; i++) {
+    vendor_ramdisk_table_entry_v4 entry;
+    memcpy(&entry,
+           table.data() + (size_t)i * header.vendor_ramdisk_table_entry_size,
+           sizeof(entry));
+    CF_EXPECT(entry.ramdisk_offset <= ramdisk.size() &&
+                  entry.ramdisk_size <= ramdisk.size() - entry.ramdisk_offset,
+              "Vendor ramdisk " << i << " is out of bounds");
+    VendorRamdisk vendor_ramdisk;
+    vendor_ramdisk.name =
+        CString(entry.ramdisk_name, sizeof(entry.ramdisk_name));
+    vendor_ramdisk.type = entry.ramdisk_type;
+    memcpy(vendor_ramdisk.board_id.data(), entry.board_id,
+           sizeof(entry.board_id));
+    vendor_ramdisk.contents =
+        ramdisk.substr(entry.ramdisk_offset, entry.ramdisk_size);
+    vendor_boot.ramdisks.push_back(std::move(vendor_ramdisk));
+  }
+  CF_EXPECT(ReadSection(image, offset, header.bootconfig_size, page_size,
+                        vendor_boot.bootconfig));
+  return vendor_boot;
+}
+
+Result<std::string> WriteVendorBootImage(const VendorBootImage& vendor_boot) {
+  const auto version = vendor_boot.header_version;
+  const auto page_size = vendor_boot.page_size;
+  CF_EXPECT(version == 3 || version == 4,
+            "Unsupported vendor_boot image header version " << version);
+  CF_EXPECT(page_size > 0 && (page_size & (page_size - 1)) == 0,
+            "Invalid page size " << page_size);
+  CF_EXPECT(version == 4 || vendor_boot.ramdisks.size() <= 1,
+            "Multiple vendor ramdisks need a v4 header");
+  CF_EXPECT(version == 4 || vendor_boot.bootconfig.empty(),
+            "Bootconfig needs a v4 header");
+
+  auto ramdisk = vendor_boot.Ramdisk();
+  vendor_boot_img_hdr_v4 header = {};
+  memcpy(header.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  header.header_version = version;
+  header.page_size = page_size;
+  header.kernel_addr = vendor_boot.kernel_addr;
+  header.ramdisk_addr = vendor_boot.ramdisk_addr;
+  header.vendor_ramdisk_size = ramdisk.size();
+  CF_EXPECT(CopyCString(vendor_boot.cmdline, header.cmdline,
+                        sizeof(header.cmdline), "Vendor command line"));
+  header.tags_addr = vendor_boot.tags_addr;
+  CF_EXPECT(CopyCString(vendor_boot.name, header.name, sizeof(header.name),
+                        "Board name"));
+  header.header_size = version == 4 ? sizeof(vendor_boot_img_hdr_v4)
+                                    : sizeof(vendor_boot_img_hdr_v3);
+  header.dtb_size = vendor_boot.dtb.size();
+  header.dtb_addr = vendor_boot.dtb_addr;
+
+  std::string table;
+  if (version == 4) {
+    uint32_t ramdisk_offset = 0;
+    for (const auto& vendor_ramdisk : vendor_boot.ramdisks) {
+      vendor_ramdisk_table_entry_v4 entry = {};
+      entry.ramdisk_size = vendor_ramdisk.contents.size();
+      entry.ramdisk_offset = ramdisk_offset;
+      entry.ramdisk_type = vendor_ramdisk.type;
+      CF_EXPECT(CopyCString(vendor_ramdisk.name, entry.ramdisk_name,
+                            sizeof(entry.ramdisk_name), "Ramdisk name"));
+      memcpy(entry.board_id, vendor_ramdisk.board_id.data(),
+             sizeof(entry.board_id));
+      table.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+      ramdisk_offset += entry.ramdisk_size;
+    }
+    header.vendor_ramdisk_table_size = table.size();
+    header.vendor_ramdisk_table_entry_num = vendor_boot.ramdisks.size();
+    header.vendor_ramdisk_table_entry_size =
+        sizeof(vendor_ramdisk_table_entry_v4);
+    header.bootconfig_size = vendor_boot.bootconfig.size();
+  }
+
+  std::string image;
+  image.reserve(page_size * 5 + ramdisk.size() + vendor_boot.dtb.size() +
+                table.size() + vendor_boot.bootconfig.size());
+  AppendPadded(image,
+               std::string_view(reinterpret_cast<const char*>(&header),
+                                header.header_size),
+               page_size);
+  AppendPadded(image, ramdisk, page_size);
+  AppendPadded(image, vendor_boot.dtb, page_size);
+  if (version == 4) {
+    AppendPadded(image, table, page_size);
+    AppendPadded(image, vendor_boot.bootconfig, page_size);
+  }
+  return image;
+}
+
+std::string OsVersionString(uint32_t os_version) {
+  uint32_t version = os_version >> 11;
+  std::stringstream ss;
+  ss << ((version >> 14) & 0x7f) << "." << ((version >> 7) & 0x7f) << "."
+     << (version & 0x7f);
+  return ss.str();
+}
+
+std::string OsPatchLevelString(uint32_t os_version) {
+  uint32_t patch_level = os_version & 0x7ff;
+  char formatted[16];
+  snprintf(formatted, sizeof(formatted), "%d-%02d", (patch_level >> 4) + 2000,
+           patch_level & 0xf);
+  return formatted;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+/**
+ * Reads and writes boot and vendor_boot images with v3 and v4 headers, the
+ * in memory equivalent of unpack_bootimg and mkbootimg.
+ */
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct BootImage {
+  uint32_t header_version = 4;
+  // Android version and security patch level, packed as in the header
+  uint32_t os_version = 0;
+  std::string cmdline;
+  std::string kernel;
+  std::string ramdisk;
+  std::string signature;
+};
+
+struct VendorRamdisk {
+  std::string name;
+  uint32_t type = 0;
+  std::array<uint32_t, 16> board_id = {};
+  std::string contents;
+};
+
+// The addresses default to what mkbootimg uses when it isn't given any.
+struct VendorBootImage {
+  uint32_t header_version = 4;
+  uint32_t page_size = 2048;
+  uint32_t kernel_addr = 0x10008000;
+  uint32_t ramdisk_addr = 0x11000000;
+  uint32_t tags_addr = 0x10000100;
+  uint64_t dtb_addr = 0x11f00000;
+  std::string name;
+  std::string cmdline;
+  // A v3 image has a single ramdisk
+  std::vector<VendorRamdisk> ramdisks;
+  std::string dtb;
+  std::string bootconfig;
+
+  // The ramdisks concatenated, as the bootloader loads them
+  std::string Ramdisk() const;
+};
+
+// The header version of a boot or vendor_boot image.
+Result<uint32_t> BootImageHeaderVersion(std::string_view image);
+
+Result<BootImage> ParseBootImage(std::string_view image);
+Result<std::string> WriteBootImage(const BootImage& boot);
+
+Result<VendorBootImage> ParseVendorBootImage(std::string_view image);
+Result<std::string> WriteVendorBootImage(const VendorBootImage& vendor_boot);
+
+// Formats the packed os version as unpack_bootimg does, e.g. "13.0.0" and
+// "2023-10".
+std::string OsVersionString(uint32_t os_version);
+std::string OsPatchLevelString(uint32_t os_version);
+
+}  // namespace cuttlefish
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host/libs/boot_image/ramdisk.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#define LZ4_HC_STATIC_LINKING_ONLY
+#include <lz4.h>
+#include <lz4hc.h>
+#include <private/fs_config.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kCpioMagic[] = "070701";
+constexpr size_t kCpioHeaderSize = 110;
+constexpr char kCpioTrailer[] = "TRAILER!!!";
+// What mkbootfs starts from, to stay clear of values that may be special
+constexpr uint32_t kFirstInode = 300000;
+
+constexpr uint32_t kLz4LegacyMagic = 0x184C2102;
+constexpr size_t kLz4LegacyBlockSize = 8 << 20;
+
+size_t Align4(size_t size) { return (size + 3) & ~size_t{3}; }
+
+Result<uint32_t> HexField(std::string_view header, size_t index) {
+  uint32_t value = 0;
+  for (char c : header.substr(6 + index * 8, 8)) {
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      return CF_ERR("Invalid cpio header field " << index);
+    }
+  }
+  return value;
+}
+
+void AppendHex(std::string& out, uint32_t value) {
+  char hex[9];
+  snprintf(hex, sizeof(hex), "%08x", value);
+  out.append(hex, 8);
+}
+
+void AppendPadding(std::string& out, size_t alignment) {
+  out.resize((out.size() + alignment - 1) / alignment * alignment, '\0');
+}
+
+void AppendHeader(std::string& out, uint32_t inode, const CpioEntry& entry) {
+  out += kCpioMagic;
+  for (uint32_t field : {inode, entry.mode, entry.uid, entry.gid, entry.nlink,
+                         entry.mtime, (uint32_t)entry.data.size(), 0u, 0u,
+                         entry.rdev_major, entry.rdev_minor,
+                         (uint32_t)entry.name.size() + 1, 0u}) {
+    AppendHex(out, field);
+  }
+  out += entry.name;
+  out.push_back('\0');
+  AppendPadding(out, 4);
+}
+
+uint32_t ReadLe32(const char* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+void AppendLe32(std::string& out, uint32_t value) {
+  value = htole32(value);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Paths in ramdisks are relative, but don't all lack the "./" prefix.
+std::string_view NormalizedName(std::string_view name) {
+  while (android::base::ConsumePrefix(&name, "./") ||
+         android::base::ConsumePrefix(&name, "/")) {
+  }
+  return name;
+}
+
+bool HasParentReference(const std::string& name) {
+  for (const auto& part : android::base::Split(name, "/")) {
+    if (part == "..") {
+      return true;
+    }
+  }
+  return false;
+}
+
+Result<void> ArchiveDirectory(const std::string& root,
+                              const std::string& relative,
+                              std::vector<CpioEntry>& entries) {
+  auto path = relative.empty() ? root : root + "/" + relative;
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(path.c_str()), closedir);
+  CF_EXPECT(dir != nullptr,
+            "Could not open \"" << path << "\": " << strerror(errno));
+  std::vector<std::string> names;
+  while (auto entry = readdir(dir.get())) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      names.push_back(name);
+    }
+  }
+  // mkbootfs sorts the entries to be reproducible
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    CpioEntry entry;
+    entry.name = relative.empty() ? name : relative + "/" + name;
+    auto file = root + "/" + entry.name;
+    struct stat st;
+    CF_EXPECT(lstat(file.c_str(), &st) == 0,
+              "Could not stat \"" << file << "\": " << strerror(errno));
+    unsigned uid, gid, mode = st.st_mode;
+    uint64_t capabilities;
+    fs_config(entry.name.c_str(), S_ISDIR(st.st_mode), nullptr, &uid, &gid,
+              &mode, &capabilities);
+    // Like mkbootfs, only the mode is taken from fs_config and everything is
+    // owned by root
+    entry.mode = mode;
+    if (S_ISREG(st.st_mode)) {
+      CF_EXPECT(android::base::ReadFileToString(file, &entry.data),
+                "Could not read \"" << file << "\": " << strerror(errno));
+    } else if (S_ISLNK(st.st_mode)) {
+      CF_EXPECT(android::base::Readlink(file, &entry.data),
+                "Could not read link \"" << file << "\": " << strerror(errno));
+    } else if (!S_ISDIR(st.st_mode)) {
+      entry.rdev_major = major(st.st_rdev);
+      entry.rdev_minor = minor(st.st_rdev);
+    }
+    // Copied, as the recursion reallocates `entries`
+    auto subdirectory = S_ISDIR(st.st_mode) ? entry.name : "";
+    entries.push_back(std::move(entry));
+    if (!subdirectory.empty()) {
+      CF_EXPECT(ArchiveDirectory(root, subdirectory, entries));
+    }
+  }
+  return {};
+}
+
+}  // namespace
+
+Result<std::vector<CpioEntry>> ParseCpio(std::string_view archive) {
+  std::vector<CpioEntry> entries;
+  std::map<std::string, size_t, std::less<>> positions;
+  size_t offset = 0;
+  while (offset < archive.size()) {
+    // Concatenated archives may be separated by padding
+    if (archive[offset] == '\0') {
+      offset++;
+      continue;
+    }
+    CF_EXPECT(archive.size() - offset >= kCpioHeaderSize,
+              "Truncated cpio header at " << offset);
+    auto header = archive.substr(offset, kCpioHeaderSize);
+    CF_EXPECT(header.substr(0, 6) == kCpioMagic,
+              "Unsupported cpio format at " << offset);
+    CpioEntry entry;
+    entry.mode = CF_EXPECT(HexField(header, 1));
+    entry.uid = CF_EXPECT(HexField(header, 2));
+    entry.gid = CF_EXPECT(HexField(header, 3));
+    entry.nlink = CF_EXPECT(HexField(header, 4));
+    entry.mtime = CF_EXPECT(HexField(header, 5));
+    auto file_size = CF_EXPECT(HexField(header, 6));
+    entry.rdev_major = CF_EXPECT(HexField(header, 9));
+    entry.rdev_minor = CF_EXPECT(HexField(header, 10));
+    auto name_size = CF_EXPECT(HexField(header, 11));
+    CF_EXPECT(name_size > 0, "Empty cpio entry name at " << offset);
+
+    size_t name_offset = offset + kCpioHeaderSize;
+    size_t data_offset = Align4(name_offset + name_size);
+    size_t end = Align4(data_offset + file_size);
+    CF_EXPECT(data_offset + file_size <= archive.size(),
+              "Truncated cpio entry at " << offset);
+    entry.name = archive.substr(name_offset, name_size - 1);
+    entry.data = archive.substr(data_offset, file_size);
+    offset = std::min(end, archive.size());
+
+    if (entry.name == kCpioTrailer) {
+      continue;
+    }
+    auto [it, inserted] = positions.emplace(entry.name, entries.size());
+    if (inserted) {
+      entries.push_back(std::move(entry));
+    } else {
+      entries[it->second] = std::move(entry);
+    }
+  }
+  return entries;
+}
+
+std::string WriteCpio(const std::vector<CpioEntry>& entries) {
+  size_t size = 0;
+  for (const auto& entry : entries) {
+    size += kCpioHeaderSize + entry.name.size() + entry.data.size() + 8;
+  }
+  std::string out;
+  out.reserve(size + 512);
+  uint32_t inode = kFirstInode;
+  for (const auto& entry : entries) {
+    AppendHeader(out, inode++, entry);
+    out += entry.data;
+    AppendPadding(out, 4);
+  }
+  AppendHeader(out, inode, CpioEntry{.name = kCpioTrailer});
+  AppendPadding(out, 256);
+  return out;
+}
+
+Result<std::string> Lz4LegacyDecompress(std::string_view compressed) {
+  CF_EXPECT(compressed.size() >= 4 &&
+                ReadLe32(compressed.data()) == kLz4LegacyMagic,
+            "Not an lz4 legacy frame");
+  std::string out;
+  size_t offset = 4;
+  while (compressed.size() - offset >= 4) {
+    auto block_size = ReadLe32(compressed.data() + offset);
+    offset += 4;
+    if (block_size == kLz4LegacyMagic) {
+      continue;  // Start of a concatenated frame
+    }
+    if (block_size == 0) {
+      break;  // Padding after the last frame
+    }
+    CF_EXPECT(block_size <= compressed.size() - offset,
+              "Truncated lz4 block at " << offset);
+    auto out_offset = out.size();
+    out.resize(out_offset + kLz4LegacyBlockSize);
+    int decompressed = LZ4_decompress_safe(
+        compressed.data() + offset, out.data() + out_offset, block_size,
+        kLz4LegacyBlockSize);
+    CF_EXPECT(decompressed >= 0, "Corrupt lz4 block at " << offset);
+    out.resize(out_offset + decompressed);
+    offset += block_size;
+  }
+  return out;
+}
+
+Result<std::string> Lz4LegacyCompress(std::string_view data) {
+  size_t blocks = (data.size() + kLz4LegacyBlockSize - 1) / kLz4LegacyBlockSize;
+  std::vector<std::string> compressed(blocks);
+  std::atomic<size_t> next_block = 0;
+  std::atomic<bool> failed = false;
+  auto compress = [&]() {
+    std::unique_ptr<LZ4_streamHC_t, int (*)(LZ4_streamHC_t*)> stream(
+        LZ4_createStreamHC(), LZ4_freeStreamHC);
+    if (!stream) {
+      failed = true;
+      return;
+    }
+    for (size_t i = next_block++; i < blocks; i = next_block++) {
+      auto block = data.substr(i * kLz4LegacyBlockSize, kLz4LegacyBlockSize);
+      auto& out = compressed[i];
+      out.resize(LZ4_compressBound(block.size()));
+      LZ4_resetStreamHC_fast(stream.get(), LZ4HC_CLEVEL_MAX);
+      LZ4_favorDecompressionSpeed(stream.get(), 1);
+      int size = LZ4_compress_HC_continue(stream.get(), block.data(),
+                                          out.data(), block.size(),
+                                          out.size());
+      if (size <= 0) {
+        failed = true;
+        return;
+      }
+      out.resize(size);
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t thread_count =
+      std::min<size_t>(blocks, std::max(1u, std::thread::hardware_concurrency()));
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(compress);
+  }
+  compress();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CF_EXPECT(!failed, "lz4 compression failed");
+
+  std::string out;
+  AppendLe32(out, kLz4LegacyMagic);
+  for (const auto& block : compressed) {
+    AppendLe32(out, block.size());
+    out += block;
+  }
+  return out;
+}
+
+Result<std::string> DecompressRamdisk(std::string_view ramdisk) {
+  if (ramdisk.empty() || ramdisk.substr(0, 6) == kCpioMagic) {
+    return std::string(ramdisk);
+  }
+  return CF_EXPECT(Lz4LegacyDecompress(ramdisk));
+}
+
+void RemoveCpioDirectory(std::vector<CpioEntry>& entries,
+                         const std::string& directory) {
+  auto removed = [&directory](const CpioEntry& entry) {
+    auto name = NormalizedName(entry.name);
+    return name == directory ||
+           (android::base::StartsWith(name, directory) &&
+            name[directory.size()] == '/');
+  };
+  entries.erase(std::remove_if(entries.begin(), entries.end(), removed),
+                entries.end());
+}
+
+Result<void> ExtractRamdisk(const std::string& ramdisk_path,
+                            const std::string& directory) {
+  std::string ramdisk;
+  CF_EXPECT(android::base::ReadFileToString(ramdisk_path, &ramdisk),
+            "Could not read \"" << ramdisk_path << "\": " << strerror(errno));
+  auto entries = CF_EXPECT(ParseCpio(CF_EXPECT(DecompressRamdisk(ramdisk))));
+  CF_EXPECT(EnsureDirectoryExists(directory));
+  for (const auto& entry : entries) {
+    std::string name(NormalizedName(entry.name));
+    if (name.empty() || name == ".") {
+      continue;
+    }
+    CF_EXPECT(!HasParentReference(name),
+              "Refusing to extract \"" << entry.name << "\"");
+    auto path = directory + "/" + name;
+    // Extracted files stay writable by the owner, so that they can be
+    // modified and removed like the ones toybox cpio extracted.
+    if (S_ISDIR(entry.mode)) {
+      CF_EXPECT(EnsureDirectoryExists(path, (entry.mode & 07777) | S_IRWXU));
+    } else if (S_ISREG(entry.mode)) {
+      unlink(path.c_str());
+      auto fd = SharedFD::Open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                               (entry.mode & 07777) | S_IRUSR | S_IWUSR);
+      CF_EXPECT(fd->IsOpen(),
+                "Could not create \"" << path << "\": " << fd->StrError());
+      CF_EXPECT(WriteAll(fd, entry.data) == (ssize_t)entry.data.size(),
+                "Could not write \"" << path << "\": " << fd->StrError());
+    } else if (S_ISLNK(entry.mode)) {
+      unlink(path.c_str());
+      CF_EXPECT(symlink(entry.data.c_str(), path.c_str()) == 0,
+                "Could not create link \"" << path
+                                           << "\": " << strerror(errno));
+    } else {
+      LOG(WARNING) << "Skipping special file \"" << name << "\" in "
+                   << ramdisk_path;
+    }
+  }
+  return {};
+}
+
+Result<void> PackRamdiskDirectory(const std::string& directory,
+                                  const std::string& ramdisk_path) {
+  std::vector<CpioEntry> entries;
+  CF_EXPECT(ArchiveDirectory(directory, "", entries));
+  auto ramdisk = CF_EXPECT(Lz4LegacyCompress(WriteCpio(entries)));
+  CF_EXPECT(android::base::WriteStringToFile(ramdisk, ramdisk_path),
+            "Could not write \"" << ramdisk_path << "\": " << strerror(errno));
+  return {};
+}
+
+}  // namespace cuttlefish
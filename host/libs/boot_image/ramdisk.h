@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+/**
+ * In memory handling of Android ramdisks: lz4 legacy frames holding newc
+ * cpio archives, as written by mkbootfs and `lz4 -l`.
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct CpioEntry {
+  std::string name;
+  uint32_t mode = 0;
+  uint32_t uid = 0;
+  uint32_t gid = 0;
+  uint32_t nlink = 1;
+  uint32_t mtime = 0;
+  uint32_t rdev_major = 0;
+  uint32_t rdev_minor = 0;
+  // File contents, or the target of a symlink
+  std::string data;
+};
+
+// Parses one or more concatenated newc archives. An entry repeated in a later
+// archive replaces the earlier one, as when the archives are extracted in
+// order.
+Result<std::vector<CpioEntry>> ParseCpio(std::string_view archive);
+// Writes a newc archive the way mkbootfs does, numbering inodes from 300000
+// and padding the end to 256 bytes.
+std::string WriteCpio(const std::vector<CpioEntry>& entries);
+
+Result<std::string> Lz4LegacyDecompress(std::string_view compressed);
+// Compresses like `lz4 -l -12 --favor-decSpeed`. The 8MiB blocks of the
+// legacy format are independent, so they are compressed in parallel.
+Result<std::string> Lz4LegacyCompress(std::string_view data);
+
+// Decompresses a ramdisk, accepting an uncompressed archive as is.
+Result<std::string> DecompressRamdisk(std::string_view ramdisk);
+
+// Removes `directory` and everything under it from the entries.
+void RemoveCpioDirectory(std::vector<CpioEntry>& entries,
+                         const std::string& directory);
+
+// Unpacks the ramdisk at `ramdisk_path` into `directory`, and packs
+// `directory` into a ramdisk with the ownership and permissions that mkbootfs
+// gives files in a ramdisk.
+Result<void> ExtractRamdisk(const std::string& ramdisk_path,
+                            const std::string& directory);
+Result<void> PackRamdiskDirectory(const std::string& directory,
+                                  const std::string& ramdisk_path);
+
+}  // namespace cuttlefish
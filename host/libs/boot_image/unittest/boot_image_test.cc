@@ -0,0 +1,191 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/boot_image/boot_image.h"
+
+#include <bootimg.h>
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+template <typename T>
+T Header(const std::string& image) {
+  T header;
+  memcpy(&header, image.data(), sizeof(T));
+  return header;
+}
+
+TEST(BootImageTest, RoundTripsV4) {
+  BootImage boot;
+  boot.os_version = (13 << 25) | (23 << 4) | 10;
+  boot.cmdline = "console=ttyS0";
+  boot.kernel = std::string(5000, 'k');
+  boot.ramdisk = std::string(100, 'r');
+  boot.signature = "signed";
+
+  auto image = WriteBootImage(boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+  // Header, kernel (two pages), ramdisk, signature
+  EXPECT_EQ(image->size(), 5 * 4096);
+  EXPECT_EQ(*BootImageHeaderVersion(*image), 4);
+  EXPECT_EQ(Header<boot_img_hdr_v4>(*image).header_size,
+            sizeof(boot_img_hdr_v4));
+  EXPECT_EQ(image->substr(3 * 4096, 100), boot.ramdisk);
+
+  auto parsed = ParseBootImage(*image);
+  ASSERT_TRUE(parsed.ok()) << parsed.error().Trace();
+  EXPECT_EQ(parsed->header_version, 4);
+  EXPECT_EQ(parsed->os_version, boot.os_version);
+  EXPECT_EQ(parsed->cmdline, boot.cmdline);
+  EXPECT_EQ(parsed->kernel, boot.kernel);
+  EXPECT_EQ(parsed->ramdisk, boot.ramdisk);
+  EXPECT_EQ(parsed->signature, boot.signature);
+  EXPECT_EQ(OsVersionString(parsed->os_version), "13.0.0");
+  EXPECT_EQ(OsPatchLevelString(parsed->os_version), "2023-10");
+}
+
+TEST(BootImageTest, RoundTripsV3) {
+  BootImage boot;
+  boot.header_version = 3;
+  boot.kernel = "kernel";
+
+  auto image = WriteBootImage(boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+  EXPECT_EQ(image->size(), 2 * 4096);
+  EXPECT_EQ(Header<boot_img_hdr_v3>(*image).header_size,
+            sizeof(boot_img_hdr_v3));
+
+  auto parsed = ParseBootImage(*image);
+  ASSERT_TRUE(parsed.ok()) << parsed.error().Trace();
+  EXPECT_EQ(parsed->header_version, 3);
+  EXPECT_EQ(parsed->kernel, boot.kernel);
+  EXPECT_EQ(parsed->ramdisk, "");
+}
+
+TEST(BootImageTest, RejectsTruncatedImage) {
+  BootImage boot;
+  boot.kernel = std::string(5000, 'k');
+  auto image = WriteBootImage(boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+
+  EXPECT_FALSE(ParseBootImage(image->substr(0, 4096 + 100)).ok());
+  EXPECT_FALSE(ParseBootImage("ANDROID!").ok());
+  EXPECT_FALSE(ParseBootImage(std::string(4096, '\0')).ok());
+}
+
+TEST(BootImageTest, RejectsLongCmdline) {
+  BootImage boot;
+  boot.cmdline = std::string(BOOT_ARGS_SIZE + BOOT_EXTRA_ARGS_SIZE, 'c');
+  EXPECT_FALSE(WriteBootImage(boot).ok());
+}
+
+TEST(VendorBootImageTest, RoundTripsV4) {
+  VendorBootImage vendor_boot;
+  vendor_boot.name = "cutf";
+  vendor_boot.cmdline = "androidboot.hardware=cutf_cvm";
+  vendor_boot.ramdisks.push_back(VendorRamdisk{
+      .type = VENDOR_RAMDISK_TYPE_PLATFORM,
+      .contents = std::string(3000, 'a'),
+  });
+  vendor_boot.ramdisks.push_back(VendorRamdisk{
+      .name = "dlkm",
+      .type = VENDOR_RAMDISK_TYPE_DLKM,
+      .board_id = {1, 2, 3},
+      .contents = "modules",
+  });
+  vendor_boot.dtb = "dtb";
+  vendor_boot.bootconfig = "androidboot.serialno=CUTTLEFISHCVD01\n";
+
+  auto image = WriteVendorBootImage(vendor_boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+  // Header and ramdisks (two pages each), dtb, ramdisk table, bootconfig
+  EXPECT_EQ(image->size(), 7 * 2048);
+  EXPECT_EQ(*BootImageHeaderVersion(*image), 4);
+  auto header = Header<vendor_boot_img_hdr_v4>(*image);
+  EXPECT_EQ(header.header_size, sizeof(vendor_boot_img_hdr_v4));
+  EXPECT_EQ(header.vendor_ramdisk_size, 3007);
+  EXPECT_EQ(header.vendor_ramdisk_table_entry_num, 2);
+  EXPECT_EQ(image->substr(2 * 2048 + 3000, 7), "modules");
+
+  auto parsed = ParseVendorBootImage(*image);
+  ASSERT_TRUE(parsed.ok()) << parsed.error().Trace();
+  EXPECT_EQ(parsed->header_version, 4);
+  EXPECT_EQ(parsed->page_size, 2048);
+  EXPECT_EQ(parsed->name, vendor_boot.name);
+  EXPECT_EQ(parsed->cmdline, vendor_boot.cmdline);
+  ASSERT_EQ(parsed->ramdisks.size(), 2);
+  EXPECT_EQ(parsed->ramdisks[0].type, VENDOR_RAMDISK_TYPE_PLATFORM);
+  EXPECT_EQ(parsed->ramdisks[0].contents, vendor_boot.ramdisks[0].contents);
+  EXPECT_EQ(parsed->ramdisks[1].name, "dlkm");
+  EXPECT_EQ(parsed->ramdisks[1].board_id, vendor_boot.ramdisks[1].board_id);
+  EXPECT_EQ(parsed->ramdisks[1].contents, "modules");
+  EXPECT_EQ(parsed->Ramdisk(), vendor_boot.Ramdisk());
+  EXPECT_EQ(parsed->dtb, vendor_boot.dtb);
+  EXPECT_EQ(parsed->bootconfig, vendor_boot.bootconfig);
+}
+
+TEST(VendorBootImageTest, RoundTripsV3) {
+  VendorBootImage vendor_boot;
+  vendor_boot.header_version = 3;
+  vendor_boot.page_size = 4096;
+  vendor_boot.ramdisks.push_back(VendorRamdisk{.contents = "ramdisk"});
+
+  auto image = WriteVendorBootImage(vendor_boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+  EXPECT_EQ(image->size(), 2 * 4096);
+
+  auto parsed = ParseVendorBootImage(*image);
+  ASSERT_TRUE(parsed.ok()) << parsed.error().Trace();
+  EXPECT_EQ(parsed->header_version, 3);
+  EXPECT_EQ(parsed->Ramdisk(), "ramdisk");
+  EXPECT_EQ(parsed->dtb, "");
+}
+
+TEST(VendorBootImageTest, RejectsV4OnlyContentsInV3) {
+  VendorBootImage vendor_boot;
+  vendor_boot.header_version = 3;
+  vendor_boot.bootconfig = "a=b\n";
+  EXPECT_FALSE(WriteVendorBootImage(vendor_boot).ok());
+
+  vendor_boot.bootconfig = "";
+  vendor_boot.ramdisks.resize(2);
+  EXPECT_FALSE(WriteVendorBootImage(vendor_boot).ok());
+}
+
+TEST(VendorBootImageTest, RejectsRamdiskOutOfBounds) {
+  VendorBootImage vendor_boot;
+  vendor_boot.ramdisks.push_back(VendorRamdisk{.contents = "ramdisk"});
+  auto image = WriteVendorBootImage(vendor_boot);
+  ASSERT_TRUE(image.ok()) << image.error().Trace();
+
+  // Grows the entry past the end of the ramdisk section. The table follows
+  // the two pages of header and the ramdisk, as there is no dtb.
+  auto header = Header<vendor_boot_img_hdr_v4>(*image);
+  size_t table_offset = 3 * 2048;
+  ASSERT_EQ(header.vendor_ramdisk_table_size,
+            sizeof(vendor_ramdisk_table_entry_v4));
+  uint32_t size = 100;
+  image->replace(table_offset, sizeof(size),
+                 reinterpret_cast<const char*>(&size), sizeof(size));
+  EXPECT_FALSE(ParseVendorBootImage(*image).ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
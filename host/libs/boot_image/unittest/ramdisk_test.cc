@@ -0,0 +1,153 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/boot_image/ramdisk.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+std::vector<CpioEntry> SampleEntries() {
+  return {
+      CpioEntry{.name = "lib", .mode = S_IFDIR | 0755},
+      CpioEntry{.name = "lib/modules", .mode = S_IFDIR | 0755},
+      CpioEntry{.name = "lib/modules/a.ko", .mode = S_IFREG | 0644,
+                .data = "module"},
+      CpioEntry{.name = "lib/modules_extra", .mode = S_IFREG | 0644},
+      CpioEntry{.name = "init", .mode = S_IFLNK | 0777, .data = "system/init"},
+  };
+}
+
+std::vector<std::string> Names(const std::vector<CpioEntry>& entries) {
+  std::vector<std::string> names;
+  for (const auto& entry : entries) {
+    names.push_back(entry.name);
+  }
+  return names;
+}
+
+TEST(RamdiskTest, CpioRoundTrips) {
+  auto archive = WriteCpio(SampleEntries());
+  EXPECT_EQ(archive.size() % 256, 0);
+
+  auto entries = ParseCpio(archive);
+  ASSERT_TRUE(entries.ok()) << entries.error().Trace();
+  EXPECT_EQ(Names(*entries), Names(SampleEntries()));
+  EXPECT_EQ((*entries)[2].mode, S_IFREG | 0644);
+  EXPECT_EQ((*entries)[2].data, "module");
+  EXPECT_EQ((*entries)[4].data, "system/init");
+}
+
+TEST(RamdiskTest, LaterArchiveReplacesEntries) {
+  std::vector<CpioEntry> overlay = {
+      CpioEntry{.name = "lib/modules/a.ko", .mode = S_IFREG | 0600,
+                .data = "new module"},
+      CpioEntry{.name = "lib/modules/b.ko", .mode = S_IFREG | 0644},
+  };
+  auto entries = ParseCpio(WriteCpio(SampleEntries()) + WriteCpio(overlay));
+  ASSERT_TRUE(entries.ok()) << entries.error().Trace();
+
+  ASSERT_EQ(entries->size(), 6);
+  EXPECT_EQ((*entries)[2].name, "lib/modules/a.ko");
+  EXPECT_EQ((*entries)[2].mode, S_IFREG | 0600);
+  EXPECT_EQ((*entries)[2].data, "new module");
+  EXPECT_EQ((*entries)[5].name, "lib/modules/b.ko");
+}
+
+TEST(RamdiskTest, RejectsTruncatedCpio) {
+  auto archive = WriteCpio(SampleEntries());
+  EXPECT_FALSE(ParseCpio(archive.substr(0, 200)).ok());
+}
+
+TEST(RamdiskTest, RemovesDirectory) {
+  auto entries = SampleEntries();
+  RemoveCpioDirectory(entries, "lib/modules");
+  EXPECT_EQ(Names(entries),
+            (std::vector<std::string>{"lib", "lib/modules_extra", "init"}));
+}
+
+TEST(RamdiskTest, Lz4LegacyRoundTrips) {
+  // Spans several of the 8MiB blocks
+  std::string data;
+  for (int i = 0; data.size() < (20 << 20); i++) {
+    data += std::to_string(i * 7919 % 100003);
+  }
+  auto compressed = Lz4LegacyCompress(data);
+  ASSERT_TRUE(compressed.ok()) << compressed.error().Trace();
+  EXPECT_LT(compressed->size(), data.size());
+
+  auto decompressed = Lz4LegacyDecompress(*compressed);
+  ASSERT_TRUE(decompressed.ok()) << decompressed.error().Trace();
+  EXPECT_EQ(*decompressed, data);
+
+  // Concatenated frames decompress to the concatenated data
+  auto twice = Lz4LegacyDecompress(*compressed + *compressed);
+  ASSERT_TRUE(twice.ok()) << twice.error().Trace();
+  EXPECT_EQ(*twice, data + data);
+}
+
+TEST(RamdiskTest, DecompressRamdiskAcceptsRawCpio) {
+  auto archive = WriteCpio(SampleEntries());
+  auto ramdisk = DecompressRamdisk(archive);
+  ASSERT_TRUE(ramdisk.ok()) << ramdisk.error().Trace();
+  EXPECT_EQ(*ramdisk, archive);
+  EXPECT_FALSE(DecompressRamdisk("not a ramdisk").ok());
+}
+
+TEST(RamdiskTest, DirectoryRoundTrips) {
+  TemporaryDir dir;
+  auto ramdisk_path = std::string(dir.path) + "/ramdisk";
+  auto extracted = std::string(dir.path) + "/extracted";
+  auto compressed = Lz4LegacyCompress(WriteCpio(SampleEntries()));
+  ASSERT_TRUE(compressed.ok()) << compressed.error().Trace();
+  ASSERT_TRUE(android::base::WriteStringToFile(*compressed, ramdisk_path));
+
+  auto res = ExtractRamdisk(ramdisk_path, extracted);
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  std::string module;
+  ASSERT_TRUE(android::base::ReadFileToString(
+      extracted + "/lib/modules/a.ko", &module));
+  EXPECT_EQ(module, "module");
+  std::string target;
+  ASSERT_TRUE(android::base::Readlink(extracted + "/init", &target));
+  EXPECT_EQ(target, "system/init");
+
+  auto repacked_path = std::string(dir.path) + "/repacked";
+  res = PackRamdiskDirectory(extracted, repacked_path);
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  std::string repacked;
+  ASSERT_TRUE(android::base::ReadFileToString(repacked_path, &repacked));
+  auto entries = ParseCpio(*DecompressRamdisk(repacked));
+  ASSERT_TRUE(entries.ok()) << entries.error().Trace();
+  // Sorted by name, as mkbootfs writes them
+  EXPECT_EQ(Names(*entries),
+            (std::vector<std::string>{"init", "lib", "lib/modules",
+                                      "lib/modules/a.ko", "lib/modules_extra"}));
+  for (const auto& entry : *entries) {
+    EXPECT_EQ(entry.uid, 0);
+    EXPECT_EQ(entry.mtime, 0);
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
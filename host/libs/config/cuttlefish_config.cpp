@@ -237,6 +237,14 @@ bool CuttlefishConfig::sig_server_strict() const {
   return (*dictionary_)[kSigServerStrict].asBool();
 }
 
+static constexpr char kPinHostCpus[] = "pin_host_cpus";
+void CuttlefishConfig::set_pin_host_cpus(bool pin_host_cpus) {
+  (*dictionary_)[kPinHostCpus] = pin_host_cpus;
+}
+bool CuttlefishConfig::pin_host_cpus() const {
+  return (*dictionary_)[kPinHostCpus].asBool();
+}
+
 static constexpr char kHostToolsVersion[] = "host_tools_version";
 void CuttlefishConfig::set_host_tools_version(
     const std::map<std::string, uint32_t>& versions) {
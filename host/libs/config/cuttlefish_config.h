@@ -194,6 +194,11 @@ class CuttlefishConfig {
   void set_sig_server_strict(bool strict);
   bool sig_server_strict() const;
 
+  // Whether each instance of the group gets its own host cores, and its host
+  // processes are kept on them.
+  void set_pin_host_cpus(bool pin_host_cpus);
+  bool pin_host_cpus() const;
+
   void set_host_tools_version(const std::map<std::string, uint32_t>&);
   std::map<std::string, uint32_t> host_tools_version() const;
 
@@ -356,7 +361,12 @@ class CuttlefishConfig {
 
     std::string console_path() const;
 
+    // The whole logcat, also kept indexed in logcat_store_path().
     std::string logcat_path() const;
+    std::string logcat_store_path() const;
+
+    std::string kernel_log_path() const;
+    std::string kernel_log_store_path() const;
 
     std::string kernel_log_pipe_name() const;
 
@@ -961,6 +961,18 @@ std::string CuttlefishConfig::InstanceSpecific::logcat_path() const {
   return AbsolutePath(PerInstanceLogPath("logcat"));
 }
 
+std::string CuttlefishConfig::InstanceSpecific::logcat_store_path() const {
+  return AbsolutePath(PerInstanceLogPath("logcat_store"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::kernel_log_path() const {
+  return AbsolutePath(PerInstanceLogPath("kernel.log"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::kernel_log_store_path() const {
+  return AbsolutePath(PerInstanceLogPath("kernel_log_store"));
+}
+
 std::string CuttlefishConfig::InstanceSpecific::launcher_monitor_socket_path()
     const {
   return AbsolutePath(PerInstanceUdsPath("launcher_monitor.sock"));
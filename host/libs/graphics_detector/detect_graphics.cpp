@@ -19,11 +19,21 @@
 #include <gflags/gflags.h>
 
 #include "android-base/logging.h"
+#include "host/libs/graphics_detector/graphics_availability_cache.h"
 #include "host/libs/graphics_detector/graphics_detector.h"
 
+DEFINE_string(refresh_cache, "",
+              "Probe again and store the results in this graphics "
+              "availability cache file instead of printing them.");
+
 int main(int argc, char* argv[]) {
   ::android::base::InitLogging(argv, android::base::StdioLogger);
   ::android::base::SetMinimumLogSeverity(android::base::VERBOSE);
   ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (!FLAGS_refresh_cache.empty()) {
+    cuttlefish::RefreshGraphicsAvailabilityCache(
+        {.path = FLAGS_refresh_cache});
+    return 0;
+  }
   LOG(INFO) << cuttlefish::GetGraphicsAvailabilityWithSubprocessCheck();
 }
\ No newline at end of file
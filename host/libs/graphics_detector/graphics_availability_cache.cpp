@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/graphics_detector/graphics_availability_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+namespace cuttlefish {
+namespace {
+
+// Bumped when the probes or the format change. Part of the driver identity
+// in place of the probing binary, which differs between detect_graphics and
+// assemble_cvd even when they probe the same way.
+constexpr char kCacheVersion[] = "2";
+
+constexpr std::pair<const char*, bool GraphicsAvailability::*> kBoolFields[] = {
+    {"has_egl", &GraphicsAvailability::has_egl},
+    {"has_gles2", &GraphicsAvailability::has_gles2},
+    {"has_gles3", &GraphicsAvailability::has_gles3},
+    {"has_vulkan", &GraphicsAvailability::has_vulkan},
+    {"can_init_gles2_on_egl_surfaceless",
+     &GraphicsAvailability::can_init_gles2_on_egl_surfaceless},
+    {"can_init_gles3_on_egl_surfaceless",
+     &GraphicsAvailability::can_init_gles3_on_egl_surfaceless},
+    {"has_discrete_gpu", &GraphicsAvailability::has_discrete_gpu},
+    {"vulkan_has_issue_with_precision_qualifiers_on_yuv_samplers",
+     &GraphicsAvailability::
+         vulkan_has_issue_with_precision_qualifiers_on_yuv_samplers},
+};
+
+constexpr std::pair<const char*, std::string GraphicsAvailability::*>
+    kStringFields[] = {
+        {"egl_client_extensions", &GraphicsAvailability::egl_client_extensions},
+        {"egl_version", &GraphicsAvailability::egl_version},
+        {"egl_vendor", &GraphicsAvailability::egl_vendor},
+        {"egl_extensions", &GraphicsAvailability::egl_extensions},
+        {"gles2_vendor", &GraphicsAvailability::gles2_vendor},
+        {"gles2_version", &GraphicsAvailability::gles2_version},
+        {"gles2_renderer", &GraphicsAvailability::gles2_renderer},
+        {"gles2_extensions", &GraphicsAvailability::gles2_extensions},
+        {"gles3_vendor", &GraphicsAvailability::gles3_vendor},
+        {"gles3_version", &GraphicsAvailability::gles3_version},
+        {"gles3_renderer", &GraphicsAvailability::gles3_renderer},
+        {"gles3_extensions", &GraphicsAvailability::gles3_extensions},
+        {"discrete_gpu_device_name",
+         &GraphicsAvailability::discrete_gpu_device_name},
+        {"discrete_gpu_device_extensions",
+         &GraphicsAvailability::discrete_gpu_device_extensions},
+};
+
+constexpr const char* kDriverEnvironment[] = {
+    "LD_LIBRARY_PATH",
+    "LIBGL_ALWAYS_SOFTWARE",
+    "MESA_LOADER_DRIVER_OVERRIDE",
+    "VK_ADD_DRIVER_FILES",
+    "VK_DRIVER_FILES",
+    "VK_ICD_FILENAMES",
+    "__EGL_VENDOR_LIBRARY_DIRS",
+    "__EGL_VENDOR_LIBRARY_FILENAMES",
+};
+
+constexpr const char* kDriverPaths[] = {
+    "/dev/dri",
+    "/etc/glvnd/egl_vendor.d",
+    "/etc/ld.so.cache",
+    "/etc/vulkan/icd.d",
+    "/proc/driver/nvidia/version",
+    "/usr/local/share/vulkan/icd.d",
+    "/usr/share/glvnd/egl_vendor.d",
+    "/usr/share/vulkan/icd.d",
+};
+
+std::string Escape(const std::string& value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string Unescape(const std::string& value) {
+  std::string unescaped;
+  for (std::size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '\\' && i + 1 < value.size()) {
+      i++;
+      unescaped += value[i] == 'n' ? '\n' : value[i];
+    } else {
+      unescaped += value[i];
+    }
+  }
+  return unescaped;
+}
+
+void DescribePath(const std::string& path, std::ostream& out) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return;
+  }
+  out << path << " " << st.st_dev << ":" << st.st_ino << " " << st.st_size
+      << " " << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec << "\n";
+}
+
+void DescribeDirectory(const std::string& path, std::ostream& out) {
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(path.c_str()), closedir);
+  if (!dir) {
+    DescribePath(path, out);
+    return;
+  }
+  std::vector<std::string> names;
+  while (auto entry = readdir(dir.get())) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      names.push_back(name);
+    }
+  }
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    DescribePath(path + "/" + name, out);
+  }
+}
+
+bool Store(const std::string& path, const std::string& identity,
+           const GraphicsAvailability& availability) {
+  std::stringstream contents;
+  contents << "version\t" << kCacheVersion << "\n";
+  contents << "identity\t" << Escape(identity) << "\n";
+  contents << "probed_at\t"
+           << std::chrono::duration_cast<std::chrono::seconds>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count()
+           << "\n";
+  contents << SerializeGraphicsAvailability(availability);
+
+  // This library doesn't depend on libcuttlefish_utils for
+  // EnsureDirectoryExists
+  auto dir = android::base::Dirname(path);
+  for (auto pos = dir.find('/', 1); pos != std::string::npos;
+       pos = dir.find('/', pos + 1)) {
+    mkdir(dir.substr(0, pos).c_str(), 0755);
+  }
+  mkdir(dir.c_str(), 0755);
+  // Written aside and renamed, as other launches may be reading it
+  auto temp_path = path + ".tmp." + std::to_string(getpid());
+  if (!android::base::WriteStringToFile(contents.str(), temp_path)) {
+    PLOG(DEBUG) << "Failed to write " << temp_path;
+    return false;
+  }
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    PLOG(DEBUG) << "Failed to rename " << temp_path << " to " << path;
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::map<std::string, std::string> ParseFields(const std::string& contents) {
+  std::map<std::string, std::string> fields;
+  for (const auto& line : android::base::Split(contents, "\n")) {
+    auto tab = line.find('\t');
+    if (tab != std::string::npos) {
+      fields[line.substr(0, tab)] = Unescape(line.substr(tab + 1));
+    }
+  }
+  return fields;
+}
+
+}  // namespace
+
+std::string GraphicsDriverIdentity() {
+  std::stringstream identity;
+  identity << "probes " << kCacheVersion << "\n";
+  struct utsname uts;
+  if (uname(&uts) == 0) {
+    identity << "kernel " << uts.release << " " << uts.version << "\n";
+  }
+  for (const char* name : kDriverEnvironment) {
+    const char* value = getenv(name);
+    if (value) {
+      identity << name << "=" << value << "\n";
+    }
+  }
+  for (const char* path : kDriverPaths) {
+    DescribeDirectory(path, identity);
+  }
+  std::string nvidia_version;
+  if (android::base::ReadFileToString("/proc/driver/nvidia/version",
+                                      &nvidia_version)) {
+    identity << nvidia_version;
+  }
+  return identity.str();
+}
+
+bool RefreshGraphicsAvailabilityCache(
+    const GraphicsAvailabilityCacheOptions& options) {
+  if (options.path.empty()) {
+    return false;
+  }
+  // Held until the results are stored, so launches starting a refresh of
+  // stale results in the meantime don't probe too
+  auto lock_path = options.path + ".lock";
+  android::base::unique_fd lock_fd(
+      open(lock_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644));
+  if (lock_fd < 0) {
+    PLOG(DEBUG) << "Failed to open " << lock_path;
+    return false;
+  }
+  if (flock(lock_fd.get(), LOCK_EX | LOCK_NB) != 0) {
+    LOG(DEBUG) << options.path << " is already being refreshed";
+    return false;
+  }
+  return Store(options.path, options.identity(), options.probe());
+}
+
+std::string SerializeGraphicsAvailability(
+    const GraphicsAvailability& availability) {
+  std::stringstream serialized;
+  for (const auto& [name, field] : kBoolFields) {
+    serialized << name << "\t" << (availability.*field ? "1" : "0") << "\n";
+  }
+  for (const auto& [name, field] : kStringFields) {
+    serialized << name << "\t" << Escape(availability.*field) << "\n";
+  }
+  return serialized.str();
+}
+
+std::optional<GraphicsAvailability> DeserializeGraphicsAvailability(
+    const std::string& serialized) {
+  auto fields = ParseFields(serialized);
+  GraphicsAvailability availability;
+  for (const auto& [name, field] : kBoolFields) {
+    auto it = fields.find(name);
+    if (it == fields.end() || (it->second != "0" && it->second != "1")) {
+      return {};
+    }
+    availability.*field = it->second == "1";
+  }
+  for (const auto& [name, field] : kStringFields) {
+    auto it = fields.find(name);
+    if (it == fields.end()) {
+      return {};
+    }
+    availability.*field = it->second;
+  }
+  return availability;
+}
+
+GraphicsAvailability GetGraphicsAvailabilityWithCache(
+    const GraphicsAvailabilityCacheOptions& options) {
+  auto identity = options.identity();
+
+  std::string contents;
+  if (!options.path.empty() &&
+      android::base::ReadFileToString(options.path, &contents)) {
+    auto fields = ParseFields(contents);
+    auto availability = DeserializeGraphicsAvailability(contents);
+    std::int64_t probed_at = 0;
+    if (fields["version"] == kCacheVersion &&
+        fields["identity"] == identity && availability &&
+        android::base::ParseInt(fields["probed_at"], &probed_at)) {
+      auto age = std::chrono::system_clock::now() -
+                 std::chrono::system_clock::time_point(
+                     std::chrono::seconds(probed_at));
+      if (age <= options.refresh_after) {
+        LOG(DEBUG) << "Using graphics availability cached in "
+                   << options.path;
+        return *availability;
+      }
+      if (options.start_refresh) {
+        LOG(DEBUG) << "Refreshing " << options.path << " in the background";
+        options.start_refresh();
+        return *availability;
+      }
+      LOG(DEBUG) << options.path << " is stale, probing again";
+    } else {
+      LOG(DEBUG) << "Graphics drivers changed since " << options.path
+                 << " was written, probing again";
+    }
+  }
+
+  auto availability = options.probe();
+  if (!options.path.empty()) {
+    Store(options.path, identity, availability);
+  }
+  return availability;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "host/libs/graphics_detector/graphics_detector.h"
+
+namespace cuttlefish {
+
+// Describes what the probe results depend on: the kernel, the Vulkan ICD
+// and EGL vendor files, the dynamic linker cache, the GPU device nodes,
+// the environment variables the loaders honor and the version of the probes.
+// It doesn't depend on which binary computes it. The cached results are
+// discarded when it changes.
+std::string GraphicsDriverIdentity();
+
+struct GraphicsAvailabilityCacheOptions {
+  // File holding the last probe results.
+  std::string path;
+  // Results older than this are still used, but probed again in the
+  // background for the next caller.
+  std::chrono::seconds refresh_after = std::chrono::hours(24);
+
+  // Replaceable for tests.
+  std::function<GraphicsAvailability()> probe =
+      GetGraphicsAvailabilityWithSubprocessCheck;
+  std::function<std::string()> identity = GraphicsDriverIdentity;
+  // Starts RefreshGraphicsAvailabilityCache() without waiting for it, such
+  // as `detect_graphics --refresh_cache=<path>`. Without it, stale results
+  // are refreshed before returning.
+  std::function<void()> start_refresh;
+};
+
+// Returns the cached results if they were probed with the same identity,
+// otherwise probes and caches them. Failing to use the cache only costs a
+// probe.
+GraphicsAvailability GetGraphicsAvailabilityWithCache(
+    const GraphicsAvailabilityCacheOptions& options);
+
+// Probes and caches the results again, unless another refresh of the same
+// file is running. Returns whether it refreshed them.
+bool RefreshGraphicsAvailabilityCache(
+    const GraphicsAvailabilityCacheOptions& options);
+
+std::string SerializeGraphicsAvailability(
+    const GraphicsAvailability& availability);
+std::optional<GraphicsAvailability> DeserializeGraphicsAvailability(
+    const std::string& serialized);
+
+}  // namespace cuttlefish
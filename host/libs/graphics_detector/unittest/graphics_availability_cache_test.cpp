@@ -0,0 +1,178 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/graphics_detector/graphics_availability_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+class GraphicsAvailabilityCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    options_.path =
+        std::string(dir_.path) + "/cache/cuttlefish/graphics_availability";
+    options_.probe = [this]() {
+      probes_++;
+      return probed_;
+    };
+    options_.identity = [this]() { return identity_; };
+    options_.start_refresh = [this]() {
+      background_runs_++;
+      RefreshGraphicsAvailabilityCache(options_);
+    };
+    probed_.has_egl = true;
+    probed_.egl_vendor = "Mesa";
+    probed_.gles2_extensions = "GL_OES_a GL_OES_b\nwith\\escapes";
+  }
+
+  GraphicsAvailability Get() {
+    return GetGraphicsAvailabilityWithCache(options_);
+  }
+
+  // Makes the entry at least a second old
+  void MakeStale() {
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(options_.path, &contents));
+    auto pos = contents.find("probed_at\t");
+    ASSERT_NE(pos, std::string::npos);
+    contents.replace(pos, contents.find('\n', pos) - pos, "probed_at\t0");
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, options_.path));
+  }
+
+  TemporaryDir dir_;
+  GraphicsAvailabilityCacheOptions options_;
+  GraphicsAvailability probed_;
+  std::string identity_ = "driver 1\nkernel 6.1";
+  int probes_ = 0;
+  int background_runs_ = 0;
+};
+
+TEST_F(GraphicsAvailabilityCacheTest, SerializationRoundTrips) {
+  probed_.has_discrete_gpu = true;
+  probed_.discrete_gpu_device_name = "GPU\tname";
+  auto parsed =
+      DeserializeGraphicsAvailability(SerializeGraphicsAvailability(probed_));
+  ASSERT_TRUE(parsed.has_value());
+  EXPECT_EQ(SerializeGraphicsAvailability(*parsed),
+            SerializeGraphicsAvailability(probed_));
+  EXPECT_TRUE(parsed->has_discrete_gpu);
+  EXPECT_FALSE(parsed->has_vulkan);
+  EXPECT_EQ(parsed->gles2_extensions, probed_.gles2_extensions);
+  EXPECT_EQ(parsed->discrete_gpu_device_name, "GPU\tname");
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, ReusesCachedResults) {
+  EXPECT_EQ(Get().egl_vendor, "Mesa");
+  EXPECT_EQ(probes_, 1);
+
+  probed_.egl_vendor = "Changed";
+  auto cached = Get();
+  EXPECT_EQ(probes_, 1);
+  EXPECT_EQ(background_runs_, 0);
+  EXPECT_TRUE(cached.has_egl);
+  EXPECT_EQ(cached.egl_vendor, "Mesa");
+  EXPECT_EQ(cached.gles2_extensions, probed_.gles2_extensions);
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, ProbesAgainWhenDriversChange) {
+  Get();
+  identity_ = "driver 2\nkernel 6.1";
+  probed_.egl_vendor = "Updated";
+  EXPECT_EQ(Get().egl_vendor, "Updated");
+  EXPECT_EQ(probes_, 2);
+  EXPECT_EQ(Get().egl_vendor, "Updated");
+  EXPECT_EQ(probes_, 2);
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, RefreshesStaleResultsInBackground) {
+  options_.refresh_after = std::chrono::seconds(0);
+  Get();
+  MakeStale();
+
+  probed_.egl_vendor = "Refreshed";
+  // The stale results are returned while they are probed again
+  EXPECT_EQ(Get().egl_vendor, "Mesa");
+  EXPECT_EQ(background_runs_, 1);
+  EXPECT_EQ(probes_, 2);
+
+  options_.refresh_after = std::chrono::hours(1);
+  EXPECT_EQ(Get().egl_vendor, "Refreshed");
+  EXPECT_EQ(probes_, 2);
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, RefreshesStaleResultsInPlace) {
+  options_.refresh_after = std::chrono::seconds(0);
+  options_.start_refresh = nullptr;
+  Get();
+  MakeStale();
+
+  probed_.egl_vendor = "Refreshed";
+  EXPECT_EQ(Get().egl_vendor, "Refreshed");
+  EXPECT_EQ(probes_, 2);
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, RunsOneRefreshAtATime) {
+  Get();
+  probed_.egl_vendor = "Refreshed";
+  {
+    android::base::unique_fd lock_fd(
+        open((options_.path + ".lock").c_str(), O_CREAT | O_RDWR, 0644));
+    ASSERT_GE(lock_fd.get(), 0);
+    ASSERT_EQ(flock(lock_fd.get(), LOCK_EX), 0);
+    EXPECT_FALSE(RefreshGraphicsAvailabilityCache(options_));
+    EXPECT_EQ(probes_, 1);
+  }
+  EXPECT_TRUE(RefreshGraphicsAvailabilityCache(options_));
+  EXPECT_EQ(probes_, 2);
+  EXPECT_EQ(Get().egl_vendor, "Refreshed");
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, ProbesAgainWhenCacheIsCorrupt) {
+  Get();
+  ASSERT_TRUE(android::base::WriteStringToFile("has_egl\tmaybe\n",
+                                               options_.path));
+  EXPECT_EQ(Get().egl_vendor, "Mesa");
+  EXPECT_EQ(probes_, 2);
+  EXPECT_EQ(Get().egl_vendor, "Mesa");
+  EXPECT_EQ(probes_, 2);
+}
+
+TEST_F(GraphicsAvailabilityCacheTest, WorksWithoutCacheFile) {
+  options_.path = "";
+  Get();
+  Get();
+  EXPECT_EQ(probes_, 2);
+}
+
+// detect_graphics refreshes the entries assemble_cvd reads
+TEST(GraphicsDriverIdentityTest, DoesNotDependOnTheProbingBinary) {
+  auto identity = GraphicsDriverIdentity();
+  EXPECT_EQ(identity.find("/proc/self/exe"), std::string::npos);
+  EXPECT_EQ(identity.find(android::base::GetExecutablePath()),
+            std::string::npos);
+  EXPECT_NE(identity.find("probes "), std::string::npos);
+}
+
+}  // namespace
+}  // namespace cuttlefish
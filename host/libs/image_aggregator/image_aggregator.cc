@@ -43,7 +43,6 @@
 #include "common/libs/utils/cf_endian.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/size_utils.h"
-#include "common/libs/utils/subprocess.h"
 #include "host/libs/config/mbr.h"
 #include "host/libs/image_aggregator/sparse_image_utils.h"
 
@@ -147,6 +146,34 @@ struct __attribute__((packed)) QCowHeader {
 
 static_assert(sizeof(QCowHeader) == 72);
 
+/**
+ * Version 3 additions to the qcow2 header. The v3 header is the v2 header
+ * followed by these fields, see docs/interop/qcow2.txt in the QEMU sources.
+ */
+struct __attribute__((packed)) QCowHeaderV3 {
+  QCowHeader v2;
+  Be64 incompatible_features;
+  Be64 compatible_features;
+  Be64 autoclear_features;
+  Be32 refcount_order;
+  Be32 header_size;
+};
+
+static_assert(sizeof(QCowHeaderV3) == 104);
+
+// Matches the defaults `crosvm create_qcow2` uses, so that overlays produced
+// here are byte-for-byte identical to the crosvm ones.
+constexpr std::uint32_t QCOW2_VERSION = 3;
+constexpr std::uint32_t QCOW2_CLUSTER_BITS = 16;
+constexpr std::uint64_t QCOW2_CLUSTER_SIZE = 1ULL << QCOW2_CLUSTER_BITS;
+constexpr std::uint32_t QCOW2_REFCOUNT_ORDER = 4;  // 16-bit refcounts
+// Size of the "end of header extensions" marker written after the header.
+constexpr std::uint64_t QCOW2_HEADER_EXTENSION_END_SIZE = 8;
+
+constexpr std::uint64_t DivRoundUp(std::uint64_t num, std::uint64_t den) {
+  return (num + den - 1) / den;
+}
+
 /*
  * Returns the expanded file size of `file_path`. Note that the raw size of
  * files doesn't match how large they may appear inside a VM.
@@ -540,28 +567,106 @@ void CreateCompositeDisk(std::vector<MultipleImagePartition> partitions,
   composite.flush();
 }
 
-void CreateQcowOverlay(const std::string& crosvm_path,
-                       const std::string& backing_file,
-                       const std::string& output_overlay_path) {
-  Command cmd(crosvm_path);
-  cmd.AddParameter("create_qcow2");
-  cmd.AddParameter("--backing-file");
-  cmd.AddParameter(backing_file);
-  cmd.AddParameter(output_overlay_path);
-
-  std::string stdout_str;
-  std::string stderr_str;
-  int success =
-      RunWithManagedStdio(std::move(cmd), nullptr, &stdout_str, &stderr_str);
-
-  if (success != 0) {
-    LOG(ERROR) << "Failed to run `" << crosvm_path
-               << " create_qcow2 --backing-file " << backing_file << " "
-               << output_overlay_path << "`";
-    LOG(ERROR) << "stdout:\n###\n" << stdout_str << "\n###";
-    LOG(ERROR) << "stderr:\n###\n" << stderr_str << "\n###";
-    LOG(FATAL) << "Return code: \"" << success << "\"";
-  }
+Result<void> CreateQcowOverlay(const std::string& backing_file,
+                               const std::string& output_overlay_path) {
+  constexpr std::uint64_t kCluster = QCOW2_CLUSTER_SIZE;
+  constexpr std::uint64_t kRefcountBytes = (1 << QCOW2_REFCOUNT_ORDER) / 8;
+  constexpr std::uint64_t kL2EntriesPerCluster = kCluster / sizeof(Be64);
+
+  const std::uint64_t header_end = sizeof(QCowHeaderV3) +
+                                   QCOW2_HEADER_EXTENSION_END_SIZE +
+                                   backing_file.size();
+  CF_EXPECT(header_end <= kCluster,
+            "Backing file path too long: \"" << backing_file << "\"");
+  CF_EXPECT(FileExists(backing_file),
+            "Backing file \"" << backing_file << "\" does not exist");
+  const std::uint64_t size = ExpandedStorageSize(backing_file);
+
+  // Layout, in clusters: header, L1 table, refcount table, refcount block.
+  // No L2 tables or data clusters are allocated until the guest writes.
+  const std::uint64_t num_clusters = DivRoundUp(size, kCluster);
+  const std::uint64_t num_l2_clusters =
+      DivRoundUp(num_clusters, kL2EntriesPerCluster);
+  const std::uint64_t l1_clusters =
+      DivRoundUp(num_l2_clusters, kL2EntriesPerCluster);
+  // The refcount table must be contiguous, so reserve enough of it to track
+  // every cluster the image could eventually grow to, as crosvm does.
+  const std::uint64_t max_clusters =
+      num_clusters + l1_clusters + num_l2_clusters + 1;
+  const std::uint64_t refcounts_for_data =
+      DivRoundUp(max_clusters * kRefcountBytes, kCluster);
+  const std::uint64_t refcounts_for_refcounts =
+      DivRoundUp(refcounts_for_data * kRefcountBytes, kCluster);
+  const std::uint64_t refcount_table_clusters = DivRoundUp(
+      (refcounts_for_data + refcounts_for_refcounts) * sizeof(Be64), kCluster);
+
+  const std::uint64_t l1_table_offset = kCluster;
+  const std::uint64_t refcount_table_offset = kCluster * (l1_clusters + 1);
+  const std::uint64_t refcount_block_offset =
+      refcount_table_offset + refcount_table_clusters * kCluster;
+  // Every metadata cluster up to and including the refcount block is in use.
+  const std::uint64_t used_clusters = refcount_block_offset / kCluster + 1;
+  CF_EXPECT(used_clusters <= kCluster / kRefcountBytes,
+            "Disk of size " << size << " needs more than one refcount block");
+
+  QCowHeaderV3 header = {
+      .v2 =
+          {
+              .magic = Be32(0x514649fb),  // QCOW2_MAGIC
+              .version = Be32(QCOW2_VERSION),
+              .backing_file_offset = Be64(sizeof(QCowHeaderV3) +
+                                          QCOW2_HEADER_EXTENSION_END_SIZE),
+              .backing_file_size = Be32(backing_file.size()),
+              .cluster_bits = Be32(QCOW2_CLUSTER_BITS),
+              .size = Be64(size),
+              .crypt_method = Be32(0),
+              .l1_size = Be32(num_l2_clusters),
+              .l1_table_offset = Be64(l1_table_offset),
+              .refcount_table_offset = Be64(refcount_table_offset),
+              .refcount_table_clusters = Be32(refcount_table_clusters),
+              .nb_snapshots = Be32(0),
+              .snapshots_offset = Be64(0),
+          },
+      .incompatible_features = Be64(0),
+      .compatible_features = Be64(0),
+      .autoclear_features = Be64(0),
+      .refcount_order = Be32(QCOW2_REFCOUNT_ORDER),
+      .header_size = Be32(sizeof(QCowHeaderV3)),
+  };
+  std::string header_cluster(header_end, '\0');
+  std::memcpy(header_cluster.data(), &header, sizeof(header));
+  // The header extension area is just the zeroed end marker.
+  std::memcpy(header_cluster.data() + sizeof(header) +
+                  QCOW2_HEADER_EXTENSION_END_SIZE,
+              backing_file.data(), backing_file.size());
+
+  Be64 refcount_table_entry(refcount_block_offset);
+  std::vector<Be16> refcount_block(used_clusters, Be16(1));
+
+  auto overlay = SharedFD::Creat(output_overlay_path, 0600);
+  CF_EXPECT(overlay->IsOpen(), "Could not create \""
+                                   << output_overlay_path
+                                   << "\": " << overlay->StrError());
+  // The L1 table and the unused parts of the refcount structures are left as
+  // holes, which read back as zeroes.
+  CF_EXPECT(overlay->Truncate(refcount_block_offset + kCluster) == 0,
+            "Could not size \"" << output_overlay_path
+                                << "\": " << overlay->StrError());
+  CF_EXPECT(WriteAll(overlay, header_cluster) == header_cluster.size(),
+            "Could not write qcow2 header: " << overlay->StrError());
+  CF_EXPECT(overlay->LSeek(refcount_table_offset, SEEK_SET) != -1,
+            overlay->StrError());
+  CF_EXPECT(WriteAllBinary(overlay, &refcount_table_entry) ==
+                sizeof(refcount_table_entry),
+            "Could not write qcow2 refcount table: " << overlay->StrError());
+  CF_EXPECT(overlay->LSeek(refcount_block_offset, SEEK_SET) != -1,
+            overlay->StrError());
+  const auto refcount_block_bytes = refcount_block.size() * sizeof(Be16);
+  CF_EXPECT(WriteAll(overlay,
+                     reinterpret_cast<const char*>(refcount_block.data()),
+                     refcount_block_bytes) == refcount_block_bytes,
+            "Could not write qcow2 refcount block: " << overlay->StrError());
+  return {};
 }
 
 } // namespace cuttlefish
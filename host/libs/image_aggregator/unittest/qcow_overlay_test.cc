@@ -0,0 +1,151 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/endian.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint64_t kClusterSize = 1 << 16;
+
+std::uint32_t ReadBe32(const std::string& data, std::size_t offset) {
+  std::uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return be32toh(value);
+}
+
+std::uint64_t ReadBe64(const std::string& data, std::size_t offset) {
+  std::uint64_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return be64toh(value);
+}
+
+std::uint16_t ReadBe16(const std::string& data, std::size_t offset) {
+  std::uint16_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return be16toh(value);
+}
+
+std::string CreateBackingFile(const TemporaryDir& dir, off_t size) {
+  std::string path = std::string(dir.path) + "/backing.img";
+  auto fd = SharedFD::Creat(path, 0600);
+  EXPECT_TRUE(fd->IsOpen()) << fd->StrError();
+  EXPECT_EQ(fd->Truncate(size), 0) << fd->StrError();
+  return path;
+}
+
+}  // namespace
+
+TEST(QcowOverlay, HeaderMatchesBackingFile) {
+  TemporaryDir dir;
+  constexpr std::uint64_t kBackingSize = 64 << 20;
+  auto backing = CreateBackingFile(dir, kBackingSize);
+  auto overlay = std::string(dir.path) + "/overlay.img";
+
+  auto res = CreateQcowOverlay(backing, overlay);
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+
+  std::string data;
+  ASSERT_TRUE(android::base::ReadFileToString(overlay, &data));
+  ASSERT_EQ(data.size() % kClusterSize, 0u);
+
+  EXPECT_EQ(data.substr(0, 4), "QFI\xfb");
+  EXPECT_EQ(ReadBe32(data, 4), 3u);  // version
+  EXPECT_EQ(ReadBe64(data, 24), kBackingSize);  // size
+  EXPECT_EQ(ReadBe32(data, 20), 16u);  // cluster_bits
+  EXPECT_EQ(ReadBe32(data, 96), 4u);  // refcount_order
+  EXPECT_EQ(ReadBe32(data, 100), 104u);  // header_size
+  EXPECT_EQ(ReadBe64(data, 104), 0u);  // end of extensions
+
+  auto backing_offset = ReadBe64(data, 8);
+  auto backing_size = ReadBe32(data, 16);
+  EXPECT_EQ(data.substr(backing_offset, backing_size), backing);
+
+  // 1024 data clusters fit in a single L2 table.
+  EXPECT_EQ(ReadBe32(data, 36), 1u);  // l1_size
+  auto l1_offset = ReadBe64(data, 40);
+  EXPECT_EQ(l1_offset, kClusterSize);
+  EXPECT_EQ(ReadBe64(data, l1_offset), 0u);
+
+  auto refcount_table_offset = ReadBe64(data, 48);
+  auto refcount_table_clusters = ReadBe32(data, 56);
+  auto refcount_block_offset = ReadBe64(data, refcount_table_offset);
+  EXPECT_EQ(refcount_block_offset,
+            refcount_table_offset + refcount_table_clusters * kClusterSize);
+  EXPECT_EQ(refcount_block_offset + kClusterSize, data.size());
+
+  // Every cluster in the file is referenced exactly once, nothing else is.
+  auto file_clusters = data.size() / kClusterSize;
+  for (std::size_t i = 0; i < kClusterSize / 2; i++) {
+    EXPECT_EQ(ReadBe16(data, refcount_block_offset + 2 * i),
+              i < file_clusters ? 1u : 0u)
+        << "cluster " << i;
+  }
+}
+
+TEST(QcowOverlay, RejectsMissingBackingFile) {
+  TemporaryDir dir;
+  auto overlay = std::string(dir.path) + "/overlay.img";
+  EXPECT_FALSE(CreateQcowOverlay(std::string(dir.path) + "/missing", overlay)
+                   .ok());
+}
+
+// Checks the overlay against the one crosvm writes. Runs only when the crosvm
+// binary is pointed to by CROSVM_BINARY.
+TEST(QcowOverlay, MatchesCrosvm) {
+  auto crosvm = StringFromEnv("CROSVM_BINARY", "");
+  if (crosvm.empty() || !FileExists(crosvm)) {
+    GTEST_SKIP() << "CROSVM_BINARY not set";
+  }
+  TemporaryDir dir;
+  for (off_t size : {off_t(1) << 20, off_t(3) << 30, (off_t(17) << 30) + 512}) {
+    auto backing = CreateBackingFile(dir, size);
+    auto native = std::string(dir.path) + "/native.img";
+    auto reference = std::string(dir.path) + "/crosvm.img";
+
+    auto res = CreateQcowOverlay(backing, native);
+    ASSERT_TRUE(res.ok()) << res.error().Trace();
+
+    Command cmd(crosvm);
+    cmd.AddParameter("create_qcow2");
+    cmd.AddParameter("--backing-file");
+    cmd.AddParameter(backing);
+    cmd.AddParameter(reference);
+    ASSERT_EQ(cmd.Start().Wait(), 0);
+
+    std::string native_data;
+    std::string reference_data;
+    ASSERT_TRUE(android::base::ReadFileToString(native, &native_data));
+    ASSERT_TRUE(android::base::ReadFileToString(reference, &reference_data));
+    EXPECT_EQ(native_data, reference_data) << "backing size " << size;
+
+    RemoveFile(native);
+    RemoveFile(reference);
+  }
+}
+
+}  // namespace cuttlefish
@@ -42,7 +42,30 @@ Result<grpc::Status> GnssClient::SendGpsLocations(
     curr->set_latitude(loc.latitude);
     curr->set_elevation(loc.elevation);
   }
+  return Send(request);
+}
+
+Result<grpc::Status> GnssClient::SendGpsLocations(int delay,
+                                                  GpsFixStream& fixes,
+                                                  double playback_speed) {
+  SendGpsCoordinatesRequest request;
+  request.set_delay(delay);
+  request.set_playback_speed(playback_speed);
+  GpsFix loc;
+  std::string error;
+  while (fixes.next(&loc, &error)) {
+    GpsCoordinates* curr = request.add_coordinates();
+    curr->set_longitude(loc.longitude);
+    curr->set_latitude(loc.latitude);
+    curr->set_elevation(loc.elevation);
+    curr->set_time(loc.time);
+  }
+  CF_EXPECT(error.empty(), "Failed to read the GPS fixes: " << error);
+  return Send(request);
+}
 
+Result<grpc::Status> GnssClient::Send(
+    const SendGpsCoordinatesRequest& request) {
   // Container for the data we expect from the server.
   SendGpsCoordinatesReply reply;
   // Context for the client. It could be used to convey extra information to
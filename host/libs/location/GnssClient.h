@@ -30,8 +30,16 @@ class GnssClient {
 
   Result<grpc::Status> SendGpsLocations(
       int delay, const GpsFixArray& coordinates);
+  // Sends the fixes read from |fixes| with their timestamps, which the proxy
+  // plays |playback_speed| times faster. |delay| separates the fixes without
+  // timestamps.
+  Result<grpc::Status> SendGpsLocations(int delay, GpsFixStream& fixes,
+                                        double playback_speed);
 
  private:
+  Result<grpc::Status> Send(
+      const gnss_grpc_proxy::SendGpsCoordinatesRequest& request);
+
   std::unique_ptr<gnss_grpc_proxy::GnssGrpcProxy::Stub> stub_;
 };
 }  // namespace cuttlefish
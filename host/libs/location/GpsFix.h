@@ -18,7 +18,9 @@
 
 #include <time.h>
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 // A struct representing a location on a map
@@ -34,3 +36,33 @@ struct GpsFix {
 };
 
 typedef std::vector<GpsFix> GpsFixArray;
+
+// Reads GPS fixes one at a time, in the order they are found.
+class GpsFixStream {
+ public:
+  virtual ~GpsFixStream() = default;
+
+  // Reads the next fix into |*fix|. Returns false at the end of the fixes or
+  // on error, |*error| is set to a string describing the error in the latter
+  // case and cleared otherwise.
+  virtual bool next(GpsFix *fix, std::string *error) = 0;
+};
+
+// A stream over fixes that are already in memory.
+class GpsFixArrayStream : public GpsFixStream {
+ public:
+  explicit GpsFixArrayStream(GpsFixArray fixes) : fixes_(std::move(fixes)) {}
+
+  bool next(GpsFix *fix, std::string *error) override {
+    error->clear();
+    if (next_ == fixes_.size()) {
+      return false;
+    }
+    *fix = std::move(fixes_[next_++]);
+    return true;
+  }
+
+ private:
+  GpsFixArray fixes_;
+  size_t next_ = 0;
+};
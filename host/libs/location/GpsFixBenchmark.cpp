@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reads synthetic drive traces of increasing length, loading the whole
+// document like the parsers used to and streaming it, and measures how far
+// from their due times the scheduler delivers fixes compared to a thread
+// sleeping between fixes.
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <libxml/parser.h>
+
+#include "host/libs/location/GpsFixScheduler.h"
+#include "host/libs/location/GpxParser.h"
+#include "host/libs/location/KmlParser.h"
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A drive with a fix every second, as a GPX track or a KML LineString
+class SyntheticTraces {
+ public:
+  const std::string& Gpx(int fixes) {
+    auto& path = gpx_[fixes];
+    if (path.empty()) {
+      path = std::string(dir_.path) + "/trace" + std::to_string(fixes) + ".gpx";
+      std::ofstream file(path);
+      file << "<?xml version=\"1.0\"?>\n<gpx><trk><trkseg>\n";
+      for (int i = 0; i < fixes; i++) {
+        time_t time = 1672531200 + i;
+        char iso_time[32];
+        strftime(iso_time, sizeof(iso_time), "%Y-%m-%dT%H:%M:%SZ",
+                 gmtime(&time));
+        file << "<trkpt lat=\"" << Latitude(i) << "\" lon=\"" << Longitude(i)
+             << "\"><ele>" << i % 100 << "</ele><time>" << iso_time
+             << "</time></trkpt>\n";
+      }
+      file << "</trkseg></trk></gpx>\n";
+    }
+    return path;
+  }
+
+  const std::string& Kml(int fixes) {
+    auto& path = kml_[fixes];
+    if (path.empty()) {
+      path = std::string(dir_.path) + "/trace" + std::to_string(fixes) + ".kml";
+      std::ofstream file(path);
+      file << "<?xml version=\"1.0\"?>\n"
+           << "<kml><Document><Placemark><name>Drive</name><LineString>"
+           << "<coordinates>\n";
+      for (int i = 0; i < fixes; i++) {
+        file << Longitude(i) << "," << Latitude(i) << "," << i % 100 << "\n";
+      }
+      file << "</coordinates></LineString></Placemark></Document></kml>\n";
+    }
+    return path;
+  }
+
+ private:
+  static double Latitude(int i) { return 37.4 + i * 1e-5; }
+  static double Longitude(int i) { return -122.08 + i * 1e-5; }
+
+  TemporaryDir dir_;
+  std::map<int, std::string> gpx_;
+  std::map<int, std::string> kml_;
+};
+
+SyntheticTraces& Traces() {
+  static SyntheticTraces traces;
+  return traces;
+}
+
+// The document tree the parsers used to build before extracting any fix
+void BM_GpxLoadDocument(benchmark::State& state) {
+  const auto& path = Traces().Gpx(state.range(0));
+  for (auto _ : state) {
+    xmlDocPtr doc = xmlReadFile(path.c_str(), nullptr, 0);
+    CHECK(doc != nullptr);
+    xmlFreeDoc(doc);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_GpxStream(benchmark::State& state) {
+  const auto& path = Traces().Gpx(state.range(0));
+  for (auto _ : state) {
+    std::string error;
+    auto stream = GpxParser::openFile(path.c_str(), &error);
+    CHECK(stream) << error;
+    GpsFix fix;
+    int64_t fixes = 0;
+    while (stream->next(&fix, &error)) {
+      fixes++;
+    }
+    CHECK(error.empty()) << error;
+    CHECK_EQ(fixes, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_GpxParseFile(benchmark::State& state) {
+  const auto& path = Traces().Gpx(state.range(0));
+  for (auto _ : state) {
+    GpsFixArray fixes;
+    std::string error;
+    CHECK(GpxParser::parseFile(path.c_str(), &fixes, &error)) << error;
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_KmlStream(benchmark::State& state) {
+  const auto& path = Traces().Kml(state.range(0));
+  for (auto _ : state) {
+    std::string error;
+    auto stream = KmlParser::openFile(path.c_str(), &error);
+    CHECK(stream) << error;
+    GpsFix fix;
+    int64_t fixes = 0;
+    while (stream->next(&fix, &error)) {
+      fixes++;
+    }
+    CHECK(error.empty()) << error;
+    CHECK_EQ(fixes, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// 1 hour, 8 hours and 24 hours of driving
+#define TRACE_SIZES ->Arg(3600)->Arg(8 * 3600)->Arg(24 * 3600)
+
+BENCHMARK(BM_GpxLoadDocument) TRACE_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GpxStream) TRACE_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GpxParseFile) TRACE_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_KmlStream) TRACE_SIZES->Unit(benchmark::kMillisecond);
+
+constexpr int kJitterFixes = 200;
+constexpr std::chrono::milliseconds kJitterInterval(5);
+
+void ReportLateness(benchmark::State& state,
+                    std::vector<std::chrono::nanoseconds> lateness) {
+  std::sort(lateness.begin(), lateness.end());
+  auto micros = [](std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+  state.counters["p50_us"] = micros(lateness[lateness.size() / 2]);
+  state.counters["p99_us"] = micros(lateness[lateness.size() * 99 / 100]);
+  state.counters["max_us"] = micros(lateness.back());
+}
+
+// How late each fix reaches the sink, relative to start + i * interval
+void BM_SchedulerJitter(benchmark::State& state) {
+  std::vector<std::chrono::nanoseconds> lateness;
+  for (auto _ : state) {
+    std::mutex mutex;
+    std::condition_variable done;
+    GpsFixArray fixes(kJitterFixes);
+    Clock::time_point start;
+    int delivered = 0;
+    GpsFixScheduler scheduler([&](const GpsFixArray& due) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto now = Clock::now();
+      for (size_t i = 0; i < due.size(); i++, delivered++) {
+        lateness.push_back(now - (start + delivered * kJitterInterval));
+      }
+      done.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(mutex);
+    start = Clock::now();
+    scheduler.Play(std::make_unique<GpsFixArrayStream>(std::move(fixes)),
+                   kJitterInterval);
+    done.wait(lock, [&delivered]() { return delivered == kJitterFixes; });
+  }
+  ReportLateness(state, std::move(lateness));
+}
+
+// The way the fixes used to be played: sleeping for the interval after each
+// one, which lets the time taken by each delivery add up.
+void BM_SleepLoopJitter(benchmark::State& state) {
+  std::vector<std::chrono::nanoseconds> lateness;
+  for (auto _ : state) {
+    auto start = Clock::now();
+    for (int i = 0; i < kJitterFixes; i++) {
+      lateness.push_back(Clock::now() - (start + i * kJitterInterval));
+      std::this_thread::sleep_for(kJitterInterval);
+    }
+  }
+  ReportLateness(state, std::move(lateness));
+}
+
+BENCHMARK(BM_SchedulerJitter)->Iterations(5)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SleepLoopJitter)->Iterations(5)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
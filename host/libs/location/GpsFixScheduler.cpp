@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/location/GpsFixScheduler.h"
+
+#include <string>
+#include <utility>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+
+GpsFixScheduler::GpsFixScheduler(Sink sink)
+    : sink_(std::move(sink)), thread_([this]() { Loop(); }) {}
+
+GpsFixScheduler::~GpsFixScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void GpsFixScheduler::Play(std::unique_ptr<GpsFixStream> fixes,
+                           std::chrono::milliseconds interval, double speed) {
+  if (speed <= 0) {
+    speed = 1.0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fixes_ = std::move(fixes);
+    speed_ = speed;
+    interval_ = std::chrono::duration_cast<Clock::duration>(interval / speed);
+    next_fix_.reset();
+    next_due_ = Clock::now();
+    previous_time_ = 0;
+    first_fix_ = true;
+  }
+  cv_.notify_one();
+}
+
+void GpsFixScheduler::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fixes_.reset();
+  next_fix_.reset();
+}
+
+// Reads the fix after the current one and works out when it's due. Due times
+// follow from the previous due time rather than from when the previous fix
+// was delivered, so late deliveries don't add up.
+bool GpsFixScheduler::ReadNextFix() {
+  GpsFix fix;
+  std::string error;
+  if (!fixes_->next(&fix, &error)) {
+    if (!error.empty()) {
+      LOG(ERROR) << "Stopped playing GPS fixes: " << error;
+    }
+    fixes_.reset();
+    return false;
+  }
+  if (first_fix_) {
+    first_fix_ = false;
+  } else if (fix.time && previous_time_ && fix.time >= previous_time_) {
+    std::chrono::duration<double> delay(fix.time - previous_time_);
+    next_due_ += std::chrono::duration_cast<Clock::duration>(delay / speed_);
+  } else {
+    next_due_ += interval_;
+  }
+  previous_time_ = fix.time;
+  next_fix_ = std::move(fix);
+  return true;
+}
+
+void GpsFixScheduler::Loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!exit_) {
+    if (!next_fix_ && (!fixes_ || !ReadNextFix())) {
+      cv_.wait(lock);
+      continue;
+    }
+    if (Clock::now() < next_due_) {
+      // Woken up early by Play(), Stop() or the destructor, or spuriously
+      cv_.wait_until(lock, next_due_);
+      continue;
+    }
+    GpsFixArray due;
+    auto now = Clock::now();
+    do {
+      due.push_back(std::move(*next_fix_));
+      next_fix_.reset();
+    } while (fixes_ && ReadNextFix() && next_due_ <= now);
+    lock.unlock();
+    sink_(due);
+    lock.lock();
+  }
+}
+
+}  // namespace cuttlefish
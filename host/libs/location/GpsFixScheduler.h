@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "host/libs/location/GpsFix.h"
+
+namespace cuttlefish {
+
+// Plays GPS fixes back on a thread of its own, which sleeps until the next fix
+// is due. A fix is due when its timestamp says, counting from the first fix,
+// which is due as soon as the playback starts. A fix without a timestamp, or
+// with one earlier than the previous fix's, is due an interval after the
+// previous one. Only the next fix is read ahead from the stream.
+class GpsFixScheduler {
+ public:
+  // Receives the fixes as they fall due. Fixes falling due together, or
+  // before the previous delivery returned, come in the same call.
+  using Sink = std::function<void(const GpsFixArray&)>;
+
+  explicit GpsFixScheduler(Sink sink);
+  ~GpsFixScheduler();
+
+  // Replaces the fixes being played with |fixes|. |interval| separates the
+  // fixes without usable timestamps, the delays between all the fixes are
+  // divided by |speed|.
+  void Play(std::unique_ptr<GpsFixStream> fixes,
+            std::chrono::milliseconds interval, double speed = 1.0);
+  // Stops the playback, without any further delivery.
+  void Stop();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void Loop();
+  bool ReadNextFix();
+
+  Sink sink_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool exit_ = false;
+  std::unique_ptr<GpsFixStream> fixes_;
+  Clock::duration interval_{};
+  double speed_ = 1.0;
+  std::optional<GpsFix> next_fix_;
+  Clock::time_point next_due_;
+  time_t previous_time_ = 0;
+  bool first_fix_ = true;
+
+  std::thread thread_;
+};
+
+}  // namespace cuttlefish
@@ -15,10 +15,11 @@
  */
 
 #include "GpxParser.h"
-#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <string.h>
 #include <time.h>
 #include <algorithm>
+#include <vector>
 #include "StringParse.h"
 
 using std::string;
@@ -31,193 +32,232 @@ static string formatError(const char *format, Args &&...args) {
   return buf;
 }
 
-static void cleanupXmlDoc(xmlDoc *doc) {
-  xmlFreeDoc(doc);
-  xmlCleanupParser();
+static const char kNotParsedError[] = "GPX document not parsed successfully.";
+
+namespace {
+
+// Walks the document with an xmlTextReader, which only keeps the nodes around
+// the current one in memory, and stops at every point element.
+class GpxStream : public GpsFixStream {
+ public:
+  explicit GpxStream(xmlTextReaderPtr reader) : reader_(reader) {}
+  ~GpxStream() override { xmlFreeTextReader(reader_); }
+
+  bool next(GpsFix *fix, string *error) override;
+
+ private:
+  bool isPoint(const char *name, int depth) const;
+  bool parseCoordinate(const char *attribute, const char *description,
+                       int line, float *result, string *error);
+  bool parseLocation(GpsFix *result, string *error);
+  time_t toTime(struct tm *time);
+
+  xmlTextReaderPtr reader_;
+  // The names of the elements enclosing the current one
+  std::vector<string> path_;
+  // The start of the hour of the last point, the hour its time falls in
+  time_t hourStart_ = 0;
+  struct tm hour_ = {};
+};
+
+// <wpt> elements are found directly under the root, <rtept> elements within a
+// <rte> and <trkpt> elements within the <trkseg> of a <trk>.
+bool GpxStream::isPoint(const char *name, int depth) const {
+  if (!strcmp(name, "wpt")) {
+    return depth == 1;
+  }
+  if (!strcmp(name, "rtept")) {
+    return depth == 2 && path_[1] == "rte";
+  }
+  if (!strcmp(name, "trkpt")) {
+    return depth == 3 && path_[1] == "trk" && path_[2] == "trkseg";
+  }
+  return false;
 }
 
-static bool parseLocation(xmlNode *ptNode, xmlDoc *doc, GpsFix *result,
-                          string *error) {
-  float latitude;
-  float longitude;
-
-  xmlAttrPtr attr;
-  xmlChar *tmpStr;
-
-  // Check for and get the latitude attribute
-  attr = xmlHasProp(ptNode, (const xmlChar *)"lat");
-  if (!attr || !(tmpStr = xmlGetProp(ptNode, (const xmlChar *)"lat"))) {
-    *error = formatError("Point missing a latitude on line %d.", ptNode->line);
-    return false;  // Return error since a point *must* have a latitude
-  } else {
-    int read = SscanfWithCLocale(reinterpret_cast<const char *>(tmpStr), "%f",
-                                 &latitude);
-    xmlFree(tmpStr);  // Caller-freed
-    if (read != 1) {
-      return false;
-    }
+bool GpxStream::parseCoordinate(const char *attribute, const char *description,
+                                int line, float *result, string *error) {
+  xmlChar *tmpStr =
+      xmlTextReaderGetAttribute(reader_, (const xmlChar *)attribute);
+  if (!tmpStr) {
+    *error = formatError("Point missing a %s on line %d.", description, line);
+    return false;  // Return error since a point *must* have both coordinates
+  }
+  int read = SscanfWithCLocale(reinterpret_cast<const char *>(tmpStr), "%f",
+                               result);
+  xmlFree(tmpStr);  // Caller-freed
+  if (read != 1) {
+    *error = formatError("Point has a malformed %s on line %d.", description,
+                         line);
+    return false;
   }
+  return true;
+}
 
-  // Check for and get the longitude attribute
-  attr = xmlHasProp(ptNode, (const xmlChar *)"lon");
-  if (!attr || !(tmpStr = xmlGetProp(ptNode, (const xmlChar *)"lon"))) {
-    *error = formatError("Point missing a longitude on line %d.", ptNode->line);
-    return false;  // Return error since a point *must* have a longitude
-  } else {
-    int read = SscanfWithCLocale(reinterpret_cast<const char *>(tmpStr), "%f",
-                                 &longitude);
-    xmlFree(tmpStr);  // Caller-freed
-    if (read != 1) {
-      return false;
-    }
+// mktime() is slow enough to dominate the parsing of a track, and points
+// usually come in the same hour as the previous one.
+time_t GpxStream::toTime(struct tm *time) {
+  int seconds = time->tm_min * 60 + time->tm_sec;
+  if (time->tm_year != hour_.tm_year || time->tm_mon != hour_.tm_mon ||
+      time->tm_mday != hour_.tm_mday || time->tm_hour != hour_.tm_hour ||
+      hourStart_ == 0) {
+    hour_ = *time;
+    hour_.tm_min = 0;
+    hour_.tm_sec = 0;
+    struct tm hour = hour_;
+    hourStart_ = mktime(&hour);
   }
+  return hourStart_ + seconds;
+}
 
-  // The result will be valid if this point is reached
-  result->latitude = latitude;
-  result->longitude = longitude;
+bool GpxStream::parseLocation(GpsFix *result, string *error) {
+  int line = xmlTextReaderGetParserLineNumber(reader_);
+  if (!parseCoordinate("lat", "latitude", line, &result->latitude, error) ||
+      !parseCoordinate("lon", "longitude", line, &result->longitude, error)) {
+    return false;
+  }
+  if (xmlTextReaderIsEmptyElement(reader_)) {
+    return true;
+  }
 
   // Check for potential children nodes (including time, elevation, name, and
   // description) Note that none are actually required according to the GPX
   // format.
-  int childCount = 0;
-  for (xmlNode *field = ptNode->children; field; field = field->next) {
-    tmpStr = nullptr;
-
-    if (!strcmp((const char *)field->name, "time")) {
-      if ((tmpStr = xmlNodeListGetString(doc, field->children, 1))) {
-        // Convert to a number
-        struct tm time = {};
-        time.tm_isdst = -1;
-        int results = sscanf((const char *)tmpStr, "%u-%u-%uT%u:%u:%u",
-                             &time.tm_year, &time.tm_mon, &time.tm_mday,
-                             &time.tm_hour, &time.tm_min, &time.tm_sec);
-        if (results != 6) {
-          *error = formatError(
-              "Improperly formatted time on line %d.<br/>"
-              "Times must be in ISO format.",
-              ptNode->line);
-          return false;
-        }
-
-        // Correct according to the struct tm specification
-        time.tm_year -= 1900;  // Years since 1900
-        time.tm_mon -= 1;      // Months since January, 0-11
-
-        result->time = mktime(&time);
-        xmlFree(tmpStr);  // Caller-freed
-        childCount++;
-      }
-    } else if (!strcmp((const char *)field->name, "ele")) {
-      if ((tmpStr = xmlNodeListGetString(doc, field->children, 1))) {
-        int read = SscanfWithCLocale(reinterpret_cast<const char *>(tmpStr),
-                                     "%f", &result->elevation);
-        xmlFree(tmpStr);  // Caller-freed
-        if (read != 1) {
-          return false;
-        }
-        childCount++;
-      }
-    } else if (!strcmp((const char *)field->name, "name")) {
-      if ((tmpStr = xmlNodeListGetString(doc, field->children, 1))) {
-        result->name = reinterpret_cast<const char *>(tmpStr);
-        xmlFree(tmpStr);  // Caller-freed
-        childCount++;
-      }
-    } else if (!strcmp((const char *)field->name, "desc")) {
-      if ((tmpStr = xmlNodeListGetString(doc, field->children, 1))) {
-        result->description = reinterpret_cast<const char *>(tmpStr);
-        xmlFree(tmpStr);  // Caller-freed
-        childCount++;
-      }
+  int depth = xmlTextReaderDepth(reader_);
+  int ret;
+  while ((ret = xmlTextReaderRead(reader_)) == 1) {
+    int type = xmlTextReaderNodeType(reader_);
+    if (type == XML_READER_TYPE_END_ELEMENT &&
+        xmlTextReaderDepth(reader_) == depth) {
+      return true;
     }
-
-    // We only care about 4 potential child fields, so quit after finding those
-    if (childCount == 4) {
-      break;
+    if (type != XML_READER_TYPE_ELEMENT ||
+        xmlTextReaderDepth(reader_) != depth + 1) {
+      continue;
+    }
+    const char *name = (const char *)xmlTextReaderConstLocalName(reader_);
+    if (strcmp(name, "time") && strcmp(name, "ele") && strcmp(name, "name") &&
+        strcmp(name, "desc")) {
+      continue;
+    }
+    xmlChar *tmpStr = xmlTextReaderReadString(reader_);
+    if (!tmpStr || !*tmpStr) {
+      xmlFree(tmpStr);
+      continue;
     }
-  }
-
-  return true;
-}
 
-static bool parse(xmlDoc *doc, GpsFixArray *fixes, string *error) {
-  xmlNode *root = xmlDocGetRootElement(doc);
-  GpsFix location;
-  bool isOk;
-
-  for (xmlNode *child = root->children; child; child = child->next) {
-    // Individual <wpt> elements are parsed on their own
-    if (!strcmp((const char *)child->name, "wpt")) {
-      isOk = parseLocation(child, doc, &location, error);
-      if (!isOk) {
-        cleanupXmlDoc(doc);
+    if (!strcmp(name, "time")) {
+      // Convert to a number
+      struct tm time = {};
+      time.tm_isdst = -1;
+      int results = sscanf((const char *)tmpStr, "%u-%u-%uT%u:%u:%u",
+                           &time.tm_year, &time.tm_mon, &time.tm_mday,
+                           &time.tm_hour, &time.tm_min, &time.tm_sec);
+      xmlFree(tmpStr);  // Caller-freed
+      if (results != 6) {
+        *error = formatError(
+            "Improperly formatted time on line %d.<br/>"
+            "Times must be in ISO format.",
+            line);
         return false;
       }
-      fixes->push_back(location);
-    }
 
-    // <rte> elements require an additional depth of parsing
-    else if (!strcmp((const char *)child->name, "rte")) {
-      for (xmlNode *rtept = child->children; rtept; rtept = rtept->next) {
-        // <rtept> elements are parsed just like <wpt> elements
-        if (!strcmp((const char *)rtept->name, "rtept")) {
-          isOk = parseLocation(rtept, doc, &location, error);
-          if (!isOk) {
-            cleanupXmlDoc(doc);
-            return false;
-          }
-          fixes->push_back(location);
-        }
+      // Correct according to the struct tm specification
+      time.tm_year -= 1900;  // Years since 1900
+      time.tm_mon -= 1;      // Months since January, 0-11
+
+      result->time = toTime(&time);
+    } else if (!strcmp(name, "ele")) {
+      int read = SscanfWithCLocale(reinterpret_cast<const char *>(tmpStr),
+                                   "%f", &result->elevation);
+      xmlFree(tmpStr);  // Caller-freed
+      if (read != 1) {
+        *error = formatError("Point has a malformed elevation on line %d.",
+                             line);
+        return false;
       }
+    } else if (!strcmp(name, "name")) {
+      result->name = reinterpret_cast<const char *>(tmpStr);
+      xmlFree(tmpStr);  // Caller-freed
+    } else {
+      result->description = reinterpret_cast<const char *>(tmpStr);
+      xmlFree(tmpStr);  // Caller-freed
     }
+  }
+  *error = kNotParsedError;
+  return false;
+}
 
-    // <trk> elements require two additional depths of parsing
-    else if (!strcmp((const char *)child->name, "trk")) {
-      for (xmlNode *trkseg = child->children; trkseg; trkseg = trkseg->next) {
-        // Skip non <trkseg> elements
-        if (!strcmp((const char *)trkseg->name, "trkseg")) {
-          // <trkseg> elements an additional depth of parsing
-          for (xmlNode *trkpt = trkseg->children; trkpt; trkpt = trkpt->next) {
-            // <trkpt> elements are parsed just like <wpt> elements
-            if (!strcmp((const char *)trkpt->name, "trkpt")) {
-              isOk = parseLocation(trkpt, doc, &location, error);
-              if (!isOk) {
-                cleanupXmlDoc(doc);
-                return false;
-              }
-              fixes->push_back(location);
-            }
-          }
-        }
-      }
+bool GpxStream::next(GpsFix *fix, string *error) {
+  error->clear();
+  int ret;
+  while ((ret = xmlTextReaderRead(reader_)) == 1) {
+    if (xmlTextReaderNodeType(reader_) != XML_READER_TYPE_ELEMENT) {
+      continue;
+    }
+    int depth = xmlTextReaderDepth(reader_);
+    const char *name = (const char *)xmlTextReaderConstLocalName(reader_);
+    path_.resize(depth);
+    if (isPoint(name, depth)) {
+      *fix = GpsFix();
+      return parseLocation(fix, error);
     }
+    if (!xmlTextReaderIsEmptyElement(reader_)) {
+      path_.push_back(name);
+    }
+  }
+  if (ret < 0) {
+    *error = kNotParsedError;
+  }
+  return false;
+}
+
+bool parse(std::unique_ptr<GpsFixStream> stream, GpsFixArray *fixes,
+           string *error) {
+  if (!stream) {
+    return false;
+  }
+  GpsFix location;
+  while (stream->next(&location, error)) {
+    fixes->push_back(std::move(location));
+  }
+  if (!error->empty()) {
+    return false;
   }
 
   // Sort the values by timestamp
   std::sort(fixes->begin(), fixes->end());
-
-  cleanupXmlDoc(doc);
   return true;
 }
 
+}  // namespace
+
+std::unique_ptr<GpsFixStream> GpxParser::openFile(const char *filePath,
+                                                  string *error) {
+  xmlTextReaderPtr reader = xmlReaderForFile(filePath, nullptr, 0);
+  if (reader == nullptr) {
+    *error = kNotParsedError;
+    return nullptr;
+  }
+  return std::make_unique<GpxStream>(reader);
+}
+
+std::unique_ptr<GpsFixStream> GpxParser::openString(const char *str, int len,
+                                                    string *error) {
+  xmlTextReaderPtr reader = xmlReaderForMemory(str, len, NULL, NULL, 0);
+  if (reader == nullptr) {
+    *error = kNotParsedError;
+    return nullptr;
+  }
+  return std::make_unique<GpxStream>(reader);
+}
+
 bool GpxParser::parseFile(const char *filePath, GpsFixArray *fixes,
                           string *error) {
-  xmlDocPtr doc = xmlReadFile(filePath, nullptr, 0);
-  if (doc == nullptr) {
-    cleanupXmlDoc(doc);
-    *error = "GPX document not parsed successfully.";
-    return false;
-  }
-  return parse(doc, fixes, error);
+  return parse(openFile(filePath, error), fixes, error);
 }
 
 bool GpxParser::parseString(const char *str, int len, GpsFixArray *fixes,
                             string *error) {
-  xmlDocPtr doc = xmlReadMemory(str, len, NULL, NULL, 0);
-  if (doc == nullptr) {
-    cleanupXmlDoc(doc);
-    *error = "GPX document not parsed successfully.";
-    return false;
-  }
-  return parse(doc, fixes, error);
-}
\ No newline at end of file
+  return parse(openString(str, len, error), fixes, error);
+}
@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+
 #include "GpsFix.h"
 
 class GpxParser {
@@ -31,4 +34,18 @@ class GpxParser {
 
   static bool parseString(const char *str, int len, GpsFixArray *fixes,
                           std::string *error);
-};
\ No newline at end of file
+
+  /* Opens a given .gpx file at |filePath| for reading its GPS fixes one at a
+   * time, in document order, without loading the whole document in memory.
+   * Unlike parseFile() the fixes are not sorted by timestamp.
+   *
+   * Returns nullptr on failure, with |*error| set to a string describing the
+   * error.
+   */
+  static std::unique_ptr<GpsFixStream> openFile(const char *filePath,
+                                                std::string *error);
+
+  // Same as openFile(), reading from |str|, which must outlive the stream.
+  static std::unique_ptr<GpsFixStream> openString(const char *str, int len,
+                                                  std::string *error);
+};
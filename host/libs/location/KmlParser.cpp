@@ -15,7 +15,7 @@
  */
 
 #include "KmlParser.h"
-#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <string.h>
 #include <unistd.h>
 #include <string>
@@ -23,19 +23,62 @@
 #include "StringParse.h"
 using std::string;
 
-// Coordinates can be nested arbitrarily deep within a Placemark, depending
-// on the type of object (Point, LineString, Polygon) the Placemark contains
-static xmlNode* findCoordinates(xmlNode* current) {
-  for (; current != nullptr; current = current->next) {
-    if (!strcmp((const char*)current->name, "coordinates")) {
-      return current;
-    }
-    xmlNode* children = findCoordinates(current->xmlChildrenNode);
-    if (children != nullptr) {
-      return children;
-    }
+static const char kNotParsedError[] = "KML document not parsed successfully.";
+static const char kMalformedCoordinatesError[] =
+    "Location found with missing or malformed coordinates";
+
+namespace {
+
+// Walks the document with an xmlTextReader, which only keeps the nodes around
+// the current one in memory. Placemarks (aka locations) can be nested
+// arbitrarily deep, the fixes come from the geometry found directly within
+// them.
+class KmlStream : public GpsFixStream {
+ public:
+  explicit KmlStream(xmlTextReaderPtr reader) : reader_(reader) {}
+  ~KmlStream() override { xmlFreeTextReader(reader_); }
+
+  bool next(GpsFix* fix, string* error) override;
+
+ private:
+  bool nextCoordinate(GpsFix* fix, string* error);
+  bool onElement(const char* name, int depth, GpsFix* fix, string* error);
+  bool onEndElement(int depth, string* error);
+  void emit(GpsFix* fix);
+  string readString();
+
+  xmlTextReaderPtr reader_;
+
+  // The depth of the Placemark being read, -1 outside of them
+  int placemarkDepth_ = -1;
+  string name_;
+  string description_;
+  int placemarkFixes_ = 0;
+  // The depth of the Point, LineString or Polygon being read, -1 outside
+  int geometryDepth_ = -1;
+  bool foundCoordinates_ = false;
+  // The depth of the gx:Track being read, -1 outside
+  int trackDepth_ = -1;
+
+  // The text of a <coordinates> element, parsed one fix at a time
+  string coordinates_;
+  size_t coordinatesOffset_ = 0;
+};
+
+string KmlStream::readString() {
+  xmlChar* tmpStr = xmlTextReaderReadString(reader_);
+  string result = tmpStr ? (const char*)tmpStr : "";
+  xmlFree(tmpStr);
+  return result;
+}
+
+// only assign name and description to the first of the
+// points to avoid needless repetition
+void KmlStream::emit(GpsFix* fix) {
+  if (placemarkFixes_++ == 0) {
+    fix->name = std::move(name_);
+    fix->description = std::move(description_);
   }
-  return nullptr;
 }
 
 // Coordinates have the following format:
@@ -43,171 +86,229 @@ static xmlNode* findCoordinates(xmlNode* current) {
 //                ...
 //                -112.2657374587321,36.08646312301303,2357
 //        </coordinates>
-// often entirely contained in a single string, necessitating regex
-static bool parseCoordinates(xmlNode* current, GpsFixArray* fixes) {
-  xmlNode* coordinates_node = findCoordinates(current);
-  bool result = true;
-  if (coordinates_node == nullptr ||
-      coordinates_node->xmlChildrenNode == nullptr ||
-      coordinates_node->xmlChildrenNode->content == nullptr) {
-    return false;
+// often entirely contained in a single string
+bool KmlStream::nextCoordinate(GpsFix* fix, string* error) {
+  // sscanf() goes through the whole string it's given before parsing
+  // anything, it's only given up to the end of the next fix.
+  size_t end = coordinates_.find(',', coordinatesOffset_);
+  end = coordinates_.find(',', end == string::npos ? end : end + 1);
+  if (end != string::npos) {
+    end = coordinates_.find_first_not_of(" \t\n\r", end + 1);
+    end = coordinates_.find_first_of(" \t\n\r", end);
   }
-
-  const char* coordinates =
-      (const char*)(coordinates_node->xmlChildrenNode->content);
-  int coordinates_len = strlen(coordinates);
-  int offset = 0, n = 0;
-  GpsFix new_fix;
-  while (3 == SscanfWithCLocale(coordinates + offset, "%f , %f , %f%n",
-                                &new_fix.longitude, &new_fix.latitude,
-                                &new_fix.elevation, &n)) {
-    fixes->push_back(new_fix);
-    offset += n;
+  char* coordinates = coordinates_.data() + coordinatesOffset_;
+  char* fixEnd = end == string::npos ? nullptr : coordinates_.data() + end;
+  char saved = fixEnd ? *fixEnd : '\0';
+  if (fixEnd) {
+    *fixEnd = '\0';
+  }
+  int n = 0;
+  *fix = GpsFix();
+  int read = SscanfWithCLocale(coordinates, "%f , %f , %f%n", &fix->longitude,
+                               &fix->latitude, &fix->elevation, &n);
+  if (fixEnd) {
+    *fixEnd = saved;
+  }
+  if (read == 3) {
+    coordinatesOffset_ += n;
+    emit(fix);
+    return true;
   }
-
   // Only allow whitespace at the end of the string to remain unconsumed.
-  for (int i = offset; i < coordinates_len && result; ++i) {
-    result = isspace(coordinates[i]);
+  for (; *coordinates; ++coordinates) {
+    if (!isspace(*coordinates)) {
+      *error = kMalformedCoordinatesError;
+      break;
+    }
   }
-
-  return result;
+  coordinates_.clear();
+  coordinatesOffset_ = 0;
+  return false;
 }
 
-static bool parseGxTrack(xmlNode* children, GpsFixArray* fixes) {
-  bool result = true;
-  for (xmlNode* current = children; result && current != nullptr;
-       current = current->next) {
-    if (current->ns && current->ns->prefix &&
-        !strcmp((const char*)current->ns->prefix, "gx") &&
-        !strcmp((const char*)current->name, "coord")) {
-      std::string coordinates{(const char*)current->xmlChildrenNode->content};
-      GpsFix new_fix;
-      result = (3 == SscanfWithCLocale(coordinates.c_str(), "%f %f %f",
-                                       &new_fix.longitude, &new_fix.latitude,
-                                       &new_fix.elevation));
-      fixes->push_back(new_fix);
+bool KmlStream::onElement(const char* name, int depth, GpsFix* fix,
+                          string* error) {
+  bool empty = xmlTextReaderIsEmptyElement(reader_);
+  if (placemarkDepth_ < 0) {
+    // if it's not a Placemark we must go deeper
+    if (!strcmp(name, "Placemark")) {
+      if (empty) {
+        *error = kMalformedCoordinatesError;
+        return false;
+      }
+      placemarkDepth_ = depth;
+      name_.clear();
+      description_.clear();
+      placemarkFixes_ = 0;
     }
+    return false;
   }
-  return result;
-}
 
-static bool parsePlacemark(xmlNode* current, GpsFixArray* fixes) {
-  string description;
-  string name;
-  size_t ind = string::npos;
-  // not worried about case-sensitivity since .kml files
-  // are expected to be machine-generated
-  for (; current != nullptr; current = current->next) {
-    const bool hasContent =
-        current->xmlChildrenNode && current->xmlChildrenNode->content;
-
-    if (hasContent && !strcmp((const char*)current->name, "description")) {
-      description = (const char*)current->xmlChildrenNode->content;
-    } else if (hasContent && !strcmp((const char*)current->name, "name")) {
-      name = (const char*)current->xmlChildrenNode->content;
-    } else if (!strcmp((const char*)current->name, "Point") ||
-               !strcmp((const char*)current->name, "LineString") ||
-               !strcmp((const char*)current->name, "Polygon")) {
-      ind = (ind != string::npos ? ind : fixes->size());
-      if (!parseCoordinates(current->xmlChildrenNode, fixes)) {
-        return false;
+  if (geometryDepth_ >= 0) {
+    // Coordinates can be nested arbitrarily deep within the geometry,
+    // depending on its type (Point, LineString, Polygon)
+    if (!strcmp(name, "coordinates") && !foundCoordinates_) {
+      foundCoordinates_ = true;
+      coordinates_ = readString();
+      coordinatesOffset_ = 0;
+      if (empty) {
+        *error = kMalformedCoordinatesError;
       }
-    } else if (current->ns && current->ns->prefix &&
-               !strcmp((const char*)current->ns->prefix, "gx") &&
-               !strcmp((const char*)current->name, "Track")) {
-      ind = (ind != string::npos ? ind : fixes->size());
-      if (!parseGxTrack(current->xmlChildrenNode, fixes)) {
+    }
+    return false;
+  }
+
+  const xmlChar* prefix = xmlTextReaderConstPrefix(reader_);
+  bool gx = prefix && !strcmp((const char*)prefix, "gx");
+  if (trackDepth_ >= 0) {
+    if (gx && depth == trackDepth_ + 1 && !strcmp(name, "coord")) {
+      *fix = GpsFix();
+      if (3 != SscanfWithCLocale(readString().c_str(), "%f %f %f",
+                                 &fix->longitude, &fix->latitude,
+                                 &fix->elevation)) {
+        *error = kMalformedCoordinatesError;
         return false;
       }
+      emit(fix);
+      return true;
     }
+    return false;
   }
 
-  if (ind == string::npos || ind >= fixes->size()) {
+  // not worried about case-sensitivity since .kml files
+  // are expected to be machine-generated
+  if (depth != placemarkDepth_ + 1) {
     return false;
   }
+  if (!strcmp(name, "description")) {
+    if (!empty) {
+      description_ = readString();
+    }
+  } else if (!strcmp(name, "name")) {
+    if (!empty) {
+      name_ = readString();
+    }
+  } else if (!strcmp(name, "Point") || !strcmp(name, "LineString") ||
+             !strcmp(name, "Polygon")) {
+    if (empty) {
+      *error = kMalformedCoordinatesError;
+      return false;
+    }
+    geometryDepth_ = depth;
+    foundCoordinates_ = false;
+  } else if (gx && !strcmp(name, "Track") && !empty) {
+    trackDepth_ = depth;
+  }
+  return false;
+}
 
-  // only assign name and description to the first of the
-  // points to avoid needless repetition
-  (*fixes)[ind].description = std::move(description);
-  (*fixes)[ind].name = std::move(name);
-
+bool KmlStream::onEndElement(int depth, string* error) {
+  if (depth == geometryDepth_) {
+    geometryDepth_ = -1;
+    if (!foundCoordinates_) {
+      *error = kMalformedCoordinatesError;
+      return false;
+    }
+  } else if (depth == trackDepth_) {
+    trackDepth_ = -1;
+  } else if (depth == placemarkDepth_) {
+    placemarkDepth_ = -1;
+    if (placemarkFixes_ == 0) {
+      *error = kMalformedCoordinatesError;
+      return false;
+    }
+  }
   return true;
 }
 
-// Placemarks (aka locations) can be nested arbitrarily deep
-static bool traverseSubtree(xmlNode* current, GpsFixArray* fixes,
-                            string* error) {
-  for (; current; current = current->next) {
-    if (current->name != nullptr &&
-        !strcmp((const char*)current->name, "Placemark")) {
-      if (!parsePlacemark(current->xmlChildrenNode, fixes)) {
-        *error = "Location found with missing or malformed coordinates";
-        return false;
+bool KmlStream::next(GpsFix* fix, string* error) {
+  error->clear();
+  while (true) {
+    if (!coordinates_.empty()) {
+      if (nextCoordinate(fix, error)) {
+        return true;
       }
-    } else if (current->name != nullptr &&
-               strcmp((const char*)current->name, "text") != 0) {
-      // if it's not a Placemark we must go deeper
-      if (!traverseSubtree(current->xmlChildrenNode, fixes, error)) {
+      if (!error->empty()) {
         return false;
       }
     }
+
+    int ret = xmlTextReaderRead(reader_);
+    if (ret != 1) {
+      if (ret < 0) {
+        *error = kNotParsedError;
+      }
+      return false;
+    }
+    int depth = xmlTextReaderDepth(reader_);
+    switch (xmlTextReaderNodeType(reader_)) {
+      case XML_READER_TYPE_ELEMENT: {
+        const char* name = (const char*)xmlTextReaderConstLocalName(reader_);
+        if (onElement(name, depth, fix, error)) {
+          return true;
+        }
+        break;
+      }
+      case XML_READER_TYPE_END_ELEMENT:
+        onEndElement(depth, error);
+        break;
+      default:
+        break;
+    }
+    if (!error->empty()) {
+      return false;
+    }
   }
-  error->clear();
-  return true;
 }
 
-bool KmlParser::parseFile(const char* filePath, GpsFixArray* fixes,
-                          string* error) {
-  // This initializes the library and checks potential ABI mismatches between
-  // the version it was compiled for and the actual shared library used.
-  LIBXML_TEST_VERSION
-
-  xmlDocPtr doc = xmlReadFile(filePath, nullptr, 0);
-  if (doc == nullptr) {
-    *error = "KML document not parsed successfully.";
-    xmlFreeDoc(doc);
+bool parse(std::unique_ptr<GpsFixStream> stream, GpsFixArray* fixes,
+           string* error) {
+  if (!stream) {
     return false;
   }
-
-  xmlNodePtr cur = xmlDocGetRootElement(doc);
-  if (cur == nullptr) {
-    *error = "Could not get root element of parsed KML file.";
-    xmlFreeDoc(doc);
-    xmlCleanupParser();
-    return false;
+  GpsFix fix;
+  while (stream->next(&fix, error)) {
+    fixes->push_back(std::move(fix));
   }
-  bool isWellFormed = traverseSubtree(cur, fixes, error);
-
-  xmlFreeDoc(doc);
-  xmlCleanupParser();
-
-  return isWellFormed;
+  return error->empty();
 }
 
-bool KmlParser::parseString(const char* str, int len, GpsFixArray* fixes,
-                            string* error) {
+}  // namespace
+
+std::unique_ptr<GpsFixStream> KmlParser::openFile(const char* filePath,
+                                                  string* error) {
   // This initializes the library and checks potential ABI mismatches between
   // the version it was compiled for and the actual shared library used.
   LIBXML_TEST_VERSION
 
-  xmlDocPtr doc = xmlReadMemory(str, len, NULL, NULL, 0);
-  if (doc == nullptr) {
-    *error = "KML document not parsed successfully.";
-    xmlFreeDoc(doc);
-    return false;
+  xmlTextReaderPtr reader = xmlReaderForFile(filePath, nullptr, 0);
+  if (reader == nullptr) {
+    *error = kNotParsedError;
+    return nullptr;
   }
+  return std::make_unique<KmlStream>(reader);
+}
 
-  xmlNodePtr cur = xmlDocGetRootElement(doc);
-  if (cur == nullptr) {
-    *error = "Could not get root element of parsed KML file.";
-    xmlFreeDoc(doc);
-    xmlCleanupParser();
-    return false;
+std::unique_ptr<GpsFixStream> KmlParser::openString(const char* str, int len,
+                                                    string* error) {
+  // This initializes the library and checks potential ABI mismatches between
+  // the version it was compiled for and the actual shared library used.
+  LIBXML_TEST_VERSION
+
+  xmlTextReaderPtr reader = xmlReaderForMemory(str, len, NULL, NULL, 0);
+  if (reader == nullptr) {
+    *error = kNotParsedError;
+    return nullptr;
   }
-  bool isWellFormed = traverseSubtree(cur, fixes, error);
+  return std::make_unique<KmlStream>(reader);
+}
 
-  xmlFreeDoc(doc);
-  xmlCleanupParser();
+bool KmlParser::parseFile(const char* filePath, GpsFixArray* fixes,
+                          string* error) {
+  return parse(openFile(filePath, error), fixes, error);
+}
 
-  return isWellFormed;
+bool KmlParser::parseString(const char* str, int len, GpsFixArray* fixes,
+                            string* error) {
+  return parse(openString(str, len, error), fixes, error);
 }
@@ -18,6 +18,7 @@
 
 #include "GpsFix.h"
 
+#include <memory>
 #include <string>
 
 class KmlParser {
@@ -30,4 +31,16 @@ class KmlParser {
                         std::string* error);
   static bool parseString(const char* str, int len, GpsFixArray* fixes,
                           std::string* error);
-};
\ No newline at end of file
+
+  // Opens a given .kml file at |filePath| for reading its GPS fixes one at a
+  // time, without loading the whole document in memory. The name and
+  // description of a Placemark go to its first fix, they must come before
+  // its geometry as the KML schema requires.
+  // Returns nullptr on failure, with |*error| set to a message describing
+  // the error.
+  static std::unique_ptr<GpsFixStream> openFile(const char* filePath,
+                                                std::string* error);
+  // Same as openFile(), reading from |str|, which must outlive the stream.
+  static std::unique_ptr<GpsFixStream> openString(const char* str, int len,
+                                                  std::string* error);
+};
@@ -0,0 +1,664 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/log_store/log_store.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <sstream>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <zstd.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kSegmentPrefix[] = "segment-";
+constexpr int kCompressionLevel = 3;
+// Only the start of a line is parsed, logcat puts the tag and pid there.
+constexpr std::size_t kMaxIndexedLineLength = 1024;
+// Size of the blocks unindexed data is split in, and of reads while scanning
+// uncompressed data.
+constexpr std::size_t kChunkSize = 256 << 10;
+constexpr std::size_t kBloomBits = 512;
+
+using Bloom = std::array<std::uint64_t, kBloomBits / 64>;
+
+struct Block {
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::int64_t begin_ms;
+  std::int64_t end_ms;
+  Bloom bloom;
+};
+
+std::int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string SegmentBase(const std::string& directory, unsigned number) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%06u", kSegmentPrefix, number);
+  return directory + "/" + name;
+}
+
+Result<std::set<unsigned>> SegmentNumbers(const std::string& directory) {
+  std::set<unsigned> numbers;
+  for (const auto& name : CF_EXPECT(DirectoryContents(directory))) {
+    if (!android::base::StartsWith(name, kSegmentPrefix)) {
+      continue;
+    }
+    auto digits = name.substr(strlen(kSegmentPrefix));
+    digits = digits.substr(0, digits.find('.'));
+    unsigned number;
+    if (android::base::ParseUint(digits, &number)) {
+      numbers.insert(number);
+    }
+  }
+  return numbers;
+}
+
+// FNV-1a, stable across builds unlike std::hash.
+std::uint64_t Hash(std::string_view key) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : key) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void BloomAdd(Bloom& bloom, std::string_view key) {
+  auto hash = Hash(key);
+  for (auto bit : {hash % kBloomBits, (hash >> 32) % kBloomBits}) {
+    bloom[bit / 64] |= 1ull << (bit % 64);
+  }
+}
+
+bool BloomMayContain(const Bloom& bloom, std::string_view key) {
+  auto hash = Hash(key);
+  for (auto bit : {hash % kBloomBits, (hash >> 32) % kBloomBits}) {
+    if (!(bloom[bit / 64] & (1ull << (bit % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string TagKey(std::string_view tag) { return "t:" + std::string(tag); }
+std::string PidKey(int pid) { return "p:" + std::to_string(pid); }
+
+struct LineInfo {
+  std::optional<int> pid;
+  std::optional<std::string_view> tag;
+};
+
+// Understands logcat's default "threadtime" format:
+//   MM-DD HH:MM:SS.mmm  PID  TID P Tag     : message
+// Other lines, like the kernel's, have no pid or tag.
+LineInfo ParseLine(std::string_view line) {
+  LineInfo info;
+  if (line.size() < 19 || line[2] != '-' || line[5] != ' ' || line[8] != ':' ||
+      line[14] != '.') {
+    return info;
+  }
+  std::size_t pos = 18;
+  auto skip_spaces = [&line, &pos]() {
+    while (pos < line.size() && line[pos] == ' ') {
+      pos++;
+    }
+  };
+  auto number = [&line, &pos]() -> std::optional<int> {
+    int value = 0;
+    auto start = pos;
+    while (pos < line.size() && isdigit((unsigned char)line[pos])) {
+      value = value * 10 + (line[pos++] - '0');
+    }
+    return pos == start ? std::nullopt : std::optional<int>(value);
+  };
+  skip_spaces();
+  auto pid = number();
+  skip_spaces();
+  auto tid = number();
+  skip_spaces();
+  if (!pid || !tid || pos + 2 > line.size() ||
+      !strchr("VDIWEFS", line[pos]) || line[pos + 1] != ' ') {
+    return info;
+  }
+  pos += 2;
+  auto colon = line.find(": ", pos);
+  if (colon == std::string_view::npos) {
+    colon = line.size();
+  }
+  auto tag = line.substr(pos, colon - pos);
+  while (!tag.empty() && tag.back() == ' ') {
+    tag.remove_suffix(1);
+  }
+  info.pid = pid;
+  info.tag = tag;
+  return info;
+}
+
+void AddToBloom(Bloom& bloom, std::string_view line) {
+  auto info = ParseLine(line);
+  if (info.tag) {
+    BloomAdd(bloom, TagKey(*info.tag));
+  }
+  if (info.pid) {
+    BloomAdd(bloom, PidKey(*info.pid));
+  }
+}
+
+std::string FormatBlock(const Block& block) {
+  std::stringstream line;
+  line << block.offset << " " << block.size << " " << block.begin_ms << " "
+       << block.end_ms << " ";
+  char hex[17];
+  for (auto word : block.bloom) {
+    snprintf(hex, sizeof(hex), "%016" PRIx64, word);
+    line << hex;
+  }
+  line << "\n";
+  return line.str();
+}
+
+Result<std::vector<Block>> LoadIndex(const std::string& path) {
+  std::vector<Block> blocks;
+  if (!FileExists(path)) {
+    return blocks;
+  }
+  std::stringstream lines(ReadFile(path));
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::stringstream fields(line);
+    Block block;
+    std::string bloom;
+    fields >> block.offset >> block.size >> block.begin_ms >> block.end_ms >>
+        bloom;
+    // A writer that died mid line leaves a truncated last entry
+    if (fields.fail() || bloom.size() != block.bloom.size() * 16) {
+      LOG(WARNING) << "Ignoring malformed log index entry in \"" << path
+                   << "\": " << line;
+      break;
+    }
+    for (std::size_t i = 0; i < block.bloom.size(); i++) {
+      block.bloom[i] = strtoull(bloom.substr(i * 16, 16).c_str(), nullptr, 16);
+    }
+    blocks.push_back(block);
+  }
+  return blocks;
+}
+
+Result<std::string> ReadAt(SharedFD fd, std::uint64_t offset,
+                           std::size_t size) {
+  CF_EXPECT(fd->LSeek(offset, SEEK_SET) == (off_t)offset, fd->StrError());
+  std::string data(size, '\0');
+  CF_EXPECT(ReadExact(fd, data.data(), size) == (ssize_t)size,
+            "Short read at " << offset << ": " << fd->StrError());
+  return data;
+}
+
+// Length of the longest prefix of `data` ending in a newline, or all of it
+// if there is no newline or `at_end` is set.
+std::size_t WholeLines(std::string_view data, bool at_end) {
+  auto newline = data.rfind('\n');
+  return at_end || newline == std::string_view::npos ? data.size()
+                                                     : newline + 1;
+}
+
+Result<void> SealSegment(const std::string& directory, unsigned number) {
+  auto base = SegmentBase(directory, number);
+  auto raw_path = base + ".log";
+  auto raw_index_path = base + ".log.idx";
+  auto sealed_path = base + ".zst";
+  auto sealed_index_path = base + ".zst.idx";
+  if (FileExists(sealed_index_path)) {
+    // A previous writer died before removing the uncompressed files
+    RemoveFile(raw_path);
+    RemoveFile(raw_index_path);
+    return {};
+  }
+
+  auto in = SharedFD::Open(raw_path, O_RDONLY);
+  CF_EXPECT(in->IsOpen(),
+            "Could not open \"" << raw_path << "\": " << in->StrError());
+  std::uint64_t size = FileSize(raw_path);
+  auto blocks = CF_EXPECT(LoadIndex(raw_index_path));
+  std::uint64_t indexed =
+      blocks.empty() ? 0 : blocks.back().offset + blocks.back().size;
+  CF_EXPECT(indexed <= size, "\"" << raw_index_path << "\" is corrupted");
+  // Data written after the last index entry, by a writer that exited or
+  // didn't know about the index.
+  auto tail_begin = blocks.empty() ? 0 : blocks.back().end_ms;
+  auto tail_end = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      FileModificationTime(raw_path).time_since_epoch())
+                      .count();
+  while (indexed < size) {
+    auto data = CF_EXPECT(ReadAt(
+        in, indexed, std::min<std::uint64_t>(kChunkSize, size - indexed)));
+    auto length = WholeLines(data, indexed + data.size() == size);
+    Block block{.offset = indexed,
+                .size = length,
+                .begin_ms = tail_begin,
+                .end_ms = tail_end,
+                .bloom = {}};
+    for (auto line : android::base::Split(data.substr(0, length), "\n")) {
+      AddToBloom(block.bloom, line);
+    }
+    blocks.push_back(block);
+    indexed += length;
+  }
+
+  auto out = SharedFD::Creat(sealed_path, 0644);
+  CF_EXPECT(out->IsOpen(),
+            "Could not create \"" << sealed_path << "\": " << out->StrError());
+  std::string index;
+  std::string compressed;
+  std::uint64_t offset = 0;
+  for (auto block : blocks) {
+    auto data = CF_EXPECT(ReadAt(in, block.offset, block.size));
+    compressed.resize(ZSTD_compressBound(data.size()));
+    auto compressed_size =
+        ZSTD_compress(compressed.data(), compressed.size(), data.data(),
+                      data.size(), kCompressionLevel);
+    CF_EXPECT(!ZSTD_isError(compressed_size),
+              "zstd: " << ZSTD_getErrorName(compressed_size));
+    CF_EXPECT(WriteAll(out, compressed.data(), compressed_size) ==
+                  (ssize_t)compressed_size,
+              "Could not write \"" << sealed_path << "\": " << out->StrError());
+    block.offset = offset;
+    block.size = compressed_size;
+    offset += compressed_size;
+    index += FormatBlock(block);
+  }
+  out->Close();
+
+  // The compressed index appearing is what makes the segment sealed
+  auto temp_index_path = sealed_index_path + ".tmp";
+  auto index_fd = SharedFD::Creat(temp_index_path, 0644);
+  CF_EXPECT(WriteAll(index_fd, index) == (ssize_t)index.size(),
+            "Could not write \"" << temp_index_path
+                                 << "\": " << index_fd->StrError());
+  index_fd->Close();
+  CF_EXPECT(RenameFile(temp_index_path, sealed_index_path));
+  RemoveFile(raw_path);
+  RemoveFile(raw_index_path);
+  return {};
+}
+
+Result<void> EmitLines(std::string_view data, const LogQuery& query,
+                       const std::function<void(std::string_view)>& callback) {
+  while (!data.empty()) {
+    auto newline = data.find('\n');
+    auto line = data.substr(0, newline);
+    data.remove_prefix(newline == std::string_view::npos ? data.size()
+                                                         : newline + 1);
+    if (!query.tags.empty() || !query.pids.empty()) {
+      auto info = ParseLine(line);
+      if (!query.tags.empty() &&
+          (!info.tag || !query.tags.count(std::string(*info.tag)))) {
+        continue;
+      }
+      if (!query.pids.empty() && (!info.pid || !query.pids.count(*info.pid))) {
+        continue;
+      }
+    }
+    callback(line);
+  }
+  return {};
+}
+
+bool MayMatch(const Block& block, const LogQuery& query) {
+  if ((query.since_ms && block.end_ms < *query.since_ms) ||
+      (query.until_ms && block.begin_ms > *query.until_ms)) {
+    return false;
+  }
+  auto any_of = [&block](const auto& values, const auto& key) {
+    return values.empty() ||
+           std::any_of(values.begin(), values.end(), [&](const auto& value) {
+             return BloomMayContain(block.bloom, key(value));
+           });
+  };
+  return any_of(query.tags, TagKey) && any_of(query.pids, PidKey);
+}
+
+Result<void> QuerySegment(
+    const std::string& directory, unsigned number, const LogQuery& query,
+    const std::function<void(std::string_view)>& callback) {
+  auto base = SegmentBase(directory, number);
+  bool sealed = FileExists(base + ".zst.idx");
+  auto path = base + (sealed ? ".zst" : ".log");
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  if (!fd->IsOpen() && !sealed) {
+    if (FileExists(base + ".zst.idx")) {
+      // Sealed while we were looking
+      return QuerySegment(directory, number, query, callback);
+    }
+    if (!FileExists(path)) {
+      // Removed for being too old, or a sealed index went first
+      return {};
+    }
+  }
+  CF_EXPECT(fd->IsOpen(),
+            "Could not open \"" << path << "\": " << fd->StrError());
+  auto blocks = CF_EXPECT(LoadIndex(path + ".idx"));
+
+  if (!sealed) {
+    // The block being written isn't indexed yet
+    std::uint64_t indexed =
+        blocks.empty() ? 0 : blocks.back().offset + blocks.back().size;
+    std::uint64_t size = FileSize(path);
+    if (indexed < size) {
+      Bloom everything;
+      everything.fill(~0ull);
+      blocks.push_back(Block{
+          .offset = indexed,
+          .size = size - indexed,
+          .begin_ms = blocks.empty() ? 0 : blocks.back().end_ms,
+          .end_ms = std::numeric_limits<std::int64_t>::max(),
+          .bloom = everything,
+      });
+    }
+  }
+
+  std::string decompressed;
+  for (const auto& block : blocks) {
+    if (!MayMatch(block, query)) {
+      continue;
+    }
+    if (!sealed) {
+      // Unindexed data may be a large file from before the store existed
+      std::string partial_line;
+      for (std::uint64_t pos = 0; pos < block.size;) {
+        auto chunk = CF_EXPECT(ReadAt(
+            fd, block.offset + pos,
+            std::min<std::uint64_t>(kChunkSize, block.size - pos)));
+        pos += chunk.size();
+        auto data = partial_line + chunk;
+        auto length = WholeLines(data, pos == block.size);
+        CF_EXPECT(EmitLines(std::string_view(data).substr(0, length), query,
+                            callback));
+        partial_line = data.substr(length);
+      }
+      continue;
+    }
+    auto compressed = CF_EXPECT(ReadAt(fd, block.offset, block.size));
+    auto size = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+    CF_EXPECT(size != ZSTD_CONTENTSIZE_ERROR &&
+                  size != ZSTD_CONTENTSIZE_UNKNOWN,
+              "Bad zstd frame at " << block.offset << " in \"" << path << "\"");
+    decompressed.resize(size);
+    auto result = ZSTD_decompress(decompressed.data(), decompressed.size(),
+                                  compressed.data(), compressed.size());
+    CF_EXPECT(!ZSTD_isError(result), "zstd: " << ZSTD_getErrorName(result));
+    CF_EXPECT(EmitLines(decompressed, query, callback));
+  }
+  return {};
+}
+
+}  // namespace
+
+LogStoreWriter::LogStoreWriter(std::string directory, Options options)
+    : directory_(std::move(directory)), options_(options) {}
+
+Result<std::unique_ptr<LogStoreWriter>> LogStoreWriter::Create(
+    const std::string& directory, const std::string& legacy_path,
+    Options options) {
+  CF_EXPECT(EnsureDirectoryExists(directory));
+  std::unique_ptr<LogStoreWriter> writer(
+      new LogStoreWriter(directory, options));
+  auto numbers = CF_EXPECT(SegmentNumbers(directory));
+  unsigned next = numbers.empty() ? 1 : *numbers.rbegin() + 1;
+  for (auto number : numbers) {
+    if (FileExists(SegmentBase(directory, number) + ".log")) {
+      writer->Seal(number);
+    }
+  }
+  if (!legacy_path.empty()) {
+    struct stat st;
+    if (lstat(legacy_path.c_str(), &st) == 0) {
+      if (S_ISLNK(st.st_mode)) {
+        // Earlier writers linked it to their active segment
+        CF_EXPECT(unlink(legacy_path.c_str()) == 0,
+                  "Could not remove \"" << legacy_path
+                                        << "\": " << strerror(errno));
+      } else if (numbers.empty() && S_ISREG(st.st_mode) && st.st_size > 0) {
+        CF_EXPECT(Copy(legacy_path, SegmentBase(directory, next) + ".log"),
+                  "Could not import \"" << legacy_path << "\"");
+        writer->Seal(next++);
+      }
+    }
+    writer->legacy_path_ = legacy_path;
+    CF_EXPECT(writer->OpenLegacy());
+  }
+  CF_EXPECT(writer->OpenSegment(next));
+  return writer;
+}
+
+LogStoreWriter::~LogStoreWriter() {
+  auto res = CloseBlock();
+  if (!res.ok()) {
+    LOG(ERROR) << "Failed to index the last log block: "
+               << res.error().Message();
+  }
+  std::vector<std::future<void>> seals;
+  {
+    std::lock_guard<std::mutex> lock(seal_mutex_);
+    seals = std::move(seals_);
+  }
+  for (auto& seal : seals) {
+    seal.wait();
+  }
+}
+
+Result<void> LogStoreWriter::OpenSegment(unsigned number) {
+  auto base = SegmentBase(directory_, number);
+  segment_fd_ =
+      SharedFD::Open(base + ".log", O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CF_EXPECT(segment_fd_->IsOpen(), "Could not create \"" << base << ".log\": "
+                                       << segment_fd_->StrError());
+  index_fd_ =
+      SharedFD::Open(base + ".log.idx", O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CF_EXPECT(index_fd_->IsOpen(), "Could not create \"" << base
+                                     << ".log.idx\": "
+                                     << index_fd_->StrError());
+  segment_number_ = number;
+  segment_size_ = 0;
+  block_offset_ = 0;
+  bloom_ = {};
+  return {};
+}
+
+Result<void> LogStoreWriter::OpenLegacy() {
+  legacy_fd_ = SharedFD::Open(
+      legacy_path_, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+  CF_EXPECT(legacy_fd_->IsOpen(), "Could not open \"" << legacy_path_ << "\": "
+                                      << legacy_fd_->StrError());
+  struct stat st;
+  CF_EXPECT(legacy_fd_->Fstat(&st) == 0, legacy_fd_->StrError());
+  legacy_size_ = st.st_size;
+  return {};
+}
+
+Result<void> LogStoreWriter::Append(const char* data, std::size_t size) {
+  if (legacy_fd_->IsOpen()) {
+    // Rotated between appends, which usually end on a line boundary. Readers
+    // following the file by name, like `tail -F`, move on to the new one.
+    if (options_.max_size != 0 && legacy_size_ > 0 &&
+        legacy_size_ >= options_.max_size / 2) {
+      CF_EXPECT(RenameFile(legacy_path_, legacy_path_ + ".old"));
+      CF_EXPECT(OpenLegacy());
+    }
+    CF_EXPECT(WriteAll(legacy_fd_, data, size) == (ssize_t)size,
+              "Could not write log: " << legacy_fd_->StrError());
+    legacy_size_ += size;
+  }
+  auto now = NowMs();
+  // Bytes of `data` already written to the segment
+  std::size_t written = 0;
+  std::size_t line_start = 0;
+  while (line_start < size) {
+    auto newline = static_cast<const char*>(
+        memchr(data + line_start, '\n', size - line_start));
+    if (!newline) {
+      break;
+    }
+    std::size_t line_end = newline - data + 1;
+    line_.append(data + line_start,
+                 std::min(line_end - 1 - line_start,
+                          kMaxIndexedLineLength - line_.size()));
+    IndexLine(line_);
+    line_.clear();
+    line_start = line_end;
+
+    auto block_size = segment_size_ + (line_end - written) - block_offset_;
+    bool block_old = segment_size_ > block_offset_ &&
+                     now - block_begin_ms_ >= options_.block_duration_ms;
+    if (block_size >= options_.block_size || block_old) {
+      CF_EXPECT(Write(data + written, line_end - written, now));
+      written = line_end;
+      CF_EXPECT(CloseBlock());
+      if (segment_size_ >= options_.segment_size) {
+        CF_EXPECT(Rotate());
+      }
+    }
+  }
+  line_.append(data + line_start,
+               std::min(size - line_start,
+                        kMaxIndexedLineLength - line_.size()));
+  CF_EXPECT(Write(data + written, size - written, now));
+  return {};
+}
+
+Result<void> LogStoreWriter::Write(const char* data, std::size_t size,
+                                   std::int64_t now) {
+  if (size == 0) {
+    return {};
+  }
+  if (segment_size_ == block_offset_) {
+    block_begin_ms_ = now;
+  }
+  CF_EXPECT(WriteAll(segment_fd_, data, size) == (ssize_t)size,
+            "Could not write log segment: " << segment_fd_->StrError());
+  segment_size_ += size;
+  block_end_ms_ = now;
+  return {};
+}
+
+void LogStoreWriter::IndexLine(std::string_view line) {
+  AddToBloom(bloom_, line);
+}
+
+Result<void> LogStoreWriter::CloseBlock() {
+  if (segment_size_ == block_offset_) {
+    return {};
+  }
+  auto entry = FormatBlock(Block{
+      .offset = block_offset_,
+      .size = segment_size_ - block_offset_,
+      .begin_ms = block_begin_ms_,
+      .end_ms = block_end_ms_,
+      .bloom = bloom_,
+  });
+  CF_EXPECT(WriteAll(index_fd_, entry) == (ssize_t)entry.size(),
+            "Could not write log index: " << index_fd_->StrError());
+  block_offset_ = segment_size_;
+  bloom_ = {};
+  return {};
+}
+
+Result<void> LogStoreWriter::Rotate() {
+  segment_fd_->Close();
+  index_fd_->Close();
+  Seal(segment_number_);
+  CF_EXPECT(OpenSegment(segment_number_ + 1));
+  return {};
+}
+
+void LogStoreWriter::Seal(unsigned number) {
+  std::lock_guard<std::mutex> lock(seal_mutex_);
+  seals_.erase(std::remove_if(seals_.begin(), seals_.end(),
+                              [](const std::future<void>& seal) {
+                                return seal.wait_for(std::chrono::seconds(0))
+                                    == std::future_status::ready;
+                              }),
+               seals_.end());
+  seals_.push_back(std::async(std::launch::async, [this, number]() {
+    auto res = SealSegment(directory_, number);
+    if (!res.ok()) {
+      LOG(ERROR) << "Failed to compress log segment " << number << ": "
+                 << res.error().Message();
+      return;
+    }
+    std::lock_guard<std::mutex> lock(seal_mutex_);
+    res = EnforceMaxSize();
+    if (!res.ok()) {
+      LOG(ERROR) << "Failed to remove old log segments: "
+                 << res.error().Message();
+    }
+  }));
+}
+
+Result<void> LogStoreWriter::EnforceMaxSize() {
+  if (options_.max_size == 0) {
+    return {};
+  }
+  std::vector<std::pair<unsigned, std::uint64_t>> sealed;
+  std::uint64_t total = 0;
+  for (auto number : CF_EXPECT(SegmentNumbers(directory_))) {
+    auto path = SegmentBase(directory_, number) + ".zst";
+    if (FileExists(path + ".idx")) {
+      sealed.emplace_back(number, FileSize(path));
+      total += sealed.back().second;
+    }
+  }
+  for (const auto& [number, size] : sealed) {
+    if (total <= options_.max_size) {
+      break;
+    }
+    auto base = SegmentBase(directory_, number);
+    // Index first, without it the data file is ignored
+    RemoveFile(base + ".zst.idx");
+    RemoveFile(base + ".zst");
+    total -= size;
+  }
+  return {};
+}
+
+Result<void> QueryLogStore(
+    const std::string& directory, const LogQuery& query,
+    const std::function<void(std::string_view line)>& callback) {
+  for (auto number : CF_EXPECT(SegmentNumbers(directory))) {
+    CF_EXPECT(QuerySegment(directory, number, query, callback));
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
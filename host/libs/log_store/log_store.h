@@ -0,0 +1,133 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * Append-only store for text logs that grow too large to be grepped as a
+ * single file, like the logcat of a long running device.
+ *
+ * Layout:
+ *   <directory>/segment-NNNNNN.log      segment being written
+ *   <directory>/segment-NNNNNN.log.idx  its index
+ *   <directory>/segment-NNNNNN.zst      sealed segment, one zstd frame per
+ *                                       block
+ *   <directory>/segment-NNNNNN.zst.idx  its index
+ *
+ * Segments are split in blocks that end on a line boundary. The index has a
+ * line per block with its offset and size in the data file, the host time
+ * range in which it was written and a bloom filter of the logcat tags and
+ * pids in it, so queries only read the blocks that may match.
+ */
+class LogStoreWriter {
+ public:
+  struct Options {
+    std::uint64_t segment_size = 64 << 20;
+    std::uint64_t block_size = 256 << 10;
+    // Blocks are also closed after this long so that time ranges are
+    // narrow when logs are quiet.
+    std::int64_t block_duration_ms = 10000;
+    // Sealed segments are deleted, oldest first, once they add up to more
+    // than this. The legacy file is moved to "<legacy_path>.old", replacing
+    // the previous one, once it reaches half of it. 0 keeps everything.
+    std::uint64_t max_size = 0;
+  };
+
+  /**
+   * Opens the store at `directory`, sealing segments left over by a previous
+   * writer. Unless `legacy_path` is empty, everything appended is also
+   * appended to it as a single plain file, like before the store existed, for
+   * the tools that read or follow that file.
+   * When the store is new, a log already at `legacy_path` is copied in as the
+   * first segment.
+   */
+  static Result<std::unique_ptr<LogStoreWriter>> Create(
+      const std::string& directory, const std::string& legacy_path,
+      Options options);
+  ~LogStoreWriter();
+
+  Result<void> Append(const char* data, std::size_t size);
+
+ private:
+  LogStoreWriter(std::string directory, Options options);
+
+  Result<void> OpenSegment(unsigned number);
+  Result<void> Write(const char* data, std::size_t size, std::int64_t now);
+  void IndexLine(std::string_view line);
+  Result<void> CloseBlock();
+  Result<void> Rotate();
+  // Compresses the segment in the background.
+  void Seal(unsigned number);
+  Result<void> EnforceMaxSize();
+  Result<void> OpenLegacy();
+
+  std::string directory_;
+  Options options_;
+  std::string legacy_path_;
+  SharedFD legacy_fd_;
+  std::uint64_t legacy_size_ = 0;
+
+  unsigned segment_number_ = 0;
+  SharedFD segment_fd_;
+  SharedFD index_fd_;
+  std::uint64_t segment_size_ = 0;
+
+  std::uint64_t block_offset_ = 0;
+  std::int64_t block_begin_ms_ = 0;
+  std::int64_t block_end_ms_ = 0;
+  std::array<std::uint64_t, 8> bloom_ = {};
+  std::string line_;
+
+  std::mutex seal_mutex_;
+  std::vector<std::future<void>> seals_;
+};
+
+struct LogQuery {
+  // Host time range in which the lines were received, in milliseconds since
+  // the epoch.
+  std::optional<std::int64_t> since_ms;
+  std::optional<std::int64_t> until_ms;
+  // Only logcat lines with one of these tags or pids, when not empty.
+  std::set<std::string> tags;
+  std::set<int> pids;
+};
+
+/**
+ * Calls `callback` with every line in the store at `directory` that matches
+ * `query`, oldest first. Time ranges are matched a block at a time, so a few
+ * seconds of lines around the requested range may be included.
+ */
+Result<void> QueryLogStore(
+    const std::string& directory, const LogQuery& query,
+    const std::function<void(std::string_view line)>& callback);
+
+}  // namespace cuttlefish
@@ -0,0 +1,223 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/log_store/log_store.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+class LogStoreTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::string(dir_.path) + "/logcat_store";
+    legacy_path_ = std::string(dir_.path) + "/logcat";
+  }
+
+  void Open(LogStoreWriter::Options options = {}) {
+    writer_.reset();
+    auto writer = LogStoreWriter::Create(directory_, legacy_path_, options);
+    ASSERT_TRUE(writer.ok()) << writer.error().Trace();
+    writer_ = std::move(*writer);
+  }
+
+  // Appends `data` in pieces of `piece_size` bytes.
+  void Append(const std::string& data, std::size_t piece_size = 1 << 20) {
+    for (std::size_t pos = 0; pos < data.size(); pos += piece_size) {
+      auto res = writer_->Append(data.data() + pos,
+                                 std::min(piece_size, data.size() - pos));
+      ASSERT_TRUE(res.ok()) << res.error().Trace();
+    }
+  }
+
+  std::vector<std::string> Query(const LogQuery& query = {}) {
+    std::vector<std::string> lines;
+    auto res = QueryLogStore(directory_, query, [&lines](auto line) {
+      lines.emplace_back(line);
+    });
+    EXPECT_TRUE(res.ok()) << res.error().Trace();
+    return lines;
+  }
+
+  static std::string Logcat(int pid, const std::string& tag, int i) {
+    return "10-19 12:00:00.000  " + std::to_string(pid) + "  " +
+           std::to_string(pid) + " I " + tag + ": message " +
+           std::to_string(i) + "\n";
+  }
+
+  TemporaryDir dir_;
+  std::string directory_;
+  std::string legacy_path_;
+  std::unique_ptr<LogStoreWriter> writer_;
+};
+
+TEST_F(LogStoreTest, ReturnsLinesInOrder) {
+  Open();
+  std::string data;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 100; i++) {
+    auto line = Logcat(1000 + i % 3, "Tag", i);
+    data += line;
+    expected.push_back(line.substr(0, line.size() - 1));
+  }
+  Append(data, 7);
+
+  EXPECT_EQ(Query(), expected);
+}
+
+TEST_F(LogStoreTest, LegacyPathHasWholeLog) {
+  Open({.segment_size = 1024, .block_size = 256});
+  std::string data;
+  for (int i = 0; i < 200; i++) {
+    data += Logcat(1234, "Tag", i);
+  }
+  Append(data, 100);
+  writer_.reset();
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(legacy_path_, &contents));
+  EXPECT_EQ(contents, data);
+}
+
+TEST_F(LogStoreTest, RotatesLegacyPathPastMaxSize) {
+  Open({.segment_size = 1024, .block_size = 256, .max_size = 4096});
+  std::string data;
+  for (int i = 0; i < 2000; i++) {
+    data += Logcat(1234, "Tag", i);
+    Append(Logcat(1234, "Tag", i));
+  }
+  writer_.reset();
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(legacy_path_, &contents));
+  std::string old_contents;
+  ASSERT_TRUE(
+      android::base::ReadFileToString(legacy_path_ + ".old", &old_contents));
+  EXPECT_LE(contents.size() + old_contents.size(), 4096u);
+  EXPECT_TRUE(android::base::EndsWith(data, old_contents + contents));
+  EXPECT_TRUE(android::base::StartsWith(old_contents, "10-19"));
+}
+
+TEST_F(LogStoreTest, ReplacesLegacySymlink) {
+  ASSERT_EQ(symlink("logcat_store/segment-000001.log", legacy_path_.c_str()),
+            0);
+  Open();
+  Append("line\n");
+
+  struct stat st;
+  ASSERT_EQ(lstat(legacy_path_.c_str(), &st), 0);
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(legacy_path_, &contents));
+  EXPECT_EQ(contents, "line\n");
+}
+
+TEST_F(LogStoreTest, FiltersByTagAndPid) {
+  Open({.block_size = 200});
+  std::string data;
+  for (int i = 0; i < 50; i++) {
+    data += Logcat(100, "ActivityManager", i);
+    data += Logcat(200, "WindowManager", i);
+    data += "[   12.345678] kernel line\n";
+  }
+  Append(data, 333);
+
+  auto lines = Query({.tags = {"WindowManager"}});
+  ASSERT_EQ(lines.size(), 50u);
+  for (const auto& line : lines) {
+    EXPECT_NE(line.find("WindowManager: "), std::string::npos) << line;
+  }
+  EXPECT_EQ(Query({.pids = {100}}).size(), 50u);
+  EXPECT_EQ(Query({.tags = {"WindowManager"}, .pids = {100}}).size(), 0u);
+  EXPECT_EQ(Query({.tags = {"Missing"}}).size(), 0u);
+}
+
+TEST_F(LogStoreTest, CompressesRotatedSegments) {
+  Open({.segment_size = 1024, .block_size = 256});
+  std::string data;
+  for (int i = 0; i < 200; i++) {
+    data += Logcat(1234, "Tag", i);
+  }
+  Append(data, 100);
+  writer_.reset();  // Waits for the compression
+
+  auto files = DirectoryContents(directory_);
+  ASSERT_TRUE(files.ok()) << files.error().Trace();
+  int sealed = 0;
+  for (const auto& file : *files) {
+    sealed += android::base::EndsWith(file, ".zst");
+  }
+  EXPECT_GT(sealed, 1);
+  auto lines = Query();
+  ASSERT_EQ(lines.size(), 200u);
+  EXPECT_EQ(lines[199] + "\n", Logcat(1234, "Tag", 199));
+  EXPECT_EQ(Query({.tags = {"Tag"}, .pids = {1234}}).size(), 200u);
+}
+
+TEST_F(LogStoreTest, FiltersByTime) {
+  Open();
+  Append(Logcat(1, "Tag", 1));
+  writer_.reset();
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+
+  EXPECT_EQ(Query({.since_ms = now - 60000}).size(), 1u);
+  EXPECT_EQ(Query({.since_ms = now + 60000}).size(), 0u);
+  EXPECT_EQ(Query({.until_ms = now - 60000}).size(), 0u);
+}
+
+TEST_F(LogStoreTest, ImportsExistingLogAndReopens) {
+  ASSERT_TRUE(android::base::WriteStringToFile("old 1\nold 2\n", legacy_path_));
+  Open();
+  Append("new 1\n");
+  Open();
+  Append("newer 1\n");
+
+  std::vector<std::string> expected = {"old 1", "old 2", "new 1", "newer 1"};
+  EXPECT_EQ(Query(), expected);
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(legacy_path_, &contents));
+  EXPECT_EQ(contents, "old 1\nold 2\nnew 1\nnewer 1\n");
+}
+
+TEST_F(LogStoreTest, RemovesOldSegmentsPastMaxSize) {
+  Open({.segment_size = 1024, .block_size = 256, .max_size = 2048});
+  std::string data;
+  for (int i = 0; i < 2000; i++) {
+    data += Logcat(1234, "Tag", i);
+  }
+  Append(data);
+  writer_.reset();
+
+  auto lines = Query();
+  ASSERT_GT(lines.size(), 0u);
+  EXPECT_LT(lines.size(), 2000u);
+  EXPECT_EQ(lines.back() + "\n", Logcat(1234, "Tag", 1999));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/vm_manager/cpu_placement.h"
+
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+namespace {
+
+// Parses the "0-3,8,10-11" format of sysfs CPU lists.
+Result<std::vector<int>> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  for (const auto& range : android::base::Split(android::base::Trim(list), ",")) {
+    if (range.empty()) {
+      continue;
+    }
+    auto bounds = android::base::Split(range, "-");
+    CF_EXPECT(bounds.size() <= 2, "Invalid CPU range \"" << range << "\"");
+    int first, last;
+    CF_EXPECT(android::base::ParseInt(bounds[0], &first, 0),
+              "Invalid CPU range \"" << range << "\"");
+    last = first;
+    if (bounds.size() == 2) {
+      CF_EXPECT(android::base::ParseInt(bounds[1], &last, first),
+                "Invalid CPU range \"" << range << "\"");
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Returns `fallback` when the file doesn't exist or doesn't hold a number.
+int ReadInt(const std::string& path, int fallback) {
+  std::string contents;
+  int value;
+  if (!android::base::ReadFileToString(path, &contents) ||
+      !android::base::ParseInt(android::base::Trim(contents), &value)) {
+    return fallback;
+  }
+  return value;
+}
+
+struct Core {
+  std::vector<int> cpus;
+};
+
+struct Node {
+  int id;
+  std::deque<Core> free_cores;
+  std::size_t free_cpus = 0;
+};
+
+// Takes whole cores from `node` until there are `count` CPUs, or the node
+// runs out.
+void TakeCpus(Node& node, std::size_t count, std::vector<int>& cpus) {
+  while (cpus.size() < count && !node.free_cores.empty()) {
+    auto& core = node.free_cores.front();
+    for (int cpu : core.cpus) {
+      if (cpus.size() < count) {
+        cpus.push_back(cpu);
+      }
+    }
+    node.free_cpus -= core.cpus.size();
+    node.free_cores.pop_front();
+  }
+}
+
+Result<std::set<int>> AllowedCpus() {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CF_EXPECT(sched_getaffinity(0, sizeof(cpus), &cpus) == 0,
+            "sched_getaffinity failed: " << strerror(errno));
+  std::set<int> allowed;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpus)) {
+      allowed.insert(cpu);
+    }
+  }
+  return allowed;
+}
+
+// A line of the reservations file: "<pid> <node> <cpu>,<cpu>,..."
+struct Reservation {
+  pid_t pid;
+  CpuPlacement placement;
+};
+
+std::optional<Reservation> ParseReservation(const std::string& line) {
+  auto fields = android::base::Split(line, " ");
+  Reservation reservation;
+  if (fields.size() != 3 ||
+      !android::base::ParseInt(fields[0], &reservation.pid, 1) ||
+      !android::base::ParseInt(fields[1], &reservation.placement.node, -1)) {
+    return std::nullopt;
+  }
+  for (const auto& cpu_str : android::base::Split(fields[2], ",")) {
+    int cpu;
+    if (!android::base::ParseInt(cpu_str, &cpu, 0)) {
+      return std::nullopt;
+    }
+    reservation.placement.cpus.push_back(cpu);
+  }
+  return reservation;
+}
+
+std::string FormatReservation(const Reservation& reservation) {
+  std::vector<std::string> cpus;
+  for (int cpu : reservation.placement.cpus) {
+    cpus.push_back(std::to_string(cpu));
+  }
+  return std::to_string(reservation.pid) + " " +
+         std::to_string(reservation.placement.node) + " " +
+         android::base::Join(cpus, ",") + "\n";
+}
+
+bool ProcessExists(pid_t pid) {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+}  // namespace
+
+Result<std::vector<HostCpu>> ReadHostCpuTopology(
+    const std::string& sysfs_root, std::optional<std::set<int>> allowed) {
+  if (!allowed) {
+    allowed = CF_EXPECT(AllowedCpus());
+  }
+  const auto cpu_dir = sysfs_root + "/devices/system/cpu";
+  std::string online;
+  CF_EXPECT(android::base::ReadFileToString(cpu_dir + "/online", &online),
+            "Failed to read " << cpu_dir << "/online");
+
+  std::map<int, int> cpu_nodes;
+  const auto node_dir = sysfs_root + "/devices/system/node";
+  if (DirectoryExists(node_dir)) {
+    for (const auto& name : CF_EXPECT(DirectoryContents(node_dir))) {
+      int node;
+      if (!android::base::StartsWith(name, "node") ||
+          !android::base::ParseInt(name.substr(4), &node)) {
+        continue;
+      }
+      std::string list;
+      if (!android::base::ReadFileToString(
+              node_dir + "/" + name + "/cpulist", &list)) {
+        continue;
+      }
+      for (int cpu : CF_EXPECT(ParseCpuList(list))) {
+        cpu_nodes[cpu] = node;
+      }
+    }
+  }
+
+  std::vector<HostCpu> topology;
+  for (int cpu : CF_EXPECT(ParseCpuList(online))) {
+    if (allowed->count(cpu) == 0) {
+      continue;
+    }
+    const auto topology_dir =
+        cpu_dir + "/cpu" + std::to_string(cpu) + "/topology";
+    topology.push_back(HostCpu{
+        .id = cpu,
+        .package = ReadInt(topology_dir + "/physical_package_id", 0),
+        .core = ReadInt(topology_dir + "/core_id", cpu),
+        .node = cpu_nodes.count(cpu) ? cpu_nodes[cpu] : 0,
+    });
+  }
+  CF_EXPECT(!topology.empty(),
+            "None of the online CPUs in " << cpu_dir << " is allowed");
+  return topology;
+}
+
+Result<std::vector<CpuPlacement>> PlanCpuPlacement(
+    const std::vector<HostCpu>& topology, const std::vector<int>& vcpus) {
+  // node -> (package, core) -> CPUs
+  std::map<int, std::map<std::pair<int, int>, Core>> cores;
+  for (const auto& cpu : topology) {
+    cores[cpu.node][{cpu.package, cpu.core}].cpus.push_back(cpu.id);
+  }
+  std::vector<Node> nodes;
+  std::size_t free_cpus = 0;
+  for (auto& [id, node_cores] : cores) {
+    Node node{.id = id};
+    for (auto& [_, core] : node_cores) {
+      std::sort(core.cpus.begin(), core.cpus.end());
+      node.free_cpus += core.cpus.size();
+      node.free_cores.push_back(std::move(core));
+    }
+    free_cpus += node.free_cpus;
+    nodes.push_back(std::move(node));
+  }
+
+  std::vector<CpuPlacement> placements;
+  for (int count : vcpus) {
+    CF_EXPECT(count > 0, "Invalid number of vCPUs: " << count);
+    CF_EXPECT((std::size_t)count <= free_cpus,
+              "Not enough host CPUs for " << vcpus.size() << " instances");
+    // Most free CPUs first, ties go to the lower node
+    std::vector<Node*> by_free;
+    for (auto& node : nodes) {
+      by_free.push_back(&node);
+    }
+    std::stable_sort(by_free.begin(), by_free.end(), [](Node* a, Node* b) {
+      return a->free_cpus > b->free_cpus;
+    });
+
+    CpuPlacement placement{.node = -1};
+    if (by_free[0]->free_cpus >= (std::size_t)count) {
+      placement.node = by_free[0]->id;
+      TakeCpus(*by_free[0], count, placement.cpus);
+    } else {
+      for (auto node : by_free) {
+        TakeCpus(*node, count, placement.cpus);
+      }
+    }
+    // Taking whole cores can leave SMT siblings unused
+    free_cpus = 0;
+    for (const auto& node : nodes) {
+      free_cpus += node.free_cpus;
+    }
+    CF_EXPECT(placement.cpus.size() == (std::size_t)count,
+              "Not enough host cores for " << vcpus.size() << " instances");
+    placements.push_back(std::move(placement));
+  }
+  return placements;
+}
+
+std::string DefaultCpuReservationsPath() {
+  return StringFromEnv("TMPDIR", "/tmp") + "/acloud_cvd_temp/cpu_reservations";
+}
+
+Result<CpuPlacement> ReserveCpuPlacement(const std::string& reservations_path,
+                                         const std::vector<HostCpu>& topology,
+                                         int vcpus) {
+  CF_EXPECT(EnsureDirectoryExists(cpp_dirname(reservations_path)));
+  // Writable by the other users of the host, as far as the umask allows
+  auto fd = SharedFD::Open(reservations_path, O_CREAT | O_RDWR | O_CLOEXEC,
+                           0666);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << reservations_path
+                                              << "\": " << fd->StrError());
+  // Released when fd is closed
+  CF_EXPECT(fd->Flock(LOCK_EX));
+  std::string contents;
+  CF_EXPECT(ReadAll(fd, &contents) >= 0,
+            "Could not read \"" << reservations_path
+                                << "\": " << fd->StrError());
+
+  // Reservations end with the process that made them
+  std::vector<Reservation> reservations;
+  std::set<int> reserved_cpus;
+  for (const auto& line : android::base::Split(contents, "\n")) {
+    auto reservation = ParseReservation(line);
+    if (!reservation) {
+      continue;
+    }
+    if (reservation->pid == getpid()) {
+      return reservation->placement;
+    }
+    if (ProcessExists(reservation->pid)) {
+      reserved_cpus.insert(reservation->placement.cpus.begin(),
+                           reservation->placement.cpus.end());
+      reservations.push_back(std::move(*reservation));
+    }
+  }
+
+  // A core is taken as soon as one of its CPUs is
+  std::set<std::pair<int, int>> taken_cores;
+  for (const auto& cpu : topology) {
+    if (reserved_cpus.count(cpu.id)) {
+      taken_cores.insert({cpu.package, cpu.core});
+    }
+  }
+  std::vector<HostCpu> free_cpus;
+  for (const auto& cpu : topology) {
+    if (taken_cores.count({cpu.package, cpu.core}) == 0) {
+      free_cpus.push_back(cpu);
+    }
+  }
+  auto placements =
+      CF_EXPECT(PlanCpuPlacement(free_cpus, {vcpus}),
+                "Not enough free host cores, " << reservations.size()
+                                               << " are reserved by others");
+  reservations.push_back(Reservation{
+      .pid = getpid(),
+      .placement = placements[0],
+  });
+
+  contents.clear();
+  for (const auto& reservation : reservations) {
+    contents += FormatReservation(reservation);
+  }
+  CF_EXPECT(fd->LSeek(0, SEEK_SET) == 0 && fd->Truncate(0) == 0 &&
+                WriteAll(fd, contents) == (ssize_t)contents.size(),
+            "Could not write \"" << reservations_path
+                                 << "\": " << fd->StrError());
+  return placements[0];
+}
+
+std::string CrosvmCpuAffinity(const CpuPlacement& placement) {
+  std::vector<std::string> vcpus;
+  for (std::size_t vcpu = 0; vcpu < placement.cpus.size(); vcpu++) {
+    vcpus.push_back(std::to_string(vcpu) + "=" +
+                    std::to_string(placement.cpus[vcpu]));
+  }
+  return android::base::Join(vcpus, ":");
+}
+
+Result<void> ApplyCpuPlacement(const CpuPlacement& placement) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int cpu : placement.cpus) {
+    CF_EXPECT(cpu < CPU_SETSIZE, "CPU " << cpu << " is out of range");
+    CPU_SET(cpu, &cpus);
+  }
+  CF_EXPECT(sched_setaffinity(0, sizeof(cpus), &cpus) == 0,
+            "sched_setaffinity failed: " << strerror(errno));
+
+  if (placement.node >= 0) {
+    constexpr int kMaxNodes = 8 * sizeof(unsigned long);
+    CF_EXPECT(placement.node < kMaxNodes,
+              "NUMA node " << placement.node << " is out of range");
+    unsigned long nodemask = 1ul << placement.node;
+    // Preferred rather than bound, so that a full node spills to the others
+    // instead of failing allocations.
+    CF_EXPECT(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask,
+                      kMaxNodes + 1) == 0,
+              "set_mempolicy failed: " << strerror(errno));
+  }
+  return {};
+}
+
+}  // namespace vm_manager
+}  // namespace cuttlefish
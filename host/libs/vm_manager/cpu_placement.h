@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+
+struct HostCpu {
+  int id;
+  // Identifies the physical core, shared by its SMT siblings
+  int package;
+  int core;
+  int node;
+};
+
+// Reads the online CPUs and their cores and NUMA nodes from a sysfs tree.
+// Missing topology files are treated as one core per CPU on node 0. Only the
+// CPUs in `allowed` are returned, by default the ones the calling process may
+// run on, which excludes those outside of its cpuset.
+Result<std::vector<HostCpu>> ReadHostCpuTopology(
+    const std::string& sysfs_root = "/sys",
+    std::optional<std::set<int>> allowed = std::nullopt);
+
+struct CpuPlacement {
+  // The host CPU of every vCPU, distinct and on cores no other instance uses.
+  std::vector<int> cpus;
+  // The NUMA node all of them are on, or -1 if the instance didn't fit on
+  // a single node.
+  int node;
+};
+
+// Gives every instance, in order, as many host CPUs as it has vCPUs. Whole
+// physical cores are handed out so that instances don't share cores, and
+// each instance goes on the NUMA node with the most free CPUs left to spread
+// the memory traffic over all of them.
+Result<std::vector<CpuPlacement>> PlanCpuPlacement(
+    const std::vector<HostCpu>& topology, const std::vector<int>& vcpus);
+
+// Where ReserveCpuPlacement() keeps the reservations of the host, next to the
+// instance lock files.
+std::string DefaultCpuReservationsPath();
+
+// Plans a placement for `vcpus` vCPUs on the cores of `topology` that no
+// running process has reserved in the file at `reservations_path`, and
+// reserves it for the calling process until it exits. Instances of every
+// group on the host get disjoint cores this way. Calling it again from the
+// same process returns the same placement.
+Result<CpuPlacement> ReserveCpuPlacement(const std::string& reservations_path,
+                                         const std::vector<HostCpu>& topology,
+                                         int vcpus);
+
+// The value of crosvm's --cpu-affinity pinning each vCPU to its host CPU.
+std::string CrosvmCpuAffinity(const CpuPlacement& placement);
+
+// Restricts the calling process to the CPUs of the placement and makes its
+// memory come from its node. Both are inherited by the processes it starts.
+Result<void> ApplyCpuPlacement(const CpuPlacement& placement);
+
+}  // namespace vm_manager
+}  // namespace cuttlefish
@@ -235,6 +235,11 @@ Result<std::vector<MonitorCommand>> CrosvmManager::StartCommands(
   // crosvm_cmd.Cmd().AddParameter("--null-audio");
   crosvm_cmd.Cmd().AddParameter("--mem=", instance.memory_mb());
   crosvm_cmd.Cmd().AddParameter("--cpus=", instance.cpus());
+  auto cpu_placement = CF_EXPECT(InstanceCpuPlacement(config, instance));
+  if (cpu_placement) {
+    crosvm_cmd.Cmd().AddParameter("--cpu-affinity=",
+                                  CrosvmCpuAffinity(*cpu_placement));
+  }
   if (instance.mte()) {
     crosvm_cmd.Cmd().AddParameter("--mte");
   }
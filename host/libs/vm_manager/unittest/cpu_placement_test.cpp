@@ -0,0 +1,220 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/vm_manager/cpu_placement.h"
+
+#include <unistd.h>
+
+#include <climits>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+namespace {
+
+// Writes a sysfs tree of `nodes` NUMA nodes with `cores` cores each and
+// `threads` SMT threads per core, numbered the way Linux does on x86:
+// first threads of every core, then the siblings.
+class FakeSysfs {
+ public:
+  FakeSysfs(int nodes, int cores, int threads) {
+    int cpus = nodes * cores * threads;
+    Write("devices/system/cpu/online", "0-" + std::to_string(cpus - 1) + "\n");
+    std::vector<std::vector<int>> node_cpus(nodes);
+    for (int cpu = 0; cpu < cpus; cpu++) {
+      int core = cpu % (nodes * cores);
+      int node = core / cores;
+      auto dir = "devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+      Write(dir + "physical_package_id", std::to_string(node) + "\n");
+      Write(dir + "core_id", std::to_string(core % cores) + "\n");
+      node_cpus[node].push_back(cpu);
+    }
+    for (int node = 0; node < nodes; node++) {
+      std::string list;
+      for (int cpu : node_cpus[node]) {
+        list += (list.empty() ? "" : ",") + std::to_string(cpu);
+      }
+      Write("devices/system/node/node" + std::to_string(node) + "/cpulist",
+            list + "\n");
+    }
+  }
+
+  std::string Root() const { return dir_.path; }
+
+  void Write(const std::string& path, const std::string& contents) {
+    auto full_path = Root() + "/" + path;
+    ASSERT_TRUE(EnsureDirectoryExists(cpp_dirname(full_path)).ok());
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, full_path));
+  }
+
+ private:
+  TemporaryDir dir_;
+};
+
+// Every CPU of the fake tree, whatever the test may run on
+std::set<int> AllCpus() {
+  std::set<int> cpus;
+  for (int cpu = 0; cpu < 1024; cpu++) {
+    cpus.insert(cpu);
+  }
+  return cpus;
+}
+
+std::vector<HostCpu> Topology(const FakeSysfs& sysfs) {
+  auto topology = ReadHostCpuTopology(sysfs.Root(), AllCpus());
+  EXPECT_TRUE(topology.ok()) << topology.error().Trace();
+  return topology.ok() ? *topology : std::vector<HostCpu>{};
+}
+
+TEST(CpuPlacementTest, ReadsTopology) {
+  FakeSysfs sysfs(2, 4, 2);
+  auto topology = Topology(sysfs);
+  ASSERT_EQ(topology.size(), 16u);
+  // cpu9 is the sibling of cpu1 on the second core of node 0
+  EXPECT_EQ(topology[9].id, 9);
+  EXPECT_EQ(topology[9].node, 0);
+  EXPECT_EQ(topology[9].package, 0);
+  EXPECT_EQ(topology[9].core, 1);
+  EXPECT_EQ(topology[12].node, 1);
+}
+
+TEST(CpuPlacementTest, ReadsTopologyWithoutNumaOrTopology) {
+  FakeSysfs sysfs(1, 1, 1);
+  sysfs.Write("devices/system/cpu/online", "0-1,4\n");
+  auto topology = Topology(sysfs);
+  ASSERT_EQ(topology.size(), 3u);
+  EXPECT_EQ(topology[2].id, 4);
+  EXPECT_EQ(topology[2].core, 4);
+  EXPECT_EQ(topology[2].node, 0);
+}
+
+TEST(CpuPlacementTest, ReadsOnlyAllowedCpus) {
+  FakeSysfs sysfs(1, 4, 2);
+  auto topology = ReadHostCpuTopology(sysfs.Root(), std::set<int>{1, 5, 6});
+  ASSERT_TRUE(topology.ok()) << topology.error().Trace();
+  ASSERT_EQ(topology->size(), 3u);
+  EXPECT_EQ((*topology)[0].id, 1);
+  EXPECT_EQ((*topology)[1].id, 5);
+  EXPECT_EQ((*topology)[1].core, 1);
+  EXPECT_EQ((*topology)[2].id, 6);
+
+  EXPECT_FALSE(ReadHostCpuTopology(sysfs.Root(), std::set<int>{8}).ok());
+}
+
+TEST(CpuPlacementTest, KeepsInstancesOnSeparateCoresAndNodes) {
+  FakeSysfs sysfs(2, 8, 2);
+  auto placements = PlanCpuPlacement(Topology(sysfs), {4, 4, 4, 4});
+  ASSERT_TRUE(placements.ok()) << placements.error().Trace();
+  ASSERT_EQ(placements->size(), 4u);
+
+  std::set<int> used_cores;
+  for (const auto& placement : *placements) {
+    ASSERT_EQ(placement.cpus.size(), 4u);
+    ASSERT_NE(placement.node, -1);
+    std::set<int> cores;
+    for (int cpu : placement.cpus) {
+      // Cores are identified by their first thread
+      cores.insert(cpu % 16);
+      EXPECT_EQ(cpu % 16 / 8, placement.node) << cpu;
+    }
+    // SMT siblings are used together
+    EXPECT_EQ(cores.size(), 2u);
+    for (int core : cores) {
+      EXPECT_TRUE(used_cores.insert(core).second) << "core " << core;
+    }
+  }
+  // Spread over both nodes
+  EXPECT_NE((*placements)[0].node, (*placements)[1].node);
+}
+
+TEST(CpuPlacementTest, SpansNodesWhenNeeded) {
+  FakeSysfs sysfs(2, 4, 1);
+  auto placements = PlanCpuPlacement(Topology(sysfs), {6});
+  ASSERT_TRUE(placements.ok()) << placements.error().Trace();
+  EXPECT_EQ((*placements)[0].node, -1);
+  EXPECT_EQ(std::set<int>((*placements)[0].cpus.begin(),
+                          (*placements)[0].cpus.end())
+                .size(),
+            6u);
+}
+
+TEST(CpuPlacementTest, FailsWithoutEnoughCores) {
+  FakeSysfs sysfs(1, 4, 2);
+  EXPECT_TRUE(PlanCpuPlacement(Topology(sysfs), {4, 4}).ok());
+  // The odd instances leave a sibling thread unused each
+  EXPECT_FALSE(PlanCpuPlacement(Topology(sysfs), {3, 3, 2}).ok());
+  EXPECT_FALSE(PlanCpuPlacement(Topology(sysfs), {9}).ok());
+}
+
+TEST(CpuPlacementTest, ReservesTheSamePlacementForTheSameProcess) {
+  FakeSysfs sysfs(1, 4, 2);
+  TemporaryDir dir;
+  const std::string path = std::string(dir.path) + "/locks/cpu_reservations";
+  auto first = ReserveCpuPlacement(path, Topology(sysfs), 2);
+  ASSERT_TRUE(first.ok()) << first.error().Trace();
+  auto second = ReserveCpuPlacement(path, Topology(sysfs), 2);
+  ASSERT_TRUE(second.ok()) << second.error().Trace();
+  EXPECT_EQ(first->cpus, second->cpus);
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+  EXPECT_EQ(contents, std::to_string(getpid()) + " 0 " +
+                          std::to_string(first->cpus[0]) + "," +
+                          std::to_string(first->cpus[1]) + "\n");
+}
+
+TEST(CpuPlacementTest, AvoidsCoresReservedByRunningProcesses) {
+  FakeSysfs sysfs(1, 4, 2);
+  TemporaryDir dir;
+  const std::string path = std::string(dir.path) + "/cpu_reservations";
+  // The parent is running: cores 0 and 1 are taken, even the unused sibling
+  // of cpu1. The other process has exited, so core 2 is free again.
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      std::to_string(getppid()) + " 0 0,4,1\n" + std::to_string(INT_MAX) +
+          " 0 2,6\n",
+      path));
+
+  auto placement = ReserveCpuPlacement(path, Topology(sysfs), 4);
+  ASSERT_TRUE(placement.ok()) << placement.error().Trace();
+  EXPECT_EQ(std::set<int>(placement->cpus.begin(), placement->cpus.end()),
+            std::set<int>({2, 6, 3, 7}));
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+  EXPECT_EQ(contents.find(std::to_string(INT_MAX)), std::string::npos);
+  EXPECT_NE(contents.find(std::to_string(getppid()) + " 0 0,4,1\n"),
+            std::string::npos);
+
+  // Another process of the same size wouldn't fit anymore
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      std::to_string(getppid()) + " 0 0,4,1,5,2,6,3,7\n", path));
+  EXPECT_FALSE(ReserveCpuPlacement(path, Topology(sysfs), 1).ok());
+}
+
+TEST(CpuPlacementTest, FormatsCrosvmAffinity) {
+  CpuPlacement placement = {.cpus = {3, 7, 4}, .node = 0};
+  EXPECT_EQ(CrosvmCpuAffinity(placement), "0=3:1=7:2=4");
+}
+
+}  // namespace
+}  // namespace vm_manager
+}  // namespace cuttlefish
@@ -94,6 +94,22 @@ class VmmCommands : public CommandSource {
   VmManager& vmm_;
 };
 
+Result<std::optional<CpuPlacement>> InstanceCpuPlacement(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  if (!config.pin_host_cpus()) {
+    return {};
+  }
+  auto topology = CF_EXPECT(ReadHostCpuTopology());
+  auto placement = ReserveCpuPlacement(DefaultCpuReservationsPath(), topology,
+                                       instance.cpus());
+  if (!placement.ok()) {
+    LOG(WARNING) << "Not pinning host CPUs: " << placement.error().Message();
+    return {};
+  }
+  return *placement;
+}
+
 fruit::Component<fruit::Required<const CuttlefishConfig,
                                  const CuttlefishConfig::InstanceSpecific>,
                  VmManager>
@@ -16,6 +16,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -25,6 +26,7 @@
 #include "common/libs/utils/result.h"
 #include "host/libs/config/command_source.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/vm_manager/cpu_placement.h"
 
 namespace cuttlefish {
 namespace vm_manager {
@@ -90,6 +92,14 @@ class VmManager {
       const CuttlefishConfig& config) = 0;
 };
 
+// The host CPUs of the instance when pin_host_cpus is set, reserved for the
+// calling process in the host-wide reservations file so instances of every
+// group get disjoint ones. Empty when the option is off or the host doesn't
+// have enough free cores.
+Result<std::optional<CpuPlacement>> InstanceCpuPlacement(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance);
+
 fruit::Component<fruit::Required<const CuttlefishConfig,
                                  const CuttlefishConfig::InstanceSpecific>,
                  VmManager>
@@ -0,0 +1,301 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/artifact_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/json.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/sha256.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr mode_t kObjectMode = S_IRUSR | S_IRGRP | S_IROTH;
+
+std::int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Entry {
+  std::string sha256;
+  std::uint64_t size;
+  std::int64_t last_used;
+};
+
+using Index = std::map<std::string, Entry>;
+
+bool IsReferenced(const Index& index, const std::string& sha256) {
+  for (const auto& [unused, entry] : index) {
+    if (entry.sha256 == sha256) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Result<Index> LoadIndex(const std::string& path) {
+  Index index;
+  if (!FileExists(path)) {
+    return index;
+  }
+  auto json = ParseJson(ReadFile(path));
+  if (!json.ok()) {
+    // The index is only an optimization over the objects directory, so a
+    // damaged one is dropped rather than failing the fetch.
+    LOG(WARNING) << "Discarding unreadable artifact cache index \"" << path
+                 << "\": " << json.error().Message();
+    return index;
+  }
+  for (const auto& key : json->getMemberNames()) {
+    const auto& value = (*json)[key];
+    index[key] = Entry{
+        .sha256 = value["sha256"].asString(),
+        .size = value["size"].asUInt64(),
+        .last_used = value["last_used"].asInt64(),
+    };
+  }
+  return index;
+}
+
+Result<void> SaveIndex(const std::string& path, const Index& index) {
+  Json::Value json(Json::objectValue);
+  for (const auto& [key, entry] : index) {
+    json[key]["sha256"] = entry.sha256;
+    json[key]["size"] = Json::UInt64(entry.size);
+    json[key]["last_used"] = Json::Int64(entry.last_used);
+  }
+  Json::StreamWriterBuilder factory;
+  auto contents = Json::writeString(factory, json);
+
+  auto temp_path = path + ".tmp";
+  auto fd = SharedFD::Creat(temp_path, 0644);
+  CF_EXPECT(fd->IsOpen(), "Could not create \"" << temp_path << "\": "
+                                                << fd->StrError());
+  CF_EXPECT(WriteAll(fd, contents) == (ssize_t)contents.size(),
+            "Could not write \"" << temp_path << "\": " << fd->StrError());
+  fd->Close();
+  CF_EXPECT(RenameFile(temp_path, path));
+  return {};
+}
+
+/*
+ * Removes the objects no key refers to anymore. An object being copied out is
+ * pinned with a shared flock(2) on the object itself, and is left for a later
+ * sweep.
+ */
+void RemoveUnreferencedObjects(const std::string& objects_dir,
+                               const Index& index) {
+  auto names = DirectoryContents(objects_dir);
+  if (!names.ok()) {
+    LOG(WARNING) << "Could not list \"" << objects_dir
+                 << "\": " << names.error().Message();
+    return;
+  }
+  for (const auto& name : *names) {
+    if (name == "." || name == ".." || IsReferenced(index, name)) {
+      continue;
+    }
+    auto object = objects_dir + "/" + name;
+    auto fd = SharedFD::Open(object, O_RDONLY | O_CLOEXEC);
+    if (!fd->IsOpen() || !fd->Flock(LOCK_EX | LOCK_NB).ok()) {
+      continue;
+    }
+    RemoveFile(object);
+  }
+}
+
+/*
+ * Puts a copy of `object` at `destination` that does not need its own disk
+ * space when the filesystem allows it. The copy never shares an inode with
+ * the object, so writing to the destination can't change the cache, and
+ * evicting the object frees its space.
+ */
+Result<void> Place(const std::string& object, const std::string& destination) {
+  unlink(destination.c_str());
+  // Copy() reflinks when the file system supports it
+  CF_EXPECT(Copy(object, destination),
+            "Could not copy \"" << object << "\" to \"" << destination << "\"");
+  return {};
+}
+
+}  // namespace
+
+ArtifactCache::ArtifactCache(std::string directory, std::uint64_t max_size)
+    : directory_(std::move(directory)), max_size_(max_size) {}
+
+Result<std::unique_ptr<ArtifactCache>> ArtifactCache::Open(
+    const std::string& directory, std::uint64_t max_size) {
+  CF_EXPECT(EnsureDirectoryExists(directory));
+  CF_EXPECT(EnsureDirectoryExists(directory + "/objects"));
+  CF_EXPECT(EnsureDirectoryExists(directory + "/staging"));
+  return std::unique_ptr<ArtifactCache>(new ArtifactCache(directory, max_size));
+}
+
+std::string ArtifactCache::Key(const std::string& build_id,
+                               const std::string& target,
+                               const std::string& artifact) {
+  return build_id + "/" + target + "/" + artifact;
+}
+
+Result<SharedFD> ArtifactCache::Lock(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_CREAT | O_RDWR, 0644);
+  CF_EXPECT(fd->IsOpen(), "Could not open lock \"" << path << "\": "
+                                                   << fd->StrError());
+  CF_EXPECT(fd->Flock(LOCK_EX));
+  // The lock is released when the last reference to `fd` is closed.
+  return fd;
+}
+
+Result<bool> ArtifactCache::TryMaterialize(const std::string& key,
+                                           const std::string& destination) {
+  std::string object;
+  SharedFD pin;
+  {
+    auto lock = CF_EXPECT(Lock(directory_ + "/lock"));
+    auto index_path = directory_ + "/index.json";
+    auto index = CF_EXPECT(LoadIndex(index_path));
+    auto it = index.find(key);
+    if (it == index.end()) {
+      return false;
+    }
+    object = directory_ + "/objects/" + it->second.sha256;
+    pin = SharedFD::Open(object, O_RDONLY | O_CLOEXEC);
+    if (!pin->IsOpen()) {
+      LOG(WARNING) << "Artifact cache object for \"" << key << "\" is missing";
+      index.erase(it);
+      CF_EXPECT(SaveIndex(index_path, index));
+      return false;
+    }
+    CF_EXPECT(pin->Flock(LOCK_SH));
+    it->second.last_used = Now();
+    CF_EXPECT(SaveIndex(index_path, index));
+  }
+  // Copying may take a while for large artifacts, so it happens outside of
+  // the index lock. The pin keeps the object from being removed meanwhile.
+  CF_EXPECT(Place(object, destination));
+  return true;
+}
+
+Result<void> ArtifactCache::Insert(const std::string& key,
+                                   const std::string& staged) {
+  // Hashing reads the whole file, so it is kept out of the critical section.
+  auto sha256 = CF_EXPECT(FileSha256(staged));
+  auto size = FileSize(staged);
+
+  auto lock = CF_EXPECT(Lock(directory_ + "/lock"));
+  auto index_path = directory_ + "/index.json";
+  auto index = CF_EXPECT(LoadIndex(index_path));
+
+  auto object = directory_ + "/objects/" + sha256;
+  if (FileExists(object)) {
+    // Same contents under another key, e.g. a rebuilt artifact.
+    RemoveFile(staged);
+  } else {
+    CF_EXPECT(chmod(staged.c_str(), kObjectMode) == 0,
+              "Could not chmod \"" << staged << "\": " << strerror(errno));
+    CF_EXPECT(RenameFile(staged, object));
+  }
+  index[key] = Entry{.sha256 = sha256, .size = (std::uint64_t)size,
+                     .last_used = Now()};
+
+  std::map<std::string, std::uint64_t> object_sizes;
+  for (const auto& [unused, entry] : index) {
+    object_sizes[entry.sha256] = entry.size;
+  }
+  std::uint64_t total = 0;
+  for (const auto& [unused, object_size] : object_sizes) {
+    total += object_size;
+  }
+  while (total > max_size_) {
+    auto oldest = index.end();
+    for (auto it = index.begin(); it != index.end(); it++) {
+      if (it->first != key &&
+          (oldest == index.end() ||
+           it->second.last_used < oldest->second.last_used)) {
+        oldest = it;
+      }
+    }
+    if (oldest == index.end()) {
+      break;  // Only the new artifact is left, it is kept even if too large.
+    }
+    auto evicted = oldest->second;
+    LOG(DEBUG) << "Evicting \"" << oldest->first << "\" from artifact cache";
+    index.erase(oldest);
+    if (!IsReferenced(index, evicted.sha256)) {
+      total -= evicted.size;
+    }
+  }
+  CF_EXPECT(SaveIndex(index_path, index));
+  // Also picks up the objects that were pinned by a copy when evicted
+  RemoveUnreferencedObjects(directory_ + "/objects", index);
+  return {};
+}
+
+Result<void> ArtifactCache::Fetch(const std::string& key,
+                                  const std::string& destination,
+                                  const Downloader& download) {
+  auto staged = directory_ + "/staging/" + Sha256(key);
+  // Held across the download so that concurrent fetches of the same artifact
+  // wait for this one and then hit the cache.
+  auto key_lock = CF_EXPECT(Lock(staged + ".lock"));
+  if (CF_EXPECT(TryMaterialize(key, destination))) {
+    LOG(INFO) << "Using cached \"" << key << "\" for \"" << destination << "\"";
+    return {};
+  }
+  // The staging path is stable per key, so downloads that keep progress next
+  // to the file resume after an interrupted run.
+  CF_EXPECT(download(staged));
+  CF_EXPECT(Insert(key, staged));
+  CF_EXPECT(CF_EXPECT(TryMaterialize(key, destination)),
+            "\"" << key << "\" was evicted right after being cached");
+  return {};
+}
+
+Result<std::uint64_t> ArtifactCache::Size() {
+  auto lock = CF_EXPECT(Lock(directory_ + "/lock"));
+  auto index = CF_EXPECT(LoadIndex(directory_ + "/index.json"));
+  std::set<std::string> seen;
+  std::uint64_t total = 0;
+  for (const auto& [unused, entry] : index) {
+    if (seen.insert(entry.sha256).second) {
+      total += entry.size;
+    }
+  }
+  return total;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * Host-wide store of downloaded build artifacts, shared by every fetch_cvd
+ * invocation that points at the same directory.
+ *
+ * Layout:
+ *   <directory>/index.json        key -> {sha256, size, last_used}
+ *   <directory>/objects/<sha256>  artifact contents, stored once per digest
+ *   <directory>/staging/          downloads in progress, one per key
+ *   <directory>/lock              flock(2) guarding the index and objects
+ *
+ * The lock is not held while an object is copied out. The copy holds a shared
+ * flock(2) on the object instead, and an evicted object is only removed once
+ * no copy holds it.
+ *
+ * Artifacts are placed in the destination directory with a reflink when the
+ * filesystem supports it, and a plain copy otherwise. They are never
+ * hardlinked: the destination is a file of its own that can be modified
+ * without touching the cache. When the cache grows past `max_size` bytes the
+ * least recently used entries are evicted.
+ */
+class ArtifactCache {
+ public:
+  using Downloader = std::function<Result<void>(const std::string& path)>;
+
+  static Result<std::unique_ptr<ArtifactCache>> Open(
+      const std::string& directory, std::uint64_t max_size);
+
+  static std::string Key(const std::string& build_id, const std::string& target,
+                         const std::string& artifact);
+
+  /**
+   * Places the artifact identified by `key` at `destination`. On a miss
+   * `download` is asked to write the artifact to a staging path, and the
+   * result is added to the cache. Concurrent callers with the same key wait
+   * for the first download instead of repeating it.
+   */
+  Result<void> Fetch(const std::string& key, const std::string& destination,
+                     const Downloader& download);
+
+  // Bytes used by the objects currently in the index.
+  Result<std::uint64_t> Size();
+
+ private:
+  ArtifactCache(std::string directory, std::uint64_t max_size);
+
+  Result<SharedFD> Lock(const std::string& path);
+  Result<bool> TryMaterialize(const std::string& key,
+                              const std::string& destination);
+  Result<void> Insert(const std::string& key, const std::string& staged);
+
+  std::string directory_;
+  std::uint64_t max_size_;
+};
+
+}  // namespace cuttlefish
@@ -20,6 +20,7 @@
 
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -118,15 +119,18 @@ BuildApi::BuildApi(std::unique_ptr<HttpClient> http_client,
 BuildApi::BuildApi(std::unique_ptr<HttpClient> http_client,
                    std::unique_ptr<HttpClient> inner_http_client,
                    std::unique_ptr<CredentialSource> credential_source,
-                   std::string api_key, const std::chrono::seconds retry_period)
+                   std::string api_key, const std::chrono::seconds retry_period,
+                   std::unique_ptr<ArtifactCache> artifact_cache)
     : http_client(std::move(http_client)),
       inner_http_client(std::move(inner_http_client)),
       credential_source(std::move(credential_source)),
       api_key_(std::move(api_key)),
-      retry_period_(retry_period) {}
+      retry_period_(retry_period),
+      artifact_cache_(std::move(artifact_cache)) {}
 
 Result<std::vector<std::string>> BuildApi::Headers() {
   std::vector<std::string> headers;
+  std::lock_guard<std::mutex> lock(credential_mutex_);
   if (credential_source) {
     headers.push_back("Authorization: Bearer " +
                       CF_EXPECT(credential_source->Credential()));
@@ -300,6 +304,20 @@ Result<void> BuildApi::ArtifactToCallback(const DeviceBuild& build,
 Result<void> BuildApi::ArtifactToFile(const DeviceBuild& build,
                                       const std::string& artifact,
                                       const std::string& path) {
+  if (!artifact_cache_) {
+    return DownloadArtifact(build, artifact, path);
+  }
+  auto key = ArtifactCache::Key(build.id, build.target, artifact);
+  CF_EXPECT(artifact_cache_->Fetch(
+      key, path, [this, &build, &artifact](const std::string& staged) {
+        return DownloadArtifact(build, artifact, staged);
+      }));
+  return {};
+}
+
+Result<void> BuildApi::DownloadArtifact(const DeviceBuild& build,
+                                        const std::string& artifact,
+                                        const std::string& path) {
   std::string download_url_endpoint =
       BUILD_API + "/builds/" + http_client->UrlEscape(build.id) + "/" +
       http_client->UrlEscape(build.target) + "/attempts/latest/artifacts/" +
@@ -411,6 +429,13 @@ Result<std::string> BuildApi::DownloadFileWithBackup(
   return DownloadTargetFile(build, target_directory, selected_artifact);
 }
 
+void BuildApi::CancelDownloads() {
+  http_client->CancelDownloads();
+  if (inner_http_client) {
+    inner_http_client->CancelDownloads();
+  }
+}
+
 Result<std::string> BuildApi::DownloadTargetFile(
     const Build& build, const std::string& target_directory,
     const std::string& artifact_name) {
@@ -18,6 +18,7 @@
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <tuple>
@@ -26,6 +27,7 @@
 #include <vector>
 
 #include "common/libs/utils/result.h"
+#include "host/libs/web/artifact_cache.h"
 #include "host/libs/web/credential_source.h"
 #include "host/libs/web/http_client/http_client.h"
 
@@ -89,7 +91,8 @@ class BuildApi {
   BuildApi(std::unique_ptr<HttpClient>, std::unique_ptr<CredentialSource>);
   BuildApi(std::unique_ptr<HttpClient>, std::unique_ptr<HttpClient>,
            std::unique_ptr<CredentialSource>, std::string api_key,
-           const std::chrono::seconds retry_period);
+           const std::chrono::seconds retry_period,
+           std::unique_ptr<ArtifactCache> artifact_cache = nullptr);
   ~BuildApi() = default;
 
   Result<std::string> LatestBuildId(const std::string& branch,
@@ -114,6 +117,9 @@ class BuildApi {
       const std::string& artifact_name,
       const std::string& backup_artifact_name);
 
+  // Makes the downloads in progress, and those started later, fail soon.
+  void CancelDownloads();
+
  private:
   Result<std::vector<std::string>> Headers();
 
@@ -143,6 +149,10 @@ class BuildApi {
                               const std::string& artifact,
                               const std::string& path);
 
+  Result<void> DownloadArtifact(const DeviceBuild& build,
+                                const std::string& artifact,
+                                const std::string& path);
+
   Result<void> ArtifactToFile(const DirectoryBuild& build,
                               const std::string& artifact,
                               const std::string& path);
@@ -165,8 +175,12 @@ class BuildApi {
   std::unique_ptr<HttpClient> http_client;
   std::unique_ptr<HttpClient> inner_http_client;
   std::unique_ptr<CredentialSource> credential_source;
+  // Credential sources refresh their token in place, and fetch_cvd downloads
+  // several artifacts at once.
+  std::mutex credential_mutex_;
   std::string api_key_;
   std::chrono::seconds retry_period_;
+  std::unique_ptr<ArtifactCache> artifact_cache_;
 };
 
 std::string GetBuildZipName(const Build& build, const std::string& name);
@@ -17,7 +17,7 @@
 
 #include <stdio.h>
 
-#include <fstream>
+#include <atomic>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -30,6 +30,7 @@
 
 #include "common/libs/utils/json.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/libs/web/http_client/segmented_download.h"
 
 namespace cuttlefish {
 namespace {
@@ -125,16 +126,11 @@ class CurlClient : public HttpClient {
       const std::string& url, const std::string& path,
       const std::vector<std::string>& headers) {
     LOG(INFO) << "Attempting to save \"" << url << "\" to \"" << path << "\"";
-    std::fstream stream;
-    auto callback = [&stream, path](char* data, size_t size) -> bool {
-      if (data == nullptr) {
-        stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
-        return !stream.fail();
-      }
-      stream.write(data, size);
-      return !stream.fail();
-    };
-    auto http_response = CF_EXPECT(DownloadToCallback(callback, url, headers));
+    auto extra_cache_entries = CF_EXPECT(ManuallyResolveUrl(url));
+    auto curl_headers = CF_EXPECT(SlistFromStrings(headers));
+    auto http_response = CF_EXPECT(SegmentedDownloadToFile(
+        url, path, curl_headers.get(), extra_cache_entries.get(),
+        {.cancelled = &downloads_cancelled_}));
     return HttpResponse<std::string>{path, http_response.http_code};
   }
 
@@ -156,6 +152,8 @@ class CurlClient : public HttpClient {
     return ret;
   }
 
+  void CancelDownloads() override { downloads_cancelled_ = true; }
+
  private:
   Result<ManagedCurlSlist> ManuallyResolveUrl(const std::string& url_str) {
     if (!resolver_) {
@@ -257,6 +255,7 @@ class CurlClient : public HttpClient {
   CURL* curl_;
   NameResolver resolver_;
   std::mutex mutex_;
+  std::atomic<bool> downloads_cancelled_ = false;
 };
 
 class ServerErrorRetryClient : public HttpClient {
@@ -345,6 +344,8 @@ class ServerErrorRetryClient : public HttpClient {
     return inner_client_.UrlEscape(text);
   }
 
+  void CancelDownloads() override { inner_client_.CancelDownloads(); }
+
  private:
   template <typename T>
   Result<HttpResponse<T>> RetryImpl(
@@ -97,6 +97,10 @@ class HttpClient {
       const std::vector<std::string>& headers = {}) = 0;
 
   virtual std::string UrlEscape(const std::string&) = 0;
+
+  // Makes the DownloadToFile calls in progress, and those made later, fail
+  // soon rather than run to completion.
+  virtual void CancelDownloads() {}
 };
 
 }  // namespace cuttlefish
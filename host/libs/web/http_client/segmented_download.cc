@@ -0,0 +1,551 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/http_client/segmented_download.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <curl/curl.h>
+#include <openssl/evp.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/base64.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kProgressSuffix[] = ".progress";
+constexpr auto kProgressSaveInterval = std::chrono::seconds(1);
+
+using ManagedCurl = std::unique_ptr<CURL, decltype(&curl_easy_cleanup)>;
+using ManagedCurlMulti =
+    std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)>;
+using HeaderMap = std::map<std::string, std::string>;
+
+size_t CollectHeader(char* buffer, size_t, size_t size, void* userdata) {
+  auto headers = static_cast<HeaderMap*>(userdata);
+  std::string line(buffer, size);
+  if (android::base::StartsWith(line, "HTTP/")) {
+    headers->clear();  // Start of a new response, e.g. after a redirect
+    return size;
+  }
+  auto colon = line.find(':');
+  if (colon == std::string::npos) {
+    return size;
+  }
+  auto key = android::base::Trim(line.substr(0, colon));
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  auto value = android::base::Trim(line.substr(colon + 1));
+  auto& stored = (*headers)[key];
+  stored = stored.empty() ? value : stored + "," + value;
+  return size;
+}
+
+void SetCommonOptions(CURL* curl, const std::string& url, curl_slist* headers,
+                      curl_slist* resolve, char* error_buf) {
+  curl_easy_setopt(curl, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buf);
+  error_buf[0] = '\0';
+}
+
+struct RangeProbe {
+  long http_code = 0;
+  bool supports_ranges = false;
+  std::uint64_t size = 0;
+  std::string validator;
+  std::string md5_base64;
+};
+
+// Makes curl abort the transfer once `cancelled` is set
+void SetCancellation(CURL* curl, const std::atomic<bool>* cancelled) {
+  if (!cancelled) {
+    return;
+  }
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION,
+                   +[](void* clientp, curl_off_t, curl_off_t, curl_off_t,
+                       curl_off_t) -> int {
+                     return static_cast<std::atomic<bool>*>(clientp)->load();
+                   });
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA,
+                   const_cast<std::atomic<bool>*>(cancelled));
+}
+
+bool Cancelled(const SegmentedDownloadOptions& options) {
+  return options.cancelled && options.cancelled->load();
+}
+
+/**
+ * Requests the first byte of the file. Signed URLs are only valid for GET, so
+ * this can't be a HEAD request. A 206 response tells the total size, a 200
+ * response means the server ignores ranges and the transfer is cut short.
+ */
+Result<RangeProbe> ProbeRanges(const std::string& url, curl_slist* headers,
+                               curl_slist* resolve) {
+  ManagedCurl curl(curl_easy_init(), curl_easy_cleanup);
+  CF_EXPECT(curl.get() != nullptr, "failed to initialize curl");
+  char error_buf[CURL_ERROR_SIZE];
+  SetCommonOptions(curl.get(), url, headers, resolve, error_buf);
+  curl_easy_setopt(curl.get(), CURLOPT_RANGE, "0-0");
+  HeaderMap response_headers;
+  curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION, CollectHeader);
+  curl_easy_setopt(curl.get(), CURLOPT_HEADERDATA, &response_headers);
+  std::uint64_t body_size = 0;
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION,
+                   +[](char*, size_t, size_t size, void* userdata) -> size_t {
+                     auto body_size = static_cast<std::uint64_t*>(userdata);
+                     *body_size += size;
+                     return *body_size <= 1 ? size : 0;
+                   });
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &body_size);
+  CURLcode res = curl_easy_perform(curl.get());
+  CF_EXPECT(res == CURLE_OK || res == CURLE_WRITE_ERROR,
+            "Probing \"" << url << "\" failed: " << curl_easy_strerror(res)
+                         << ", " << error_buf);
+
+  RangeProbe probe;
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &probe.http_code);
+  probe.validator = response_headers.count("etag")
+                        ? response_headers["etag"]
+                        : response_headers["last-modified"];
+  for (const auto& hash :
+       android::base::Split(response_headers["x-goog-hash"], ",")) {
+    auto trimmed = android::base::Trim(hash);
+    if (android::base::StartsWith(trimmed, "md5=")) {
+      probe.md5_base64 = trimmed.substr(4);
+    }
+  }
+  // Content-Range: bytes 0-0/<size>
+  const auto& content_range = response_headers["content-range"];
+  auto slash = content_range.rfind('/');
+  if (probe.http_code == 206 && slash != std::string::npos &&
+      android::base::ParseUint(content_range.substr(slash + 1), &probe.size)) {
+    probe.supports_ranges = true;
+  }
+  return probe;
+}
+
+Result<std::string> FileMd5Base64(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path << "\": "
+                                              << fd->StrError());
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  CF_EXPECT(EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr));
+  std::vector<char> buffer(1 << 20);
+  ssize_t bytes_read;
+  while ((bytes_read = fd->Read(buffer.data(), buffer.size())) > 0) {
+    CF_EXPECT(EVP_DigestUpdate(ctx.get(), buffer.data(), bytes_read));
+  }
+  CF_EXPECT(bytes_read == 0, "Could not read \"" << path << "\": "
+                                                 << fd->StrError());
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_size;
+  CF_EXPECT(EVP_DigestFinal_ex(ctx.get(), digest, &digest_size));
+  std::string encoded;
+  CF_EXPECT(EncodeBase64(digest, digest_size, &encoded));
+  return encoded;
+}
+
+Result<void> VerifyDownload(const std::string& path, const RangeProbe& probe) {
+  if (probe.supports_ranges) {
+    CF_EXPECT(FileSize(path) == static_cast<off_t>(probe.size),
+              "\"" << path << "\" has size " << FileSize(path)
+                   << ", the server reported " << probe.size);
+  }
+  if (!probe.md5_base64.empty()) {
+    auto md5 = CF_EXPECT(FileMd5Base64(path));
+    CF_EXPECT(md5 == probe.md5_base64, "\"" << path << "\" has md5 " << md5
+                                            << ", the server reported "
+                                            << probe.md5_base64);
+  }
+  return {};
+}
+
+Result<HttpResponse<SegmentedDownloadReport>> StreamToFile(
+    const std::string& url, const std::string& path, curl_slist* headers,
+    curl_slist* resolve, const SegmentedDownloadOptions& options) {
+  auto fd = SharedFD::Creat(path, 0644);
+  CF_EXPECT(fd->IsOpen(), "Could not create \"" << path << "\": "
+                                                << fd->StrError());
+  ManagedCurl curl(curl_easy_init(), curl_easy_cleanup);
+  CF_EXPECT(curl.get() != nullptr, "failed to initialize curl");
+  char error_buf[CURL_ERROR_SIZE];
+  SetCommonOptions(curl.get(), url, headers, resolve, error_buf);
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION,
+                   +[](char* data, size_t, size_t size, void* userdata) {
+                     auto fd = static_cast<SharedFD*>(userdata);
+                     return WriteAll(*fd, data, size) == (ssize_t)size
+                                ? size
+                                : 0;
+                   });
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &fd);
+  SetCancellation(curl.get(), options.cancelled);
+  CURLcode res = curl_easy_perform(curl.get());
+  CF_EXPECT(!Cancelled(options), "Download of \"" << url << "\" cancelled");
+  CF_EXPECT(res == CURLE_OK, "Downloading \"" << url << "\" failed: "
+                                              << curl_easy_strerror(res)
+                                              << ", " << error_buf);
+  long http_code = 0;
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+  return HttpResponse<SegmentedDownloadReport>{
+      {.size = static_cast<std::uint64_t>(FileSize(path)), .connections = 1},
+      http_code};
+}
+
+// One range request in flight. Every transfer writes through its own file
+// description, so each keeps an independent file offset.
+struct SegmentTransfer {
+  DownloadSegment* segment;
+  SharedFD fd;
+  ManagedCurl curl{nullptr, curl_easy_cleanup};
+  std::string range;
+  int retries_left;
+  char error_buf[CURL_ERROR_SIZE];
+};
+
+size_t WriteSegment(char* data, size_t, size_t size, void* userdata) {
+  auto transfer = static_cast<SegmentTransfer*>(userdata);
+  if (size > transfer->segment->Remaining()) {
+    LOG(ERROR) << "Server sent more than the range " << transfer->range;
+    return 0;
+  }
+  if (WriteAll(transfer->fd, data, size) != (ssize_t)size) {
+    LOG(ERROR) << "Could not write segment: " << transfer->fd->StrError();
+    return 0;
+  }
+  transfer->segment->done += size;
+  return size;
+}
+
+Result<void> StartTransfer(CURLM* multi, SegmentTransfer& transfer,
+                           const std::string& url, curl_slist* headers,
+                           curl_slist* resolve,
+                           const std::atomic<bool>* cancelled) {
+  auto& segment = *transfer.segment;
+  auto offset = segment.begin + segment.done;
+  CF_EXPECT(transfer.fd->LSeek(offset, SEEK_SET) == (off_t)offset,
+            transfer.fd->StrError());
+  transfer.curl.reset(curl_easy_init());
+  CF_EXPECT(transfer.curl.get() != nullptr, "failed to initialize curl");
+  transfer.range =
+      std::to_string(offset) + "-" + std::to_string(segment.end - 1);
+  auto curl = transfer.curl.get();
+  SetCommonOptions(curl, url, headers, resolve, transfer.error_buf);
+  curl_easy_setopt(curl, CURLOPT_RANGE, transfer.range.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteSegment);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+  SetCancellation(curl, cancelled);
+  CF_EXPECT(curl_multi_add_handle(multi, curl) == CURLM_OK);
+  return {};
+}
+
+Result<void> SaveProgress(const std::string& progress_path,
+                          const DownloadProgress& progress) {
+  auto temp_path = progress_path + ".tmp";
+  CF_EXPECT(android::base::WriteStringToFile(progress.Serialize(), temp_path),
+            "Could not write \"" << temp_path << "\"");
+  CF_EXPECT(RenameFile(temp_path, progress_path));
+  return {};
+}
+
+// Reuses the progress of an earlier attempt if it is for the same file.
+DownloadProgress LoadOrSplit(const std::string& path,
+                             const std::string& progress_path,
+                             const RangeProbe& probe,
+                             const SegmentedDownloadOptions& options) {
+  std::string serialized;
+  if (!probe.validator.empty() &&
+      FileSize(path) == static_cast<off_t>(probe.size) &&
+      android::base::ReadFileToString(progress_path, &serialized)) {
+    auto progress = DownloadProgress::Parse(serialized);
+    if (progress.ok() && progress->size == probe.size &&
+        progress->validator == probe.validator) {
+      LOG(INFO) << "Resuming download of \"" << path << "\" with "
+                << progress->Done() << " of " << probe.size << " bytes";
+      return *progress;
+    }
+  }
+  return DownloadProgress::Split(probe.size, probe.validator,
+                                 options.max_connections,
+                                 options.min_segment_size);
+}
+
+Result<HttpResponse<SegmentedDownloadReport>> DownloadSegments(
+    const std::string& url, const std::string& path, curl_slist* headers,
+    curl_slist* resolve, const RangeProbe& probe,
+    const SegmentedDownloadOptions& options) {
+  const auto progress_path = path + kProgressSuffix;
+  auto progress = LoadOrSplit(path, progress_path, probe, options);
+  const auto resumed = progress.Done();
+  if (resumed == 0) {
+    // Give the file its final size up front, so every segment can write into
+    // its own region as the bytes arrive.
+    auto fd = SharedFD::Creat(path, 0644);
+    CF_EXPECT(fd->IsOpen(), "Could not create \"" << path << "\": "
+                                                  << fd->StrError());
+    CF_EXPECT(fd->Truncate(probe.size) == 0, fd->StrError());
+  }
+  CF_EXPECT(SaveProgress(progress_path, progress));
+
+  // Declared before `multi` so that the multi handle, which may still refer
+  // to their easy handles on early returns, goes away first.
+  std::vector<std::unique_ptr<SegmentTransfer>> transfers;
+  ManagedCurlMulti multi(curl_multi_init(), curl_multi_cleanup);
+  CF_EXPECT(multi.get() != nullptr, "failed to initialize curl_multi");
+  std::deque<DownloadSegment*> pending;
+  for (auto& segment : progress.segments) {
+    if (segment.Remaining() > 0) {
+      pending.push_back(&segment);
+    }
+  }
+  std::size_t active = 0;
+  auto start_next = [&]() -> Result<void> {
+    auto transfer = std::make_unique<SegmentTransfer>();
+    transfer->segment = pending.front();
+    pending.pop_front();
+    transfer->fd = SharedFD::Open(path, O_WRONLY);
+    CF_EXPECT(transfer->fd->IsOpen(), "Could not open \""
+                                          << path << "\": "
+                                          << transfer->fd->StrError());
+    transfer->retries_left = options.segment_retries;
+    CF_EXPECT(StartTransfer(multi.get(), *transfer, url, headers, resolve,
+                            options.cancelled));
+    transfers.emplace_back(std::move(transfer));
+    active++;
+    return {};
+  };
+  while (!pending.empty() && active < options.max_connections) {
+    CF_EXPECT(start_next());
+  }
+
+  auto last_save = std::chrono::steady_clock::now();
+  while (active > 0) {
+    int running;
+    CF_EXPECT(curl_multi_perform(multi.get(), &running) == CURLM_OK);
+    if (Cancelled(options)) {
+      // Checked before the aborted transfers would be retried below
+      CF_EXPECT(SaveProgress(progress_path, progress));
+      return CF_ERR("Download of \"" << url << "\" cancelled");
+    }
+    CURLMsg* msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi.get(), &queued))) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      SegmentTransfer* transfer;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+      long http_code = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+      CURLcode result = msg->data.result;
+      curl_multi_remove_handle(multi.get(), msg->easy_handle);
+      active--;
+      if (result == CURLE_OK && http_code == 206 &&
+          transfer->segment->Remaining() == 0) {
+        transfer->curl.reset();
+        transfer->fd = SharedFD();
+        if (!pending.empty()) {
+          CF_EXPECT(start_next());
+        }
+        continue;
+      }
+      if (result == CURLE_OK && !IsHttpSuccess(http_code) &&
+          !(http_code >= 500 && http_code <= 599)) {
+        // Not transient, e.g. the signed url expired. The other segments
+        // would fail the same way, so stop here and let the caller decide.
+        CF_EXPECT(SaveProgress(progress_path, progress));
+        return HttpResponse<SegmentedDownloadReport>{{}, http_code};
+      }
+      LOG(WARNING) << "Range " << transfer->range << " of \"" << url
+                   << "\" stopped: " << curl_easy_strerror(result) << ", "
+                   << transfer->error_buf << ", http code " << http_code;
+      if (transfer->retries_left-- <= 0) {
+        CF_EXPECT(SaveProgress(progress_path, progress));
+        if (http_code >= 500) {
+          return HttpResponse<SegmentedDownloadReport>{{}, http_code};
+        }
+        return CF_ERR("Giving up on range " << transfer->range << " of \""
+                                            << url << "\"");
+      }
+      CF_EXPECT(StartTransfer(multi.get(), *transfer, url, headers, resolve,
+                            options.cancelled));
+      active++;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_save >= kProgressSaveInterval) {
+      CF_EXPECT(SaveProgress(progress_path, progress));
+      last_save = now;
+    }
+    if (active > 0) {
+      CF_EXPECT(curl_multi_poll(multi.get(), nullptr, 0, 1000, nullptr) ==
+                CURLM_OK);
+    }
+  }
+  CF_EXPECT(progress.Complete(), "Segments of \"" << path << "\" are missing");
+  RemoveFile(progress_path);
+
+  SegmentedDownloadReport report = {
+      .size = probe.size,
+      .resumed = resumed,
+      .connections = std::min(options.max_connections, transfers.size()),
+  };
+  return HttpResponse<SegmentedDownloadReport>{report, 200};
+}
+
+}  // namespace
+
+DownloadProgress DownloadProgress::Split(std::uint64_t size,
+                                         std::string validator,
+                                         std::size_t max_segments,
+                                         std::uint64_t min_segment_size) {
+  DownloadProgress progress;
+  progress.size = size;
+  progress.validator = std::move(validator);
+  std::uint64_t count = std::max<std::uint64_t>(
+      1, std::min<std::uint64_t>(max_segments,
+                                 size / std::max<std::uint64_t>(
+                                            min_segment_size, 1)));
+  std::uint64_t segment_size = (size + count - 1) / count;
+  for (std::uint64_t begin = 0; begin < size; begin += segment_size) {
+    progress.segments.push_back(DownloadSegment{
+        .begin = begin,
+        .end = std::min(size, begin + segment_size),
+        .done = 0,
+    });
+  }
+  return progress;
+}
+
+// Format:
+//   size <bytes>
+//   validator <etag>
+//   segment <begin> <end> <done>
+//   ...
+Result<DownloadProgress> DownloadProgress::Parse(
+    const std::string& serialized) {
+  DownloadProgress progress;
+  for (const auto& line : android::base::Split(serialized, "\n")) {
+    if (line.empty()) {
+      continue;
+    }
+    auto space = line.find(' ');
+    CF_EXPECT(space != std::string::npos, "Malformed line \"" << line << "\"");
+    auto key = line.substr(0, space);
+    auto value = line.substr(space + 1);
+    if (key == "size") {
+      CF_EXPECT(android::base::ParseUint(value, &progress.size));
+    } else if (key == "validator") {
+      progress.validator = value;
+    } else if (key == "segment") {
+      auto fields = android::base::Split(value, " ");
+      CF_EXPECT(fields.size() == 3, "Malformed segment \"" << line << "\"");
+      DownloadSegment segment;
+      CF_EXPECT(android::base::ParseUint(fields[0], &segment.begin));
+      CF_EXPECT(android::base::ParseUint(fields[1], &segment.end));
+      CF_EXPECT(android::base::ParseUint(fields[2], &segment.done));
+      CF_EXPECT(segment.begin <= segment.end &&
+                    segment.done <= segment.end - segment.begin &&
+                    segment.end <= progress.size,
+                "Segment out of bounds: \"" << line << "\"");
+      progress.segments.push_back(segment);
+    } else {
+      return CF_ERR("Unknown key in \"" << line << "\"");
+    }
+  }
+  return progress;
+}
+
+std::string DownloadProgress::Serialize() const {
+  std::stringstream out;
+  out << "size " << size << "\n";
+  out << "validator " << validator << "\n";
+  for (const auto& segment : segments) {
+    out << "segment " << segment.begin << " " << segment.end << " "
+        << segment.done << "\n";
+  }
+  return out.str();
+}
+
+std::uint64_t DownloadProgress::Done() const {
+  std::uint64_t done = 0;
+  for (const auto& segment : segments) {
+    done += segment.done;
+  }
+  return done;
+}
+
+double SegmentedDownloadReport::MegabytesPerSecond() const {
+  auto seconds = std::chrono::duration<double>(duration).count();
+  return seconds > 0 ? (size - resumed) / seconds / (1 << 20) : 0;
+}
+
+std::ostream& operator<<(std::ostream& out,
+                         const SegmentedDownloadReport& report) {
+  return out << (report.size >> 20) << " MiB ("
+             << (report.resumed >> 20) << " MiB resumed) in "
+             << std::chrono::duration<double>(report.duration).count()
+             << " s, " << report.MegabytesPerSecond() << " MiB/s over "
+             << report.connections << " connection(s)";
+}
+
+Result<HttpResponse<SegmentedDownloadReport>> SegmentedDownloadToFile(
+    const std::string& url, const std::string& path,
+    curl_slist* headers, curl_slist* resolve,
+    const SegmentedDownloadOptions& options) {
+  CF_EXPECT(!Cancelled(options), "Download of \"" << url << "\" cancelled");
+  const auto start = std::chrono::steady_clock::now();
+  auto probe = CF_EXPECT(ProbeRanges(url, headers, resolve));
+  if (!IsHttpSuccess(probe.http_code)) {
+    return HttpResponse<SegmentedDownloadReport>{{}, probe.http_code};
+  }
+  HttpResponse<SegmentedDownloadReport> response;
+  if (probe.supports_ranges && options.max_connections > 1 &&
+      probe.size >= 2 * options.min_segment_size) {
+    response = CF_EXPECT(
+        DownloadSegments(url, path, headers, resolve, probe, options));
+  } else {
+    response = CF_EXPECT(StreamToFile(url, path, headers, resolve, options));
+  }
+  if (!response.HttpSuccess()) {
+    return response;
+  }
+  CF_EXPECT(VerifyDownload(path, probe));
+  response.data.duration = std::chrono::steady_clock::now() - start;
+  LOG(INFO) << "Downloaded \"" << path << "\": " << response.data;
+  return response;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "common/libs/utils/result.h"
+#include "host/libs/web/http_client/http_client.h"
+
+namespace cuttlefish {
+
+// A byte range [begin, end) of the remote file, of which the first `done`
+// bytes are already on disk.
+struct DownloadSegment {
+  std::uint64_t begin;
+  std::uint64_t end;
+  std::uint64_t done;
+
+  std::uint64_t Remaining() const { return end - begin - done; }
+};
+
+// The state of a segmented download. It is persisted next to the destination
+// file so that an interrupted download resumes instead of starting over.
+struct DownloadProgress {
+  std::uint64_t size = 0;
+  // ETag or Last-Modified of the remote file, used to detect that the partial
+  // file on disk belongs to a different version of it.
+  std::string validator;
+  std::vector<DownloadSegment> segments;
+
+  static DownloadProgress Split(std::uint64_t size, std::string validator,
+                                std::size_t max_segments,
+                                std::uint64_t min_segment_size);
+  static Result<DownloadProgress> Parse(const std::string& serialized);
+  std::string Serialize() const;
+
+  std::uint64_t Done() const;
+  bool Complete() const { return Done() == size; }
+};
+
+struct SegmentedDownloadOptions {
+  // Number of concurrent range requests.
+  std::size_t max_connections = 8;
+  // Files smaller than this, and pieces smaller than this, are not split.
+  std::uint64_t min_segment_size = 32 << 20;
+  // How many times one segment is restarted after a transfer error before the
+  // whole download fails. Progress is kept between attempts.
+  int segment_retries = 3;
+  // Once this is set the download stops with an error, keeping its progress
+  // for a later call.
+  const std::atomic<bool>* cancelled = nullptr;
+};
+
+struct SegmentedDownloadReport {
+  std::uint64_t size = 0;
+  // Bytes that were already on disk from an earlier, interrupted attempt.
+  std::uint64_t resumed = 0;
+  std::size_t connections = 0;
+  std::chrono::steady_clock::duration duration{};
+
+  double MegabytesPerSecond() const;
+};
+
+std::ostream& operator<<(std::ostream&, const SegmentedDownloadReport&);
+
+/**
+ * Downloads `url` into `path`.
+ *
+ * When the server honors range requests the file is preallocated and split
+ * into segments that are fetched concurrently with curl_multi, each one
+ * written straight to its region of the file. Progress is recorded in
+ * `<path>.progress`, and a later call with the same arguments resumes from
+ * it. The result is checked against the size reported by the server and,
+ * when the server provides one (e.g. `x-goog-hash`), the MD5 digest.
+ *
+ * Servers without range support get a single stream, as before.
+ */
+Result<HttpResponse<SegmentedDownloadReport>> SegmentedDownloadToFile(
+    const std::string& url, const std::string& path,
+    curl_slist* headers, curl_slist* resolve = nullptr,
+    const SegmentedDownloadOptions& options = {});
+
+}  // namespace cuttlefish
@@ -0,0 +1,354 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/http_client/segmented_download.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+/**
+ * Minimal HTTP/1.1 stand-in for the artifact server. Every connection serves
+ * one GET of `body`, honoring a single "Range: bytes=a-b" header unless range
+ * support is turned off.
+ */
+class FakeHttpServer {
+ public:
+  FakeHttpServer(std::string body) : body_(std::move(body)) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, (sockaddr*)&addr, sizeof(addr));
+    listen(listen_fd_, 64);
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd_, (sockaddr*)&addr, &len);
+    port_ = ntohs(addr.sin_port);
+    accept_thread_ = std::thread([this]() { AcceptLoop(); });
+  }
+
+  ~FakeHttpServer() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    close(listen_fd_);
+    accept_thread_.join();
+    for (auto& thread : connection_threads_) {
+      thread.join();
+    }
+  }
+
+  std::string Url() const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/artifact";
+  }
+
+  std::atomic<bool> supports_ranges = true;
+  // Connections are dropped after this many body bytes while it is positive.
+  std::atomic<int> drop_after_bytes = 0;
+  std::atomic<int> status_code = 0;  // Overrides the status when non-zero
+  // The status is only overridden after this many requests
+  std::atomic<int> status_code_after_requests = 0;
+  // While positive, later requests get part of the body and then nothing until
+  // the client hangs up.
+  std::atomic<int> stall_after_requests = 0;
+  std::string md5_base64;
+  std::atomic<int> requests = 0;
+
+ private:
+  void AcceptLoop() {
+    int fd;
+    while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+      connection_threads_.emplace_back([this, fd]() {
+        Serve(fd);
+        close(fd);
+      });
+    }
+  }
+
+  void Serve(int fd) {
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      auto got = read(fd, buf, sizeof(buf));
+      if (got <= 0) {
+        return;
+      }
+      request.append(buf, got);
+    }
+    int request_count = ++requests;
+    std::string headers;
+    if (!md5_base64.empty()) {
+      headers += "x-goog-hash: crc32c=AAAAAA==\r\n";
+      headers += "x-goog-hash: md5=" + md5_base64 + "\r\n";
+    }
+    headers += "ETag: \"v1\"\r\n";
+    if (status_code != 0 && request_count > status_code_after_requests) {
+      Send(fd, "HTTP/1.1 " + std::to_string(status_code) +
+                   " Error\r\nContent-Length: 0\r\n\r\n");
+      return;
+    }
+    size_t begin = 0;
+    size_t end = body_.size() - 1;
+    std::string status = "200 OK";
+    auto range_pos = request.find("Range: bytes=");
+    if (supports_ranges && range_pos != std::string::npos) {
+      auto spec = request.substr(range_pos + 13);
+      spec = spec.substr(0, spec.find("\r\n"));
+      auto dash = spec.find('-');
+      begin = std::stoull(spec.substr(0, dash));
+      end = std::stoull(spec.substr(dash + 1));
+      status = "206 Partial Content";
+      headers += "Content-Range: bytes " + std::to_string(begin) + "-" +
+                 std::to_string(end) + "/" + std::to_string(body_.size()) +
+                 "\r\n";
+    }
+    size_t length = end - begin + 1;
+    Send(fd, "HTTP/1.1 " + status + "\r\n" + headers +
+                 "Content-Length: " + std::to_string(length) + "\r\n\r\n");
+    if (drop_after_bytes > 0 && length > (size_t)drop_after_bytes) {
+      length = drop_after_bytes;
+    }
+    if (stall_after_requests > 0 && request_count > stall_after_requests) {
+      Send(fd, body_.substr(begin, std::min<size_t>(length, 1000)));
+      while (read(fd, buf, sizeof(buf)) > 0) {
+      }
+      return;
+    }
+    Send(fd, body_.substr(begin, length));
+  }
+
+  static void Send(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      auto ret = write(fd, data.data() + sent, data.size() - sent);
+      if (ret <= 0) {
+        return;
+      }
+      sent += ret;
+    }
+  }
+
+  std::string body_;
+  int listen_fd_;
+  int port_;
+  std::thread accept_thread_;
+  std::vector<std::thread> connection_threads_;
+};
+
+std::string RandomBody(size_t size) {
+  std::mt19937 gen(size);
+  std::string body(size, '\0');
+  for (auto& c : body) {
+    c = gen();
+  }
+  return body;
+}
+
+std::string ReadAll(const std::string& path) {
+  std::string contents;
+  android::base::ReadFileToString(path, &contents);
+  return contents;
+}
+
+SegmentedDownloadOptions SmallSegments() {
+  return SegmentedDownloadOptions{
+      .max_connections = 4,
+      .min_segment_size = 64 << 10,
+      .segment_retries = 0,
+  };
+}
+
+}  // namespace
+
+TEST(DownloadProgressTest, SplitCoversWholeFile) {
+  auto progress = DownloadProgress::Split(1000, "etag", 3, 100);
+  ASSERT_EQ(progress.segments.size(), 3);
+  EXPECT_EQ(progress.segments.front().begin, 0);
+  EXPECT_EQ(progress.segments.back().end, 1000);
+  for (size_t i = 1; i < progress.segments.size(); i++) {
+    EXPECT_EQ(progress.segments[i].begin, progress.segments[i - 1].end);
+  }
+  EXPECT_EQ(DownloadProgress::Split(1000, "etag", 8, 600).segments.size(), 1);
+}
+
+TEST(DownloadProgressTest, SerializeRoundTrip) {
+  auto progress = DownloadProgress::Split(1 << 20, "\"abc\"", 4, 1);
+  progress.segments[1].done = 17;
+  auto parsed = DownloadProgress::Parse(progress.Serialize());
+  ASSERT_TRUE(parsed.ok()) << parsed.error().Trace();
+  EXPECT_EQ(parsed->size, progress.size);
+  EXPECT_EQ(parsed->validator, progress.validator);
+  ASSERT_EQ(parsed->segments.size(), 4);
+  EXPECT_EQ(parsed->segments[1].done, 17);
+  EXPECT_EQ(parsed->Done(), 17);
+}
+
+TEST(DownloadProgressTest, ParseRejectsOutOfBounds) {
+  EXPECT_FALSE(DownloadProgress::Parse("size 10\nsegment 0 20 0\n").ok());
+  EXPECT_FALSE(DownloadProgress::Parse("size 10\nsegment 0 5 6\n").ok());
+}
+
+TEST(SegmentedDownloadTest, DownloadsInSegments) {
+  auto body = RandomBody(1 << 20);
+  FakeHttpServer server(body);
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+
+  auto res = SegmentedDownloadToFile(server.Url(), path, {}, nullptr,
+                                     SmallSegments());
+
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  EXPECT_TRUE(res->HttpSuccess());
+  EXPECT_EQ(res->data.connections, 4);
+  EXPECT_EQ(res->data.size, body.size());
+  EXPECT_EQ(server.requests, 5);  // The probe and one per segment
+  EXPECT_EQ(ReadAll(path), body);
+  EXPECT_FALSE(FileExists(path + ".progress"));
+}
+
+TEST(SegmentedDownloadTest, FallsBackToSingleStream) {
+  auto body = RandomBody(1 << 20);
+  FakeHttpServer server(body);
+  server.supports_ranges = false;
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+
+  auto res = SegmentedDownloadToFile(server.Url(), path, {}, nullptr,
+                                     SmallSegments());
+
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  EXPECT_EQ(res->data.connections, 1);
+  EXPECT_EQ(ReadAll(path), body);
+}
+
+TEST(SegmentedDownloadTest, ResumesAfterInterruption) {
+  auto body = RandomBody(1 << 20);
+  FakeHttpServer server(body);
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+
+  server.drop_after_bytes = 10000;
+  auto interrupted = SegmentedDownloadToFile(server.Url(), path, {}, nullptr,
+                                             SmallSegments());
+  EXPECT_FALSE(interrupted.ok());
+  EXPECT_TRUE(FileExists(path + ".progress"));
+
+  server.drop_after_bytes = 0;
+  auto resumed = SegmentedDownloadToFile(server.Url(), path, {}, nullptr,
+                                         SmallSegments());
+  ASSERT_TRUE(resumed.ok()) << resumed.error().Trace();
+  EXPECT_GT(resumed->data.resumed, 0);
+  EXPECT_EQ(ReadAll(path), body);
+}
+
+TEST(SegmentedDownloadTest, RetriesDroppedSegments) {
+  auto body = RandomBody(1 << 20);
+  FakeHttpServer server(body);
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+  auto options = SmallSegments();
+  options.segment_retries = 100;
+
+  server.drop_after_bytes = 100000;
+  auto res = SegmentedDownloadToFile(server.Url(), path, {}, nullptr, options);
+
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  EXPECT_GT(server.requests, 5);
+  EXPECT_EQ(ReadAll(path), body);
+}
+
+TEST(SegmentedDownloadTest, VerifiesMd5) {
+  auto body = RandomBody(1 << 20);
+  FakeHttpServer server(body);
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+
+  server.md5_base64 = "AAAAAAAAAAAAAAAAAAAAAA==";
+  EXPECT_FALSE(SegmentedDownloadToFile(server.Url(), path, {}, nullptr,
+                                       SmallSegments())
+                   .ok());
+}
+
+TEST(SegmentedDownloadTest, StopsOnFatalSegmentError) {
+  FakeHttpServer server(RandomBody(1 << 20));
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+  auto options = SmallSegments();
+  options.segment_retries = 100;
+  // The probe succeeds, then the signed url "expires"
+  server.status_code = 403;
+  server.status_code_after_requests = 1;
+
+  auto res = SegmentedDownloadToFile(server.Url(), path, {}, nullptr, options);
+
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  EXPECT_TRUE(res->HttpClientError());
+  // Nothing is retried or started after the first 403
+  EXPECT_LE(server.requests, 1 + options.max_connections);
+  EXPECT_TRUE(FileExists(path + ".progress"));
+}
+
+TEST(SegmentedDownloadTest, ReportsServerErrors) {
+  FakeHttpServer server(RandomBody(1 << 10));
+  TemporaryDir dir;
+  server.status_code = 503;
+
+  auto res = SegmentedDownloadToFile(
+      server.Url(), std::string(dir.path) + "/artifact", {}, nullptr,
+      SmallSegments());
+
+  ASSERT_TRUE(res.ok()) << res.error().Trace();
+  EXPECT_TRUE(res->HttpServerError());
+}
+
+TEST(SegmentedDownloadTest, StopsWhenCancelled) {
+  FakeHttpServer server(RandomBody(1 << 20));
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/artifact";
+  server.stall_after_requests = 1;
+  std::atomic<bool> cancelled = false;
+  auto options = SmallSegments();
+  options.cancelled = &cancelled;
+
+  std::thread canceller([&cancelled]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    cancelled = true;
+  });
+  auto res = SegmentedDownloadToFile(server.Url(), path, {}, nullptr, options);
+  canceller.join();
+
+  EXPECT_FALSE(res.ok());
+  EXPECT_TRUE(FileExists(path + ".progress"));
+  EXPECT_FALSE(SegmentedDownloadToFile(server.Url(), path, {}, nullptr, options)
+                   .ok());
+  EXPECT_EQ(server.requests, 1 + options.max_connections);
+}
+
+}  // namespace cuttlefish
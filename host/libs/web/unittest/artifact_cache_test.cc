@@ -0,0 +1,199 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/artifact_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/sha256.h"
+
+namespace cuttlefish {
+namespace {
+
+class ArtifactCacheTest : public testing::Test {
+ protected:
+  void SetUp() override { OpenCache(1 << 20); }
+
+  void OpenCache(std::uint64_t max_size) {
+    auto cache = ArtifactCache::Open(std::string(cache_dir_.path), max_size);
+    ASSERT_TRUE(cache.ok()) << cache.error().Trace();
+    cache_ = std::move(*cache);
+  }
+
+  // Fetches `key` into the output directory, "downloading" `contents` on a
+  // cache miss.
+  std::string Fetch(const std::string& key, const std::string& contents,
+                    const std::string& name = "artifact") {
+    auto destination = std::string(out_dir_.path) + "/" + name;
+    auto res = cache_->Fetch(
+        key, destination, [this, &contents](const std::string& path) {
+          downloads_++;
+          return WriteFile(path, contents);
+        });
+    EXPECT_TRUE(res.ok()) << res.error().Trace();
+    return destination;
+  }
+
+  static Result<void> WriteFile(const std::string& path,
+                                const std::string& contents) {
+    CF_EXPECT(android::base::WriteStringToFile(contents, path));
+    return {};
+  }
+
+  static std::string ReadAll(const std::string& path) {
+    std::string contents;
+    android::base::ReadFileToString(path, &contents);
+    return contents;
+  }
+
+  TemporaryDir cache_dir_;
+  TemporaryDir out_dir_;
+  std::unique_ptr<ArtifactCache> cache_;
+  int downloads_ = 0;
+};
+
+}  // namespace
+
+TEST_F(ArtifactCacheTest, DownloadsOnlyOnce) {
+  auto key = ArtifactCache::Key("1234", "aosp_cf-userdebug", "kernel");
+
+  auto first = Fetch(key, "kernel contents", "first");
+  auto second = Fetch(key, "kernel contents", "second");
+
+  EXPECT_EQ(downloads_, 1);
+  EXPECT_EQ(ReadAll(first), "kernel contents");
+  EXPECT_EQ(ReadAll(second), "kernel contents");
+}
+
+TEST_F(ArtifactCacheTest, SharedAcrossInstances) {
+  auto key = ArtifactCache::Key("1234", "aosp_cf-userdebug", "kernel");
+  Fetch(key, "kernel contents");
+
+  OpenCache(1 << 20);
+  auto path = Fetch(key, "kernel contents", "other");
+
+  EXPECT_EQ(downloads_, 1);
+  EXPECT_EQ(ReadAll(path), "kernel contents");
+}
+
+TEST_F(ArtifactCacheTest, RemovingDestinationKeepsEntry) {
+  auto key = ArtifactCache::Key("1234", "aosp_cf-userdebug", "img.zip");
+  auto path = Fetch(key, "zip contents");
+  ASSERT_TRUE(RemoveFile(path));
+
+  path = Fetch(key, "zip contents");
+
+  EXPECT_EQ(downloads_, 1);
+  EXPECT_EQ(ReadAll(path), "zip contents");
+}
+
+TEST_F(ArtifactCacheTest, ModifyingDestinationKeepsCache) {
+  auto key = ArtifactCache::Key("1234", "aosp_cf-userdebug", "misc_info.txt");
+  auto path = Fetch(key, "original", "first");
+  ASSERT_TRUE(android::base::WriteStringToFile("modified", path));
+
+  auto other = Fetch(key, "original", "second");
+
+  EXPECT_EQ(downloads_, 1);
+  EXPECT_EQ(ReadAll(path), "modified");
+  EXPECT_EQ(ReadAll(other), "original");
+}
+
+TEST_F(ArtifactCacheTest, FailedDownloadIsNotCached) {
+  auto key = ArtifactCache::Key("1234", "aosp_cf-userdebug", "kernel");
+  auto destination = std::string(out_dir_.path) + "/artifact";
+  auto failed = cache_->Fetch(key, destination, [](const std::string&) {
+    return Result<void>(CF_ERR("network down"));
+  });
+  EXPECT_FALSE(failed.ok());
+
+  Fetch(key, "kernel contents");
+
+  EXPECT_EQ(downloads_, 1);
+}
+
+TEST_F(ArtifactCacheTest, StoresIdenticalContentsOnce) {
+  Fetch(ArtifactCache::Key("1", "target", "bootloader"), "u-boot", "a");
+  Fetch(ArtifactCache::Key("2", "target", "bootloader"), "u-boot", "b");
+
+  auto size = cache_->Size();
+  ASSERT_TRUE(size.ok()) << size.error().Trace();
+  EXPECT_EQ(*size, 6u);
+}
+
+TEST_F(ArtifactCacheTest, EvictsLeastRecentlyUsed) {
+  OpenCache(250);
+  auto a = ArtifactCache::Key("1", "target", "a");
+  auto b = ArtifactCache::Key("1", "target", "b");
+  auto c = ArtifactCache::Key("1", "target", "c");
+  Fetch(a, std::string(100, 'a'));
+  Fetch(b, std::string(100, 'b'));
+  Fetch(a, std::string(100, 'a'));  // Makes "b" the oldest entry
+  Fetch(c, std::string(100, 'c'));
+  ASSERT_EQ(downloads_, 3);
+
+  Fetch(a, std::string(100, 'a'));
+  EXPECT_EQ(downloads_, 3);
+  Fetch(b, std::string(100, 'b'));
+  EXPECT_EQ(downloads_, 4);
+
+  auto size = cache_->Size();
+  ASSERT_TRUE(size.ok()) << size.error().Trace();
+  EXPECT_LE(*size, 250u);
+}
+
+TEST_F(ArtifactCacheTest, KeepsArtifactLargerThanLimit) {
+  OpenCache(10);
+  auto key = ArtifactCache::Key("1", "target", "super.img");
+
+  auto path = Fetch(key, std::string(100, 's'));
+
+  EXPECT_EQ(ReadAll(path), std::string(100, 's'));
+  Fetch(key, std::string(100, 's'));
+  EXPECT_EQ(downloads_, 1);
+}
+
+TEST_F(ArtifactCacheTest, KeepsEvictedObjectWhileItIsCopied) {
+  OpenCache(150);
+  auto a = ArtifactCache::Key("1", "target", "a");
+  Fetch(a, std::string(100, 'a'));
+  auto objects = std::string(cache_dir_.path) + "/objects";
+  auto object = objects + "/" + Sha256(std::string(100, 'a'));
+  ASSERT_TRUE(FileExists(object));
+  {
+    // As held by a copy in progress
+    auto pin = SharedFD::Open(object, O_RDONLY);
+    ASSERT_TRUE(pin->Flock(LOCK_SH).ok());
+
+    Fetch(ArtifactCache::Key("1", "target", "b"), std::string(100, 'b'));
+    EXPECT_TRUE(FileExists(object));
+  }
+  Fetch(ArtifactCache::Key("1", "target", "c"), std::string(100, 'c'));
+  EXPECT_FALSE(FileExists(object));
+
+  Fetch(a, std::string(100, 'a'));
+  EXPECT_EQ(downloads_, 4);
+}
+
+}  // namespace cuttlefish
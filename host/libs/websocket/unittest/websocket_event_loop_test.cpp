@@ -0,0 +1,138 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <libwebsockets.h>
+
+#include "host/libs/websocket/websocket_handler.h"
+#include "host/libs/websocket/websocket_server.h"
+
+namespace cuttlefish {
+
+class TestHandler : public WebSocketHandler {
+ public:
+  using WebSocketHandler::WebSocketHandler;
+
+  void OnReceive(const uint8_t*, size_t, bool) override {}
+  void OnConnected() override {}
+  void OnClosed() override {}
+};
+
+// The tests stand in for the loop's thread, the requests come from threads of
+// their own. The connections are never touched, so any address serves as wsi.
+class WebSocketEventLoopTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    struct lws_context_creation_info info = {};
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = kProtocols;
+    loop_.context_ = lws_create_context(&info);
+    ASSERT_NE(loop_.context_, nullptr);
+  }
+
+  void TearDown() override {
+    if (loop_.context_) {
+      lws_context_destroy(loop_.context_);
+    }
+  }
+
+  struct lws* Wsi(int i) {
+    return reinterpret_cast<struct lws*>(&wsi_storage_[i]);
+  }
+
+  std::shared_ptr<TestHandler> Connect(struct lws* wsi) {
+    auto handler = std::make_shared<TestHandler>(wsi);
+    loop_.AddHandler(wsi, handler);
+    return handler;
+  }
+  void Disconnect(struct lws* wsi) { loop_.RemoveHandler(wsi); }
+
+  std::vector<struct lws*> TakeWritableRequests() {
+    return loop_.TakeWritableRequests();
+  }
+
+  template <typename F>
+  void FromOtherThread(F&& f) {
+    std::thread(std::forward<F>(f)).join();
+  }
+
+  static constexpr struct lws_protocols kProtocols[] =  //
+      {{
+           .name = "test",
+           .callback = lws_callback_http_dummy,
+           .per_session_data_size = 0,
+           .rx_buffer_size = 0,
+           .id = 0,
+           .user = nullptr,
+           .tx_packet_size = 0,
+       },
+       {
+           .name = nullptr,
+           .callback = nullptr,
+           .per_session_data_size = 0,
+           .rx_buffer_size = 0,
+           .id = 0,
+           .user = nullptr,
+           .tx_packet_size = 0,
+       }};
+
+  WebSocketEventLoop loop_;
+  char wsi_storage_[2] = {};
+};
+
+namespace {
+
+const char kMessage[] = "message";
+
+TEST_F(WebSocketEventLoopTest, ServesRequestsFromOtherThreads) {
+  auto handler = Connect(Wsi(0));
+  FromOtherThread(
+      [&handler]() { handler->EnqueueMessage(kMessage, sizeof(kMessage)); });
+  EXPECT_EQ(TakeWritableRequests(), std::vector<struct lws*>({Wsi(0)}));
+  // Each request is served once
+  EXPECT_TRUE(TakeWritableRequests().empty());
+}
+
+TEST_F(WebSocketEventLoopTest, DropsRequestsAfterConnectionCloses) {
+  auto handler = Connect(Wsi(0));
+  auto other = Connect(Wsi(1));
+  Disconnect(Wsi(0));
+  // The handler outlives its connection as long as other threads hold it
+  FromOtherThread([&handler, &other]() {
+    handler->EnqueueMessage(kMessage, sizeof(kMessage));
+    handler->Close();
+    other->EnqueueMessage(kMessage, sizeof(kMessage));
+  });
+  EXPECT_EQ(TakeWritableRequests(), std::vector<struct lws*>({Wsi(1)}));
+}
+
+TEST_F(WebSocketEventLoopTest, DropsRequestsForReusedConnections) {
+  auto old_handler = Connect(Wsi(0));
+  FromOtherThread([&old_handler]() {
+    old_handler->EnqueueMessage(kMessage, sizeof(kMessage));
+  });
+  // lws reuses the wsi of a closed connection for a new one before the loop
+  // got to the request
+  Disconnect(Wsi(0));
+  auto new_handler = Connect(Wsi(0));
+  EXPECT_TRUE(TakeWritableRequests().empty());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -36,8 +36,21 @@ void WebSocketHandler::EnqueueMessage(const uint8_t* data, size_t len,
                                       bool binary) {
   std::vector<uint8_t> buffer(LWS_PRE + len, 0);
   std::copy(data, data + len, buffer.begin() + LWS_PRE);
-  buffer_queue_.emplace_front(std::move(buffer), binary);
-  lws_callback_on_writable(wsi_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_queue_.emplace_front(std::move(buffer), binary);
+  }
+  RequestWritable();
+}
+
+// Only the thread servicing the connection may call lws_callback_on_writable()
+// on it, the others go through its event loop.
+void WebSocketHandler::RequestWritable() {
+  if (event_loop_ && !event_loop_->InLoopThread()) {
+    event_loop_->RequestWritable(wsi_, this);
+  } else {
+    lws_callback_on_writable(wsi_);
+  }
 }
 
 // Attempts to write what's left on a websocket buffer to the websocket,
@@ -61,22 +74,30 @@ void WebSocketHandler::WriteWsBuffer(WebSocketHandler::WsBuffer& ws_buffer) {
 }
 
 bool WebSocketHandler::OnWritable() {
+  std::unique_lock<std::mutex> lock(mutex_);
   if (buffer_queue_.empty()) {
     return close_;
   }
-  WriteWsBuffer(buffer_queue_.back());
+  auto ws_buffer = std::move(buffer_queue_.back());
   buffer_queue_.pop_back();
+  bool more_queued = !buffer_queue_.empty();
+  // Only close if there are no more queued writes
+  bool should_close = !more_queued && close_;
+  lock.unlock();
 
-  if (!buffer_queue_.empty()) {
+  WriteWsBuffer(ws_buffer);
+  if (more_queued) {
     lws_callback_on_writable(wsi_);
   }
-  // Only close if there are no more queued writes
-  return buffer_queue_.empty() && close_;
+  return should_close;
 }
 
 void WebSocketHandler::Close() {
-  close_ = true;
-  lws_callback_on_writable(wsi_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    close_ = true;
+  }
+  RequestWritable();
 }
 
 DynHandler::DynHandler(struct lws* wsi) : wsi_(wsi), out_buffer_(LWS_PRE, 0) {}
@@ -16,6 +16,9 @@
 #pragma once
 
 #include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -23,6 +26,9 @@ struct lws;
 
 namespace cuttlefish {
 
+class WebSocketEventLoop;
+class WebSocketServer;
+
 class WebSocketHandler {
  public:
   WebSocketHandler(struct lws* wsi);
@@ -36,14 +42,19 @@ class WebSocketHandler {
   virtual void OnConnected() = 0;
   virtual void OnClosed() = 0;
 
+  // These may be called from any thread, not just the one servicing this
+  // handler's connection.
   void EnqueueMessage(const uint8_t* data, size_t len, bool binary = false);
   void EnqueueMessage(const char* data, size_t len, bool binary = false) {
     EnqueueMessage(reinterpret_cast<const uint8_t*>(data), len, binary);
   }
   void Close();
+
   bool OnWritable();
 
  private:
+  friend WebSocketEventLoop;
+
   struct WsBuffer {
     WsBuffer(std::vector<uint8_t> data, bool binary)
         : data(std::move(data)), binary(binary) {}
@@ -52,8 +63,12 @@ class WebSocketHandler {
   };
 
   void WriteWsBuffer(WsBuffer& ws_buffer);
+  void RequestWritable();
 
   struct lws* wsi_;
+  // Set by the event loop before OnConnected() is called
+  WebSocketEventLoop* event_loop_ = nullptr;
+  std::mutex mutex_;
   bool close_ = false;
   std::deque<WsBuffer> buffer_queue_;
 };
@@ -64,8 +79,6 @@ class WebSocketHandlerFactory {
   virtual std::shared_ptr<WebSocketHandler> Build(struct lws* wsi) = 0;
 };
 
-class WebSocketServer;
-
 enum class HttpStatusCode : int {
   // From https://developer.mozilla.org/en-US/docs/Web/HTTP/Status
   Ok = 200,
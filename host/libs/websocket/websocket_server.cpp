@@ -16,7 +16,9 @@
 
 #include <host/libs/websocket/websocket_server.h>
 
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 #include <android-base/logging.h>
@@ -28,6 +30,10 @@
 namespace cuttlefish {
 namespace {
 
+// The loop serviced by the current thread, if any. The lws callbacks always
+// run on the thread of the loop the connection belongs to.
+thread_local WebSocketEventLoop* current_loop = nullptr;
+
 std::string GetPath(struct lws* wsi) {
   auto len = lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI);
   std::string path(len + 1, '\0');
@@ -91,6 +97,64 @@ bool WriteCommonHttpHeaders(int status, const char* mime_type,
 }
 
 }  // namespace
+
+bool WebSocketEventLoop::InLoopThread() const { return current_loop == this; }
+
+void WebSocketEventLoop::RequestWritable(struct lws* wsi,
+                                         WebSocketHandler* handler) {
+  {
+    std::lock_guard<std::mutex> lock(writable_requests_mutex_);
+    writable_requests_.emplace_back(wsi, handler);
+  }
+  // Wakes up the loop with LWS_CALLBACK_EVENT_WAIT_CANCELLED
+  lws_cancel_service(context_);
+}
+
+void WebSocketEventLoop::Run() {
+  current_loop = this;
+  int n = 0;
+  while (n >= 0) {
+    n = lws_service(context_, 0);
+  }
+  lws_context_destroy(context_);
+  current_loop = nullptr;
+}
+
+void WebSocketEventLoop::AddHandler(struct lws* wsi,
+                                    std::shared_ptr<WebSocketHandler> handler) {
+  handler->event_loop_ = this;
+  handlers_[wsi] = std::move(handler);
+}
+
+void WebSocketEventLoop::RemoveHandler(struct lws* wsi) {
+  handlers_.erase(wsi);
+}
+
+std::vector<struct lws*> WebSocketEventLoop::TakeWritableRequests() {
+  std::vector<std::pair<struct lws*, WebSocketHandler*>> requests;
+  {
+    std::lock_guard<std::mutex> lock(writable_requests_mutex_);
+    std::swap(requests, writable_requests_);
+  }
+  std::vector<struct lws*> writable;
+  for (const auto& [wsi, handler] : requests) {
+    // The connection may have been closed since the request was made, and its
+    // wsi reused for another one. The requesting handler is still alive while
+    // it makes the request, so no new handler can have its address.
+    auto it = handlers_.find(wsi);
+    if (it != handlers_.end() && it->second.get() == handler) {
+      writable.push_back(wsi);
+    }
+  }
+  return writable;
+}
+
+void WebSocketEventLoop::ServeWritableRequests() {
+  for (auto wsi : TakeWritableRequests()) {
+    lws_callback_on_writable(wsi);
+  }
+}
+
 WebSocketServer::WebSocketServer(const char* protocol_name,
                                  const std::string& assets_dir, int server_port)
     : WebSocketServer(protocol_name, "", assets_dir, server_port) {}
@@ -103,7 +167,7 @@ WebSocketServer::WebSocketServer(const char* protocol_name,
       certs_dir_(certs_dir),
       server_port_(server_port) {}
 
-void WebSocketServer::InitializeLwsObjects() {
+void WebSocketServer::InitializeLwsObjects(std::size_t event_loops) {
   std::string cert_file = certs_dir_ + "/server.crt";
   std::string key_file = certs_dir_ + "/server.key";
   std::string ca_file = certs_dir_ + "/CA.crt";
@@ -216,9 +280,18 @@ void WebSocketServer::InitializeLwsObjects() {
     }
   }
 
-  context_ = lws_create_context(&info);
-  if (!context_) {
-    LOG(FATAL) << "Failed to create websocket context";
+  if (event_loops > 1) {
+    // Every loop listens on the port, the kernel spreads the incoming
+    // connections among them.
+    info.options |= LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE;
+  }
+  for (std::size_t i = 0; i < event_loops; i++) {
+    auto event_loop = std::make_unique<WebSocketEventLoop>();
+    event_loop->context_ = lws_create_context(&info);
+    if (!event_loop->context_) {
+      LOG(FATAL) << "Failed to create websocket context";
+    }
+    event_loops_.push_back(std::move(event_loop));
   }
 }
 
@@ -234,22 +307,26 @@ void WebSocketServer::RegisterDynHandlerFactory(
   dyn_handler_factories_[path] = std::move(handler_factory);
 }
 
-void WebSocketServer::Serve() {
-  InitializeLwsObjects();
-  int n = 0;
-  while (n >= 0) {
-    n = lws_service(context_, 0);
+void WebSocketServer::Serve(std::size_t event_loops) {
+  InitializeLwsObjects(std::max<std::size_t>(event_loops, 1));
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < event_loops_.size(); i++) {
+    threads.emplace_back(&WebSocketEventLoop::Run, event_loops_[i].get());
+  }
+  event_loops_[0]->Run();
+  for (auto& thread : threads) {
+    thread.join();
   }
-  lws_context_destroy(context_);
 }
 
 int WebSocketServer::WebsocketCallback(struct lws* wsi,
                                        enum lws_callback_reasons reason,
                                        void* user, void* in, size_t len) {
   auto protocol = lws_get_protocol(wsi);
-  if (!protocol) {
+  if (!protocol || !current_loop) {
     // Some callback reasons are always handled by the first protocol, before a
-    // wsi struct is even created.
+    // wsi struct is even created. Others come while the contexts are created,
+    // before any loop runs.
     return lws_callback_http_dummy(wsi, reason, user, in, len);
   }
   return reinterpret_cast<WebSocketServer*>(protocol->user)
@@ -264,6 +341,9 @@ int WebSocketServer::DynHttpCallback(struct lws* wsi,
     LOG(ERROR) << "No protocol associated with connection";
     return 1;
   }
+  if (!current_loop) {
+    return lws_callback_http_dummy(wsi, reason, user, in, len);
+  }
   return reinterpret_cast<WebSocketServer*>(protocol->user)
       ->DynServerCallback(wsi, reason, user, in, len);
 }
@@ -271,6 +351,7 @@ int WebSocketServer::DynHttpCallback(struct lws* wsi,
 int WebSocketServer::DynServerCallback(struct lws* wsi,
                                        enum lws_callback_reasons reason,
                                        void* user, void* in, size_t len) {
+  auto& dyn_handlers = current_loop->dyn_handlers_;
   switch (reason) {
     case LWS_CALLBACK_HTTP: {
       char* path_raw;
@@ -288,13 +369,13 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
         }
         return lws_http_transaction_completed(wsi);
       }
-      dyn_handlers_[wsi] = std::move(handler);
+      dyn_handlers[wsi] = std::move(handler);
       switch (method) {
         case LWSHUMETH_GET: {
-          auto status = dyn_handlers_[wsi]->DoGet();
+          auto status = dyn_handlers[wsi]->DoGet();
           if (!WriteCommonHttpHeaders(static_cast<int>(status),
                                       "application/json",
-                                      dyn_handlers_[wsi]->content_len(), wsi)) {
+                                      dyn_handlers[wsi]->content_len(), wsi)) {
             return 1;
           }
           // Write the response later, when the server is ready
@@ -320,7 +401,7 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_HTTP_BODY: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Received body for unknown wsi";
         return 1;
@@ -329,27 +410,27 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_HTTP_BODY_COMPLETION: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Unexpected body completion event from unknown wsi";
         return 1;
       }
       auto status = handler->DoPost();
       if (!WriteCommonHttpHeaders(static_cast<int>(status), "application/json",
-                                  dyn_handlers_[wsi]->content_len(), wsi)) {
+                                  dyn_handlers[wsi]->content_len(), wsi)) {
         return 1;
       }
       lws_callback_on_writable(wsi);
       break;
     }
     case LWS_CALLBACK_HTTP_WRITEABLE: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Unknown wsi became writable";
         return 1;
       }
       auto ret = handler->OnWritable();
-      dyn_handlers_.erase(wsi);
+      dyn_handlers.erase(wsi);
       // Make sure the connection (in HTTP 1) or stream (in HTTP 2) is closed
       // after the response is written
       return ret;
@@ -365,6 +446,7 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
 int WebSocketServer::ServerCallback(struct lws* wsi,
                                     enum lws_callback_reasons reason,
                                     void* user, void* in, size_t len) {
+  auto& handlers = current_loop->handlers_;
   switch (reason) {
     case LWS_CALLBACK_ESTABLISHED: {
       auto path = GetPath(wsi);
@@ -374,20 +456,20 @@ int WebSocketServer::ServerCallback(struct lws* wsi,
         lws_close_reason(wsi, LWS_CLOSE_STATUS_NOSTATUS, (uint8_t*)"404", 3);
         return -1;
       }
-      handlers_[wsi] = handler;
+      current_loop->AddHandler(wsi, handler);
       handler->OnConnected();
       break;
     }
     case LWS_CALLBACK_CLOSED: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
         handler->OnClosed();
-        handlers_.erase(wsi);
+        current_loop->RemoveHandler(wsi);
       }
       break;
     }
     case LWS_CALLBACK_SERVER_WRITEABLE: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
         auto should_close = handler->OnWritable();
         if (should_close) {
@@ -401,7 +483,7 @@ int WebSocketServer::ServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_RECEIVE: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
         bool is_final = (lws_remaining_packet_payload(wsi) == 0) &&
                         lws_is_final_fragment(wsi);
@@ -412,6 +494,9 @@ int WebSocketServer::ServerCallback(struct lws* wsi,
       }
       break;
     }
+    case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+      current_loop->ServeWritableRequests();
+      break;
     default:
       return lws_callback_http_dummy(wsi, reason, user, in, len);
   }
@@ -16,8 +16,12 @@
 
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -26,6 +30,40 @@
 #include <host/libs/websocket/websocket_handler.h>
 
 namespace cuttlefish {
+
+// An lws context and the thread servicing it. The connections a loop accepts
+// are only handled on its thread, other threads ask it to write to them.
+class WebSocketEventLoop {
+ public:
+  // Whether the calling thread is the one servicing this loop.
+  bool InLoopThread() const;
+  // Has the loop's thread request a writable callback for wsi, unless it's no
+  // longer handled by handler by then. Safe to call from any thread.
+  void RequestWritable(struct lws* wsi, WebSocketHandler* handler);
+
+ private:
+  friend class WebSocketServer;
+  friend class WebSocketEventLoopTest;
+
+  void Run();
+  // Called on the loop's thread when the connection opens and closes
+  void AddHandler(struct lws* wsi, std::shared_ptr<WebSocketHandler> handler);
+  void RemoveHandler(struct lws* wsi);
+  // The connections with pending requests that are still handled by the
+  // handler that made them
+  std::vector<struct lws*> TakeWritableRequests();
+  void ServeWritableRequests();
+
+  struct lws_context* context_ = nullptr;
+  std::unordered_map<struct lws*, std::shared_ptr<WebSocketHandler>> handlers_ =
+      {};
+  std::unordered_map<struct lws*, std::unique_ptr<DynHandler>> dyn_handlers_ =
+      {};
+  std::mutex writable_requests_mutex_;
+  std::vector<std::pair<struct lws*, WebSocketHandler*>> writable_requests_ =
+      {};
+};
+
 class WebSocketServer {
  public:
   // Uses HTTP and WS
@@ -47,7 +85,9 @@ class WebSocketServer {
   void RegisterDynHandlerFactory(const std::string& path,
                                  DynHandlerFactory handler_factory);
 
-  void Serve();
+  // Services connections on `event_loops` threads. Each loop listens on the
+  // server port and owns the connections it accepts.
+  void Serve(std::size_t event_loops = 1);
 
  private:
   static int WebsocketCallback(struct lws* wsi,
@@ -67,21 +107,17 @@ class WebSocketServer {
   std::unique_ptr<DynHandler> InstantiateDynHandler(
       const std::string& uri_path, struct lws* wsi);
 
-  void InitializeLwsObjects();
+  void InitializeLwsObjects(std::size_t event_loops);
 
-  std::unordered_map<struct lws*, std::shared_ptr<WebSocketHandler>> handlers_ =
-      {};
   std::unordered_map<std::string, std::unique_ptr<WebSocketHandlerFactory>>
       handler_factories_ = {};
-  std::unordered_map<struct lws*, std::unique_ptr<DynHandler>> dyn_handlers_ =
-      {};
   std::unordered_map<std::string, DynHandlerFactory> dyn_handler_factories_ =
       {};
   std::string protocol_name_;
   std::string assets_dir_;
   std::string certs_dir_;
   int server_port_;
-  struct lws_context* context_;
+  std::vector<std::unique_ptr<WebSocketEventLoop>> event_loops_ = {};
   struct lws_http_mount static_mount_;
   std::vector<struct lws_http_mount> dyn_mounts_ = {};
   struct lws_protocol_vhost_options headers_;